@@ -118,6 +118,47 @@ public:
 	GetOptimizeActionServiceHandlers(
 		) = 0;
 
+	//
+	// Return true if scripts should start in the VM and only be JIT'd once
+	// they have proven to be hot (tiered compilation).
+	//
+
+	virtual
+	bool
+	GetTieredCompilation(
+		) = 0;
+
+	//
+	// Return the count of invocations after which a tiered script is promoted
+	// to the JIT engine, else zero if call counts do not trigger promotion.
+	//
+
+	virtual
+	ULONG
+	GetTierUpCallCount(
+		) = 0;
+
+	//
+	// Return the count of loop back-edges taken in the VM after which a tiered
+	// script is promoted to the JIT engine, else zero if back-edge counts do
+	// not trigger promotion.
+	//
+
+	virtual
+	ULONG
+	GetTierUpBackEdgeCount(
+		) = 0;
+
+	//
+	// Return true if code should be generated on a background thread, with
+	// scripts running in the VM until their code is ready.
+	//
+
+	virtual
+	bool
+	GetBackgroundCompilation(
+		) = 0;
+
 };
 
 #endif
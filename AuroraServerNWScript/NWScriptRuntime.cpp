@@ -126,11 +126,14 @@ Environment:
 	// Save the rest of the intermediate state onto the stack as well; we'll
 	// pull it off when the script situation is run.
 	//
-	// N.B.  The code size does not strictly need to be saved (nor the
-	//       SAVED_STATE_ID "header").  These fields are retained for
-	//       debugging purposes, i.e. to catch issues where a script
+	// N.B.  The code size does not strictly need to be saved.  It is retained
+	//       for debugging purposes, i.e. to catch issues where a script
 	//       situation is restored using a different script's code.
 	//
+	//       The SAVED_STATE_ID "header" records which engine saved the state,
+	//       as a script may be promoted from the VM to the JIT engine while
+	//       script situations that the VM saved are still outstanding.
+	//
 
 	m_Bridge->StackPushInt( (int) ResumeMethodId );
 	m_Bridge->StackPushInt( (int) ResumeMethodPC );
@@ -139,7 +142,8 @@ Environment:
 	m_Bridge->StackPushObjectId( ObjectSelf );
 	m_Bridge->StackPushInt( (int) m_CurrentScriptCodeSize );
 	m_Bridge->StackPushString( ServerVM->GetScriptName( ) );
-	m_Bridge->StackPushInt( (int) SAVED_STATE_ID );
+	m_Bridge->StackPushInt(
+		(m_CurrentJITProgram.get( ) != NULL) ? (int) SAVED_STATE_ID : (int) SAVED_STATE_ID_VM );
 
 	NewSP = ServerVM->GetCurrentSP( );
 
@@ -191,9 +195,19 @@ Environment:
 	size_t                             PrevScriptCodeSize;
 	bool                               TraceCall;
 	ULONG                              Time;
+	ULONG64                            BackEdges;
+	ULONG64                            PrevNestedBackEdges;
 
 	TraceCall = (m_Bridge->IsDebugLevel( NWScriptVM::EDL_Calls ) );
 
+	//
+	// Install any programs that the background compilation thread has
+	// finished generating, so that they are used from this invocation on.
+	//
+
+	if (m_PendingCompiles != 0)
+		PublishCompiledScripts( );
+
 	//
 	// If we were executing a script situation, instantiate a script situation
 	// state from the contents that were placed on the VM stack during sript
@@ -220,8 +234,15 @@ Environment:
 
 		ScriptData->ScriptSituationCount += 1;
 
+		//
+		// A script situation runs in the engine that saved it, which may not
+		// be the script's current tier if the script was promoted since.
+		//
+
 		PrevProgram             = m_CurrentJITProgram;
-		m_CurrentJITProgram     = ScriptData->JITProgram;
+		m_CurrentJITProgram     = (ResumeData.ScriptSituationJIT.get( ) != NULL)
+		                            ? ScriptData->JITProgram
+		                            : NWScriptJITLib::Program::Ptr( );
 		PrevScriptName          = m_CurrentScriptName;
 		m_CurrentScriptName     = ResRef32FromStr( ScriptName );
 		PrevScriptCodeSize      = m_CurrentScriptCodeSize;
@@ -230,6 +251,10 @@ Environment:
 
 		ScriptData->RecursionLevel += 1;
 
+		PrevNestedBackEdges = m_NestedBackEdges;
+		m_NestedBackEdges   = 0;
+		BackEdges           = m_VM->GetBackwardBranchCount( );
+
 		try
 		{
 			if (TraceCall)
@@ -243,7 +268,7 @@ Environment:
 			Time = ReadPerformanceCounterMilliseconds( );
 
 #if NWSCRIPTVM_FALLBACK
-			if (ScriptData->JITProgram.get( ) != NULL)
+			if (ResumeData.ScriptSituationJIT.get( ) != NULL)
 #endif
 			{
 				ScriptData->JITProgram->ExecuteScriptSituation(
@@ -277,6 +302,16 @@ Environment:
 			Time = ReadPerformanceCounterMilliseconds( ) - Time;
 			ScriptData->Runtime += Time;
 
+			//
+			// Attribute the VM back-edges taken to the script, excluding those
+			// taken by nested script invocations (which were attributed to the
+			// nested scripts).
+			//
+
+			BackEdges                  = m_VM->GetBackwardBranchCount( ) - BackEdges;
+			ScriptData->BackEdgeCount += BackEdges - m_NestedBackEdges;
+			m_NestedBackEdges          = PrevNestedBackEdges + BackEdges;
+
 			if (TraceCall)
 			{
 				m_TextOut->WriteText(
@@ -291,6 +326,8 @@ Environment:
 			m_CurrentScriptName     = PrevScriptName;
 			m_CurrentJITProgram     = PrevProgram;
 			m_RecursionLevel        = m_RecursionLevel - 1;
+			m_NestedBackEdges       = PrevNestedBackEdges +
+			                          (m_VM->GetBackwardBranchCount( ) - BackEdges);
 
 			ScriptData->RecursionLevel -= 1;
 
@@ -324,6 +361,30 @@ Environment:
 			return;
 		}
 
+		//
+		// If the script is being profiled in the VM and has become hot, then
+		// promote it to the JIT engine.  The start of a fresh invocation is a
+		// safe point for the tier change, provided that the script is not
+		// already active further up the call stack.
+		//
+
+		if ((ScriptData->Tier == SCRIPT_TIER_VM_PROFILING) &&
+		    (ScriptData->RecursionLevel == 0))
+		{
+			const char * Reason = CheckTierUpThresholds( *ScriptData );
+
+			if (Reason != NULL)
+			{
+				PromoteScript(
+					*ScriptData,
+					ScriptName,
+					InstructionStream,
+					CodeSize,
+					Reason,
+					true);
+			}
+		}
+
 		ScriptData->CallCount += 1;
 
 		PrevProgram             = m_CurrentJITProgram;
@@ -336,6 +397,10 @@ Environment:
 
 		ScriptData->RecursionLevel += 1;
 
+		PrevNestedBackEdges = m_NestedBackEdges;
+		m_NestedBackEdges   = 0;
+		BackEdges           = m_VM->GetBackwardBranchCount( );
+
 		try
 		{
 			ConvertScriptParameters( Params, ServerVM );
@@ -391,6 +456,16 @@ Environment:
 			Time = ReadPerformanceCounterMilliseconds( ) - Time;
 			ScriptData->Runtime += Time;
 
+			//
+			// Attribute the VM back-edges taken to the script, excluding those
+			// taken by nested script invocations (which were attributed to the
+			// nested scripts).
+			//
+
+			BackEdges                  = m_VM->GetBackwardBranchCount( ) - BackEdges;
+			ScriptData->BackEdgeCount += BackEdges - m_NestedBackEdges;
+			m_NestedBackEdges          = PrevNestedBackEdges + BackEdges;
+
 			if (TraceCall)
 			{
 				m_TextOut->WriteText(
@@ -405,15 +480,23 @@ Environment:
 			m_CurrentScriptName     = PrevScriptName;
 			m_CurrentJITProgram     = PrevProgram;
 			m_RecursionLevel        = m_RecursionLevel - 1;
+			m_NestedBackEdges       = PrevNestedBackEdges +
+			                          (m_VM->GetBackwardBranchCount( ) - BackEdges);
 
 			ScriptData->RecursionLevel -= 1;
 
 			//
-			// If we ran the script with the VM, we'll only be notified of a
-			// problem with the script on the first run.  Track this now.
+			// If the script is to run only in the VM (by policy, or because
+			// code generation failed), we'll only be notified of a problem
+			// with the script on the first run.  Track this now.
+			//
+			// N.B.  A script that is in the VM only until it is promoted to
+			//       the JIT engine (or until its background compilation is
+			//       done) is not marked as broken, as code generation will
+			//       still vet it.
 			//
 
-			if ((ScriptData->FirstRun) && (ScriptData->JITProgram.get( ) == NULL))
+			if ((ScriptData->FirstRun) && (ScriptData->Tier == SCRIPT_TIER_VM))
 				ScriptData->BrokenScript = true;
 
 			throw;
@@ -469,6 +552,7 @@ Environment:
 		FILETIME KernelTime;
 		FILETIME UserTime;
 		ULONG    TotalMemoryCost;
+		ULONG    TierCounts[ LAST_SCRIPT_TIER ];
 
 		m_TextOut->WriteText(
 			"NWScriptRuntime::DumpStatistics: %lu scripts cached:\n",
@@ -476,6 +560,8 @@ Environment:
 
 		TotalMemoryCost = 0;
 
+		ZeroMemory( TierCounts, sizeof( TierCounts ) );
+
 		if (!GetThreadTimes(
 			GetCurrentThread( ),
 			&CreationTime,
@@ -494,15 +580,19 @@ Environment:
 		     ++it)
 		{
 			m_TextOut->WriteText(
-				"%s - %s (%lu calls, %lu script situations, %lu bytes VA space usage, %lums runtime).\n",
+				"%s - %s (%lu calls, %lu script situations, %I64lu VM loop back-edges, %lu bytes VA space usage, %lums runtime; %s at call %lu).\n",
 				StrFromResRef( it->first ).c_str( ),
-				it->second.JITProgram.get( ) != NULL ? "(JIT)" : "(VM)",
+				GetTierName( it->second.Tier ),
 				(unsigned long) it->second.CallCount,
 				(unsigned long) it->second.ScriptSituationCount,
+				it->second.BackEdgeCount,
 				(unsigned long) it->second.MemoryCost,
-				it->second.Runtime);
+				it->second.Runtime,
+				it->second.TierReason,
+				(unsigned long) it->second.TierChangeCall);
 
-			TotalMemoryCost += it->second.MemoryCost;
+			TotalMemoryCost                += it->second.MemoryCost;
+			TierCounts[ it->second.Tier ]  += 1;
 		}
 
 		ThreadTimeMs  = ((ULONG64) UserTime.dwLowDateTime | ((ULONG64) UserTime.dwHighDateTime << 32));
@@ -513,11 +603,16 @@ Environment:
 			"Total time spent running scripts: %I64lums.\n"
 			"Total time spent in thread 0: %I64lums.\n"
 			"Scripts consumed %g%% of thread 0 time.\n"
-			"Scripts compiled to native code consumed approximately %lu bytes of VA space.\n",
+			"Scripts compiled to native code consumed approximately %lu bytes of VA space.\n"
+			"Scripts by tier: %lu JIT, %lu VM, %lu profiling in the VM, %lu compiling in the background.\n",
 			m_TotalScriptRuntime,
 			ThreadTimeMs,
 			((double) m_TotalScriptRuntime / (double) ThreadTimeMs) * 100.0,
-			TotalMemoryCost);
+			TotalMemoryCost,
+			TierCounts[ SCRIPT_TIER_JIT ],
+			TierCounts[ SCRIPT_TIER_VM ],
+			TierCounts[ SCRIPT_TIER_VM_PROFILING ],
+			TierCounts[ SCRIPT_TIER_VM_COMPILING ]);
 	}
 	catch (std::exception)
 	{
@@ -535,6 +630,10 @@ Routine Description:
 	for any scripts that were JIT'd.  Note that scripts may still have pending
 	script situations outstanding.
 
+	Queued background compilations are cancelled.  If a compilation is in
+	progress, the routine waits for it to finish, and its result is discarded
+	along with all other completed compilations that were not yet published.
+
 Arguments:
 
 	None.
@@ -549,6 +648,44 @@ Environment:
 
 --*/
 {
+	CompileJobList Stale;
+
+	m_CompileLock.Lock( );
+
+	m_CompileQueue.clear( );
+
+	while (m_CompileInFlight)
+	{
+		//
+		// Wait for the compilation thread to hand back its job.  As only the
+		// main thread waits on the event, resetting it under the lock cannot
+		// cause a hand back to be missed.
+		//
+
+		ResetEvent( m_CompileDoneEvent );
+
+		m_CompileLock.Unlock( );
+
+		WaitForSingleObject( m_CompileDoneEvent, INFINITE );
+
+		m_CompileLock.Lock( );
+	}
+
+	Stale.splice( Stale.end( ), m_CompletedJobs );
+
+	m_CompileLock.Unlock( );
+
+	//
+	// The stale programs are released outside of the lock.  Any result that
+	// slips through regardless is rejected by the generation check in
+	// PublishCompiledScripts.
+	//
+
+	Stale.clear( );
+
+	m_CacheGeneration += 1;
+	m_PendingCompiles  = 0;
+
 	m_ScriptCache.clear( );
 }
 
@@ -745,15 +882,22 @@ Environment:
 	ULONG                        SaveLocalCount;
 	NWN::OBJECTID                ObjectSelf;
 	size_t                       SavedCodeSize;
+	int                          SavedStateId;
 
 	UNREFERENCED_PARAMETER( ServerVM );
 
 	//
-	// Check that the saved state is valid.
+	// Check that the saved state is valid.  The signature identifies the
+	// engine that saved the state.
 	//
 
-	if (m_Bridge->StackPopInt( ) != (int) SAVED_STATE_ID)
+	SavedStateId = m_Bridge->StackPopInt( );
+
+	if ((SavedStateId != (int) SAVED_STATE_ID) &&
+	    (SavedStateId != (int) SAVED_STATE_ID_VM))
+	{
 		throw std::runtime_error( "Saved state signature does not match." );
+	}
 
 	ScriptName = m_Bridge->StackPopString( );
 
@@ -803,7 +947,34 @@ Environment:
 	PC = ResumeMethodPC;
 
 #if NWSCRIPTVM_FALLBACK
-	if ((*ScriptData)->JITProgram.get( ) != NULL)
+	//
+	// A script situation saved by the JIT engine can only be resumed by the
+	// JIT engine.  If the script is still being profiled in the VM (e.g. the
+	// script cache was cleared since the state was saved), or its code is
+	// still being generated in the background, promote it synchronously now.
+	//
+
+	if ((SavedStateId == (int) SAVED_STATE_ID) &&
+	    ((*ScriptData)->JITProgram.get( ) == NULL))
+	{
+		if ((((*ScriptData)->Tier == SCRIPT_TIER_VM_PROFILING) ||
+		     ((*ScriptData)->Tier == SCRIPT_TIER_VM_COMPILING)) &&
+		    ((*ScriptData)->RecursionLevel == 0))
+		{
+			PromoteScript(
+				**ScriptData,
+				ResRef32FromStr( ScriptName ),
+				InstructionStream,
+				CodeSize,
+				"promoted to resume a JIT script situation",
+				false);
+		}
+
+		if ((*ScriptData)->JITProgram.get( ) == NULL)
+			throw std::runtime_error( "Script situation was saved by the JIT engine, but the script is not JIT'd." );
+	}
+
+	if (SavedStateId == (int) SAVED_STATE_ID)
 #endif
 	{
 		ResumeData->ScriptSituationJIT = (*ScriptData)->JITProgram->PopSavedStatePtr(
@@ -864,6 +1035,14 @@ Routine Description:
 	If the script already existed in the cache, the cached entry is returned.
 	Otherwise, the script is compiled to native code on the fly and returned.
 
+	Under tiered compilation, a newly loaded script is not compiled.  Instead,
+	it is placed in the profiling tier and runs in the VM until it is promoted
+	by PromoteScript.
+
+	Under background compilation, a newly loaded script is queued to the
+	compilation thread and runs in the VM until its generated code has been
+	published by PublishCompiledScripts.
+
 Arguments:
 
 	ScriptName - Supplies the resource name of the script to load.
@@ -890,9 +1069,6 @@ Environment:
 {
 	NWN::ResRef32            ResRef;
 	ScriptCacheMap::iterator it;
-	NWSCRIPT_JIT_PARAMS      CodeGenParams;
-	ULONG                    StartTick;
-	ULONGLONG                StartVASpace;
 
 	//
 	// Convert the name to a canonical resref and search for it in our cache.
@@ -931,6 +1107,10 @@ Environment:
 	Data.MemoryCost           = 0;
 	Data.Runtime              = 0;
 	Data.RecursionLevel       = 0;
+	Data.Tier                 = SCRIPT_TIER_VM;
+	Data.TierReason           = "selected by policy";
+	Data.TierChangeCall       = 0;
+	Data.BackEdgeCount        = 0;
 
 	//
 	// Construct a NWScriptReader for the in-memory instruction stream and hand
@@ -942,9 +1122,6 @@ Environment:
 	//       instruction buffer on each execution.
 	//
 
-	StartVASpace = GetAvailableVASpace( );
-	StartTick    = ReadPerformanceCounterMilliseconds( );
-
 	Script = new NWScriptReader(
 		ScriptNameStr.c_str( ),
 		InstructionStream,
@@ -973,83 +1150,90 @@ Environment:
 
 	LoadSymbols( *Script, ScriptNameStr );
 
-	ZeroMemory( &CodeGenParams, sizeof( CodeGenParams ) );
-
-	CodeGenParams.Size             = sizeof( CodeGenParams );
-	CodeGenParams.CodeGenFlags     = NWCGF_ENABLE_SAVESTATE_TO_VMSTACK |
-	                                 NWCGF_ASSUME_LOADER_PATCHED;
-	CodeGenParams.CodeGenOutputDir = m_JITPolicy->GetCodeGenOutputDir( );
+	//
+	// The reader is retained even if the script is JIT'd, so that script
+	// situations saved by the VM before a promotion can still be resumed.
+	//
 
-	if (CodeGenParams.CodeGenOutputDir != NULL)
-		CodeGenParams.CodeGenFlags |= NWCGF_SAVE_OUTPUT;
+	Data.Reader = Script;
 
-	if (m_JITPolicy->GetOptimizeActionServiceHandlers( ))
-		CodeGenParams.CodeGenFlags |= NWCGF_NWN_COMPATIBLE_ACTIONS;
+#if NWSCRIPTVM_FALLBACK
+	//
+	// Under tiered compilation, every script starts out in the VM, and is
+	// only compiled once it has proven to be hot.  This saves the cost of code
+	// generation (and the VA space) for the many scripts that only run a
+	// handful of times.
+	//
 
-	try
+	if ((m_JITEngine != NULL) && (m_JITPolicy->GetTieredCompilation( )))
 	{
-#if NWSCRIPTVM_FALLBACK
-		if (ShouldJITScript( CodeSize ))
-#endif
+		Data.Tier       = SCRIPT_TIER_VM_PROFILING;
+		Data.TierReason = "awaiting promotion";
+
+		it = m_ScriptCache.insert( ScriptCacheMap::value_type( ResRef, Data ) ).first;
+
+		*ScriptData = &it->second;
+
+		if (m_Bridge->IsDebugLevel( NWScriptVM::EDL_Calls ))
 		{
-			ULONG AnalysisFlags = 0;
+			m_Bridge->GetTextOut( )->WriteText(
+				"NWScriptRuntime::LoadScript: Profiling script '%s' (%lu bytes compiled script) in the NWScript VM.\n",
+				ScriptNameStr.c_str( ),
+				(unsigned long) CodeSize);
+		}
 
-			if (!m_JITPolicy->GetEnableIROptimizations( ))
-				AnalysisFlags |= NWScriptAnalyzer::AF_NO_OPTIMIZATIONS;
+		return true;
+	}
 
-			if (m_JITManagedSupport.get( ) != NULL)
-			{
-				CodeGenParams.CodeGenFlags   |= NWCGF_MANAGED_SCRIPT_SUPPORT;
-				CodeGenParams.ManagedSupport  = m_JITManagedSupport->GetManagedSupport( );
-			}
+	if (!ShouldJITScript( CodeSize ))
+	{
+		Data.JITProgram = NULL;
 
-			if (m_JITPolicy->GetDisableExecutionGuards( ))
-				CodeGenParams.CodeGenFlags |= NWCGF_DISABLE_EXECUTION_GUARDS;
+		it = m_ScriptCache.insert( ScriptCacheMap::value_type( ResRef, Data ) ).first;
 
-			CodeGenParams.MaxLoopIterations = m_JITPolicy->GetMaxLoopIterations( );
-			CodeGenParams.MaxCallDepth      = m_JITPolicy->GetMaxCallDepth( );
+		*ScriptData = &it->second;
 
-			Data.JITProgram = m_JITEngine->GenerateCodePtr(
-				Script.get( ),
-				NWActions_NWN2,
-				MAX_ACTION_ID_NWN2,
-				AnalysisFlags,
-				m_TextOut,
-				(ULONG) m_Bridge->GetScriptDebug( ),
-				m_Bridge,
-				NWN::INVALIDOBJID,
-				&CodeGenParams);
-		}
-#if NWSCRIPTVM_FALLBACK
-		else
-		{
-			Data.Reader     = Script;
-			Data.JITProgram = NULL;
+		m_Bridge->GetTextOut( )->WriteText(
+			"Using NWScript VM for script '%s' (%lu bytes compiled script).\n",
+			ScriptNameStr.c_str( ),
+			(unsigned long) CodeSize);
+
+		return true;
+	}
 
-			it = m_ScriptCache.insert( ScriptCacheMap::value_type( ResRef, Data ) ).first;
+	//
+	// Under background compilation, the script runs in the VM while its code
+	// is generated on the compilation thread, rather than stalling the server
+	// for the duration of code generation.  If the compilation thread is not
+	// available, code is generated synchronously as usual.
+	//
+
+	if ((m_JITPolicy->GetBackgroundCompilation( )) &&
+	    (QueueCompile( Data, ResRef, InstructionStream, CodeSize )))
+	{
+		Data.Tier       = SCRIPT_TIER_VM_COMPILING;
+		Data.TierReason = "selected by policy";
 
-			*ScriptData = &it->second;
+		it = m_ScriptCache.insert( ScriptCacheMap::value_type( ResRef, Data ) ).first;
+
+		*ScriptData = &it->second;
 
+		if (m_Bridge->IsDebugLevel( NWScriptVM::EDL_Calls ))
+		{
 			m_Bridge->GetTextOut( )->WriteText(
-				"Using NWScript VM for script '%s' (%lu bytes compiled script).\n",
+				"NWScriptRuntime::LoadScript: Queued script '%s' (%lu bytes compiled script) for background compilation; using NWScript VM until it is ready.\n",
 				ScriptNameStr.c_str( ),
 				(unsigned long) CodeSize);
-
-			return true;
 		}
-#endif
+
+		return true;
 	}
-	catch (std::exception &e)
-	{
-		m_Bridge->GetTextOut( )->WriteText(
-			"NWScriptRuntime::LoadScript: Failed to generate code for script '%s' (%lu bytes compiled script): exception '%s'.\n",
-			ScriptNameStr.c_str( ),
-			(unsigned long) CodeSize,
-			e.what( ));
+#endif
 
+	if (!GenerateCodeForScript( Data, ScriptNameStr, CodeSize ))
+	{
 #if NWSCRIPTVM_FALLBACK
-		Data.Reader     = Script;
-		Data.JITProgram = NULL;
+		Data.TierReason = "code generation failed";
 
 		it = m_ScriptCache.insert( ScriptCacheMap::value_type( ResRef, Data ) ).first;
 
@@ -1057,9 +1241,9 @@ Environment:
 
 		return true;
 #else
-		ScriptData.BrokenScript = true;
-		Data.Reader             = NULL;
-		Data.JITProgram         = NULL;
+		Data.BrokenScript = true;
+		Data.Reader       = NULL;
+		Data.JITProgram   = NULL;
 
 		it = m_ScriptCache.insert( ScriptCacheMap::value_type( ResRef, Data ) ).first;
 
@@ -1067,6 +1251,91 @@ Environment:
 #endif
 	}
 
+	Data.Tier       = SCRIPT_TIER_JIT;
+	Data.TierReason = "selected by policy";
+
+	//
+	// Cache the generated code for future use and return the newly generated
+	// script program.
+	//
+
+	it = m_ScriptCache.insert( ScriptCacheMap::value_type( ResRef, Data ) ).first;
+
+	*ScriptData = &it->second;
+
+	return true;
+}
+
+bool
+NWScriptRuntime::GenerateCodeForScript(
+	__inout ScriptCacheData & Data,
+	__in const std::string & ScriptName,
+	__in size_t CodeSize
+	)
+/*++
+
+Routine Description:
+
+	This routine generates native code for a script, storing the generated
+	program in the script's cache data.
+
+Arguments:
+
+	Data - Supplies the script cache data of the script.  The reader of the
+	       script must refer to a valid instruction buffer.  On success, the
+	       generated program and its memory cost are filled in.
+
+	ScriptName - Supplies the name of the script, for diagnostics.
+
+	CodeSize - Supplies the length, in bytes, of the instruction stream.
+
+Return Value:
+
+	The routine returns true if code was generated, else false if code
+	generation failed.  Failures are logged.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	NWSCRIPT_JIT_PARAMS CodeGenParams;
+	ULONG               AnalysisFlags;
+	ULONG               StartTick;
+	ULONGLONG           StartVASpace;
+
+	StartVASpace = GetAvailableVASpace( );
+	StartTick    = ReadPerformanceCounterMilliseconds( );
+
+	try
+	{
+		BuildCodeGenParams( CodeGenParams, AnalysisFlags );
+
+		Data.JITProgram = m_JITEngine->GenerateCodePtr(
+			Data.Reader.get( ),
+			NWActions_NWN2,
+			MAX_ACTION_ID_NWN2,
+			AnalysisFlags,
+			m_TextOut,
+			(ULONG) m_Bridge->GetScriptDebug( ),
+			m_Bridge,
+			NWN::INVALIDOBJID,
+			&CodeGenParams);
+	}
+	catch (std::exception &e)
+	{
+		m_Bridge->GetTextOut( )->WriteText(
+			"NWScriptRuntime::LoadScript: Failed to generate code for script '%s' (%lu bytes compiled script): exception '%s'.\n",
+			ScriptName.c_str( ),
+			(unsigned long) CodeSize,
+			e.what( ));
+
+		Data.JITProgram = NULL;
+
+		return false;
+	}
+
 	Data.MemoryCost = (size_t) (StartVASpace - GetAvailableVASpace( ));
 
 	if ((LONG_PTR) Data.MemoryCost < 0)
@@ -1074,21 +1343,806 @@ Environment:
 
 	m_Bridge->GetTextOut( )->WriteText(
 		"NWScriptRuntime::LoadScript: Generated code for script '%s' (%lu bytes compiled script) in %lums, approximately %I64lu bytes additional VA space used.\n",
-		ScriptNameStr.c_str( ),
+		ScriptName.c_str( ),
 		(unsigned long) CodeSize,
 		ReadPerformanceCounterMilliseconds( ) - StartTick,
 		(ULONGLONG) Data.MemoryCost);
 
-	//
-	// Cache the generated code for future use and return the newly generated
-	// script program.
-	//
+	return true;
+}
 
-	it = m_ScriptCache.insert( ScriptCacheMap::value_type( ResRef, Data ) ).first;
+void
+NWScriptRuntime::BuildCodeGenParams(
+	__out NWSCRIPT_JIT_PARAMS & CodeGenParams,
+	__out ULONG & AnalysisFlags
+	)
+/*++
 
-	*ScriptData = &it->second;
+Routine Description:
 
-	return true;
+	This routine builds the code generation parameters and analysis flags for
+	a script, as selected by the JIT policy.
+
+	Other than the output directory string, which is owned by the JIT policy,
+	the parameters only refer to data that lives as long as the runtime.
+
+Arguments:
+
+	CodeGenParams - Receives the code generation parameters.
+
+	AnalysisFlags - Receives the script analyzer flags.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode, main thread.
+
+--*/
+{
+	ZeroMemory( &CodeGenParams, sizeof( CodeGenParams ) );
+
+	CodeGenParams.Size             = sizeof( CodeGenParams );
+	CodeGenParams.CodeGenFlags     = NWCGF_ENABLE_SAVESTATE_TO_VMSTACK |
+	                                 NWCGF_ASSUME_LOADER_PATCHED;
+	CodeGenParams.CodeGenOutputDir = m_JITPolicy->GetCodeGenOutputDir( );
+
+	if (CodeGenParams.CodeGenOutputDir != NULL)
+		CodeGenParams.CodeGenFlags |= NWCGF_SAVE_OUTPUT;
+
+	if (m_JITPolicy->GetOptimizeActionServiceHandlers( ))
+		CodeGenParams.CodeGenFlags |= NWCGF_NWN_COMPATIBLE_ACTIONS;
+
+	AnalysisFlags = 0;
+
+	if (!m_JITPolicy->GetEnableIROptimizations( ))
+		AnalysisFlags |= NWScriptAnalyzer::AF_NO_OPTIMIZATIONS;
+
+	if (m_JITManagedSupport.get( ) != NULL)
+	{
+		CodeGenParams.CodeGenFlags   |= NWCGF_MANAGED_SCRIPT_SUPPORT;
+		CodeGenParams.ManagedSupport  = m_JITManagedSupport->GetManagedSupport( );
+	}
+
+	if (m_JITPolicy->GetDisableExecutionGuards( ))
+		CodeGenParams.CodeGenFlags |= NWCGF_DISABLE_EXECUTION_GUARDS;
+
+	CodeGenParams.MaxLoopIterations = m_JITPolicy->GetMaxLoopIterations( );
+	CodeGenParams.MaxCallDepth      = m_JITPolicy->GetMaxCallDepth( );
+}
+
+const char *
+NWScriptRuntime::CheckTierUpThresholds(
+	__in const ScriptCacheData & Data
+	)
+/*++
+
+Routine Description:
+
+	This routine checks whether a script in the profiling tier has crossed a
+	promotion threshold.
+
+	Both fresh invocations and script situations count as invocations, as a
+	script that is mostly run via DelayCommand is just as hot as one that is
+	run directly.
+
+Arguments:
+
+	Data - Supplies the script cache data of the script.
+
+Return Value:
+
+	The routine returns a description of the threshold that was crossed, else
+	NULL if the script has not crossed any promotion threshold.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	ULONG CallThreshold;
+	ULONG BackEdgeThreshold;
+
+	CallThreshold     = m_JITPolicy->GetTierUpCallCount( );
+	BackEdgeThreshold = m_JITPolicy->GetTierUpBackEdgeCount( );
+
+	if ((CallThreshold != 0) &&
+	    (Data.CallCount + Data.ScriptSituationCount >= (size_t) CallThreshold))
+	{
+		return "promoted by call count";
+	}
+
+	if ((BackEdgeThreshold != 0) &&
+	    (Data.BackEdgeCount >= (ULONG64) BackEdgeThreshold))
+	{
+		return "promoted by loop back-edge count";
+	}
+
+	return NULL;
+}
+
+bool
+NWScriptRuntime::PromoteScript(
+	__inout ScriptCacheData & Data,
+	__in const NWN::ResRef32 & ScriptName,
+	__in_ecount( CodeSize ) const unsigned char * InstructionStream,
+	__in size_t CodeSize,
+	__in const char * Reason,
+	__in bool AllowBackground
+	)
+/*++
+
+Routine Description:
+
+	This routine promotes a script from the profiling tier to the JIT engine.
+
+	Promotion may only be performed at a safe point, where the script is not
+	active anywhere on the call stack: the script's reader is rebased to the
+	current instruction buffer for code generation, which would invalidate an
+	active VM invocation of the script.  Script situations that were saved by
+	the VM before the promotion continue to run in the VM.
+
+	If the JIT policy declines the script (e.g. due to VA space pressure), or
+	code generation fails, the script is moved to the VM tier for good.
+
+	Under background compilation, the script is instead queued to the
+	compilation thread and moved to the compiling tier.  It keeps running in
+	the VM until PublishCompiledScripts installs the generated code.
+
+Arguments:
+
+	Data - Supplies the script cache data of the script to promote.
+
+	ScriptName - Supplies the resource name of the script.
+
+	InstructionStream - Supplies the complete script program instruction stream.
+
+	CodeSize - Supplies the length, in bytes, of the instruction stream.
+
+	Reason - Supplies the reason for the promotion, for statistics.
+
+	AllowBackground - Supplies whether the code may be generated on the
+	                  background compilation thread.  The caller passes false
+	                  if it needs the generated code immediately.
+
+Return Value:
+
+	The routine returns true if the script was promoted, else false if it
+	stays in the VM (for now, if it was queued for background compilation).
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	std::string ScriptNameStr( StrFromResRef( ScriptName ) );
+
+	if (Data.RecursionLevel != 0)
+		throw std::runtime_error( "Attempted to promote a script that is active on the call stack." );
+
+	Data.TierChangeCall = Data.CallCount + Data.ScriptSituationCount;
+
+	if (!ShouldJITScript( CodeSize ))
+	{
+		Data.Tier       = SCRIPT_TIER_VM;
+		Data.TierReason = "promotion declined by policy";
+
+		m_Bridge->GetTextOut( )->WriteText(
+			"NWScriptRuntime::PromoteScript: Not promoting script '%s' (%lu bytes compiled script); using NWScript VM.\n",
+			ScriptNameStr.c_str( ),
+			(unsigned long) CodeSize);
+
+		return false;
+	}
+
+	if ((AllowBackground) &&
+	    (m_JITPolicy->GetBackgroundCompilation( )) &&
+	    (QueueCompile( Data, ScriptName, InstructionStream, CodeSize )))
+	{
+		Data.Tier       = SCRIPT_TIER_VM_COMPILING;
+		Data.TierReason = Reason;
+
+		m_Bridge->GetTextOut( )->WriteText(
+			"NWScriptRuntime::PromoteScript: Queued script '%s' for background compilation (%s) after %lu calls, %lu script situations, %I64lu loop back-edges.\n",
+			ScriptNameStr.c_str( ),
+			Reason,
+			(unsigned long) Data.CallCount,
+			(unsigned long) Data.ScriptSituationCount,
+			Data.BackEdgeCount);
+
+		return false;
+	}
+
+	Data.Reader->ResetInstructionBuffer( InstructionStream, CodeSize );
+
+	if (!GenerateCodeForScript( Data, ScriptNameStr, CodeSize ))
+	{
+		Data.Tier       = SCRIPT_TIER_VM;
+		Data.TierReason = "promotion failed code generation";
+
+		return false;
+	}
+
+	Data.Tier       = SCRIPT_TIER_JIT;
+	Data.TierReason = Reason;
+
+	m_Bridge->GetTextOut( )->WriteText(
+		"NWScriptRuntime::PromoteScript: Promoted script '%s' to the JIT engine (%s) after %lu calls, %lu script situations, %I64lu loop back-edges.\n",
+		ScriptNameStr.c_str( ),
+		Reason,
+		(unsigned long) Data.CallCount,
+		(unsigned long) Data.ScriptSituationCount,
+		Data.BackEdgeCount);
+
+	return true;
+}
+
+bool
+NWScriptRuntime::QueueCompile(
+	__in const ScriptCacheData & Data,
+	__in const NWN::ResRef32 & ScriptName,
+	__in_ecount( CodeSize ) const unsigned char * InstructionStream,
+	__in size_t CodeSize
+	)
+/*++
+
+Routine Description:
+
+	This routine queues a script for code generation on the background
+	compilation thread, starting the thread if necessary.
+
+	The job receives a private copy of the instruction stream, together with
+	the patch state and debug symbols of the script's own reader, so that the
+	generated code is the same as that of a synchronous compilation.  The
+	code generation parameters are likewise captured on the main thread, as
+	the JIT policy is not safe to call from the compilation thread.
+
+Arguments:
+
+	Data - Supplies the script cache data of the script, whose reader has
+	       been set up by LoadScript.
+
+	ScriptName - Supplies the resource name of the script.
+
+	InstructionStream - Supplies the complete script program instruction stream.
+
+	CodeSize - Supplies the length, in bytes, of the instruction stream.
+
+Return Value:
+
+	The routine returns true if the script was queued, else false if the
+	compilation thread could not be started.  Otherwise, errors are reported
+	via raising an std::exception.
+
+Environment:
+
+	User mode, main thread.
+
+--*/
+{
+	CompileJobPtr                          Job;
+	const unsigned char                  * Instructions;
+	size_t                                 InstructionsLen;
+	NWScriptReader::SymbolTableRawEntryVec SymTab;
+	std::string                            ScriptNameStr( StrFromResRef( ScriptName ) );
+
+	if (!StartCompileThread( ))
+		return false;
+
+	Job = new CompileJob;
+
+	Job->ScriptName      = ScriptName;
+	Job->CacheGeneration = m_CacheGeneration;
+	Job->QueueTick       = ReadPerformanceCounterMilliseconds( );
+	Job->CompileTime     = 0;
+	Job->MemoryCost      = 0;
+
+	Job->Code.assign( InstructionStream, InstructionStream + CodeSize );
+
+	//
+	// N.B.  Only the symbol table is taken from the script's reader, as its
+	//       instruction buffer may refer to a stale server buffer.
+	//
+
+	Data.Reader->StoreInternalState( Instructions, InstructionsLen, SymTab );
+
+	Job->Reader = new NWScriptReader(
+		ScriptNameStr.c_str( ),
+		Job->Code.empty( ) ? NULL : &Job->Code[ 0 ],
+		Job->Code.size( ),
+		SymTab.empty( ) ? NULL : &SymTab[ 0 ],
+		SymTab.size( ));
+
+	Job->Reader->SetPatchState( Data.Reader->GetPatchState( ) );
+
+	BuildCodeGenParams( Job->CodeGenParams, Job->AnalysisFlags );
+
+	//
+	// The policy's output directory string may change should the
+	// configuration be reloaded, so the job keeps its own copy.
+	//
+
+	if (Job->CodeGenParams.CodeGenOutputDir != NULL)
+	{
+		Job->CodeGenOutputDir               = Job->CodeGenParams.CodeGenOutputDir;
+		Job->CodeGenParams.CodeGenOutputDir = Job->CodeGenOutputDir.c_str( );
+	}
+
+	Job->DebugLevel = (ULONG) m_Bridge->GetScriptDebug( );
+
+	{
+		swutil::ScopedLock Lock( m_CompileLock );
+
+		m_CompileQueue.push_back( Job );
+	}
+
+	ReleaseSemaphore( m_CompileSemaphore, 1, NULL );
+
+	m_PendingCompiles += 1;
+
+	return true;
+}
+
+void
+NWScriptRuntime::PublishCompiledScripts(
+	)
+/*++
+
+Routine Description:
+
+	This routine installs the programs generated by the background compilation
+	thread into the script cache.  A published program is used from the next
+	invocation of the script on; script situations that were saved by the VM
+	beforehand continue to run in the VM.
+
+	A program is only published while its script is not active on the call
+	stack, so that a tier change is never observed by a running invocation.
+	Results for scripts that are active are held back for a later call.
+
+	Results are discarded if the script cache was cleared since the job was
+	queued, or if the script no longer awaits them (e.g. because it had to be
+	compiled synchronously to resume a JIT script situation).
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode, main thread.
+
+--*/
+{
+	CompileJobList Completed;
+
+	{
+		swutil::ScopedLock Lock( m_CompileLock );
+
+		Completed.splice( Completed.end( ), m_CompletedJobs );
+	}
+
+	for (CompileJobList::iterator it = Completed.begin( );
+	     it != Completed.end( );
+	     )
+	{
+		CompileJob               * Job;
+		ScriptCacheMap::iterator   Entry;
+		ScriptCacheData          * Data;
+		std::string                ScriptNameStr;
+
+		Job   = it->get( );
+		Entry = m_ScriptCache.find( Job->ScriptName );
+
+		if ((Job->CacheGeneration != m_CacheGeneration) ||
+		    (Entry == m_ScriptCache.end( )) ||
+		    (Entry->second.Tier != SCRIPT_TIER_VM_COMPILING))
+		{
+			if (Job->CacheGeneration == m_CacheGeneration)
+				m_PendingCompiles -= 1;
+
+			it = Completed.erase( it );
+			continue;
+		}
+
+		if (Entry->second.RecursionLevel != 0)
+		{
+			++it;
+			continue;
+		}
+
+		Data          = &Entry->second;
+		ScriptNameStr = StrFromResRef( Job->ScriptName );
+
+		Data->TierChangeCall = Data->CallCount + Data->ScriptSituationCount;
+
+		if (Job->JITProgram.get( ) == NULL)
+		{
+			Data->Tier       = SCRIPT_TIER_VM;
+			Data->TierReason = "background code generation failed";
+
+			m_Bridge->GetTextOut( )->WriteText(
+				"NWScriptRuntime::PublishCompiledScripts: Failed to generate code for script '%s' (%lu bytes compiled script): exception '%s'.\n",
+				ScriptNameStr.c_str( ),
+				(unsigned long) Job->Code.size( ),
+				Job->ErrorMessage.c_str( ));
+		}
+		else
+		{
+			Data->JITProgram = Job->JITProgram;
+			Data->MemoryCost = Job->MemoryCost;
+			Data->Tier       = SCRIPT_TIER_JIT;
+
+			m_Bridge->GetTextOut( )->WriteText(
+				"NWScriptRuntime::PublishCompiledScripts: Generated code for script '%s' (%lu bytes compiled script, %s) in %lums on the compilation thread, %lums after it was queued; approximately %I64lu bytes additional VA space used.\n",
+				ScriptNameStr.c_str( ),
+				(unsigned long) Job->Code.size( ),
+				Data->TierReason,
+				Job->CompileTime,
+				ReadPerformanceCounterMilliseconds( ) - Job->QueueTick,
+				(ULONGLONG) Data->MemoryCost);
+		}
+
+		m_PendingCompiles -= 1;
+
+		it = Completed.erase( it );
+	}
+
+	//
+	// Hand back any results that are being held for a later call.
+	//
+
+	if (!Completed.empty( ))
+	{
+		swutil::ScopedLock Lock( m_CompileLock );
+
+		m_CompletedJobs.splice( m_CompletedJobs.begin( ), Completed );
+	}
+}
+
+bool
+NWScriptRuntime::StartCompileThread(
+	)
+/*++
+
+Routine Description:
+
+	This routine starts the background compilation thread, if it has not yet
+	been started.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	The routine returns true if the compilation thread is running, else false
+	if it could not be started.
+
+Environment:
+
+	User mode, main thread.
+
+--*/
+{
+	if (m_CompileThread != NULL)
+		return true;
+
+	if (m_CompileSemaphore == NULL)
+	{
+		m_CompileSemaphore = CreateSemaphore( NULL, 0, LONG_MAX, NULL );
+
+		if (m_CompileSemaphore == NULL)
+			return false;
+	}
+
+	if (m_CompileStopEvent == NULL)
+	{
+		m_CompileStopEvent = CreateEvent( NULL, TRUE, FALSE, NULL );
+
+		if (m_CompileStopEvent == NULL)
+			return false;
+	}
+
+	if (m_CompileDoneEvent == NULL)
+	{
+		m_CompileDoneEvent = CreateEvent( NULL, TRUE, FALSE, NULL );
+
+		if (m_CompileDoneEvent == NULL)
+			return false;
+	}
+
+	//
+	// N.B.  _beginthreadex is used as code generation makes use of the CRT.
+	//
+
+	m_CompileThread = (HANDLE) _beginthreadex(
+		NULL,
+		0,
+		CompileThread,
+		this,
+		0,
+		NULL);
+
+	if (m_CompileThread == NULL)
+	{
+		m_TextOut->WriteText(
+			"NWScriptRuntime::StartCompileThread: Failed to start the background compilation thread; generating code synchronously.\n");
+
+		return false;
+	}
+
+	//
+	// Code generation should not compete with the main thread for the CPU.
+	//
+
+	SetThreadPriority( m_CompileThread, THREAD_PRIORITY_BELOW_NORMAL );
+
+	return true;
+}
+
+void
+NWScriptRuntime::StopCompileThread(
+	)
+/*++
+
+Routine Description:
+
+	This routine shuts down the background compilation thread, waiting for any
+	compilation in progress to finish.  All queued and completed jobs are
+	discarded.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode, main thread.
+
+--*/
+{
+	if (m_CompileThread != NULL)
+	{
+		SetEvent( m_CompileStopEvent );
+
+		WaitForSingleObject( m_CompileThread, INFINITE );
+		CloseHandle( m_CompileThread );
+
+		m_CompileThread = NULL;
+	}
+
+	if (m_CompileSemaphore != NULL)
+	{
+		CloseHandle( m_CompileSemaphore );
+		m_CompileSemaphore = NULL;
+	}
+
+	if (m_CompileStopEvent != NULL)
+	{
+		CloseHandle( m_CompileStopEvent );
+		m_CompileStopEvent = NULL;
+	}
+
+	if (m_CompileDoneEvent != NULL)
+	{
+		CloseHandle( m_CompileDoneEvent );
+		m_CompileDoneEvent = NULL;
+	}
+
+	m_CompileInFlight = false;
+
+	m_CompileQueue.clear( );
+	m_CompletedJobs.clear( );
+
+	m_PendingCompiles = 0;
+}
+
+unsigned
+__stdcall
+NWScriptRuntime::CompileThread(
+	__in void * Parameter
+	)
+/*++
+
+Routine Description:
+
+	This routine is the entry point of the background compilation thread.
+
+Arguments:
+
+	Parameter - Supplies the owning NWScriptRuntime object.
+
+Return Value:
+
+	The routine always returns zero.
+
+Environment:
+
+	User mode, compilation thread.
+
+--*/
+{
+	((NWScriptRuntime *) Parameter)->ProcessCompileQueue( );
+
+	return 0;
+}
+
+void
+NWScriptRuntime::ProcessCompileQueue(
+	)
+/*++
+
+Routine Description:
+
+	This routine generates code for queued scripts until the runtime is shut
+	down.  Each finished job, successful or not, is moved to the completed
+	list for the main thread to publish.
+
+	Only the job itself, the JIT engine and the bridge's action handler table
+	are touched here; the script cache and the JIT policy belong to the main
+	thread.  Diagnostics from code generation go to the debug text output,
+	whereas the outcome of each job is logged when it is published.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode, compilation thread.
+
+--*/
+{
+	HANDLE Waits[ 2 ];
+
+	Waits[ 0 ] = m_CompileStopEvent;
+	Waits[ 1 ] = m_CompileSemaphore;
+
+	for (;;)
+	{
+		CompileJobList Claimed;
+		CompileJob   * Job;
+		ULONG          StartTick;
+		ULONGLONG      StartVASpace;
+
+		if (WaitForMultipleObjects( 2, Waits, FALSE, INFINITE ) != WAIT_OBJECT_0 + 1)
+			break;
+
+		//
+		// Claim the oldest queued job.  The queue may be empty if the jobs
+		// that released the semaphore were since cancelled.
+		//
+		// N.B.  The job is moved between lists by splicing so that handing it
+		//       back to the main thread cannot fail.
+		//
+
+		{
+			swutil::ScopedLock Lock( m_CompileLock );
+
+			if (m_CompileQueue.empty( ))
+				continue;
+
+			Claimed.splice(
+				Claimed.end( ),
+				m_CompileQueue,
+				m_CompileQueue.begin( ));
+
+			m_CompileInFlight = true;
+		}
+
+		Job = Claimed.front( ).get( );
+
+		StartVASpace = GetAvailableVASpace( );
+		StartTick    = ReadPerformanceCounterMilliseconds( );
+
+		try
+		{
+			Job->JITProgram = m_JITEngine->GenerateCodePtr(
+				Job->Reader.get( ),
+				NWActions_NWN2,
+				MAX_ACTION_ID_NWN2,
+				Job->AnalysisFlags,
+				m_TextOut,
+				Job->DebugLevel,
+				m_Bridge,
+				NWN::INVALIDOBJID,
+				&Job->CodeGenParams);
+		}
+		catch (std::exception &e)
+		{
+			Job->JITProgram = NULL;
+
+			try
+			{
+				Job->ErrorMessage = e.what( );
+			}
+			catch (std::exception)
+			{
+			}
+		}
+
+		//
+		// N.B.  The VA space cost is approximate, as the main thread continues
+		//       to allocate memory while the code is generated.
+		//
+
+		Job->CompileTime = ReadPerformanceCounterMilliseconds( ) - StartTick;
+		Job->MemoryCost  = (size_t) (StartVASpace - GetAvailableVASpace( ));
+
+		if ((LONG_PTR) Job->MemoryCost < 0)
+			Job->MemoryCost = 0;
+
+		{
+			swutil::ScopedLock Lock( m_CompileLock );
+
+			m_CompletedJobs.splice( m_CompletedJobs.end( ), Claimed );
+
+			m_CompileInFlight = false;
+
+			SetEvent( m_CompileDoneEvent );
+		}
+	}
+}
+
+const char *
+NWScriptRuntime::GetTierName(
+	__in SCRIPT_TIER Tier
+	)
+/*++
+
+Routine Description:
+
+	This routine returns the display name of a script execution tier.
+
+Arguments:
+
+	Tier - Supplies the tier to return the name of.
+
+Return Value:
+
+	The routine returns a pointer to a static string naming the tier.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	switch (Tier)
+	{
+
+	case SCRIPT_TIER_VM:
+		return "(VM)";
+
+	case SCRIPT_TIER_VM_PROFILING:
+		return "(VM, profiling)";
+
+	case SCRIPT_TIER_VM_COMPILING:
+		return "(VM, compiling)";
+
+	case SCRIPT_TIER_JIT:
+		return "(JIT)";
+
+	default:
+		return "(unknown)";
+
+	}
 }
 
 void
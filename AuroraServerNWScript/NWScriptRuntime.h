@@ -56,7 +56,15 @@ public:
 	  m_VM( NULL ),
 	  m_JITPolicy( JITPolicy ),
 	  m_RecursionLevel( 0 ),
-	  m_TotalScriptRuntime( 0 )
+	  m_NestedBackEdges( 0 ),
+	  m_TotalScriptRuntime( 0 ),
+	  m_CompileThread( NULL ),
+	  m_CompileSemaphore( NULL ),
+	  m_CompileStopEvent( NULL ),
+	  m_CompileDoneEvent( NULL ),
+	  m_CompileInFlight( false ),
+	  m_CacheGeneration( 0 ),
+	  m_PendingCompiles( 0 )
 	{
 		ZeroMemory( &m_CurrentScriptName, sizeof( m_CurrentScriptName ) );
 
@@ -82,6 +90,8 @@ public:
 	~NWScriptRuntime(
 		)
 	{
+		StopCompileThread( );
+
 		m_ScriptCache.clear( );
 
 		if (m_VM != NULL)
@@ -142,7 +152,29 @@ private:
 
 	enum
 	{
-		SAVED_STATE_ID = 'NSSJ'
+		SAVED_STATE_ID    = 'NSSJ', // Saved by the JIT engine
+		SAVED_STATE_ID_VM = 'NSSV'  // Saved by the NWScript VM
+	};
+
+	//
+	// Define the execution tier of a script.  Under tiered compilation, a
+	// script starts in the profiling tier (running in the VM) and moves to
+	// the JIT tier once it is hot.  A script whose promotion is declined or
+	// fails remains in the VM tier for good.
+	//
+	// Under background compilation, a script whose code is being generated
+	// by the compilation thread runs in the VM (in the compiling tier) until
+	// the generated program is published.
+	//
+
+	enum SCRIPT_TIER
+	{
+		SCRIPT_TIER_VM,
+		SCRIPT_TIER_VM_PROFILING,
+		SCRIPT_TIER_VM_COMPILING,
+		SCRIPT_TIER_JIT,
+
+		LAST_SCRIPT_TIER
 	};
 
 	typedef swutil::SharedPtr< NWScriptReader > NWScriptReaderPtr;
@@ -162,6 +194,10 @@ private:
 		size_t                       MemoryCost;
 		ULONG                        Runtime;
 		size_t                       RecursionLevel;
+		SCRIPT_TIER                  Tier;
+		const char                 * TierReason;
+		size_t                       TierChangeCall;
+		ULONG64                      BackEdgeCount;
 	};
 
 	struct ScriptResumeData
@@ -170,6 +206,35 @@ private:
 		NWScriptJITLib::SavedState::Ptr ScriptSituationJIT;
 	};
 
+	//
+	// Define a request to generate code for a script on the background
+	// compilation thread.  The job owns a private copy of the instruction
+	// stream (and a reader over it), as the server's instruction buffer is
+	// only valid for the duration of a call.  The main thread fills in the
+	// job before queuing it; the compilation thread fills in the results.
+	//
+
+	struct CompileJob
+	{
+		NWN::ResRef32                ScriptName;
+		ULONG                        CacheGeneration;
+		ULONG                        QueueTick;
+		std::vector< unsigned char > Code;
+		NWScriptReaderPtr            Reader;
+		NWSCRIPT_JIT_PARAMS          CodeGenParams;
+		std::wstring                 CodeGenOutputDir;
+		ULONG                        AnalysisFlags;
+		ULONG                        DebugLevel;
+
+		NWScriptJITLib::Program::Ptr JITProgram;
+		std::string                  ErrorMessage;
+		ULONG                        CompileTime;
+		size_t                       MemoryCost;
+	};
+
+	typedef swutil::SharedPtr< CompileJob > CompileJobPtr;
+	typedef std::list< CompileJobPtr > CompileJobList;
+
 	//
 	// Comparison predicate for ResRefModelMap.
 	//
@@ -250,6 +315,116 @@ private:
 		__deref_out ScriptCacheData * * ScriptData
 		);
 
+	//
+	// Generate native code for a script program whose reader has been set up
+	// by LoadScript.
+	//
+
+	bool
+	GenerateCodeForScript(
+		__inout ScriptCacheData & Data,
+		__in const std::string & ScriptName,
+		__in size_t CodeSize
+		);
+
+	//
+	// Build the code generation parameters for a script from the JIT policy.
+	//
+
+	void
+	BuildCodeGenParams(
+		__out NWSCRIPT_JIT_PARAMS & CodeGenParams,
+		__out ULONG & AnalysisFlags
+		);
+
+	//
+	// Queue a script for code generation on the background compilation
+	// thread.  The routine returns false if the compilation thread could not
+	// be started, in which case the caller should generate code itself.
+	//
+
+	bool
+	QueueCompile(
+		__in const ScriptCacheData & Data,
+		__in const NWN::ResRef32 & ScriptName,
+		__in_ecount( CodeSize ) const unsigned char * InstructionStream,
+		__in size_t CodeSize
+		);
+
+	//
+	// Install the programs generated by the background compilation thread
+	// into the script cache, for scripts that are not active on the call
+	// stack.
+	//
+
+	void
+	PublishCompiledScripts(
+		);
+
+	//
+	// Start or stop the background compilation thread.
+	//
+
+	bool
+	StartCompileThread(
+		);
+
+	void
+	StopCompileThread(
+		);
+
+	//
+	// Background compilation thread entry point and work loop.
+	//
+
+	static
+	unsigned
+	__stdcall
+	CompileThread(
+		__in void * Parameter
+		);
+
+	void
+	ProcessCompileQueue(
+		);
+
+	//
+	// Return the reason that a script in the profiling tier should be
+	// promoted to the JIT engine, else NULL if it should stay in the VM.
+	//
+
+	const char *
+	CheckTierUpThresholds(
+		__in const ScriptCacheData & Data
+		);
+
+	//
+	// Promote a script in the profiling tier to the JIT engine.  The script
+	// must not be active on the call stack.  If AllowBackground is true and
+	// background compilation is enabled, the code is generated on the
+	// compilation thread and the script stays in the VM until it is ready.
+	//
+
+	bool
+	PromoteScript(
+		__inout ScriptCacheData & Data,
+		__in const NWN::ResRef32 & ScriptName,
+		__in_ecount( CodeSize ) const unsigned char * InstructionStream,
+		__in size_t CodeSize,
+		__in const char * Reason,
+		__in bool AllowBackground
+		);
+
+	//
+	// Return the display name of a script tier.
+	//
+
+	static
+	const char *
+	GetTierName(
+		__in SCRIPT_TIER Tier
+		);
+
 	//
 	// Convert script parameters from the server's internal representation to
 	// the native representation used by the execution environment.
@@ -469,6 +644,14 @@ private:
 
 	unsigned long                               m_RecursionLevel;
 
+	//
+	// Define the count of VM back-edges taken by scripts nested within the
+	// current script invocation, which are excluded from the back-edge count
+	// of the current script.
+	//
+
+	ULONG64                                     m_NestedBackEdges;
+
 	//
 	// Define total runtime spent in the script VM.
 	//
@@ -480,6 +663,40 @@ private:
 	//
 
 	LARGE_INTEGER                               m_PerfFrequency;
+
+	//
+	// Define the background compilation queue.  m_CompileQueue holds jobs
+	// awaiting the compilation thread and m_CompletedJobs holds jobs awaiting
+	// publication by the main thread; both are guarded by m_CompileLock.
+	// m_CompileSemaphore is released once for each queued job, and
+	// m_CompileStopEvent signals the compilation thread to exit.
+	// m_CompileInFlight (also guarded by m_CompileLock) is set while the
+	// compilation thread holds a claimed job, and m_CompileDoneEvent is
+	// signaled whenever it hands a job back.
+	//
+
+	swutil::CriticalSection                     m_CompileLock;
+	CompileJobList                              m_CompileQueue;
+	CompileJobList                              m_CompletedJobs;
+	HANDLE                                      m_CompileThread;
+	HANDLE                                      m_CompileSemaphore;
+	HANDLE                                      m_CompileStopEvent;
+	HANDLE                                      m_CompileDoneEvent;
+	bool                                        m_CompileInFlight;
+
+	//
+	// Define the generation of the script cache, which is advanced whenever
+	// the cache is cleared so that stale compilation results are discarded.
+	//
+
+	ULONG                                       m_CacheGeneration;
+
+	//
+	// Define the count of scripts queued for background compilation whose
+	// results have not yet been published (main thread only).
+	//
+
+	size_t                                      m_PendingCompiles;
 };
 
 #endif
@@ -624,6 +624,30 @@ Environment:
 			(INT) m_OptimizeActionServiceHandlers ? 1 : 0,
 			m_IniPath.c_str( ) ) ? true : false;
 
+		m_TieredCompilation = GetPrivateProfileInt(
+			L"Settings",
+			L"TieredCompilation",
+			(INT) m_TieredCompilation ? 1 : 0,
+			m_IniPath.c_str( ) ) ? true : false;
+
+		m_TierUpCallCount = (ULONG) GetPrivateProfileInt(
+			L"Settings",
+			L"TierUpCallCount",
+			(INT) m_TierUpCallCount,
+			m_IniPath.c_str( ) );
+
+		m_TierUpBackEdgeCount = (ULONG) GetPrivateProfileInt(
+			L"Settings",
+			L"TierUpBackEdgeCount",
+			(INT) m_TierUpBackEdgeCount,
+			m_IniPath.c_str( ) );
+
+		m_BackgroundCompilation = GetPrivateProfileInt(
+			L"Settings",
+			L"BackgroundCompilation",
+			(INT) m_BackgroundCompilation ? 1 : 0,
+			m_IniPath.c_str( ) ) ? true : false;
+
 		GetPrivateProfileString(
 			L"Settings",
 			L"CodeGenOutputDirectory",
@@ -673,6 +697,18 @@ Environment:
 		m_TextOut->WriteText(
 			"OptimizeActionServiceHandlers set to %lu.\n",
 			m_OptimizeActionServiceHandlers ? 1 : 0 );
+		m_TextOut->WriteText(
+			"TieredCompilation set to %lu.\n",
+			m_TieredCompilation ? 1 : 0 );
+		m_TextOut->WriteText(
+			"TierUpCallCount set to %lu.\n",
+			(unsigned long) m_TierUpCallCount );
+		m_TextOut->WriteText(
+			"TierUpBackEdgeCount set to %lu.\n",
+			(unsigned long) m_TierUpBackEdgeCount );
+		m_TextOut->WriteText(
+			"BackgroundCompilation set to %lu.\n",
+			m_BackgroundCompilation ? 1 : 0 );
 
 		if (m_CodeGenOutputDirectory.empty( ))
 		{
@@ -1262,6 +1298,122 @@ Environment:
 	return m_OptimizeActionServiceHandlers;
 }
 
+bool
+ServerNWScriptPlugin::GetTieredCompilation(
+	)
+/*++
+
+Routine Description:
+
+	This routine determines whether tiered compilation is enabled.  With tiered
+	compilation, every script begins execution in the reference VM and is only
+	JIT'd once it has been invoked frequently enough, or has spent enough time
+	in loops, to be worth the cost of code generation.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	The routine returns a Boolean value indicating true if tiered compilation
+	is enabled.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	return m_TieredCompilation;
+}
+
+ULONG
+ServerNWScriptPlugin::GetTierUpCallCount(
+	)
+/*++
+
+Routine Description:
+
+	This routine determines the number of invocations after which a script
+	running under tiered compilation is promoted to the JIT engine.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	The routine returns the promotion invocation count, else zero if the
+	invocation count does not cause promotion.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	return m_TierUpCallCount;
+}
+
+ULONG
+ServerNWScriptPlugin::GetTierUpBackEdgeCount(
+	)
+/*++
+
+Routine Description:
+
+	This routine determines the number of loop back-edges, taken while running
+	in the reference VM, after which a script running under tiered compilation
+	is promoted to the JIT engine.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	The routine returns the promotion back-edge count, else zero if the
+	back-edge count does not cause promotion.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	return m_TierUpBackEdgeCount;
+}
+
+bool
+ServerNWScriptPlugin::GetBackgroundCompilation(
+	)
+/*++
+
+Routine Description:
+
+	This routine determines whether code generation for scripts is performed
+	on a background thread.  If so, a script runs in the reference VM until its
+	code has been generated, instead of stalling the server while the code is
+	generated.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	The routine returns true if background compilation is enabled.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	return m_BackgroundCompilation;
+}
+
 
 
 
@@ -63,7 +63,11 @@ public:
 	  m_LoadDebugSymbols( true ),
 	  m_AllowManagedScripts( false ),
 	  m_DisableExecutionGuards( false ),
-	  m_OptimizeActionServiceHandlers( true )
+	  m_OptimizeActionServiceHandlers( true ),
+	  m_TieredCompilation( false ),
+	  m_TierUpCallCount( 32 ),
+	  m_TierUpBackEdgeCount( 10000 ),
+	  m_BackgroundCompilation( false )
 	{
 		m_sPlugin = this;
 	}
@@ -245,6 +249,42 @@ public:
 	GetOptimizeActionServiceHandlers(
 		);
 
+	//
+	// Return true if tiered compilation is enabled.
+	//
+
+	virtual
+	bool
+	GetTieredCompilation(
+		);
+
+	//
+	// Return the invocation count that promotes a tiered script to the JIT.
+	//
+
+	virtual
+	ULONG
+	GetTierUpCallCount(
+		);
+
+	//
+	// Return the loop back-edge count that promotes a tiered script to the JIT.
+	//
+
+	virtual
+	ULONG
+	GetTierUpBackEdgeCount(
+		);
+
+	//
+	// Return true if background compilation is enabled.
+	//
+
+	virtual
+	bool
+	GetBackgroundCompilation(
+		);
+
 private:
 
 	bool
@@ -298,6 +338,10 @@ private:
 	bool                          m_AllowManagedScripts;
 	bool                          m_DisableExecutionGuards;
 	bool                          m_OptimizeActionServiceHandlers;
+	bool                          m_TieredCompilation;
+	ULONG                         m_TierUpCallCount;
+	ULONG                         m_TierUpBackEdgeCount;
+	bool                          m_BackgroundCompilation;
 
 };
 
@@ -364,12 +364,15 @@ Environment:
 		const GffFileReader::GffStruct * RootStruct = ModuleIfo.GetRootStruct( );
 		std::string                      ModName;
 		GffFileReader::GffStruct         Struct;
+		std::vector< NWN::ResRef32 >     AreaList;
 
 		if (RootStruct->GetCExoLocString( "Mod_Name", ModName ))
 			TextOut.WriteText( "The module name is: %s.\n", ModName.c_str( ) );
 
 		//
-		// Now look at each area.
+		// Gather the area list, and queue each area's resources for prefetch
+		// so that the area files are read in while earlier areas are being
+		// displayed.
 		//
 
 		for (size_t i = 0; i <= ULONG_MAX; i += 1)
@@ -382,11 +385,24 @@ Environment:
 			if (!Struct.GetResRef( "Area_Name", AreaResRef ))
 				throw std::runtime_error( "Mod_Area_list element is missing Area_Name." );
 
+			AreaList.push_back( AreaResRef );
+
+			ResMan.PrefetchArea( AreaResRef );
+		}
+
+		//
+		// Now look at each area.
+		//
+
+		for (std::vector< NWN::ResRef32 >::const_iterator it = AreaList.begin( );
+		     it != AreaList.end( );
+		     ++it)
+		{
 			//
 			// Show information about this area.
 			//
 
-			ShowAreaInformation( AreaResRef, ResMan, &TextOut );
+			ShowAreaInformation( *it, ResMan, &TextOut );
 		}
 	}
 	catch (std::exception &e)
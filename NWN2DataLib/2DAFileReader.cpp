@@ -20,6 +20,12 @@ Abstract:
 TwoDAFileReader::TwoDAFileReader(
 	__in const std::string & FileName
 	)
+: m_Pool( NULL ),
+  m_PoolSize( 0 ),
+  m_CellTable( NULL ),
+  m_RowCount( 0 ),
+  m_MappedView( NULL ),
+  m_MappedSize( 0 )
 /*++
 
 Routine Description:
@@ -47,6 +53,84 @@ Environment:
 	//
 
 	Parse2DAFile( FileName );
+	BuildColumns( );
+}
+
+TwoDAFileReader::TwoDAFileReader(
+	__in_bcount( DataSize ) const void * TwoDARawData,
+	__in size_t DataSize,
+	__in const std::string & ResourceName
+	)
+: m_Pool( NULL ),
+  m_PoolSize( 0 ),
+  m_CellTable( NULL ),
+  m_RowCount( 0 ),
+  m_MappedView( NULL ),
+  m_MappedSize( 0 )
+/*++
+
+Routine Description:
+
+	This routine constructs a new TwoDAFileReader object and parses the contents
+	of a 2DA file by raw in-memory buffer.  The contents are immediately
+	deserialized, so the raw memory buffer need only remain valid for the
+	duration of the constructor.
+
+Arguments:
+
+	TwoDARawData - Supplies the raw 2DA file data to process.
+
+	DataSize - Supplies the length, in bytes, of the raw data buffer.
+
+	ResourceName - Supplies the name of the 2DA, for diagnostic purposes.
+
+Return Value:
+
+	The newly constructed object.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	//
+	// Parse the buffer contents.
+	//
+
+	Parse2DABuffer( TwoDARawData, DataSize, ResourceName );
+	BuildColumns( );
+}
+
+TwoDAFileReader::TwoDAFileReader(
+	)
+: m_Pool( NULL ),
+  m_PoolSize( 0 ),
+  m_CellTable( NULL ),
+  m_RowCount( 0 ),
+  m_MappedView( NULL ),
+  m_MappedSize( 0 )
+/*++
+
+Routine Description:
+
+	This routine constructs a new, empty TwoDAFileReader object, whose contents
+	are subsequently supplied by a binary 2DA cache file.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	The newly constructed object.
+
+Environment:
+
+	User mode.
+
+--*/
+{
 }
 
 TwoDAFileReader::~TwoDAFileReader(
@@ -71,6 +155,14 @@ Environment:
 
 --*/
 {
+	FreeColumnCaches( );
+
+	if (m_MappedView != NULL)
+	{
+		UnmapViewOfFile( (PVOID) m_MappedView );
+
+		m_MappedView = NULL;
+	}
 }
 
 bool
@@ -106,15 +198,10 @@ Environment:
 
 --*/
 {
-	if (Row >= m_Rows.size( ))
-		return false;
-
-	Value = m_Rows[ Row ][ GetColumnIndex( Column ) ];
-
-	if (Value == "****")
+	if (Row >= m_RowCount)
 		return false;
 
-	return true;
+	return Get2DAString( GetColumnIndex( Column ), Row, Value );
 }
 
 void
@@ -147,15 +234,10 @@ Environment:
 {
 	std::vector< char >   Line;
 	FILE                * File;
-	enum
-	{
-		ModeFileHeader,
-		ModeFileHeader2,
-		ModeColumnHeader,
-		ModeContents
-	}                     Mode;
+	PARSE_MODE            Mode;
+	StringInternMap       InternMap;
 
-	Line.resize( 32768 );
+	Line.resize( MAX_LINE_LENGTH );
 
 	File = fopen( FileName.c_str( ), "rt" );
 
@@ -183,247 +265,1281 @@ Environment:
 
 		while (fgets( &Line[ 0 ], (int) Line.size( ), File ))
 		{
-			strtok( &Line[ 0 ], "\r\n" );
-
-			if (!Line[ 0 ])
+			if (!Parse2DALine( &Line[ 0 ], Mode, InternMap, FileName ))
 				break;
+		}
+	}
+	catch (...)
+	{
+		fclose( File );
+		throw;
+	}
+
+	fclose( File );
+}
+
+void
+TwoDAFileReader::Parse2DABuffer(
+	__in_bcount( DataSize ) const void * TwoDARawData,
+	__in size_t DataSize,
+	__in const std::string & ResourceName
+	)
+/*++
+
+Routine Description:
+
+	This routine parses the in-memory contents of a 2DA file, building an
+	in-memory representation.
+
+	The buffer is split into lines in the same fashion as the file-based
+	parser would, so that both parsers accept the same input.
+
+Arguments:
+
+	TwoDARawData - Supplies the raw 2DA file contents.
+
+	DataSize - Supplies the length, in bytes, of the raw 2DA file contents.
+
+	ResourceName - Supplies the name of the 2DA, for diagnostic purposes.
+
+Return Value:
+
+	None.  On failure, the routine raises an std::exception.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	std::vector< char >   Line;
+	const char          * p;
+	const char          * End;
+	PARSE_MODE            Mode;
+	StringInternMap       InternMap;
+
+	Line.resize( MAX_LINE_LENGTH );
+
+	p    = (const char *) TwoDARawData;
+	End  = p + DataSize;
+	Mode = ModeFileHeader;
+
+	while (p != End)
+	{
+		const char * Eol;
+		size_t       Length;
+
+		//
+		// Extract the next line (including its terminator), truncated to the
+		// line buffer size just as fgets would.
+		//
+
+		Length = min( (size_t) (End - p), Line.size( ) - 1 );
+		Eol    = (const char *) memchr( p, '\n', Length );
+
+		if (Eol != NULL)
+			Length = (Eol - p) + 1;
+
+		memcpy( &Line[ 0 ], p, Length );
+		Line[ Length ] = '\0';
+
+		p += Length;
+
+		if (!Parse2DALine( &Line[ 0 ], Mode, InternMap, ResourceName ))
+			break;
+	}
+}
+
+bool
+TwoDAFileReader::Parse2DALine(
+	__inout char * Line,
+	__inout PARSE_MODE & Mode,
+	__inout StringInternMap & InternMap,
+	__in const std::string & FileName
+	)
+/*++
+
+Routine Description:
+
+	This routine parses a single line of a 2DA file, advancing the parser
+	state as appropriate.
+
+Arguments:
+
+	Line - Supplies the null terminated line contents, including any line
+	       terminator.  The line buffer is modified during parsing.
+
+	Mode - Supplies the current parser state, and receives the next parser
+	       state.
+
+	InternMap - Supplies the map of cell values interned so far.
+
+	FileName - Supplies the name of the .2DA file, for diagnostic purposes.
+
+Return Value:
+
+	The routine returns true if parsing should continue with the next line,
+	else false if the end of the 2DA contents has been reached.  On failure,
+	the routine raises an std::exception.
+
+Environment:
 
-			switch (Mode)
+	User mode.
+
+--*/
+{
+	strtok( Line, "\r\n" );
+
+	if (!Line[ 0 ])
+		return false;
+
+	switch (Mode)
+	{
+
+	case ModeFileHeader:
+		{
+			if ((strncmp( Line, "2DA\tV2.0", 8 )) &&
+			    (strncmp( Line, "2DA V2.0", 8 )))
 			{
+				try
+				{
+					std::string ErrorStr;
+
+					ErrorStr  = "Unrecognized file format on .2DA '";
+					ErrorStr += FileName;
+					ErrorStr += "'.";
 
-			case ModeFileHeader:
+					throw std::runtime_error( ErrorStr );
+				}
+				catch (std::bad_alloc)
 				{
-					if ((strncmp( &Line[ 0 ], "2DA\tV2.0", 8 )) &&
-					    (strncmp( &Line[ 0 ], "2DA V2.0", 8 )))
-					{
-						try
-						{
-							std::string ErrorStr;
-
-							ErrorStr  = "Unrecognized file format on .2DA '";
-							ErrorStr += FileName;
-							ErrorStr += "'.";
-
-							throw std::runtime_error( ErrorStr );
-						}
-						catch (std::bad_alloc)
-						{
-							throw std::runtime_error( "Unrecognized file format on .2DA." );
-						}
-					}
-
-					Mode = ModeFileHeader2;
+					throw std::runtime_error( "Unrecognized file format on .2DA." );
 				}
-				break;
+			}
+
+			Mode = ModeFileHeader2;
+		}
+		break;
+
+	case ModeFileHeader2:
+		{
+			//
+			// TODO: Default value.
+			//
+
+			Mode = ModeColumnHeader;
+
+			//
+			// Here's a giant hack.  Some 2DAs appear to violate the
+			// BioWare spec and actually do not have a second line in
+			// the file header, but go right to the column header list.
+			//
+			// We detect this by looking for a second line that is not
+			// entirely composed of whitespace and doesn't contain the
+			// default value (which we don't support).  In such a case,
+			// we assume the 2DA is damaged, like creaturespeed.2da,
+			// and try to work around it.
+			//
+
+			if (_strnicmp( Line, "DEFAULT:", 8 ))
+			{
+				size_t Len;
 
-			case ModeFileHeader2:
+				Len = strlen( Line );
+
+				if (strspn( Line, "\t \r\n" ) != Len)
 				{
-					//
-					// TODO: Default value.
-					//
-
-					Mode = ModeColumnHeader;
-
-					//
-					// Here's a giant hack.  Some 2DAs appear to violate the
-					// BioWare spec and actually do not have a second line in
-					// the file header, but go right to the column header list.
-					//
-					// We detect this by looking for a second line that is not
-					// entirely composed of whitespace and doesn't contain the
-					// default value (which we don't support).  In such a case,
-					// we assume the 2DA is damaged, like creaturespeed.2da,
-					// and try to work around it.
-					//
-
-					if (_strnicmp( &Line[ 0 ], "DEFAULT:", 8 ))
-					{
-						size_t Len;
-
-						Len = strlen( &Line[ 0 ] );
-
-						if (strspn( &Line[ 0 ], "\t \r\n" ) != Len)
-						{
-							goto TryColumnHeader;
-						}
-					}
+					goto TryColumnHeader;
 				}
-				break;
+			}
+		}
+		break;
 
-			TryColumnHeader:
-			case ModeColumnHeader:
-				{
-					char * State;
-					char * p;
+	TryColumnHeader:
+	case ModeColumnHeader:
+		{
+			char * State;
+			char * p;
+
+			State = NULL;
+
+			for (p = strtok_s( Line, "\t ", &State );
+			     p != NULL;
+			     p = strtok_s( NULL, "\t ", &State ))
+			{
+				m_Columns.push_back( p );
+			}
 
-					State = NULL;
+			m_Cells.reserve( 64 * m_Columns.size( ) );
+
+			Mode = ModeContents;
+		}
+		break;
 
-					for (p = strtok_s( &Line[ 0 ], "\t ", &State );
-					     p != NULL;
-					     p = strtok_s( NULL, "\t ", &State ))
-					{
-						m_Columns.push_back( p );
-					}
+	case ModeContents:
+		{
+			size_t       ColumnIndex;
+			char       * p;
+			const char * Delim[ 2 ] = { "\t ", "\"" };
+			size_t       QuoteMode;
+			size_t       Offset;
+			size_t       RowStart;
+			size_t       RowCells;
+
+			RowStart    = m_Cells.size( );
+			p           = Line;
+			ColumnIndex = 0;
+			QuoteMode   = 0;
+
+			//
+			// p = "\"string\" string2"
+			//
+
+			while (*p != 0)
+			{
+				while (isspace( (int) (unsigned char) *p ))
+					p++;
 
-					m_Rows.reserve( 64 );
+				if (*p == 0)
+					break;
 
-					Mode = ModeContents;
+				if (*p == '\"')
+				{
+					QuoteMode = 1;
+					p++;
 				}
-				break;
+				else
+				{
+					QuoteMode = 0;
+				}
+
+				Offset = strcspn( p, Delim[ QuoteMode ] );
+
+				//
+				// Skip the first column, which should just give us the
+				// row index (however it is ignored and may even be out
+				// of sync!).
+				//
 
-			case ModeContents:
+				if (ColumnIndex != 0)
 				{
-					size_t       ColumnIndex;
-					char       * p;
-					const char * Delim[ 2 ] = { "\t ", "\"" };
-					size_t       QuoteMode;
-					size_t       Offset;
+					if ((Offset == 4) && (!memcmp( p, "****", 4 )))
+						m_Cells.push_back( EMPTY_CELL );
+					else
+						m_Cells.push_back( InternCellValue( p, Offset, InternMap, FileName ) );
+				}
+
+				ColumnIndex += 1;
+
+				//
+				// Advance to the next delimiter.
+				//
+
+				p += Offset;
 
-					m_Rows.push_back( RowValueVec( ) );
+				if (!*p)
+					break;
 
-					RowValueVec & RowVec = m_Rows.back( );
+				//
+				// Move beyond the delimiter.
+				//
 
-					RowVec.reserve( m_Columns.size( ) );
+				p += 1;
 
-					p           = &Line[ 0 ];
-					ColumnIndex = 0;
-					QuoteMode   = 0;
+				if (!*p)
+					break;
 
-					//
-					// p = "\"string\" string2"
-					//
+				//
+				// If we were in dquote mode, we need to move one more
+				// character beyond as there would be a dquote followed
+				// by the next delimiter, and we want to be past the
+				// next delimiter.
+				//
 
-					while (*p != 0)
-					{
-						while (isspace( (int) (unsigned char) *p ))
-							p++;
+				if (QuoteMode == 1)
+				{
+					p += 1;
 
-						if (*p == 0)
-							break;
-
-						if (*p == '\"')
-						{
-							QuoteMode = 1;
-							p++;
-						}
-						else
-						{
-							QuoteMode = 0;
-						}
-
-						Offset = strcspn( p, Delim[ QuoteMode ] );
-
-						//
-						// Skip the first column, which should just give us the
-						// row index (however it is ignored and may even be out
-						// of sync!).
-						//
-
-						if (ColumnIndex != 0)
-							RowVec.push_back( std::string( p, Offset ) );
-
-						ColumnIndex += 1;
-
-						//
-						// Advance to the next delimiter.
-						//
-
-						p += Offset;
-
-						if (!*p)
-							break;
-
-						//
-						// Move beyond the delimiter.
-						//
-
-						p += 1;
-
-						if (!*p)
-							break;
-
-						//
-						// If we were in dquote mode, we need to move one more
-						// character beyond as there would be a dquote followed
-						// by the next delimiter, and we want to be past the
-						// next delimiter.
-						//
-
-						if (QuoteMode == 1)
-						{
-							p += 1;
-
-							if (!*p)
-								break;
-						}
-					}
-#if 0
-
-					p = strtok_s( &Line[ 0 ], "\t ", &State );
-
-					if (p == NULL)
-						continue;
-
-//					WriteText( "%lu: ", m_Rows.size( ) - 1 );
-
-					for (p = strtok_s( NULL, "\t ", &State );
-					     p != NULL;
-					     p = strtok_s( NULL, "\t ", &State ))
-					{
-						RowVec.push_back( p );
-
-//						WriteText( "%s ", p );
-
-						ColumnIndex += 1;
-					}
-
-//					WriteText( "\n" );
-#endif
-					if (ColumnIndex == 0)
-					{
-						m_Rows.pop_back( );
-
-						continue;
-					}
-
-					if (RowVec.size( ) != m_Columns.size( ))
-					{
-						try
-						{
-							char ErrorStr[ 256 ];
-
-							StringCbPrintfA(
-								ErrorStr,
-								sizeof( ErrorStr ),
-								"Bad column count on .2DA '%s' / row %lu (line %lu, cols %lu/%lu).",
-								FileName.c_str( ),
-								(unsigned long) RowVec.size( ),
-								(unsigned long) m_Rows.size( ),
-								(unsigned long) ColumnIndex,
-								(unsigned long) m_Columns.size( ));
-
-							throw std::runtime_error( ErrorStr );
-						}
-						catch (std::bad_alloc)
-						{
-							throw std::runtime_error( "Bad column count on .2DA" );
-						}
-					}
+					if (!*p)
+						break;
 				}
+			}
+			if (ColumnIndex == 0)
 				break;
 
-			default:
-				throw std::runtime_error( "Illegal 2DA reader mode." );
+			RowCells = m_Cells.size( ) - RowStart;
 
+			if (RowCells != m_Columns.size( ))
+			{
+				try
+				{
+					char ErrorStr[ 256 ];
+
+					StringCbPrintfA(
+						ErrorStr,
+						sizeof( ErrorStr ),
+						"Bad column count on .2DA '%s' / row %lu (line %lu, cols %lu/%lu).",
+						FileName.c_str( ),
+						(unsigned long) RowCells,
+						(unsigned long) m_RowCount + 1,
+						(unsigned long) ColumnIndex,
+						(unsigned long) m_Columns.size( ));
+
+					throw std::runtime_error( ErrorStr );
+				}
+				catch (std::bad_alloc)
+				{
+					throw std::runtime_error( "Bad column count on .2DA" );
+				}
 			}
+
+			m_RowCount += 1;
 		}
+		break;
+
+	default:
+		throw std::runtime_error( "Illegal 2DA reader mode." );
+
 	}
-	catch (...)
+
+	return true;
+}
+
+unsigned long
+TwoDAFileReader::InternCellValue(
+	__in_ecount( Length ) const char * Text,
+	__in size_t Length,
+	__inout StringInternMap & InternMap,
+	__in const std::string & FileName
+	)
+/*++
+
+Routine Description:
+
+	This routine adds a cell value to the string pool, unless an identical
+	value has already been added, in which case the existing copy is shared.
+
+Arguments:
+
+	Text - Supplies the cell value text (not null terminated).
+
+	Length - Supplies the length, in characters, of the cell value text.
+
+	InternMap - Supplies the map of cell values interned so far, which is
+	            updated with the new value.
+
+	FileName - Supplies the name of the .2DA file, for diagnostic purposes.
+
+Return Value:
+
+	The routine returns the string pool offset of the null terminated cell
+	value.  On failure, the routine raises an std::exception.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	std::string                       Value( Text, Length );
+	StringInternMap::const_iterator   it;
+	size_t                            Offset;
+
+	it = InternMap.find( Value );
+
+	if (it != InternMap.end( ))
+		return it->second;
+
+	Offset = m_StringPool.size( );
+
+	if ((Offset >= EMPTY_CELL) || (Length >= EMPTY_CELL - Offset))
 	{
-		fclose( File );
-		throw;
+		try
+		{
+			std::string ErrorStr;
+
+			ErrorStr  = "String pool overflow on .2DA '";
+			ErrorStr += FileName;
+			ErrorStr += "'.";
+
+			throw std::runtime_error( ErrorStr );
+		}
+		catch (std::bad_alloc)
+		{
+			throw std::runtime_error( "String pool overflow on .2DA." );
+		}
 	}
 
-	fclose( File );
+	m_StringPool.insert( m_StringPool.end( ), Text, Text + Length );
+	m_StringPool.push_back( '\0' );
+
+	InternMap.insert( StringInternMap::value_type( Value, (unsigned long) Offset ) );
+
+	return (unsigned long) Offset;
 }
 
+void
+TwoDAFileReader::BuildColumns(
+	)
+/*++
+
+Routine Description:
+
+	This routine completes the in-memory representation of a parsed 2DA.  The
+	cell table, which the parser builds in row-major order, is rearranged into
+	column-major order so that the cells of a column are contiguous, and the
+	column name index and (empty) typed column caches are created.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.  On failure, the routine raises an std::exception.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	CellOffsetVec Cells;
+	ColumnCache   EmptyCache;
+	size_t        ColumnCount;
+
+	ColumnCount = m_Columns.size( );
+
+	Cells.resize( m_Cells.size( ) );
+
+	for (size_t Row = 0; Row < m_RowCount; Row += 1)
+	{
+		for (size_t Column = 0; Column < ColumnCount; Column += 1)
+		{
+			Cells[ Column * m_RowCount + Row ] = m_Cells[ Row * ColumnCount + Column ];
+		}
+	}
+
+	m_Cells.swap( Cells );
+
+	//
+	// Index the column names.  Should a column name be duplicated, the first
+	// such column is the one that is referenced by name.
+	//
+
+	for (size_t Column = 0; Column < ColumnCount; Column += 1)
+	{
+		m_ColumnIndex.insert( ColumnIndexMap::value_type( m_Columns[ Column ], Column ) );
+	}
+
+	ZeroMemory( &EmptyCache, sizeof( EmptyCache ) );
+
+	m_ColumnCaches.resize( ColumnCount, EmptyCache );
+
+	m_Pool      = m_StringPool.empty( ) ? NULL : &m_StringPool[ 0 ];
+	m_PoolSize  = m_StringPool.size( );
+	m_CellTable = m_Cells.empty( ) ? NULL : &m_Cells[ 0 ];
+}
+
+void
+TwoDAFileReader::FreeColumnCaches(
+	)
+/*++
+
+Routine Description:
+
+	This routine releases all typed column caches that have been built.  Typed
+	columns that reside in a mapped binary cache file are not freed.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	for (ColumnCacheVec::iterator it = m_ColumnCaches.begin( );
+	     it != m_ColumnCaches.end( );
+	     ++it)
+	{
+		if (!IsMappedPointer( it->Ints ))
+			delete [] it->Ints;
+		if (!IsMappedPointer( it->Floats ))
+			delete [] it->Floats;
+
+		delete [] it->Ulongs;
+		delete [] it->ResRefs;
+	}
+
+	m_ColumnCaches.clear( );
+}
+
+//
+// Define the conversions used to build typed column caches.  These match the
+// conversions historically applied to the column text by each accessor.
+//
+
+static
+void
+ConvertInt(
+	__in const char * Text,
+	__out int & Value
+	)
+{
+	Value = (int) strtol( Text, NULL, 0 );
+}
+
+static
+void
+ConvertUlong(
+	__in const char * Text,
+	__out unsigned long & Value
+	)
+{
+	Value = strtoul( Text, NULL, 0 );
+}
+
+static
+void
+ConvertFloat(
+	__in const char * Text,
+	__out float & Value
+	)
+{
+	Value = (float) atof( Text );
+}
+
+static
+void
+ConvertResRef(
+	__in const char * Text,
+	__out NWN::ResRef32 & Value
+	)
+{
+	ZeroMemory( &Value, sizeof( Value ) );
+	memcpy( &Value, Text, min( strlen( Text ), sizeof( Value ) ) );
+}
+
+template< typename T >
+const T *
+TwoDAFileReader::GetTypedColumn(
+	__in ColumnHandle Column,
+	__in T * ColumnCache::* Slot,
+	__in void (* Convert)( __in const char * Text, __out T & Value )
+	) const
+/*++
+
+Routine Description:
+
+	This routine returns the typed contents of a column, converting the column
+	text and caching the result if this is the first such access.
+
+	Concurrent first accesses may each build the column; only the first to
+	publish its result wins, and the others discard theirs.
+
+Arguments:
+
+	Column - Supplies the (valid) column handle.
+
+	Slot - Supplies the column cache slot that holds the typed contents.
+
+	Convert - Supplies the conversion routine for an individual cell.
+
+Return Value:
+
+	The routine returns a pointer to an array holding one typed value per row.
+	On failure, the routine raises an std::exception.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	ColumnCache & Cache = m_ColumnCaches[ Column ];
+	T           * Values;
+	T           * Existing;
+
+	Values = *(T * volatile *) &(Cache.*Slot);
+
+	if (Values != NULL)
+		return Values;
+
+	Values = new T[ m_RowCount ? m_RowCount : 1 ];
+
+	for (size_t Row = 0; Row < m_RowCount; Row += 1)
+	{
+		unsigned long Offset;
+
+		Offset = m_CellTable[ Column * m_RowCount + Row ];
+
+		if (Offset == EMPTY_CELL)
+			ZeroMemory( &Values[ Row ], sizeof( T ) );
+		else
+			Convert( &m_Pool[ Offset ], Values[ Row ] );
+	}
+
+	Existing = (T *) InterlockedCompareExchangePointer(
+		(PVOID volatile *) &(Cache.*Slot),
+		Values,
+		NULL);
+
+	if (Existing != NULL)
+	{
+		delete [] Values;
+		return Existing;
+	}
+
+	return Values;
+}
+
+const int *
+TwoDAFileReader::GetIntColumn(
+	__in ColumnHandle Column
+	) const
+/*++
+
+Routine Description:
+
+	This routine returns the integer contents of a column.
+
+Arguments:
+
+	Column - Supplies the (valid) column handle.
+
+Return Value:
+
+	The routine returns a pointer to an array holding one value per row.  On
+	failure, the routine raises an std::exception.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	return GetTypedColumn( Column, &ColumnCache::Ints, ConvertInt );
+}
+
+const unsigned long *
+TwoDAFileReader::GetUlongColumn(
+	__in ColumnHandle Column
+	) const
+/*++
+
+Routine Description:
+
+	This routine returns the unsigned integer contents of a column.
+
+Arguments:
+
+	Column - Supplies the (valid) column handle.
+
+Return Value:
+
+	The routine returns a pointer to an array holding one value per row.  On
+	failure, the routine raises an std::exception.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	return GetTypedColumn( Column, &ColumnCache::Ulongs, ConvertUlong );
+}
+
+const float *
+TwoDAFileReader::GetFloatColumn(
+	__in ColumnHandle Column
+	) const
+/*++
+
+Routine Description:
+
+	This routine returns the floating point contents of a column.
+
+Arguments:
+
+	Column - Supplies the (valid) column handle.
+
+Return Value:
+
+	The routine returns a pointer to an array holding one value per row.  On
+	failure, the routine raises an std::exception.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	return GetTypedColumn( Column, &ColumnCache::Floats, ConvertFloat );
+}
+
+const NWN::ResRef32 *
+TwoDAFileReader::GetResRefColumn(
+	__in ColumnHandle Column
+	) const
+/*++
+
+Routine Description:
+
+	This routine returns the RESREF contents of a column.  Values longer than
+	a RESREF are truncated.
+
+Arguments:
+
+	Column - Supplies the (valid) column handle.
+
+Return Value:
+
+	The routine returns a pointer to an array holding one value per row.  On
+	failure, the routine raises an std::exception.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	return GetTypedColumn( Column, &ColumnCache::ResRefs, ConvertResRef );
+}
+
+TwoDAFileReader *
+TwoDAFileReader::LoadBinaryCache(
+	__in const std::string & CacheFileName,
+	__in ULONG64 SourceSize,
+	__in ULONG64 SourceHash
+	)
+/*++
+
+Routine Description:
+
+	This routine creates a TwoDAFileReader object from a binary 2DA cache
+	file.  The cache file is only used if it was built from a text 2DA of the
+	supplied size and content hash.
+
+Arguments:
+
+	CacheFileName - Supplies the path to the binary 2DA cache file.
+
+	SourceSize - Supplies the size, in bytes, of the current text 2DA.
+
+	SourceHash - Supplies the content hash of the current text 2DA, as computed
+	             by ComputeSourceHash.
+
+Return Value:
+
+	The routine returns a pointer to a new TwoDAFileReader object, which the
+	caller assumes ownership of, on success.  If the cache file was missing,
+	stale or damaged, the routine returns NULL.  On catastrophic failure, an
+	std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	TwoDAFileReader * Reader;
+
+	Reader = new TwoDAFileReader( );
+
+	try
+	{
+		if (!Reader->MapBinaryCache( CacheFileName, SourceSize, SourceHash ))
+		{
+			delete Reader;
+			return NULL;
+		}
+	}
+	catch (...)
+	{
+		delete Reader;
+		throw;
+	}
+
+	return Reader;
+}
+
+bool
+TwoDAFileReader::MapBinaryCache(
+	__in const std::string & CacheFileName,
+	__in ULONG64 SourceSize,
+	__in ULONG64 SourceHash
+	)
+/*++
+
+Routine Description:
+
+	This routine maps a binary 2DA cache file and validates it in its entirety,
+	so that no accessor need perform any bounds checking beyond the row and
+	column ranges.  The column names and index are then built, and any typed
+	columns present in the cache file are installed in the column cache.
+
+Arguments:
+
+	CacheFileName - Supplies the path to the binary 2DA cache file.
+
+	SourceSize - Supplies the size, in bytes, of the current text 2DA.
+
+	SourceHash - Supplies the content hash of the current text 2DA.
+
+Return Value:
+
+	The routine returns true if the cache file was mapped, else false if the
+	cache file was missing, stale or damaged.  On catastrophic failure, an
+	std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	HANDLE               File;
+	HANDLE               Section;
+	LARGE_INTEGER        Size;
+	const BinaryHeader * Header;
+	const BinaryColumn * Columns;
+	ULONG64              CellCount;
+	ColumnCache          EmptyCache;
+
+	File = CreateFileA(
+		CacheFileName.c_str( ),
+		GENERIC_READ,
+		FILE_SHARE_READ | FILE_SHARE_DELETE,
+		NULL,
+		OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL,
+		NULL);
+
+	if (File == INVALID_HANDLE_VALUE)
+		return false;
+
+	if ((!GetFileSizeEx( File, &Size )) ||
+	    ((ULONG64) Size.QuadPart < sizeof( BinaryHeader )) ||
+	    ((ULONG64) Size.QuadPart > (SIZE_T) -1))
+	{
+		CloseHandle( File );
+		return false;
+	}
+
+	Section = CreateFileMapping( File, NULL, PAGE_READONLY, 0, 0, NULL );
+
+	CloseHandle( File );
+
+	if (Section == NULL)
+		return false;
+
+	m_MappedView = (const unsigned char *) MapViewOfFile(
+		Section,
+		FILE_MAP_READ,
+		0,
+		0,
+		0);
+
+	CloseHandle( Section );
+
+	if (m_MappedView == NULL)
+		return false;
+
+	m_MappedSize = (size_t) Size.QuadPart;
+
+	//
+	// Validate the header and the placement of each table.
+	//
+
+	Header    = (const BinaryHeader *) m_MappedView;
+	CellCount = (ULONG64) Header->ColumnCount * Header->RowCount;
+
+	if ((Header->Signature != BINARY_SIGNATURE) ||
+	    (Header->Version != BINARY_VERSION) ||
+	    (Header->SourceSize != SourceSize) ||
+	    (Header->SourceHash != SourceHash) ||
+	    (Header->FileSize != m_MappedSize) ||
+	    (!IsValidSpan(
+	        sizeof( BinaryHeader ),
+	        (ULONG64) Header->ColumnCount * sizeof( BinaryColumn ) )) ||
+	    (!IsValidSpan(
+	        Header->CellOffset,
+	        CellCount * sizeof( unsigned long ) )) ||
+	    (Header->CellOffset % __alignof( unsigned long )) ||
+	    (!IsValidSpan( Header->StringPoolOffset, Header->StringPoolSize )) ||
+	    (Header->StringPoolSize == 0) ||
+	    (Header->StringPoolSize >= EMPTY_CELL) ||
+	    (m_MappedView[ (size_t) (Header->StringPoolOffset + Header->StringPoolSize - 1) ] != '\0'))
+	{
+		return false;
+	}
+
+	m_Pool      = (const char *) (m_MappedView + Header->StringPoolOffset);
+	m_PoolSize  = (size_t) Header->StringPoolSize;
+	m_CellTable = (const unsigned long *) (m_MappedView + Header->CellOffset);
+	m_RowCount  = Header->RowCount;
+
+	//
+	// Every cell must reference a string within the pool.  As the pool ends
+	// with a null terminator, every referenced string is then terminated.
+	//
+
+	for (ULONG64 i = 0; i < CellCount; i += 1)
+	{
+		if ((m_CellTable[ i ] != EMPTY_CELL) && (m_CellTable[ i ] >= m_PoolSize))
+			return false;
+	}
+
+	Columns = (const BinaryColumn *) (Header + 1);
+
+	for (unsigned long i = 0; i < Header->ColumnCount; i += 1)
+	{
+		if ((Columns[ i ].NameOffset >= m_PoolSize) ||
+		    ((Columns[ i ].IntsOffset != 0) &&
+		     ((!IsValidSpan(
+		          Columns[ i ].IntsOffset,
+		          (ULONG64) m_RowCount * sizeof( int ) )) ||
+		      (Columns[ i ].IntsOffset % __alignof( int )))) ||
+		    ((Columns[ i ].FloatsOffset != 0) &&
+		     ((!IsValidSpan(
+		          Columns[ i ].FloatsOffset,
+		          (ULONG64) m_RowCount * sizeof( float ) )) ||
+		      (Columns[ i ].FloatsOffset % __alignof( float )))))
+		{
+			return false;
+		}
+	}
+
+	//
+	// Build the column names and index, and install any stored typed columns.
+	// The stored typed columns are never written to, they are only published
+	// through the (otherwise writable) column cache.
+	//
+
+	ZeroMemory( &EmptyCache, sizeof( EmptyCache ) );
+
+	m_Columns.reserve( Header->ColumnCount );
+	m_ColumnCaches.resize( Header->ColumnCount, EmptyCache );
+
+	for (unsigned long i = 0; i < Header->ColumnCount; i += 1)
+	{
+		m_Columns.push_back( &m_Pool[ Columns[ i ].NameOffset ] );
+		m_ColumnIndex.insert( ColumnIndexMap::value_type( m_Columns.back( ), (size_t) i ) );
+
+		if (Columns[ i ].IntsOffset != 0)
+			m_ColumnCaches[ i ].Ints = (int *) (m_MappedView + Columns[ i ].IntsOffset);
+
+		if (Columns[ i ].FloatsOffset != 0)
+			m_ColumnCaches[ i ].Floats = (float *) (m_MappedView + Columns[ i ].FloatsOffset);
+	}
+
+	return true;
+}
+
+void
+TwoDAFileReader::WriteBinaryCache(
+	__in const std::string & CacheFileName,
+	__in ULONG64 SourceSize,
+	__in ULONG64 SourceHash
+	) const
+/*++
+
+Routine Description:
+
+	This routine writes the 2DA contents out as a binary 2DA cache file.  The
+	cache file is written to a temporary file first and then renamed over any
+	existing cache file.
+
+	Columns whose values are all integers are stored with their integer
+	conversions, and columns whose values are all otherwise numeric are stored
+	with their floating point conversions, so that loading the cache file need
+	not convert them again.  Other typed conversions are built on demand.
+
+Arguments:
+
+	CacheFileName - Supplies the path to the binary 2DA cache file.
+
+	SourceSize - Supplies the size, in bytes, of the text 2DA that the reader
+	             was parsed from.
+
+	SourceHash - Supplies the content hash of the text 2DA that the reader was
+	             parsed from.
+
+Return Value:
+
+	None.  Raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	std::vector< unsigned char > Image;
+	std::vector< BinaryColumn >  Columns;
+	std::vector< char >          Names;
+	BinaryHeader                 Header;
+	ULONG64                      Offset;
+	size_t                       ColumnCount;
+	std::string                  TempFileName;
+	HANDLE                       File;
+	DWORD                        Written;
+	CHAR                         TempSuffix[ 32 ];
+	bool                         Succeeded;
+
+	ColumnCount = m_Columns.size( );
+
+	if ((ColumnCount > ULONG_MAX) || (m_RowCount > ULONG_MAX))
+		throw std::runtime_error( "2DA too large to cache." );
+
+	//
+	// Lay out the header and column directory, followed by the cell table,
+	// the typed columns and the string pool (with the column names appended).
+	//
+
+	Columns.resize( ColumnCount );
+
+	Offset  = sizeof( BinaryHeader ) + ColumnCount * sizeof( BinaryColumn );
+	Offset += (ULONG64) ColumnCount * m_RowCount * sizeof( unsigned long );
+
+	for (size_t Column = 0; Column < ColumnCount; Column += 1)
+	{
+		bool Integral;
+		bool Numeric;
+		bool Populated;
+
+		Integral  = true;
+		Numeric   = true;
+		Populated = false;
+
+		for (size_t Row = 0; Row < m_RowCount; Row += 1)
+		{
+			unsigned long   CellOffset;
+			const char    * Text;
+			char          * End;
+
+			CellOffset = m_CellTable[ Column * m_RowCount + Row ];
+
+			if (CellOffset == EMPTY_CELL)
+				continue;
+
+			Text      = &m_Pool[ CellOffset ];
+			Populated = true;
+
+			if (Text[ 0 ] == '\0')
+			{
+				Numeric = false;
+				break;
+			}
+
+			if (Integral)
+			{
+				strtol( Text, &End, 0 );
+
+				if (*End != '\0')
+					Integral = false;
+			}
+
+			if (!Integral)
+			{
+				strtod( Text, &End );
+
+				if (*End != '\0')
+				{
+					Numeric = false;
+					break;
+				}
+			}
+		}
+
+		ZeroMemory( &Columns[ Column ], sizeof( BinaryColumn ) );
+
+		Columns[ Column ].NameOffset = (unsigned long) (m_PoolSize + Names.size( ));
+
+		Names.insert( Names.end( ), m_Columns[ Column ].begin( ), m_Columns[ Column ].end( ) );
+		Names.push_back( '\0' );
+
+		if ((!Populated) || (!Numeric))
+			continue;
+
+		if (Integral)
+		{
+			Columns[ Column ].IntsOffset = Offset;
+			Offset += m_RowCount * sizeof( int );
+		}
+		else
+		{
+			Columns[ Column ].FloatsOffset = Offset;
+			Offset += m_RowCount * sizeof( float );
+		}
+	}
+
+	if ((m_PoolSize + Names.size( ) >= EMPTY_CELL) ||
+	    (Offset + m_PoolSize + Names.size( ) > ULONG_MAX))
+	{
+		throw std::runtime_error( "2DA too large to cache." );
+	}
+
+	Header.Signature        = BINARY_SIGNATURE;
+	Header.Version          = BINARY_VERSION;
+	Header.ColumnCount      = (unsigned long) ColumnCount;
+	Header.RowCount         = (unsigned long) m_RowCount;
+	Header.SourceSize       = SourceSize;
+	Header.SourceHash       = SourceHash;
+	Header.CellOffset       = sizeof( BinaryHeader ) + ColumnCount * sizeof( BinaryColumn );
+	Header.StringPoolOffset = Offset;
+	Header.StringPoolSize   = m_PoolSize + Names.size( );
+	Header.FileSize         = Offset + Header.StringPoolSize;
+
+	Image.resize( (size_t) Header.FileSize );
+
+	memcpy( &Image[ 0 ], &Header, sizeof( Header ) );
+
+	if (ColumnCount != 0)
+	{
+		memcpy(
+			&Image[ sizeof( BinaryHeader ) ],
+			&Columns[ 0 ],
+			ColumnCount * sizeof( BinaryColumn ) );
+	}
+
+	if (ColumnCount * m_RowCount != 0)
+	{
+		memcpy(
+			&Image[ (size_t) Header.CellOffset ],
+			m_CellTable,
+			ColumnCount * m_RowCount * sizeof( unsigned long ) );
+	}
+
+	for (size_t Column = 0; Column < ColumnCount; Column += 1)
+	{
+		if (m_RowCount == 0)
+			break;
+
+		if (Columns[ Column ].IntsOffset != 0)
+		{
+			memcpy(
+				&Image[ (size_t) Columns[ Column ].IntsOffset ],
+				GetIntColumn( Column ),
+				m_RowCount * sizeof( int ) );
+		}
+
+		if (Columns[ Column ].FloatsOffset != 0)
+		{
+			memcpy(
+				&Image[ (size_t) Columns[ Column ].FloatsOffset ],
+				GetFloatColumn( Column ),
+				m_RowCount * sizeof( float ) );
+		}
+	}
+
+	if (m_PoolSize != 0)
+		memcpy( &Image[ (size_t) Header.StringPoolOffset ], m_Pool, m_PoolSize );
+
+	if (!Names.empty( ))
+	{
+		memcpy(
+			&Image[ (size_t) Header.StringPoolOffset + m_PoolSize ],
+			&Names[ 0 ],
+			Names.size( ) );
+	}
+
+	//
+	// Write the new cache file out.
+	//
+
+	StringCbPrintfA(
+		TempSuffix,
+		sizeof( TempSuffix ),
+		".%lu.tmp",
+		GetCurrentProcessId( ) );
+
+	TempFileName  = CacheFileName;
+	TempFileName += TempSuffix;
+
+	File = CreateFileA(
+		TempFileName.c_str( ),
+		GENERIC_WRITE,
+		0,
+		NULL,
+		CREATE_ALWAYS,
+		FILE_ATTRIBUTE_NORMAL,
+		NULL);
+
+	if (File == INVALID_HANDLE_VALUE)
+		throw std::runtime_error( "Failed to create binary 2DA cache file." );
+
+	Succeeded = (WriteFile(
+		File,
+		&Image[ 0 ],
+		(DWORD) Image.size( ),
+		&Written,
+		NULL) != FALSE) && (Written == Image.size( ));
+
+	CloseHandle( File );
+
+	if (Succeeded)
+	{
+		Succeeded = (MoveFileExA(
+			TempFileName.c_str( ),
+			CacheFileName.c_str( ),
+			MOVEFILE_REPLACE_EXISTING) != FALSE);
+	}
+
+	if (!Succeeded)
+	{
+		DeleteFileA( TempFileName.c_str( ) );
+
+		throw std::runtime_error( "Failed to write binary 2DA cache file." );
+	}
+}
+
+ULONG64
+TwoDAFileReader::ComputeSourceHash(
+	__in_bcount( DataSize ) const void * TwoDARawData,
+	__in size_t DataSize
+	)
+/*++
+
+Routine Description:
+
+	This routine computes the 64-bit FNV-1a hash of a text 2DA, which is used
+	to determine whether a binary 2DA cache file is current.
+
+Arguments:
+
+	TwoDARawData - Supplies the raw 2DA file contents.
+
+	DataSize - Supplies the length, in bytes, of the raw 2DA file contents.
+
+Return Value:
+
+	The routine returns the content hash.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	const unsigned char * p;
+	ULONG64               Hash;
+
+	p    = (const unsigned char *) TwoDARawData;
+	Hash = 14695981039346656037ui64;
+
+	for (size_t i = 0; i < DataSize; i += 1)
+	{
+		Hash ^= p[ i ];
+		Hash *= 1099511628211ui64;
+	}
+
+	return Hash;
+}
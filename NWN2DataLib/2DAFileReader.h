@@ -38,6 +38,12 @@ public:
 		__in const std::string & FileName
 		);
 
+	TwoDAFileReader(
+		__in_bcount( DataSize ) const void * TwoDARawData,
+		__in size_t DataSize,
+		__in const std::string & ResourceName
+		);
+
 	//
 	// Destructor.
 	//
@@ -46,6 +52,57 @@ public:
 	~TwoDAFileReader(
 		);
 
+	//
+	// Load a binary 2DA cache file, as written by WriteBinaryCache.  The cache
+	// file is mapped and its contents are used in place.
+	//
+	// The routine returns NULL if the cache file does not exist, is not valid,
+	// or was not built from a 2DA with the supplied size and content hash.
+	// Raises an std::exception on allocation failure.
+	//
+
+	static
+	TwoDAFileReader *
+	LoadBinaryCache(
+		__in const std::string & CacheFileName,
+		__in ULONG64 SourceSize,
+		__in ULONG64 SourceHash
+		);
+
+	//
+	// Write the 2DA contents out as a binary 2DA cache file, tagged with the
+	// size and content hash of the text 2DA it was parsed from.  Any existing
+	// cache file is replaced.  Raises an std::exception on failure.
+	//
+
+	void
+	WriteBinaryCache(
+		__in const std::string & CacheFileName,
+		__in ULONG64 SourceSize,
+		__in ULONG64 SourceHash
+		) const;
+
+	//
+	// Compute the content hash of a text 2DA, for use with the binary 2DA
+	// cache.
+	//
+
+	static
+	ULONG64
+	ComputeSourceHash(
+		__in_bcount( DataSize ) const void * TwoDARawData,
+		__in size_t DataSize
+		);
+
+	//
+	// Define a column handle.  Callers that repeatedly access the same column
+	// may resolve the column name to a handle once, via GetColumnHandle, and
+	// then use the handle-based accessors, which do not need to look up the
+	// column name.  A handle is only meaningful for the reader that issued it.
+	//
+
+	typedef size_t ColumnHandle;
+
 	//
 	// Look up the value of a particular column at a given row index.
 	//
@@ -60,9 +117,98 @@ public:
 		__out std::string & Value
 		) const;
 
+	//
+	// Resolve a column name to a column handle.  The routine returns false if
+	// the .2DA has no such column.
+	//
+
+	inline
+	bool
+	GetColumnHandle(
+		__in const std::string & Column,
+		__out ColumnHandle & Handle
+		) const
+	{
+		ColumnIndexMap::const_iterator it;
+
+		it = m_ColumnIndex.find( Column );
+
+		if (it == m_ColumnIndex.end( ))
+			return false;
+
+		Handle = it->second;
+
+		return true;
+	}
+
+	//
+	// Return the text of a particular column at a given row index.  The
+	// returned string remains valid for the lifetime of the reader.
+	//
+	// The routine returns NULL if no such column or row existed, or if the
+	// column value was the empty value ("****").
+	//
+
+	inline
+	const char *
+	Get2DAText(
+		__in ColumnHandle Column,
+		__in size_t Row
+		) const
+	{
+		unsigned long Offset;
+
+		if (!GetCellOffset( Column, Row, Offset ))
+			return NULL;
+
+		return &m_Pool[ Offset ];
+	}
+
 	//
 	// Various datatype wrappers around Get2DAString.
 	//
+	// The typed column contents are converted once, on first access to a
+	// column, and are cached thereafter.  The conversions assume a radix of
+	// zero; any other radix is converted from the column text on each call.
+	//
+
+	inline
+	bool
+	Get2DAString(
+		__in ColumnHandle Column,
+		__in size_t Row,
+		__out std::string & Value
+		) const
+	{
+		const char * Text;
+
+		Text = Get2DAText( Column, Row );
+
+		if (Text == NULL)
+			return false;
+
+		Value = Text;
+
+		return true;
+	}
+
+	inline
+	bool
+	Get2DAInt(
+		__in ColumnHandle Column,
+		__in size_t Row,
+		__out int & Value
+		) const
+	{
+		unsigned long Offset;
+
+		if (!GetCellOffset( Column, Row, Offset ))
+			return false;
+
+		Value = GetIntColumn( Column )[ Row ];
+
+		return true;
+	}
 
 	inline
 	bool
@@ -73,12 +219,38 @@ public:
 		__in int Radix = 0
 		) const
 	{
-		std::string V;
+		const char * Text;
+
+		if (Row >= m_RowCount)
+			return false;
+
+		if (Radix == 0)
+			return Get2DAInt( GetColumnIndex( Column ), Row, Value );
+
+		Text = Get2DAText( GetColumnIndex( Column ), Row );
+
+		if (Text == NULL)
+			return false;
+
+		Value = (int) strtol( Text, NULL, Radix );
+
+		return true;
+	}
+
+	inline
+	bool
+	Get2DAUlong(
+		__in ColumnHandle Column,
+		__in size_t Row,
+		__out unsigned long & Value
+		) const
+	{
+		unsigned long Offset;
 
-		if (!Get2DAString( Column, Row, V ))
+		if (!GetCellOffset( Column, Row, Offset ))
 			return false;
 
-		Value = (int) strtol( V.c_str( ), NULL, Radix );
+		Value = GetUlongColumn( Column )[ Row ];
 
 		return true;
 	}
@@ -92,12 +264,20 @@ public:
 		__in int Radix = 0
 		) const
 	{
-		std::string V;
+		const char * Text;
+
+		if (Row >= m_RowCount)
+			return false;
 
-		if (!Get2DAString( Column, Row, V ))
+		if (Radix == 0)
+			return Get2DAUlong( GetColumnIndex( Column ), Row, Value );
+
+		Text = Get2DAText( GetColumnIndex( Column ), Row );
+
+		if (Text == NULL)
 			return false;
 
-		Value = strtoul( V.c_str( ), NULL, Radix );
+		Value = strtoul( Text, NULL, Radix );
 
 		return true;
 	}
@@ -105,20 +285,19 @@ public:
 	inline
 	bool
 	Get2DABool(
-		__in const std::string & Column,
+		__in ColumnHandle Column,
 		__in size_t Row,
 		__out bool & Value
 		) const
 	{
-		std::string V;
+		const char * Text;
 
-		if (!Get2DAString( Column, Row, V ))
-			return false;
+		Text = Get2DAText( Column, Row );
 
-		if (V.empty( ))
+		if ((Text == NULL) || (Text[ 0 ] == '\0'))
 			return false;
 
-		if ((V[ 0 ] == 't') || (V[ 0 ] == 'T') || (V[ 0 ] == '1'))
+		if ((Text[ 0 ] == 't') || (Text[ 0 ] == 'T') || (Text[ 0 ] == '1'))
 			Value = true;
 		else
 			Value = false;
@@ -128,22 +307,35 @@ public:
 
 	inline
 	bool
-	Get2DAResRef(
+	Get2DABool(
 		__in const std::string & Column,
 		__in size_t Row,
+		__out bool & Value
+		) const
+	{
+		if (Row >= m_RowCount)
+			return false;
+
+		return Get2DABool( GetColumnIndex( Column ), Row, Value );
+	}
+
+	inline
+	bool
+	Get2DAResRef(
+		__in ColumnHandle Column,
+		__in size_t Row,
 		__out NWN::ResRef32 & Value
 		) const
 	{
-		std::string V;
+		unsigned long Offset;
 
-		if (!Get2DAString( Column, Row, V ))
+		if (!GetCellOffset( Column, Row, Offset ))
 			return false;
 
-		if (V.empty( ))
+		if (m_Pool[ Offset ] == '\0')
 			return false;
 
-		ZeroMemory( &Value, sizeof( Value ) );
-		memcpy( &Value, V.data( ), min( V.size( ), sizeof( Value ) ) );
+		Value = GetResRefColumn( Column )[ Row ];
 
 		return true;
 	}
@@ -151,42 +343,88 @@ public:
 	inline
 	bool
 	Get2DAResRef(
-		__in const std::string & Column,
+		__in ColumnHandle Column,
 		__in size_t Row,
 		__out NWN::ResRef16 & Value
 		) const
 	{
-		std::string V;
+		NWN::ResRef32 ResRef;
 
-		if (!Get2DAString( Column, Row, V ))
-			return false;
+		//
+		// The cached RESREF is zero padded, so its leading portion is exactly
+		// the truncated 16-character RESREF.
+		//
 
-		if (V.empty( ))
+		if (!Get2DAResRef( Column, Row, ResRef ))
 			return false;
 
-		ZeroMemory( &Value, sizeof( Value ) );
-		memcpy( &Value, V.data( ), min( V.size( ), sizeof( Value ) ) );
+		C_ASSERT( sizeof( Value ) <= sizeof( ResRef ) );
+
+		memcpy( &Value, &ResRef, sizeof( Value ) );
 
 		return true;
 	}
 
 	inline
 	bool
-	Get2DAFloat(
+	Get2DAResRef(
+		__in const std::string & Column,
+		__in size_t Row,
+		__out NWN::ResRef32 & Value
+		) const
+	{
+		if (Row >= m_RowCount)
+			return false;
+
+		return Get2DAResRef( GetColumnIndex( Column ), Row, Value );
+	}
+
+	inline
+	bool
+	Get2DAResRef(
 		__in const std::string & Column,
 		__in size_t Row,
+		__out NWN::ResRef16 & Value
+		) const
+	{
+		if (Row >= m_RowCount)
+			return false;
+
+		return Get2DAResRef( GetColumnIndex( Column ), Row, Value );
+	}
+
+	inline
+	bool
+	Get2DAFloat(
+		__in ColumnHandle Column,
+		__in size_t Row,
 		__out float & Value
 		) const
 	{
-		std::string V;
+		unsigned long Offset;
 
-		if (!Get2DAString( Column, Row, V ))
+		if (!GetCellOffset( Column, Row, Offset ))
 			return false;
 
-		Value = (float) atof( V.c_str( ) );
+		Value = GetFloatColumn( Column )[ Row ];
 
 		return true;
 	}
+
+	inline
+	bool
+	Get2DAFloat(
+		__in const std::string & Column,
+		__in size_t Row,
+		__out float & Value
+		) const
+	{
+		if (Row >= m_RowCount)
+			return false;
+
+		return Get2DAFloat( GetColumnIndex( Column ), Row, Value );
+	}
+
 	//
 	// Return the count of valid rows in the .2DA.
 	//
@@ -196,7 +434,7 @@ public:
 	GetRowCount(
 		) const
 	{
-		return m_Rows.size( );
+		return m_RowCount;
 	}
 
 	//
@@ -221,22 +459,116 @@ public:
 		__in const std::string & ColumnName
 		) const
 	{
-		for (ColumnNameVec::const_iterator it = m_Columns.begin( );
-		     it != m_Columns.end( );
-		     ++it)
-		{
-			if (*it == ColumnName)
-				return true;
-		}
-
-		return false;
+		return (m_ColumnIndex.find( ColumnName ) != m_ColumnIndex.end( ));
 	}
 
 private:
 
 	typedef std::vector< std::string > ColumnNameVec;
-	typedef std::vector< std::string > RowValueVec;
-	typedef std::vector< RowValueVec > RowsVec;
+	typedef stdext::hash_map< std::string, size_t > ColumnIndexMap;
+	typedef std::vector< char > StringPoolVec;
+	typedef std::vector< unsigned long > CellOffsetVec;
+
+	//
+	// Define the interning map used while parsing, which maps each distinct
+	// cell value to its offset in the string pool.
+	//
+
+	typedef stdext::hash_map< std::string, unsigned long > StringInternMap;
+
+	//
+	// Define the lazily materialized typed contents of a column.  Each array,
+	// once built, holds one converted value per row (empty cells convert to
+	// zero) and is published with an interlocked exchange, so that concurrent
+	// readers need no lock.
+	//
+
+	struct ColumnCache
+	{
+		int           * Ints;
+		unsigned long * Ulongs;
+		float         * Floats;
+		NWN::ResRef32 * ResRefs;
+	};
+
+	typedef std::vector< ColumnCache > ColumnCacheVec;
+
+	//
+	// Define the parser state and line length limit.
+	//
+
+	typedef enum _PARSE_MODE
+	{
+		ModeFileHeader,
+		ModeFileHeader2,
+		ModeColumnHeader,
+		ModeContents
+	} PARSE_MODE, * PPARSE_MODE;
+
+	enum { MAX_LINE_LENGTH = 32768 };
+
+	//
+	// Define the cell offset that denotes the empty value ("****").
+	//
+
+	enum { EMPTY_CELL = 0xFFFFFFFF };
+
+	//
+	// Define the binary 2DA cache format.  The file consists of the header,
+	// the column directory, the column-major cell table, any typed column
+	// arrays, and finally the string pool, which also holds the column names.
+	// All offsets are relative to the start of the file.
+	//
+
+	enum
+	{
+		BINARY_SIGNATURE = 'AD2B',
+		BINARY_VERSION   = 1,
+
+		LAST_BINARY_CONSTANT
+	};
+
+	struct BinaryHeader
+	{
+		unsigned long Signature;
+		unsigned long Version;
+		unsigned long ColumnCount;
+		unsigned long RowCount;
+		ULONG64       SourceSize;
+		ULONG64       SourceHash;
+		ULONG64       FileSize;
+		ULONG64       CellOffset;
+		ULONG64       StringPoolOffset;
+		ULONG64       StringPoolSize;
+	};
+
+	struct BinaryColumn
+	{
+		unsigned long NameOffset;    // String pool offset
+		unsigned long Reserved;
+		ULONG64       IntsOffset;    // Zero if not present
+		ULONG64       FloatsOffset;  // Zero if not present
+	};
+
+	//
+	// Construct an empty reader, for use by LoadBinaryCache.
+	//
+
+	TwoDAFileReader(
+		);
+
+	//
+	// 2DA readers are not copyable, as they own their column caches.
+	//
+
+	TwoDAFileReader(
+		__in const TwoDAFileReader & other
+		);
+
+	TwoDAFileReader &
+	operator=(
+		__in const TwoDAFileReader & other
+		);
 
 	//
 	// Parse the on-disk format and read the base column listing in.
@@ -247,6 +579,154 @@ private:
 		__in const std::string & FileName
 		);
 
+	//
+	// Parse the in-memory format and read the base column listing in.
+	//
+
+	void
+	Parse2DABuffer(
+		__in_bcount( DataSize ) const void * TwoDARawData,
+		__in size_t DataSize,
+		__in const std::string & ResourceName
+		);
+
+	//
+	// Parse a single line of the 2DA, returning false at end of contents.
+	//
+
+	bool
+	Parse2DALine(
+		__inout char * Line,
+		__inout PARSE_MODE & Mode,
+		__inout StringInternMap & InternMap,
+		__in const std::string & FileName
+		);
+
+	//
+	// Add a cell value to the string pool, returning its offset.  Identical
+	// values share a single copy.
+	//
+
+	unsigned long
+	InternCellValue(
+		__in_ecount( Length ) const char * Text,
+		__in size_t Length,
+		__inout StringInternMap & InternMap,
+		__in const std::string & FileName
+		);
+
+	//
+	// Convert the row-major cell offsets accumulated by the parser into their
+	// final column-major layout, and build the column name index.
+	//
+
+	void
+	BuildColumns(
+		);
+
+	//
+	// Release all typed column caches.
+	//
+
+	void
+	FreeColumnCaches(
+		);
+
+	//
+	// Return the typed contents of a column, building them on first access.
+	//
+
+	const int *
+	GetIntColumn(
+		__in ColumnHandle Column
+		) const;
+
+	const unsigned long *
+	GetUlongColumn(
+		__in ColumnHandle Column
+		) const;
+
+	const float *
+	GetFloatColumn(
+		__in ColumnHandle Column
+		) const;
+
+	const NWN::ResRef32 *
+	GetResRefColumn(
+		__in ColumnHandle Column
+		) const;
+
+	template< typename T >
+	const T *
+	GetTypedColumn(
+		__in ColumnHandle Column,
+		__in T * ColumnCache::* Slot,
+		__in void (* Convert)( __in const char * Text, __out T & Value )
+		) const;
+
+	//
+	// Map and validate a binary 2DA cache file, and build the column index
+	// from it.  The routine returns false if the cache file is not usable.
+	//
+
+	bool
+	MapBinaryCache(
+		__in const std::string & CacheFileName,
+		__in ULONG64 SourceSize,
+		__in ULONG64 SourceHash
+		);
+
+	//
+	// Return whether a span lies entirely within the mapped cache file.
+	//
+
+	inline
+	bool
+	IsValidSpan(
+		__in ULONG64 Offset,
+		__in ULONG64 Length
+		) const
+	{
+		return (Offset <= m_MappedSize) && (Length <= m_MappedSize - Offset);
+	}
+
+	//
+	// Return whether a typed column array resides in the mapped cache file
+	// (and is thus not owned by the column cache).
+	//
+
+	inline
+	bool
+	IsMappedPointer(
+		__in const void * p
+		) const
+	{
+		return (m_MappedView != NULL) &&
+		       ((const unsigned char *) p >= m_MappedView) &&
+		       ((const unsigned char *) p < m_MappedView + m_MappedSize);
+	}
+
+	//
+	// Look up the string pool offset of a cell.  The routine returns false if
+	// the column or row is out of range, or if the cell is empty.
+	//
+
+	inline
+	bool
+	GetCellOffset(
+		__in ColumnHandle Column,
+		__in size_t Row,
+		__out unsigned long & Offset
+		) const
+	{
+		if ((Column >= m_Columns.size( )) || (Row >= m_RowCount))
+			return false;
+
+		Offset = m_CellTable[ Column * m_RowCount + Row ];
+
+		return (Offset != EMPTY_CELL);
+	}
+
 	//
 	// Look up a column index by column name.
 	//
@@ -257,11 +737,12 @@ private:
 		__in const std::string & Column
 		) const
 	{
-		for (size_t i = 0; i < m_Columns.size( ); i += 1)
-		{
-			if (m_Columns[ i ] == Column)
-				return i;
-		}
+		ColumnIndexMap::const_iterator it;
+
+		it = m_ColumnIndex.find( Column );
+
+		if (it != m_ColumnIndex.end( ))
+			return it->second;
 
 		try
 		{
@@ -282,9 +763,23 @@ private:
 	//
 	// Resource list data.
 	//
+	// Cell contents are stored as null terminated strings in a single string
+	// pool, and are referenced by offset from a column-major cell table.  The
+	// pool and cell table are either owned by the reader (if parsed from a
+	// text 2DA) or reside in a mapped binary 2DA cache file.
+	//
 
-	ColumnNameVec m_Columns; // Column names
-	RowsVec       m_Rows;    // Row contents
+	ColumnNameVec          m_Columns;      // Column names
+	ColumnIndexMap         m_ColumnIndex;  // Column name to column index
+	StringPoolVec          m_StringPool;   // Interned cell values
+	CellOffsetVec          m_Cells;        // Cell string pool offsets
+	const char           * m_Pool;         // Active string pool
+	size_t                 m_PoolSize;     // Active string pool length
+	const unsigned long  * m_CellTable;    // Active cell table
+	size_t                 m_RowCount;     // Count of rows
+	mutable ColumnCacheVec m_ColumnCaches; // Typed column contents
+	const unsigned char  * m_MappedView;   // Binary cache file view
+	size_t                 m_MappedSize;   // Binary cache file view length
 
 };
 
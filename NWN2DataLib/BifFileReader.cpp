@@ -349,6 +349,110 @@ Environment:
 	}
 }
 
+template< typename ResRefT >
+bool
+BifFileReader< ResRefT >::ReadEncapsulatedFiles(
+	__inout_ecount( Count ) ReadRequest * Requests,
+	__in size_t Count
+	)
+/*++
+
+Routine Description:
+
+	This routine logically reads a batch of ranges of encapsulated sub-files
+	within the BIF file.
+
+	Each range is translated to an extent of the BIF file, and the extents
+	are then read in file offset order, with nearby extents coalesced into a
+	single read.
+
+Arguments:
+
+	Requests - Supplies the read requests.  On return, the BytesRead and
+	           Succeeded fields of each request are filled in.
+
+	Count - Supplies the count of read requests.
+
+Return Value:
+
+	The routine returns a Boolean value indicating true if every request
+	succeeded, else false if any request failed.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	std::vector< FileWrapper::ReadExtent > Extents;
+	bool                                   AllSucceeded;
+
+	AllSucceeded = true;
+
+	try
+	{
+		Extents.reserve( Count );
+
+		for (size_t i = 0; i < Count; i += 1)
+		{
+			PCBIF_RESOURCE          ResElem;
+			FileWrapper::ReadExtent Extent;
+			size_t                  BytesToRead;
+
+			Requests[ i ].BytesRead = 0;
+			Requests[ i ].Succeeded = false;
+
+			ResElem = LookupResourceKey( ((ResID) Requests[ i ].File) - 1 );
+
+			if ((ResElem == NULL) || (Requests[ i ].Offset >= ResElem->FileSize))
+			{
+				AllSucceeded = false;
+				continue;
+			}
+
+			BytesToRead = min( Requests[ i ].BytesToRead, ResElem->FileSize - Requests[ i ].Offset );
+
+			Extent.Offset = (ULONGLONG) ResElem->Offset + Requests[ i ].Offset;
+			Extent.Length = BytesToRead;
+			Extent.Buffer = Requests[ i ].Buffer;
+
+			Extents.push_back( Extent );
+
+			Requests[ i ].BytesRead = BytesToRead;
+			Requests[ i ].Succeeded = true;
+		}
+
+		if (!Extents.empty( ))
+		{
+			m_FileWrapper.ReadExtents(
+				&Extents[ 0 ],
+				Extents.size( ),
+				"File Contents");
+
+			m_NextOffset = m_FileWrapper.GetFilePointer( );
+		}
+	}
+	catch (std::exception)
+	{
+		//
+		// The file position is no longer known, so force the next read to
+		// seek, and fail every request as we cannot tell which completed.
+		//
+
+		m_NextOffset = (ULONGLONG) -1;
+
+		for (size_t i = 0; i < Count; i += 1)
+		{
+			Requests[ i ].BytesRead = 0;
+			Requests[ i ].Succeeded = false;
+		}
+
+		return false;
+	}
+
+	return AllSucceeded;
+}
+
 template< typename ResRefT >
 size_t
 BifFileReader< ResRefT >::GetEncapsulatedFileSize(
@@ -543,6 +647,60 @@ Environment:
 	return AccessorTypeBif;
 }
 
+template< typename ResRefT >
+bool
+BifFileReader< ResRefT >::GetEncapsulatedFileMapping(
+	__in FileHandle File,
+	__out HANDLE * BackingFile,
+	__out ULONG64 * BackingFileOffset
+	)
+/*++
+
+Routine Description:
+
+	This routine returns the backing file handle and file offset of an
+	encapsulated file so that the caller may map the file contents directly.
+
+	BIF resources are always stored contiguously and without compression, so
+	any legal file handle may be mapped.
+
+Arguments:
+
+	File - Supplies the file handle to inquire about.
+
+	BackingFile - Receives the BIF file handle.  The handle remains owned by
+	              the BifFileReader object.
+
+	BackingFileOffset - Receives the offset of the encapsulated file's data
+	                    within the BIF file.
+
+Return Value:
+
+	The routine returns a Boolean value indicating true on success, else false
+	on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	PCBIF_RESOURCE          ResElem;
+
+	*BackingFile       = INVALID_HANDLE_VALUE;
+	*BackingFileOffset = 0;
+
+	ResElem = LookupResourceKey( ((ResID) File) - 1 );
+
+	if ((ResElem == NULL) || (m_File == INVALID_HANDLE_VALUE))
+		return false;
+
+	*BackingFile       = m_File;
+	*BackingFileOffset = (ULONG64) ResElem->Offset;
+
+	return true;
+}
+
 
 
 template< typename ResRefT >
@@ -584,6 +742,15 @@ Environment:
 	if (memcmp( &Header.Version, "V1  ", 4 ))
 		throw std::runtime_error( "Header.Version is not V1 (illegal BIF file)" );
 
+	//
+	// The resource table is read in full immediately, so ask for it to be
+	// brought in ahead of the parse.
+	//
+
+	m_FileWrapper.PrefetchRange(
+		Header.VariableTableOffset,
+		(ULONGLONG) Header.VariableResourceCount * sizeof( BIF_RESOURCE ));
+
 	m_FileWrapper.SeekOffset( Header.VariableTableOffset, "VariableTableOffset" );
 
 	for (unsigned long i = 0; i < Header.VariableResourceCount; i += 1)
@@ -603,6 +770,13 @@ Environment:
 
 		m_ResDir.push_back( Key );
 	}
+
+	//
+	// Resource contents are subsequently read on demand, in no particular
+	// order.
+	//
+
+	m_FileWrapper.SetAccessPattern( FileWrapper::AccessPatternRandom );
 }
 
 template BifFileReader< NWN::ResRef16 >;
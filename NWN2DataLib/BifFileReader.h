@@ -100,6 +100,18 @@ public:
 		__out_bcount( BytesToRead ) void * Buffer
 		);
 
+	//
+	// Read a batch of ranges of encapsulated files.  The reads are issued in
+	// BIF file offset order, and nearby ranges are coalesced.
+	//
+
+	virtual
+	bool
+	ReadEncapsulatedFiles(
+		__inout_ecount( Count ) ReadRequest * Requests,
+		__in size_t Count
+		);
+
 	//
 	// Return the size of a file.
 	//
@@ -153,6 +165,19 @@ public:
 		__out std::string & AccessorName
 		);
 
+	//
+	// Return the backing file handle and offset of an encapsulated file, for
+	// use in directly mapping the file contents.
+	//
+
+	virtual
+	bool
+	GetEncapsulatedFileMapping(
+		__in FileHandle File,
+		__out HANDLE * BackingFile,
+		__out ULONG64 * BackingFileOffset
+		);
+
 private:
 
 	//
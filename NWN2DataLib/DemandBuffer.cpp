@@ -0,0 +1,168 @@
+/*++
+
+Copyright (c) Ken Johnson (Skywing). All rights reserved.
+
+Module Name:
+
+	DemandBuffer.cpp
+
+Abstract:
+
+	This module houses the demand buffer object, which represents the
+	read-only, in-memory contents of a demand-loaded resource.
+
+--*/
+
+#include "Precomp.h"
+#include "DemandBuffer.h"
+
+DemandBuffer::DemandBuffer(
+	__in HANDLE File,
+	__in ULONG64 FileOffset,
+	__in size_t Size
+	)
+/*++
+
+Routine Description:
+
+	This routine constructs a new DemandBuffer object that is backed by a
+	mapped view of a region of a file.
+
+Arguments:
+
+	File - Supplies the file handle to map.  The handle must have been opened
+	       for read access.  The view remains valid after the handle is closed.
+
+	FileOffset - Supplies the offset of the first byte of the region to map.
+
+	Size - Supplies the length, in bytes, of the region to map.
+
+Return Value:
+
+	The newly constructed object.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+: m_MappedView( NULL ),
+  m_Data( NULL ),
+  m_Size( Size )
+{
+	SYSTEM_INFO SysInfo;
+	ULONG64     ViewOffset;
+	size_t      ViewDelta;
+	HANDLE      Section;
+	void      * View;
+
+	//
+	// A zero length region cannot be mapped (a zero length view would map the
+	// entire file), so simply represent it as an empty heap buffer.
+	//
+
+	if (Size == 0)
+		return;
+
+	//
+	// Views must start on an allocation granularity boundary, so round the
+	// view offset down and remember how far into the view the data begins.
+	//
+
+	GetSystemInfo( &SysInfo );
+
+	ViewOffset = FileOffset & ~((ULONG64) SysInfo.dwAllocationGranularity - 1);
+	ViewDelta  = (size_t) (FileOffset - ViewOffset);
+
+	if (ViewDelta + Size < Size)
+		throw std::runtime_error( "DemandBuffer view size overflow." );
+
+	Section = CreateFileMapping( File, NULL, PAGE_READONLY, 0, 0, NULL );
+
+	if (Section == NULL)
+		throw std::runtime_error( "CreateFileMapping failed." );
+
+	View = MapViewOfFile(
+		Section,
+		FILE_MAP_READ,
+		(DWORD) (ViewOffset >> 32),
+		(DWORD) (ViewOffset & 0xFFFFFFFF),
+		ViewDelta + Size);
+
+	CloseHandle( Section );
+
+	if (View == NULL)
+		throw std::runtime_error( "MapViewOfFile failed." );
+
+	m_MappedView = View;
+	m_Data       = (const unsigned char *) View + ViewDelta;
+}
+
+DemandBuffer::DemandBuffer(
+	__inout std::vector< unsigned char > & Contents
+	)
+/*++
+
+Routine Description:
+
+	This routine constructs a new DemandBuffer object that is backed by a
+	private heap buffer.
+
+Arguments:
+
+	Contents - Supplies the resource contents.  Ownership of the contents is
+	           transferred to the DemandBuffer object and the vector is left
+	           empty on return.
+
+Return Value:
+
+	The newly constructed object.
+
+Environment:
+
+	User mode.
+
+--*/
+: m_MappedView( NULL ),
+  m_Data( NULL ),
+  m_Size( 0 )
+{
+	m_Contents.swap( Contents );
+
+	if (!m_Contents.empty( ))
+	{
+		m_Data = &m_Contents[ 0 ];
+		m_Size = m_Contents.size( );
+	}
+}
+
+DemandBuffer::~DemandBuffer(
+	)
+/*++
+
+Routine Description:
+
+	This routine cleans up an already-existing DemandBuffer object.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	if (m_MappedView != NULL)
+	{
+		UnmapViewOfFile( m_MappedView );
+
+		m_MappedView = NULL;
+	}
+}
+
@@ -0,0 +1,152 @@
+/*++
+
+Copyright (c) Ken Johnson (Skywing). All rights reserved.
+
+Module Name:
+
+	DemandBuffer.h
+
+Abstract:
+
+	This module defines the demand buffer object, which represents the
+	read-only, in-memory contents of a demand-loaded resource.
+
+--*/
+
+#ifndef _PROGRAMS_NWN2DATALIB_DEMANDBUFFER_H
+#define _PROGRAMS_NWN2DATALIB_DEMANDBUFFER_H
+
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+//
+// Define the demand buffer object.  A demand buffer is a reference counted,
+// read-only span of memory that contains the entire contents of a resource.
+//
+// The span is backed either by a mapped view of the file that contains the
+// resource (for resources that are stored contiguously and uncompressed, such
+// as ERF, BIF or directory resources), or by a private heap buffer (for
+// resources that must be decompressed, such as deflated ZIP resources).
+//
+// Demand buffers are independent of the resource accessor that produced them
+// and remain valid even after the resource manager has unloaded its resource
+// providers.
+//
+
+class DemandBuffer
+{
+
+public:
+
+	typedef swutil::SharedPtr< DemandBuffer > Ptr;
+
+	//
+	// Construct a demand buffer that maps a region of a file.  The file
+	// handle need only remain valid for the duration of the constructor.
+	// Raises an std::exception on failure.
+	//
+
+	DemandBuffer(
+		__in HANDLE File,
+		__in ULONG64 FileOffset,
+		__in size_t Size
+		);
+
+	//
+	// Construct a demand buffer that assumes ownership of the contents of a
+	// heap buffer.  The supplied vector is left empty on return.
+	//
+
+	DemandBuffer(
+		__inout std::vector< unsigned char > & Contents
+		);
+
+	//
+	// Destructor.
+	//
+
+	~DemandBuffer(
+		);
+
+	//
+	// Return the address of the first byte of the resource contents.  The
+	// contents must not be modified.
+	//
+
+	inline
+	const unsigned char *
+	GetData(
+		) const
+	{
+		return m_Data;
+	}
+
+	//
+	// Return the length, in bytes, of the resource contents.
+	//
+
+	inline
+	size_t
+	GetSize(
+		) const
+	{
+		return m_Size;
+	}
+
+	//
+	// Return whether the resource contents are backed by a mapped view (as
+	// opposed to a private heap buffer).
+	//
+
+	inline
+	bool
+	IsMapped(
+		) const
+	{
+		return (m_MappedView != NULL);
+	}
+
+private:
+
+	//
+	// Demand buffers are not copyable; share them via the reference counted
+	// Ptr type instead.
+	//
+
+	DemandBuffer(
+		__in const DemandBuffer & other
+		);
+
+	DemandBuffer &
+	operator=(
+		__in const DemandBuffer & other
+		);
+
+	//
+	// Define the base address of the mapped view, if we are backed by a
+	// mapped view.  The view base may precede the data pointer as views must
+	// begin on an allocation granularity boundary.
+	//
+
+	void                         * m_MappedView;
+
+	//
+	// Define the heap buffer, if we are not backed by a mapped view.
+	//
+
+	std::vector< unsigned char >   m_Contents;
+
+	//
+	// Define the resource contents span.
+	//
+
+	const unsigned char          * m_Data;
+	size_t                         m_Size;
+
+};
+
+typedef DemandBuffer::Ptr DemandBufferPtr;
+
+#endif
+
@@ -51,7 +51,7 @@ Environment:
 	// Create directory file entries as necessary.
 	//
 
-	ScanDirectory( m_DirectoryName, 0 );
+	ScanDirectory( m_DirectoryName, 0, m_DirectoryEntries );
 }
 
 template< typename ResRefT >
@@ -390,6 +390,13 @@ Environment:
 	if ((size_t) FileIndex >= m_DirectoryEntries.size( ))
 		return false;
 
+	//
+	// Removed entries retain their file index but no longer name a resource.
+	//
+
+	if (m_DirectoryEntries[ (size_t) FileIndex ].RealFileName.empty( ))
+		return false;
+
 	memcpy(
 		&ResRef,
 		&m_DirectoryEntries[ (size_t) FileIndex ].Name,
@@ -464,11 +471,172 @@ Environment:
 	return AccessorTypeDirectory;
 }
 
+template< typename ResRefT >
+bool
+DirectoryFileReader< ResRefT >::GetEncapsulatedFileMapping(
+	__in FileHandle File,
+	__out HANDLE * BackingFile,
+	__out ULONG64 * BackingFileOffset
+	)
+/*++
+
+Routine Description:
+
+	This routine returns the backing file handle and file offset of an
+	encapsulated file so that the caller may map the file contents directly.
+
+	Directory resources are simply the raw file on disk, so the file handle is
+	the backing file handle itself.
+
+Arguments:
+
+	File - Supplies the file handle to inquire about.
+
+	BackingFile - Receives the operating system file handle.  The handle is
+	              only valid until the file handle is closed.
+
+	BackingFileOffset - Receives zero, as the resource spans the entire file.
+
+Return Value:
+
+	The routine returns a Boolean value indicating true on success, else false
+	on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	if (File == INVALID_FILE)
+	{
+		*BackingFile       = INVALID_HANDLE_VALUE;
+		*BackingFileOffset = 0;
+
+		return false;
+	}
+
+	*BackingFile       = (HANDLE) File;
+	*BackingFileOffset = 0;
+
+	return true;
+}
+
+template< typename ResRefT >
+void
+DirectoryFileReader< ResRefT >::EnableChangeWatch(
+	)
+/*++
+
+Routine Description:
+
+	This routine begins watching the directory for changes, such that the
+	directory entry table can be updated incrementally by PollChanges rather
+	than by rescanning the entire directory.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	if (m_Watcher.get( ) != NULL)
+		return;
+
+	//
+	// Index the file names of the existing entries, so that removal and
+	// modification notifications can be matched to their entries.
+	//
+	// The watcher is started after the directory was scanned, so any change
+	// made in between is only picked up when the file is next changed.
+	//
+
+	try
+	{
+		for (size_t i = 0; i < m_DirectoryEntries.size( ); i += 1)
+		{
+			if (m_DirectoryEntries[ i ].RealFileName.empty( ))
+				continue;
+
+			m_FileNames[ MakeFileNameKey( m_DirectoryEntries[ i ].RealFileName ) ] =
+				(FileId) i;
+		}
+
+		m_Watcher = new DirectoryWatcher(
+			m_DirectoryName.substr( 0, m_DirectoryName.size( ) - 2 ) );
+	}
+	catch (...)
+	{
+		m_FileNames.clear( );
+		throw;
+	}
+}
+
+template< typename ResRefT >
+void
+DirectoryFileReader< ResRefT >::PollChanges(
+	__inout ResourceChangeVec & Changes
+	)
+/*++
+
+Routine Description:
+
+	This routine applies all changes made to the directory since the last
+	poll to the directory entry table, and reports the affected entries.
+
+	Added files are appended to the table.  Removed files keep their file
+	index (so that the file indicies of other entries remain stable), but are
+	no longer reported by GetEncapsulatedFileEntry.
+
+Arguments:
+
+	Changes - Supplies the array to which a change is appended for each
+	          affected directory entry.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.  The caller must serialize the call with all other access to
+	the reader.
+
+--*/
+{
+	DirectoryWatcher::ChangeVec FileChanges;
+
+	if (m_Watcher.get( ) == NULL)
+		return;
+
+	if (!m_Watcher->Poll( FileChanges ))
+	{
+		Resynchronize( Changes );
+		return;
+	}
+
+	for (DirectoryWatcher::ChangeVec::const_iterator it = FileChanges.begin( );
+	     it != FileChanges.end( );
+	     ++it)
+	{
+		ApplyFileChange( *it, Changes );
+	}
+}
+
 template< typename ResRefT >
 void
 DirectoryFileReader< ResRefT >::ScanDirectory(
 	__in const std::string & Directory,
-	__in size_t RecursionLevel
+	__in size_t RecursionLevel,
+	__inout DirectoryEntryVec & Entries
 	)
 /*++
 
@@ -484,9 +652,11 @@ Arguments:
 
 	RecursionLevel - Supplies the recursion level.
 
+	Entries - Supplies the directory entry list to append entries to.
+
 Return Value:
 
-	The routine returns the count of files present.
+	None.
 
 Environment:
 
@@ -497,10 +667,6 @@ Environment:
 	WIN32_FIND_DATAA FindData;
 	HANDLE           Find;
 	std::string      Name;
-	ResType          Type;
-	char             Ext[ 32 ];
-	char             ResName[ MAX_PATH ];
-	size_t           Len;
 
 	if (RecursionLevel >= 256)
 		return;
@@ -527,7 +693,7 @@ Environment:
 				Name += FindData.cFileName;
 				Name += "//";
 
-				ScanDirectory( Name, RecursionLevel + 1 );
+				ScanDirectory( Name, RecursionLevel + 1, Entries );
 				continue;
 			}
 
@@ -536,58 +702,485 @@ Environment:
 			// if it is.
 			//
 
-			if (_splitpath_s(
-				FindData.cFileName,
-				NULL,
-				0,
-				NULL,
-				0,
-				ResName,
-				sizeof( ResName ),
-				Ext,
-				sizeof( Ext )) || (Ext[ 0 ] == '\0'))
-			{
+			DirectoryEntry Entry;
+
+			if (!MakeDirectoryEntry( Directory, FindData.cFileName, Entry ))
 				continue;
-			}
 
-			Type = ExtToResType( Ext + 1 );
+			Entries.push_back( Entry );
 
-			//
-			// Ignore unrecognized types.
-			//
+		} while (FindNextFileA( Find, &FindData ) );
+	}
+	catch (...)
+	{
+		FindClose( Find );
+		throw;
+	}
 
-			if (Type == NWN::ResINVALID)
-				continue;
+	FindClose( Find );
+}
 
-			//
-			// Create and append a directory entry for it.
-			//
+template< typename ResRefT >
+bool
+DirectoryFileReader< ResRefT >::MakeDirectoryEntry(
+	__in const std::string & Directory,
+	__in const char * FileName,
+	__out DirectoryEntry & Entry
+	)
+/*++
 
-			DirectoryEntry Entry;
+Routine Description:
 
-			Entry.RealFileName  = Directory;
-			Entry.RealFileName += FindData.cFileName;
-			Entry.Type          = Type;
+	This routine builds a directory entry for a file, if the file is of a
+	recognized resource type.
 
-			Len = strlen( ResName );
+Arguments:
 
-			_strlwr( ResName );
+	Directory - Supplies the name of the directory containing the file.  The
+	            name must have a path separator at the end.
 
-			ZeroMemory( &Entry.Name, sizeof( Entry.Name ) );
+	FileName - Supplies the name of the file within the directory.
 
-			memcpy( &Entry.Name, ResName, min( Len, sizeof( Entry.Name ) ) );
+	Entry - Receives the directory entry.
 
-			m_DirectoryEntries.push_back( Entry );
+Return Value:
 
-		} while (FindNextFileA( Find, &FindData ) );
+	The routine returns true if the entry was built, else false if the file is
+	not of a recognized resource type.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	ResType Type;
+	char    Ext[ 32 ];
+	char    ResName[ MAX_PATH ];
+	size_t  Len;
+
+	if (_splitpath_s(
+		FileName,
+		NULL,
+		0,
+		NULL,
+		0,
+		ResName,
+		sizeof( ResName ),
+		Ext,
+		sizeof( Ext )) || (Ext[ 0 ] == '\0'))
+	{
+		return false;
+	}
+
+	Type = ExtToResType( Ext + 1 );
+
+	//
+	// Ignore unrecognized types.
+	//
+
+	if (Type == NWN::ResINVALID)
+		return false;
+
+	Entry.RealFileName  = Directory;
+	Entry.RealFileName += FileName;
+	Entry.Type          = Type;
+
+	Len = strlen( ResName );
+
+	_strlwr( ResName );
+
+	ZeroMemory( &Entry.Name, sizeof( Entry.Name ) );
+
+	memcpy( &Entry.Name, ResName, min( Len, sizeof( Entry.Name ) ) );
+
+	return true;
+}
+
+template< typename ResRefT >
+std::string
+DirectoryFileReader< ResRefT >::MakeFileNameKey(
+	__in const std::string & RealFileName
+	)
+/*++
+
+Routine Description:
+
+	This routine returns the key under which a real file name is stored in the
+	file name map.  File names are compared without regard to case.
+
+Arguments:
+
+	RealFileName - Supplies the real file name of a directory entry.
+
+Return Value:
+
+	The routine returns the file name key.  The routine raises an
+	std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	std::string Key( RealFileName );
+
+	for (std::string::iterator it = Key.begin( ); it != Key.end( ); ++it)
+		*it = (char) tolower( (int) (unsigned char) *it );
+
+	return Key;
+}
+
+template< typename ResRefT >
+void
+DirectoryFileReader< ResRefT >::AppendEntry(
+	__in const DirectoryEntry & Entry,
+	__inout ResourceChangeVec & Changes
+	)
+/*++
+
+Routine Description:
+
+	This routine appends a new entry for an added file to the directory entry
+	table.  If the file already has an entry, then that entry is reported as
+	modified instead.
+
+Arguments:
+
+	Entry - Supplies the directory entry to append.
+
+	Changes - Supplies the array to which the change is appended.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	typename FileNameMap::const_iterator it;
+	std::string                          Key;
+	FileId                               FileIndex;
+
+	Key = MakeFileNameKey( Entry.RealFileName );
+	it  = m_FileNames.find( Key );
+
+	if (it != m_FileNames.end( ))
+	{
+		ReportChange( DirectoryWatcher::ChangeModified, it->second, Changes );
+		return;
+	}
+
+	FileIndex = (FileId) m_DirectoryEntries.size( );
+
+	m_DirectoryEntries.push_back( Entry );
+
+	try
+	{
+		m_FileNames.insert( typename FileNameMap::value_type( Key, FileIndex ) );
 	}
 	catch (...)
 	{
-		FindClose( Find );
+		m_DirectoryEntries.pop_back( );
 		throw;
 	}
 
-	FindClose( Find );
+	ReportChange( DirectoryWatcher::ChangeAdded, FileIndex, Changes );
+}
+
+template< typename ResRefT >
+void
+DirectoryFileReader< ResRefT >::RemoveEntry(
+	__in FileId FileIndex,
+	__inout ResourceChangeVec & Changes
+	)
+/*++
+
+Routine Description:
+
+	This routine marks the entry of a removed file as removed.  The entry
+	keeps its file index, but no longer names a resource.
+
+Arguments:
+
+	FileIndex - Supplies the file index of the entry to remove.
+
+	Changes - Supplies the array to which the change is appended.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	DirectoryEntry & Entry = m_DirectoryEntries[ (size_t) FileIndex ];
+
+	ReportChange( DirectoryWatcher::ChangeRemoved, FileIndex, Changes );
+
+	m_FileNames.erase( MakeFileNameKey( Entry.RealFileName ) );
+	Entry.RealFileName.clear( );
+}
+
+template< typename ResRefT >
+void
+DirectoryFileReader< ResRefT >::ReportChange(
+	__in ChangeType Change,
+	__in FileId FileIndex,
+	__inout ResourceChangeVec & Changes
+	) const
+/*++
+
+Routine Description:
+
+	This routine reports a change to a directory entry.
+
+Arguments:
+
+	Change - Supplies the type of change.
+
+	FileIndex - Supplies the file index of the entry that changed.
+
+	Changes - Supplies the array to which the change is appended.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	ResourceChange C;
+
+	C.Change    = Change;
+	C.FileIndex = FileIndex;
+	C.Name      = m_DirectoryEntries[ (size_t) FileIndex ].Name;
+	C.Type      = m_DirectoryEntries[ (size_t) FileIndex ].Type;
+
+	Changes.push_back( C );
+}
+
+template< typename ResRefT >
+void
+DirectoryFileReader< ResRefT >::ApplyFileChange(
+	__in const DirectoryWatcher::Change & FileChange,
+	__inout ResourceChangeVec & Changes
+	)
+/*++
+
+Routine Description:
+
+	This routine applies a single change notification, which may refer to
+	either a file or a subdirectory, to the directory entry table.
+
+Arguments:
+
+	FileChange - Supplies the change notification to apply.
+
+	Changes - Supplies the array to which a change is appended for each
+	          affected directory entry.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	typename FileNameMap::const_iterator it;
+	std::string                          RealFileName;
+	std::string                          Key;
+	std::string::size_type               Sep;
+	DWORD                                Attributes;
+
+	//
+	// Convert the relative name to the form used by ScanDirectory.
+	//
+
+	RealFileName = m_DirectoryName;
+
+	for (std::string::const_iterator c = FileChange.FileName.begin( );
+	     c != FileChange.FileName.end( );
+	     ++c)
+	{
+		if (*c == '\\')
+			RealFileName += "//";
+		else
+			RealFileName.push_back( *c );
+	}
+
+	Key = MakeFileNameKey( RealFileName );
+
+	switch (FileChange.Type)
+	{
+
+	case DirectoryWatcher::ChangeAdded:
+		Attributes = GetFileAttributesA( RealFileName.c_str( ) );
+
+		//
+		// The file may have been removed again already, in which case a
+		// removal notification follows.
+		//
+
+		if (Attributes == INVALID_FILE_ATTRIBUTES)
+			break;
+
+		if (Attributes & FILE_ATTRIBUTE_DIRECTORY)
+		{
+			DirectoryEntryVec Entries;
+
+			RealFileName += "//";
+
+			ScanDirectory( RealFileName, 1, Entries );
+
+			for (typename DirectoryEntryVec::const_iterator e = Entries.begin( );
+			     e != Entries.end( );
+			     ++e)
+			{
+				AppendEntry( *e, Changes );
+			}
+		}
+		else
+		{
+			DirectoryEntry Entry;
+
+			Sep = RealFileName.rfind( '/' );
+
+			if (Sep == std::string::npos)
+				break;
+
+			if (!MakeDirectoryEntry(
+				RealFileName.substr( 0, Sep + 1 ),
+				RealFileName.c_str( ) + Sep + 1,
+				Entry))
+			{
+				break;
+			}
+
+			AppendEntry( Entry, Changes );
+		}
+		break;
+
+	case DirectoryWatcher::ChangeRemoved:
+		it = m_FileNames.find( Key );
+
+		if (it != m_FileNames.end( ))
+		{
+			RemoveEntry( it->second, Changes );
+			break;
+		}
+
+		//
+		// The name may refer to a removed subdirectory, in which case every
+		// entry beneath it is removed.
+		//
+
+		Key += "//";
+
+		for (size_t i = 0; i < m_DirectoryEntries.size( ); i += 1)
+		{
+			const std::string & Name = m_DirectoryEntries[ i ].RealFileName;
+
+			if (Name.size( ) <= Key.size( ))
+				continue;
+
+			if (MakeFileNameKey( Name.substr( 0, Key.size( ) ) ) != Key)
+				continue;
+
+			RemoveEntry( (FileId) i, Changes );
+		}
+		break;
+
+	case DirectoryWatcher::ChangeModified:
+		it = m_FileNames.find( Key );
+
+		//
+		// Modification notifications for subdirectories are ignored; the
+		// files within them are reported individually.
+		//
+
+		if (it == m_FileNames.end( ))
+			break;
+
+		ReportChange( DirectoryWatcher::ChangeModified, it->second, Changes );
+		break;
+
+	}
+}
+
+template< typename ResRefT >
+void
+DirectoryFileReader< ResRefT >::Resynchronize(
+	__inout ResourceChangeVec & Changes
+	)
+/*++
+
+Routine Description:
+
+	This routine rescans the directory after change notifications were lost,
+	and brings the directory entry table in line with the directory contents.
+
+	As it is unknown which files changed, every surviving entry is reported as
+	modified.
+
+Arguments:
+
+	Changes - Supplies the array to which a change is appended for each
+	          affected directory entry.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	DirectoryEntryVec Entries;
+	FileNameMap       Present;
+
+	ScanDirectory( m_DirectoryName, 0, Entries );
+
+	for (size_t i = 0; i < Entries.size( ); i += 1)
+		Present[ MakeFileNameKey( Entries[ i ].RealFileName ) ] = (FileId) i;
+
+	for (size_t i = 0; i < m_DirectoryEntries.size( ); i += 1)
+	{
+		const std::string & Name = m_DirectoryEntries[ i ].RealFileName;
+
+		if (Name.empty( ))
+			continue;
+
+		if (Present.find( MakeFileNameKey( Name ) ) == Present.end( ))
+			RemoveEntry( (FileId) i, Changes );
+		else
+			ReportChange( DirectoryWatcher::ChangeModified, (FileId) i, Changes );
+	}
+
+	for (typename DirectoryEntryVec::const_iterator it = Entries.begin( );
+	     it != Entries.end( );
+	     ++it)
+	{
+		if (m_FileNames.find( MakeFileNameKey( it->RealFileName ) ) != m_FileNames.end( ))
+			continue;
+
+		AppendEntry( *it, Changes );
+	}
 }
 
 template DirectoryFileReader< NWN::ResRef32 >;
@@ -22,6 +22,7 @@ Abstract:
 #endif
 
 #include "ResourceAccessor.h"
+#include "DirectoryWatcher.h"
 
 //
 // Define the directory file reader object, used to access directory files.
@@ -148,6 +149,19 @@ public:
 		__out std::string & AccessorName
 		);
 
+	//
+	// Return the backing file handle and offset of an encapsulated file, for
+	// use in directly mapping the file contents.
+	//
+
+	virtual
+	bool
+	GetEncapsulatedFileMapping(
+		__in FileHandle File,
+		__out HANDLE * BackingFile,
+		__out ULONG64 * BackingFileOffset
+		);
+
 	//
 	// Return the path name of the directory as provided to the constructor.
 	//
@@ -176,29 +190,177 @@ public:
 		return m_DirectoryEntries[ (size_t) FileIndex ].RealFileName;
 	}
 
-private:
+	//
+	// Define a change to the directory entry table, as reported by
+	// PollChanges.  Name and Type identify the resource that was added,
+	// removed or modified at FileIndex.
+	//
+
+	typedef DirectoryWatcher::ChangeType ChangeType;
+
+	struct ResourceChange
+	{
+		ChangeType Change;
+		FileId     FileIndex;
+		ResRefT    Name;
+		ResType    Type;
+	};
+
+	typedef std::vector< ResourceChange > ResourceChangeVec;
 
 	//
-	// Scan directories to create directory file entries.
+	// Begin watching the directory for changes, so that PollChanges may
+	// update the directory entry table incrementally.  Raises an
+	// std::exception on failure.
 	//
 
 	void
-	ScanDirectory(
-		__in const std::string & Directory,
-		__in size_t RecursionLevel
+	EnableChangeWatch(
+		);
+
+	//
+	// Return whether the directory is being watched for changes.
+	//
+
+	inline
+	bool
+	IsChangeWatchEnabled(
+		) const
+	{
+		return (m_Watcher.get( ) != NULL);
+	}
+
+	//
+	// Apply all changes made to the directory since the last poll to the
+	// directory entry table, appending a ResourceChange for each affected
+	// entry to Changes.
+	//
+	// Added files are appended to the table.  Removed files keep their file
+	// index, but GetEncapsulatedFileEntry no longer reports them, so the file
+	// indicies of other entries remain stable.  If change notifications were
+	// lost, the directory is rescanned and every surviving entry is reported
+	// as modified.
+	//
+	// The caller must serialize the call with all other access to the reader.
+	// The routine raises an std::exception on failure.
+	//
+
+	void
+	PollChanges(
+		__inout ResourceChangeVec & Changes
 		);
 
+private:
+
 	struct DirectoryEntry
 	{
-		std::string RealFileName;
+		std::string RealFileName; // Empty if the file was removed
 		ResRefT     Name;
 		ResType     Type;
 	};
 
 	typedef std::vector< DirectoryEntry > DirectoryEntryVec;
 
-	DirectoryEntryVec m_DirectoryEntries;
-	std::string       m_DirectoryName;
+	//
+	// Map of lowercased real file names to the file indicies of the entries
+	// that are still present, maintained only while watching for changes.
+	//
+
+	typedef stdext::hash_map< std::string, FileId > FileNameMap;
+
+	typedef swutil::SharedPtr< DirectoryWatcher > DirectoryWatcherPtr;
+
+	//
+	// Scan directories to create directory file entries.
+	//
+
+	void
+	ScanDirectory(
+		__in const std::string & Directory,
+		__in size_t RecursionLevel,
+		__inout DirectoryEntryVec & Entries
+		);
+
+	//
+	// Build a directory entry for a file, returning false if the file is not
+	// of a recognized resource type.
+	//
+
+	static
+	bool
+	MakeDirectoryEntry(
+		__in const std::string & Directory,
+		__in const char * FileName,
+		__out DirectoryEntry & Entry
+		);
+
+	//
+	// Return the key under which a real file name is stored in the file name
+	// map.
+	//
+
+	static
+	std::string
+	MakeFileNameKey(
+		__in const std::string & RealFileName
+		);
+
+	//
+	// Append a new entry to the directory entry table, or report the existing
+	// entry as modified if the file is already present.
+	//
+
+	void
+	AppendEntry(
+		__in const DirectoryEntry & Entry,
+		__inout ResourceChangeVec & Changes
+		);
+
+	//
+	// Mark an entry as removed.
+	//
+
+	void
+	RemoveEntry(
+		__in FileId FileIndex,
+		__inout ResourceChangeVec & Changes
+		);
+
+	//
+	// Report a change to an entry.
+	//
+
+	void
+	ReportChange(
+		__in ChangeType Change,
+		__in FileId FileIndex,
+		__inout ResourceChangeVec & Changes
+		) const;
+
+	//
+	// Apply a single file (or subdirectory) change notification.
+	//
+
+	void
+	ApplyFileChange(
+		__in const DirectoryWatcher::Change & FileChange,
+		__inout ResourceChangeVec & Changes
+		);
+
+	//
+	// Rescan the directory and bring the directory entry table in line with
+	// its current contents, after change notifications were lost.
+	//
+
+	void
+	Resynchronize(
+		__inout ResourceChangeVec & Changes
+		);
+
+	DirectoryEntryVec   m_DirectoryEntries;
+	std::string         m_DirectoryName;
+	DirectoryWatcherPtr m_Watcher;
+	FileNameMap         m_FileNames;
 
 };
 
@@ -0,0 +1,366 @@
+/*++
+
+Copyright (c) Ken Johnson (Skywing). All rights reserved.
+
+Module Name:
+
+	DirectoryWatcher.cpp
+
+Abstract:
+
+	This module houses the directory watcher, which reports files that are
+	added to, removed from or changed within a directory hierarchy.
+
+--*/
+
+#include "Precomp.h"
+#include "DirectoryWatcher.h"
+
+DirectoryWatcher::DirectoryWatcher(
+	__in const std::string & DirectoryName
+	)
+/*++
+
+Routine Description:
+
+	This routine constructs a new DirectoryWatcher object and begins watching
+	the given directory (and its subdirectories) for changes.
+
+Arguments:
+
+	DirectoryName - Supplies the path of the directory to watch.
+
+Return Value:
+
+	The newly constructed object.  The routine raises an std::exception on
+	failure.
+
+Environment:
+
+	User mode.
+
+--*/
+: m_Directory( INVALID_HANDLE_VALUE ),
+  m_Event( NULL ),
+  m_ReadPending( false )
+{
+	ZeroMemory( &m_Overlapped, sizeof( m_Overlapped ) );
+
+	m_Buffer.resize( NOTIFY_BUFFER_SIZE / sizeof( DWORD ) );
+
+	m_Directory = CreateFileA(
+		DirectoryName.c_str( ),
+		FILE_LIST_DIRECTORY,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL,
+		OPEN_EXISTING,
+		FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED,
+		NULL);
+
+	if (m_Directory == INVALID_HANDLE_VALUE)
+		throw std::runtime_error( "Failed to open directory for watching." );
+
+	m_Event = CreateEvent( NULL, TRUE, FALSE, NULL );
+
+	if (m_Event == NULL)
+	{
+		CloseHandle( m_Directory );
+		throw std::runtime_error( "Failed to create directory watch event." );
+	}
+
+	try
+	{
+		IssueRead( );
+	}
+	catch (...)
+	{
+		CloseHandle( m_Event );
+		CloseHandle( m_Directory );
+		throw;
+	}
+}
+
+DirectoryWatcher::~DirectoryWatcher(
+	)
+/*++
+
+Routine Description:
+
+	This routine cleans up an already-existing DirectoryWatcher object.  Any
+	outstanding change notification request is cancelled.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	CancelRead( );
+
+	CloseHandle( m_Event );
+	CloseHandle( m_Directory );
+}
+
+bool
+DirectoryWatcher::Poll(
+	__inout ChangeVec & Changes
+	)
+/*++
+
+Routine Description:
+
+	This routine collects all change notifications that have completed since
+	the last poll, without waiting for further changes.
+
+Arguments:
+
+	Changes - Supplies the array to which changes are appended.
+
+Return Value:
+
+	The routine returns true if all changes were reported, else false if change
+	notifications were lost and the directory must be rescanned.  The routine
+	raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	bool Complete;
+
+	Complete = true;
+
+	for (;;)
+	{
+		DWORD Transferred;
+
+		if (!m_ReadPending)
+		{
+			IssueRead( );
+			continue;
+		}
+
+		if (!GetOverlappedResult(
+			m_Directory,
+			&m_Overlapped,
+			&Transferred,
+			FALSE))
+		{
+			if (GetLastError( ) == ERROR_IO_INCOMPLETE)
+				break;
+
+			//
+			// The request failed outright; notifications may have been
+			// missed, so ask for a rescan.  A new request is issued on the
+			// next poll.
+			//
+
+			m_ReadPending = false;
+			Complete      = false;
+			break;
+		}
+
+		m_ReadPending = false;
+
+		//
+		// A successful completion with no data indicates that the system
+		// notification buffer overflowed and changes were discarded.
+		//
+
+		if (Transferred == 0)
+		{
+			Complete = false;
+			continue;
+		}
+
+		DecodeNotifications( (size_t) Transferred, Changes );
+	}
+
+	return Complete;
+}
+
+void
+DirectoryWatcher::IssueRead(
+	)
+/*++
+
+Routine Description:
+
+	This routine issues an asynchronous change notification request against
+	the watched directory hierarchy.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	ResetEvent( m_Event );
+
+	ZeroMemory( &m_Overlapped, sizeof( m_Overlapped ) );
+
+	m_Overlapped.hEvent = m_Event;
+
+	if (!ReadDirectoryChangesW(
+		m_Directory,
+		&m_Buffer[ 0 ],
+		(DWORD) (m_Buffer.size( ) * sizeof( DWORD )),
+		TRUE,
+		FILE_NOTIFY_CHANGE_FILE_NAME  |
+		FILE_NOTIFY_CHANGE_DIR_NAME   |
+		FILE_NOTIFY_CHANGE_SIZE       |
+		FILE_NOTIFY_CHANGE_LAST_WRITE,
+		NULL,
+		&m_Overlapped,
+		NULL))
+	{
+		throw std::runtime_error( "Failed to watch directory for changes." );
+	}
+
+	m_ReadPending = true;
+}
+
+void
+DirectoryWatcher::DecodeNotifications(
+	__in size_t BufferLength,
+	__inout ChangeVec & Changes
+	)
+/*++
+
+Routine Description:
+
+	This routine decodes the records of a completed change notification
+	buffer, appending a change for each record.
+
+Arguments:
+
+	BufferLength - Supplies the count of valid bytes in the notification
+	               buffer.
+
+	Changes - Supplies the array to which changes are appended.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	const unsigned char * Buffer;
+	size_t                Offset;
+	char                  FileName[ MAX_PATH * 2 ];
+
+	Buffer = (const unsigned char *) &m_Buffer[ 0 ];
+	Offset = 0;
+
+	for (;;)
+	{
+		const FILE_NOTIFY_INFORMATION * Info;
+		Change                          C;
+		int                             Len;
+
+		if (BufferLength - Offset < sizeof( FILE_NOTIFY_INFORMATION ))
+			break;
+
+		Info = (const FILE_NOTIFY_INFORMATION *) (Buffer + Offset);
+
+		switch (Info->Action)
+		{
+
+		case FILE_ACTION_ADDED:
+		case FILE_ACTION_RENAMED_NEW_NAME:
+			C.Type = ChangeAdded;
+			break;
+
+		case FILE_ACTION_REMOVED:
+		case FILE_ACTION_RENAMED_OLD_NAME:
+			C.Type = ChangeRemoved;
+			break;
+
+		default:
+			C.Type = ChangeModified;
+			break;
+
+		}
+
+		Len = WideCharToMultiByte(
+			CP_ACP,
+			0,
+			Info->FileName,
+			(int) (Info->FileNameLength / sizeof( WCHAR )),
+			FileName,
+			(int) sizeof( FileName ),
+			NULL,
+			NULL);
+
+		if (Len > 0)
+		{
+			C.FileName.assign( FileName, (size_t) Len );
+
+			Changes.push_back( C );
+		}
+
+		if (Info->NextEntryOffset == 0)
+			break;
+
+		Offset += Info->NextEntryOffset;
+	}
+}
+
+void
+DirectoryWatcher::CancelRead(
+	)
+/*++
+
+Routine Description:
+
+	This routine cancels any outstanding change notification request, and
+	waits for the request to complete so that the notification buffer may be
+	safely released.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	DWORD Transferred;
+
+	if (!m_ReadPending)
+		return;
+
+	CancelIo( m_Directory );
+
+	GetOverlappedResult( m_Directory, &m_Overlapped, &Transferred, TRUE );
+
+	m_ReadPending = false;
+}
@@ -0,0 +1,151 @@
+/*++
+
+Copyright (c) Ken Johnson (Skywing). All rights reserved.
+
+Module Name:
+
+	DirectoryWatcher.h
+
+Abstract:
+
+	This module defines the directory watcher, which reports files that are
+	added to, removed from or changed within a directory hierarchy.
+
+--*/
+
+#ifndef _PROGRAMS_NWN2DATALIB_DIRECTORYWATCHER_H
+#define _PROGRAMS_NWN2DATALIB_DIRECTORYWATCHER_H
+
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+//
+// Define the directory watcher object.  The watcher monitors a directory and
+// all of its subdirectories, accumulating change notifications in the
+// background until the owner polls for them.  Polling never blocks.
+//
+// Change notifications name the affected file (or subdirectory) relative to
+// the watched directory, using backslash path separators.  A renamed file is
+// reported as the removal of its old name and the addition of its new name.
+//
+// Should the operating system discard notifications (for example, if too many
+// changes occur between polls), the owner is told so and must rescan the
+// directory in order to resynchronize.
+//
+// The watcher is not thread safe; only the owning thread may access it.
+//
+
+class DirectoryWatcher
+{
+
+public:
+
+	enum ChangeType
+	{
+		ChangeAdded,
+		ChangeRemoved,
+		ChangeModified,
+
+		LAST_CHANGE_TYPE
+	};
+
+	struct Change
+	{
+		ChangeType  Type;
+		std::string FileName;
+	};
+
+	typedef std::vector< Change > ChangeVec;
+
+	//
+	// Constructor.  Raises an std::exception on failure.
+	//
+
+	DirectoryWatcher(
+		__in const std::string & DirectoryName
+		);
+
+	//
+	// Destructor.
+	//
+
+	~DirectoryWatcher(
+		);
+
+	//
+	// Append all changes reported since the last poll to Changes.  The routine
+	// returns false if change notifications were lost, in which case the
+	// directory must be rescanned.  Raises an std::exception on failure.
+	//
+
+	bool
+	Poll(
+		__inout ChangeVec & Changes
+		);
+
+private:
+
+	enum
+	{
+		NOTIFY_BUFFER_SIZE = 64 * 1024,
+
+		LAST_WATCHER_CONSTANT
+	};
+
+	//
+	// Directory watchers are not copyable.
+	//
+
+	DirectoryWatcher(
+		__in const DirectoryWatcher & other
+		);
+
+	DirectoryWatcher &
+	operator=(
+		__in const DirectoryWatcher & other
+		);
+
+	//
+	// Issue a change notification request against the directory.  Raises an
+	// std::exception on failure.
+	//
+
+	void
+	IssueRead(
+		);
+
+	//
+	// Decode a completed change notification buffer into Changes.
+	//
+
+	void
+	DecodeNotifications(
+		__in size_t BufferLength,
+		__inout ChangeVec & Changes
+		);
+
+	//
+	// Cancel any outstanding change notification request and wait for it to
+	// complete.
+	//
+
+	void
+	CancelRead(
+		);
+
+	HANDLE                m_Directory;
+	HANDLE                m_Event;
+	OVERLAPPED            m_Overlapped;
+	bool                  m_ReadPending;
+
+	//
+	// The notification buffer must be DWORD aligned, hence the element type.
+	//
+
+	std::vector< DWORD >  m_Buffer;
+
+};
+
+#endif
+
@@ -47,69 +47,77 @@ Environment:
   m_NextOffset( 0 ),
   m_FileName( FileName )
 {
-	HANDLE File;
+	OpenErfFile( );
 
-	File = CreateFileA(
-		FileName.c_str( ),
-		GENERIC_READ,
-		FILE_SHARE_READ | FILE_SHARE_DELETE,
-		NULL,
-		OPEN_EXISTING,
-		FILE_ATTRIBUTE_NORMAL,
-		NULL);
-
-	if (File == INVALID_HANDLE_VALUE)
+	try
 	{
-		File = CreateFileA(
-				FileName.c_str( ),
-				GENERIC_READ,
-				FILE_SHARE_READ,
-				NULL,
-				OPEN_EXISTING,
-				FILE_ATTRIBUTE_NORMAL,
-				NULL);
+		ParseErfFile( );
+	}
+	catch (...)
+	{
+		CloseHandle( m_File );
 
-		if (File == INVALID_HANDLE_VALUE)
-			throw std::exception( "Failed to open ERF file." );
+		m_File = INVALID_HANDLE_VALUE;
+
+		throw;
 	}
 
-	m_File = File;
+	C_ASSERT( sizeof( ERF_HEADER ) == 160 );
+	C_ASSERT( sizeof( ERF_KEY ) == 8 + sizeof( ResRefT ) );
+	C_ASSERT( sizeof( RESOURCE_LIST_ELEMENT ) == 8 );
+}
 
-	//
-	// N.B.  We don't use memory mapped I/O for .HAKs due to address space 
-	//       pressure on 32-bit builds (if we do, we tend to run the client
-	//       out of address space in client extension mode).  On 64-bit builds,
-	//       the available address space is so much larger than the sum total
-	//       of content loaded that it's better to just use a mapped view.
-	//
+template< typename ResRefT >
+ErfFileReader< ResRefT >::ErfFileReader(
+	__in const std::string & FileName,
+	__in_ecount( EntryCount ) const ResourceIndexCache::Entry * Entries,
+	__in size_t EntryCount
+	)
+/*++
 
-#if !defined(_WIN64)
-	m_FileWrapper.SetFileHandle( File, false );
-#else
-	m_FileWrapper.SetFileHandle( File, true );
-#endif
+Routine Description:
 
-	try
-	{
-		m_FileSize = GetFileSize( File, NULL );
+	This routine constructs a new ErfFileReader object and opens an ERF file
+	by filename, using a cached directory listing in lieu of parsing the key
+	and resource lists of the file.
 
-		if ((m_FileSize == 0xFFFFFFFF) && (GetLastError( ) != NO_ERROR))
-			throw std::exception( "Failed to read file size." );
+Arguments:
 
-		ParseErfFile( );
+	FileName - Supplies the path to the ERF file.
+
+	Entries - Supplies the cached directory listing, as previously returned by
+	          GetDirectoryEntries for an unmodified copy of the file.
+
+	EntryCount - Supplies the count of cached directory entries.
+
+Return Value:
+
+	The newly constructed object.
+
+Environment:
+
+	User mode.
+
+--*/
+: m_File( INVALID_HANDLE_VALUE ),
+  m_FileSize( 0 ),
+  m_NextOffset( 0 ),
+  m_FileName( FileName )
+{
+	OpenErfFile( );
+
+	try
+	{
+		LoadCachedDirectory( Entries, EntryCount );
 	}
 	catch (...)
 	{
-		m_File = INVALID_HANDLE_VALUE;
+		CloseHandle( m_File );
 
-		CloseHandle( File );
+		m_File = INVALID_HANDLE_VALUE;
 
 		throw;
 	}
-
-	C_ASSERT( sizeof( ERF_HEADER ) == 160 );
-	C_ASSERT( sizeof( ERF_KEY ) == 8 + sizeof( ResRefT ) );
-	C_ASSERT( sizeof( RESOURCE_LIST_ELEMENT ) == 8 );
 }
 
 template< typename ResRefT >
@@ -352,6 +360,110 @@ Environment:
 	}
 }
 
+template< typename ResRefT >
+bool
+ErfFileReader< ResRefT >::ReadEncapsulatedFiles(
+	__inout_ecount( Count ) ReadRequest * Requests,
+	__in size_t Count
+	)
+/*++
+
+Routine Description:
+
+	This routine logically reads a batch of ranges of encapsulated sub-files
+	within the ERF file.
+
+	Each range is translated to an extent of the ERF file, and the extents
+	are then read in file offset order, with nearby extents coalesced into a
+	single read.
+
+Arguments:
+
+	Requests - Supplies the read requests.  On return, the BytesRead and
+	           Succeeded fields of each request are filled in.
+
+	Count - Supplies the count of read requests.
+
+Return Value:
+
+	The routine returns a Boolean value indicating true if every request
+	succeeded, else false if any request failed.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	std::vector< FileWrapper::ReadExtent > Extents;
+	bool                                   AllSucceeded;
+
+	AllSucceeded = true;
+
+	try
+	{
+		Extents.reserve( Count );
+
+		for (size_t i = 0; i < Count; i += 1)
+		{
+			PCRESOURCE_LIST_ELEMENT ResElem;
+			FileWrapper::ReadExtent Extent;
+			size_t                  BytesToRead;
+
+			Requests[ i ].BytesRead = 0;
+			Requests[ i ].Succeeded = false;
+
+			ResElem = LookupResourceDirectory( ((ResID) Requests[ i ].File) - 1 );
+
+			if ((ResElem == NULL) || (Requests[ i ].Offset >= ResElem->ResourceSize))
+			{
+				AllSucceeded = false;
+				continue;
+			}
+
+			BytesToRead = min( Requests[ i ].BytesToRead, ResElem->ResourceSize - Requests[ i ].Offset );
+
+			Extent.Offset = (ULONGLONG) ResElem->OffsetToResource + Requests[ i ].Offset;
+			Extent.Length = BytesToRead;
+			Extent.Buffer = Requests[ i ].Buffer;
+
+			Extents.push_back( Extent );
+
+			Requests[ i ].BytesRead = BytesToRead;
+			Requests[ i ].Succeeded = true;
+		}
+
+		if (!Extents.empty( ))
+		{
+			m_FileWrapper.ReadExtents(
+				&Extents[ 0 ],
+				Extents.size( ),
+				"File Contents");
+
+			m_NextOffset = m_FileWrapper.GetFilePointer( );
+		}
+	}
+	catch (std::exception)
+	{
+		//
+		// The file position is no longer known, so force the next read to
+		// seek, and fail every request as we cannot tell which completed.
+		//
+
+		m_NextOffset = (ULONGLONG) -1;
+
+		for (size_t i = 0; i < Count; i += 1)
+		{
+			Requests[ i ].BytesRead = 0;
+			Requests[ i ].Succeeded = false;
+		}
+
+		return false;
+	}
+
+	return AllSucceeded;
+}
+
 template< typename ResRefT >
 size_t
 ErfFileReader< ResRefT >::GetEncapsulatedFileSize(
@@ -428,6 +540,60 @@ Environment:
 	return AccessorTypeErf;
 }
 
+template< typename ResRefT >
+bool
+ErfFileReader< ResRefT >::GetEncapsulatedFileMapping(
+	__in FileHandle File,
+	__out HANDLE * BackingFile,
+	__out ULONG64 * BackingFileOffset
+	)
+/*++
+
+Routine Description:
+
+	This routine returns the backing file handle and file offset of an
+	encapsulated file so that the caller may map the file contents directly.
+
+	ERF resources are always stored contiguously and without compression, so
+	any legal file handle may be mapped.
+
+Arguments:
+
+	File - Supplies the file handle to inquire about.
+
+	BackingFile - Receives the ERF file handle.  The handle remains owned by
+	              the ErfFileReader object.
+
+	BackingFileOffset - Receives the offset of the encapsulated file's data
+	                    within the ERF file.
+
+Return Value:
+
+	The routine returns a Boolean value indicating true on success, else false
+	on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	PCRESOURCE_LIST_ELEMENT ResElem;
+
+	*BackingFile       = INVALID_HANDLE_VALUE;
+	*BackingFileOffset = 0;
+
+	ResElem = LookupResourceDirectory( ((ResID) File) - 1 );
+
+	if ((ResElem == NULL) || (m_File == INVALID_HANDLE_VALUE))
+		return false;
+
+	*BackingFile       = m_File;
+	*BackingFileOffset = (ULONG64) ResElem->OffsetToResource;
+
+	return true;
+}
+
 template< typename ResRefT >
 typename ErfFileReader< ResRefT >::ResType
 ErfFileReader< ResRefT >::GetEncapsulatedFileType(
@@ -547,6 +713,89 @@ Environment:
 	return m_KeyDir.size( );
 }
 
+template< typename ResRefT >
+void
+ErfFileReader< ResRefT >::OpenErfFile(
+	)
+/*++
+
+Routine Description:
+
+	This routine opens the ERF file named by m_FileName and attaches it to the
+	file wrapper.  The file must already exist.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.  On failure, the routine raises an std::exception, and no file is
+	left open.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	HANDLE File;
+
+	File = CreateFileA(
+		m_FileName.c_str( ),
+		GENERIC_READ,
+		FILE_SHARE_READ | FILE_SHARE_DELETE,
+		NULL,
+		OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL,
+		NULL);
+
+	if (File == INVALID_HANDLE_VALUE)
+	{
+		File = CreateFileA(
+				m_FileName.c_str( ),
+				GENERIC_READ,
+				FILE_SHARE_READ,
+				NULL,
+				OPEN_EXISTING,
+				FILE_ATTRIBUTE_NORMAL,
+				NULL);
+
+		if (File == INVALID_HANDLE_VALUE)
+			throw std::exception( "Failed to open ERF file." );
+	}
+
+	//
+	// N.B.  We don't use memory mapped I/O for .HAKs due to address space 
+	//       pressure on 32-bit builds (if we do, we tend to run the client
+	//       out of address space in client extension mode).  On 64-bit builds,
+	//       the available address space is so much larger than the sum total
+	//       of content loaded that it's better to just use a mapped view.
+	//
+
+	try
+	{
+#if !defined(_WIN64)
+		m_FileWrapper.SetFileHandle( File, false );
+#else
+		m_FileWrapper.SetFileHandle( File, true );
+#endif
+
+		m_FileSize = GetFileSize( File, NULL );
+
+		if ((m_FileSize == 0xFFFFFFFF) && (GetLastError( ) != NO_ERROR))
+			throw std::exception( "Failed to read file size." );
+	}
+	catch (...)
+	{
+		CloseHandle( File );
+
+		throw;
+	}
+
+	m_File = File;
+}
+
 template< typename ResRefT >
 void
 ErfFileReader< ResRefT >::ParseErfFile(
@@ -587,6 +836,18 @@ Environment:
 		m_ResDir.reserve( 1024 * 1024 );
 	}
 
+	//
+	// The key and resource lists are read in full immediately, so ask for
+	// them to be brought in ahead of the parse.
+	//
+
+	m_FileWrapper.PrefetchRange(
+		Header.OffsetToKeyList,
+		(ULONGLONG) Header.EntryCount * sizeof( ERF_KEY ));
+	m_FileWrapper.PrefetchRange(
+		Header.OffsetToResourceList,
+		(ULONGLONG) Header.EntryCount * sizeof( RESOURCE_LIST_ELEMENT ));
+
 	m_FileWrapper.SeekOffset( Header.OffsetToKeyList, "OffsetToKeyList" );
 
 	for (unsigned long i = 0; i < Header.EntryCount; i += 1)
@@ -630,6 +891,233 @@ Environment:
 
 		m_ResDir.push_back( Entry );
 	}
+
+	//
+	// Resource contents are subsequently read on demand, in no particular
+	// order.
+	//
+
+	m_FileWrapper.SetAccessPattern( FileWrapper::AccessPatternRandom );
+
+	BuildKeyIndex( );
+}
+
+template< typename ResRefT >
+void
+ErfFileReader< ResRefT >::BuildKeyIndex(
+	)
+/*++
+
+Routine Description:
+
+	This routine builds the hashed key directory index, so that lookups by
+	name and type need not scan the key directory.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.  On failure, the routine raises an std::exception.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	m_KeyIndex.Clear( );
+	m_KeyIndexIds.clear( );
+
+	m_KeyIndex.Reserve( m_KeyDir.size( ) );
+	m_KeyIndexIds.reserve( m_KeyDir.size( ) );
+
+	for (ErfKeyVec::const_iterator it = m_KeyDir.begin( );
+	     it != m_KeyDir.end( );
+	     ++it)
+	{
+		ResRefIf Name;
+
+		ZeroMemory( &Name, sizeof( Name ) );
+		memcpy( &Name, &it->FileName, sizeof( it->FileName ) );
+
+		//
+		// Only the first of any duplicate keys is indexed, which matches the
+		// first-match behavior of a directory scan.
+		//
+
+		if (m_KeyIndex.Insert( Name, it->Type ))
+			m_KeyIndexIds.push_back( it->ResourceID );
+	}
+}
+
+template< typename ResRefT >
+void
+ErfFileReader< ResRefT >::LoadCachedDirectory(
+	__in_ecount( EntryCount ) const ResourceIndexCache::Entry * Entries,
+	__in size_t EntryCount
+	)
+/*++
+
+Routine Description:
+
+	This routine generates the in-memory key and resource list entry
+	directories from a cached directory listing.  Each cached entry's locator
+	holds the offset of the resource in its high 32 bits and the size of the
+	resource in its low 32 bits, and its index is its ResID.
+
+Arguments:
+
+	Entries - Supplies the cached directory listing.
+
+	EntryCount - Supplies the count of cached directory entries.
+
+Return Value:
+
+	None.  On failure, the routine raises an std::exception.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	m_KeyDir.resize( EntryCount );
+	m_ResDir.resize( EntryCount );
+
+	for (size_t i = 0; i < EntryCount; i += 1)
+	{
+		ERF_KEY               & Key   = m_KeyDir[ i ];
+		RESOURCE_LIST_ELEMENT & Entry = m_ResDir[ i ];
+
+		ZeroMemory( &Key, sizeof( Key ) );
+		memcpy(
+			&Key.FileName,
+			&Entries[ i ].Name,
+			min( sizeof( Key.FileName ), sizeof( Entries[ i ].Name ) ) );
+
+		Key.ResourceID         = (ResID) i;
+		Key.Type               = (ResType) Entries[ i ].Type;
+		Entry.OffsetToResource = (unsigned long) (Entries[ i ].Locator >> 32);
+		Entry.ResourceSize     = (unsigned long) (Entries[ i ].Locator);
+
+		//
+		// The cache is keyed on the file size and last write time, but a
+		// damaged cache must still never yield an entry beyond the file.
+		//
+
+		if ((ULONGLONG) Entry.OffsetToResource + Entry.ResourceSize > (ULONGLONG) m_FileSize)
+			throw std::runtime_error( "ERF entry exceeds file size" );
+	}
+
+	m_FileWrapper.SetAccessPattern( FileWrapper::AccessPatternRandom );
+
+	BuildKeyIndex( );
+}
+
+template< typename ResRefT >
+void
+ErfFileReader< ResRefT >::GetDirectoryEntries(
+	__out ResourceIndexCache::EntryVec & Entries
+	) const
+/*++
+
+Routine Description:
+
+	This routine returns the directory listing of the ERF in a form suitable
+	for caching.  The listing may later be supplied to the cached directory
+	constructor for an unmodified copy of the ERF.
+
+Arguments:
+
+	Entries - Receives the directory listing.
+
+Return Value:
+
+	None.  Raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	Entries.resize( m_KeyDir.size( ) );
+
+	for (size_t i = 0; i < m_KeyDir.size( ); i += 1)
+	{
+		ResourceIndexCache::Entry & Entry = Entries[ i ];
+
+		ZeroMemory( &Entry, sizeof( Entry ) );
+		memcpy(
+			&Entry.Name,
+			&m_KeyDir[ i ].FileName,
+			min( sizeof( Entry.Name ), sizeof( m_KeyDir[ i ].FileName ) ) );
+
+		Entry.Type    = m_KeyDir[ i ].Type;
+		Entry.Locator = ((ULONG64) m_ResDir[ i ].OffsetToResource << 32) |
+		                ((ULONG64) m_ResDir[ i ].ResourceSize);
+	}
+}
+
+template< typename ResRefT >
+size_t
+ErfFileReader< ResRefT >::FindEncapsulatedFiles(
+	__in size_t Count,
+	__in_ecount( Count ) const ResRefIf * ResRefs,
+	__in_ecount( Count ) const ResType * Types,
+	__out_ecount( Count ) FileId * FileIndicies
+	) const
+/*++
+
+Routine Description:
+
+	This routine looks up the file index of each of a batch of resources.  The
+	file indicies may be supplied to OpenFileByIndex.
+
+Arguments:
+
+	Count - Supplies the count of resources to look up.
+
+	ResRefs - Supplies the names of the resources to look up.
+
+	Types - Supplies the types of the resources to look up.
+
+	FileIndicies - Receives the file index of each resource, or
+	               INVALID_FILE_ID for each resource that is not present.
+
+Return Value:
+
+	The routine returns the count of resources that were found.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	size_t Found;
+
+	Found = 0;
+
+	for (size_t i = 0; i < Count; i += 1)
+	{
+		PCERF_KEY Key;
+
+		Key = LookupResourceKey( ResRefs[ i ], Types[ i ] );
+
+		if (Key == NULL)
+		{
+			FileIndicies[ i ] = INVALID_FILE_ID;
+			continue;
+		}
+
+		FileIndicies[ i ] = (FileId) Key->ResourceID;
+		Found            += 1;
+	}
+
+	return Found;
 }
 
 template ErfFileReader< NWN::ResRef32 >;
@@ -23,6 +23,8 @@ Abstract:
 
 #include "ResourceAccessor.h"
 #include "FileWrapper.h"
+#include "ResourceIndex.h"
+#include "ResourceIndexCache.h"
 
 template< typename ResRefT >
 class ErfFileWriter;
@@ -46,6 +48,13 @@ public:
 
 	typedef NWN::ResRef32 ResRefIf;
 
+	//
+	// Define the file index reported by FindEncapsulatedFiles for a resource
+	// that is not present.
+	//
+
+	static const FileId INVALID_FILE_ID = (FileId) -1;
+
 	//
 	// Constructor.  Raises an std::exception on parse failure.
 	//
@@ -54,6 +63,18 @@ public:
 		__in const std::string & FileName
 		);
 
+	//
+	// Constructor, used when the directory listing of the ERF was previously
+	// retrieved via GetDirectoryEntries and has been cached.  The key and
+	// resource lists are not reread.  Raises an std::exception on failure.
+	//
+
+	ErfFileReader(
+		__in const std::string & FileName,
+		__in_ecount( EntryCount ) const ResourceIndexCache::Entry * Entries,
+		__in size_t EntryCount
+		);
+
 	//
 	// Destructor.
 	//
@@ -108,6 +129,18 @@ public:
 		__out_bcount( BytesToRead ) void * Buffer
 		);
 
+	//
+	// Read a batch of ranges of encapsulated files.  The reads are issued in
+	// ERF file offset order, and nearby ranges are coalesced.
+	//
+
+	virtual
+	bool
+	ReadEncapsulatedFiles(
+		__inout_ecount( Count ) ReadRequest * Requests,
+		__in size_t Count
+		);
+
 	//
 	// Return the size of a file.
 	//
@@ -161,8 +194,54 @@ public:
 		__out std::string & AccessorName
 		);
 
+	//
+	// Return the backing file handle and offset of an encapsulated file, for
+	// use in directly mapping the file contents.
+	//
+
+	virtual
+	bool
+	GetEncapsulatedFileMapping(
+		__in FileHandle File,
+		__out HANDLE * BackingFile,
+		__out ULONG64 * BackingFileOffset
+		);
+
+	//
+	// Look up the file index of each of a batch of resources by name and
+	// type.  Entries for resources that are not present receive
+	// INVALID_FILE_ID.  The routine returns the count of resources found.
+	//
+
+	size_t
+	FindEncapsulatedFiles(
+		__in size_t Count,
+		__in_ecount( Count ) const ResRefIf * ResRefs,
+		__in_ecount( Count ) const ResType * Types,
+		__out_ecount( Count ) FileId * FileIndicies
+		) const;
+
+	//
+	// Retrieve the directory listing of the ERF in a form suitable for
+	// caching.  Raises an std::exception on failure.
+	//
+
+	void
+	GetDirectoryEntries(
+		__out ResourceIndexCache::EntryVec & Entries
+		) const;
+
 private:
 
+	//
+	// Open the ERF file named by m_FileName.  Raises an std::exception on
+	// failure.
+	//
+
+	void
+	OpenErfFile(
+		);
+
 	//
 	// Parse the on-disk format and read the base directory data in.
 	//
@@ -171,6 +250,25 @@ private:
 	ParseErfFile(
 		);
 
+	//
+	// Build the hashed key directory index from the key directory.
+	//
+
+	void
+	BuildKeyIndex(
+		);
+
+	//
+	// Build the key and resource directories from a cached directory listing
+	// in lieu of parsing them from the ERF file.
+	//
+
+	void
+	LoadCachedDirectory(
+		__in_ecount( EntryCount ) const ResourceIndexCache::Entry * Entries,
+		__in size_t EntryCount
+		);
+
 	//
 	// Define the ERF on-disk file structures.  This data is based on the
 	// BioWare Aurora engine documentation.
@@ -220,13 +318,16 @@ private:
 
 	typedef std::vector< ERF_KEY > ErfKeyVec;
 	typedef std::vector< RESOURCE_LIST_ELEMENT > ErfResVec;
+	typedef std::vector< ResID > ResIDVec;
 
 	//
 	// Define helper routines for looking up resource data.
 	//
 
 	//
-	// Locate a resource by its resref name.
+	// Locate a resource by its resref name.  Only the portion of the name
+	// that fits in the on-disk resref is significant.  If the directory has
+	// duplicate keys, the first is returned.
 	//
 
 	inline
@@ -236,20 +337,16 @@ private:
 		__in ResType Type
 		) const
 	{
+		size_t Index;
+
 		C_ASSERT( sizeof( ResRefT ) <= sizeof( ResRefIf ) );
 
-		for (ErfKeyVec::const_iterator it = m_KeyDir.begin( );
-		     it != m_KeyDir.end( );
-		     ++it)
-		{
-			if (it->Type != Type)
-				continue;
+		Index = m_KeyIndex.Find( Name.RefStr, sizeof( ResRefT ), Type );
 
-			if (!memcmp( &Name, &it->FileName, sizeof( ResRefT ) ))
-				return &*it;
-		}
+		if (Index == ResourceIndex::INVALID_INDEX)
+			return NULL;
 
-		return NULL;
+		return &m_KeyDir[ m_KeyIndexIds[ Index ] ];
 	}
 
 	//
@@ -301,6 +398,15 @@ private:
 	ErfKeyVec          m_KeyDir;
 	ErfResVec          m_ResDir;
 
+	//
+	// Hashed key directory.  The index assigns sequential indicies to the
+	// distinct keys, and m_KeyIndexIds maps each of those back to the ResID
+	// of the first key directory entry with that key.
+	//
+
+	ResourceIndex      m_KeyIndex;
+	ResIDVec           m_KeyIndexIds;
+
 	friend class ErfFileWriter< ResRefT >;
 
 };
@@ -17,6 +17,7 @@ Abstract:
 #include "ResourceManager.h"
 #include "../NWNBaseLib/NWNBaseLib.h"
 #include "ErfFileWriter.h"
+#include "ParallelWork.h"
 
 template< typename ResRefT >
 ErfFileWriter< ResRefT >::ErfFileWriter(
@@ -103,31 +104,38 @@ Environment:
 --*/
 {
 	HANDLE File;
+	bool   Mapped;
 
-	File = INVALID_HANDLE_VALUE;
+	File   = INVALID_HANDLE_VALUE;
+	Mapped = ((Flags & ERF_COMMIT_FLAG_MAP_OUTPUT) != 0);
+
+#if !defined(_WIN64)
+	Mapped = false;
+#endif
 
 	try
 	{
 		//
 		// Create a write abstraction context for the disk file and perform the
-		// commit operation.
+		// commit operation.  Unless the file is to be mapped, it is opened for
+		// overlapped I/O so that positional writes may proceed concurrently.
 		//
 
 		ErfWriteContext Context;
 
 		File = CreateFileA(
 			FileName.c_str( ),
-			GENERIC_WRITE,
+			Mapped ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_WRITE,
 			0,
 			NULL,
 			CREATE_ALWAYS,
-			FILE_ATTRIBUTE_NORMAL,
+			Mapped ? FILE_ATTRIBUTE_NORMAL : (FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED),
 			NULL);
 
 		if (File == INVALID_HANDLE_VALUE)
 			throw std::runtime_error( "Failed to open file." );
 
-		Context.Type = ErfWriteContext::ContextTypeFile;
+		Context.Type = Mapped ? ErfWriteContext::ContextTypeMapped : ErfWriteContext::ContextTypeFile;
 		Context.File = File;
 
 		CommitInternal( &Context, FileType, Flags );
@@ -217,7 +225,8 @@ Routine Description:
 
 	This routine initializes an ERF writer with the contents of an existing
 	resource accessor (which may or may not be an ERF reader).  The contents
-	are staged for future writing.
+	are staged for future writing as accessor references, and are streamed
+	from the accessor at commit time.
 
 	N.B.  It is the responsibility of the caller to ensure that the contents of
 	      the resource accessor do not conflict with any existing contents that
@@ -225,7 +234,8 @@ Routine Description:
 
 Arguments:
 
-	Accessor - Supplies the resource accessor to pull resources from.
+	Accessor - Supplies the resource accessor to pull resources from.  The
+	           accessor must remain valid through any commit calls.
 
 	CheckForDuplicates - Supplies a Boolean value that indicates whether the
 	                     existing staged contents are checked for duplicate
@@ -245,7 +255,6 @@ Environment:
 {
 	ResRefIf                                         ResRef;
 	ResType                                          ResType;
-	swutil::SharedByteVec                            Contents;
 	typename IResourceAccessor< ResRefIf >::FileId   CurId;
 	typename IResourceAccessor< ResRefIf >::FileId   MaxId;
 
@@ -265,14 +274,10 @@ Environment:
 			RemoveFile( ResRef, ResType );
 
 		//
-		// Add the file contents.
+		// Add the file by reference; its contents are read at commit time.
 		//
 
-		Contents = new std::vector< unsigned char >;
-
-		ResourceManager::LoadEncapsulatedFile( Accessor, CurId, *Contents );
-
-		AddFile( ResRef, ResType, Contents );
+		AddFile( ResRef, ResType, Accessor, CurId );
 	}
 }
 
@@ -551,6 +556,52 @@ Environment:
 	m_PendingFiles.push_back( File );
 }
 
+template< typename ResRefT >
+void
+ErfFileWriter< ResRefT >::AddFile(
+	__in const ResRefIf & ResRef,
+	__in ResType Type,
+	__in IResourceAccessor< ResRefIf > * Accessor,
+	__in typename IResourceAccessor< ResRefIf >::FileId FileIndex
+	)
+/*++
+
+Routine Description:
+
+	This routine stages a resource accessor file for future commit to an ERF.
+	The file contents are streamed from the accessor at commit time.
+
+	N.B.  The caller bears responsibility for ensuring that duplicate files are
+	      not added.
+
+Arguments:
+
+	ResRef - Supplies the canonical RESREF of the file to add.
+
+	Type - Supplies resource type of the file to add.
+
+	Accessor - Supplies the resource accessor that contains the file.  The
+	           accessor must remain valid through any commit calls.
+
+	FileIndex - Supplies the index of the file within the accessor.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	ErfPendingFilePtr File;
+
+	File = new ErfPendingFile( ResRef, Type, Accessor, FileIndex );
+
+	m_PendingFiles.push_back( File );
+}
+
 template< typename ResRefT >
 void
 ErfFileWriter< ResRefT >::CommitInternal(
@@ -563,7 +614,12 @@ ErfFileWriter< ResRefT >::CommitInternal(
 Routine Description:
 
 	This routine writes the staged ERF contents to a write context, which may
-	represent a disk file or an in-memory buffer.
+	represent a disk file, a mapped disk file or an in-memory buffer.
+
+	The header, key list and resource list are computed in full first, which
+	fixes the final offset of every resource.  The target is then sized once,
+	and the contents of each resource are copied to their final offset (in
+	parallel, unless ERF_COMMIT_FLAG_SERIAL is specified).
 
 Arguments:
 
@@ -585,9 +641,10 @@ Environment:
 
 --*/
 {
-	ERF_HEADER        Header;
-
-	UNREFERENCED_PARAMETER( Flags );
+	ERF_HEADER Header;
+	ErfKeyVec  Keys;
+	ErfResVec  Resources;
+	ULONGLONG  TotalSize;
 
 	//
 	// If the user did not supply an override file type, take the default one.
@@ -597,52 +654,55 @@ Environment:
 		FileType = m_FileType;
 
 	//
-	// First, generate and store the header.
-	//
-
-	BuildHeader( Header, FileType, GetErfFileVersion< ResRefT >( ) );
-
-	Context->Write( &Header, sizeof( Header ) );
-
+	// First, generate the header and lay out the key and resource lists.
 	//
-	// If talk strings were supported, we would write them out now.  However,
-	// they are generally an unused ERF features and, as such, are not
+	// If talk strings were supported, they would precede the key list.
+	// However, they are generally an unused ERF features and, as such, are not
 	// implemented in this context.
 	//
 
-	Header.OffsetToLocalizedString = sizeof( Header );
-
-	//
-	// Write the key list out.
-	//
-
-	Header.OffsetToKeyList = sizeof( Header );
-
-	WriteKeyList( Header, Context );
+	BuildHeader( Header, FileType, GetErfFileVersion< ResRefT >( ) );
 
-	//
-	// Write the resource list out.
-	//
+	Header.OffsetToLocalizedString = sizeof( Header );
+	Header.OffsetToKeyList         = sizeof( Header );
 
 	if (Header.OffsetToKeyList + Header.EntryCount * sizeof( ERF_KEY ) < Header.OffsetToKeyList)
 		throw std::runtime_error( "ERF file is too large." );
 
 	Header.OffsetToResourceList = Header.OffsetToKeyList + (Header.EntryCount * sizeof( ERF_KEY ) );
 
-	WriteResourceList( Header, Context );
+	BuildKeyList( Keys );
+	BuildResourceList( Header, Resources, TotalSize );
 
 	//
-	// Write the resource content list out.
+	// Size the target once, then write the header and directory.
 	//
 
-	WriteResourceContentList( Header, Context );
+	Context->Reserve( TotalSize );
+
+	Context->WriteAt( 0, &Header, sizeof( Header ) );
+
+	if (!Keys.empty( ))
+	{
+		Context->WriteAt(
+			Header.OffsetToKeyList,
+			&Keys[ 0 ],
+			Keys.size( ) * sizeof( ERF_KEY ));
+	}
+
+	if (!Resources.empty( ))
+	{
+		Context->WriteAt(
+			Header.OffsetToResourceList,
+			&Resources[ 0 ],
+			Resources.size( ) * sizeof( RESOURCE_LIST_ELEMENT ));
+	}
 
 	//
-	// Finally, re-write the updated header.
+	// Finally, copy the resource contents into place.
 	//
 
-	Context->SeekOffset( 0, "Write Finalized Header" );
-	Context->Write( &Header, sizeof( Header ) );
+	WriteResourceContents( Context, Resources, Flags );
 }
 
 template< typename ResRefT >
@@ -710,24 +770,18 @@ Environment:
 
 template< typename ResRefT >
 void
-ErfFileWriter< ResRefT >::WriteKeyList(
-	__inout ERF_HEADER & Header,
-	__in ErfWriteContext * Context
+ErfFileWriter< ResRefT >::BuildKeyList(
+	__out ErfKeyVec & Keys
 	)
 /*++
 
 Routine Description:
 
-	This routine writes the contents of each resource key out to the writer
-	context.
+	This routine builds the resource key list.
 
 Arguments:
 
-	Header - Receives the constructed file header.  The header is updated as
-	         the write operation progresses.
-
-	Context - Supplies the write context that receives the contents of the
-	          formatted ERF file.
+	Keys - Receives the resource key list.
 
 Return Value:
 
@@ -741,7 +795,8 @@ Environment:
 {
 	ResID ResourceId;
 
-	UNREFERENCED_PARAMETER( Header );
+	Keys.clear( );
+	Keys.reserve( m_PendingFiles.size( ) );
 
 	ResourceId = 0;
 
@@ -759,11 +814,7 @@ Environment:
 		Key.Type       = (*it)->ResType;
 		Key.Reserved   = 0;
 
-		//
-		// Transfer the key to the ERF.
-		//
-
-		Context->Write( &Key, sizeof( Key ) );
+		Keys.push_back( Key );
 
 		ResourceId += 1;
 	}
@@ -771,24 +822,29 @@ Environment:
 
 template< typename ResRefT >
 void
-ErfFileWriter< ResRefT >::WriteResourceList(
-	__inout ERF_HEADER & Header,
-	__in ErfWriteContext * Context
+ErfFileWriter< ResRefT >::BuildResourceList(
+	__in const ERF_HEADER & Header,
+	__out ErfResVec & Resources,
+	__out ULONGLONG & TotalSize
 	)
 /*++
 
 Routine Description:
 
-	This routine writes the contents of each resource list element out to the
-	writer context.
+	This routine builds the resource list, assigning each resource its final
+	offset within the ERF.  Resource contents follow the resource list, in
+	key order.
+
+	The size of an accessor-backed file is queried from its accessor.
 
 Arguments:
 
-	Header - Receives the constructed file header.  The header is updated as
-	         the write operation progresses.
+	Header - Supplies the file header, with the offset of the resource list
+	         already established.
 
-	Context - Supplies the write context that receives the contents of the
-	          formatted ERF file.
+	Resources - Receives the resource list.
+
+	TotalSize - Receives the total size of the ERF, in bytes.
 
 Return Value:
 
@@ -802,8 +858,6 @@ Environment:
 {
 	unsigned long OffsetToResource;
 
-	UNREFERENCED_PARAMETER( Header );
-
 	//
 	// Calculate the end of the resource list.
 	//
@@ -813,52 +867,78 @@ Environment:
 
 	OffsetToResource = Header.OffsetToResourceList + Header.EntryCount * sizeof( RESOURCE_LIST_ELEMENT );
 
+	Resources.clear( );
+	Resources.reserve( m_PendingFiles.size( ) );
+
 	for (ErfPendingFileVec::const_iterator it = m_PendingFiles.begin( );
 	     it != m_PendingFiles.end( );
 	     ++it)
 	{
 		RESOURCE_LIST_ELEMENT ListElement;
+		ULONGLONG             FileSize;
 
-		if ((*it)->Contents.GetFileSize( ) > ULONG_MAX)
-			throw std::runtime_error( "Resource size exceeds maximum ERF resource size limit." );
+		if ((*it)->Accessor != NULL)
+		{
+			AccessorFileHandle Handle;
 
-		ListElement.OffsetToResource = OffsetToResource;
-		ListElement.ResourceSize     = (ULONG) (*it)->Contents.GetFileSize( );
+			Handle = (*it)->Accessor->OpenFileByIndex( (*it)->FileIndex );
 
-		//
-		// Transfer the resource list element to the ERF.
-		//
+			if (Handle == IResourceAccessor< ResRefIf >::INVALID_FILE)
+				throw std::runtime_error( "Failed to open pending accessor file." );
 
-		Context->Write( &ListElement, sizeof( ListElement ) );
+			FileSize = (*it)->Accessor->GetEncapsulatedFileSize( Handle );
+
+			(*it)->Accessor->CloseFile( Handle );
+		}
+		else
+		{
+			FileSize = (*it)->Contents.GetFileSize( );
+		}
+
+		if (FileSize > ULONG_MAX)
+			throw std::runtime_error( "Resource size exceeds maximum ERF resource size limit." );
+
+		ListElement.OffsetToResource = OffsetToResource;
+		ListElement.ResourceSize     = (ULONG) FileSize;
 
 		if (ListElement.OffsetToResource + ListElement.ResourceSize < ListElement.OffsetToResource)
 			throw std::runtime_error( "ERF file contents exceed maximum ERF file size limit." );
 
+		Resources.push_back( ListElement );
+
 		OffsetToResource = ListElement.OffsetToResource + ListElement.ResourceSize;
 	}
+
+	TotalSize = OffsetToResource;
 }
 
 template< typename ResRefT >
 void
-ErfFileWriter< ResRefT >::WriteResourceContentList(
-	__inout ERF_HEADER & Header,
-	__in ErfWriteContext * Context
+ErfFileWriter< ResRefT >::WriteResourceContents(
+	__in ErfWriteContext * Context,
+	__in const ErfResVec & Resources,
+	__in unsigned long Flags
 	)
 /*++
 
 Routine Description:
 
-	This routine writes the contents of each resource out to the writer
-	context.
+	This routine copies the contents of each resource to its final offset in
+	the write context.  As each resource's offset is already fixed, resources
+	are copied independently, across a set of worker threads unless
+	ERF_COMMIT_FLAG_SERIAL is specified.
 
 Arguments:
 
-	Header - Receives the constructed file header.  The header is updated as
-	         the write operation progresses.
-
 	Context - Supplies the write context that receives the contents of the
 	          formatted ERF file.
 
+	Resources - Supplies the resource list, which gives the offset and size
+	            of each resource.
+
+	Flags - Supplies flags that control the behavior of the commit operation.
+	        Legal values are drawn from the ERF_COMMIT_FLAG_* family of values.
+
 Return Value:
 
 	None.  The routine raises an std::exception on failure.
@@ -869,48 +949,276 @@ Environment:
 
 --*/
 {
-	UNREFERENCED_PARAMETER( Header );
+	ErfCopyContext Copy;
 
-	enum { CHUNK_SIZE = 4096 };
+	if (Resources.empty( ))
+		return;
 
-	for (ErfPendingFileVec::const_iterator it = m_PendingFiles.begin( );
-	     it != m_PendingFiles.end( );
-	     ++it)
+	Copy.Writer    = this;
+	Copy.Output    = Context;
+	Copy.Resources = &Resources[ 0 ];
+	Copy.Failed    = 0;
+
+	ExecuteParallelWork(
+		Resources.size( ),
+		CopyPendingFileRoutine,
+		&Copy,
+		(Flags & ERF_COMMIT_FLAG_SERIAL) ? 1 : 0);
+
+	if (Copy.Failed)
+		throw std::runtime_error( Copy.Error );
+}
+
+template< typename ResRefT >
+void
+ErfFileWriter< ResRefT >::CopyPendingFileRoutine(
+	__in void * Context,
+	__in size_t WorkItem
+	)
+/*++
+
+Routine Description:
+
+	This routine is invoked, potentially concurrently, for each pending file in
+	order to copy its contents to its final offset.  The first failure is
+	recorded in the copy context, and causes the remaining work to be skipped.
+
+Arguments:
+
+	Context - Supplies the copy context.
+
+	WorkItem - Supplies the index of the pending file to copy.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	ErfCopyContext * Copy = (ErfCopyContext *) Context;
+
+	if (Copy->Failed)
+		return;
+
+	try
+	{
+		Copy->Writer->CopyPendingFile( *Copy, WorkItem );
+	}
+	catch (std::exception &e)
 	{
-		unsigned char Buffer[ CHUNK_SIZE ];
-		unsigned long FileSize;
-		unsigned long BytesLeft;
-		unsigned long Offset;
-		unsigned long Read;
+		swutil::ScopedLock Lock( Copy->ErrorLock );
 
-		//
-		// Transfer the resource file contents to the ERF.  It has already been
-		// verified that the resource will fit in the ERF, and has a size that
-		// fits within ULONG_MAX.
-		//
+		if (!Copy->Failed)
+		{
+			try
+			{
+				Copy->Error = e.what( );
+			}
+			catch (std::exception)
+			{
+			}
+
+			InterlockedExchange( &Copy->Failed, 1 );
+		}
+	}
+}
 
-		FileSize = (unsigned long) (*it)->Contents.GetFileSize( );
+template< typename ResRefT >
+void
+ErfFileWriter< ResRefT >::CopyPendingFile(
+	__in ErfCopyContext & Copy,
+	__in size_t FileIndex
+	)
+/*++
 
-		if (FileSize == 0)
-			continue;
+Routine Description:
+
+	This routine copies the contents of a pending file to its final offset.
+
+	If the target is addressable (memory or a mapped file), the contents are
+	read directly into place.  Otherwise, the contents are staged through a
+	bounded buffer and written with positional writes.
+
+Arguments:
+
+	Copy - Supplies the copy context.
+
+	FileIndex - Supplies the index of the pending file to copy.
+
+Return Value:
 
-		BytesLeft = FileSize;
-		Offset    = 0;
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	ErfPendingFile               * File;
+	const RESOURCE_LIST_ELEMENT  * Element;
+	unsigned char                * Dest;
+	std::vector< unsigned char >   Buffer;
+	AccessorFileHandle             Handle;
+	ULONG                          Offset;
+
+	File    = m_PendingFiles[ FileIndex ].get( );
+	Element = &Copy.Resources[ FileIndex ];
+
+	if (Element->ResourceSize == 0)
+		return;
+
+	Dest = Copy.Output->GetView( Element->OffsetToResource );
 
-		while (BytesLeft != 0)
+	if (Dest == NULL)
+		Buffer.resize( min( Element->ResourceSize, (ULONG) COPY_CHUNK_SIZE ) );
+
+	//
+	// Open the source.  Files backed by Contents are rewound, as the same
+	// pending file may be committed more than once.
+	//
+
+	Handle = IResourceAccessor< ResRefIf >::INVALID_FILE;
+
+	if (File->Accessor != NULL)
+	{
+		swutil::ScopedLock Lock( Copy.AccessorLock );
+
+		Handle = File->Accessor->OpenFileByIndex( File->FileIndex );
+
+		if (Handle == IResourceAccessor< ResRefIf >::INVALID_FILE)
+			throw std::runtime_error( "Failed to open pending accessor file." );
+	}
+	else
+	{
+		File->Contents.SeekOffset( 0, "Rewind Pending File Contents" );
+	}
+
+	try
+	{
+		Offset = 0;
+
+		while (Offset < Element->ResourceSize)
+		{
+			unsigned char * Target;
+			ULONG           Length;
+
+			Length = Element->ResourceSize - Offset;
+
+			if (Dest != NULL)
+			{
+				Target = Dest + Offset;
+			}
+			else
+			{
+				Length = min( Length, (ULONG) COPY_CHUNK_SIZE );
+				Target = &Buffer[ 0 ];
+			}
+
+			ReadPendingFile( Copy, File, Handle, Offset, Target, Length );
+
+			if (Dest == NULL)
+			{
+				Copy.Output->WriteAt(
+					(ULONGLONG) Element->OffsetToResource + Offset,
+					Target,
+					Length);
+			}
+
+			Offset += Length;
+		}
+	}
+	catch (...)
+	{
+		if (Handle != IResourceAccessor< ResRefIf >::INVALID_FILE)
 		{
-			Read = min( BytesLeft, CHUNK_SIZE );
+			swutil::ScopedLock Lock( Copy.AccessorLock );
+
+			File->Accessor->CloseFile( Handle );
+		}
+
+		throw;
+	}
+
+	if (Handle != IResourceAccessor< ResRefIf >::INVALID_FILE)
+	{
+		swutil::ScopedLock Lock( Copy.AccessorLock );
+
+		File->Accessor->CloseFile( Handle );
+	}
+}
+
+template< typename ResRefT >
+void
+ErfFileWriter< ResRefT >::ReadPendingFile(
+	__in ErfCopyContext & Copy,
+	__in ErfPendingFile * File,
+	__in AccessorFileHandle Handle,
+	__in ULONG Offset,
+	__out_bcount( Length ) void * Buffer,
+	__in ULONG Length
+	)
+/*++
+
+Routine Description:
+
+	This routine reads a range of the contents of a pending file.
+
+Arguments:
+
+	Copy - Supplies the copy context.
+
+	File - Supplies the pending file to read from.
+
+	Handle - Supplies the open accessor file handle, for an accessor-backed
+	         pending file.
+
+	Offset - Supplies the offset within the file to read from.  Reads from a
+	         file backed by Contents must be sequential.
+
+	Buffer - Receives the file contents.
+
+	Length - Supplies the count of bytes to read.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
 
-			(*it)->Contents.ReadFile(
-				Buffer,
-				Read,
-				"Read Pending File Contents");
+--*/
+{
+	if (File->Accessor == NULL)
+	{
+		File->Contents.ReadFile( Buffer, Length, "Read Pending File Contents" );
+		return;
+	}
 
-			Offset    += Read;
-			BytesLeft -= Read;
+	swutil::ScopedLock Lock( Copy.AccessorLock );
 
-			Context->Write( Buffer, Read );
+	while (Length != 0)
+	{
+		size_t Read;
+
+		if ((!File->Accessor->ReadEncapsulatedFile(
+			Handle,
+			Offset,
+			Length,
+			&Read,
+			Buffer)) || (Read == 0))
+		{
+			throw std::runtime_error( "Failed to read pending accessor file." );
 		}
+
+		Buffer  = (unsigned char *) Buffer + Read;
+		Offset += (ULONG) Read;
+		Length -= (ULONG) Read;
 	}
 }
 
@@ -80,12 +80,33 @@ public:
 
 	enum
 	{
+		//
+		// Copy resource contents into the ERF on the calling thread only,
+		// rather than on a set of worker threads.
+		//
+
+		ERF_COMMIT_FLAG_SERIAL     = 0x00000001,
+
+		//
+		// Map the output disk file and copy resource contents directly into
+		// the mapped view, rather than issuing positional writes.  Ignored
+		// for in-memory commits, and on 32-bit builds (where a large ERF may
+		// not fit in the address space).
+		//
+
+		ERF_COMMIT_FLAG_MAP_OUTPUT = 0x00000002,
+
 		LAST_ERF_COMMIT_FLAG
 	};
 
 	//
 	// Commit the contents of the ERF to disk.
 	//
+	// The key and resource lists are laid out in full before any resource
+	// contents are copied, so that the contents of each resource can be
+	// copied to its final offset independently of (and in parallel with) the
+	// others.
+	//
 
 	bool
 	Commit(
@@ -128,7 +149,9 @@ public:
 	}
 
 	//
-	// Initialize a writer's contents from a resource accessor.
+	// Initialize a writer's contents from a resource accessor.  Resources are
+	// added as accessor references (see AddFile), so the accessor must remain
+	// valid through any commit calls.
 	//
 
 	void
@@ -209,11 +232,29 @@ public:
 		__in size_t FileSize
 		);
 
+	//
+	// Add a file to the ERF by resource accessor reference.  The file contents
+	// are streamed from the accessor at commit time rather than being read
+	// into memory up front.  The accessor must remain valid until the file is
+	// removed or the ErfFileWriter object is deleted, and is only accessed by
+	// one thread at a time.  The caller bears responsibility for ensuring the
+	// uniqueness of the file in the ERF.
+	//
+
+	void
+	AddFile(
+		__in const ResRefIf & ResRef,
+		__in ResType Type,
+		__in IResourceAccessor< ResRefIf > * Accessor,
+		__in typename IResourceAccessor< ResRefIf >::FileId FileIndex
+		);
+
 private:
 
 	//
-	// Define the ERF writer context, which supports data append only, to a
-	// disk or memory target.
+	// Define the ERF writer context, which supports positional writes to a
+	// disk, mapped disk or memory target.  The target is sized up front, after
+	// which writes to disjoint ranges may be issued concurrently.
 	//
 
 	struct ErfWriteContext
@@ -222,6 +263,7 @@ private:
 		{
 			ContextTypeFile,
 			ContextTypeMemory,
+			ContextTypeMapped,
 
 			LastContextType
 		};
@@ -230,179 +272,214 @@ private:
 		ErfWriteContext(
 			)
 		: Type( LastContextType ),
-		  WritePtr( 0 )
+		  File( INVALID_HANDLE_VALUE ),
+		  Memory( NULL ),
+		  View( NULL )
 		{
 
 		}
 
-		ContextType Type;
-
-		union
+		inline
+		~ErfWriteContext(
+			)
 		{
-			HANDLE                         File;
-			std::vector< unsigned char > * Memory;
-		};
+			if ((Type == ContextTypeMapped) && (View != NULL))
+			{
+				UnmapViewOfFile( View );
+				View = NULL;
+			}
+		}
 
-		size_t      WritePtr;
+		ContextType                    Type;
+		HANDLE                         File;   // File, Mapped
+		std::vector< unsigned char > * Memory; // Memory
+		unsigned char                * View;   // Memory, Mapped
 
 		//
-		// Append contents to the write context's target.  The routine raises
-		// an std::exception on failure.
+		// Size the target to hold the entire ERF, and establish the view of
+		// a memory or mapped target.  A disk file target must have been opened
+		// for overlapped I/O.  The routine raises an std::exception on failure.
 		//
 
 		inline
 		void
-		Write(
-			__in_bcount( Length ) const void * Data,
-			__in size_t Length
+		Reserve(
+			__in ULONGLONG Size
 			)
 		{
-			if (Length == 0)
-				return;
-
 			switch (Type)
 			{
 
-			case ContextTypeFile:
-				{
-					DWORD Written;
+			case ContextTypeMemory:
+				if (Size > (ULONGLONG) (size_t) -1)
+					throw std::runtime_error( "ErfWriteContext::Reserve exceeded the address space." );
 
-					if (!WriteFile(
-						File,
-						Data,
-						(DWORD) Length,
-						&Written,
-						NULL))
-					{
-						throw std::runtime_error( "ErfWriteContext::Write failed to write to file." );
-					}
+				Memory->resize( (size_t) Size );
 
-					if ((size_t) Written != Length)
-						throw std::runtime_error( "ErfWriteContext::Write wrote less than the required count of bytes." );
-				}
+				View = (Memory->empty( )) ? NULL : &(*Memory)[ 0 ];
 				break;
 
-			case ContextTypeMemory:
+			case ContextTypeFile:
+			case ContextTypeMapped:
 				{
-					size_t Tail;
-
-					Tail = Memory->size( );
+					LARGE_INTEGER Fp;
+					HANDLE        Section;
 
-					if (WritePtr + Length < WritePtr)
-						throw std::runtime_error( "ErfWriteContext::Write encountered write pointer overflow." );
+					Fp.QuadPart = (LONGLONG) Size;
 
-					if (WritePtr + Length > Tail)
-						Memory->resize( WritePtr + Length );
+					if ((!SetFilePointerEx( File, Fp, NULL, FILE_BEGIN )) ||
+					    (!SetEndOfFile( File )))
+					{
+						throw std::runtime_error( "ErfWriteContext::Reserve failed to extend file." );
+					}
 
-					memcpy( &(*Memory)[ WritePtr ], Data, Length );
+					if ((Type == ContextTypeFile) || (Size == 0))
+						break;
 
-					WritePtr += Length;
+					Section = CreateFileMapping(
+						File,
+						NULL,
+						PAGE_READWRITE,
+						(DWORD) (Size >> 32),
+						(DWORD) (Size & 0xFFFFFFFF),
+						NULL);
+
+					if (Section == NULL)
+						throw std::runtime_error( "ErfWriteContext::Reserve failed to create file mapping." );
+
+					View = (unsigned char *) MapViewOfFile(
+						Section,
+						FILE_MAP_WRITE,
+						0,
+						0,
+						(SIZE_T) Size);
+
+					CloseHandle( Section );
+
+					if (View == NULL)
+						throw std::runtime_error( "ErfWriteContext::Reserve failed to map file." );
 				}
 				break;
+
 			}
 		}
 
 		//
-		// (Re-)read data from the write context's target.  The data must have
-		// been already written with Write.  The routine raises an std::exception
-		// on failure.
+		// Return the address of the target contents at a given offset, or
+		// NULL if the target is not addressable (a disk file target).
+		//
+
+		inline
+		unsigned char *
+		GetView(
+			__in ULONGLONG Offset
+			) const
+		{
+			if (View == NULL)
+				return NULL;
+
+			return View + (size_t) Offset;
+		}
+
+		//
+		// Write contents at an offset within the target, which must have been
+		// reserved.  The routine raises an std::exception on failure.
 		//
 
 		inline
 		void
-		Read(
-			__out_bcount( Length ) void * Data,
+		WriteAt(
+			__in ULONGLONG Offset,
+			__in_bcount( Length ) const void * Data,
 			__in size_t Length
 			)
 		{
+			OVERLAPPED Overlapped;
+			DWORD      Written;
+			BOOL       Succeeded;
+
 			if (Length == 0)
 				return;
 
-			switch (Type)
+			if (View != NULL)
 			{
+				CopyToView( View + (size_t) Offset, Data, Length );
+				return;
+			}
 
-			case ContextTypeFile:
-				{
-					DWORD Read;
+			if (Length > ULONG_MAX)
+				throw std::runtime_error( "ErfWriteContext::WriteAt write is too large." );
 
-					if (!ReadFile(
-						File,
-						Data,
-						(DWORD) Length,
-						&Read,
-						NULL))
-					{
-						throw std::runtime_error( "ErfWriteContext::Read failed to read from file." );
-					}
+			ZeroMemory( &Overlapped, sizeof( Overlapped ) );
 
-					if ((size_t) Read != Length)
-						throw std::runtime_error( "ErfWriteContext::Read read less than the required count of bytes." );
-				}
-				break;
+			Overlapped.Offset     = (DWORD) (Offset & 0xFFFFFFFF);
+			Overlapped.OffsetHigh = (DWORD) (Offset >> 32);
+			Overlapped.hEvent     = CreateEvent( NULL, TRUE, FALSE, NULL );
 
-			case ContextTypeMemory:
-				{
-					size_t Tail;
+			if (Overlapped.hEvent == NULL)
+				throw std::runtime_error( "ErfWriteContext::WriteAt failed to create event." );
 
-					Tail = Memory->size( );
+			Written   = 0;
+			Succeeded = WriteFile(
+				File,
+				Data,
+				(DWORD) Length,
+				NULL,
+				&Overlapped);
 
-					if (WritePtr + Length < WritePtr)
-						throw std::runtime_error( "ErfWriteContext::Read encountered read pointer overflow." );
+			if ((Succeeded) || (GetLastError( ) == ERROR_IO_PENDING))
+			{
+				Succeeded = GetOverlappedResult(
+					File,
+					&Overlapped,
+					&Written,
+					TRUE);
+			}
 
-					if (WritePtr + Length > Tail)
-						throw std::runtime_error( "ErfWriteContext::Read read past the end of stream." );
+			CloseHandle( Overlapped.hEvent );
 
-					memcpy( Data, &(*Memory)[ WritePtr ], Length );
+			if (!Succeeded)
+				throw std::runtime_error( "ErfWriteContext::WriteAt failed to write to file." );
 
-					WritePtr += Length;
-				}
-				break;
-			}
+			if ((size_t) Written != Length)
+				throw std::runtime_error( "ErfWriteContext::WriteAt wrote less than the required count of bytes." );
 		}
 
 		//
-		// Seek to a particular position.
+		// Copy contents into the view, converting an in-page error (such as
+		// running out of disk space behind a mapped view) into an
+		// std::exception.
 		//
 
 		inline
+		static
 		void
-		SeekOffset(
-			__in ULONGLONG Offset,
-			__in const char * Description
+		CopyToView(
+			__out_bcount( Length ) void * Dst,
+			__in_bcount( Length ) const void * Src,
+			__in size_t Length
 			)
 		{
-			LONG  Low;
-			LONG  High;
-			DWORD NewPtrLow;
-			char  ExMsg[ 64 ];
-
-			switch (Type)
+			__try
 			{
-
-			case ContextTypeMemory:
-				WritePtr = (size_t) Offset;
-				break;
-
-			case ContextTypeFile:
-				Low  = (LONG) ((Offset >>  0) & 0xFFFFFFFF);
-				High = (LONG) ((Offset >> 32) & 0xFFFFFFFF);
-
-				NewPtrLow = SetFilePointer( File, Low, &High, FILE_BEGIN );
-
-				if ((NewPtrLow == INVALID_SET_FILE_POINTER) &&
-					(GetLastError( ) != NO_ERROR))
-				{
-					StringCbPrintfA(
-						ExMsg,
-						sizeof( ExMsg ),
-						"SeekOffset( %s ) failed.",
-						Description);
-
-					throw std::runtime_error( ExMsg );
-				}
-				break;
+				memcpy( Dst, Src, Length );
+			}
+			__except( (GetExceptionCode( ) == EXCEPTION_IN_PAGE_ERROR ) ?
+			          EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH )
+			{
+				ThrowInPageError( );
 			}
 		}
+
+		DECLSPEC_NORETURN
+		inline
+		static
+		void
+		ThrowInPageError(
+			)
+		{
+			throw std::runtime_error( "In-page I/O error writing ERF." );
+		}
 	};
 
 	//
@@ -442,33 +519,35 @@ private:
 		);
 
 	//
-	// Write the resource key list out.
+	// Build the resource key list.
 	//
 
 	void
-	WriteKeyList(
-		__inout ERF_HEADER & Header,
-		__in ErfWriteContext * Context
+	BuildKeyList(
+		__out ErfKeyVec & Keys
 		);
 
 	//
-	// Write the resource list out.
+	// Build the resource list, assigning each resource its final offset, and
+	// return the total size of the ERF.
 	//
 
 	void
-	WriteResourceList(
-		__inout ERF_HEADER & Header,
-		__in ErfWriteContext * Context
+	BuildResourceList(
+		__in const ERF_HEADER & Header,
+		__out ErfResVec & Resources,
+		__out ULONGLONG & TotalSize
 		);
 
 	//
-	// Write the resource content list out.
+	// Copy the contents of each resource to its final offset.
 	//
 
 	void
-	WriteResourceContentList(
-		__inout ERF_HEADER & Header,
-		__in ErfWriteContext * Context
+	WriteResourceContents(
+		__in ErfWriteContext * Context,
+		__in const ErfResVec & Resources,
+		__in unsigned long Flags
 		);
 
 	//
@@ -505,17 +584,24 @@ private:
 		return '0.1V';
 	}
 
+	typedef typename IResourceAccessor< ResRefIf >::FileId AccessorFileId;
+	typedef typename IResourceAccessor< ResRefIf >::FileHandle AccessorFileHandle;
+
 	//
-	// Define a pending file that is awaiting addition.
+	// Define a pending file that is awaiting addition.  The contents are
+	// supplied by Contents, unless Accessor is non-NULL, in which case they
+	// are streamed from the accessor.
 	//
 
 	struct ErfPendingFile
 	{
-		ResRefIf                        ResRef;
-		typename ErfFileWriter::ResType ResType;
-		FileWrapper                     Contents;
-		HANDLE                          FileHandle;
-		swutil::SharedByteVec           Buffer;
+		ResRefIf                         ResRef;
+		typename ErfFileWriter::ResType  ResType;
+		FileWrapper                      Contents;
+		HANDLE                           FileHandle;
+		swutil::SharedByteVec            Buffer;
+		IResourceAccessor< ResRefIf >  * Accessor;
+		AccessorFileId                   FileIndex;
 
 		inline
 		ErfPendingFile(
@@ -524,8 +610,10 @@ private:
 			__in const std::string & FileName
 			)
 		{
-			this->ResRef  = ResRef;
-			this->ResType = ResType;
+			this->ResRef    = ResRef;
+			this->ResType   = ResType;
+			this->Accessor  = NULL;
+			this->FileIndex = 0;
 
 			FileHandle = CreateFileA(
 				FileName.c_str( ),
@@ -562,8 +650,10 @@ private:
 			__in size_t FileSize
 			)
 		{
-			this->ResRef  = ResRef;
-			this->ResType = ResType;
+			this->ResRef    = ResRef;
+			this->ResType   = ResType;
+			this->Accessor  = NULL;
+			this->FileIndex = 0;
 
 			FileHandle = INVALID_HANDLE_VALUE;
 
@@ -579,8 +669,10 @@ private:
 			__in const swutil::SharedByteVec & Buffer
 			)
 		{
-			this->ResRef  = ResRef;
-			this->ResType = ResType;
+			this->ResRef    = ResRef;
+			this->ResType   = ResType;
+			this->Accessor  = NULL;
+			this->FileIndex = 0;
 
 			FileHandle   = INVALID_HANDLE_VALUE;
 			this->Buffer = Buffer;
@@ -589,6 +681,22 @@ private:
 				Contents.SetExternalView( &Buffer->front( ), Buffer->size( ) );
 		}
 
+		inline
+		ErfPendingFile(
+			__in const ResRefIf & ResRef,
+			__in typename ErfFileWriter::ResType ResType,
+			__in IResourceAccessor< ResRefIf > * Accessor,
+			__in AccessorFileId FileIndex
+			)
+		{
+			this->ResRef    = ResRef;
+			this->ResType   = ResType;
+			this->Accessor  = Accessor;
+			this->FileIndex = FileIndex;
+
+			FileHandle = INVALID_HANDLE_VALUE;
+		}
+
 		inline
 		~ErfPendingFile(
 			)
@@ -604,6 +712,69 @@ private:
 	typedef swutil::SharedPtr< ErfPendingFile > ErfPendingFilePtr;
 	typedef std::vector< ErfPendingFilePtr > ErfPendingFileVec;
 
+	//
+	// Define the state shared by the threads that copy resource contents for
+	// a commit operation.  Accesses to accessor-backed files are serialized
+	// by AccessorLock.
+	//
+
+	struct ErfCopyContext
+	{
+		ErfFileWriter                 * Writer;
+		ErfWriteContext               * Output;
+		const RESOURCE_LIST_ELEMENT   * Resources;
+		swutil::CriticalSection         AccessorLock;
+		swutil::CriticalSection         ErrorLock;
+		volatile LONG                   Failed;
+		std::string                     Error;
+	};
+
+	enum
+	{
+		COPY_CHUNK_SIZE = 1024 * 1024,
+
+		LAST_COPY_CONSTANT
+	};
+
+	//
+	// Parallel work routine that copies the contents of one pending file.
+	//
+
+	static
+	void
+	CopyPendingFileRoutine(
+		__in void * Context,
+		__in size_t WorkItem
+		);
+
+	//
+	// Copy the contents of a pending file to its final offset.  Raises an
+	// std::exception on failure.
+	//
+
+	void
+	CopyPendingFile(
+		__in ErfCopyContext & Copy,
+		__in size_t FileIndex
+		);
+
+	//
+	// Read a range of the contents of a pending file.  Reads from a file
+	// backed by Contents must be sequential, starting at offset zero.  Raises
+	// an std::exception on failure.
+	//
+
+	static
+	void
+	ReadPendingFile(
+		__in ErfCopyContext & Copy,
+		__in ErfPendingFile * File,
+		__in AccessorFileHandle Handle,
+		__in ULONG Offset,
+		__out_bcount( Length ) void * Buffer,
+		__in ULONG Length
+		);
+
 	//
 	// Define the default file type if none is specified for a commit request.
 	//
@@ -11,6 +11,17 @@ Abstract:
 	This module defines the file wrapper object, which provides various common
 	wrapper operations for file I/O.
 
+	On Windows, the file wrapper operates on Win32 file handles and section
+	views.  Elsewhere, it operates on POSIX file descriptors, using mmap for
+	mapped views and pread for unmapped reads.
+
+	On POSIX platforms, this header is self-contained and does not depend on
+	the precompiled header.
+
+	N.B.  The readers built on the file wrapper (GFF, ERF, BIF, TLK and TRX)
+	      have not yet been ported; they still open their files through
+	      Win32.
+
 --*/
 
 #ifndef _PROGRAMS_NWN2DATALIB_FILEWRAPPER_H
@@ -20,14 +31,91 @@ Abstract:
 #pragma once
 #endif
 
+//
+// N.B.  The standard headers are included before any annotation shims below
+//       are defined, as the shims would otherwise collide with identifiers
+//       used inside the standard library implementation.
+//
+
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#if defined(_WIN32)
+
+typedef HANDLE FILE_WRAPPER_HANDLE;
+
+#define INVALID_FILE_WRAPPER_HANDLE INVALID_HANDLE_VALUE
+
+#else
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef int FILE_WRAPPER_HANDLE;
+
+#define INVALID_FILE_WRAPPER_HANDLE (-1)
+
+//
+// Supply the Windows types and annotations used by the file wrapper that the
+// Windows headers would otherwise provide.
+//
+
+#ifndef _ULONGLONG_
+typedef unsigned long long ULONGLONG;
+#endif
+
+#ifndef DECLSPEC_NORETURN
+#define DECLSPEC_NORETURN __attribute__((noreturn))
+#endif
+
+#ifndef __in
+#define __in
+#define __out
+#define __inout
+#endif
+
+#ifndef __in_bcount
+#define __in_bcount( Size )
+#define __out_bcount( Size )
+#define __inout_ecount( Size )
+#define __in_bcount_opt( Size )
+#define __out_bcount_full_opt( Size )
+#endif
+
+#endif
+
 class FileWrapper
 {
 
 public:
 
+	typedef FILE_WRAPPER_HANDLE FileHandle;
+
+	//
+	// Define access pattern hints, which describe how the remainder of the
+	// file is expected to be read.
+	//
+
+	enum AccessPattern
+	{
+		AccessPatternNormal,
+		AccessPatternSequential,
+		AccessPatternRandom,
+
+		LAST_ACCESS_PATTERN
+	};
+
 	inline
 	FileWrapper(
-		__in HANDLE File = INVALID_HANDLE_VALUE
+		__in FileHandle File = INVALID_FILE_WRAPPER_HANDLE
 		)
 		: m_File( File ),
 		  m_View( NULL ),
@@ -36,74 +124,45 @@ public:
 		  m_ExternalView( false )
 
 	{
-		if (File != INVALID_HANDLE_VALUE)
-			m_Offset = GetFilePointer( );
+		if (File != INVALID_FILE_WRAPPER_HANDLE)
+			m_Offset = GetNativeFilePointer( );
 	}
 
 	inline
 	~FileWrapper(
 		)
 	{
-		if ((m_View != NULL) && (!m_ExternalView))
-		{
-			UnmapViewOfFile( m_View );
-
-			m_View = NULL;
-		}
-		else if (m_View != NULL)
-		{
-			m_View = NULL;
-		}
+		ReleaseView( );
 	}
 
 	inline
 	void
 	SetFileHandle(
-		__in HANDLE File,
+		__in FileHandle File,
 		__in bool AsSection = true
 		)
 	{
+		ReleaseView( );
+
 		m_File         = File;
 		m_ExternalView = false;
 
-		if (m_View != NULL)
-		{
-			UnmapViewOfFile( m_View );
+		if (m_File == INVALID_FILE_WRAPPER_HANDLE)
+			return;
 
-			m_View = NULL;
-		}
+		m_Offset = GetNativeFilePointer( );
 
-		if ((m_File != INVALID_HANDLE_VALUE) &&
-		    (AsSection))
+		if (AsSection)
 		{
-			HANDLE Section;
+			unsigned char * View;
+			ULONGLONG       Size;
 
-			Section = CreateFileMapping(
-				m_File,
-				NULL,
-				PAGE_READONLY,
-				0,
-				0,
-				NULL);
+			View = MapNativeView( Size );
 
-			if (Section != NULL)
+			if (View != NULL)
 			{
-				unsigned char * View;
-
-				View = (unsigned char *) MapViewOfFile(
-					Section,
-					FILE_MAP_READ,
-					0,
-					0,
-					0);
-				CloseHandle( Section );
-
-				if (View != NULL)
-				{
-					m_Offset = GetFilePointer( );
-					m_Size   = GetFileSize( );
-					m_View   = View;
-				}
+				m_Size = Size;
+				m_View = View;
 			}
 		}
 	}
@@ -115,12 +174,139 @@ public:
 		__in ULONGLONG ViewSize
 		)
 	{
+		ReleaseView( );
+
 		m_Offset       = 0;
 		m_Size         = ViewSize;
 		m_View         = (unsigned char *) View; // Still const
 		m_ExternalView = true;
 	}
 
+	//
+	// Advise the system of the expected access pattern for the remainder of
+	// the file, so that read-ahead may be tuned accordingly.  The hint is
+	// purely advisory.
+	//
+	// N.B.  On Windows, the access pattern of a file handle is fixed when the
+	//       file is opened (FILE_FLAG_SEQUENTIAL_SCAN, FILE_FLAG_RANDOM_ACCESS)
+	//       and this routine has no effect.
+	//
+
+	inline
+	void
+	SetAccessPattern(
+		__in AccessPattern Pattern
+		)
+	{
+#if defined(_WIN32)
+		UNREFERENCED_PARAMETER( Pattern );
+#else
+		if ((m_View != NULL) && (!m_ExternalView))
+		{
+			int Advice;
+
+			switch (Pattern)
+			{
+
+			case AccessPatternSequential:
+				Advice = MADV_SEQUENTIAL;
+				break;
+
+			case AccessPatternRandom:
+				Advice = MADV_RANDOM;
+				break;
+
+			default:
+				Advice = MADV_NORMAL;
+				break;
+
+			}
+
+			madvise( m_View, (size_t) m_Size, Advice );
+		}
+
+#if defined(POSIX_FADV_NORMAL)
+		if ((m_File != INVALID_FILE_WRAPPER_HANDLE) && (!m_ExternalView))
+		{
+			int Advice;
+
+			switch (Pattern)
+			{
+
+			case AccessPatternSequential:
+				Advice = POSIX_FADV_SEQUENTIAL;
+				break;
+
+			case AccessPatternRandom:
+				Advice = POSIX_FADV_RANDOM;
+				break;
+
+			default:
+				Advice = POSIX_FADV_NORMAL;
+				break;
+
+			}
+
+			posix_fadvise( m_File, 0, 0, Advice );
+		}
+#endif
+#endif
+	}
+
+	//
+	// Advise the system that a range of the file will be read shortly (for
+	// example, a directory table that is about to be parsed), so that it may
+	// be brought into memory ahead of time.  The hint is purely advisory.
+	//
+	// N.B.  On Windows, this routine has no effect.
+	//
+
+	inline
+	void
+	PrefetchRange(
+		__in ULONGLONG Offset,
+		__in ULONGLONG Length
+		)
+	{
+#if defined(_WIN32)
+		UNREFERENCED_PARAMETER( Offset );
+		UNREFERENCED_PARAMETER( Length );
+#else
+		if ((Length == 0) || (m_ExternalView))
+			return;
+
+		if (m_View != NULL)
+		{
+			ULONGLONG PageMask;
+			ULONGLONG Start;
+
+			if (Offset >= m_Size)
+				return;
+
+			if (Length > m_Size - Offset)
+				Length = m_Size - Offset;
+
+			PageMask = (ULONGLONG) GetPageSize( ) - 1;
+			Start    = Offset & ~PageMask;
+
+			madvise(
+				m_View + (size_t) Start,
+				(size_t) (Offset + Length - Start),
+				MADV_WILLNEED);
+		}
+#if defined(POSIX_FADV_WILLNEED)
+		else if (m_File != INVALID_FILE_WRAPPER_HANDLE)
+		{
+			posix_fadvise(
+				m_File,
+				(off_t) Offset,
+				(off_t) Length,
+				POSIX_FADV_WILLNEED);
+		}
+#endif
+#endif
+	}
+
 	//
 	// ReadFile wrapper with descriptive exception raising on failure.
 	//
@@ -133,9 +319,6 @@ public:
 		__in const char * Description
 		)
 	{
-		DWORD Transferred;
-		char  ExMsg[ 64 ];
-
 		if (Length == 0)
 			return;
 
@@ -144,13 +327,7 @@ public:
 			if ((m_Offset + Length < m_Offset) ||
 			    (m_Offset + Length > m_Size))
 			{
-				StringCbPrintfA(
-					ExMsg,
-					sizeof( ExMsg ),
-					"ReadFile( %s ) failed.",
-					Description);
-
-				throw std::runtime_error( ExMsg );
+				ThrowIoError( "ReadFile", Description );
 			}
 
 			xmemcpy(
@@ -162,6 +339,9 @@ public:
 			return;
 		}
 
+#if defined(_WIN32)
+		DWORD Transferred;
+
 		if (::ReadFile(
 			m_File,
 			Buffer,
@@ -169,14 +349,44 @@ public:
 			&Transferred,
 			NULL) && (Transferred == (DWORD) Length))
 			return;
+#else
+		unsigned char * Dest;
+		size_t          Remaining;
 
-		StringCbPrintfA(
-			ExMsg,
-			sizeof( ExMsg ),
-			"ReadFile( %s ) failed.",
-			Description);
+		Dest      = (unsigned char *) Buffer;
+		Remaining = Length;
 
-		throw std::runtime_error( ExMsg );
+		while (Remaining != 0)
+		{
+			ssize_t Transferred;
+
+			Transferred = pread(
+				m_File,
+				Dest,
+				Remaining,
+				(off_t) m_Offset);
+
+			if (Transferred < 0)
+			{
+				if (errno == EINTR)
+					continue;
+
+				break;
+			}
+
+			if (Transferred == 0)
+				break;
+
+			Dest      += Transferred;
+			Remaining -= (size_t) Transferred;
+			m_Offset  += (ULONGLONG) Transferred;
+		}
+
+		if (Remaining == 0)
+			return;
+#endif
+
+		ThrowIoError( "ReadFile", Description );
 	}
 
 	//
@@ -190,28 +400,20 @@ public:
 		__in const char * Description
 		)
 	{
-		LONG  Low;
-		LONG  High;
-		DWORD NewPtrLow;
-		char  ExMsg[ 64 ];
-
 		if (m_View != NULL)
 		{
 			if (Offset >= m_Size)
-			{
-				StringCbPrintfA(
-					ExMsg,
-					sizeof( ExMsg ),
-					"SeekOffset( %s ) failed.",
-					Description);
-
-				throw std::runtime_error( ExMsg );
-			}
+				ThrowIoError( "SeekOffset", Description );
 
 			m_Offset = Offset;
 			return;
 		}
 
+#if defined(_WIN32)
+		LONG  Low;
+		LONG  High;
+		DWORD NewPtrLow;
+
 		Low  = (LONG) ((Offset >>  0) & 0xFFFFFFFF);
 		High = (LONG) ((Offset >> 32) & 0xFFFFFFFF);
 
@@ -220,13 +422,116 @@ public:
 		if ((NewPtrLow == INVALID_SET_FILE_POINTER) &&
 			(GetLastError( ) != NO_ERROR))
 		{
-			StringCbPrintfA(
-				ExMsg,
-				sizeof( ExMsg ),
-				"SeekOffset( %s ) failed.",
-				Description);
+			ThrowIoError( "SeekOffset", Description );
+		}
+#else
+		if ((off_t) Offset < 0)
+			ThrowIoError( "SeekOffset", Description );
+
+		//
+		// Unmapped reads are positional, so the wrapper itself tracks the
+		// file pointer.
+		//
+
+		m_Offset = Offset;
+#endif
+	}
+
+	//
+	// Define a single extent of a ReadExtents request.
+	//
+
+	struct ReadExtent
+	{
+		ULONGLONG Offset;
+		size_t    Length;
+		void    * Buffer;
+	};
+
+	//
+	// Read a set of extents, each into its own buffer.  The extents are read
+	// in file offset order, and runs of extents that lie close together in
+	// the file are transferred with a single read, so that many small random
+	// reads become a few large sequential ones.  The extent array is sorted
+	// in place.  Raises an std::exception on failure.
+	//
+
+	inline
+	void
+	ReadExtents(
+		__inout_ecount( Count ) ReadExtent * Extents,
+		__in size_t Count,
+		__in const char * Description
+		)
+	{
+		std::vector< unsigned char > Staging;
+		size_t                       First;
+
+		std::sort( Extents, Extents + Count, ReadExtentLess( ) );
+
+		for (First = 0; First < Count; )
+		{
+			ULONGLONG RunEnd;
+			size_t    Last;
+
+			//
+			// Extend the run while the next extent starts within a small gap
+			// of the end of the run, and the run remains of bounded size.
+			// Reads from a mapped view are plain copies, so there is nothing
+			// to gain from coalescing them.
+			//
+
+			RunEnd = Extents[ First ].Offset + Extents[ First ].Length;
+
+			for (Last = First + 1; Last < Count; Last += 1)
+			{
+				ULONGLONG End;
+
+				if (m_View != NULL)
+					break;
+
+				if (Extents[ Last ].Offset > RunEnd + EXTENT_MAX_GAP)
+					break;
+
+				End = Extents[ Last ].Offset + Extents[ Last ].Length;
+
+				if (End < RunEnd)
+					End = RunEnd;
 
-			throw std::runtime_error( ExMsg );
+				if (End - Extents[ First ].Offset > EXTENT_MAX_RUN)
+					break;
+
+				RunEnd = End;
+			}
+
+			if (Last == First + 1)
+			{
+				if (Extents[ First ].Length != 0)
+				{
+					SeekOffset( Extents[ First ].Offset, Description );
+					ReadFile( Extents[ First ].Buffer, Extents[ First ].Length, Description );
+				}
+			}
+			else
+			{
+				Staging.resize( (size_t) (RunEnd - Extents[ First ].Offset) );
+
+				SeekOffset( Extents[ First ].Offset, Description );
+				ReadFile( &Staging[ 0 ], Staging.size( ), Description );
+
+				for (size_t i = First; i < Last; i += 1)
+				{
+					if (Extents[ i ].Length == 0)
+						continue;
+
+					memcpy(
+						Extents[ i ].Buffer,
+						&Staging[ (size_t) (Extents[ i ].Offset - Extents[ First ].Offset) ],
+						Extents[ i ].Length);
+				}
+			}
+
+			First = Last;
 		}
 	}
 
@@ -235,12 +540,13 @@ public:
 	GetFileSize(
 		) const
 	{
-		ULONGLONG Size;
-		DWORD     SizeHigh;
-
 		if (m_View != NULL)
 			return m_Size;
 
+#if defined(_WIN32)
+		ULONGLONG Size;
+		DWORD     SizeHigh;
+
 		Size = ::GetFileSize( m_File, &SizeHigh );
 
 		if ((Size == INVALID_FILE_SIZE) && (GetLastError( ) != NO_ERROR))
@@ -249,6 +555,14 @@ public:
 		}
 
 		return Size | ((ULONGLONG) SizeHigh) << 32;
+#else
+		struct stat St;
+
+		if (fstat( m_File, &St ) != 0)
+			throw std::runtime_error( "GetFileSize failed" );
+
+		return (ULONGLONG) St.st_size;
+#endif
 	}
 
 	inline
@@ -256,20 +570,321 @@ public:
 	GetFilePointer(
 		) const
 	{
-		LARGE_INTEGER Fp;
-
 		if (m_View != NULL)
 			return m_Offset;
 
+#if defined(_WIN32)
+		return GetNativeFilePointer( );
+#else
+		return m_Offset;
+#endif
+	}
+
+private:
+
+	//
+	// Define the largest gap between extents, and the largest run of
+	// extents, that ReadExtents transfers with a single read.
+	//
+
+	enum
+	{
+		EXTENT_MAX_GAP = 64 * 1024,
+		EXTENT_MAX_RUN = 4 * 1024 * 1024,
+
+		LAST_EXTENT_CONSTANT
+	};
+
+#if !defined(_WIN32)
+
+	//
+	// Define the huge page size that large mappings are aligned to, and the
+	// smallest file that is mapped huge-page aligned.  Aligning the view lets
+	// the kernel back it with huge pages where it supports doing so for file
+	// mappings, which reduces TLB pressure for random access across a large
+	// BIF.  Small files are not worth the extra address space.
+	//
+
+	enum
+	{
+		HUGE_PAGE_SIZE              = 2 * 1024 * 1024,
+		HUGE_PAGE_MAPPING_THRESHOLD = 16 * 1024 * 1024,
+
+		LAST_MAPPING_CONSTANT
+	};
+
+#endif
+
+	struct ReadExtentLess
+	{
+		inline
+		bool
+		operator()(
+			__in const ReadExtent & left,
+			__in const ReadExtent & right
+			) const
+		{
+			return left.Offset < right.Offset;
+		}
+	};
+
+	//
+	// Retrieve the current file pointer of the underlying file.
+	//
+
+	inline
+	ULONGLONG
+	GetNativeFilePointer(
+		) const
+	{
+#if defined(_WIN32)
+		LARGE_INTEGER Fp;
+
 		Fp.QuadPart = 0;
 
 		if (!SetFilePointerEx( m_File, Fp, &Fp, FILE_CURRENT ))
 			throw std::runtime_error( "SetFilePointerEx failed" );
 
 		return Fp.QuadPart;
+#else
+		off_t Fp;
+
+		Fp = lseek( m_File, 0, SEEK_CUR );
+
+		if (Fp == (off_t) -1)
+			throw std::runtime_error( "lseek failed" );
+
+		return (ULONGLONG) Fp;
+#endif
 	}
 
-private:
+	//
+	// Map a read only view of the entire underlying file.  The routine
+	// returns NULL if the file could not be mapped, in which case the caller
+	// falls back to unmapped reads.
+	//
+
+	inline
+	unsigned char *
+	MapNativeView(
+		__out ULONGLONG & Size
+		)
+	{
+#if defined(_WIN32)
+		HANDLE          Section;
+		unsigned char * View;
+
+		Section = CreateFileMapping(
+			m_File,
+			NULL,
+			PAGE_READONLY,
+			0,
+			0,
+			NULL);
+
+		if (Section == NULL)
+			return NULL;
+
+		View = (unsigned char *) MapViewOfFile(
+			Section,
+			FILE_MAP_READ,
+			0,
+			0,
+			0);
+		CloseHandle( Section );
+
+		if (View == NULL)
+			return NULL;
+
+		try
+		{
+			Size = GetFileSize( );
+		}
+		catch (std::exception)
+		{
+			UnmapViewOfFile( View );
+			return NULL;
+		}
+
+		return View;
+#else
+		struct stat St;
+		void      * View;
+
+		if (fstat( m_File, &St ) != 0)
+			return NULL;
+
+		if ((St.st_size <= 0) ||
+		    ((ULONGLONG) St.st_size > (ULONGLONG) (size_t) -1))
+		{
+			return NULL;
+		}
+
+		Size = (ULONGLONG) St.st_size;
+		View = NULL;
+
+		if (Size >= HUGE_PAGE_MAPPING_THRESHOLD)
+			View = MapHugePageAlignedView( (size_t) Size );
+
+		if (View == NULL)
+		{
+			View = mmap(
+				NULL,
+				(size_t) Size,
+				PROT_READ,
+				MAP_PRIVATE,
+				m_File,
+				0);
+
+			if (View == MAP_FAILED)
+				return NULL;
+		}
+
+		return (unsigned char *) View;
+#endif
+	}
+
+#if !defined(_WIN32)
+
+	//
+	// Map a read only view of the entire underlying file at a huge page
+	// aligned address.  Address space for the view (plus alignment slack) is
+	// reserved first, the file is mapped over the aligned portion of the
+	// reservation, and the slack on either side is then released.  The
+	// routine returns NULL on failure.
+	//
+
+	inline
+	void *
+	MapHugePageAlignedView(
+		__in size_t Size
+		)
+	{
+		unsigned char * Reserve;
+		unsigned char * Aligned;
+		unsigned char * ReserveEnd;
+		unsigned char * ViewEnd;
+		size_t          PageMask;
+		void          * View;
+
+		if (Size + HUGE_PAGE_SIZE < Size)
+			return NULL;
+
+		Reserve = (unsigned char *) mmap(
+			NULL,
+			Size + HUGE_PAGE_SIZE,
+			PROT_NONE,
+			MAP_PRIVATE | MAP_ANONYMOUS,
+			-1,
+			0);
+
+		if ((void *) Reserve == MAP_FAILED)
+			return NULL;
+
+		Aligned = (unsigned char *)
+			(((uintptr_t) Reserve + HUGE_PAGE_SIZE - 1) & ~((uintptr_t) HUGE_PAGE_SIZE - 1));
+
+		View = mmap(
+			Aligned,
+			Size,
+			PROT_READ,
+			MAP_PRIVATE | MAP_FIXED,
+			m_File,
+			0);
+
+		if (View == MAP_FAILED)
+		{
+			munmap( Reserve, Size + HUGE_PAGE_SIZE );
+			return NULL;
+		}
+
+		PageMask   = GetPageSize( ) - 1;
+		ViewEnd    = Aligned + ((Size + PageMask) & ~PageMask);
+		ReserveEnd = Reserve + ((Size + HUGE_PAGE_SIZE + PageMask) & ~PageMask);
+
+		if (Aligned > Reserve)
+			munmap( Reserve, (size_t) (Aligned - Reserve) );
+
+		if (ReserveEnd > ViewEnd)
+			munmap( ViewEnd, (size_t) (ReserveEnd - ViewEnd) );
+
+#if defined(MADV_HUGEPAGE)
+		madvise( View, Size, MADV_HUGEPAGE );
+#endif
+
+		return View;
+	}
+
+	inline
+	static
+	size_t
+	GetPageSize(
+		)
+	{
+		long PageSize;
+
+		PageSize = sysconf( _SC_PAGESIZE );
+
+		if (PageSize <= 0)
+			PageSize = 4096;
+
+		return (size_t) PageSize;
+	}
+
+#endif
+
+	//
+	// Release the current view, unmapping it unless it was supplied by the
+	// caller.
+	//
+
+	inline
+	void
+	ReleaseView(
+		)
+	{
+		if ((m_View != NULL) && (!m_ExternalView))
+		{
+#if defined(_WIN32)
+			UnmapViewOfFile( m_View );
+#else
+			munmap( m_View, (size_t) m_Size );
+#endif
+		}
+
+		m_View = NULL;
+	}
+
+	DECLSPEC_NORETURN
+	inline
+	void
+	ThrowIoError(
+		__in const char * Operation,
+		__in const char * Description
+		)
+	{
+		char ExMsg[ 64 ];
+
+#if defined(_WIN32)
+		StringCbPrintfA(
+			ExMsg,
+			sizeof( ExMsg ),
+			"%s( %s ) failed.",
+			Operation,
+			Description);
+#else
+		snprintf(
+			ExMsg,
+			sizeof( ExMsg ),
+			"%s( %s ) failed.",
+			Operation,
+			Description);
+#endif
+
+		throw std::runtime_error( ExMsg );
+	}
+
+#if defined(_WIN32)
 
 	DECLSPEC_NORETURN
 	inline
@@ -300,7 +915,29 @@ private:
 		}
 	}
 
-	HANDLE          m_File;
+#else
+
+	//
+	// N.B.  An I/O error behind a mapped view (for example, truncation of the
+	//       file by another process) is raised as SIGBUS, which cannot be
+	//       converted into an exception here.  Files that may be truncated
+	//       while open should not be mapped.
+	//
+
+	inline
+	void *
+	xmemcpy(
+		__out_bcount_full_opt(_Size) void * _Dst,
+		__in_bcount_opt(_Size) const void * _Src,
+		__in size_t _Size
+		)
+	{
+		return (memcpy( _Dst, _Src, _Size ));
+	}
+
+#endif
+
+	FileHandle      m_File;
 	unsigned char * m_View;
 	ULONGLONG       m_Offset;
 	ULONGLONG       m_Size;
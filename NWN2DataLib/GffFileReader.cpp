@@ -52,6 +52,7 @@ Environment:
 --*/
 : m_File( INVALID_HANDLE_VALUE ),
   m_FileSize( 0 ),
+  m_LabelSlotMask( 0 ),
   m_Language( LangEnglish ),
   m_ResourceManager( ResMan )
 {
@@ -141,6 +142,7 @@ Environment:
 --*/
 : m_File( INVALID_HANDLE_VALUE ),
   m_FileSize( (unsigned long) DataSize ),
+  m_LabelSlotMask( 0 ),
   m_Language( LangEnglish ),
   m_ResourceManager( ResMan )
 {
@@ -151,6 +153,52 @@ Environment:
 	ParseGffFile( );
 }
 
+GffFileReader::GffFileReader(
+	__in const DemandBufferPtr & GffBuffer,
+	__in ResourceManager & ResMan
+	)
+/*++
+
+Routine Description:
+
+	This routine constructs a new GffFileReader object and parses the contents
+	of a GFF file from a demand-loaded resource buffer, as returned by the
+	ResourceManager::DemandView routine.  The GffFileReader object maintains
+	a reference to the buffer for its lifetime.
+
+Arguments:
+
+	GffBuffer - Supplies the demand buffer containing the raw GFF file data.
+
+	ResMan - Supplies the resource manager instance that is used to look up
+	         STRREFs from talk tables.
+
+Return Value:
+
+	The newly constructed object.
+
+Environment:
+
+	User mode.
+
+--*/
+: m_File( INVALID_HANDLE_VALUE ),
+  m_FileSize( (unsigned long) GffBuffer->GetSize( ) ),
+  m_LabelSlotMask( 0 ),
+  m_Language( LangEnglish ),
+  m_ResourceManager( ResMan ),
+  m_DemandBuffer( GffBuffer )
+{
+	if (m_DemandBuffer->GetSize( ) > ULONG_MAX)
+		throw std::runtime_error( "GFF buffer is too large." );
+
+	m_FileWrapper.SetExternalView(
+		m_DemandBuffer->GetData( ),
+		(ULONGLONG) m_DemandBuffer->GetSize( ));
+
+	ParseGffFile( );
+}
+
 GffFileReader::~GffFileReader(
 	)
 /*++
@@ -189,7 +237,7 @@ GffFileReader::ParseGffFile(
 Routine Description:
 
 	This routine parses the contents of the GFF file, which consists of
-	reading the main fixed header block in.
+	reading the main fixed header block in, followed by the directory tables.
 
 Arguments:
 
@@ -242,6 +290,12 @@ Environment:
 	if ((ULONGLONG) m_Header.ListIndiciesCount + m_Header.ListIndiciesOffset > FileSize)
 		throw std::runtime_error( "List indicies accounting is incorrect." );
 
+	//
+	// Read the directory tables in and index the labels.
+	//
+
+	BuildIndex( );
+
 	//
 	// Now pull in the default structure.
 	//
@@ -255,10 +309,165 @@ Environment:
 	m_RootStruct.SetStructEntry( &RootStructEntry );
 
 	//
-	// The remainder of the file is just processed on demand.
+	// The remainder of the file (i.e. the field data and list indicies) is
+	// just processed on demand.
 	//
 }
 
+void
+GffFileReader::BuildIndex(
+	)
+/*++
+
+Routine Description:
+
+	This routine reads the struct, field, label and field index tables of the
+	GFF file into memory, and builds the label hash table.  Subsequent
+	navigation of the GFF hierarchy is then performed against the in-memory
+	tables, with only field data and list indicies being read on demand.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	size_t    SlotCount;
+	LabelSlot EmptySlot;
+
+	m_Structs.resize( m_Header.StructCount );
+	m_Fields.resize( m_Header.FieldCount );
+	m_Labels.resize( m_Header.LabelCount );
+	m_FieldIndicies.resize( m_Header.FieldIndiciesCount );
+
+	if (!m_Structs.empty( ))
+	{
+		SEEK_OFFSET( m_Header.StructOffset );
+		READ_FILE( &m_Structs[ 0 ], m_Structs.size( ) * sizeof( GFF_STRUCT_ENTRY ) );
+	}
+
+	if (!m_Fields.empty( ))
+	{
+		SEEK_OFFSET( m_Header.FieldOffset );
+		READ_FILE( &m_Fields[ 0 ], m_Fields.size( ) * sizeof( GFF_FIELD_ENTRY ) );
+	}
+
+	if (!m_Labels.empty( ))
+	{
+		SEEK_OFFSET( m_Header.LabelOffset );
+		READ_FILE( &m_Labels[ 0 ], m_Labels.size( ) * sizeof( GFF_LABEL_ENTRY ) );
+	}
+
+	if (!m_FieldIndicies.empty( ))
+	{
+		SEEK_OFFSET( m_Header.FieldIndiciesOffset );
+		READ_FILE( &m_FieldIndicies[ 0 ], m_FieldIndicies.size( ) );
+	}
+
+	//
+	// Size the label hash table to at most half full, and insert each
+	// distinct label text, recording the canonical label index of each label
+	// as we go.
+	//
+
+	for (SlotCount = 16; SlotCount < m_Labels.size( ) * 2; SlotCount *= 2)
+		NOTHING;
+
+	ZeroMemory( &EmptySlot, sizeof( EmptySlot ) );
+	EmptySlot.LabelIndex = EMPTY_LABEL_SLOT;
+
+	m_LabelSlots.assign( SlotCount, EmptySlot );
+	m_LabelSlotMask = SlotCount - 1;
+	m_CanonicalLabels.resize( m_Labels.size( ) );
+
+	for (LABEL_INDEX LabelIndex = 0;
+	     LabelIndex < m_Labels.size( );
+	     LabelIndex += 1)
+	{
+		const GFF_LABEL_ENTRY & Label = m_Labels[ LabelIndex ];
+		size_t                  i;
+
+		for (i = (size_t) GffHashLabel( Label ) & m_LabelSlotMask;
+		     m_LabelSlots[ i ].LabelIndex != EMPTY_LABEL_SLOT;
+		     i = (i + 1) & m_LabelSlotMask)
+		{
+			if (!memcmp( &m_LabelSlots[ i ].Name, &Label, sizeof( Label ) ))
+				break;
+		}
+
+		if (m_LabelSlots[ i ].LabelIndex == EMPTY_LABEL_SLOT)
+		{
+			m_LabelSlots[ i ].Name       = Label;
+			m_LabelSlots[ i ].LabelIndex = LabelIndex;
+		}
+
+		m_CanonicalLabels[ LabelIndex ] = m_LabelSlots[ i ].LabelIndex;
+	}
+}
+
+bool
+GffFileReader::FindLabel(
+	__in const char * Name,
+	__out LABEL_INDEX & LabelIndex
+	) const
+/*++
+
+Routine Description:
+
+	This routine locates the canonical label index for a label name.  Names
+	are matched in the same fashion as CompareFieldName, i.e. the name is
+	truncated to the label length and compared with the zero padded label.
+
+Arguments:
+
+	Name - Supplies the label name to look up.
+
+	LabelIndex - Receives the canonical label index, on success.
+
+Return Value:
+
+	The routine returns true if a label with the given text exists, else false.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	size_t          NameLen;
+	GFF_LABEL_ENTRY CompareEntry;
+
+	if (m_LabelSlots.empty( ))
+		return false;
+
+	NameLen = strlen( Name );
+	NameLen = min( NameLen, sizeof( CompareEntry.Name ) );
+
+	ZeroMemory( &CompareEntry, sizeof( CompareEntry ) );
+	memcpy( CompareEntry.Name, Name, NameLen );
+
+	for (size_t i = (size_t) GffHashLabel( CompareEntry ) & m_LabelSlotMask;
+	     m_LabelSlots[ i ].LabelIndex != EMPTY_LABEL_SLOT;
+	     i = (i + 1) & m_LabelSlotMask)
+	{
+		if (!memcmp( &m_LabelSlots[ i ].Name, &CompareEntry, sizeof( CompareEntry ) ))
+		{
+			LabelIndex = m_LabelSlots[ i ].LabelIndex;
+			return true;
+		}
+	}
+
+	return false;
+}
+
 void
 GffFileReader::GetFieldByIndex(
 	__in FIELD_INDEX FieldIndex,
@@ -286,11 +495,10 @@ Environment:
 
 --*/
 {
-	if (FieldIndex >= m_Header.FieldCount)
+	if (FieldIndex >= m_Fields.size( ))
 		throw std::runtime_error( "Illegal field index." );
 
-	SEEK_OFFSET( (ULONGLONG) FieldIndex * sizeof( GFF_FIELD_ENTRY ) + m_Header.FieldOffset );
-	READ_FILE( &FieldEntry, sizeof( FieldEntry ) );
+	FieldEntry = m_Fields[ FieldIndex ];
 }
 
 void
@@ -320,13 +528,10 @@ Environment:
 
 --*/
 {
-	GFF_LABEL_ENTRY LabelEntry;
-
-	if (LabelIndex >= m_Header.LabelCount)
+	if (LabelIndex >= m_Labels.size( ))
 		throw std::runtime_error( "Illegal label index." );
 
-	SEEK_OFFSET( (ULONGLONG) LabelIndex * sizeof( GFF_LABEL_ENTRY ) + m_Header.LabelOffset );
-	READ_FILE( &LabelEntry, sizeof( LabelEntry ) );
+	const GFF_LABEL_ENTRY & LabelEntry = m_Labels[ LabelIndex ];
 
 	//
 	// Now convert the label to an std::string.
@@ -371,11 +576,10 @@ Environment:
 
 --*/
 {
-	if (StructIndex >= m_Header.StructCount)
+	if (StructIndex >= m_Structs.size( ))
 		throw std::runtime_error( "Illegal struct index." );
 
-	SEEK_OFFSET( (ULONGLONG) StructIndex * sizeof( GFF_STRUCT_ENTRY ) + m_Header.StructOffset );
-	READ_FILE( &StructEntry, sizeof( StructEntry ) );
+	StructEntry = m_Structs[ StructIndex ];
 }
 
 bool
@@ -408,14 +612,12 @@ Environment:
 --*/
 {
 	size_t          NameLen;
-	GFF_LABEL_ENTRY LabelEntry;
 	GFF_LABEL_ENTRY CompareEntry;
 
-	if (FieldEntry.LabelIndex >= m_Header.LabelCount)
+	if (FieldEntry.LabelIndex >= m_Labels.size( ))
 		throw std::runtime_error( "Illegal label index." );
 
-	SEEK_OFFSET( (ULONGLONG) FieldEntry.LabelIndex * sizeof( GFF_LABEL_ENTRY ) + m_Header.LabelOffset );
-	READ_FILE( &LabelEntry, sizeof( LabelEntry ) );
+	const GFF_LABEL_ENTRY & LabelEntry = m_Labels[ FieldEntry.LabelIndex ];
 
 	NameLen = strlen( Name );
 	NameLen = min( NameLen, sizeof( LabelEntry.Name ) );
@@ -459,41 +661,52 @@ Environment:
 
 --*/
 {
-	try
+	LABEL_INDEX LabelIndex;
+
+	//
+	// Resolve the name to a label once, after which each field is matched by
+	// comparing canonical label indicies.
+	//
+
+	if (!FindLabel( FieldName, LabelIndex ))
+		return false;
+
+	if (Struct->FieldCount == 1)
 	{
-		if (Struct->FieldCount == 1)
-		{
-			GetFieldByIndex( Struct->DataOrDataOffset, FieldEntry );
+		if (Struct->DataOrDataOffset >= m_Fields.size( ))
+			return false;
 
-			return (CompareFieldName( FieldEntry, FieldName ) == true);
-		}
-		else
-		{
-			for (FIELD_INDICIES_INDEX IndexOffset = 0;
-			     IndexOffset < Struct->FieldCount;
-			     IndexOffset += 1)
-			{
-				FIELD_INDEX FieldIndex;
+		FieldEntry = m_Fields[ Struct->DataOrDataOffset ];
 
-				if ((ULONGLONG) IndexOffset * sizeof( FIELD_INDEX ) + Struct->DataOrDataOffset > m_Header.FieldIndiciesCount)
-					throw std::runtime_error( "Illegal field indicies index." );
+		return (FieldEntry.LabelIndex < m_CanonicalLabels.size( )) &&
+		       (m_CanonicalLabels[ FieldEntry.LabelIndex ] == LabelIndex);
+	}
 
-				SEEK_OFFSET( (ULONGLONG) IndexOffset * sizeof( FIELD_INDEX ) + Struct->DataOrDataOffset + m_Header.FieldIndiciesOffset );
-				READ_FILE( &FieldIndex, sizeof( FieldIndex ) );
+	for (FIELD_INDICIES_INDEX IndexOffset = 0;
+	     IndexOffset < Struct->FieldCount;
+	     IndexOffset += 1)
+	{
+		FIELD_INDEX FieldIndex;
 
-				GetFieldByIndex( FieldIndex, FieldEntry );
+		if (!GetStructFieldIndex( Struct, IndexOffset, FieldIndex ))
+			return false;
 
-				if (CompareFieldName( FieldEntry, FieldName ))
-					return true;
-			}
+		if (FieldIndex >= m_Fields.size( ))
+			return false;
+
+		const GFF_FIELD_ENTRY & Entry = m_Fields[ FieldIndex ];
 
+		if (Entry.LabelIndex >= m_CanonicalLabels.size( ))
 			return false;
+
+		if (m_CanonicalLabels[ Entry.LabelIndex ] == LabelIndex)
+		{
+			FieldEntry = Entry;
+			return true;
 		}
 	}
-	catch (std::exception)
-	{
-		return false;
-	}
+
+	return false;
 }
 
 bool
@@ -553,12 +766,9 @@ Environment:
 
 			IndexOffset = (FIELD_INDICIES_INDEX) FieldIndex;
 
-			if ((ULONGLONG) IndexOffset * sizeof( FIELD_INDEX ) + Struct->DataOrDataOffset > m_Header.FieldIndiciesCount)
+			if (!GetStructFieldIndex( Struct, IndexOffset, FieldIndex ))
 				throw std::runtime_error( "Illegal field indicies index." );
 
-			SEEK_OFFSET( (ULONGLONG) IndexOffset * sizeof( FIELD_INDEX ) + Struct->DataOrDataOffset + m_Header.FieldIndiciesOffset );
-			READ_FILE( &FieldIndex, sizeof( FieldIndex ) );
-
 			GetFieldByIndex( FieldIndex, FieldEntry );
 		}
 
@@ -603,46 +813,49 @@ Environment:
 
 --*/
 {
-	try
+	LABEL_INDEX LabelIndex;
+
+	if (!FindLabel( FieldName, LabelIndex ))
+		return false;
+
+	if (Struct->FieldCount == 1)
 	{
-		GFF_FIELD_ENTRY FieldEntry;
+		if (Struct->DataOrDataOffset >= m_Fields.size( ))
+			return false;
 
-		if (Struct->FieldCount == 1)
-		{
-			FieldIndex = 0;
+		const GFF_FIELD_ENTRY & Entry = m_Fields[ Struct->DataOrDataOffset ];
 
-			return (CompareFieldName( FieldEntry, FieldName ) == true);
-		}
-		else
-		{
-			for (FIELD_INDICIES_INDEX IndexOffset = 0;
-			     IndexOffset < Struct->FieldCount;
-			     IndexOffset += 1)
-			{
-				FIELD_INDEX QueryFieldIndex;
+		FieldIndex = 0;
 
-				if ((ULONGLONG) IndexOffset * sizeof( FIELD_INDEX ) + Struct->DataOrDataOffset > m_Header.FieldIndiciesCount)
-					throw std::runtime_error( "Illegal field indicies index." );
+		return (Entry.LabelIndex < m_CanonicalLabels.size( )) &&
+		       (m_CanonicalLabels[ Entry.LabelIndex ] == LabelIndex);
+	}
 
-				SEEK_OFFSET( (ULONGLONG) IndexOffset * sizeof( FIELD_INDEX ) + Struct->DataOrDataOffset + m_Header.FieldIndiciesOffset );
-				READ_FILE( &QueryFieldIndex, sizeof( QueryFieldIndex ) );
+	for (FIELD_INDICIES_INDEX IndexOffset = 0;
+	     IndexOffset < Struct->FieldCount;
+	     IndexOffset += 1)
+	{
+		FIELD_INDEX QueryFieldIndex;
 
-				GetFieldByIndex( QueryFieldIndex, FieldEntry );
+		if (!GetStructFieldIndex( Struct, IndexOffset, QueryFieldIndex ))
+			return false;
 
-				if (CompareFieldName( FieldEntry, FieldName ))
-				{
-					FieldIndex = QueryFieldIndex;
-					return true;
-				}
-			}
+		if (QueryFieldIndex >= m_Fields.size( ))
+			return false;
+
+		const GFF_FIELD_ENTRY & Entry = m_Fields[ QueryFieldIndex ];
 
+		if (Entry.LabelIndex >= m_CanonicalLabels.size( ))
 			return false;
+
+		if (m_CanonicalLabels[ Entry.LabelIndex ] == LabelIndex)
+		{
+			FieldIndex = QueryFieldIndex;
+			return true;
 		}
 	}
-	catch (std::exception)
-	{
-		return false;
-	}
+
+	return false;
 }
 
 bool
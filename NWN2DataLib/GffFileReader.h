@@ -22,6 +22,7 @@ Abstract:
 #endif
 
 #include "FileWrapper.h"
+#include "DemandBuffer.h"
 
 class ResourceManager;
 
@@ -68,6 +69,11 @@ public:
 		__in ResourceManager & ResMan
 		);
 
+	GffFileReader(
+		__in const DemandBufferPtr & GffBuffer,
+		__in ResourceManager & ResMan
+		);
+
 	//
 	// Destructor.
 	//
@@ -131,6 +137,15 @@ private:
 	ParseGffFile(
 		);
 
+	//
+	// Read the struct, field, label and field index tables in and build the
+	// label index.
+	//
+
+	void
+	BuildIndex(
+		);
+
 public:
 
 	//
@@ -1162,6 +1177,43 @@ private:
 		__out GFF_STRUCT_ENTRY & StructEntry
 		) const;
 
+	//
+	// Look up the canonical label index of a label name, i.e. the index of the
+	// first label with that text.  The routine returns false if no label in
+	// the file has that text.
+	//
+
+	bool
+	FindLabel(
+		__in const char * Name,
+		__out LABEL_INDEX & LabelIndex
+		) const;
+
+	//
+	// Read an entry from a struct's field index list.  The routine returns
+	// false if the entry lies outside of the field indicies table.
+	//
+
+	inline
+	bool
+	GetStructFieldIndex(
+		__in PCGFF_STRUCT_ENTRY Struct,
+		__in FIELD_INDICIES_INDEX IndexOffset,
+		__out FIELD_INDEX & FieldIndex
+		) const
+	{
+		ULONGLONG Offset;
+
+		Offset = (ULONGLONG) IndexOffset * sizeof( FIELD_INDEX ) + Struct->DataOrDataOffset;
+
+		if (Offset + sizeof( FIELD_INDEX ) > m_FieldIndicies.size( ))
+			return false;
+
+		memcpy( &FieldIndex, &m_FieldIndicies[ (size_t) Offset ], sizeof( FieldIndex ) );
+
+		return true;
+	}
+
 	//
 	// Compare field names.
 	//
@@ -1330,6 +1382,46 @@ private:
 	mutable FileWrapper   m_FileWrapper;
 	GFF_HEADER            m_Header;
 
+	//
+	// Define the in-memory copies of the struct, field, label and field index
+	// tables, which are read in once at parse time so that navigating the
+	// GFF hierarchy requires no file I/O.
+	//
+	// Labels are looked up by name through an open-addressed hash table of
+	// distinct label texts.  As a label table may contain the same text more
+	// than once, each label index is also mapped to the canonical (first)
+	// label index with the same text, which is what field labels are
+	// compared by.
+	//
+
+	struct LabelSlot
+	{
+		GFF_LABEL_ENTRY Name;
+		LABEL_INDEX     LabelIndex;
+	};
+
+	enum
+	{
+		EMPTY_LABEL_SLOT = 0xFFFFFFFF,
+
+		LAST_LABEL_CONSTANT
+	};
+
+	typedef std::vector< GFF_STRUCT_ENTRY > StructEntryVec;
+	typedef std::vector< GFF_FIELD_ENTRY > FieldEntryVec;
+	typedef std::vector< GFF_LABEL_ENTRY > LabelEntryVec;
+	typedef std::vector< LABEL_INDEX > LabelIndexVec;
+	typedef std::vector< LabelSlot > LabelSlotVec;
+	typedef std::vector< unsigned char > FieldIndiciesVec;
+
+	StructEntryVec        m_Structs;
+	FieldEntryVec         m_Fields;
+	LabelEntryVec         m_Labels;
+	LabelIndexVec         m_CanonicalLabels;
+	LabelSlotVec          m_LabelSlots;
+	size_t                m_LabelSlotMask;
+	FieldIndiciesVec      m_FieldIndicies;
+
 	GFF_LANGUAGE          m_Language; // Default LocString language code
 
 	//
@@ -1344,6 +1436,13 @@ private:
 
 	ResourceManager     & m_ResourceManager;
 
+	//
+	// Demand buffer reference, if we are parsing a demand-loaded resource.
+	// The reference keeps the underlying view alive for our lifetime.
+	//
+
+	DemandBufferPtr       m_DemandBuffer;
+
 };
 
 #endif
@@ -76,6 +76,110 @@ Environment:
 {
 }
 
+//
+// Define the lookaside list of free FieldStruct allocations, and the maximum
+// number of free allocations that are retained.  The list header is set up by
+// a static initializer when the module is initialized.
+//
+
+static DECLSPEC_ALIGN( MEMORY_ALLOCATION_ALIGNMENT ) SLIST_HEADER FieldStructLookaside;
+static const USHORT FieldStructLookasideDepth = 4096;
+
+struct FieldStructLookasideInitializer
+{
+	inline
+	FieldStructLookasideInitializer(
+		)
+	{
+		InitializeSListHead( &FieldStructLookaside );
+	}
+};
+
+static FieldStructLookasideInitializer FieldStructLookasideInit;
+
+void *
+GffFileWriter::FieldStruct::operator new(
+	__in size_t Size
+	)
+/*++
+
+Routine Description:
+
+	This routine allocates storage for a FieldStruct, preferentially from the
+	lookaside list of previously freed structures.
+
+Arguments:
+
+	Size - Supplies the size of the allocation, which must be the size of a
+	       FieldStruct.
+
+Return Value:
+
+	The routine returns a pointer to the allocated storage.  The routine
+	raises an std::bad_alloc on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	void * p;
+
+	NWN_ASSERT( Size == sizeof( FieldStruct ) );
+
+	C_ASSERT( sizeof( FieldStruct ) >= sizeof( SLIST_ENTRY ) );
+
+	p = InterlockedPopEntrySList( &FieldStructLookaside );
+
+	if (p != NULL)
+		return p;
+
+	p = _aligned_malloc( Size, MEMORY_ALLOCATION_ALIGNMENT );
+
+	if (p == NULL)
+		throw std::bad_alloc( );
+
+	return p;
+}
+
+void
+GffFileWriter::FieldStruct::operator delete(
+	__in void * p
+	)
+/*++
+
+Routine Description:
+
+	This routine releases storage for a FieldStruct back to the lookaside
+	list, or to the heap if the lookaside list is already full.
+
+Arguments:
+
+	p - Supplies the storage to release.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	if (p == NULL)
+		return;
+
+	if (QueryDepthSList( &FieldStructLookaside ) < FieldStructLookasideDepth)
+	{
+		InterlockedPushEntrySList( &FieldStructLookaside, (PSLIST_ENTRY) p );
+		return;
+	}
+
+	_aligned_free( p );
+}
+
 bool
 GffFileWriter::Commit(
 	__in const std::string & FileName,
@@ -123,7 +227,7 @@ Environment:
 
 		File = CreateFileA(
 			FileName.c_str( ),
-			GENERIC_WRITE | ((Flags & GFF_COMMIT_FLAG_SEQUENTIAL) ? GENERIC_READ : 0),
+			GENERIC_WRITE,
 			0,
 			NULL,
 			CREATE_ALWAYS,
@@ -223,6 +327,10 @@ Routine Description:
 	This routine writes the staged GFF contents to a write context, which may
 	represent a disk file or an in-memory buffer.
 
+	All indicies, offsets and section sizes are assigned up front by a layout
+	pass, so that each section can then be streamed out exactly once, in the
+	canonical (sequential) order, without seeking or re-reading the target.
+
 Arguments:
 
 	Context - Supplies the write context that receives the contents of the
@@ -243,8 +351,15 @@ Environment:
 
 --*/
 {
-	GFF_HEADER        Header;
-	FieldStructPtrVec Structs;
+	GFF_HEADER Header;
+	ULONGLONG  Offset;
+
+	//
+	// The sections are always emitted in sequential order, so there is no
+	// additional work to perform for GFF_COMMIT_FLAG_SEQUENTIAL.
+	//
+
+	UNREFERENCED_PARAMETER( Flags );
 
 	//
 	// If the user did not supply an override file type, take the default one.
@@ -256,142 +371,58 @@ Environment:
 	m_RootStruct->StructType = 0xFFFFFFFF;
 
 	//
-	// First, generate and store the header.
+	// First, generate the header and assign the index of each struct, field,
+	// label, data record and list in the file.
 	//
 
 	BuildHeader( Header, FileType );
+	LayoutSections( Header );
 
-	Context->Write( &Header, sizeof( Header ) );
-
-	//
-	// First, we write the labels out.
 	//
-
-	Header.LabelOffset = sizeof( Header );
-
-	WriteLabelEntries( Header, Context );
-
+	// Now place each section, in sequential order:
 	//
-	// Write the field data section out next.
+	// - Structs, Fields, Labels, Field Data, Field Indicies, List Indicies
 	//
 
-	if (Header.LabelOffset + Header.LabelCount * sizeof( GFF_LABEL_ENTRY ) < Header.LabelOffset)
+	Offset                     = sizeof( Header );
+
+	Header.StructOffset        = (unsigned long) Offset;
+	Offset                    += (ULONGLONG) Header.StructCount * sizeof( GFF_STRUCT_ENTRY );
+	Header.FieldOffset         = (unsigned long) Offset;
+	Offset                    += (ULONGLONG) Header.FieldCount * sizeof( GFF_FIELD_ENTRY );
+	Header.LabelOffset         = (unsigned long) Offset;
+	Offset                    += (ULONGLONG) Header.LabelCount * sizeof( GFF_LABEL_ENTRY );
+	Header.FieldDataOffset     = (unsigned long) Offset;
+	Offset                    += Header.FieldDataCount;
+	Header.FieldIndiciesOffset = (unsigned long) Offset;
+	Offset                    += Header.FieldIndiciesCount;
+	Header.ListIndiciesOffset  = (unsigned long) Offset;
+	Offset                    += Header.ListIndiciesCount;
+
+	if (Offset > ULONG_MAX)
 		throw std::runtime_error( "GFF file is too large." );
 
-	Header.FieldDataOffset = Header.LabelOffset + (Header.LabelCount * sizeof( GFF_LABEL_ENTRY ));
-
-	WriteFieldData( Header, Context );
-
 	//
-	// Now write out the field data indicies, since we have assigned these as
-	// a part of the field data write process.
+	// The final size of the file is known, so let the target size itself once
+	// rather than growing with each write.
 	//
 
-	Header.FieldIndiciesOffset = Header.FieldDataOffset + Header.FieldDataCount;
-
-	if (Header.FieldDataOffset + Header.FieldDataCount < Header.FieldDataOffset)
-		throw std::runtime_error( "GFF file is too large." );
-
-	WriteFieldIndicies( Header, Context );
+	Context->Reserve( (size_t) Offset );
 
 	//
-	// Write structures.
+	// Stream each section out to the target.
 	//
 
-	if (Header.FieldIndiciesOffset + Header.FieldIndiciesCount < Header.FieldIndiciesOffset)
-		throw std::runtime_error( "GFF file is too large." );
-
-	Header.StructOffset = Header.FieldIndiciesOffset + Header.FieldIndiciesCount;
-
-	WriteStructEntries( Header, Context );
-
-	//
-	// Write list indicies.
-	//
-
-	if (Header.StructOffset + (Header.StructCount * sizeof( GFF_STRUCT_ENTRY )) < Header.StructOffset)
-		throw std::runtime_error( "GFF file is too large." );
-
-	Header.ListIndiciesOffset = Header.StructOffset + (Header.StructCount * sizeof( GFF_STRUCT_ENTRY ));
-
-	WriteListIndicies( Header, Context );
-
-	//
-	// Write the field descriptors out.
-	//
-
-	if (Header.ListIndiciesOffset + Header.ListIndiciesCount < Header.ListIndiciesOffset)
-		throw std::runtime_error( "GFF file is too large." );
-
-	Header.FieldOffset = Header.ListIndiciesOffset + Header.ListIndiciesCount;
-
-	WriteFieldEntries( Header, Context );
-
-	//
-	// Finally, re-write the updated header.
-	//
-
-	Context->SeekOffset( 0, "Write Finalized Header" );
 	Context->Write( &Header, sizeof( Header ) );
 
-	if (Flags & GFF_COMMIT_FLAG_SEQUENTIAL)
-	{
-		GFF_HEADER                   NewHeader;
-		std::vector< unsigned char > OrderedContents;
-
-		//
-		// If we must arrange the fields in sequential order, i.e. to work around
-		// buggy GFF readers, then stitch up the final file here.
-		// 
+	WriteStructEntries( Context );
+	WriteFieldEntries( Context );
+	WriteLabelEntries( Context );
+	WriteFieldData( Context );
+	WriteFieldIndicies( Context );
+	WriteListIndicies( Context );
 
-		OrderedContents.resize(
-			Header.FieldOffset + (Header.FieldCount * sizeof( GFF_FIELD_ENTRY ) ) );
-
-		//
-		// Build the new header up now.
-		//
-
-		NewHeader = Header;
-		NewHeader.StructOffset        = sizeof( NewHeader );
-		NewHeader.FieldOffset         = NewHeader.StructOffset        + (NewHeader.StructCount * sizeof( GFF_STRUCT_ENTRY ));
-		NewHeader.LabelOffset         = NewHeader.FieldOffset         + (NewHeader.FieldCount  * sizeof( GFF_FIELD_ENTRY  ));
-		NewHeader.FieldDataOffset     = NewHeader.LabelOffset         + (NewHeader.LabelCount  * sizeof( GFF_LABEL_ENTRY  ));
-		NewHeader.FieldIndiciesOffset = NewHeader.FieldDataOffset     + (NewHeader.FieldDataCount);
-		NewHeader.ListIndiciesOffset  = NewHeader.FieldIndiciesOffset + (NewHeader.FieldIndiciesCount);
-
-		memcpy( &OrderedContents[ 0 ], &NewHeader, sizeof( NewHeader ) );
-
-		//
-		// Now copy each section over from the previous write context.
-		//
-
-		Context->Read(
-			&OrderedContents[ NewHeader.LabelOffset ],
-			NewHeader.LabelCount * sizeof( GFF_LABEL_ENTRY ));
-		Context->Read(
-			&OrderedContents[ NewHeader.FieldDataOffset ],
-			NewHeader.FieldDataCount);
-		Context->Read(
-			&OrderedContents[ NewHeader.FieldIndiciesOffset ],
-			NewHeader.FieldIndiciesCount );
-		Context->Read(
-			&OrderedContents[ NewHeader.StructOffset ],
-			NewHeader.StructCount * sizeof( GFF_STRUCT_ENTRY ));
-		Context->Read(
-			&OrderedContents[ NewHeader.ListIndiciesOffset ],
-			NewHeader.ListIndiciesCount);
-		Context->Read(
-			&OrderedContents[ NewHeader.FieldOffset ],
-			NewHeader.FieldCount * sizeof( GFF_FIELD_ENTRY ));
-
-		//
-		// Now transfer the sequentially ordered contents back over to the writer
-		// context for persistence.
-		//
-
-		Context->SeekOffset( 0, "Write Sequentialized File Contents" );
-		Context->Write( &OrderedContents[ 0 ], OrderedContents.size( ) );
-	}
+	Context->Flush( );
 
 #if !GFFFILEWRITER_PRETRACK_STRUCTS
 	//
@@ -434,8 +465,8 @@ Environment:
 	memcpy( &Header.Version, GFF_VERSION_CURRENT, 4 );
 
 	//
-	// Now prepare the data section of the header.  The header is updated as we
-	// go and then re-written at the end.
+	// Now prepare the data section of the header.  The counts are filled in by
+	// the layout pass and the offsets are then assigned from the counts.
 	//
 
 	Header.StructOffset        = 0;
@@ -453,23 +484,25 @@ Environment:
 }
 
 void
-GffFileWriter::WriteLabelEntries(
-	__inout GFF_HEADER & Header,
-	__in GffWriteContext * Context
+GffFileWriter::LayoutSections(
+	__inout GFF_HEADER & Header
 	)
 /*++
 
 Routine Description:
 
-	This routine writes the contents of each label out to the writer context.
+	This routine assigns the on-disk position of every record in the file,
+	and computes the size of each section.  No data is written.
+
+	Struct indicies are assigned in flattened (m_Structs) order, and field
+	indicies in flattened order of each struct's fields.  Labels are assigned
+	in order of first use, and are deduplicated through the label hash table,
+	which is retained across commits to avoid reallocating it.
 
 Arguments:
 
-	Header - Receives the constructed file header.  The header is updated as
-	         the write operation progresses.
-
-	Context - Supplies the write context that receives the contents of the
-	          formatted GFF file.
+	Header - Supplies the header under construction.  The count fields are
+	         updated with the size of each section.
 
 Return Value:
 
@@ -481,8 +514,14 @@ Environment:
 
 --*/
 {
-	STRUCT_INDEX  StructIndex;
-	LabelIndexMap AssignedLabels;
+	ULONGLONG                  FieldCount;
+	ULONGLONG                  FieldDataCount;
+	ULONGLONG                  FieldIndiciesCount;
+	ULONGLONG                  ListIndiciesCount;
+	GffFileReader::FIELD_INDEX FieldIndex;
+	STRUCT_INDEX               StructIndex;
+	size_t                     SlotCount;
+	LabelSlot                  EmptySlot;
 
 #if !GFFFILEWRITER_PRETRACK_STRUCTS
 	//
@@ -498,59 +537,415 @@ Environment:
 	AddStructRecursive( m_RootStruct.get( ) );
 #endif
 
+	if (m_Structs.size( ) > ULONG_MAX)
+		throw std::runtime_error( "GFF file is too large." );
+
 	//
-	// Write the label of each field to disk.  Also, take the opportunity to
-	// assign struct indicies now as the struct array is frozen for writing and
-	// this is our first pass.
+	// Assign struct indicies first, as struct and list fields refer forward to
+	// structs that are later in the flattened list.  Count the fields while we
+	// are here, so that the label table can be sized once.
 	//
 
 	StructIndex = 0;
+	FieldCount  = 0;
 
 	for (FieldStructIdxVec::iterator it = m_Structs.begin( );
 	     it != m_Structs.end( );
 	     ++it)
 	{
 		(*it)->StructIndex = StructIndex++;
+		FieldCount        += (*it)->StructFields.size( );
+	}
+
+	if (FieldCount > ULONG_MAX)
+		throw std::runtime_error( "GFF file is too large." );
+
+	//
+	// Size the label table to a power of two that is at least twice the field
+	// count (an upper bound on the number of distinct labels).
+	//
+
+	for (SlotCount = 16; SlotCount < (size_t) FieldCount * 2; SlotCount *= 2)
+		;
+
+	ZeroMemory( &EmptySlot, sizeof( EmptySlot ) );
+	EmptySlot.LabelIndex = EMPTY_LABEL_SLOT;
+
+	m_LabelSlots.assign( SlotCount, EmptySlot );
+	m_Labels.clear( );
+	m_Labels.reserve( (size_t) FieldCount );
+
+	//
+	// Now assign labels, field data offsets, field indicies and list indicies
+	// offsets in a single pass.
+	//
+
+	FieldIndex         = 0;
+	FieldDataCount     = 0;
+	FieldIndiciesCount = 0;
+	ListIndiciesCount  = 0;
+
+	for (FieldStructIdxVec::iterator it = m_Structs.begin( );
+	     it != m_Structs.end( );
+	     ++it)
+	{
+		//
+		// Not all structures need field data indicies assigned.  If we have
+		// no fields then there is nothing to assign.  If we've got only one
+		// field then the field index for that field is stored inline.
+		//
+
+		switch ((*it)->StructFields.size( ))
+		{
+
+		case 0: // No field indicies.
+			break;
+
+		case 1: // Only one field, we store the index inline within the struct.
+			(*it)->DataOrDataOffset = FieldIndex;
+			break;
+
+		default: // Multiple fields, store the offset to the field indicies.
+			(*it)->DataOrDataOffset = (unsigned long) FieldIndiciesCount;
+			FieldIndiciesCount     += (*it)->StructFields.size( ) * sizeof( GffFileReader::FIELD_INDEX );
+			break;
+
+		}
+
+		FieldIndex += (GffFileReader::FIELD_INDEX) (*it)->StructFields.size( );
 
 		for (FieldEntryVec::iterator fit = (*it)->StructFields.begin( );
 		     fit != (*it)->StructFields.end( );
 		     ++fit)
 		{
-			LabelIndexMap::iterator lit;
+			size_t i;
 
 			//
-			// If we have not already stored this label, assign a new label
-			// index and write it.
+			// Locate the label in the label table.  If we have not already
+			// seen this label, assign it the next label index.
 			//
 
-			lit = AssignedLabels.find( fit->FieldLabelEntry );
+			for (i = (size_t) GffHashLabel( fit->FieldLabelEntry ) & (SlotCount - 1);
+			     m_LabelSlots[ i ].LabelIndex != EMPTY_LABEL_SLOT;
+			     i = (i + 1) & (SlotCount - 1))
+			{
+				if (!memcmp( &m_LabelSlots[ i ].Name, &fit->FieldLabelEntry, sizeof( GFF_LABEL_ENTRY ) ))
+					break;
+			}
 
-			if (lit == AssignedLabels.end( ))
+			if (m_LabelSlots[ i ].LabelIndex == EMPTY_LABEL_SLOT)
 			{
-				Context->Write( fit->FieldLabel, sizeof( fit->FieldLabel ) );
+				m_LabelSlots[ i ].Name       = fit->FieldLabelEntry;
+				m_LabelSlots[ i ].LabelIndex = (LABEL_INDEX) m_Labels.size( );
 
-				AssignedLabels.insert(
-					LabelIndexMap::value_type(
-						fit->FieldLabelEntry,
-						Header.LabelCount
-						)
-					);
+				m_Labels.push_back( fit->FieldLabelEntry );
+			}
 
-				fit->FieldLabelIndex = (LABEL_INDEX) Header.LabelCount;
+			fit->FieldLabelIndex = m_LabelSlots[ i ].LabelIndex;
 
-				Header.LabelCount += 1;
+			//
+			// Assign the field data index, which is the offset into the field
+			// data section for complex data fields, or into the list indicies
+			// section for list fields.  Struct fields refer to the struct
+			// index directly, which is resolved when the field is written.
+			//
+
+			if (fit->FieldType == GffFileReader::GFF_LIST)
+			{
+				fit->FieldDataIndex = (FIELD_DATA_INDEX) ListIndiciesCount;
+				ListIndiciesCount  += fit->List.size( ) * sizeof( STRUCT_INDEX ) + sizeof( LIST_INDICIES_INDEX );
 			}
-			else
+			else if ((fit->FieldFlags & FIELD_FLAG_HAS_DATA) &&
+			         (fit->FieldFlags & FIELD_FLAG_COMPLEX) &&
+			         (fit->FieldDataLength != 0))
 			{
-				fit->FieldLabelIndex = lit->second;
+				fit->FieldDataIndex = (FIELD_DATA_INDEX) FieldDataCount;
+				FieldDataCount     += fit->FieldDataLength;
 			}
+
+			if ((FieldDataCount > ULONG_MAX) || (ListIndiciesCount > ULONG_MAX))
+				throw std::runtime_error( "GFF file is too large." );
+		}
+	}
+
+	if (FieldIndiciesCount > ULONG_MAX)
+		throw std::runtime_error( "GFF file is too large." );
+
+	Header.StructCount        = (unsigned long) m_Structs.size( );
+	Header.FieldCount         = (unsigned long) FieldCount;
+	Header.LabelCount         = (unsigned long) m_Labels.size( );
+	Header.FieldDataCount     = (unsigned long) FieldDataCount;
+	Header.FieldIndiciesCount = (unsigned long) FieldIndiciesCount;
+	Header.ListIndiciesCount  = (unsigned long) ListIndiciesCount;
+}
+
+void
+GffFileWriter::StoreFieldData(
+	__inout FieldEntry & Field,
+	__in_bcount_opt( Length ) const void * Data,
+	__in size_t Length
+	)
+/*++
+
+Routine Description:
+
+	This routine stores the data of a field in the field data arena.  If the
+	new data fits in the storage that the field already occupies, then that
+	storage is reused (and any excess is released).  Otherwise, the data is
+	placed in the first free range of the arena that is large enough, else
+	appended to the arena, and the field's previous storage is released.
+
+	The source data may itself reside in the arena (e.g. when copying a field
+	within the same writer).
+
+Arguments:
+
+	Field - Supplies the field whose data is to be set.
+
+	Data - Supplies the new field data.
+
+	Length - Supplies the length, in bytes, of the new field data.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure, in which case the
+	field is unchanged.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	size_t Offset;
+
+	if (Length == 0)
+	{
+		ReleaseFieldData( Field );
+		return;
+	}
+
+	if (Length <= Field.FieldDataLength)
+	{
+		memmove( &m_FieldData[ Field.FieldDataOffset ], Data, Length );
+
+		ReleaseFieldDataRange(
+			Field.FieldDataOffset + Length,
+			Field.FieldDataLength - Length);
+
+		Field.FieldDataLength = Length;
+		return;
+	}
+
+	//
+	// Reuse the first free range that is large enough.  The source data, if
+	// it is in the arena, is live data and so never lies in a free range.
+	//
+
+	for (FreeRangeMap::iterator it = m_FreeFieldData.begin( );
+	     it != m_FreeFieldData.end( );
+	     ++it)
+	{
+		size_t RangeOffset;
+		size_t RangeLength;
+
+		if (it->second < Length)
+			continue;
+
+		RangeOffset = it->first;
+		RangeLength = it->second;
+
+		if (RangeLength > Length)
+		{
+			m_FreeFieldData.insert(
+				FreeRangeMap::value_type( RangeOffset + Length, RangeLength - Length ) );
 		}
+
+		m_FreeFieldData.erase( it );
+
+		memcpy( &m_FieldData[ RangeOffset ], Data, Length );
+
+		ReleaseFieldData( Field );
+
+		Field.FieldDataOffset = RangeOffset;
+		Field.FieldDataLength = Length;
+		return;
 	}
+
+	Offset = m_FieldData.size( );
+
+	if ((!m_FieldData.empty( )) &&
+	    ((const unsigned char *) Data >= &m_FieldData[ 0 ]) &&
+	    ((const unsigned char *) Data < &m_FieldData[ 0 ] + Offset))
+	{
+		size_t SourceOffset;
+
+		//
+		// The source is in the arena, which may move as it grows.
+		//
+
+		SourceOffset = (const unsigned char *) Data - &m_FieldData[ 0 ];
+
+		m_FieldData.resize( Offset + Length );
+
+		memcpy( &m_FieldData[ Offset ], &m_FieldData[ SourceOffset ], Length );
+	}
+	else
+	{
+		m_FieldData.resize( Offset + Length );
+
+		memcpy( &m_FieldData[ Offset ], Data, Length );
+	}
+
+	ReleaseFieldData( Field );
+
+	Field.FieldDataOffset = Offset;
+	Field.FieldDataLength = Length;
+}
+
+void
+GffFileWriter::ReleaseFieldData(
+	__inout FieldEntry & Field
+	)
+/*++
+
+Routine Description:
+
+	This routine returns the field data storage of a field to the field data
+	arena, so that it may be reused by a later store.
+
+Arguments:
+
+	Field - Supplies the field whose data is to be released.  On return, the
+	        field has no data.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	ReleaseFieldDataRange( Field.FieldDataOffset, Field.FieldDataLength );
+
+	Field.FieldDataOffset = 0;
+	Field.FieldDataLength = 0;
+}
+
+void
+GffFileWriter::ReleaseFieldDataRange(
+	__in size_t Offset,
+	__in size_t Length
+	)
+/*++
+
+Routine Description:
+
+	This routine records a range of the field data arena as free.  The range
+	is merged with any adjacent free ranges, and if the merged range ends at
+	the end of the arena, the arena is trimmed instead.
+
+Arguments:
+
+	Offset - Supplies the offset of the range to release.
+
+	Length - Supplies the length, in bytes, of the range to release.
+
+Return Value:
+
+	None.  If the free range list cannot be extended, the range is simply
+	not reused.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	FreeRangeMap::iterator it;
+
+	if (Length == 0)
+		return;
+
+	//
+	// Merge with the following free range, then with the preceding one.
+	//
+
+	it = m_FreeFieldData.find( Offset + Length );
+
+	if (it != m_FreeFieldData.end( ))
+	{
+		Length += it->second;
+		m_FreeFieldData.erase( it );
+	}
+
+	it = m_FreeFieldData.lower_bound( Offset );
+
+	if (it != m_FreeFieldData.begin( ))
+	{
+		--it;
+
+		if (it->first + it->second == Offset)
+		{
+			Offset  = it->first;
+			Length += it->second;
+			m_FreeFieldData.erase( it );
+		}
+	}
+
+	if (Offset + Length == m_FieldData.size( ))
+	{
+		m_FieldData.resize( Offset );
+		return;
+	}
+
+	try
+	{
+		m_FreeFieldData.insert( FreeRangeMap::value_type( Offset, Length ) );
+	}
+	catch (std::bad_alloc)
+	{
+	}
+}
+
+void
+GffFileWriter::WriteLabelEntries(
+	__in GffWriteContext * Context
+	)
+/*++
+
+Routine Description:
+
+	This routine writes the contents of each label out to the writer context.
+
+	Note that labels must have been already assigned by the layout pass.
+
+Arguments:
+
+	Context - Supplies the write context that receives the contents of the
+	          formatted GFF file.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	if (m_Labels.empty( ))
+		return;
+
+	Context->Write( &m_Labels[ 0 ], m_Labels.size( ) * sizeof( GFF_LABEL_ENTRY ) );
 }
 
 void
 GffFileWriter::WriteFieldData(
-	__inout GFF_HEADER & Header,
 	__in GffWriteContext * Context
 	)
 /*++
@@ -561,9 +956,6 @@ Routine Description:
 
 Arguments:
 
-	Header - Receives the constructed file header.  The header is updated as
-	         the write operation progresses.
-
 	Context - Supplies the write context that receives the contents of the
 	          formatted GFF file.
 
@@ -590,9 +982,9 @@ Environment:
 		     ++fit)
 		{
 			//
-			// Skip non-data fields for now (such as structs and lists).  Also,
-			// skip fields that are not stored as complex data as that data is
-			// not written here.
+			// Skip non-data fields (such as structs and lists).  Also, skip
+			// fields that are not stored as complex data as that data is not
+			// written here.
 			//
 
 			if (!(fit->FieldFlags & FIELD_FLAG_HAS_DATA))
@@ -601,44 +993,31 @@ Environment:
 			if (!(fit->FieldFlags & FIELD_FLAG_COMPLEX))
 				continue;
 
-			if (fit->FieldData.empty( ))
+			if (fit->FieldDataLength == 0)
 				continue;
 
 			//
 			// Transfer field contents to the GFF.
 			//
 
-			Context->Write( &fit->FieldData[ 0 ], fit->FieldData.size( ) );
-
-			//
-			// Now assign the field data index, which is the offset into the
-			// field data section.  Also, update accounting in the header for
-			// the new data record.
-			//
-
-			fit->FieldDataIndex   = Header.FieldDataCount;
-			Header.FieldDataCount += (unsigned long) fit->FieldData.size( );
+			Context->Write( GetFieldData( *fit ), fit->FieldDataLength );
 		}
 	}
 }
 
 void
 GffFileWriter::WriteFieldIndicies(
-	__inout GFF_HEADER & Header,
 	__in GffWriteContext * Context
 	)
 /*++
 
 Routine Description:
 
-	This routine assigns field indicies for each struct field and write the
-	field indicies data out.
+	This routine writes the field indicies data out for each struct that has
+	more than one field.
 
 Arguments:
 
-	Header - Receives the constructed file header.  The header is updated as
-	         the write operation progresses.
-
 	Context - Supplies the write context that receives the contents of the
 	          formatted GFF file.
 
@@ -655,9 +1034,8 @@ Environment:
 	GffFileReader::FIELD_INDEX FieldIndex;
 
 	//
-	// Write the field index of each complex data field out.
-	//
-	// N.B.  We can compute the field index on the fly as
+	// Fields are numbered sequentially in flattened struct order, so the field
+	// indicies can be regenerated on the fly here.
 	//
 
 	FieldIndex = 0;
@@ -666,39 +1044,17 @@ Environment:
 	     it != m_Structs.end( );
 	     ++it)
 	{
-		//
-		// Not all structures need field data indicies assigned.  If we have
-		// no fields then there is nothing to write.  If we've got only one
-		// field then the field offset for that field is stored inline.
-		//
+		size_t Count = (*it)->StructFields.size( );
 
-		switch ((*it)->StructFields.size( ))
+		if (Count < 2)
 		{
-
-		case 0: // No data to write.
-			continue;
-
-		case 1: // Only one field, we store the index inline within the struct.
-			(*it)->DataOrDataOffset = FieldIndex;
-			FieldIndex += 1;
+			FieldIndex += (GffFileReader::FIELD_INDEX) Count;
 			continue;
-
-		default: // Multiple fields, store the offset to the field indicies.
-			(*it)->DataOrDataOffset = Header.FieldIndiciesCount;
-			break;
-
 		}
 
-		//
-		// This structure needs field indicies assigned, write them out now.
-		//
-
-		for (FieldEntryVec::iterator fit = (*it)->StructFields.begin( );
-		     fit != (*it)->StructFields.end( );
-		     ++fit)
+		for (size_t i = 0; i < Count; i += 1)
 		{
 			Context->Write( &FieldIndex, sizeof( FieldIndex ) );
-			Header.FieldIndiciesCount += sizeof( FieldIndex );
 			FieldIndex += 1;
 		}
 	}
@@ -706,7 +1062,6 @@ Environment:
 
 void
 GffFileWriter::WriteStructEntries(
-	__inout GFF_HEADER & Header,
 	__in GffWriteContext * Context
 	)
 /*++
@@ -717,13 +1072,10 @@ Routine Description:
 	context.
 
 	Note that the DataOrDataOffset field of each struct must have been already
-	computed by going through the field indicies write process.
+	computed by the layout pass.
 
 Arguments:
 
-	Header - Receives the constructed file header.  The header is updated as
-	         the write operation progresses.
-
 	Context - Supplies the write context that receives the contents of the
 	          formatted GFF file.
 
@@ -748,14 +1100,11 @@ Environment:
 		StructEntry.FieldCount       = (unsigned long) (*it)->StructFields.size( );
 
 		Context->Write( &StructEntry, sizeof( StructEntry ) );
-
-		Header.StructCount += 1;
 	}
 }
 
 void
 GffFileWriter::WriteListIndicies(
-	__inout GFF_HEADER & Header,
 	__in GffWriteContext * Context
 	)
 /*++
@@ -767,9 +1116,6 @@ Routine Description:
 
 Arguments:
 
-	Header - Receives the constructed file header.  The header is updated as
-	         the write operation progresses.
-
 	Context - Supplies the write context that receives the contents of the
 	          formatted GFF file.
 
@@ -784,7 +1130,7 @@ Environment:
 --*/
 {
 	//
-	// Write each data field's contents out.
+	// Write each list field's contents out.
 	//
 
 	for (FieldStructIdxVec::iterator it = m_Structs.begin( );
@@ -812,23 +1158,14 @@ Environment:
 			     lit != fit->List.end( );
 			     ++lit)
 			{
-				Context->Write( &(*lit)->StructIndex, sizeof( (*it)->StructIndex ) );
+				Context->Write( &(*lit)->StructIndex, sizeof( (*lit)->StructIndex ) );
 			}
-
-			//
-			// Now assign the field data index, which is the offset into the
-			// list indicies section for list types.
-			//
-
-			fit->FieldDataIndex       = Header.ListIndiciesCount;
-			Header.ListIndiciesCount += (unsigned long) fit->List.size( ) * sizeof( STRUCT_INDEX ) + sizeof( Count );
 		}
 	}
 }
 
 void
 GffFileWriter::WriteFieldEntries(
-	__inout GFF_HEADER & Header,
 	__in GffWriteContext * Context
 	)
 /*++
@@ -839,9 +1176,6 @@ Routine Description:
 
 Arguments:
 
-	Header - Receives the constructed file header.  The header is updated as
-	         the write operation progresses.
-
 	Context - Supplies the write context that receives the contents of the
 	          formatted GFF file.
 
@@ -855,14 +1189,10 @@ Environment:
 
 --*/
 {
-	LABEL_INDEX LabelIndex;
-
 	//
 	// Write each field entry descriptor out.
 	//
 
-	LabelIndex = 0;
-
 	for (FieldStructIdxVec::iterator it = m_Structs.begin( );
 	     it != m_Structs.end( );
 	     ++it)
@@ -903,12 +1233,12 @@ Environment:
 			{
 				FieldEntry.DataOrDataOffset = 0;
 
-				if (!fit->FieldData.empty( ))
+				if (fit->FieldDataLength != 0)
 				{
 					memcpy(
 						&FieldEntry.DataOrDataOffset,
-						&fit->FieldData[ 0 ],
-						fit->FieldData.size( ));
+						GetFieldData( *fit ),
+						min( fit->FieldDataLength, sizeof( FieldEntry.DataOrDataOffset ) ));
 				}
 			}
 
@@ -917,13 +1247,10 @@ Environment:
 			//
 
 			Context->Write( &FieldEntry, sizeof( FieldEntry ) );
-
-			Header.FieldCount += 1;
 		}
 	}
 }
 
-
 bool
 GffFileWriter::IsComplexType(
 	__in GFF_FIELD_TYPE FieldType
@@ -1037,6 +1364,14 @@ Environment:
 
 	FieldCount = Struct->GetFieldCount( );
 
+	//
+	// Size the field array once up front, as growing it would copy each of
+	// the fields (and their data) already transferred.
+	//
+
+	m_StructEntry->StructFields.reserve(
+		m_StructEntry->StructFields.size( ) + FieldCount );
+
 	for (GffFileReader::FIELD_INDEX FieldIndex = 0;
 	     FieldIndex < FieldCount;
 	     FieldIndex += 1)
@@ -1133,11 +1468,24 @@ Environment:
 
 			if (Struct->GetFieldRawData(
 				FieldIndex,
-				Field->FieldData,
+				m_Writer->m_FieldDataScratch,
 				FieldLabel,
 				Field->FieldType,
 				Complex))
 			{
+				try
+				{
+					m_Writer->StoreFieldData(
+						*Field,
+						m_Writer->m_FieldDataScratch.empty( ) ? NULL : &m_Writer->m_FieldDataScratch[ 0 ],
+						m_Writer->m_FieldDataScratch.size( ));
+				}
+				catch (...)
+				{
+					m_StructEntry->StructFields.pop_back( );
+					throw;
+				}
+
 				Field->FieldFlags |= FIELD_FLAG_HAS_DATA;
 
 				if (Complex)
@@ -1372,11 +1720,24 @@ Environment:
 
 			if (Struct->GetFieldRawData(
 				FieldIndex,
-				Field->FieldData,
+				m_Writer->m_FieldDataScratch,
 				FieldLabel,
 				Field->FieldType,
 				Complex))
 			{
+				try
+				{
+					m_Writer->StoreFieldData(
+						*Field,
+						m_Writer->m_FieldDataScratch.empty( ) ? NULL : &m_Writer->m_FieldDataScratch[ 0 ],
+						m_Writer->m_FieldDataScratch.size( ));
+				}
+				catch (...)
+				{
+					m_StructEntry->StructFields.pop_back( );
+					throw;
+				}
+
 				Field->FieldFlags |= FIELD_FLAG_HAS_DATA;
 
 				if (Complex)
@@ -1452,6 +1813,9 @@ Environment:
 
 	StructEntry = Struct.GetStructEntry( );
 
+	m_StructEntry->StructFields.reserve(
+		m_StructEntry->StructFields.size( ) + StructEntry->StructFields.size( ) );
+
 	for (FieldEntryVec::iterator it = StructEntry->StructFields.begin( );
 	     it != StructEntry->StructFields.end( );
 	     ++it)
@@ -1540,7 +1904,28 @@ Environment:
 			break;
 
 		default:
-			m_StructEntry->StructFields.push_back( Entry );
+			//
+			// The field data lives in the source writer's arena, so it must
+			// be copied to this writer's arena.
+			//
+
+			Entry.FieldDataOffset = 0;
+			Entry.FieldDataLength = 0;
+
+			m_Writer->StoreFieldData(
+				Entry,
+				Struct.m_Writer->GetFieldData( *it ),
+				it->FieldDataLength);
+
+			try
+			{
+				m_StructEntry->StructFields.push_back( Entry );
+			}
+			catch (...)
+			{
+				m_Writer->ReleaseFieldData( Entry );
+				throw;
+			}
 			break;
 
 		}
@@ -67,6 +67,7 @@ class GffFileWriter
 
 	typedef GffFileReader::GFF_FIELD_TYPE GFF_FIELD_TYPE;
 	typedef std::vector< unsigned char > FieldDataVec;
+	typedef std::map< size_t, size_t > FreeRangeMap;
 
 	//
 	// Define field flags.
@@ -103,7 +104,9 @@ class GffFileWriter
 		inline
 		FieldEntry(
 			)
-		: FieldDataIndex( 0 ),
+		: FieldDataOffset( 0 ),
+		  FieldDataLength( 0 ),
+		  FieldDataIndex( 0 ),
 		  FieldLabelIndex( 0 )
 		{
 		}
@@ -137,14 +140,16 @@ class GffFileWriter
 		LABEL_INDEX       FieldLabelIndex;
 
 		//
-		// Define the field data.  Regardless of whether this is a complex or
-		// simple field, all of the data is held here.
+		// Define the location of the field data within the field data arena
+		// of the owning writer (m_FieldData).  Regardless of whether this is
+		// a complex or simple field, all of the data is held there.
 		//
-		// N.B.  Only data members are stored here.  Struct and list members
+		// N.B.  Only data members are stored there.  Struct and list members
 		//       are stored in their respective fields.
 		//
 
-		FieldDataVec      FieldData;
+		size_t            FieldDataOffset;
+		size_t            FieldDataLength;
 
 		//
 		// Define the field data offset, which is assigned at write time.
@@ -194,6 +199,24 @@ class GffFileWriter
 		{
 		}
 
+		//
+		// Structures are allocated from a process-wide lookaside list, as
+		// tools that rewrite many GFF files otherwise spend much of their
+		// time allocating and freeing the same structure objects.
+		//
+
+		static
+		void *
+		operator new(
+			__in size_t Size
+			);
+
+		static
+		void
+		operator delete(
+			__in void * p
+			);
+
 		//
 		// Define the type code of the structure.  The type code has a user-
 		// defined meaning, except for the root structure, which must have type
@@ -277,9 +300,9 @@ public:
 		// Some buggy GFF readers, such as the NWN2 Toolset, require this data
 		// ordering.  The core NWN/NWN2 game client and server themselves do not.
 		//
-		// Choosing this option imposes a performance and memory overhead, and is
-		// thus not recommended if the GFF is only to be consumed by the game
-		// core itself.
+		// N.B.  The writer always streams the sections out in this order, so
+		//       the flag imposes no overhead and is retained for compatibility
+		//       only.
 		//
 	
 		GFF_COMMIT_FLAG_SEQUENTIAL = 0x00000001,
@@ -493,6 +516,10 @@ public:
 						m_Writer->DeleteStruct( *lit );
 					}
 				}
+				else
+				{
+					m_Writer->ReleaseFieldData( *it );
+				}
 
 				m_StructEntry->StructFields.erase( it );
 			}
@@ -1503,14 +1530,11 @@ public:
 
 			try
 			{
-				it->FieldData.clear( );
-				it->FieldData.resize( sizeof( T ) );
-
 				//
 				// N.B.  Little endian assumed.
 				//
 
-				memcpy( &it->FieldData[ 0 ], &Data, sizeof( Data ) );
+				m_Writer->StoreFieldData( *it, &Data, sizeof( Data ) );
 
 				it->FieldFlags |= FIELD_FLAG_HAS_DATA;
 			}
@@ -1552,14 +1576,11 @@ public:
 
 			try
 			{
-				it->FieldData.clear( );
-				it->FieldData.resize( sizeof( T ) );
-
 				//
 				// N.B.  Little endian assumed.
 				//
 
-				memcpy( &it->FieldData[ 0 ], &Data, sizeof( Data ) );
+				m_Writer->StoreFieldData( *it, &Data, sizeof( Data ) );
 
 				it->FieldFlags |= FIELD_FLAG_HAS_DATA | FIELD_FLAG_COMPLEX;
 			}
@@ -1600,7 +1621,10 @@ public:
 
 			try
 			{
-				it->FieldData = Data;
+				m_Writer->StoreFieldData(
+					*it,
+					Data.empty( ) ? NULL : &Data[ 0 ],
+					Data.size( ));
 
 				it->FieldFlags |= FIELD_FLAG_HAS_DATA | FIELD_FLAG_COMPLEX;
 			}
@@ -1686,7 +1710,8 @@ private:
 		GffWriteContext(
 			)
 		: Type( LastContextType ),
-		  WritePtr( 0 )
+		  WritePtr( 0 ),
+		  BufferLength( 0 )
 		{
 
 		}
@@ -1701,6 +1726,15 @@ private:
 
 		size_t      WritePtr;
 
+		//
+		// Define the staging buffer for file targets.  A GFF is largely made
+		// of small fixed size records, which are gathered here rather than
+		// each costing a WriteFile call.
+		//
+
+		unsigned char Buffer[ 16384 ];
+		size_t        BufferLength;
+
 		//
 		// Append contents to the write context's target.  The routine raises
 		// an std::exception on failure.
@@ -1721,20 +1755,19 @@ private:
 
 			case ContextTypeFile:
 				{
-					DWORD Written;
-
-					if (!WriteFile(
-						File,
-						Data,
-						(DWORD) Length,
-						&Written,
-						NULL))
+					if (Length > sizeof( Buffer ) - BufferLength)
 					{
-						throw std::runtime_error( "GffWriteContext::Write failed to write to file." );
+						Flush( );
+
+						if (Length >= sizeof( Buffer ))
+						{
+							WriteFileData( Data, Length );
+							break;
+						}
 					}
 
-					if ((size_t) Written != Length)
-						throw std::runtime_error( "GffWriteContext::Write wrote less than the required count of bytes." );
+					memcpy( &Buffer[ BufferLength ], Data, Length );
+					BufferLength += Length;
 				}
 				break;
 
@@ -1759,105 +1792,61 @@ private:
 		}
 
 		//
-		// (Re-)read data from the write context's target.  The data must have
-		// been already written with Write.  The routine raises an std::exception
-		// on failure.
+		// Size the target for the full contents of the file ahead of the
+		// first write, so that a memory target is allocated exactly once.
+		// The routine raises an std::exception on failure.
 		//
 
 		inline
 		void
-		Read(
-			__out_bcount( Length ) void * Data,
+		Reserve(
 			__in size_t Length
 			)
 		{
-			if (Length == 0)
-				return;
-
-			switch (Type)
-			{
-
-			case ContextTypeFile:
-				{
-					DWORD Read;
-
-					if (!ReadFile(
-						File,
-						Data,
-						(DWORD) Length,
-						&Read,
-						NULL))
-					{
-						throw std::runtime_error( "GffWriteContext::Read failed to read from file." );
-					}
-
-					if ((size_t) Read != Length)
-						throw std::runtime_error( "GffWriteContext::Read read less than the required count of bytes." );
-				}
-				break;
-
-			case ContextTypeMemory:
-				{
-					size_t Tail;
-
-					Tail = Memory->size( );
-
-					if (WritePtr + Length < WritePtr)
-						throw std::runtime_error( "GffWriteContext::Read encountered read pointer overflow." );
-
-					if (WritePtr + Length > Tail)
-						throw std::runtime_error( "GffWriteContext::Read read past the end of stream." );
-
-					memcpy( Data, &(*Memory)[ WritePtr ], Length );
-
-					WritePtr += Length;
-				}
-				break;
-			}
+			if (Type == ContextTypeMemory)
+				Memory->resize( WritePtr + Length );
 		}
 
 		//
-		// Seek to a particular position.
+		// Transfer any staged contents to the target.  The routine raises an
+		// std::exception on failure.
 		//
 
 		inline
 		void
-		SeekOffset(
-			__in ULONGLONG Offset,
-			__in const char * Description
+		Flush(
 			)
 		{
-			LONG  Low;
-			LONG  High;
-			DWORD NewPtrLow;
-			char  ExMsg[ 64 ];
-
-			switch (Type)
-			{
-
-			case ContextTypeMemory:
-				WritePtr = (size_t) Offset;
-				break;
+			if ((Type != ContextTypeFile) || (BufferLength == 0))
+				return;
 
-			case ContextTypeFile:
-				Low  = (LONG) ((Offset >>  0) & 0xFFFFFFFF);
-				High = (LONG) ((Offset >> 32) & 0xFFFFFFFF);
+			WriteFileData( Buffer, BufferLength );
+			BufferLength = 0;
+		}
 
-				NewPtrLow = SetFilePointer( File, Low, &High, FILE_BEGIN );
+	private:
 
-				if ((NewPtrLow == INVALID_SET_FILE_POINTER) &&
-					(GetLastError( ) != NO_ERROR))
-				{
-					StringCbPrintfA(
-						ExMsg,
-						sizeof( ExMsg ),
-						"SeekOffset( %s ) failed.",
-						Description);
+		inline
+		void
+		WriteFileData(
+			__in_bcount( Length ) const void * Data,
+			__in size_t Length
+			)
+		{
+			DWORD Written;
 
-					throw std::runtime_error( ExMsg );
-				}
-				break;
+			if (!WriteFile(
+				File,
+				Data,
+				(DWORD) Length,
+				&Written,
+				NULL))
+			{
+				throw std::runtime_error( "GffWriteContext::Write failed to write to file." );
 			}
+
+			if ((size_t) Written != Length)
+				throw std::runtime_error( "GffWriteContext::Write wrote less than the required count of bytes." );
 		}
 	};
 
@@ -1877,6 +1866,58 @@ private:
 	typedef GffFileReader::GFF_FIELD_ENTRY GFF_FIELD_ENTRY;
 	typedef GffFileReader::GFF_LIST_ENTRY GFF_LIST_ENTRY;
 
+	//
+	// Store the data of a field in the field data arena.  Raises an
+	// std::exception on failure, in which case the field is unchanged.
+	//
+
+	void
+	StoreFieldData(
+		__inout FieldEntry & Field,
+		__in_bcount_opt( Length ) const void * Data,
+		__in size_t Length
+		);
+
+	//
+	// Return the field data storage of a field to the arena for reuse.  The
+	// field is left with no data.
+	//
+
+	void
+	ReleaseFieldData(
+		__inout FieldEntry & Field
+		);
+
+	//
+	// Return a range of the field data arena to the free range list, merging
+	// it with adjacent free ranges.  A free range at the end of the arena is
+	// trimmed from the arena instead.
+	//
+
+	void
+	ReleaseFieldDataRange(
+		__in size_t Offset,
+		__in size_t Length
+		);
+
+	//
+	// Return a pointer to the data of a field in the field data arena, else
+	// NULL if the field has no data.  The pointer is invalidated by the next
+	// call to StoreFieldData.
+	//
+
+	inline
+	const unsigned char *
+	GetFieldData(
+		__in const FieldEntry & Field
+		) const
+	{
+		if (Field.FieldDataLength == 0)
+			return NULL;
+
+		return &m_FieldData[ Field.FieldDataOffset ];
+	}
+
 	//
 	// Build the GFF header.
 	//
@@ -1887,13 +1928,22 @@ private:
 		__in unsigned long FileType
 		);
 
+	//
+	// Assign the position of each record in the file and compute the size of
+	// each section.
+	//
+
+	void
+	LayoutSections(
+		__inout GFF_HEADER & Header
+		);
+
 	//
 	// Write the label entries out.
 	//
 
 	void
 	WriteLabelEntries(
-		__inout GFF_HEADER & Header,
 		__in GffWriteContext * Context
 		);
 
@@ -1903,7 +1953,6 @@ private:
 
 	void
 	WriteFieldData(
-		__inout GFF_HEADER & Header,
 		__in GffWriteContext * Context
 		);
 
@@ -1913,7 +1962,6 @@ private:
 
 	void
 	WriteFieldIndicies(
-		__inout GFF_HEADER & Header,
 		__in GffWriteContext * Context
 		);
 
@@ -1923,7 +1971,6 @@ private:
 
 	void
 	WriteStructEntries(
-		__inout GFF_HEADER & Header,
 		__in GffWriteContext * Context
 		);
 
@@ -1933,7 +1980,6 @@ private:
 
 	void
 	WriteListIndicies(
-		__inout GFF_HEADER & Header,
 		__in GffWriteContext * Context
 		);
 
@@ -1943,7 +1989,6 @@ private:
 
 	void
 	WriteFieldEntries(
-		__inout GFF_HEADER & Header,
 		__in GffWriteContext * Context
 		);
 
@@ -2081,25 +2126,25 @@ private:
 	typedef GffFileReader::GFF_LANGUAGE GFF_LANGUAGE;
 
 	//
-	// Comparison predicate for LabelIndexMap.
+	// Define a slot in the open addressed label table used to deduplicate
+	// labels at commit time.
 	//
 
-	struct LabelLess : public std::binary_function< const GFF_LABEL_ENTRY &, const GFF_LABEL_ENTRY &, bool >
+	enum
 	{
+		EMPTY_LABEL_SLOT = 0xFFFFFFFF,
 
-		inline
-		bool
-		operator()(
-			__in const GFF_LABEL_ENTRY & left,
-			__in const GFF_LABEL_ENTRY & right
-			) const
-		{
-			return memcmp( &left, &right, sizeof( left ) ) < 0;
-		}
+		LAST_LABEL_SLOT_CONSTANT
+	};
 
+	struct LabelSlot
+	{
+		GFF_LABEL_ENTRY Name;
+		LABEL_INDEX     LabelIndex;
 	};
 
-	typedef std::map< GFF_LABEL_ENTRY, LABEL_INDEX, LabelLess > LabelIndexMap;
+	typedef std::vector< LabelSlot > LabelSlotVec;
+	typedef std::vector< GFF_LABEL_ENTRY > LabelVec;
 
 
 
@@ -2142,6 +2187,40 @@ private:
 
 	FieldStructIdxVec m_Structs;
 
+	//
+	// Define the label table and the distinct labels in label index order.
+	// These are only meaningful during the commit process, but are retained
+	// so that repeated commits do not reallocate them.
+	//
+
+	LabelSlotVec      m_LabelSlots;
+	LabelVec          m_Labels;
+
+	//
+	// Define the field data arena, which holds the data of every data field
+	// in the tree, so that fields do not each own a separate allocation.
+	// Fields refer to their data by offset and length.  Storage that is
+	// released when a data field grows, shrinks or is deleted is recorded in
+	// the free range list (keyed by offset, holding the length) and reused by
+	// later stores.  The data of fields within a deleted struct or list is
+	// not reclaimed, as the struct may still be referenced by a GffStruct.
+	//
+	// N.B.  As the structures of the tree may outlive the writer, but their
+	//       field data does not, structures must only be accessed while the
+	//       writer (which owns the GffStruct contexts) is alive.
+	//
+
+	FieldDataVec      m_FieldData;
+	FreeRangeMap      m_FreeFieldData;
+
+	//
+	// Define the scratch buffer that field data copied from a GFF reader is
+	// staged in before it is stored in the arena.  It is retained so that
+	// copying many fields does not reallocate it.
+	//
+
+	FieldDataVec      m_FieldDataScratch;
+
 };
 
 #endif
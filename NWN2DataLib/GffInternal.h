@@ -24,4 +24,31 @@ Abstract:
 
 #define GFF_VERSION_CURRENT "V3.2"
 
+//
+// Compute the hash of a (zero padded) label.  The reader and the writer both
+// use this to index their label tables.
+//
+
+inline
+ULONG64
+GffHashLabel(
+	__in const GffFileReader::GFF_LABEL_ENTRY & Label
+	)
+{
+	ULONG64 Words[ 2 ];
+	ULONG64 Hash;
+
+	C_ASSERT( sizeof( Words ) == sizeof( Label.Name ) );
+
+	memcpy( Words, Label.Name, sizeof( Words ) );
+
+	Hash  = Words[ 0 ] * 0x9E3779B97F4A7C15ULL;
+	Hash ^= Hash >> 29;
+	Hash ^= Words[ 1 ];
+	Hash *= 0x9E3779B97F4A7C15ULL;
+	Hash ^= Hash >> 29;
+
+	return Hash;
+}
+
 #endif
@@ -22,7 +22,8 @@ Abstract:
 template< typename ResRefT >
 KeyFileReader< ResRefT >::KeyFileReader(
 	__in const std::string & FileName,
-	__in const std::string & InstallDir
+	__in const std::string & InstallDir,
+	__in unsigned long Flags /* = 0 */
 	)
 /*++
 
@@ -32,6 +33,9 @@ Routine Description:
 	of a KEY file by filename.  The file must already exist as it is
 	immediately deserialized.
 
+	Unless KEY_FLAG_LAZY_BIF_LOAD is specified, each BIF file attached to the
+	KEY file is opened and its resource table is validated up front.
+
 Arguments:
 
 	FileName - Supplies the path to the KEY file.
@@ -41,6 +45,9 @@ Arguments:
 	             The install directory name need only remain valid until the
 	             constructor returns.
 
+	Flags - Supplies flags that control the behavior of the reader.  Legal
+	        values are drawn from the KEY_FLAG_* family of values.
+
 Return Value:
 
 	The newly constructed object.
@@ -50,7 +57,10 @@ Environment:
 	User mode.
 
 --*/
-: m_KeyFileName( FileName )
+: m_KeyTable( NULL ),
+  m_KeyCount( 0 ),
+  m_MappedView( NULL ),
+  m_KeyFileName( FileName )
 {
 	HANDLE        File;
 	unsigned long FileSize;
@@ -86,10 +96,16 @@ Environment:
 		if ((FileSize == 0xFFFFFFFF) && (GetLastError( ) != NO_ERROR))
 			throw std::exception( "Failed to read file size." );
 
-		ParseKeyFile( File, InstallDir );
+		ParseKeyFile( File, InstallDir, Flags );
 	}
 	catch (...)
 	{
+		if (m_MappedView != NULL)
+		{
+			UnmapViewOfFile( m_MappedView );
+			m_MappedView = NULL;
+		}
+
 		CloseHandle( File );
 
 		throw;
@@ -125,6 +141,11 @@ Environment:
 
 --*/
 {
+	if (m_MappedView != NULL)
+	{
+		UnmapViewOfFile( m_MappedView );
+		m_MappedView = NULL;
+	}
 }
 
 template< typename ResRefT >
@@ -162,7 +183,7 @@ Environment:
 
 --*/
 {
-	PCKEY_RESOURCE_DESCRIPTOR Key;
+	PCKEY_RESOURCE Key;
 
 //	WriteText( "Checking for key %.32s/%lu -- %lu keys\n", FileName.RefStr, Type, m_KeyDir.size( ) );
 
@@ -171,7 +192,7 @@ Environment:
 	if (Key == NULL)
 		return INVALID_FILE;
 
-	return (FileHandle) (Key->DirectoryIndex + 1);
+	return (FileHandle) (GetResourceIndex( Key ) + 1);
 }
 
 template< typename ResRefT >
@@ -206,14 +227,14 @@ Environment:
 
 --*/
 {
-	PCKEY_RESOURCE_DESCRIPTOR ResKey;
+	PCKEY_RESOURCE ResKey;
 
 	ResKey = LookupResourceKey( (ResID) FileIndex );
 
 	if (ResKey == NULL)
 		return INVALID_FILE;
 
-	return (FileHandle) (ResKey->DirectoryIndex + 1);
+	return (FileHandle) (GetResourceIndex( ResKey ) + 1);
 }
 
 template< typename ResRefT >
@@ -295,7 +316,9 @@ Environment:
 
 --*/
 {
-	PCKEY_RESOURCE_DESCRIPTOR  ResKey;
+	PCKEY_RESOURCE             ResKey;
+	BifFileReaderT           * BifFile;
+	BifFileId                  BifFileIndex;
 	BifFileReaderT::FileHandle FileHandle;
 	bool                       Status;
 
@@ -310,6 +333,11 @@ Environment:
 	if (ResKey == NULL)
 		return false;
 
+	BifFile = GetBifFile( ResKey, BifFileIndex );
+
+	if (BifFile == NULL)
+		return false;
+
 	//
 	// Now delegate the read request to the specific BIF file that has been
 	// chosen.
@@ -320,25 +348,167 @@ Environment:
 	//       no-ops.
 	//
 
-	FileHandle = ResKey->BifFile->OpenFileByIndex(
-		ResKey->Res.ResID & 0xFFFFF );
+	FileHandle = BifFile->OpenFileByIndex( BifFileIndex );
 
 	if (FileHandle == INVALID_FILE)
 		return false;
 
-	Status = ResKey->BifFile->ReadEncapsulatedFile(
+	Status = BifFile->ReadEncapsulatedFile(
 		FileHandle,
 		Offset,
 		BytesToRead,
 		BytesRead,
 		Buffer);
 
-	ResKey->BifFile->CloseFile( FileHandle );
+	BifFile->CloseFile( FileHandle );
 	FileHandle = INVALID_FILE;
 
 	return Status;
 }
 
+template< typename ResRefT >
+bool
+KeyFileReader< ResRefT >::ReadEncapsulatedFiles(
+	__inout_ecount( Count ) ReadRequest * Requests,
+	__in size_t Count
+	)
+/*++
+
+Routine Description:
+
+	This routine logically reads a batch of ranges of encapsulated sub-files
+	within the BIF files that are attached to the KEY file.
+
+	The requests are grouped by BIF file, and each group is then forwarded to
+	its BIF file as a single batch, so that the BIF file may read the group in
+	file offset order.
+
+Arguments:
+
+	Requests - Supplies the read requests.  On return, the BytesRead and
+	           Succeeded fields of each request are filled in.
+
+	Count - Supplies the count of read requests.
+
+Return Value:
+
+	The routine returns a Boolean value indicating true if every request
+	succeeded, else false if any request failed.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	BifReadOrderVec   Order;
+	BifReadRequestVec Forwarded;
+	bool              AllSucceeded;
+	size_t            First;
+
+	AllSucceeded = true;
+
+	try
+	{
+		Order.reserve( Count );
+
+		for (size_t i = 0; i < Count; i += 1)
+		{
+			PCKEY_RESOURCE ResKey;
+			BifReadOrder   Position;
+
+			Requests[ i ].BytesRead = 0;
+			Requests[ i ].Succeeded = false;
+
+			ResKey = LookupResourceKey( ((ResID) Requests[ i ].File) - 1 );
+
+			if (ResKey == NULL)
+			{
+				AllSucceeded = false;
+				continue;
+			}
+
+			Position.BifFile = GetBifFile( ResKey, Position.FileIndex );
+			Position.Request = i;
+
+			if (Position.BifFile == NULL)
+			{
+				AllSucceeded = false;
+				continue;
+			}
+
+			Order.push_back( Position );
+		}
+
+		std::stable_sort( Order.begin( ), Order.end( ), BifReadOrderLess( ) );
+
+		Forwarded.resize( Order.size( ) );
+	}
+	catch (std::exception)
+	{
+		return false;
+	}
+
+	//
+	// Translate each request to a request against its BIF file.
+	//
+	// N.B.  File open/close for BIF files is a no-op, see
+	//       ReadEncapsulatedFile.
+	//
+
+	for (size_t i = 0; i < Order.size( ); i += 1)
+	{
+		const ReadRequest & Request = Requests[ Order[ i ].Request ];
+
+		Forwarded[ i ].File        = Order[ i ].BifFile->OpenFileByIndex(
+			Order[ i ].FileIndex );
+		Forwarded[ i ].Offset      = Request.Offset;
+		Forwarded[ i ].BytesToRead = Request.BytesToRead;
+		Forwarded[ i ].Buffer      = Request.Buffer;
+		Forwarded[ i ].BytesRead   = 0;
+		Forwarded[ i ].Succeeded   = false;
+	}
+
+	//
+	// Now forward each run of requests against the same BIF file as a batch,
+	// and transfer the results back.
+	//
+
+	for (First = 0; First < Order.size( ); )
+	{
+		size_t Last;
+
+		for (Last = First + 1;
+		     (Last < Order.size( )) && (Order[ Last ].BifFile == Order[ First ].BifFile);
+		     Last += 1)
+		{
+			NOTHING;
+		}
+
+		if (!Order[ First ].BifFile->ReadEncapsulatedFiles(
+			&Forwarded[ First ],
+			Last - First))
+		{
+			AllSucceeded = false;
+		}
+
+		for (size_t i = First; i < Last; i += 1)
+		{
+			ReadRequest & Request = Requests[ Order[ i ].Request ];
+
+			Request.BytesRead = Forwarded[ i ].BytesRead;
+			Request.Succeeded = Forwarded[ i ].Succeeded;
+
+			if (Forwarded[ i ].File != INVALID_FILE)
+				Order[ i ].BifFile->CloseFile( Forwarded[ i ].File );
+		}
+
+		First = Last;
+	}
+
+	return AllSucceeded;
+}
+
 template< typename ResRefT >
 size_t
 KeyFileReader< ResRefT >::GetEncapsulatedFileSize(
@@ -370,7 +540,9 @@ Environment:
 
 --*/
 {
-	PCKEY_RESOURCE_DESCRIPTOR  ResKey;
+	PCKEY_RESOURCE             ResKey;
+	BifFileReaderT           * BifFile;
+	BifFileId                  BifFileIndex;
 	BifFileReaderT::FileHandle FileHandle;
 	size_t                     FileSize;
 
@@ -383,6 +555,11 @@ Environment:
 	if (ResKey == NULL)
 		return 0;
 
+	BifFile = GetBifFile( ResKey, BifFileIndex );
+
+	if (BifFile == NULL)
+		return 0;
+
 	//
 	// Now delegate the query to the BIF file reader, which has the sizing
 	// information for its contained files.
@@ -393,15 +570,14 @@ Environment:
 	//       no-ops.
 	//
 
-	FileHandle = ResKey->BifFile->OpenFileByIndex(
-		ResKey->Res.ResID & 0xFFFFF );
+	FileHandle = BifFile->OpenFileByIndex( BifFileIndex );
 
 	if (FileHandle == INVALID_FILE)
 		return 0;
 
-	FileSize = ResKey->BifFile->GetEncapsulatedFileSize( FileHandle );
+	FileSize = BifFile->GetEncapsulatedFileSize( FileHandle );
 	
-	ResKey->BifFile->CloseFile( FileHandle );
+	BifFile->CloseFile( FileHandle );
 	FileHandle = INVALID_FILE;
 
 	return FileSize;
@@ -438,14 +614,14 @@ Environment:
 
 --*/
 {
-	PCKEY_RESOURCE_DESCRIPTOR ResKey;
+	PCKEY_RESOURCE ResKey;
 
 	ResKey = LookupResourceKey( ((ResID) File) - 1 );
 
 	if (ResKey == NULL)
 		return NWN::ResINVALID;
 
-	return ResKey->Res.ResourceType;
+	return ResKey->ResourceType;
 }
 
 template< typename ResRefT >
@@ -481,7 +657,7 @@ Environment:
 
 --*/
 {
-	PCKEY_RESOURCE_DESCRIPTOR ResKey;
+	PCKEY_RESOURCE ResKey;
 
 	C_ASSERT( sizeof( ResRefT ) <= sizeof( ResRefIf ) );
 
@@ -491,8 +667,8 @@ Environment:
 		return false;
 
 	ZeroMemory( &ResRef, sizeof( ResRef ) );
-	memcpy( &ResRef, &ResKey->Res.ResRef, sizeof( ResKey->Res.ResRef ) );
-	Type = ResKey->Res.ResourceType;
+	memcpy( &ResRef, &ResKey->ResRef, sizeof( ResKey->ResRef ) );
+	Type = ResKey->ResourceType;
 
 	return true;
 }
@@ -523,7 +699,7 @@ Environment:
 
 --*/
 {
-	return m_KeyResDir.size( );
+	return m_KeyCount;
 }
 
 template< typename ResRefT >
@@ -556,7 +732,9 @@ Environment:
 --*/
 {
 	
-	PCKEY_RESOURCE_DESCRIPTOR  ResKey;
+	PCKEY_RESOURCE             ResKey;
+	BifFileReaderT           * BifFile;
+	BifFileId                  BifFileIndex;
 	BifFileReaderT::FileHandle FileHandle;
 	AccessorType               Type;
 
@@ -575,6 +753,11 @@ Environment:
 	if (ResKey == NULL)
 		throw std::runtime_error( "invalid file handle passed to KeyFileReader::GetResourceAccessorName" );
 
+	BifFile = GetBifFile( ResKey, BifFileIndex );
+
+	if (BifFile == NULL)
+		throw std::runtime_error( "failed to open BIF file in KeyFileReader::GetResourceAccessorName" );
+
 	//
 	// Now delegate the query to the specific BIF file that has been chosen.
 	//
@@ -584,36 +767,119 @@ Environment:
 	//       no-ops.
 	//
 
-	FileHandle = ResKey->BifFile->OpenFileByIndex(
-		ResKey->Res.ResID & 0xFFFFF );
+	FileHandle = BifFile->OpenFileByIndex( BifFileIndex );
 
 	if (FileHandle == INVALID_FILE)
 		throw std::runtime_error( "file open that should not fail has failed" );
 
 	try
 	{
-		Type = (AccessorType) ResKey->BifFile->GetResourceAccessorName(
+		Type = (AccessorType) BifFile->GetResourceAccessorName(
 			FileHandle,
 			AccessorName);
 	}
 	catch (std::exception)
 	{
-		ResKey->BifFile->CloseFile( FileHandle );
+		BifFile->CloseFile( FileHandle );
 		FileHandle = INVALID_FILE;
 		throw;
 	}
 
-	ResKey->BifFile->CloseFile( FileHandle );
+	BifFile->CloseFile( FileHandle );
 	FileHandle = INVALID_FILE;
 
 	return Type;
 }
 
+template< typename ResRefT >
+bool
+KeyFileReader< ResRefT >::GetEncapsulatedFileMapping(
+	__in FileHandle File,
+	__out HANDLE * BackingFile,
+	__out ULONG64 * BackingFileOffset
+	)
+/*++
+
+Routine Description:
+
+	This routine returns the backing file handle and file offset of an
+	encapsulated file so that the caller may map the file contents directly.
+
+	The request is delegated to the BIF file that contains the resource.
+
+Arguments:
+
+	File - Supplies the file handle to inquire about.
+
+	BackingFile - Receives the BIF file handle.  The handle remains owned by
+	              the BIF file reader object.
+
+	BackingFileOffset - Receives the offset of the encapsulated file's data
+	                    within the BIF file.
+
+Return Value:
+
+	The routine returns a Boolean value indicating true on success, else false
+	on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	PCKEY_RESOURCE             ResKey;
+	BifFileReaderT           * BifFile;
+	BifFileId                  BifFileIndex;
+	BifFileReaderT::FileHandle FileHandle;
+	bool                       Status;
+
+	*BackingFile       = INVALID_HANDLE_VALUE;
+	*BackingFileOffset = 0;
+
+	//
+	// Locate the containing BIF file.
+	//
+
+	ResKey = LookupResourceKey( ((ResID) File) - 1 );
+
+	if (ResKey == NULL)
+		return false;
+
+	BifFile = GetBifFile( ResKey, BifFileIndex );
+
+	if (BifFile == NULL)
+		return false;
+
+	//
+	// Now delegate the query to the specific BIF file that has been chosen.
+	//
+	// N.B.  File open/close for BIF files is a no-op, so the returned mapping
+	//       remains valid for as long as the BIF file reader itself.
+	//
+
+	FileHandle = BifFile->OpenFileByIndex( BifFileIndex );
+
+	if (FileHandle == INVALID_FILE)
+		return false;
+
+	Status = BifFile->GetEncapsulatedFileMapping(
+		FileHandle,
+		BackingFile,
+		BackingFileOffset);
+
+	BifFile->CloseFile( FileHandle );
+	FileHandle = INVALID_FILE;
+
+	return Status;
+}
+
 template< typename ResRefT >
 void
 KeyFileReader< ResRefT >::ParseKeyFile(
 	__in HANDLE File,
-	__in const std::string & InstallDir
+	__in const std::string & InstallDir,
+	__in unsigned long Flags
 	)
 /*++
 
@@ -622,6 +888,9 @@ Routine Description:
 	This routine parses the directory structures of a KEY file and generates
 	the in-memory key and resource list entry directories.
 
+	In lazy mode, the resource table is instead used in place from a mapped
+	view of the KEY file, and no BIF files are opened.
+
 Arguments:
 
 	File - Supplies a handle to the file to read.
@@ -629,6 +898,9 @@ Arguments:
 	InstallDir - Supplies the installation directory to use for drive 0.  The
 	             directory should have a trailing path separator character.
 
+	Flags - Supplies flags that control the behavior of the reader.  Legal
+	        values are drawn from the KEY_FLAG_* family of values.
+
 Return Value:
 
 	None.  On failure, the routine raises an std::exception.
@@ -639,9 +911,8 @@ Environment:
 
 --*/
 {
-	FileWrapper                           FileWrap( INVALID_HANDLE_VALUE );
-	KEY_HEADER                            Header;
-	std::vector< BifFileReaderT::FileId > MaxBifFileIdVec;
+	FileWrapper FileWrap( INVALID_HANDLE_VALUE );
+	KEY_HEADER  Header;
 
 	FileWrap.SetFileHandle( File );
 
@@ -655,23 +926,20 @@ Environment:
 	if (Header.BIFCount < 1024)
 	{
 		m_BifFiles.reserve( Header.BIFCount );
-		MaxBifFileIdVec.reserve( Header.BIFCount );
+		m_BifPaths.reserve( Header.BIFCount );
+		m_BifOpenFailed.reserve( Header.BIFCount );
 	}
 	else
 	{
 		m_BifFiles.reserve( 1024 );
-		MaxBifFileIdVec.reserve( 1024 );
+		m_BifPaths.reserve( 1024 );
+		m_BifOpenFailed.reserve( 1024 );
 	}
 
-	if (Header.KeyCount < 1024 * 1024)
-		m_KeyResDir.reserve( Header.KeyCount );
-	else
-		m_KeyResDir.reserve( 1024 * 1024 );
-
 	//
-	// Load up all of the BIF files attached to this key.  We require that they
-	// are all present in the game installation directory in this
-	// implementation.
+	// Collect the names of all of the BIF files attached to this key.  We
+	// require that they are all present in the game installation directory in
+	// this implementation.
 	//
 
 	FileWrap.SeekOffset( Header.OffsetToFileTable, "OffsetToFileTable" );
@@ -681,7 +949,6 @@ Environment:
 		KEY_FILE          Bif;
 		char              Name[ 1024 ];
 		ULONGLONG         FilePtr;
-		BifFileReaderTPtr BifFile;
 		std::string       BifPath( InstallDir );
 
 		BifPath += "/";
@@ -707,13 +974,34 @@ Environment:
 
 		BifPath += Name;
 
-		BifFile = new BifFileReaderT( BifPath );
+		m_BifPaths.push_back( BifPath );
+		m_BifFiles.push_back( BifFileReaderTPtr( ) );
+		m_BifOpenFailed.push_back( false );
+	}
 
-		m_BifFiles.push_back( BifFile );
+	//
+	// In lazy mode, each resource is validated against its BIF file when the
+	// BIF file is first opened (see GetBifFile).
+	//
 
-		MaxBifFileIdVec.push_back( BifFile->GetEncapsulatedFileCount( ) );
+	if (Flags & KEY_FLAG_LAZY_BIF_LOAD)
+	{
+		MapKeyTable( File, Header );
+		return;
 	}
 
+	//
+	// Load up all of the BIF files attached to this key.
+	//
+
+	for (size_t i = 0; i < m_BifPaths.size( ); i += 1)
+		OpenBifFile( i );
+
+	if (Header.KeyCount < 1024 * 1024)
+		m_KeyResDir.reserve( Header.KeyCount );
+	else
+		m_KeyResDir.reserve( 1024 * 1024 );
+
 	//
 	// Now process each of the file entries.
 	//
@@ -724,25 +1012,199 @@ Environment:
 
 	for (unsigned long i = 0; i < Header.KeyCount; i += 1)
 	{
-		KEY_RESOURCE_DESCRIPTOR Key;
+		KEY_RESOURCE             Key;
 		size_t                   BifId;
 		BifFileReaderT::FileId   FileId;
 
-		FileWrap.ReadFile( &Key.Res, sizeof( Key.Res ), "Key" );
+		FileWrap.ReadFile( &Key, sizeof( Key ), "Key" );
 
-		BifId  = (Key.Res.ResID >> 20);
-		FileId = (Key.Res.ResID & 0xFFFFF);
+		BifId  = (Key.ResID >> 20);
+		FileId = (Key.ResID & 0xFFFFF);
 
 		if (BifId >= m_BifFiles.size( ))
 			throw std::runtime_error( "Key.ResID specifies an out of range BIF file" );
-		if (FileId >= MaxBifFileIdVec[ BifId ])
+		if (FileId >= m_BifFiles[ BifId ]->GetEncapsulatedFileCount( ))
 			throw std::runtime_error( "Key.ResID specifies an out of range BIF resource ID" );
 
-		Key.BifFile        = m_BifFiles[ BifId ].get( );
-		Key.DirectoryIndex = m_KeyResDir.size( );
-
 		m_KeyResDir.push_back( Key );
 	}
+
+	m_KeyTable = (m_KeyResDir.empty( )) ? NULL : &m_KeyResDir[ 0 ];
+	m_KeyCount = m_KeyResDir.size( );
+}
+
+template< typename ResRefT >
+void
+KeyFileReader< ResRefT >::MapKeyTable(
+	__in HANDLE File,
+	__in const KEY_HEADER & Header
+	)
+/*++
+
+Routine Description:
+
+	This routine maps a view of the KEY file and locates the resource table
+	within it, so that resource table entries are used in place rather than
+	being copied into the resource list.  The view remains mapped for the
+	lifetime of the reader.
+
+Arguments:
+
+	File - Supplies a handle to the KEY file.
+
+	Header - Supplies the KEY file header.
+
+Return Value:
+
+	None.  On failure, the routine raises an std::exception.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	LARGE_INTEGER Size;
+	HANDLE        Section;
+	ULONGLONG     TableSize;
+
+	if (!GetFileSizeEx( File, &Size ))
+		throw std::runtime_error( "Failed to read file size." );
+
+	TableSize = (ULONGLONG) Header.KeyCount * sizeof( KEY_RESOURCE );
+
+	if (((ULONGLONG) Header.OffsetToKeyTable + TableSize > (ULONGLONG) Size.QuadPart) ||
+	    ((ULONGLONG) Size.QuadPart > (SIZE_T) -1))
+	{
+		throw std::runtime_error( "KEY resource table exceeds file size" );
+	}
+
+	if (Header.KeyCount == 0)
+		return;
+
+	Section = CreateFileMapping( File, NULL, PAGE_READONLY, 0, 0, NULL );
+
+	if (Section == NULL)
+		throw std::runtime_error( "Failed to create KEY file mapping." );
+
+	m_MappedView = (const unsigned char *) MapViewOfFile(
+		Section,
+		FILE_MAP_READ,
+		0,
+		0,
+		0);
+
+	CloseHandle( Section );
+
+	if (m_MappedView == NULL)
+		throw std::runtime_error( "Failed to map KEY file." );
+
+	m_KeyTable = (PCKEY_RESOURCE) (m_MappedView + Header.OffsetToKeyTable);
+	m_KeyCount = Header.KeyCount;
+}
+
+template< typename ResRefT >
+typename KeyFileReader< ResRefT >::BifFileReaderT *
+KeyFileReader< ResRefT >::OpenBifFile(
+	__in size_t BifId
+	)
+/*++
+
+Routine Description:
+
+	This routine opens a BIF file attached to the KEY file, which parses and
+	validates the BIF file's resource table.
+
+Arguments:
+
+	BifId - Supplies the index of the BIF file within the KEY file table.
+
+Return Value:
+
+	The routine returns the BIF file reader.  On failure, the routine raises
+	an std::exception.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	BifFileReaderTPtr BifFile;
+
+	BifFile = new BifFileReaderT( m_BifPaths[ BifId ] );
+
+	m_BifFiles[ BifId ] = BifFile;
+
+	return BifFile.get( );
+}
+
+template< typename ResRefT >
+typename KeyFileReader< ResRefT >::BifFileReaderT *
+KeyFileReader< ResRefT >::GetBifFile(
+	__in PCKEY_RESOURCE Key,
+	__out BifFileId & FileIndex
+	)
+/*++
+
+Routine Description:
+
+	This routine returns the BIF file that contains a resource, along with the
+	index of the resource within the BIF file.  In lazy mode, the BIF file is
+	opened on first use.  Should the open fail, the failure is recorded so
+	that subsequent requests fail immediately instead of retrying the open.
+
+	As the resource table is not validated up front in lazy mode, the resource
+	is checked against the BIF file's resource table here.
+
+Arguments:
+
+	Key - Supplies the resource table entry of the resource.
+
+	FileIndex - Receives the index of the resource within the BIF file.
+
+Return Value:
+
+	The routine returns the BIF file reader on success, else NULL if the BIF
+	file could not be opened or does not contain the resource.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	BifFileReaderT * BifFile;
+	size_t           BifId;
+
+	BifId     = (Key->ResID >> 20);
+	FileIndex = (Key->ResID & 0xFFFFF);
+
+	if (BifId >= m_BifFiles.size( ))
+		return NULL;
+
+	BifFile = m_BifFiles[ BifId ].get( );
+
+	if (BifFile == NULL)
+	{
+		if (m_BifOpenFailed[ BifId ])
+			return NULL;
+
+		try
+		{
+			BifFile = OpenBifFile( BifId );
+		}
+		catch (std::exception)
+		{
+			m_BifOpenFailed[ BifId ] = true;
+			return NULL;
+		}
+	}
+
+	if (FileIndex >= BifFile->GetEncapsulatedFileCount( ))
+		return NULL;
+
+	return BifFile;
 }
 
 template KeyFileReader< NWN::ResRef16 >;
@@ -44,13 +44,30 @@ public:
 
 	typedef NWN::ResRef32 ResRefIf;
 
+	enum
+	{
+		//
+		// Use the resource table directly from a mapped view of the KEY file,
+		// and defer opening each BIF file (and validating its resource table)
+		// until one of its resources is first accessed.  A BIF file that is
+		// missing or damaged is then reported as a failure to access its
+		// resources, rather than as a failure to construct the reader.
+		//
+
+		KEY_FLAG_LAZY_BIF_LOAD = 0x00000001,
+
+		LAST_KEY_FLAG
+	};
+
 	//
-	// Constructor.  Raises an std::exception on parse failure.
+	// Constructor.  Raises an std::exception on parse failure.  Legal flags
+	// are drawn from the KEY_FLAG_* family of values.
 	//
 
 	KeyFileReader(
 		__in const std::string & FileName,
-		__in const std::string & InstallDir
+		__in const std::string & InstallDir,
+		__in unsigned long Flags = 0
 		);
 
 	//
@@ -107,6 +124,18 @@ public:
 		__out_bcount( BytesToRead ) void * Buffer
 		);
 
+	//
+	// Read a batch of ranges of encapsulated files.  The requests are grouped
+	// by BIF file and each group is forwarded as a batch to its BIF file.
+	//
+
+	virtual
+	bool
+	ReadEncapsulatedFiles(
+		__inout_ecount( Count ) ReadRequest * Requests,
+		__in size_t Count
+		);
+
 	//
 	// Return the size of a file.
 	//
@@ -160,6 +189,19 @@ public:
 		__out std::string & AccessorName
 		);
 
+	//
+	// Return the backing file handle and offset of an encapsulated file, for
+	// use in directly mapping the file contents.
+	//
+
+	virtual
+	bool
+	GetEncapsulatedFileMapping(
+		__in FileHandle File,
+		__out HANDLE * BackingFile,
+		__out ULONG64 * BackingFileOffset
+		);
+
 private:
 
 	//
@@ -169,12 +211,16 @@ private:
 	void
 	ParseKeyFile(
 		__in HANDLE File,
-		__in const std::string & InstallDir
+		__in const std::string & InstallDir,
+		__in unsigned long Flags
 		);
 
 	typedef BifFileReader< ResRefT > BifFileReaderT;
 	typedef swutil::SharedPtr< BifFileReaderT > BifFileReaderTPtr;
 	typedef std::vector< BifFileReaderTPtr > BifFileVec;
+	typedef std::vector< std::string > BifPathVec;
+	typedef std::vector< bool > BifFailedVec;
+	typedef typename BifFileReaderT::FileId BifFileId;
 
 	//
 	// Define the KEY on-disk file structures.  This data is based on the
@@ -217,31 +263,89 @@ private:
 		unsigned long ResID;                   // Bits 0-19 -> BIF file index (within BIF's resource table), bits 20-31 -> BIF index (within key file table)
 	} KEY_RESOURCE, * PKEY_RESOURCE;
 
-	typedef const struct _KEY_FILE * PCKEY_FILE;
+	typedef const struct _KEY_RESOURCE * PCKEY_RESOURCE;
 
 #include <poppack.h>
 
-	typedef struct _KEY_RESOURCE_DESCRIPTOR
+	typedef std::vector< KEY_RESOURCE > KeyResVec;
+
+	//
+	// Define a batched read request forwarded to a BIF file, used by
+	// ReadEncapsulatedFiles to group requests by BIF file.
+	//
+
+	struct BifReadOrder
 	{
-		KEY_RESOURCE     Res;
 		BifFileReaderT * BifFile;
-		size_t           DirectoryIndex; // Index into m_KeyResDir
-	} KEY_RESOURCE_DESCRIPTOR, * PKEY_RESOURCE_DESCRIPTOR;
+		BifFileId        FileIndex;
+		size_t           Request;
+	};
+
+	struct BifReadOrderLess
+	{
+		inline
+		bool
+		operator()(
+			__in const BifReadOrder & left,
+			__in const BifReadOrder & right
+			) const
+		{
+			return left.BifFile < right.BifFile;
+		}
+	};
 
-	typedef const struct _KEY_RESOURCE_DESCRIPTOR * PCKEY_RESOURCE_DESCRIPTOR;
+	typedef std::vector< BifReadOrder > BifReadOrderVec;
+	typedef std::vector< typename BifFileReaderT::ReadRequest > BifReadRequestVec;
 
-	typedef std::vector< KEY_RESOURCE_DESCRIPTOR > KeyResVec;
+	//
+	// Define helper routines for looking up resource data.
+	//
+
+	//
+	// Map the resource table of the KEY file, for use in place.  Raises an
+	// std::exception on failure.
+	//
+
+	void
+	MapKeyTable(
+		__in HANDLE File,
+		__in const KEY_HEADER & Header
+		);
+
+	//
+	// Open the BIF file at a given index within the BIF file table.  Raises
+	// an std::exception on failure.
+	//
+
+	BifFileReaderT *
+	OpenBifFile(
+		__in size_t BifId
+		);
+
+	//
+	// Return the BIF file that contains a resource, opening it if it has not
+	// yet been opened, along with the index of the resource within the BIF
+	// file.  The routine returns NULL if the BIF file could not be opened or
+	// does not contain the resource.  A failed open is remembered, so later
+	// calls for the same BIF file fail without retrying it.
+	//
+
+	BifFileReaderT *
+	GetBifFile(
+		__in PCKEY_RESOURCE Key,
+		__out BifFileId & FileIndex
+		);
 
 	//
 	// Define helper routines for looking up resource data.
 	//
 
 	//
-	// Look up a key file descriptor by its resref name.
+	// Look up a key file resource by its resref name.
 	//
 
 	inline
-	PCKEY_RESOURCE_DESCRIPTOR
+	PCKEY_RESOURCE
 	LookupResourceKey(
 		__in const ResRefIf & Name,
 		__in ResType Type
@@ -249,44 +353,63 @@ private:
 	{
 		C_ASSERT( sizeof( ResRefT ) <= sizeof( ResRefIf ) );
 
-		for (KeyResVec::const_iterator it = m_KeyResDir.begin( );
-		     it != m_KeyResDir.end( );
-		     ++it)
+		for (size_t i = 0; i < m_KeyCount; i += 1)
 		{
-			if (it->Res.ResourceType != Type)
+			if (m_KeyTable[ i ].ResourceType != Type)
 				continue;
 
-			if (!memcmp( &Name, &it->Res.ResRef, sizeof( ResRefT ) ))
-				return &*it;
+			if (!memcmp( &Name, &m_KeyTable[ i ].ResRef, sizeof( ResRefT ) ))
+				return &m_KeyTable[ i ];
 		}
 
 		return NULL;
 	}
 
 	//
-	// Look up a key file descriptor by resource index.  The resource index is
+	// Look up a key file resource by resource index.  The resource index is
 	// the index into the resource table.
 	//
 
 	inline
-	PCKEY_RESOURCE_DESCRIPTOR
+	PCKEY_RESOURCE
 	LookupResourceKey(
 		__in ResID ResourceId
 		) const
 	{
-		if (ResourceId >= m_KeyResDir.size( ))
+		if (ResourceId >= m_KeyCount)
 			return NULL;
 
-		return &m_KeyResDir[ ResourceId ];
+		return &m_KeyTable[ ResourceId ];
+	}
+
+	//
+	// Return the resource index of a key file resource.
+	//
+
+	inline
+	ResID
+	GetResourceIndex(
+		__in PCKEY_RESOURCE Key
+		) const
+	{
+		return (ResID) (Key - m_KeyTable);
 	}
 
 	//
-	// Resource list data.
+	// Resource list data.  The resource table, m_KeyTable, refers either to
+	// m_KeyResDir or (in lazy mode) to the mapped view of the KEY file.  The
+	// BIF files that have not yet been opened (lazy mode only) are NULL, and
+	// m_BifOpenFailed marks the BIF files whose lazy open has failed.
 	//
 
-	KeyResVec          m_KeyResDir;
-	BifFileVec         m_BifFiles;
-	std::string        m_KeyFileName;
+	KeyResVec             m_KeyResDir;
+	PCKEY_RESOURCE        m_KeyTable;
+	size_t                m_KeyCount;
+	const unsigned char * m_MappedView;
+	BifFileVec            m_BifFiles;
+	BifPathVec            m_BifPaths;
+	BifFailedVec          m_BifOpenFailed;
+	std::string           m_KeyFileName;
 
 };
 
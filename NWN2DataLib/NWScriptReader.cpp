@@ -245,6 +245,7 @@ Environment:
   m_PatchState( other.m_PatchState ),
   m_Name( other.m_Name ),
   m_Analyzed( other.m_Analyzed ),
+  m_DecodedProgram( other.m_DecodedProgram ),
   m_SymbolTable( other.m_SymbolTable )
 {
 	m_Parser = new swutil::BufferParser(
@@ -631,7 +632,8 @@ Routine Description:
 
 	This routine patches a new byte into the opcode stream at a given location.
 
-	Note that all users of the NWScriptReader see the modified stream.
+	Note that all users of the NWScriptReader see the modified stream.  Any
+	pre-decoded instruction stream is discarded, as it no longer matches.
 
 Arguments:
 
@@ -653,6 +655,8 @@ Environment:
 		throw std::runtime_error( "NWScriptReader::PatchBYTE: Illegal Offset." );
 
 	m_Instructions[ Offset ] = Byte;
+
+	m_DecodedProgram.release( );
 }
 
 void
@@ -322,6 +322,45 @@ public:
 		m_Analyzed     = true;
 	}
 
+	//
+	// Pre-decoded instruction stream cache (for the script VM).  The layout of
+	// the decoded program is private to the script VM; the reader retains it
+	// on the VM's behalf so that a script is decoded only once, and discards
+	// it should the instruction stream be patched.
+	//
+
+	class DecodedProgram
+	{
+
+	public:
+
+		virtual
+		~DecodedProgram(
+			)
+		{
+		}
+
+	};
+
+	typedef swutil::SharedPtr< DecodedProgram > DecodedProgramPtr;
+
+	inline
+	DecodedProgramPtr
+	GetDecodedProgram(
+		) const
+	{
+		return m_DecodedProgram;
+	}
+
+	inline
+	void
+	SetDecodedProgram(
+		__in const DecodedProgramPtr & Program
+		)
+	{
+		m_DecodedProgram = Program;
+	}
+
 	//
 	// Look up a subroutine name (exact match) from the symbol table, if any
 	// was loaded.
@@ -413,6 +452,13 @@ private:
 	ScriptAnalyzeState      m_AnalyzeState;
 	bool                    m_Analyzed;
 
+	//
+	// Define the pre-decoded instruction stream, if the script VM has
+	// decoded the script.
+	//
+
+	DecodedProgramPtr       m_DecodedProgram;
+
 	//
 	// Define the symbol table for the script.
 	//
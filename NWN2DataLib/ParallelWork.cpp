@@ -0,0 +1,206 @@
+/*++
+
+Copyright (c) Ken Johnson (Skywing). All rights reserved.
+
+Module Name:
+
+	ParallelWork.cpp
+
+Abstract:
+
+	This module houses the parallel work dispatcher, which executes a batch
+	of independent work items across a set of worker threads.
+
+--*/
+
+#include "Precomp.h"
+#include "ParallelWork.h"
+#include <process.h>
+
+//
+// Define the shared state of a batch of work items.
+//
+
+typedef struct _PARALLEL_WORK_BATCH
+{
+	PARALLEL_WORK_ROUTINE   Routine;
+	void                  * Context;
+	size_t                  WorkItemCount;
+	volatile LONG           NextWorkItem;
+} PARALLEL_WORK_BATCH, * PPARALLEL_WORK_BATCH;
+
+static
+void
+DrainParallelWork(
+	__in PPARALLEL_WORK_BATCH Batch
+	)
+/*++
+
+Routine Description:
+
+	This routine claims and executes work items from a batch until no work
+	items remain.
+
+Arguments:
+
+	Batch - Supplies the batch to execute work items from.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	for (;;)
+	{
+		size_t WorkItem;
+
+		WorkItem = (size_t) (InterlockedIncrement( &Batch->NextWorkItem ) - 1);
+
+		if (WorkItem >= Batch->WorkItemCount)
+			break;
+
+		Batch->Routine( Batch->Context, WorkItem );
+	}
+}
+
+static
+unsigned
+__stdcall
+ParallelWorkThread(
+	__in void * Parameter
+	)
+/*++
+
+Routine Description:
+
+	This routine is the entry point of a parallel work worker thread.
+
+Arguments:
+
+	Parameter - Supplies the batch to execute work items from.
+
+Return Value:
+
+	The routine always returns zero.
+
+Environment:
+
+	User mode, worker thread.
+
+--*/
+{
+	DrainParallelWork( (PPARALLEL_WORK_BATCH) Parameter );
+
+	return 0;
+}
+
+void
+ExecuteParallelWork(
+	__in size_t WorkItemCount,
+	__in PARALLEL_WORK_ROUTINE Routine,
+	__in void * Context,
+	__in size_t MaxThreads
+	)
+/*++
+
+Routine Description:
+
+	This routine executes a batch of work items in parallel, and returns once
+	all work items have completed.
+
+Arguments:
+
+	WorkItemCount - Supplies the count of work items.
+
+	Routine - Supplies the routine to invoke for each work item.
+
+	Context - Supplies the context argument passed to the routine.
+
+	MaxThreads - Supplies the maximum count of threads (including the calling
+	             thread) to use, or zero to use one thread per processor.
+
+Return Value:
+
+	None.  Raises an std::exception if the count of work items is too large,
+	in which case no work items are executed.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	PARALLEL_WORK_BATCH Batch;
+	HANDLE              Threads[ MAXIMUM_WAIT_OBJECTS ];
+	DWORD               ThreadCount;
+	size_t              WantThreads;
+
+	if (WorkItemCount == 0)
+		return;
+
+	//
+	// Each thread advances the shared work item counter once past the end of
+	// the batch before it stops, so the counter must not be able to overflow
+	// even then.
+	//
+
+	if ((ULONG64) WorkItemCount > (ULONG64) LONG_MAX - (MAXIMUM_WAIT_OBJECTS + 1))
+		throw std::runtime_error( "Too many parallel work items." );
+
+	Batch.Routine       = Routine;
+	Batch.Context       = Context;
+	Batch.WorkItemCount = WorkItemCount;
+	Batch.NextWorkItem  = 0;
+
+	if (MaxThreads == 0)
+	{
+		SYSTEM_INFO SysInfo;
+
+		GetSystemInfo( &SysInfo );
+
+		MaxThreads = SysInfo.dwNumberOfProcessors;
+	}
+
+	WantThreads = min( MaxThreads, WorkItemCount );
+	WantThreads = min( WantThreads, (size_t) MAXIMUM_WAIT_OBJECTS + 1 );
+
+	//
+	// Start the worker threads.  The calling thread is itself a worker, so
+	// one fewer thread than requested is created.
+	//
+
+	for (ThreadCount = 0; ThreadCount + 1 < WantThreads; ThreadCount += 1)
+	{
+		//
+		// N.B.  _beginthreadex is used as the work routines make use of the
+		//       CRT.
+		//
+
+		Threads[ ThreadCount ] = (HANDLE) _beginthreadex(
+			NULL,
+			0,
+			ParallelWorkThread,
+			&Batch,
+			0,
+			NULL);
+
+		if (Threads[ ThreadCount ] == NULL)
+			break;
+	}
+
+	DrainParallelWork( &Batch );
+
+	if (ThreadCount != 0)
+	{
+		WaitForMultipleObjects( ThreadCount, Threads, TRUE, INFINITE );
+
+		for (DWORD i = 0; i < ThreadCount; i += 1)
+			CloseHandle( Threads[ i ] );
+	}
+}
+
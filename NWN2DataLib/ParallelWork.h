@@ -0,0 +1,56 @@
+/*++
+
+Copyright (c) Ken Johnson (Skywing). All rights reserved.
+
+Module Name:
+
+	ParallelWork.h
+
+Abstract:
+
+	This module defines the parallel work dispatcher, which executes a batch
+	of independent work items across a set of worker threads.
+
+--*/
+
+#ifndef _PROGRAMS_NWN2DATALIB_PARALLELWORK_H
+#define _PROGRAMS_NWN2DATALIB_PARALLELWORK_H
+
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+//
+// Define the work item routine type.  The routine is invoked once for each
+// work item index, potentially concurrently with other work items, and must
+// not raise an exception.
+//
+
+typedef
+void
+(* PARALLEL_WORK_ROUTINE)(
+	__in void * Context,
+	__in size_t WorkItem
+	);
+
+//
+// Execute a batch of work items in parallel and wait for all of them to
+// complete.  The calling thread participates in executing work items.  Work
+// items are started in index order, but may complete in any order.
+//
+// If MaxThreads is zero, one thread per processor is used.  If worker threads
+// cannot be created, the remaining work is executed on fewer threads (down to
+// only the calling thread).  Raises an std::exception, without executing any
+// work items, if WorkItemCount is too large to be dispatched.
+//
+
+void
+ExecuteParallelWork(
+	__in size_t WorkItemCount,
+	__in PARALLEL_WORK_ROUTINE Routine,
+	__in void * Context,
+	__in size_t MaxThreads
+	);
+
+#endif
+
@@ -84,6 +84,59 @@ struct IResourceAccessor
 		__out_bcount( BytesToRead ) void * Buffer
 		) = 0;
 
+	//
+	// Define a single read request for ReadEncapsulatedFiles.  The BytesRead
+	// and Succeeded fields are filled in by the resource accessor.
+	//
+
+	struct ReadRequest
+	{
+		FileHandle File;
+		size_t     Offset;
+		size_t     BytesToRead;
+		void     * Buffer;
+		size_t     BytesRead;
+		bool       Succeeded;
+	};
+
+	//
+	// Read a batch of ranges of encapsulated files by file handle.  Each
+	// request is satisfied as per ReadEncapsulatedFile, but the accessor may
+	// reorder and combine the underlying reads, i.e. to turn many small random
+	// reads into a few large sequential ones.  The routine returns true if
+	// every request succeeded.
+	//
+	// The default implementation issues each request in turn.
+	//
+
+	virtual
+	bool
+	ReadEncapsulatedFiles(
+		__inout_ecount( Count ) ReadRequest * Requests,
+		__in size_t Count
+		)
+	{
+		bool AllSucceeded;
+
+		AllSucceeded = true;
+
+		for (size_t i = 0; i < Count; i += 1)
+		{
+			Requests[ i ].BytesRead = 0;
+			Requests[ i ].Succeeded = ReadEncapsulatedFile(
+				Requests[ i ].File,
+				Requests[ i ].Offset,
+				Requests[ i ].BytesToRead,
+				&Requests[ i ].BytesRead,
+				Requests[ i ].Buffer);
+
+			if (!Requests[ i ].Succeeded)
+				AllSucceeded = false;
+		}
+
+		return AllSucceeded;
+	}
+
 	//
 	// Return the size of a file.
 	//
@@ -148,6 +201,35 @@ struct IResourceAccessor
 		__out std::string & AccessorName
 		) = 0;
 
+	//
+	// Return the backing operating system file handle and file offset of an
+	// encapsulated file whose contents are stored contiguously and without
+	// compression, so that the caller may map the file contents directly
+	// instead of copying them through ReadEncapsulatedFile.  The returned
+	// handle remains owned by the resource accessor and may only be used while
+	// the encapsulated file handle remains open.
+	//
+	// Accessors that cannot supply a direct mapping (for example, because the
+	// resource data is compressed) return false, in which case the caller must
+	// fall back to ReadEncapsulatedFile.  This is the default behavior.
+	//
+
+	virtual
+	bool
+	GetEncapsulatedFileMapping(
+		__in FileHandle File,
+		__out HANDLE * BackingFile,
+		__out ULONG64 * BackingFileOffset
+		)
+	{
+		UNREFERENCED_PARAMETER( File );
+
+		*BackingFile       = INVALID_HANDLE_VALUE;
+		*BackingFileOffset = 0;
+
+		return false;
+	}
+
 	static
 	const char *
 	ResTypeToExt(
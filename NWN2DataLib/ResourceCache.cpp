@@ -0,0 +1,512 @@
+/*++
+
+Copyright (c) Ken Johnson (Skywing). All rights reserved.
+
+Module Name:
+
+	ResourceCache.cpp
+
+Abstract:
+
+	This module houses the resource cache, which retains the in-memory
+	contents of recently used resources within a fixed byte budget.
+
+--*/
+
+#include "Precomp.h"
+#include "ResourceCache.h"
+
+ResourceCache::ResourceCache(
+	)
+/*++
+
+Routine Description:
+
+	This routine constructs a new, empty ResourceCache object.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	The newly constructed object.
+
+Environment:
+
+	User mode.
+
+--*/
+: m_Bytes( 0 ),
+  m_PinnedBytes( 0 ),
+  m_PinnedResources( 0 ),
+  m_MaxBytes( DEFAULT_MAX_BYTES ),
+  m_Hits( 0 ),
+  m_Misses( 0 ),
+  m_Evictions( 0 )
+{
+}
+
+ResourceCache::~ResourceCache(
+	)
+/*++
+
+Routine Description:
+
+	This routine cleans up an already-existing ResourceCache object.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+}
+
+void
+ResourceCache::SetLimit(
+	__in size_t MaxBytes
+	)
+/*++
+
+Routine Description:
+
+	This routine sets the byte budget of the cache.  If the cache currently
+	exceeds the new budget, then the least recently used resources are
+	discarded.
+
+Arguments:
+
+	MaxBytes - Supplies the maximum total size, in bytes, of cached resources.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	m_MaxBytes = MaxBytes;
+
+	Evict( 0 );
+}
+
+bool
+ResourceCache::Lookup(
+	__in size_t Resource,
+	__out DemandBufferPtr & Buffer
+	)
+/*++
+
+Routine Description:
+
+	This routine looks up a cached resource.  A cached, unpinned resource is
+	moved to the head of the LRU list.
+
+Arguments:
+
+	Resource - Supplies the index of the resource to look up.
+
+	Buffer - Receives the cached contents of the resource on success.
+
+Return Value:
+
+	The routine returns true if the resource was cached, else false.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	CacheEntryMap::iterator it;
+
+	it = m_Entries.find( Resource );
+
+	if (it == m_Entries.end( ))
+	{
+		m_Misses += 1;
+		return false;
+	}
+
+	if (it->second.PinCount == 0)
+	{
+		m_LruList.splice(
+			m_LruList.begin( ),
+			m_LruList,
+			it->second.Position );
+	}
+
+	Buffer  = it->second.Buffer;
+	m_Hits += 1;
+
+	return true;
+}
+
+void
+ResourceCache::Insert(
+	__in size_t Resource,
+	__in const DemandBufferPtr & Buffer,
+	__in bool Pinned
+	)
+/*++
+
+Routine Description:
+
+	This routine inserts a resource into the cache, discarding the least
+	recently used resources as necessary to stay within the byte budget.
+
+Arguments:
+
+	Resource - Supplies the index of the resource to insert.
+
+	Buffer - Supplies the contents of the resource.
+
+	Pinned - Supplies true if the resource is to be pinned.  A pinned resource
+	         is always cached; an unpinned resource that does not fit within the
+	         byte budget is not cached.
+
+Return Value:
+
+	None.  If the resource is already cached, its existing contents are
+	retained (and pinned, if requested).  The routine raises an std::exception
+	on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	CacheEntry Entry;
+	size_t     Size;
+
+	if (m_Entries.find( Resource ) != m_Entries.end( ))
+	{
+		if (Pinned)
+			Pin( Resource );
+
+		return;
+	}
+
+	Size = Buffer->GetSize( );
+
+	if ((!Pinned) &&
+	    ((m_PinnedBytes > m_MaxBytes) || (Size > m_MaxBytes - m_PinnedBytes)))
+	{
+		return;
+	}
+
+	Evict( Size );
+
+	Entry.Buffer   = Buffer;
+	Entry.PinCount = 0;
+
+	if (Pinned)
+	{
+		Entry.PinCount = 1;
+	}
+	else
+	{
+		Entry.Position = m_LruList.insert( m_LruList.begin( ), Resource );
+	}
+
+	try
+	{
+		m_Entries.insert( CacheEntryMap::value_type( Resource, Entry ) );
+	}
+	catch (...)
+	{
+		if (!Pinned)
+			m_LruList.erase( Entry.Position );
+
+		throw;
+	}
+
+	m_Bytes += Size;
+
+	if (Pinned)
+	{
+		m_PinnedBytes     += Size;
+		m_PinnedResources += 1;
+	}
+}
+
+bool
+ResourceCache::Pin(
+	__in size_t Resource
+	)
+/*++
+
+Routine Description:
+
+	This routine pins an already-cached resource, such that it is not
+	discarded until it is unpinned.
+
+Arguments:
+
+	Resource - Supplies the index of the resource to pin.
+
+Return Value:
+
+	The routine returns true if the resource was pinned, else false if the
+	resource is not cached.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	CacheEntryMap::iterator it;
+
+	it = m_Entries.find( Resource );
+
+	if (it == m_Entries.end( ))
+		return false;
+
+	if (it->second.PinCount++ == 0)
+	{
+		m_LruList.erase( it->second.Position );
+
+		m_PinnedBytes     += it->second.Buffer->GetSize( );
+		m_PinnedResources += 1;
+	}
+
+	return true;
+}
+
+bool
+ResourceCache::Unpin(
+	__in size_t Resource
+	)
+/*++
+
+Routine Description:
+
+	This routine releases a pin on a cached resource.  Once all pins are
+	released, the resource becomes the most recently used resource, and the
+	least recently used resources are discarded if the cache exceeds its byte
+	budget.
+
+Arguments:
+
+	Resource - Supplies the index of the resource to unpin.
+
+Return Value:
+
+	The routine returns true if the pin was released, else false if the
+	resource is not cached or is not pinned.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	CacheEntryMap::iterator it;
+
+	it = m_Entries.find( Resource );
+
+	if ((it == m_Entries.end( )) || (it->second.PinCount == 0))
+		return false;
+
+	if (--it->second.PinCount != 0)
+		return true;
+
+	m_PinnedBytes     -= it->second.Buffer->GetSize( );
+	m_PinnedResources -= 1;
+
+	try
+	{
+		it->second.Position = m_LruList.insert( m_LruList.begin( ), Resource );
+	}
+	catch (std::exception)
+	{
+		//
+		// The resource cannot be linked into the LRU list, so simply discard
+		// it.
+		//
+
+		m_Bytes -= it->second.Buffer->GetSize( );
+		m_Entries.erase( it );
+
+		return true;
+	}
+
+	Evict( 0 );
+
+	return true;
+}
+
+bool
+ResourceCache::Remove(
+	__in size_t Resource
+	)
+/*++
+
+Routine Description:
+
+	This routine discards a cached resource.  A pinned resource is discarded
+	along with all of its pins.
+
+Arguments:
+
+	Resource - Supplies the index of the resource to discard.
+
+Return Value:
+
+	The routine returns true if the resource was discarded, else false if the
+	resource is not cached.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	CacheEntryMap::iterator it;
+	size_t                  Size;
+
+	it = m_Entries.find( Resource );
+
+	if (it == m_Entries.end( ))
+		return false;
+
+	Size = it->second.Buffer->GetSize( );
+
+	if (it->second.PinCount != 0)
+	{
+		m_PinnedBytes     -= Size;
+		m_PinnedResources -= 1;
+	}
+	else
+	{
+		m_LruList.erase( it->second.Position );
+	}
+
+	m_Bytes -= Size;
+	m_Entries.erase( it );
+
+	return true;
+}
+
+void
+ResourceCache::Clear(
+	)
+/*++
+
+Routine Description:
+
+	This routine discards all cached resources, including pinned resources.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	m_Entries.clear( );
+	m_LruList.clear( );
+
+	m_Bytes           = 0;
+	m_PinnedBytes     = 0;
+	m_PinnedResources = 0;
+}
+
+void
+ResourceCache::GetStatistics(
+	__out Statistics & Stats
+	) const
+/*++
+
+Routine Description:
+
+	This routine retrieves the cache statistics.
+
+Arguments:
+
+	Stats - Receives the cache statistics.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	Stats.Hits            = m_Hits;
+	Stats.Misses          = m_Misses;
+	Stats.Evictions       = m_Evictions;
+	Stats.Resources       = m_Entries.size( );
+	Stats.PinnedResources = m_PinnedResources;
+	Stats.Bytes           = m_Bytes;
+	Stats.PinnedBytes     = m_PinnedBytes;
+	Stats.MaxBytes        = m_MaxBytes;
+}
+
+void
+ResourceCache::Evict(
+	__in size_t BytesNeeded
+	)
+/*++
+
+Routine Description:
+
+	This routine discards least recently used resources until an additional
+	resource of the given size would fit within the byte budget, or until no
+	unpinned resources remain.
+
+Arguments:
+
+	BytesNeeded - Supplies the size of the resource that is to be inserted, or
+	              zero to simply enforce the byte budget.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	while ((!m_LruList.empty( )) &&
+	       ((m_Bytes > m_MaxBytes) || (BytesNeeded > m_MaxBytes - m_Bytes)))
+	{
+		CacheEntryMap::iterator it;
+
+		it = m_Entries.find( m_LruList.back( ) );
+
+		m_Bytes -= it->second.Buffer->GetSize( );
+
+		m_LruList.pop_back( );
+		m_Entries.erase( it );
+
+		m_Evictions += 1;
+	}
+}
+
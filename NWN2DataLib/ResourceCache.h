@@ -0,0 +1,223 @@
+/*++
+
+Copyright (c) Ken Johnson (Skywing). All rights reserved.
+
+Module Name:
+
+	ResourceCache.h
+
+Abstract:
+
+	This module defines the resource cache, which retains the in-memory
+	contents of recently used resources within a fixed byte budget.
+
+--*/
+
+#ifndef _PROGRAMS_NWN2DATALIB_RESOURCECACHE_H
+#define _PROGRAMS_NWN2DATALIB_RESOURCECACHE_H
+
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+#include "DemandBuffer.h"
+
+//
+// Define the resource cache object.  Resources are identified by an opaque
+// index supplied by the owner (the resource manager uses its resource entry
+// index).  The total size of cached resources is kept within a byte budget by
+// discarding the least recently used resources.
+//
+// A pinned resource is never discarded.  Pins nest; a resource becomes
+// eligible for discard once each Pin has been matched by an Unpin.  Pinned
+// resources count against the byte budget, but are retained even if they
+// alone exceed it.
+//
+// The cache is not thread safe; only the owning thread may access it.
+//
+
+class ResourceCache
+{
+
+public:
+
+	//
+	// Define cache statistics.
+	//
+
+	struct Statistics
+	{
+		ULONG64 Hits;
+		ULONG64 Misses;
+		ULONG64 Evictions;
+		size_t  Resources;
+		size_t  PinnedResources;
+		size_t  Bytes;
+		size_t  PinnedBytes;
+		size_t  MaxBytes;
+	};
+
+	enum
+	{
+		DEFAULT_MAX_BYTES = 32 * 1024 * 1024,
+
+		LAST_RESOURCE_CACHE_CONSTANT
+	};
+
+	//
+	// Constructor.
+	//
+
+	ResourceCache(
+		);
+
+	//
+	// Destructor.
+	//
+
+	~ResourceCache(
+		);
+
+	//
+	// Set the byte budget, discarding least recently used resources if the
+	// cache currently exceeds it.  A budget of zero disables caching of
+	// resources that are not pinned.
+	//
+
+	void
+	SetLimit(
+		__in size_t MaxBytes
+		);
+
+	//
+	// Look up a cached resource, marking it as most recently used.  The
+	// routine returns true if the resource was cached.
+	//
+
+	bool
+	Lookup(
+		__in size_t Resource,
+		__out DemandBufferPtr & Buffer
+		);
+
+	//
+	// Insert a resource, discarding least recently used resources as
+	// necessary to stay within the byte budget.  If Pinned is true, the
+	// resource is also pinned.  An unpinned resource that does not fit within
+	// the budget is not cached.  If the resource is already cached, its existing
+	// contents are retained.  Raises an std::exception on failure.
+	//
+
+	void
+	Insert(
+		__in size_t Resource,
+		__in const DemandBufferPtr & Buffer,
+		__in bool Pinned
+		);
+
+	//
+	// Pin an already-cached resource.  The routine returns false if the
+	// resource is not cached.
+	//
+
+	bool
+	Pin(
+		__in size_t Resource
+		);
+
+	//
+	// Release a pin on a cached resource.  The routine returns false if the
+	// resource is not cached or is not pinned.
+	//
+
+	bool
+	Unpin(
+		__in size_t Resource
+		);
+
+	//
+	// Discard a cached resource, even if it is pinned (for example, because
+	// its contents have changed).  The routine returns false if the resource
+	// is not cached.
+	//
+
+	bool
+	Remove(
+		__in size_t Resource
+		);
+
+	//
+	// Discard all cached resources, including pinned resources.  Statistics
+	// counters are retained.
+	//
+
+	void
+	Clear(
+		);
+
+	//
+	// Retrieve cache statistics.
+	//
+
+	void
+	GetStatistics(
+		__out Statistics & Stats
+		) const;
+
+private:
+
+	typedef std::list< size_t > ResourceList;
+
+	//
+	// Define a cached resource.  Unpinned resources are linked into the LRU
+	// list (most recently used first) at Position; pinned resources are not
+	// linked into the LRU list.
+	//
+
+	struct CacheEntry
+	{
+		DemandBufferPtr        Buffer;
+		ResourceList::iterator Position;
+		size_t                 PinCount;
+	};
+
+	typedef stdext::hash_map< size_t, CacheEntry > CacheEntryMap;
+
+	//
+	// Resource caches are not copyable.
+	//
+
+	ResourceCache(
+		__in const ResourceCache & other
+		);
+
+	ResourceCache &
+	operator=(
+		__in const ResourceCache & other
+		);
+
+	//
+	// Discard least recently used resources until an additional resource of
+	// the given size would fit within the byte budget, or until no unpinned
+	// resources remain.
+	//
+
+	void
+	Evict(
+		__in size_t BytesNeeded
+		);
+
+	CacheEntryMap m_Entries;
+	ResourceList  m_LruList;
+	size_t        m_Bytes;
+	size_t        m_PinnedBytes;
+	size_t        m_PinnedResources;
+	size_t        m_MaxBytes;
+	ULONG64       m_Hits;
+	ULONG64       m_Misses;
+	ULONG64       m_Evictions;
+
+};
+
+#endif
+
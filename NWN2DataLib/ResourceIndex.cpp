@@ -0,0 +1,273 @@
+/*++
+
+Copyright (c) Ken Johnson (Skywing). All rights reserved.
+
+Module Name:
+
+	ResourceIndex.cpp
+
+Abstract:
+
+	This module houses the resource index, which maps resource names and
+	types to resource entry indicies for the resource manager.
+
+--*/
+
+#include "Precomp.h"
+#include "ResourceIndex.h"
+
+ResourceIndex::ResourceIndex(
+	)
+/*++
+
+Routine Description:
+
+	This routine constructs a new, empty ResourceIndex object.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	The newly constructed object.
+
+Environment:
+
+	User mode.
+
+--*/
+: m_SlotMask( 0 )
+{
+}
+
+ResourceIndex::~ResourceIndex(
+	)
+/*++
+
+Routine Description:
+
+	This routine cleans up an already-existing ResourceIndex object.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+}
+
+void
+ResourceIndex::Clear(
+	)
+/*++
+
+Routine Description:
+
+	This routine removes all keys from the index and releases the storage
+	associated with the index.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	SlotVec( ).swap( m_Slots );
+	KeyVec( ).swap( m_Keys );
+
+	m_SlotMask = 0;
+}
+
+void
+ResourceIndex::Reserve(
+	__in size_t Count
+	)
+/*++
+
+Routine Description:
+
+	This routine sizes the index such that at least a given count of keys may
+	be inserted without a further reallocation.  The slot array is kept at no
+	more than half full so that probe sequences remain short.
+
+Arguments:
+
+	Count - Supplies the count of keys to reserve space for.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	size_t SlotCount;
+
+	if (Count >= EMPTY_SLOT)
+		throw std::runtime_error( "Too many resources to index." );
+
+	m_Keys.reserve( Count );
+
+	SlotCount = MIN_SLOTS;
+
+	while (SlotCount < Count * 2)
+		SlotCount *= 2;
+
+	if (SlotCount > m_Slots.size( ))
+		Rehash( SlotCount );
+}
+
+bool
+ResourceIndex::Insert(
+	__in const NWN::ResRef32 & Name,
+	__in ResType Type
+	)
+/*++
+
+Routine Description:
+
+	This routine inserts a key into the index, if the key was not already
+	present.  New keys are assigned the next sequential key index.
+
+Arguments:
+
+	Name - Supplies the resource name.
+
+	Type - Supplies the resource type.
+
+Return Value:
+
+	The routine returns true if the key was inserted, else false if the key
+	was already present.  On failure, an std::exception is raised and the
+	index is unchanged.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	Key     K;
+	ULONG64 Hash;
+	size_t  i;
+
+	MakeKey( Name.RefStr, sizeof( Name.RefStr ), Type, K );
+
+	Hash = HashKey( K );
+
+	if (FindKey( K, Hash ) != INVALID_INDEX)
+		return false;
+
+	//
+	// Grow the slot array if we would exceed our maximum load factor.
+	//
+
+	if ((m_Keys.size( ) + 1) * 2 > m_Slots.size( ))
+	{
+		if (m_Keys.size( ) + 1 >= EMPTY_SLOT)
+			throw std::runtime_error( "Too many resources to index." );
+
+		Rehash( max( m_Slots.size( ) * 2, (size_t) MIN_SLOTS ) );
+	}
+
+	m_Keys.push_back( K );
+
+	//
+	// Claim the first free slot in the probe sequence.  The key was not found
+	// above, so there are no duplicates to consider.
+	//
+
+	for (i = (size_t) Hash & m_SlotMask;
+	     m_Slots[ i ].KeyIndex != EMPTY_SLOT;
+	     i = (i + 1) & m_SlotMask)
+	{
+		NOTHING;
+	}
+
+	m_Slots[ i ].Hash     = Hash;
+	m_Slots[ i ].KeyIndex = (unsigned long) (m_Keys.size( ) - 1);
+
+	return true;
+}
+
+void
+ResourceIndex::Rehash(
+	__in size_t SlotCount
+	)
+/*++
+
+Routine Description:
+
+	This routine rebuilds the slot array with a new slot count.  The
+	precomputed hash values are reused, so no keys need to be rehashed.
+
+Arguments:
+
+	SlotCount - Supplies the new slot count, which must be a power of two and
+	            must exceed the current count of keys.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised and the index is
+	unchanged.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	SlotVec NewSlots;
+	Slot    EmptySlot;
+	size_t  NewMask;
+
+	EmptySlot.Hash     = 0;
+	EmptySlot.KeyIndex = EMPTY_SLOT;
+
+	NewSlots.resize( SlotCount, EmptySlot );
+
+	NewMask = SlotCount - 1;
+
+	for (SlotVec::const_iterator it = m_Slots.begin( );
+	     it != m_Slots.end( );
+	     ++it)
+	{
+		size_t i;
+
+		if (it->KeyIndex == EMPTY_SLOT)
+			continue;
+
+		for (i = (size_t) it->Hash & NewMask;
+		     NewSlots[ i ].KeyIndex != EMPTY_SLOT;
+		     i = (i + 1) & NewMask)
+		{
+			NOTHING;
+		}
+
+		NewSlots[ i ] = *it;
+	}
+
+	m_Slots.swap( NewSlots );
+	m_SlotMask = NewMask;
+}
+
@@ -0,0 +1,327 @@
+/*++
+
+Copyright (c) Ken Johnson (Skywing). All rights reserved.
+
+Module Name:
+
+	ResourceIndex.h
+
+Abstract:
+
+	This module defines the resource index, which maps resource names and
+	types to resource entry indicies for the resource manager.
+
+--*/
+
+#ifndef _PROGRAMS_NWN2DATALIB_RESOURCEINDEX_H
+#define _PROGRAMS_NWN2DATALIB_RESOURCEINDEX_H
+
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+//
+// Define the resource index object.  The resource index is an open-addressed
+// (linear probing) hash table keyed on the raw bytes of a 32-byte resref plus
+// the resource type.  Each key is assigned a sequential index at insertion
+// time, which the resource manager uses as the index into its resource entry
+// array.
+//
+// The table is stored as two contiguous arrays: a slot array holding the
+// precomputed 64-bit hash and key index of each occupied slot, and a key
+// array holding the actual keys in insertion order.  Lookups compare the
+// precomputed hash first and only touch the key array on a hash match, and
+// no lookup allocates memory.
+//
+// Resource names are compared exactly (no case folding is performed).  Bytes
+// after the first null character in a resref are ignored.
+//
+
+class ResourceIndex
+{
+
+public:
+
+	typedef NWN::ResType ResType;
+
+	static const size_t INVALID_INDEX = (size_t) -1;
+
+	//
+	// Constructor.
+	//
+
+	ResourceIndex(
+		);
+
+	//
+	// Destructor.
+	//
+
+	~ResourceIndex(
+		);
+
+	//
+	// Remove all keys from the index.
+	//
+
+	void
+	Clear(
+		);
+
+	//
+	// Size the table to hold at least a given number of keys without further
+	// reallocation.  Raises an std::exception on failure.
+	//
+
+	void
+	Reserve(
+		__in size_t Count
+		);
+
+	//
+	// Insert a key into the index.  If the key was not already present, it is
+	// assigned the next sequential index (i.e. the count of keys present
+	// prior to the insertion) and the routine returns true.  Otherwise, the
+	// index is unchanged and the routine returns false.  Raises an
+	// std::exception on failure.
+	//
+
+	bool
+	Insert(
+		__in const NWN::ResRef32 & Name,
+		__in ResType Type
+		);
+
+	//
+	// Look up a key, returning its index, else INVALID_INDEX if the key is not
+	// present in the index.
+	//
+
+	inline
+	size_t
+	Find(
+		__in const NWN::ResRef32 & Name,
+		__in ResType Type
+		) const
+	{
+		Key     K;
+		ULONG64 Hash;
+
+		MakeKey( Name.RefStr, sizeof( Name.RefStr ), Type, K );
+
+		Hash = HashKey( K );
+
+		return FindKey( K, Hash );
+	}
+
+	inline
+	size_t
+	Find(
+		__in_bcount( NameLength ) const char * Name,
+		__in size_t NameLength,
+		__in ResType Type
+		) const
+	{
+		Key     K;
+		ULONG64 Hash;
+
+		//
+		// Names longer than a resref can never have been indexed.
+		//
+
+		if (NameLength > sizeof( K.Name.RefStr ))
+			return INVALID_INDEX;
+
+		MakeKey( Name, NameLength, Type, K );
+
+		Hash = HashKey( K );
+
+		return FindKey( K, Hash );
+	}
+
+	inline
+	size_t
+	Find(
+		__in const std::string & Name,
+		__in ResType Type
+		) const
+	{
+		return Find( Name.data( ), Name.size( ), Type );
+	}
+
+	//
+	// Return the key that was assigned a given index.  The index must be less
+	// than the count of keys in the index.
+	//
+
+	inline
+	void
+	GetKey(
+		__in size_t Index,
+		__out NWN::ResRef32 & Name,
+		__out ResType & Type
+		) const
+	{
+		Name = m_Keys[ Index ].Name;
+		Type = m_Keys[ Index ].Type;
+	}
+
+	//
+	// Return the count of keys in the index.
+	//
+
+	inline
+	size_t
+	GetCount(
+		) const
+	{
+		return m_Keys.size( );
+	}
+
+private:
+
+	//
+	// Define the key format.  Unused name bytes are always zero so that keys
+	// may be compared and hashed as raw memory.
+	//
+
+	struct Key
+	{
+		NWN::ResRef32 Name;
+		ResType       Type;
+	};
+
+	typedef std::vector< Key > KeyVec;
+
+	//
+	// Define the slot format.  An empty slot has a key index of EMPTY_SLOT.
+	//
+
+	struct Slot
+	{
+		ULONG64       Hash;
+		unsigned long KeyIndex;
+	};
+
+	typedef std::vector< Slot > SlotVec;
+
+	enum
+	{
+		EMPTY_SLOT    = 0xFFFFFFFF,
+		MIN_SLOTS     = 64,
+
+		LAST_INDEX_CONSTANT
+	};
+
+	//
+	// Build a canonical key from a resource name and type.
+	//
+
+	inline
+	static
+	void
+	MakeKey(
+		__in_bcount( NameLength ) const char * Name,
+		__in size_t NameLength,
+		__in ResType Type,
+		__out Key & K
+		)
+	{
+		const char * p;
+
+		ZeroMemory( &K, sizeof( K ) );
+
+		p = (const char *) memchr( Name, '\0', NameLength );
+
+		if (p != NULL)
+			NameLength = p - Name;
+
+		memcpy( K.Name.RefStr, Name, NameLength );
+
+		K.Type = Type;
+	}
+
+	//
+	// Compute the 64-bit hash of a canonical key.  The name is consumed as
+	// four 64-bit words, each mixed in with a multiply-xorshift step.
+	//
+
+	inline
+	static
+	ULONG64
+	HashKey(
+		__in const Key & K
+		)
+	{
+		ULONG64 Words[ 4 ];
+		ULONG64 Hash;
+
+		C_ASSERT( sizeof( Words ) == sizeof( K.Name ) );
+
+		memcpy( Words, K.Name.RefStr, sizeof( Words ) );
+
+		Hash = 0xCBF29CE484222325ULL ^ (ULONG64) K.Type;
+
+		for (size_t i = 0; i < 4; i += 1)
+		{
+			Hash ^= Words[ i ];
+			Hash *= 0x9E3779B97F4A7C15ULL;
+			Hash ^= Hash >> 29;
+		}
+
+		return Hash;
+	}
+
+	//
+	// Locate a canonical key in the slot array.
+	//
+
+	inline
+	size_t
+	FindKey(
+		__in const Key & K,
+		__in ULONG64 Hash
+		) const
+	{
+		size_t i;
+
+		if (m_Slots.empty( ))
+			return INVALID_INDEX;
+
+		for (i = (size_t) Hash & m_SlotMask;
+		     m_Slots[ i ].KeyIndex != EMPTY_SLOT;
+		     i = (i + 1) & m_SlotMask)
+		{
+			const Slot & S = m_Slots[ i ];
+
+			if (S.Hash != Hash)
+				continue;
+
+			if (!memcmp( &m_Keys[ S.KeyIndex ], &K, sizeof( K ) ))
+				return S.KeyIndex;
+		}
+
+		return INVALID_INDEX;
+	}
+
+	//
+	// Rebuild the slot array with a new (power of two) slot count.
+	//
+
+	void
+	Rehash(
+		__in size_t SlotCount
+		);
+
+	//
+	// Define the slot array, key array, and slot index mask.
+	//
+
+	SlotVec m_Slots;
+	KeyVec  m_Keys;
+	size_t  m_SlotMask;
+
+};
+
+#endif
+
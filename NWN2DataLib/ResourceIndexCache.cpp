@@ -0,0 +1,805 @@
+/*++
+
+Copyright (c) Ken Johnson (Skywing). All rights reserved.
+
+Module Name:
+
+	ResourceIndexCache.cpp
+
+Abstract:
+
+	This module houses the resource index cache, which persists the directory
+	listings of resource providers to disk so that unchanged providers need not
+	be rescanned each time resources are loaded.
+
+--*/
+
+#include "Precomp.h"
+#include "ResourceIndexCache.h"
+
+ResourceIndexCache::ResourceIndexCache(
+	)
+/*++
+
+Routine Description:
+
+	This routine constructs a new, empty ResourceIndexCache object.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	The newly constructed object.
+
+Environment:
+
+	User mode.
+
+--*/
+: m_MappedView( NULL ),
+  m_MappedSize( 0 ),
+  m_Hits( 0 )
+{
+}
+
+ResourceIndexCache::~ResourceIndexCache(
+	)
+/*++
+
+Routine Description:
+
+	This routine cleans up an already-existing ResourceIndexCache object.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	Unload( );
+}
+
+bool
+ResourceIndexCache::Load(
+	__in const std::string & CacheFileName
+	)
+/*++
+
+Routine Description:
+
+	This routine maps the newest valid generation of a cache file into memory.
+	Any previously loaded cache file and recorded providers are discarded.
+
+	Older generations are tried in turn should the newest generation be
+	unusable, e.g. because another instance has already deleted it.
+
+Arguments:
+
+	CacheFileName - Supplies the base path of the cache file.
+
+Return Value:
+
+	The routine returns true if a cache file was loaded, else false if no
+	cache file existed or none was valid.  The cache is left empty on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	GenerationVec Generations;
+
+	Unload( );
+
+	EnumerateGenerations( CacheFileName, Generations );
+
+	for (GenerationVec::const_iterator it = Generations.begin( );
+	     it != Generations.end( );
+	     ++it)
+	{
+		if (LoadGeneration( GetGenerationFileName( CacheFileName, *it ) ))
+			return true;
+	}
+
+	return false;
+}
+
+bool
+ResourceIndexCache::LoadGeneration(
+	__in const std::string & GenerationFileName
+	)
+/*++
+
+Routine Description:
+
+	This routine maps a single cache file generation into memory and
+	validates its contents.  The cache must be empty on entry.
+
+Arguments:
+
+	GenerationFileName - Supplies the path to the cache file generation.
+
+Return Value:
+
+	The routine returns true if the cache file was loaded, else false if the
+	cache file did not exist or was not valid.  The cache is left empty on
+	failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	HANDLE                File;
+	HANDLE                Section;
+	LARGE_INTEGER         Size;
+	const CacheHeader   * Header;
+	const CacheProvider * Providers;
+
+	File = CreateFileA(
+		GenerationFileName.c_str( ),
+		GENERIC_READ,
+		FILE_SHARE_READ | FILE_SHARE_DELETE,
+		NULL,
+		OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL,
+		NULL);
+
+	if (File == INVALID_HANDLE_VALUE)
+		return false;
+
+	if ((!GetFileSizeEx( File, &Size )) ||
+	    ((ULONG64) Size.QuadPart < sizeof( CacheHeader )) ||
+	    ((ULONG64) Size.QuadPart > (SIZE_T) -1))
+	{
+		CloseHandle( File );
+		return false;
+	}
+
+	Section = CreateFileMapping( File, NULL, PAGE_READONLY, 0, 0, NULL );
+
+	CloseHandle( File );
+
+	if (Section == NULL)
+		return false;
+
+	m_MappedView = (const unsigned char *) MapViewOfFile(
+		Section,
+		FILE_MAP_READ,
+		0,
+		0,
+		0);
+
+	CloseHandle( Section );
+
+	if (m_MappedView == NULL)
+		return false;
+
+	m_MappedSize = (ULONG64) Size.QuadPart;
+
+	//
+	// Validate the header, then each provider descriptor, so that lookups
+	// need not perform any further bounds checking.
+	//
+
+	Header = (const CacheHeader *) m_MappedView;
+
+	if ((Header->Signature != CACHE_SIGNATURE) ||
+	    (Header->Version != CACHE_VERSION) ||
+	    (Header->EntrySize != sizeof( Entry )) ||
+	    (Header->FileSize != m_MappedSize) ||
+	    (!IsValidSpan(
+	        sizeof( CacheHeader ),
+	        (ULONG64) Header->ProviderCount * sizeof( CacheProvider ))))
+	{
+		Unload( );
+		return false;
+	}
+
+	Providers = (const CacheProvider *) (Header + 1);
+
+	for (unsigned long i = 0; i < Header->ProviderCount; i += 1)
+	{
+		if ((!IsValidSpan(
+		        Providers[ i ].PathOffset,
+		        Providers[ i ].PathLength )) ||
+		    (!IsValidSpan(
+		        Providers[ i ].EntryOffset,
+		        (ULONG64) Providers[ i ].EntryCount * sizeof( Entry ) )) ||
+		    (Providers[ i ].EntryOffset % __alignof( Entry )))
+		{
+			Unload( );
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void
+ResourceIndexCache::Unload(
+	)
+/*++
+
+Routine Description:
+
+	This routine releases the mapped cache file and discards all recorded
+	providers.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	m_Records.clear( );
+	m_Hits = 0;
+
+	if (m_MappedView != NULL)
+	{
+		UnmapViewOfFile( m_MappedView );
+
+		m_MappedView = NULL;
+		m_MappedSize = 0;
+	}
+}
+
+const ResourceIndexCache::Entry *
+ResourceIndexCache::LookupProvider(
+	__in const std::string & ProviderPath,
+	__in ULONG64 FileSize,
+	__in ULONG64 LastWriteTime,
+	__out size_t & EntryCount
+	) const
+/*++
+
+Routine Description:
+
+	This routine looks up the cached directory entries for a provider.
+
+Arguments:
+
+	ProviderPath - Supplies the path to the provider file.  Paths are compared
+	               without regard to case.
+
+	FileSize - Supplies the current size of the provider file.
+
+	LastWriteTime - Supplies the current last write time of the provider file.
+
+	EntryCount - Receives the count of cached directory entries.
+
+Return Value:
+
+	The routine returns a pointer to the cached directory entries if the
+	provider was cached and is unchanged, else NULL.  The entries remain valid
+	until the cache is unloaded.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	const CacheHeader   * Header;
+	const CacheProvider * Providers;
+
+	EntryCount = 0;
+
+	if (m_MappedView == NULL)
+		return NULL;
+
+	Header    = (const CacheHeader *) m_MappedView;
+	Providers = (const CacheProvider *) (Header + 1);
+
+	for (unsigned long i = 0; i < Header->ProviderCount; i += 1)
+	{
+		const CacheProvider & Provider = Providers[ i ];
+
+		if (Provider.PathLength != ProviderPath.size( ))
+			continue;
+
+		if (_strnicmp(
+			(const char *) m_MappedView + Provider.PathOffset,
+			ProviderPath.c_str( ),
+			Provider.PathLength))
+		{
+			continue;
+		}
+
+		//
+		// The provider is known; if it has been modified since it was cached
+		// then the cached entries are of no use.
+		//
+
+		if ((Provider.FileSize != FileSize) ||
+		    (Provider.LastWriteTime != LastWriteTime))
+		{
+			return NULL;
+		}
+
+		EntryCount = Provider.EntryCount;
+
+		return (const Entry *) (m_MappedView + Provider.EntryOffset);
+	}
+
+	return NULL;
+}
+
+void
+ResourceIndexCache::RecordProvider(
+	__in const std::string & ProviderPath,
+	__in ULONG64 FileSize,
+	__in ULONG64 LastWriteTime,
+	__in_ecount( EntryCount ) const Entry * Entries,
+	__in size_t EntryCount
+	)
+/*++
+
+Routine Description:
+
+	This routine records the directory entries of a provider for inclusion in
+	the next cache file written by Save.
+
+Arguments:
+
+	ProviderPath - Supplies the path to the provider file.
+
+	FileSize - Supplies the current size of the provider file.
+
+	LastWriteTime - Supplies the current last write time of the provider file.
+
+	Entries - Supplies the directory entries of the provider.  If the entries
+	          were returned by LookupProvider, they are referenced in place,
+	          otherwise they are copied.
+
+	EntryCount - Supplies the count of directory entries.
+
+Return Value:
+
+	None.  Raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	ProviderRecord Record;
+	bool           Mapped;
+
+	Mapped = (m_MappedView != NULL) &&
+	         ((const unsigned char *) Entries >= m_MappedView) &&
+	         ((const unsigned char *) Entries < m_MappedView + m_MappedSize);
+
+	Record.Path          = ProviderPath;
+	Record.FileSize      = FileSize;
+	Record.LastWriteTime = LastWriteTime;
+	Record.EntryCount    = EntryCount;
+
+	if (Mapped)
+	{
+		Record.MappedEntries = Entries;
+	}
+	else
+	{
+		Record.MappedEntries = NULL;
+
+		if (EntryCount != 0)
+			Record.Entries.assign( Entries, Entries + EntryCount );
+	}
+
+	m_Records.push_back( Record );
+
+	if (Mapped)
+		m_Hits += 1;
+}
+
+bool
+ResourceIndexCache::IsModified(
+	) const
+/*++
+
+Routine Description:
+
+	This routine determines whether the recorded provider set differs from the
+	loaded cache file.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	The routine returns true if the cache file should be rewritten.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	unsigned long ProviderCount;
+
+	//
+	// Any provider that was not served from the cache was either new or
+	// changed.  Otherwise, the recorded set matches the cache file only if
+	// every cached provider was recorded.
+	//
+
+	if (m_Hits != m_Records.size( ))
+		return true;
+
+	if (m_MappedView != NULL)
+		ProviderCount = ((const CacheHeader *) m_MappedView)->ProviderCount;
+	else
+		ProviderCount = 0;
+
+	return (m_Hits != ProviderCount);
+}
+
+void
+ResourceIndexCache::Save(
+	__in const std::string & CacheFileName
+	)
+/*++
+
+Routine Description:
+
+	This routine writes the recorded providers to a new generation of a cache
+	file.  The cache file is written to a temporary file first and then
+	renamed to the next generation's name, so that no file is ever replaced
+	(a file that another instance has mapped cannot be replaced).  The older
+	generations are then deleted where possible; any that are still in use
+	are left for a later save to clean up.  The mapped cache file and the
+	recorded providers are released.
+
+Arguments:
+
+	CacheFileName - Supplies the base path of the cache file.
+
+Return Value:
+
+	None.  Raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	std::vector< unsigned char > Image;
+	CacheHeader                  Header;
+	ULONG64                      Offset;
+	std::string                  TempFileName;
+	HANDLE                       File;
+	DWORD                        Written;
+	CHAR                         TempSuffix[ 32 ];
+	bool                         Succeeded;
+	GenerationVec                Generations;
+	unsigned long                Generation;
+
+	if (m_Records.size( ) > ULONG_MAX)
+		throw std::runtime_error( "Too many providers to cache." );
+
+	//
+	// Lay out the header and provider descriptors, followed by the entry
+	// tables (which are kept aligned) and finally the provider paths.
+	//
+
+	Offset = sizeof( CacheHeader ) + m_Records.size( ) * sizeof( CacheProvider );
+
+	for (ProviderRecordVec::const_iterator it = m_Records.begin( );
+	     it != m_Records.end( );
+	     ++it)
+	{
+		if ((it->EntryCount > ULONG_MAX) || (it->Path.size( ) > ULONG_MAX))
+			throw std::runtime_error( "Provider too large to cache." );
+
+		Offset += it->EntryCount * sizeof( Entry );
+		Offset += it->Path.size( );
+	}
+
+	if (Offset > ULONG_MAX)
+		throw std::runtime_error( "Resource index cache too large." );
+
+	Image.resize( (size_t) Offset );
+
+	Header.Signature     = CACHE_SIGNATURE;
+	Header.Version       = CACHE_VERSION;
+	Header.EntrySize     = sizeof( Entry );
+	Header.ProviderCount = (unsigned long) m_Records.size( );
+	Header.FileSize      = Offset;
+
+	memcpy( &Image[ 0 ], &Header, sizeof( Header ) );
+
+	Offset = sizeof( CacheHeader ) + m_Records.size( ) * sizeof( CacheProvider );
+
+	for (size_t i = 0; i < m_Records.size( ); i += 1)
+	{
+		const ProviderRecord & Record = m_Records[ i ];
+		CacheProvider          Provider;
+		const Entry          * Entries;
+
+		if (Record.MappedEntries != NULL)
+			Entries = Record.MappedEntries;
+		else if (!Record.Entries.empty( ))
+			Entries = &Record.Entries[ 0 ];
+		else
+			Entries = NULL;
+
+		Provider.FileSize      = Record.FileSize;
+		Provider.LastWriteTime = Record.LastWriteTime;
+		Provider.EntryOffset   = Offset;
+		Provider.EntryCount    = (unsigned long) Record.EntryCount;
+
+		if (Record.EntryCount != 0)
+		{
+			memcpy(
+				&Image[ (size_t) Offset ],
+				Entries,
+				Record.EntryCount * sizeof( Entry ) );
+
+			Offset += Record.EntryCount * sizeof( Entry );
+		}
+
+		memcpy(
+			&Image[ sizeof( CacheHeader ) + i * sizeof( CacheProvider ) ],
+			&Provider,
+			sizeof( Provider ) );
+	}
+
+	for (size_t i = 0; i < m_Records.size( ); i += 1)
+	{
+		const ProviderRecord & Record = m_Records[ i ];
+		CacheProvider        * Provider;
+
+		Provider = (CacheProvider *) &Image[ sizeof( CacheHeader ) + i * sizeof( CacheProvider ) ];
+
+		Provider->PathOffset = Offset;
+		Provider->PathLength = (unsigned long) Record.Path.size( );
+
+		if (!Record.Path.empty( ))
+		{
+			memcpy(
+				&Image[ (size_t) Offset ],
+				Record.Path.data( ),
+				Record.Path.size( ) );
+
+			Offset += Record.Path.size( );
+		}
+	}
+
+	//
+	// The image is complete and no longer references the mapped view, so
+	// release it, and then write the new cache file out.
+	//
+
+	Unload( );
+
+	StringCbPrintfA(
+		TempSuffix,
+		sizeof( TempSuffix ),
+		".%lu.tmp",
+		GetCurrentProcessId( ) );
+
+	TempFileName  = CacheFileName;
+	TempFileName += TempSuffix;
+
+	File = CreateFileA(
+		TempFileName.c_str( ),
+		GENERIC_WRITE,
+		0,
+		NULL,
+		CREATE_ALWAYS,
+		FILE_ATTRIBUTE_NORMAL,
+		NULL);
+
+	if (File == INVALID_HANDLE_VALUE)
+		throw std::runtime_error( "Failed to create resource index cache file." );
+
+	Succeeded = (WriteFile(
+		File,
+		&Image[ 0 ],
+		(DWORD) Image.size( ),
+		&Written,
+		NULL) != FALSE) && (Written == Image.size( ));
+
+	CloseHandle( File );
+
+	//
+	// Publish the new generation.  Should another instance publish the same
+	// generation concurrently, move on to the following one.
+	//
+
+	EnumerateGenerations( CacheFileName, Generations );
+
+	Generation = Generations.empty( ) ? 1 : Generations.front( ) + 1;
+
+	if (Succeeded)
+	{
+		for (unsigned long i = 0; i < MAX_PUBLISH_ATTEMPTS; i += 1)
+		{
+			Succeeded = (MoveFileA(
+				TempFileName.c_str( ),
+				GetGenerationFileName( CacheFileName, Generation ).c_str( ) ) != FALSE);
+
+			if ((Succeeded) || (GetLastError( ) != ERROR_ALREADY_EXISTS))
+				break;
+
+			Generation += 1;
+		}
+	}
+
+	if (!Succeeded)
+	{
+		DeleteFileA( TempFileName.c_str( ) );
+
+		throw std::runtime_error( "Failed to write resource index cache file." );
+	}
+
+	//
+	// Delete the superseded generations.  A generation that another instance
+	// still has mapped may not be deletable yet, which is harmless, as Load
+	// always prefers the newest generation.
+	//
+
+	for (GenerationVec::const_iterator it = Generations.begin( );
+	     it != Generations.end( );
+	     ++it)
+	{
+		DeleteFileA( GetGenerationFileName( CacheFileName, *it ).c_str( ) );
+	}
+}
+
+std::string
+ResourceIndexCache::GetGenerationFileName(
+	__in const std::string & CacheFileName,
+	__in unsigned long Generation
+	)
+/*++
+
+Routine Description:
+
+	This routine forms the file name of a cache file generation, which is the
+	base cache file name followed by the generation number in hexadecimal.
+
+Arguments:
+
+	CacheFileName - Supplies the base path of the cache file.
+
+	Generation - Supplies the generation number.
+
+Return Value:
+
+	The routine returns the path to the cache file generation.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	CHAR        Suffix[ 16 ];
+	std::string FileName;
+
+	StringCbPrintfA(
+		Suffix,
+		sizeof( Suffix ),
+		".%08lx",
+		Generation);
+
+	FileName  = CacheFileName;
+	FileName += Suffix;
+
+	return FileName;
+}
+
+void
+ResourceIndexCache::EnumerateGenerations(
+	__in const std::string & CacheFileName,
+	__out GenerationVec & Generations
+	)
+/*++
+
+Routine Description:
+
+	This routine enumerates the generations of a cache file that are present
+	on disk.  Files that merely resemble a generation name (such as temporary
+	files) are ignored.
+
+Arguments:
+
+	CacheFileName - Supplies the base path of the cache file.
+
+	Generations - Receives the generation numbers, newest first.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	HANDLE           Find;
+	WIN32_FIND_DATAA FindData;
+	std::string      Mask;
+	std::string      BaseName;
+	size_t           Pos;
+
+	Generations.clear( );
+
+	Pos = CacheFileName.find_last_of( "\\/" );
+
+	if (Pos != std::string::npos)
+		BaseName = CacheFileName.substr( Pos + 1 );
+	else
+		BaseName = CacheFileName;
+
+	Mask  = CacheFileName;
+	Mask += ".*";
+
+	Find = FindFirstFileA( Mask.c_str( ), &FindData );
+
+	if (Find == INVALID_HANDLE_VALUE)
+		return;
+
+	try
+	{
+		do
+		{
+			const char * Suffix;
+			size_t       Length;
+
+			if (FindData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+				continue;
+
+			Length = strlen( FindData.cFileName );
+
+			if ((Length != BaseName.size( ) + 9) ||
+			    (_strnicmp( FindData.cFileName, BaseName.c_str( ), BaseName.size( ) )) ||
+			    (FindData.cFileName[ BaseName.size( ) ] != '.'))
+				continue;
+
+			Suffix = &FindData.cFileName[ BaseName.size( ) + 1 ];
+
+			if (strspn( Suffix, "0123456789abcdefABCDEF" ) != 8)
+				continue;
+
+			Generations.push_back( strtoul( Suffix, NULL, 16 ) );
+		} while (FindNextFileA( Find, &FindData )) ;
+
+		FindClose( Find );
+	}
+	catch (...)
+	{
+		FindClose( Find );
+		throw;
+	}
+
+	std::sort( Generations.begin( ), Generations.end( ) );
+	std::reverse( Generations.begin( ), Generations.end( ) );
+}
+
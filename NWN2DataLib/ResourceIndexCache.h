@@ -0,0 +1,292 @@
+/*++
+
+Copyright (c) Ken Johnson (Skywing). All rights reserved.
+
+Module Name:
+
+	ResourceIndexCache.h
+
+Abstract:
+
+	This module defines the resource index cache, which persists the directory
+	listings of resource providers to disk so that unchanged providers need not
+	be rescanned each time resources are loaded.
+
+--*/
+
+#ifndef _PROGRAMS_NWN2DATALIB_RESOURCEINDEXCACHE_H
+#define _PROGRAMS_NWN2DATALIB_RESOURCEINDEXCACHE_H
+
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+//
+// Define the resource index cache object.  The cache file holds, for each
+// resource provider file, the provider's path, size and last write time, and
+// the provider's directory entries (resource name, type and a provider
+// specific locator).
+//
+// On load, the cache file is mapped read-only and validated.  Each provider
+// that is looked up with a matching path, size and last write time is a hit,
+// and its directory entries are returned directly out of the mapped view.  The
+// caller then records the provider (whether it was a hit or freshly scanned),
+// and if any provider changed, the cache file is rewritten from the recorded
+// set.  Providers that were not recorded are dropped from the rewritten cache.
+//
+// The cache file is never rewritten in place.  Instead, each save publishes a
+// new generation alongside the old ones (named after the base cache file name
+// with the generation number appended), and load maps the newest generation.
+// This way, a generation that another instance has mapped never needs to be
+// replaced, and concurrent readers always observe a complete cache file.  A
+// failure to load the cache file is never fatal; the cache is simply treated
+// as empty.
+//
+
+class ResourceIndexCache
+{
+
+public:
+
+	typedef NWN::ResType ResType;
+
+	//
+	// Define the format of a cached directory entry.  The locator is private
+	// to the provider type that generated it.
+	//
+
+	struct Entry
+	{
+		NWN::ResRef32 Name;
+		ULONG64       Locator;
+		unsigned long Type;
+		unsigned long Reserved;
+	};
+
+	typedef std::vector< Entry > EntryVec;
+
+	//
+	// Constructor.
+	//
+
+	ResourceIndexCache(
+		);
+
+	//
+	// Destructor.
+	//
+
+	~ResourceIndexCache(
+		);
+
+	//
+	// Map and validate the newest generation of a cache file.  Any
+	// previously loaded cache file and recorded providers are discarded.  The
+	// routine returns false if no generation of the cache file existed or was
+	// valid, in which case the cache is left empty.
+	//
+
+	bool
+	Load(
+		__in const std::string & CacheFileName
+		);
+
+	//
+	// Release the mapped cache file and all recorded providers.
+	//
+
+	void
+	Unload(
+		);
+
+	//
+	// Look up the cached directory entries for a provider.  The routine
+	// returns NULL if the provider is not present in the cache, or if its size
+	// or last write time differ from the cached values.  The returned entries
+	// remain valid until the cache is unloaded.
+	//
+
+	const Entry *
+	LookupProvider(
+		__in const std::string & ProviderPath,
+		__in ULONG64 FileSize,
+		__in ULONG64 LastWriteTime,
+		__out size_t & EntryCount
+		) const;
+
+	//
+	// Record the directory entries of a provider for inclusion in the next
+	// cache file written by Save.  Entries that were returned by
+	// LookupProvider may be supplied directly.  Raises an std::exception on
+	// failure.
+	//
+
+	void
+	RecordProvider(
+		__in const std::string & ProviderPath,
+		__in ULONG64 FileSize,
+		__in ULONG64 LastWriteTime,
+		__in_ecount( EntryCount ) const Entry * Entries,
+		__in size_t EntryCount
+		);
+
+	//
+	// Return whether the recorded provider set differs from the loaded cache
+	// file, i.e. whether the cache file should be rewritten.
+	//
+
+	bool
+	IsModified(
+		) const;
+
+	//
+	// Write the recorded providers to a new generation of a cache file, and
+	// delete the superseded generations that are not in use.  The mapped
+	// cache file, if any, is released first.  Raises an std::exception on
+	// failure.
+	//
+
+	void
+	Save(
+		__in const std::string & CacheFileName
+		);
+
+private:
+
+	//
+	// Define the on-disk format.  All offsets are relative to the start of
+	// the file.
+	//
+
+	enum
+	{
+		CACHE_SIGNATURE = 'CIRN',
+		CACHE_VERSION   = 2,
+
+		//
+		// Define the number of generation numbers to try when publishing a
+		// new generation races with other instances.
+		//
+
+		MAX_PUBLISH_ATTEMPTS = 16,
+
+		LAST_CACHE_CONSTANT
+	};
+
+	struct CacheHeader
+	{
+		unsigned long Signature;
+		unsigned long Version;
+		unsigned long EntrySize;
+		unsigned long ProviderCount;
+		ULONG64       FileSize;
+	};
+
+	struct CacheProvider
+	{
+		ULONG64       FileSize;
+		ULONG64       LastWriteTime;
+		ULONG64       PathOffset;
+		ULONG64       EntryOffset;
+		unsigned long PathLength;
+		unsigned long EntryCount;
+	};
+
+	//
+	// Define a recorded provider, pending the next Save.  Entries are copied
+	// only if they do not already reside in the mapped cache file.
+	//
+
+	struct ProviderRecord
+	{
+		std::string   Path;
+		ULONG64       FileSize;
+		ULONG64       LastWriteTime;
+		const Entry * MappedEntries;
+		size_t        EntryCount;
+		EntryVec      Entries;
+	};
+
+	typedef std::vector< ProviderRecord > ProviderRecordVec;
+
+	typedef std::vector< unsigned long > GenerationVec;
+
+	//
+	// Resource index caches are not copyable.
+	//
+
+	ResourceIndexCache(
+		__in const ResourceIndexCache & other
+		);
+
+	ResourceIndexCache &
+	operator=(
+		__in const ResourceIndexCache & other
+		);
+
+	//
+	// Map and validate a single cache file generation.  The cache must be
+	// empty on entry, and is left empty on failure.
+	//
+
+	bool
+	LoadGeneration(
+		__in const std::string & GenerationFileName
+		);
+
+	//
+	// Return the file name of a cache file generation.
+	//
+
+	static
+	std::string
+	GetGenerationFileName(
+		__in const std::string & CacheFileName,
+		__in unsigned long Generation
+		);
+
+	//
+	// Enumerate the generations of a cache file present on disk, newest
+	// first.
+	//
+
+	static
+	void
+	EnumerateGenerations(
+		__in const std::string & CacheFileName,
+		__out GenerationVec & Generations
+		);
+
+	//
+	// Return whether a span lies entirely within the mapped cache file.
+	//
+
+	inline
+	bool
+	IsValidSpan(
+		__in ULONG64 Offset,
+		__in ULONG64 Length
+		) const
+	{
+		return (Offset <= m_MappedSize) && (Length <= m_MappedSize - Offset);
+	}
+
+	//
+	// Define the mapped cache file view, if any.
+	//
+
+	const unsigned char * m_MappedView;
+	ULONG64               m_MappedSize;
+
+	//
+	// Define the recorded providers, and the count of recorded providers that
+	// were unchanged from the mapped cache file.
+	//
+
+	ProviderRecordVec     m_Records;
+	size_t                m_Hits;
+
+};
+
+#endif
+
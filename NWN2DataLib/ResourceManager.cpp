@@ -17,6 +17,7 @@ Abstract:
 #include "Precomp.h"
 #include "ResourceManager.h"
 #include "TextOut.h"
+#include "ParallelWork.h"
 
 
 
@@ -85,11 +86,16 @@ Environment:
 : m_TextWriter( TextWriter ),
   m_NextFileHandle( 0 ),
   m_Gr2Accessor( NULL ),
-  m_ResManFlags( 0 )
+  m_ResManFlags( 0 ),
+  m_Frozen2DAs( NULL ),
+  m_Frozen2DALookups( 0 ),
+  m_NextContentSlot( 0 )
 {
 	CHAR TempPath[ MAX_PATH + 1 ];
 	CHAR TempUnique[ 32 ];
 
+	m_Prefetcher.Initialize( PrefetchLoadRoutine, this );
+
 	if (CreateFlags & ResManCreateFlagNoInstanceSetup)
 		return;
 
@@ -142,6 +148,8 @@ Environment:
 {
 	CleanDemandLoadedFiles( );
 
+	Free2DAGenerations( false );
+
 	RemoveDirectoryA( m_TempPath.c_str( ) );
 
 	if (m_InstanceEvent != NULL)
@@ -346,6 +354,28 @@ Environment:
 	m_TempPath += m_TempUnique;
 	m_TempPath += "\\";
 
+	//
+	// The resource index cache and binary 2DA cache are shared between
+	// instances, so they live in the temp directory itself and not our
+	// instance subdirectory.
+	//
+
+	if (!TempDirectory.empty( ))
+	{
+		m_IndexCacheFile  = TempDirectory;
+		m_IndexCacheFile += "NWN2ResIndex.dat";
+
+		m_TwoDACachePath  = TempDirectory;
+		m_TwoDACachePath += "NWN2TwoDACache\\";
+
+		CreateDirectoryA( m_TwoDACachePath.c_str( ), NULL );
+	}
+	else
+	{
+		m_IndexCacheFile.clear( );
+		m_TwoDACachePath.clear( );
+	}
+
 	//
 	// A previous instance might have had the same path as us, so delete it.
 	//
@@ -416,7 +446,7 @@ Environment:
 	HANDLE                           ResFile;
 	char                             Msg[ 512 ];
 	ResRefNameMap::iterator          nit;
-	ResourceEntryMap::const_iterator eit;
+	size_t                           EntryIndex;
 	std::string                      LookupName;
 
 	LookupName  = _itoa( (int) Type, Msg, 10 );
@@ -458,13 +488,16 @@ Environment:
 	// Look up the file in our index mapping.
 	//
 
-	if ((eit = m_NameIdMap.find( LookupName )) != m_NameIdMap.end( ))
+	EntryIndex = m_ResourceIndex.Find( ResRef, Type );
+
+	if ((EntryIndex != ResourceIndex::INVALID_INDEX) &&
+	    (m_ResourceEntries[ EntryIndex ].Accessor != NULL))
 	{
 		DemandResourceRef     Ref;
 		FileHandle            Handle;
 		const ResourceEntry * Entry;
 
-		Entry = &m_ResourceEntries[ eit->second ];
+		Entry = &m_ResourceEntries[ EntryIndex ];
 
 		//
 		// Pull the file and return it to the caller.
@@ -517,10 +550,13 @@ Environment:
 			LONG   DistHigh;
 
 			//
-			// Open a handle to the file.
+			// Open a handle to the file.  Cached or prefetched contents are
+			// served from memory; otherwise the file is streamed from its
+			// provider, so that a large resource is never staged in memory
+			// in its entirety.
 			//
 
-			Handle = Entry->Accessor->OpenFileByIndex( Entry->FileIndex );
+			Handle = OpenFileByIndex( (FileId) EntryIndex );
 
 			if (Handle == INVALID_FILE)
 			{
@@ -569,7 +605,7 @@ Environment:
 			// Copy contents over.
 			//
 
-			FileSize = Entry->Accessor->GetEncapsulatedFileSize( Handle );
+			FileSize = GetEncapsulatedFileSize( Handle );
 
 #ifdef _WIN64
 			DistHigh = (LONG) (FileSize >> 32);
@@ -603,7 +639,7 @@ Environment:
 				size_t        Read;
 				DWORD         Written;
 
-				if (!Entry->Accessor->ReadEncapsulatedFile(
+				if (!ReadEncapsulatedFile(
 					Handle,
 					Offset,
 					min( BytesLeft, CHUNK_SIZE ),
@@ -614,6 +650,9 @@ Environment:
 						"ReadEncapsulatedFile failed" );
 				}
 
+				if (Read == 0)
+					throw std::runtime_error( "Read zero bytes" );
+
 				if (!WriteFile(
 					ResFile,
 					Buffer,
@@ -641,7 +680,7 @@ Environment:
 		catch (std::exception &e)
 		{
 			if (Handle != INVALID_FILE)
-				Entry->Accessor->CloseFile( Handle );
+				CloseFile( Handle );
 
 			if (ResFile != INVALID_HANDLE_VALUE)
 				CloseHandle( ResFile );
@@ -660,7 +699,7 @@ Environment:
 		catch (...)
 		{
 			if (Handle != INVALID_FILE)
-				Entry->Accessor->CloseFile( Handle );
+				CloseFile( Handle );
 
 			if (ResFile != INVALID_HANDLE_VALUE)
 				CloseHandle( ResFile );
@@ -676,7 +715,7 @@ Environment:
 		//
 
 		CloseHandle( ResFile );
-		Entry->Accessor->CloseFile( Handle );
+		CloseFile( Handle );
 
 		//
 		// Hand the temporary path out to the caller.  It will persist
@@ -990,6 +1029,110 @@ Environment:
 	throw std::runtime_error( Msg );
 }
 
+DemandBufferPtr
+ResourceManager::DemandView(
+	__in const NWN::ResRef32 & ResRef,
+	__in ResType Type
+	)
+/*++
+
+Routine Description:
+
+	This routine demand-loads a resource into memory and returns a read-only
+	view of its contents.  Unlike Demand, no temporary file is created.
+
+	If the providing resource accessor can supply a direct mapping of the
+	resource (i.e. the resource is stored uncompressed and contiguously, such
+	as for ERF, BIF or directory resources), then the resource contents are
+	mapped directly from the containing file.  Otherwise, the resource is read
+	(and decompressed, as necessary) into a private heap buffer.
+
+Arguments:
+
+	ResRef - Supplies the resource reference identifying the name of the
+	         resource to load.
+
+	Type - Supplies the type of the resource to load.
+
+Return Value:
+
+	A reference counted demand buffer describing the resource contents is
+	returned on success.  The buffer remains valid for as long as the caller
+	maintains a reference to it.
+
+	The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	FileHandle      Handle;
+	DemandBufferPtr Buffer;
+	size_t          EntryIndex;
+	char            Msg[ 512 ];
+
+	if (ResRef.RefStr[ 0 ] == '\0')
+	{
+		throw std::runtime_error(
+			"Attempted to demand load the null resource." );
+	}
+
+	EntryIndex = LookupResourceEntry( ResRef, Type );
+
+	if (EntryIndex != ResourceIndex::INVALID_INDEX)
+	{
+		try
+		{
+			return AcquireResourceContents( EntryIndex );
+		}
+		catch (std::exception &e)
+		{
+			m_TextWriter->WriteText(
+				"WARNING: Exception '%s' loading resource '%.32s' (type %04X).\n",
+				e.what( ),
+				ResRef.RefStr,
+				(unsigned short) Type);
+
+			throw;
+		}
+	}
+
+	Handle = OpenFile( ResRef, Type );
+
+	if (Handle == INVALID_FILE)
+	{
+		StringCbPrintfA(
+			Msg,
+			sizeof( Msg ),
+			"Failed to locate RESREF '%.32s'",
+			ResRef.RefStr );
+		throw std::runtime_error( Msg );
+	}
+
+	try
+	{
+		Buffer = CreateDemandBuffer( this, Handle );
+	}
+	catch (std::exception &e)
+	{
+		CloseFile( Handle );
+
+		m_TextWriter->WriteText(
+			"WARNING: Exception '%s' loading resource '%.32s' (type %04X).\n",
+			e.what( ),
+			ResRef.RefStr,
+			(unsigned short) Type);
+
+		throw;
+	}
+
+	CloseFile( Handle );
+
+	return Buffer;
+}
+
 bool
 ResourceManager::ResourceExists(
 	__in const NWN::ResRef32 & ResRef,
@@ -1023,21 +1166,7 @@ Environment:
 --*/
 {
 #if USE_INDEX
-	char        TypeStr[ 32 ];
-	std::string LookupName;
-
-	try
-	{
-		LookupName  = _itoa( (int) Type, TypeStr, 10 );
-		LookupName.push_back( 'T' );
-		LookupName += StrFromResRef( ResRef );
-	}
-	catch (std::exception)
-	{
-		return false;
-	}
-
-	return (m_NameIdMap.find( LookupName ) != m_NameIdMap.end( ));
+	return (LookupResourceEntry( ResRef, Type ) != ResourceIndex::INVALID_INDEX);
 #else
 	FileHandle Handle;
 
@@ -1053,25 +1182,35 @@ Environment:
 }
 
 void
-ResourceManager::Release(
-	__in const std::string & ResourceFileName
+ResourceManager::PrefetchResources(
+	__in_ecount( Count ) const NWN::ResRef32 * ResRefs,
+	__in_ecount( Count ) const ResType * Types,
+	__in size_t Count,
+	__in PrefetchPriority Priority /* = PrefetchPriorityNormal */
 	)
 /*++
 
 Routine Description:
 
-	This routine releases a reference to a resource previously loaded by a call
-	to Demand.
+	This routine queues a set of resources to be read into memory ahead of use
+	by the prefetch worker threads.  A later Demand, DemandView, OpenFile or
+	OpenFileByIndex call for a prefetched resource is satisfied from memory.
 
 Arguments:
 
-	ResourceFileName - Supplies the resource file name, which must h ave been
-	                   returned by a prior call to Demand.
+	ResRefs - Supplies the names of the resources to prefetch.
+
+	Types - Supplies the types of the resources to prefetch.
+
+	Count - Supplies the count of resources to prefetch.
+
+	Priority - Supplies the priority of the prefetch request.  Higher priority
+	           resources are read before lower priority resources.
 
 Return Value:
 
-	The routine raises an std::exception on catastrophic failure, such as an
-	attempt to release an already-unloaded resource.
+	None.  Resources that do not exist are ignored.  The routine raises an
+	std::exception on failure.
 
 Environment:
 
@@ -1079,114 +1218,100 @@ Environment:
 
 --*/
 {
-	char                    Ext[ 32 ];
-	char                    Name[ MAX_PATH ];
-	NWN::ResType            ResType;
-	ResRefNameMap::iterator nit;
+	std::vector< size_t > EntryIndicies;
 
-	if (_splitpath_s(
-		ResourceFileName.c_str( ),
-		NULL,
-		0,
-		NULL,
-		0,
-		Name,
-		sizeof( Name ),
-		Ext,
-		sizeof( Ext )) || (Ext[ 0 ] == '\0'))
+	if (m_ResManFlags & ResManFlagNoPrefetch)
+		return;
+
+	EntryIndicies.reserve( Count );
+
+	for (size_t i = 0; i < Count; i += 1)
 	{
-		try
-		{
-			std::string ErrorStr;
+		size_t EntryIndex;
 
-			ErrorStr  = "Illegal resource path '";
-			ErrorStr += ResourceFileName;
-			ErrorStr += "'.";
+		EntryIndex = LookupResourceEntry( ResRefs[ i ], Types[ i ] );
 
-			throw std::runtime_error( ErrorStr );
-		}
-		catch (std::bad_alloc)
-		{
-			throw std::runtime_error( "Illegal resource path." );
-		}
+		if (EntryIndex == ResourceIndex::INVALID_INDEX)
+			continue;
+
+		EntryIndicies.push_back( EntryIndex );
 	}
 
-	//
-	// Look up the name in the demand-loaded file list.
-	//
+	if (EntryIndicies.empty( ))
+		return;
 
-	ResType = ExtToResType( Ext + 1 );
+	m_Prefetcher.Enqueue( &EntryIndicies[ 0 ], EntryIndicies.size( ), Priority );
+}
 
-	try
-	{
-		std::string RefName;
+void
+ResourceManager::PrefetchArea(
+	__in const NWN::ResRef32 & AreaResRef,
+	__in PrefetchPriority Priority /* = PrefetchPriorityNormal */
+	)
+/*++
 
-		_strlwr( Name );
+Routine Description:
 
-		_itoa( (int) ResType, Ext, 10 );
+	This routine queues the resources that make up an area for prefetch, such
+	that a subsequent load of the area need not wait on file I/O.
 
-		RefName  = Ext;
-		RefName.push_back( 'T' );
-		RefName += Name;
+Arguments:
 
-		nit = m_NameMap.find( RefName );
-	}
-	catch (std::exception)
-	{
-		return;
-	}
+	AreaResRef - Supplies the resource name of the area.
 
-	if (nit == m_NameMap.end( ))
-	{
-		if (m_TextWriter != NULL)
-		{
-			m_TextWriter->WriteText(
-				"ERROR: ResourceManager::Release: Attempted to release resource '%s' after it was already released (or it was never demanded in the first place).\n"
-				"Check also that a resource extension mapping exists in ExtToResType for this resource type.\n",
-				ResourceFileName.c_str( ));
-		}
+	Priority - Supplies the priority of the prefetch request.
 
-		throw std::runtime_error( "Attempted to release unknown resource!" );
-	}
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	NWN::ResRef32 ResRefs[ 3 ];
+	ResType       Types[ 3 ];
 
 	//
-	// Drop the reference to us and perform the appropriate action once the
-	// reference count goes to zero.
+	// The area parameters (.are) and object instances (.git) are read first,
+	// followed by the (typically much larger) terrain and walkmesh (.trx).
 	//
 
-	if (--nit->second.Refs == 0)
-	{
-		if (nit->second.Delete)
-			DeleteFileA( nit->second.ResourceFileName.c_str( ) );
+	ResRefs[ 0 ] = AreaResRef;
+	Types[ 0 ]   = NWN::ResARE;
+	ResRefs[ 1 ] = AreaResRef;
+	Types[ 1 ]   = NWN::ResGIT;
+	ResRefs[ 2 ] = AreaResRef;
+	Types[ 2 ]   = NWN::ResTRX;
 
-		m_NameMap.erase( nit );
-	}
+	PrefetchResources( ResRefs, Types, 3, Priority );
 }
 
-ResourceManager::FileHandle
-ResourceManager::OpenFile(
-	__in const ResRefT & FileName,
+bool
+ResourceManager::PinResource(
+	__in const NWN::ResRef32 & ResRef,
 	__in ResType Type
 	)
 /*++
 
 Routine Description:
 
-	This routine logically opens an encapsulated sub-file.
+	This routine loads a resource into the resource cache (if it is not
+	already cached) and pins it there, such that it is not discarded until it
+	is unpinned.
 
 Arguments:
 
-	FileName - Supplies the name of the resource file to open.
+	ResRef - Supplies the resource name of the resource to pin.
 
-	Type - Supplies the type of file to open (i.e. ResTRN, ResARE).
+	Type - Supplies the type of the resource to pin.
 
 Return Value:
 
-	The routine returns a new file handle on success.  The file handle must be
-	closed by a call to CloseFile on successful return.
-
-	On failure, the routine returns the manifest constant INVALID_FILE, which
-	should not be closed.
+	The routine returns true if the resource was pinned, else false if the
+	resource does not exist.  The routine raises an std::exception on failure.
 
 Environment:
 
@@ -1194,197 +1319,148 @@ Environment:
 
 --*/
 {
-#if USE_INDEX
-	ResourceEntryMap::const_iterator eit;
-	char                             TypeStr[ 32 ];
-	std::string                      LookupName;
+	size_t                EntryIndex;
+	size_t                CacheKey;
+	DemandBufferPtr       Contents;
+	EntryPinMap::iterator Pin;
+	EntryPin              NewPin;
 
-	LookupName  = _itoa( (int) Type, TypeStr, 10 );
-	LookupName.push_back( 'T' );
-	LookupName += StrFromResRef( FileName );
+	EntryIndex = LookupResourceEntry( ResRef, Type );
+
+	if (EntryIndex == ResourceIndex::INVALID_INDEX)
+		return false;
 
 	//
-	// Look up the file in our index mapping.
+	// If the entry is already pinned, then nest another pin on the contents
+	// that it pinned (which remain cached as they are pinned).
 	//
 
-	if ((eit = m_NameIdMap.find( LookupName )) != m_NameIdMap.end( ))
-	{
-		const ResourceEntry * Entry;
-		FileHandle            AccessorHandle;
+	Pin = m_EntryPins.find( EntryIndex );
 
-		//
-		// Open it up via the accessor.
-		//
+	if ((Pin != m_EntryPins.end( )) &&
+	    (m_ResourceCache.Pin( Pin->second.CacheKey )))
+	{
+		Pin->second.PinCount += 1;
+		return true;
+	}
 
-		Entry          = &m_ResourceEntries[ eit->second ];
-		AccessorHandle = Entry->Accessor->OpenFileByIndex( Entry->FileIndex );
+	CacheKey = GetResourceCacheKey( EntryIndex );
 
-		if (AccessorHandle == INVALID_FILE)
-			return INVALID_FILE;
+	if (!m_ResourceCache.Pin( CacheKey ))
+	{
+		if (!m_Prefetcher.Lookup( EntryIndex, Contents ))
+			Contents = LoadResourceEntry( EntryIndex );
 
 		//
-		// We've found a match, build a resource manager handle and return
-		// it to the caller.
+		// If the contents are shared with another resource, then the shared
+		// contents are pinned (and may already be cached).
 		//
 
-		try
-		{
-			FileHandle ResManHandle;
-			ResHandle  HandleEntry;
+		if (m_ResManFlags & ResManFlagShareContents)
+			CacheKey = ShareResourceContents( EntryIndex, Contents );
 
-			//
-			// Allocate a resource manager handle table entry.
-			//
+		m_ResourceCache.Insert( CacheKey, Contents, true );
+	}
 
-			ResManHandle = AllocateFileHandle( );
+	//
+	// Remember which contents this entry pinned, so that only this entry's
+	// own pins are released when it is unpinned.
+	//
 
-			if (ResManHandle == INVALID_FILE)
-				throw std::runtime_error( "Failed to build FileHandle" );
+	NewPin.CacheKey = CacheKey;
+	NewPin.PinCount = 1;
 
-			HandleEntry.Accessor = Entry->Accessor;
-			HandleEntry.Handle   = AccessorHandle;
-			HandleEntry.Type     = Type;
+	try
+	{
+		m_EntryPins[ EntryIndex ] = NewPin;
+	}
+	catch (...)
+	{
+		m_ResourceCache.Unpin( CacheKey );
+		throw;
+	}
 
-			//
-			// Link the handle table entry up.
-			//
+	return true;
+}
 
-			m_ResFileHandles.insert(
-				ResHandleMap::value_type( ResManHandle, HandleEntry ) );
-
-			//
-			// All done.
-			//
-
-			return ResManHandle;
-		}
-		catch (std::exception &e)
-		{
-			Entry->Accessor->CloseFile( AccessorHandle );
-
-			m_TextWriter->WriteText(
-				"WARNING: Exception '%s' loading resource '%.32s' (type %04X).\n",
-				e.what( ),
-				FileName.RefStr,
-				(unsigned short) Type );
-
-			throw;
-		}
-		catch (...)
-		{
-			Entry->Accessor->CloseFile( AccessorHandle );
-
-			throw;
-		}
-
-	}
-#else
-	//
-	// Search through all providers, finding a match if we can.
-	//
-
-	for (size_t i = 0; i < MAX_TIERS; i += 1)
-	{
-		for (ResourceAccessorVec::reverse_iterator it = m_ResourceFiles[ i ].rbegin( );
-		     it != m_ResourceFiles[ i ].rend( );
-		     ++it)
-		{
-			FileHandle AccessorHandle;
+bool
+ResourceManager::UnpinResource(
+	__in const NWN::ResRef32 & ResRef,
+	__in ResType Type
+	)
+/*++
 
-			//
-			// Have each accessor attempt to open the file in turn.
-			//
+Routine Description:
 
-			AccessorHandle = (*it)->OpenFile( FileName, Type );
+	This routine releases a pin on a resource that was taken by PinResource.
+	Once all pins are released, the resource may be discarded from the
+	resource cache as any other cached resource.
 
-			if (AccessorHandle == INVALID_FILE)
-				continue;
+Arguments:
 
-			//
-			// We've found a match, build a resource manager handle and return
-			// it to the caller.
-			//
+	ResRef - Supplies the resource name of the resource to unpin.
 
-			try
-			{
-				FileHandle ResManHandle;
-				ResHandle  HandleEntry;
+	Type - Supplies the type of the resource to unpin.
 
-				//
-				// Allocate a resource manager handle table entry.
-				//
+Return Value:
 
-				ResManHandle = AllocateFileHandle( );
+	The routine returns true if the pin was released, else false if the
+	resource was not pinned.  Only pins taken on this resource are released,
+	even if its contents are shared with another pinned resource.
 
-				if (ResManHandle == INVALID_FILE)
-					throw std::runtime_error( "Failed to build FileHandle" );
+Environment:
 
-				HandleEntry.Accessor = (*it);
-				HandleEntry.Handle   = AccessorHandle;
-				HandleEntry.Type     = Type;
+	User mode.
 
-				//
-				// Link the handle table entry up.
-				//
+--*/
+{
+	size_t                EntryIndex;
+	EntryPinMap::iterator Pin;
 
-				m_ResFileHandles.insert(
-					ResHandleMap::value_type( ResManHandle, HandleEntry ) );
+	EntryIndex = LookupResourceEntry( ResRef, Type );
 
-				//
-				// All done.
-				//
+	if (EntryIndex == ResourceIndex::INVALID_INDEX)
+		return false;
 
-				return ResManHandle;
-			}
-			catch (std::exception &e)
-			{
-				(*it)->CloseFile( AccessorHandle );
+	Pin = m_EntryPins.find( EntryIndex );
 
-				m_TextWriter->WriteText(
-					"WARNING: Exception '%s' loading resource '%.32s'.\n",
-					e.what( ),
-					FileName.RefStr );
+	if (Pin == m_EntryPins.end( ))
+		return false;
 
-				throw;
-			}
-			catch (...)
-			{
-				(*it)->CloseFile( AccessorHandle );
+	m_ResourceCache.Unpin( Pin->second.CacheKey );
 
-				throw;
-			}
-		}
-	}
-#endif
+	Pin->second.PinCount -= 1;
 
-	//
-	// No resource providers recognize it, bail.
-	//
+	if (Pin->second.PinCount == 0)
+		m_EntryPins.erase( Pin );
 
-	return INVALID_FILE;
+	return true;
 }
 
-ResourceManager::FileHandle
-ResourceManager::OpenFileByIndex(
-	__in FileId FileIndex
+size_t
+ResourceManager::RefreshDirectoryResources(
 	)
 /*++
 
 Routine Description:
 
-	This routine logically opens an encapsulated sub-file.
+	This routine applies the changes made to watched directory providers since
+	the last refresh to the resource index, without reloading the module
+	resources.
+
+	Only the resource index entries of added, removed or modified files are
+	updated.  An added file claims its resource if its directory takes
+	precedence over the current provider of the resource; a removed file
+	yields its resource to the next most precedent provider (if any).
 
 Arguments:
 
-	FileIndex - Supplies the directory index of the file to open.
+	None.
 
 Return Value:
 
-	The routine returns a new file handle on success.  The file handle must be
-	closed by a call to CloseFile on successful return.
-
-	On failure, the routine returns the manifest constant INVALID_FILE, which
-	should not be closed.
+	The routine returns the count of resource index entries that changed.  The
+	routine raises an std::exception on failure.
 
 Environment:
 
@@ -1392,103 +1468,78 @@ Environment:
 
 --*/
 {
+	DirectoryFileReader::ResourceChangeVec Changes;
+	std::vector< size_t >                  Vacated;
+	size_t                                 Changed;
 
-	const ResourceEntry * Entry;
-	FileHandle            AccessorHandle;
-	NWN::ResRef32         FileName;
-	NWN::ResType          Type;
-
-	if ((size_t) FileIndex >= m_ResourceEntries.size( ))
-		return INVALID_FILE;
-
-	if (!GetEncapsulatedFileEntry( FileIndex, FileName, Type ))
-		return INVALID_FILE;
-
-	//
-	// Open it up via the accessor.
-	//
-
-	Entry          = &m_ResourceEntries[ (size_t) FileIndex ];
-	AccessorHandle = Entry->Accessor->OpenFileByIndex( Entry->FileIndex );
-
-	if (AccessorHandle == INVALID_FILE)
-		return INVALID_FILE;
-
-	//
-	// We've found a match, build a resource manager handle and return
-	// it to the caller.
-	//
+	Changed = 0;
 
-	try
+	for (size_t i = 0; i < m_DirFiles.size( ); i += 1)
 	{
-		FileHandle ResManHandle;
-		ResHandle  HandleEntry;
-
-		//
-		// Allocate a resource manager handle table entry.
-		//
-
-		ResManHandle = AllocateFileHandle( );
+		DirectoryFileReader * Directory = m_DirFiles[ i ].get( );
 
-		if (ResManHandle == INVALID_FILE)
-			throw std::runtime_error( "Failed to build FileHandle" );
+		if (!Directory->IsChangeWatchEnabled( ))
+			continue;
 
-		HandleEntry.Accessor = Entry->Accessor;
-		HandleEntry.Handle   = AccessorHandle;
-		HandleEntry.Type     = Type;
+		Changes.clear( );
 
 		//
-		// Link the handle table entry up.
+		// The prefetch worker threads may be reading from the directory, so
+		// the entry table is only updated under the accessor lock.
 		//
 
-		m_ResFileHandles.insert(
-			ResHandleMap::value_type( ResManHandle, HandleEntry ) );
+		{
+			swutil::ScopedLock Lock( m_AccessorLock );
+
+			Directory->PollChanges( Changes );
+		}
 
 		//
-		// All done.
+		// Directory providers are searched most recently added first, which
+		// is the reverse of their order in m_DirFiles.
 		//
 
-		return ResManHandle;
+		for (DirectoryFileReader::ResourceChangeVec::const_iterator it = Changes.begin( );
+		     it != Changes.end( );
+		     ++it)
+		{
+			if (ApplyDirectoryChange(
+				Directory,
+				m_DirFiles.size( ) - i,
+				*it,
+				Vacated))
+			{
+				Changed += 1;
+			}
+		}
 	}
-	catch (std::exception &e)
-	{
-		Entry->Accessor->CloseFile( AccessorHandle );
-
-		m_TextWriter->WriteText(
-			"WARNING: Exception '%s' loading resource '%.32s' (type %04X).\n",
-			e.what( ),
-			FileName.RefStr,
-			(unsigned short) Type );
 
-		throw;
-	}
-	catch (...)
-	{
-		Entry->Accessor->CloseFile( AccessorHandle );
+	if (!Vacated.empty( ))
+		ReassignVacatedEntries( Vacated );
 
-		throw;
-	}
+	return Changed;
 }
 
-bool
-ResourceManager::CloseFile(
-	__in FileHandle File
+void
+ResourceManager::Release(
+	__in const std::string & ResourceFileName
 	)
 /*++
 
 Routine Description:
 
-	This routine logically closes an encapsulated sub-file.
+	This routine releases a reference to a resource previously loaded by a call
+	to Demand.
 
 Arguments:
 
-	File - Supplies the file handle to close.
+	ResourceFileName - Supplies the resource file name, which must h ave been
+	                   returned by a prior call to Demand.
 
 Return Value:
 
-	The routine returns a Boolean value indicating true on success, else false
-	on failure.  A return value of false typically indicates a serious
-	programming error upon the caller (i.e. reuse of a closed file handle).
+	The routine raises an std::exception on catastrophic failure, such as an
+	attempt to release an already-unloaded resource.
 
 Environment:
 
@@ -1496,108 +1547,114 @@ Environment:
 
 --*/
 {
-	ResHandleMap::iterator it = m_ResFileHandles.find( File );
-	bool                   Res;
+	char                    Ext[ 32 ];
+	char                    Name[ MAX_PATH ];
+	NWN::ResType            ResType;
+	ResRefNameMap::iterator nit;
 
-	if (it == m_ResFileHandles.end( ))
-		return false;
+	if (_splitpath_s(
+		ResourceFileName.c_str( ),
+		NULL,
+		0,
+		NULL,
+		0,
+		Name,
+		sizeof( Name ),
+		Ext,
+		sizeof( Ext )) || (Ext[ 0 ] == '\0'))
+	{
+		try
+		{
+			std::string ErrorStr;
 
-	//
-	// Delegate the request to the underlying accessor's implementation.
-	//
+			ErrorStr  = "Illegal resource path '";
+			ErrorStr += ResourceFileName;
+			ErrorStr += "'.";
 
-	Res = it->second.Accessor->CloseFile( it->second.Handle );
+			throw std::runtime_error( ErrorStr );
+		}
+		catch (std::bad_alloc)
+		{
+			throw std::runtime_error( "Illegal resource path." );
+		}
+	}
 
 	//
-	// Invalidate the resource manager handle.
+	// Look up the name in the demand-loaded file list.
 	//
 
-	m_ResFileHandles.erase( it );
+	ResType = ExtToResType( Ext + 1 );
 
-	return Res;
-}
+	try
+	{
+		std::string RefName;
 
-bool
-ResourceManager::ReadEncapsulatedFile(
-	__in FileHandle File,
-	__in size_t Offset,
-	__in size_t BytesToRead,
-	__out size_t * BytesRead,
-	__out_bcount( BytesToRead ) void * Buffer
-	)
-/*++
-
-Routine Description:
-
-	This routine logically reads an encapsulated sub-file.
-
-	File reading is optimized for sequential scan.
-
-Arguments:
-
-	File - Supplies a file handle to the desired sub-file to read.
-
-	Offset - Supplies the offset into the desired sub-file to read from.
-
-	BytesToRead - Supplies the requested count of bytes to read.
-
-	BytesRead - Receives the count of bytes transferred.
-
-	Buffer - Supplies the address of a buffer to transfer raw encapsulated file
-	         contents to.
-
-Return Value:
+		_strlwr( Name );
 
-	The routine returns a Boolean value indicating true on success, else false
-	on failure.  An attempt to read from an invalid file handle, or an attempt
-	to read beyond the end of file would be examples of failure conditions.
+		_itoa( (int) ResType, Ext, 10 );
 
-Environment:
+		RefName  = Ext;
+		RefName.push_back( 'T' );
+		RefName += Name;
 
-	User mode.
+		nit = m_NameMap.find( RefName );
+	}
+	catch (std::exception)
+	{
+		return;
+	}
 
---*/
-{
-	ResHandleMap::const_iterator it = m_ResFileHandles.find( File );
+	if (nit == m_NameMap.end( ))
+	{
+		if (m_TextWriter != NULL)
+		{
+			m_TextWriter->WriteText(
+				"ERROR: ResourceManager::Release: Attempted to release resource '%s' after it was already released (or it was never demanded in the first place).\n"
+				"Check also that a resource extension mapping exists in ExtToResType for this resource type.\n",
+				ResourceFileName.c_str( ));
+		}
 
-	if (it == m_ResFileHandles.end( ))
-		return 0;
+		throw std::runtime_error( "Attempted to release unknown resource!" );
+	}
 
 	//
-	// Delegate the request to the underlying accessor's implementation.
+	// Drop the reference to us and perform the appropriate action once the
+	// reference count goes to zero.
 	//
 
-	return it->second.Accessor->ReadEncapsulatedFile(
-		it->second.Handle,
-		Offset,
-		BytesToRead,
-		BytesRead,
-		Buffer);
+	if (--nit->second.Refs == 0)
+	{
+		if (nit->second.Delete)
+			DeleteFileA( nit->second.ResourceFileName.c_str( ) );
+
+		m_NameMap.erase( nit );
+	}
 }
 
-size_t
-ResourceManager::GetEncapsulatedFileSize(
-	__in FileHandle File
+ResourceManager::FileHandle
+ResourceManager::OpenFile(
+	__in const ResRefT & FileName,
+	__in ResType Type
 	)
 /*++
 
 Routine Description:
 
-	This routine returns the size, in bytes, of an encapsulated file.
+	This routine logically opens an encapsulated sub-file.
 
 Arguments:
 
-	File - Supplies the file handle to query the size of.
+	FileName - Supplies the name of the resource file to open.
+
+	Type - Supplies the type of file to open (i.e. ResTRN, ResARE).
 
 Return Value:
 
-	The routine returns the size of the given file.  If a valid file handle is
-	supplied, then the routine never fails.
+	The routine returns a new file handle on success.  The file handle must be
+	closed by a call to CloseFile on successful return.
 
-	Should an illegal file handle be supplied, the routine returns zero.  There
-	is no way to distinguish this condition from legal file handle to a file
-	with zero length.  Only a serious programming error results in a caller
-	supplying an illegal file handle.
+	On failure, the routine returns the manifest constant INVALID_FILE, which
+	should not be closed.
 
 Environment:
 
@@ -1605,150 +1662,207 @@ Environment:
 
 --*/
 {
-	ResHandleMap::const_iterator it = m_ResFileHandles.find( File );
-
-	if (it == m_ResFileHandles.end( ))
-		return 0;
+#if USE_INDEX
+	size_t EntryIndex;
 
 	//
-	// Delegate the request to the underlying accessor's implementation.
+	// Look up the file in our index mapping.
 	//
 
-	return it->second.Accessor->GetEncapsulatedFileSize( it->second.Handle );
-}
-
-ResourceManager::ResType
-ResourceManager::GetEncapsulatedFileType(
-	__in FileHandle File
-	)
-/*++
+	EntryIndex = LookupResourceEntry( FileName, Type );
 
-Routine Description:
+	if (EntryIndex != ResourceIndex::INVALID_INDEX)
+	{
+		const ResourceEntry * Entry;
+		FileHandle            AccessorHandle;
+		DemandBufferPtr       Contents;
 
-	This routine returns the type of an encapsulated file.
+		//
+		// If the resource is cached or was prefetched, then serve it from
+		// memory.
+		//
 
-Arguments:
+		if ((m_ResourceCache.Lookup( GetResourceCacheKey( EntryIndex ), Contents )) ||
+		    (m_Prefetcher.Lookup( EntryIndex, Contents )))
+		{
+			return OpenInMemoryFile( EntryIndex, Type, Contents );
+		}
 
-	File - Supplies the file handle to query the size of.
+		//
+		// Open it up via the accessor.
+		//
 
-Return Value:
+		swutil::ScopedLock Lock( m_AccessorLock );
 
-	The routine returns the type of the given file.  If a valid file handle is
-	supplied, then the routine never fails.
+		Entry          = &m_ResourceEntries[ EntryIndex ];
+		AccessorHandle = Entry->Accessor->OpenFileByIndex( Entry->FileIndex );
 
-	Should an illegal file handle be supplied, the routine returns ResINVALID.
-	There is no way to distinguish this condition from legal file handle to a
-	file of type ResINVALID.  Only a serious programming error results in a
-	caller supplying an illegal file handle.
+		if (AccessorHandle == INVALID_FILE)
+			return INVALID_FILE;
 
-Environment:
+		//
+		// We've found a match, build a resource manager handle and return
+		// it to the caller.
+		//
 
-	User mode.
+		try
+		{
+			FileHandle ResManHandle;
+			ResHandle  HandleEntry;
 
---*/
-{
-	ResHandleMap::const_iterator it = m_ResFileHandles.find( File );
+			//
+			// Allocate a resource manager handle table entry.
+			//
 
-	if (it == m_ResFileHandles.end( ))
-		return NWN::ResINVALID;
+			ResManHandle = AllocateFileHandle( );
 
-	return it->second.Type;
-}
+			if (ResManHandle == INVALID_FILE)
+				throw std::runtime_error( "Failed to build FileHandle" );
 
-bool
-ResourceManager::GetEncapsulatedFileEntry(
-	__in FileId FileIndex,
-	__out ResRefT & ResRef,
-	__out ResType & Type
-	)
-/*++
+			HandleEntry.Accessor = Entry->Accessor;
+			HandleEntry.Handle   = AccessorHandle;
+			HandleEntry.Type     = Type;
 
-Routine Description:
+			//
+			// Link the handle table entry up.
+			//
 
-	This routine reads an encapsulated file directory entry, returning the name
-	and type of a particular resource.  The enumeration is stable across calls.
+			m_ResFileHandles.insert(
+				ResHandleMap::value_type( ResManHandle, HandleEntry ) );
 
-Arguments:
+			//
+			// All done.
+			//
 
-	FileIndex - Supplies the index into the logical directory entry to reutrn.
+			return ResManHandle;
+		}
+		catch (std::exception &e)
+		{
+			Entry->Accessor->CloseFile( AccessorHandle );
 
-	ResRef - Receives the resource name.
+			m_TextWriter->WriteText(
+				"WARNING: Exception '%s' loading resource '%.32s' (type %04X).\n",
+				e.what( ),
+				FileName.RefStr,
+				(unsigned short) Type );
 
-	Type - Receives the resource type.
+			throw;
+		}
+		catch (...)
+		{
+			Entry->Accessor->CloseFile( AccessorHandle );
 
-Return Value:
+			throw;
+		}
 
-	The routine returns a Boolean value indicating success or failure.  The
-	routine always succeeds as long as the caller provides a legal file index.
+	}
+#else
+	//
+	// Search through all providers, finding a match if we can.
+	//
 
-Environment:
+	for (size_t i = 0; i < MAX_TIERS; i += 1)
+	{
+		for (ResourceAccessorVec::reverse_iterator it = m_ResourceFiles[ i ].rbegin( );
+		     it != m_ResourceFiles[ i ].rend( );
+		     ++it)
+		{
+			FileHandle AccessorHandle;
 
-	User mode.
+			//
+			// Have each accessor attempt to open the file in turn.
+			//
 
---*/
-{
-	IResourceAccessor * Accessor;
+			AccessorHandle = (*it)->OpenFile( FileName, Type );
 
-	if ((size_t) FileIndex >= m_ResourceEntries.size( ))
-		return false;
+			if (AccessorHandle == INVALID_FILE)
+				continue;
 
-	Accessor = m_ResourceEntries[ (size_t) FileIndex ].Accessor;
+			//
+			// We've found a match, build a resource manager handle and return
+			// it to the caller.
+			//
 
-	return Accessor->GetEncapsulatedFileEntry(
-		m_ResourceEntries[ (size_t) FileIndex ].FileIndex,
-		ResRef,
-		Type);
-}
+			try
+			{
+				FileHandle ResManHandle;
+				ResHandle  HandleEntry;
 
-ResourceManager::FileId
-ResourceManager::GetEncapsulatedFileCount(
-	)
-/*++
+				//
+				// Allocate a resource manager handle table entry.
+				//
 
-Routine Description:
+				ResManHandle = AllocateFileHandle( );
 
-	This routine returns the count of files in this resource accessor.  The
-	highest valid file index is the returned count minus one, unless there are
-	zero files, in which case no file index values are legal.
+				if (ResManHandle == INVALID_FILE)
+					throw std::runtime_error( "Failed to build FileHandle" );
 
-Arguments:
+				HandleEntry.Accessor = (*it);
+				HandleEntry.Handle   = AccessorHandle;
+				HandleEntry.Type     = Type;
 
-	None.
+				//
+				// Link the handle table entry up.
+				//
 
-Return Value:
+				m_ResFileHandles.insert(
+					ResHandleMap::value_type( ResManHandle, HandleEntry ) );
 
-	The routine returns the count of files present.
+				//
+				// All done.
+				//
 
-Environment:
+				return ResManHandle;
+			}
+			catch (std::exception &e)
+			{
+				(*it)->CloseFile( AccessorHandle );
 
-	User mode.
+				m_TextWriter->WriteText(
+					"WARNING: Exception '%s' loading resource '%.32s'.\n",
+					e.what( ),
+					FileName.RefStr );
 
---*/
-{
-	return m_ResourceEntries.size( );
+				throw;
+			}
+			catch (...)
+			{
+				(*it)->CloseFile( AccessorHandle );
+
+				throw;
+			}
+		}
+	}
+#endif
+
+	//
+	// No resource providers recognize it, bail.
+	//
+
+	return INVALID_FILE;
 }
 
-ResourceManager::AccessorType
-ResourceManager::GetResourceAccessorName(
-	__in FileHandle File,
-	__out std::string & AccessorName
+ResourceManager::FileHandle
+ResourceManager::OpenFileByIndex(
+	__in FileId FileIndex
 	)
 /*++
 
 Routine Description:
 
-	This routine returns the logical name of the resource accessor.
+	This routine logically opens an encapsulated sub-file.
 
 Arguments:
 
-	File - Supplies the file handle to inquire about.
-
-	AccessorName - Receives the logical name of the resource accessor.
+	FileIndex - Supplies the directory index of the file to open.
 
 Return Value:
 
-	The routine returns the accessor type.  An std::exception is raised on
-	failure.
+	The routine returns a new file handle on success.  The file handle must be
+	closed by a call to CloseFile on successful return.
+
+	On failure, the routine returns the manifest constant INVALID_FILE, which
+	should not be closed.
 
 Environment:
 
@@ -1756,152 +1870,116 @@ Environment:
 
 --*/
 {
-	ResHandleMap::const_iterator it;
 
-	if (File == INVALID_FILE)
-	{
-		AccessorName = "Resource Manager";
-		return AccessorTypeResourceManager;
-	}
+	const ResourceEntry * Entry;
+	FileHandle            AccessorHandle;
+	NWN::ResRef32         FileName;
+	NWN::ResType          Type;
+	DemandBufferPtr       Contents;
 
-	it = m_ResFileHandles.find( File );
+	if ((size_t) FileIndex >= m_ResourceEntries.size( ))
+		return INVALID_FILE;
 
-	if (it == m_ResFileHandles.end( ))
-		throw std::runtime_error( "invalid file handle passed to ResourceManager::GetResourceAccessorName" );
+	if (!GetEncapsulatedFileEntry( FileIndex, FileName, Type ))
+		return INVALID_FILE;
 
 	//
-	// Delegate the request to the underlying accessor's implementation.
+	// If the resource is cached or was prefetched, then serve it from memory.
 	//
 
-	return it->second.Accessor->GetResourceAccessorName(
-			it->second.Handle,
-			AccessorName);
-}
-
-template< typename ResRefType >
-void
-ResourceManager::LoadEncapsulatedFile(
-	__in IResourceAccessor< ResRefType > * Accessor,
-	__in typename IResourceAccessor< ResRefType >::FileId FileIndex,
-	__out std::vector< unsigned char > & FileContents
-	)
-/*++
-
-Routine Description:
-
-	This helper routine loads a file from a resource accessor into an
-	std::vector.  The entire file is loaded at once.
-
-Arguments:
-
-	Accessor - Supplies the resource accessor instance to open the file from.
-
-	FileIndex - Supplies the index of the file in the resource accessor that is
-	            to be loaded.
-
-	FileContents - Receives the loaded contents of the file.
-
-Return Value:
+	if ((m_ResourceCache.Lookup( GetResourceCacheKey( (size_t) FileIndex ), Contents )) ||
+	    (m_Prefetcher.Lookup( (size_t) FileIndex, Contents )))
+	{
+		return OpenInMemoryFile( (size_t) FileIndex, Type, Contents );
+	}
 
-	None.  On failure, an std::exception is raised.
+	//
+	// Open it up via the accessor.
+	//
 
-Environment:
+	swutil::ScopedLock Lock( m_AccessorLock );
 
-	User mode.
+	Entry          = &m_ResourceEntries[ (size_t) FileIndex ];
+	AccessorHandle = Entry->Accessor->OpenFileByIndex( Entry->FileIndex );
 
---*/
-{
-	IResourceAccessor< ResRefType >::FileHandle   Handle;
-	size_t                                        FileSize;
-	size_t                                        BytesLeft;
-	size_t                                        Offset;
-	size_t                                        Read;
+	if (AccessorHandle == INVALID_FILE)
+		return INVALID_FILE;
 
 	//
-	// Open the file via the resource system.
+	// We've found a match, build a resource manager handle and return
+	// it to the caller.
 	//
 
-	Handle = Accessor->OpenFileByIndex( FileIndex );
+	try
+	{
+		FileHandle ResManHandle;
+		ResHandle  HandleEntry;
 
-	if (Handle == IResourceAccessor< ResRefType >::INVALID_FILE)
-		throw std::runtime_error( "OpenFileByIndex failed." );
+		//
+		// Allocate a resource manager handle table entry.
+		//
 
-	//
-	// Read the whole contents into memory up front.
-	//
+		ResManHandle = AllocateFileHandle( );
 
-	FileSize = Accessor->GetEncapsulatedFileSize( Handle );
+		if (ResManHandle == INVALID_FILE)
+			throw std::runtime_error( "Failed to build FileHandle" );
 
-	try
-	{
-		if (FileSize != 0)
-		{
-			FileContents.resize( FileSize );
+		HandleEntry.Accessor = Entry->Accessor;
+		HandleEntry.Handle   = AccessorHandle;
+		HandleEntry.Type     = Type;
 
-			BytesLeft = FileSize;
-			Offset    = 0;
+		//
+		// Link the handle table entry up.
+		//
 
-			while (BytesLeft != 0)
-			{
-				if (!Accessor->ReadEncapsulatedFile(
-					Handle,
-					Offset,
-					BytesLeft,
-					&Read,
-					&FileContents[ Offset ]))
-				{
-					throw std::runtime_error( "ReadEncapsulatedFile failed." );
-				}
+		m_ResFileHandles.insert(
+			ResHandleMap::value_type( ResManHandle, HandleEntry ) );
 
-				if (Read == 0)
-					throw std::runtime_error( "Read zero bytes." );
+		//
+		// All done.
+		//
 
-				Offset    += Read;
-				BytesLeft -= Read;
-			}
-		}
-		else
-		{
-			FileContents.clear( );
-		}
+		return ResManHandle;
 	}
-	catch (std::exception)
+	catch (std::exception &e)
 	{
-		Accessor->CloseFile( Handle );
+		Entry->Accessor->CloseFile( AccessorHandle );
+
+		m_TextWriter->WriteText(
+			"WARNING: Exception '%s' loading resource '%.32s' (type %04X).\n",
+			e.what( ),
+			FileName.RefStr,
+			(unsigned short) Type );
 
 		throw;
 	}
+	catch (...)
+	{
+		Entry->Accessor->CloseFile( AccessorHandle );
 
-	//
-	// Close the file out and we're done.
-	//
-
-	Accessor->CloseFile( Handle );
+		throw;
+	}
 }
 
 bool
-ResourceManager::GetTalkString(
-	__in unsigned long StringId,
-	__out std::string & String
-	) const
+ResourceManager::CloseFile(
+	__in FileHandle File
+	)
 /*++
 
 Routine Description:
 
-	This routine retrieves a localized string from the string tables.
+	This routine logically closes an encapsulated sub-file.
 
 Arguments:
 
-	StringId - Supplies the STRREF to look up.
-
-	String - Receives the localized string, on success.
+	File - Supplies the file handle to close.
 
 Return Value:
 
-	The routine returns a Boolean value indicating whether the string could be
-	successfully located or not.
-	
-	On catastrophic failure, the routine raises an std::exception.
+	The routine returns a Boolean value indicating true on success, else false
+	on failure.  A return value of false typically indicates a serious
+	programming error upon the caller (i.e. reuse of a closed file handle).
 
 Environment:
 
@@ -1909,71 +1987,71 @@ Environment:
 
 --*/
 {
-	unsigned long RefId;
-
-	if (StringId == STRREF_INVALID)
-	{
-		String = "";
-		return true;
-	}
+	ResHandleMap::iterator it = m_ResFileHandles.find( File );
+	bool                   Res;
 
-	RefId = (StringId & STRREF_IDMASK);
+	if (it == m_ResFileHandles.end( ))
+		return false;
 
 	//
-	// If requested, try the alternate table first.
+	// Delegate the request to the underlying accessor's implementation.  An
+	// in-memory file has no accessor handle to close.
 	//
 
-	if (StringId & STRREF_TABLEMASK)
+	if (it->second.Contents.get( ) != NULL)
 	{
-		if ((m_AlternateTlk.get( ) != NULL) &&
-		    (m_AlternateTlk->GetTalkString( RefId, String )))
-		{
-			return true;
-		}
+		Res = true;
+	}
+	else
+	{
+		swutil::ScopedLock Lock( m_AccessorLock );
+
+		Res = it->second.Accessor->CloseFile( it->second.Handle );
 	}
 
 	//
-	// Always fall back to the base table if we've found nothing so far.
+	// Invalidate the resource manager handle.
 	//
 
-	if ((m_BaseTlk.get( ) != NULL) &&
-	    (m_BaseTlk->GetTalkString( RefId, String )))
-	{
-		return true;
-	}
+	m_ResFileHandles.erase( it );
 
-	return false;
+	return Res;
 }
 
 bool
-ResourceManager::Get2DAString(
-	__in const std::string & ResourceName,
-	__in const std::string & Column,
-	__in size_t Row,
-	__out std::string & Value
+ResourceManager::ReadEncapsulatedFile(
+	__in FileHandle File,
+	__in size_t Offset,
+	__in size_t BytesToRead,
+	__out size_t * BytesRead,
+	__out_bcount( BytesToRead ) void * Buffer
 	)
 /*++
 
 Routine Description:
 
-	This routine fetches the string value of a column at a particular row index
-	into the given 2DA file.
+	This routine logically reads an encapsulated sub-file.
+
+	File reading is optimized for sequential scan.
 
 Arguments:
 
-	ResourceName - Supplies the RESREF identifier of the .2DA to read.
+	File - Supplies a file handle to the desired sub-file to read.
 
-	Column - Supplies the column name to look up.
+	Offset - Supplies the offset into the desired sub-file to read from.
 
-	Row - Supplies the row index to pull the column from.
+	BytesToRead - Supplies the requested count of bytes to read.
 
-	Value - Receives the string contents of the particular row.
+	BytesRead - Receives the count of bytes transferred.
+
+	Buffer - Supplies the address of a buffer to transfer raw encapsulated file
+	         contents to.
 
 Return Value:
 
 	The routine returns a Boolean value indicating true on success, else false
-	on failure (i.e. unknown string).  On catastrophic failure, an
-	std::exception is raised.
+	on failure.  An attempt to read from an invalid file handle, or an attempt
+	to read beyond the end of file would be examples of failure conditions.
 
 Environment:
 
@@ -1981,125 +2059,74 @@ Environment:
 
 --*/
 {
-	TwoDANameMap::const_iterator it;
+	ResHandleMap::const_iterator it = m_ResFileHandles.find( File );
 
-	it = m_2DAs.find( ResourceName );
+	if (it == m_ResFileHandles.end( ))
+		return 0;
 
-	if (it == m_2DAs.end( ))
-	{
-		//
-		// Try and load the .2DA on demand using the resource manager's search
-		// hierarchy for locating the .2DA file.
-		//
-		// If successful, cache the 2DA object in-memory, drop the demanded
-		// resource reference (as the TwoDAFileReader does not require
-		// continual file access), and delegate the Get2DAString requets to the
-		// newly-instantiated TwoDAReader object.
-		//
+	//
+	// Satisfy reads of an in-memory file directly from its contents.
+	//
 
-		try
-		{
-			TwoDAFileReaderPtr Reader;
-			DemandResourceStr  Res( *this, ResourceName, NWN::Res2DA );
+	if (it->second.Contents.get( ) != NULL)
+	{
+		const DemandBuffer * Contents = it->second.Contents.get( );
 
-			Reader = new TwoDAFileReader( Res );
+		*BytesRead = 0;
 
-			m_2DAs.insert( TwoDANameMap::value_type( ResourceName, Reader ) );
+		if (Offset >= Contents->GetSize( ))
+			return false;
 
-			return Reader->Get2DAString( Column, Row, Value );
-		}
-		catch (std::exception &e)
-		{
-			m_TextWriter->WriteText(
-				"WARNING: Failed to access 2DA '%s' ('%s'/%lu): exception '%s'.\n",
-				ResourceName.c_str( ),
-				Column.c_str( ),
-				Row,
-				e.what( ));
+		BytesToRead = min( BytesToRead, Contents->GetSize( ) - Offset );
 
-			//
-			// Cache a NULL reader pointer so that we don't try and hit the
-			// resource list each time from now on.  Failures to load a 2DA are
-			// not temporary failures and are typically symptomatic of a critical
-			// condition such as a missing or malformed .2DA on-disk.
-			//
+		memcpy( Buffer, Contents->GetData( ) + Offset, BytesToRead );
 
-			m_2DAs.insert( TwoDANameMap::value_type( ResourceName, (TwoDAFileReader *) NULL ) );
-		}
+		*BytesRead = BytesToRead;
 
-		return false;
+		return true;
 	}
 
 	//
-	// If we cached this .2DA as not present, fail all attempts to access it.
-	//
-
-	if (it->second.get( ) == NULL)
-		return false;
-
-	//
-	// Delegate the request to the actual .2DA reader implementation.
+	// Delegate the request to the underlying accessor's implementation.
 	//
 
-	try
-	{
-		return it->second->Get2DAString( Column, Row, Value );
-	}
-	catch (std::exception &e)
-	{
-		m_TextWriter->WriteText(
-			"WARNING: Failed to retrieve 2DA value '%s'/%lu from '%s': exception '%s'.\n",
-			Column.c_str( ),
-			Row,
-			ResourceName.c_str( ),
-			e.what( ));
+	swutil::ScopedLock Lock( m_AccessorLock );
 
-		return false;
-	}
+	return it->second.Accessor->ReadEncapsulatedFile(
+		it->second.Handle,
+		Offset,
+		BytesToRead,
+		BytesRead,
+		Buffer);
 }
 
-
-void
-ResourceManager::LoadModuleResourcesInternal(
-	__in const std::string & ModuleResName,
-	__in const std::string & AltTlkFileName,
-	__in const std::string & HomeDir,
-	__in const std::string & InstallDir,
-	__in const std::vector< NWN::ResRef32 > & HAKs,
-	__in_opt ModuleLoadParams * LoadParams,
-	__in bool PartialLoadOnly
+bool
+ResourceManager::ReadEncapsulatedFiles(
+	__inout_ecount( Count ) ReadRequest * Requests,
+	__in size_t Count
 	)
 /*++
 
 Routine Description:
 
-	This routine is invoked when all module resources have been downloaded and
-	are available.  It bears responsibility for loading always-load resources
-	such as TLK files, as well as setting up other state necessary for the
-	proper servicing of demand-load requests.
-
-Arguments:
-
-	ModuleResName - Supplies the resource name of the current module.
+	This routine logically reads a batch of ranges of encapsulated sub-files.
 
-	AltTlkFileName - Optionally supplies the name of an alternate tlk file.
-
-	HomeDir - Supplies the game home directory, i.e. Docs\Neverwinter Nights 2.
-
-	InstallDir - Supplies the installation directory of the game.
+	The requests are grouped by the resource provider that backs each file,
+	and each group is then forwarded to its provider as a single batch, so
+	that the provider may order and coalesce the reads against its backing
+	storage.
 
-	HAKs - Supplies the list of HAK files to load.
+Arguments:
 
-	LoadParams - Optionally supplies extended module load parameters, such as
-	             the campaign ID.
+	Requests - Supplies the read requests.  On return, the BytesRead and
+	           Succeeded fields of each request are filled in.
 
-	PartialLoadOnly - Supplies a Boolean value that indicates whether only a
-	                  partial load, enough to pull data out of the module GFF
-	                  resources, should be performed.
+	Count - Supplies the count of read requests.
 
 Return Value:
 
-	The routine raises an std::exception on catastrophic failure.
+	The routine returns a Boolean value indicating true if every request
+	succeeded, else false if any request failed.
 
 Environment:
 
@@ -2107,176 +2134,189 @@ Environment:
 
 --*/
 {
-	std::string Tlk;
-	int         Cp;
+	ProviderReadOrderVec Order;
+	ReadRequestVec       Forwarded;
+	bool                 AllSucceeded;
+	size_t               First;
 
-	CleanDemandLoadedFiles( );
+	AllSucceeded = true;
 
-	m_ModuleResName = ModuleResName;
-	m_HomeDir       = HomeDir;
-	m_InstallDir    = InstallDir;
+	try
+	{
+		Order.reserve( Count );
 
-	//
-	// Ensure that we don't get into DBCS comparisons which gets us a bit more
-	// speed when figuring resrefs via splitpath_s.  Resrefs have a restricted
-	// character set to begin with.
-	//
+		for (size_t i = 0; i < Count; i += 1)
+		{
+			ResHandleMap::const_iterator it;
+			ProviderReadOrder            Position;
 
-	Cp = _getmbcp( );
+			Requests[ i ].BytesRead = 0;
+			Requests[ i ].Succeeded = false;
 
-	_setmbcp( _MB_CP_SBCS );
+			it = m_ResFileHandles.find( Requests[ i ].File );
 
-	if (LoadParams != NULL)
-		m_ResManFlags = LoadParams->ResManFlags;
-	else
-		m_ResManFlags = 0;
+			if (it == m_ResFileHandles.end( ))
+			{
+				AllSucceeded = false;
+				continue;
+			}
 
-	//
-	// If all built-in providers are disabled, set the load module only and
-	// load base resource only flags which turn off everything but directory
-	// loads (which we'll explicitly test for later).
-	//
+			//
+			// Requests against in-memory files are satisfied immediately.
+			//
 
-	if (m_ResManFlags & ResManFlagNoBuiltinProviders)
+			if (it->second.Contents.get( ) != NULL)
+			{
+				Requests[ i ].Succeeded = ReadEncapsulatedFile(
+					Requests[ i ].File,
+					Requests[ i ].Offset,
+					Requests[ i ].BytesToRead,
+					&Requests[ i ].BytesRead,
+					Requests[ i ].Buffer);
+
+				if (!Requests[ i ].Succeeded)
+					AllSucceeded = false;
+
+				continue;
+			}
+
+			Position.Accessor = it->second.Accessor;
+			Position.Handle   = it->second.Handle;
+			Position.Request  = i;
+
+			Order.push_back( Position );
+		}
+
+		std::stable_sort( Order.begin( ), Order.end( ), ProviderReadOrderLess( ) );
+
+		Forwarded.resize( Order.size( ) );
+	}
+	catch (std::exception)
 	{
-		m_ResManFlags |= ResManFlagLoadCoreModuleOnly |
-		                 ResManFlagBaseResourcesOnly;
+		return false;
 	}
 
-	if (m_ResManFlags & ResManFlagLoadCoreModuleOnly)
-		PartialLoadOnly = true;
-
-	ResDebug2(
-		"ResourceManager::LoadModuleResourcesInternal: Beginning resource load of module %s (HomeDir %s, InstallDir %s, AltTlk %s, NumHaks %lu, PartialLoad %lu)...\n",
-		ModuleResName.c_str( ),
-		HomeDir.c_str( ),
-		InstallDir.c_str( ),
-		AltTlkFileName.c_str( ),
-		(unsigned long) HAKs.size( ),
-		PartialLoadOnly ? 1 : 0);
+	//
+	// Translate each request to a request against its provider's handle.
+	//
 
-	try
+	for (size_t i = 0; i < Order.size( ); i += 1)
 	{
-		if (LoadParams != NULL)
-		{
-			LoadCustomResourceProviders(
-				LoadParams->CustomFirstChanceAccessors,
-				LoadParams->NumCustomFirstChanceAccessors,
-				true);
-		}
+		const ReadRequest & Request = Requests[ Order[ i ].Request ];
 
-		//
-		// Load all built-in resource providers.
-		//
+		Forwarded[ i ]           = Request;
+		Forwarded[ i ].File      = Order[ i ].Handle;
+		Forwarded[ i ].BytesRead = 0;
+		Forwarded[ i ].Succeeded = false;
+	}
 
-		if ((m_ResManFlags & ResManFlagBaseResourcesOnly) == 0)
-		{
-			LoadModule(
-				LoadParams != NULL ? LoadParams->SearchOrder : ModSearch_Automatic,
-				LoadParams != NULL ? LoadParams->CustomModuleSourcePath : NULL);
+	//
+	// Now forward each run of requests against the same provider as a batch,
+	// and transfer the results back.
+	//
 
-			if ((LoadParams != NULL) && (LoadParams->CampaignID != NULL))
-				LoadCampaign( *LoadParams->CampaignID, LoadParams->CampaignIDUsed );
+	swutil::ScopedLock Lock( m_AccessorLock );
 
-			if (!PartialLoadOnly)
-			{
-				if (!(m_ResManFlags & ResManFlagErf16))
-					LoadHAKFiles< NWN::ResRef32, TIER_ENCAPSULATED >( HAKs );
-				else
-					LoadHAKFiles< NWN::ResRef16, TIER_ENCAPSULAT16 >( HAKs );
-			}
-		}
+	for (First = 0; First < Order.size( ); )
+	{
+		size_t Last;
 
-		if ((m_ResManFlags & ResManFlagNoBuiltinProviders) == 0)
+		for (Last = First + 1;
+		     (Last < Order.size( )) && (Order[ Last ].Accessor == Order[ First ].Accessor);
+		     Last += 1)
 		{
-			LoadDirectories(
-				LoadParams != NULL ? LoadParams->CustomSearchPath : NULL );
+			NOTHING;
 		}
 
-		if (!PartialLoadOnly)
+		if (!Order[ First ].Accessor->ReadEncapsulatedFiles(
+			&Forwarded[ First ],
+			Last - First))
 		{
-			LoadZipArchives( );
-
-			if (LoadParams != NULL && LoadParams->KeyFiles != NULL)
-				LoadFixedKeyFiles( *LoadParams->KeyFiles );
+			AllSucceeded = false;
 		}
 
-		if (LoadParams != NULL)
+		for (size_t i = First; i < Last; i += 1)
 		{
-			LoadCustomResourceProviders(
-				LoadParams->CustomLastChanceAccessors,
-				LoadParams->NumCustomLastChanceAccessors,
-				false);
+			Requests[ Order[ i ].Request ].BytesRead = Forwarded[ i ].BytesRead;
+			Requests[ Order[ i ].Request ].Succeeded = Forwarded[ i ].Succeeded;
 		}
 
-#if USE_INDEX
-		//
-		// Now, discover and index all resources.
-		//
+		First = Last;
+	}
 
-		DiscoverResources( );
-#endif
+	return AllSucceeded;
+}
 
-		//
-		// Now load talk tables after we've initialized all resources.
-		//
+size_t
+ResourceManager::GetEncapsulatedFileSize(
+	__in FileHandle File
+	)
+/*++
 
-		LoadTalkTables( AltTlkFileName );
+Routine Description:
 
-		//
-		// Attempt to load GR2 support.
-		//
+	This routine returns the size, in bytes, of an encapsulated file.
 
-		if ((m_Gr2Accessor.get( ) == NULL) &&
-		    (!(m_ResManFlags & ResManFlagNoGranny2)))
-		{
-			try
-			{
-				std::string Gr2Path;
+Arguments:
 
-				Gr2Path  = m_InstallDir;
-				Gr2Path += "/granny2.dll";
+	File - Supplies the file handle to query the size of.
 
-				if (_access( Gr2Path.c_str( ), 0 ))
-					Gr2Path = "granny2.dll";
+Return Value:
 
-				m_Gr2Accessor = new Gr2Accessor( Gr2Path, m_TempPath );
-			}
-			catch (std::exception &e)
-			{
-				m_TextWriter->WriteText(
-					"WARNING: Exception '%s' loading granny2.  Model skeletons will be unavailable.\n",
-					e.what( ));
-			}
-		}
-	}
-	catch (...)
-	{
-		_setmbcp( Cp );
-		throw;
-	}
+	The routine returns the size of the given file.  If a valid file handle is
+	supplied, then the routine never fails.
 
-	_setmbcp( Cp );
+	Should an illegal file handle be supplied, the routine returns zero.  There
+	is no way to distinguish this condition from legal file handle to a file
+	with zero length.  Only a serious programming error results in a caller
+	supplying an illegal file handle.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	ResHandleMap::const_iterator it = m_ResFileHandles.find( File );
+
+	if (it == m_ResFileHandles.end( ))
+		return 0;
+
+	if (it->second.Contents.get( ) != NULL)
+		return it->second.Contents->GetSize( );
+
+	//
+	// Delegate the request to the underlying accessor's implementation.
+	//
+
+	swutil::ScopedLock Lock( m_AccessorLock );
+
+	return it->second.Accessor->GetEncapsulatedFileSize( it->second.Handle );
 }
 
-template< typename ResRefLoadType, const size_t LoadTier >
-void
-ResourceManager::LoadHAKFiles(
-	__in const std::vector< NWN::ResRef32 > & HAKs
+ResourceManager::ResType
+ResourceManager::GetEncapsulatedFileType(
+	__in FileHandle File
 	)
 /*++
 
 Routine Description:
 
-	This routine loads module HAK files.
+	This routine returns the type of an encapsulated file.
 
 Arguments:
 
-	HAKs - Supplies the list of HAK files to load.
+	File - Supplies the file handle to query the size of.
 
 Return Value:
 
-	None.  Raises an std::exception on failure.
+	The routine returns the type of the given file.  If a valid file handle is
+	supplied, then the routine never fails.
+
+	Should an illegal file handle be supplied, the routine returns ResINVALID.
+	There is no way to distinguish this condition from legal file handle to a
+	file of type ResINVALID.  Only a serious programming error results in a
+	caller supplying an illegal file handle.
 
 Environment:
 
@@ -2284,107 +2324,118 @@ Environment:
 
 --*/
 {
-	typedef swutil::SharedPtr< typename ::ErfFileReader< typename ResRefLoadType > > ErfFileReaderPtr;
-	typedef std::vector< typename ErfFileReaderPtr > HakVecType;
+	ResHandleMap::const_iterator it = m_ResFileHandles.find( File );
 
-	HakVecType & HakFiles = GetHakFiles< ResRefLoadType >( );
+	if (it == m_ResFileHandles.end( ))
+		return NWN::ResINVALID;
 
-#if defined(RES_DEBUG) && RES_DEBUG >= 1
-	ULONG TimeSpent;
+	return it->second.Type;
+}
 
-	TimeSpent = GetTickCount( );
-#endif
+bool
+ResourceManager::GetEncapsulatedFileEntry(
+	__in FileId FileIndex,
+	__out ResRefT & ResRef,
+	__out ResType & Type
+	)
+/*++
 
-	HakFiles.reserve( HakFiles.size( ) + HAKs.size( ) );
-	m_ResourceFiles[ LoadTier ].reserve(
-		m_ResourceFiles[ LoadTier ].size( ) + HAKs.size( ) );
+Routine Description:
 
-	for (std::vector< NWN::ResRef32 >::const_reverse_iterator it = HAKs.rbegin( );
-	     it != HAKs.rend( );
-	     ++it)
-	{
-		try
-		{
-			std::string      HAKFile;
-			std::string      HAKPath;
-			ErfFileReaderPtr HAK;
+	This routine reads an encapsulated file directory entry, returning the name
+	and type of a particular resource.  The enumeration is stable across calls.
 
-			HAKFile = StrFromResRef( *it );
+Arguments:
 
-			CheckResFileName( HAKFile );
+	FileIndex - Supplies the index into the logical directory entry to reutrn.
 
-			for (size_t Pass = 0; Pass < 2; Pass += 1)
-			{
-				if (Pass == 0)
-					HAKPath = m_HomeDir;
-				else
-					HAKPath = m_InstallDir;
+	ResRef - Receives the resource name.
 
-				HAKPath += "/HAK/";
-				HAKPath += HAKFile;
-				HAKPath += ".hak";
+	Type - Receives the resource type.
 
-				if ((Pass == 0) && _access( HAKPath.c_str( ), 00 ))
-					continue;
+Return Value:
 
-				ResDebug2(
-					"ResourceManager::LoadHAKFiles: Loading HAK '%s'...\n",
-					HAKPath.c_str( ));
+	The routine returns a Boolean value indicating success or failure.  The
+	routine always succeeds as long as the caller provides a legal file index.
 
-				//
-				// Load it up.
-				//
+Environment:
+
+	User mode.
 
-				HAK = new ::ErfFileReader< ResRefLoadType >( HAKPath );
+--*/
+{
+	IResourceAccessor * Accessor;
 
-				HakFiles.push_back( HAK );
-				m_ResourceFiles[ LoadTier ].push_back( HAK.get( ) );
-				break;
-			}
-		}
-		catch (std::exception &e)
-		{
-			m_TextWriter->WriteText(
-				"WARNING: Failed to load HAK file '%.32s' (exception '%s').  Certain module resources may be unavailable.\n",
-				it->RefStr,
-				e.what( ));
-		}
-	}
+	if ((size_t) FileIndex >= m_ResourceEntries.size( ))
+		return false;
 
-#if defined(RES_DEBUG) && RES_DEBUG >= 1
-	m_TextWriter->WriteText( "HAK: %lu\n", GetTickCount( ) - TimeSpent );
-#endif
+	Accessor = m_ResourceEntries[ (size_t) FileIndex ].Accessor;
+
+	//
+	// An entry whose resource was removed by a directory refresh no longer
+	// names a resource.
+	//
+
+	if (Accessor == NULL)
+		return false;
+
+	swutil::ScopedLock Lock( m_AccessorLock );
+
+	return Accessor->GetEncapsulatedFileEntry(
+		m_ResourceEntries[ (size_t) FileIndex ].FileIndex,
+		ResRef,
+		Type);
 }
 
-void
-ResourceManager::LoadModule(
-	__in ModuleSearchOrder SearchOrder,
-	__in_opt const char * CustomModuleSourcePath
+ResourceManager::FileId
+ResourceManager::GetEncapsulatedFileCount(
 	)
 /*++
 
 Routine Description:
 
-	This routine registers module resources in the resource manager.
+	This routine returns the count of files in this resource accessor.  The
+	highest valid file index is the returned count minus one, unless there are
+	zero files, in which case no file index values are legal.
 
 Arguments:
 
-	SearchOrder - Supplies the module search order.  Legal values are drawn from
-	              the ModuleSearchOrder enumeration.
+	None.
 
-	              ModSearch_Automatic - Try encapsulated, then directory.
+Return Value:
 
-	              ModSearch_PrefDirectory - Prefer directory modules.
+	The routine returns the count of files present.
 
-	              ModSearch_PrefEncapsulated - Prefer encapsulated modules.
+Environment:
 
-	CustomModuleSourcePath - Optionally supplies a custom search path for the
-	                         module.  If provided, the default search logic is
-	                         overridden.
+	User mode.
+
+--*/
+{
+	return m_ResourceEntries.size( );
+}
+
+ResourceManager::AccessorType
+ResourceManager::GetResourceAccessorName(
+	__in FileHandle File,
+	__out std::string & AccessorName
+	)
+/*++
+
+Routine Description:
+
+	This routine returns the logical name of the resource accessor.
+
+Arguments:
+
+	File - Supplies the file handle to inquire about.
+
+	AccessorName - Receives the logical name of the resource accessor.
 
 Return Value:
 
-	None.  Raises an std::exception on failure.
+	The routine returns the accessor type.  An std::exception is raised on
+	failure.
 
 Environment:
 
@@ -2392,220 +2443,222 @@ Environment:
 
 --*/
 {
-	try
+	ResHandleMap::const_iterator it;
+
+	if (File == INVALID_FILE)
 	{
-		std::string ModulePath;
+		AccessorName = "Resource Manager";
+		return AccessorTypeResourceManager;
+	}
 
-		CheckResFileName( m_ModuleResName );
+	it = m_ResFileHandles.find( File );
 
-		ResDebug2(
-			"ResourceManager::LoadModule: Beginning module search (search order = %lu)...\n",
-			(unsigned long) SearchOrder );
+	if (it == m_ResFileHandles.end( ))
+		throw std::runtime_error( "invalid file handle passed to ResourceManager::GetResourceAccessorName" );
 
-		//
-		// If we have an override custom module source location, then load the
-		// module directly from there.  The location is a full path and not a
-		// resource name.
-		//
+	//
+	// Delegate the request to the underlying accessor's implementation.
+	//
+	// N.B.  An in-memory file has no accessor handle, so the accessor reports
+	//       its own name rather than that of the specific file (which only
+	//       differs for KEY files, where the BIF file name is reported).
+	//
 
-		if (CustomModuleSourcePath != NULL)
-		{
-			struct _stat s;
+	swutil::ScopedLock Lock( m_AccessorLock );
 
-			ResDebug2(
-				"ResourceManager::LoadModule: Using custom module source path '%s'.\n",
-				CustomModuleSourcePath );
+	return it->second.Accessor->GetResourceAccessorName(
+			it->second.Handle,
+			AccessorName);
+}
 
-			if ((_stat( CustomModuleSourcePath, &s ) == 0) &&
-			    (s.st_mode & _S_IFDIR))
-			{
-				DirectoryFileReaderPtr ModuleRes;
+bool
+ResourceManager::GetEncapsulatedFileMapping(
+	__in FileHandle File,
+	__out HANDLE * BackingFile,
+	__out ULONG64 * BackingFileOffset
+	)
+/*++
 
-				ResDebug2(
-					"ResourceManager::LoadModule: Using custom directory '%s'.\n",
-					CustomModuleSourcePath );
+Routine Description:
 
-				if (!CheckModuleIfo( CustomModuleSourcePath, false ))
-				{
-					throw std::runtime_error(
-							std::string( "No module.ifo in " ) +
-							CustomModuleSourcePath );
-				}
+	This routine returns the backing file handle and file offset of an
+	encapsulated file so that the caller may map the file contents directly.
 
-				ModuleRes  = new DirectoryFileReader( CustomModuleSourcePath );
+Arguments:
 
-				m_DirFiles.push_back( ModuleRes );
-				m_ResourceFiles[ TIER_DIRECTORY ].push_back( ModuleRes.get( ) );
-			}
-			else
-			{
-				ResDebug2(
-					"ResourceManager::LoadModule: Using custom ERF '%s'.\n",
-					CustomModuleSourcePath );
+	File - Supplies the file handle to inquire about.
 
-				if (!CheckModuleIfo( CustomModuleSourcePath, true ))
-				{
-					throw std::runtime_error(
-							std::string( "No module.ifo in " ) +
-							CustomModuleSourcePath );
-				}
+	BackingFile - Receives the backing file handle.  The handle remains owned
+	              by the underlying resource accessor.
 
-				LoadEncapsulatedFile( CustomModuleSourcePath );
-			}
+	BackingFileOffset - Receives the offset of the encapsulated file's data
+	                    within the backing file.
 
-			return;
-		}
+Return Value:
 
-		//
-		// Use two passes.  For the first, we'll go with the home directory
-		// instead of the install directory, searching that 'Modules' and 'PWC'
-		// directory set.  Priority is given to the home directory.
-		//
+	The routine returns a Boolean value indicating true on success, else false
+	if the underlying resource accessor cannot supply a direct mapping.
 
-		for (size_t i = 0; i < 2; i += 1)
-		{
-			bool UseHome;
+Environment:
 
-			UseHome = (i == 0);
+	User mode.
 
-			ResDebug2(
-				"ResourceManager::LoadModule: Searching for module in %s...\n",
-				UseHome ? "home directory" : "install directory");
+--*/
+{
+	ResHandleMap::const_iterator it = m_ResFileHandles.find( File );
 
-			//
-			// Try it as an ERF (.mod) first.
-			//
+	if ((it == m_ResFileHandles.end( )) ||
+	    (it->second.Contents.get( ) != NULL))
+	{
+		*BackingFile       = INVALID_HANDLE_VALUE;
+		*BackingFileOffset = 0;
 
-			ModulePath = GetModulePath( false, UseHome );
+		return false;
+	}
 
-			if ((SearchOrder == ModSearch_PrefDirectory) ||
-			    (_access( ModulePath.c_str( ), 00 ))     ||
-			    (!CheckModuleIfo( ModulePath, true )))
-			{
-				//
-				// Try as a PWC next.
-				//
+	//
+	// Delegate the request to the underlying accessor's implementation.
+	//
 
-				std::string PWCName;
+	swutil::ScopedLock Lock( m_AccessorLock );
 
-				PWCName  = "pwc/";
-				PWCName += m_ModuleResName;
-				PWCName += ".pwc";
+	return it->second.Accessor->GetEncapsulatedFileMapping(
+		it->second.Handle,
+		BackingFile,
+		BackingFileOffset);
+}
 
-				ModulePath = GetResourceFilePath( PWCName );
+template< typename ResRefType >
+void
+ResourceManager::LoadEncapsulatedFile(
+	__in IResourceAccessor< ResRefType > * Accessor,
+	__in typename IResourceAccessor< ResRefType >::FileId FileIndex,
+	__out std::vector< unsigned char > & FileContents
+	)
+/*++
 
-				if ((SearchOrder == ModSearch_PrefDirectory) ||
-				    (_access( ModulePath.c_str( ), 00 ))     ||
-				    (!CheckModuleIfo( ModulePath, true )))
-				{
-					DirectoryFileReaderPtr ModuleRes;
+Routine Description:
 
-					//
-					// Doesn't exist?  Try as a directory.
-					//
+	This helper routine loads a file from a resource accessor into an
+	std::vector.  The entire file is loaded at once.
 
-					ModulePath = GetModulePath( true, UseHome );
+Arguments:
 
-					if ((SearchOrder == ModSearch_PrefEncapsulated) ||
-					    (_access( ModulePath.c_str( ), 00 ))        ||
-					    (!CheckModuleIfo( ModulePath, false )))
-					{
-						continue;
-					}
+	Accessor - Supplies the resource accessor instance to open the file from.
 
-					ResDebug2(
-						"ResourceManager::LoadModule: Found module directory '%s'.\n",
-						ModulePath.c_str( ));
+	FileIndex - Supplies the index of the file in the resource accessor that is
+	            to be loaded.
 
-					ModuleRes  = new DirectoryFileReader( ModulePath );
+	FileContents - Receives the loaded contents of the file.
 
-					m_DirFiles.push_back( ModuleRes );
-					m_ResourceFiles[ TIER_DIRECTORY ].push_back( ModuleRes.get( ) );
-					return;
-				}
-			}
+Return Value:
 
-			ResDebug2(
-				"ResourceManager::LoadModule: Found module ERF file '%s'.\n",
-				ModulePath.c_str( ));
+	None.  On failure, an std::exception is raised.
 
-			//
-			// We've got a .mod or a .pwc, both of which are ERFs that include the
-			// necessary client files.  Load them up.
-			//
+Environment:
 
-			LoadEncapsulatedFile( ModulePath );
-			return;
-		}
+	User mode.
 
-		//
-		// If we failed completely to find a module, try automatic searching as a
-		// next resort.
-		//
+--*/
+{
+	IResourceAccessor< ResRefType >::FileHandle   Handle;
+	size_t                                        FileSize;
+	size_t                                        BytesLeft;
+	size_t                                        Offset;
+	size_t                                        Read;
 
-		if (SearchOrder != ModSearch_Automatic)
-			return LoadModule( ModSearch_Automatic, CustomModuleSourcePath );
+	//
+	// Open the file via the resource system.
+	//
 
-		//
-		// Finally, try as a NWM (legacy campaign module), should all else
-		// fail.
-		//
+	Handle = Accessor->OpenFileByIndex( FileIndex );
 
-		ModulePath = GetModuleNWMPath( );
+	if (Handle == IResourceAccessor< ResRefType >::INVALID_FILE)
+		throw std::runtime_error( "OpenFileByIndex failed." );
 
-		if ((!_access( ModulePath.c_str( ), 00 )) &&
-		    (CheckModuleIfo( ModulePath, true )))
+	//
+	// Read the whole contents into memory up front.
+	//
+
+	FileSize = Accessor->GetEncapsulatedFileSize( Handle );
+
+	try
+	{
+		if (FileSize != 0)
 		{
-			ResDebug2(
-				"ResourceManager::LoadModule: Found module NWM ERF file '%s'.\n",
-				ModulePath.c_str( ));
+			FileContents.resize( FileSize );
 
-			//
-			// We've got a .nwm, which is a .ERF that includes the necessary
-			// client files.  Load them up.
-			//
+			BytesLeft = FileSize;
+			Offset    = 0;
 
-			LoadEncapsulatedFile( ModulePath );
-			return;
-		}
+			while (BytesLeft != 0)
+			{
+				if (!Accessor->ReadEncapsulatedFile(
+					Handle,
+					Offset,
+					BytesLeft,
+					&Read,
+					&FileContents[ Offset ]))
+				{
+					throw std::runtime_error( "ReadEncapsulatedFile failed." );
+				}
 
-		throw std::runtime_error( "Couldn't locate module file." );
+				if (Read == 0)
+					throw std::runtime_error( "Read zero bytes." );
+
+				Offset    += Read;
+				BytesLeft -= Read;
+			}
+		}
+		else
+		{
+			FileContents.clear( );
+		}
 	}
-	catch (std::exception &e)
+	catch (std::exception)
 	{
-		m_TextWriter->WriteText(
-			"WARNING: Exception '%s' loading module resources.  The area map may not function.\n",
-			e.what( ) );
+		Accessor->CloseFile( Handle );
 
-		if (m_ResManFlags & ResManFlagRequireModuleIfo)
-			throw;
+		throw;
 	}
+
+	//
+	// Close the file out and we're done.
+	//
+
+	Accessor->CloseFile( Handle );
 }
 
+template< typename ResRefType >
 void
-ResourceManager::LoadCampaign(
-	__in const GUID & CampaignID,
-	__out GUID & CampaignIDUsed
+ResourceManager::LoadEncapsulatedFiles(
+	__in IResourceAccessor< ResRefType > * Accessor,
+	__in size_t Count,
+	__in_ecount( Count ) const typename IResourceAccessor< ResRefType >::FileId * FileIndicies,
+	__out_ecount( Count ) std::vector< unsigned char > * FileContents
 	)
 /*++
 
 Routine Description:
 
-	This routine registers campaign resources in the resource manager.
-
-	Not all modules have an associated campaign.
+	This helper routine loads a batch of files from a resource accessor into
+	std::vectors.  All of the files are opened, read with a single batched
+	read request, and then closed.
 
 Arguments:
 
-	CampaignID - Supplies the campaign ID of the campaign to load.
+	Accessor - Supplies the resource accessor instance to open the files from.
 
-	CampaignIDUsed - Receives the ID of the campaign that was actually loaded.
-	                 Generally, this is the input campaign ID, unless there was
-	                 no matching GUID (in which case the default ID is used).
+	Count - Supplies the count of files to load.
+
+	FileIndicies - Supplies the indicies of the files in the resource accessor
+	               that are to be loaded.
+
+	FileContents - Receives the loaded contents of each file.
 
 Return Value:
 
-	None.  Raises an std::exception on failure.
+	None.  On failure, an std::exception is raised.
 
 Environment:
 
@@ -2613,221 +2666,191 @@ Environment:
 
 --*/
 {
-	HANDLE Find;
+	typedef IResourceAccessor< ResRefType > Accessor_t;
 
-	Find = INVALID_HANDLE_VALUE;
+	std::vector< typename Accessor_t::ReadRequest > Requests;
+	bool                                            Succeeded;
 
-	//
-	// Set to the default campaign ID first.  If we then find a matching
-	// campaign, we return the real ID.
-	//
+	Requests.resize( Count );
 
-	ZeroMemory( &CampaignIDUsed, sizeof( CampaignIDUsed ) );
-	memcpy( &CampaignIDUsed, "AdHocGUID", 9 );
+	for (size_t i = 0; i < Count; i += 1)
+		Requests[ i ].File = Accessor_t::INVALID_FILE;
 
 	try
 	{
-		std::string CampaignPath;
-		ResRefT     ResRef;
-		ResType     Type;
-
 		//
-		// Use two passes.  For the first, we'll go with the home directory
-		// instead of the install directory.  Then we'll try the install
-		// directory.
+		// Open each file and size its buffer.
 		//
 
-		for (size_t i = 0; i < 2; i += 1)
+		for (size_t i = 0; i < Count; i += 1)
 		{
-			bool              UseHome;
-			FileId            ResourceCount;
-			WIN32_FIND_DATAA  FindData;
-			std::string       SearchedPath;
+			size_t FileSize;
 
-			UseHome = (i == 0);
+			Requests[ i ].File = Accessor->OpenFileByIndex( FileIndicies[ i ] );
 
-			ResDebug2(
-				"ResourceManager::LoadCampaign: Searching for campaign in %s...\n",
-				UseHome ? "home directory" : "install directory");
+			if (Requests[ i ].File == Accessor_t::INVALID_FILE)
+				throw std::runtime_error( "OpenFileByIndex failed." );
 
-			//
-			// Try and find a campaign that matches our campaign ID.  We sweep
-			// all directories in the campaigns directory for one with a .cam
-			// resource and then choose the first matching one for our campaign
-			// resource directory.
-			//
+			FileSize = Accessor->GetEncapsulatedFileSize( Requests[ i ].File );
 
-			CampaignPath  = GetCampaignPath( UseHome );
-			SearchedPath  = CampaignPath;
-			SearchedPath += "*.";
-
-			do
-			{
-				if ((!strcmp( FindData.cFileName, "." )) ||
-					 (!strcmp( FindData.cFileName, ".." )))
-					continue;
+			FileContents[ i ].resize( FileSize );
 
-				if (!(FindData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
-					continue;
+			Requests[ i ].Offset      = 0;
+			Requests[ i ].BytesToRead = FileSize;
+			Requests[ i ].Buffer      = FileSize ? &FileContents[ i ][ 0 ] : NULL;
+			Requests[ i ].BytesRead   = 0;
+			Requests[ i ].Succeeded   = false;
+		}
 
-				DirectoryFileReaderPtr CampaignSearcher;
+		//
+		// Read all of the files in one batch.  Empty files have nothing to
+		// read, and are not submitted (a read at offset zero of an empty
+		// file fails).
+		//
 
-				//
-				// We have a directory to search.  Inventory all subdirectories
-				// for a ResCAM type file and pull IDs out until we find one
-				// that matches (or we reach the end).
-				//
+		Succeeded = true;
 
-				SearchedPath     = CampaignPath + FindData.cFileName;
-				CampaignSearcher = new DirectoryFileReader( SearchedPath );
-				ResourceCount    = CampaignSearcher->GetEncapsulatedFileCount( );
+		{
+			std::vector< typename Accessor_t::ReadRequest > Batch;
+			std::vector< size_t >                           BatchIndex;
 
-				for (FileId CurId = ResourceCount; CurId != 0; CurId -= 1)
-				{
-					//
-					// Get the resource name and type at this index.
-					//
+			for (size_t i = 0; i < Count; i += 1)
+			{
+				if (Requests[ i ].BytesToRead == 0)
+					continue;
 
-					if (!CampaignSearcher->GetEncapsulatedFileEntry(
-						CurId - 1,
-						ResRef,
-						Type))
-					{
-						//
-						// It might be an unrecognized type, ignore it if so.
-						//
-						continue;
-					}
+				Batch.push_back( Requests[ i ] );
+				BatchIndex.push_back( i );
+			}
 
-					//
-					// We are only searching for campaign descriptor files.
-					//
+			if ((!Batch.empty( )) &&
+			    (!Accessor->ReadEncapsulatedFiles( &Batch[ 0 ], Batch.size( ) )))
+			{
+				Succeeded = false;
+			}
 
-					if (Type != NWN::ResCAM)
-						continue;
+			for (size_t i = 0; i < Batch.size( ); i += 1)
+			{
+				if (Batch[ i ].BytesRead != Batch[ i ].BytesToRead)
+					Succeeded = false;
+			}
+		}
 
-					//
-					// We only want actual campaign.cam files.
-					//
+		if (!Succeeded)
+			throw std::runtime_error( "ReadEncapsulatedFiles failed." );
+	}
+	catch (std::exception)
+	{
+		for (size_t i = 0; i < Count; i += 1)
+		{
+			if (Requests[ i ].File != Accessor_t::INVALID_FILE)
+				Accessor->CloseFile( Requests[ i ].File );
+		}
 
-					if (memcmp( &ResRef, "campaign", 8 ))
-						continue;
+		throw;
+	}
 
-					ResDebug2(
-						"ResourceManager::LoadCampaign: Found campaign.cam (%s).\n",
-						CampaignSearcher->GetRealFileName( CurId - 1 ).c_str( ));
+	//
+	// Close the files out and we're done.
+	//
 
-					//
-					// We have a campaign.cam file, check that the GUID matches.
-					//
+	for (size_t i = 0; i < Count; i += 1)
+		Accessor->CloseFile( Requests[ i ].File );
+}
 
-					try
-					{
-						std::vector< unsigned char > ID;
-						GffFileReader                Campaign(
-							CampaignSearcher->GetRealFileName( CurId - 1 ),
-							*this);
+bool
+ResourceManager::GetTalkString(
+	__in unsigned long StringId,
+	__out std::string & String
+	) const
+/*++
 
-						if (!Campaign.GetRootStruct( )->GetVOID( "GUID", ID ))
-							throw std::runtime_error( "Failed to read GUID." );
+Routine Description:
 
-						if (ID.size( ) != sizeof( CampaignID ))
-							throw std::runtime_error( "Malformed GUID." );
+	This routine retrieves a localized string from the string tables.
 
-						if (!memcmp( &ID[ 0 ], &CampaignID, sizeof( CampaignID ) ))
-						{
-							//
-							// We've found our one.  Register it with the
-							// resource search system and return the ID back to
-							// the caller to let them know which campaign was
-							// in use.
-							//
+Arguments:
 
-							m_DirFiles.push_back( CampaignSearcher );
-							m_ResourceFiles[ TIER_DIRECTORY ].push_back(
-								CampaignSearcher.get( ) );
+	StringId - Supplies the STRREF to look up.
 
-							CampaignIDUsed = CampaignID;
+	String - Receives the localized string, on success.
 
-							FindClose( Find );
-							Find = INVALID_HANDLE_VALUE;
+Return Value:
 
-							return;
-						}
-					}
-					catch (std::exception &e)
-					{
-						m_TextWriter->WriteText(
-							"WARNING: Failed to process campaign (FileId #%I64lu) in '%s': '%s'.\n",
-							CurId,
-							SearchedPath.c_str( ),
-							e.what( ));
-					}
-				}
+	The routine returns a Boolean value indicating whether the string could be
+	successfully located or not.
+	
+	On catastrophic failure, the routine raises an std::exception.
 
-				//
-				// "These are not the campaigns that you are looking for."
-				//
-				// Search the next directory if we had one.
-				//
+Environment:
 
-			} while (FindNextFileA( Find, &FindData ));
+	User mode.
 
-			//
-			// Try the next directory hierarchy (i.e. the install directory).
-			//
-		}
+--*/
+{
+	unsigned long RefId;
 
-		//
-		// No campaign can be found.  This is acceptable as modules may be
-		// created without any campaign linkage in effect.
-		//
-	}
-	catch (std::exception &e)
+	if (StringId == STRREF_INVALID)
 	{
-		m_TextWriter->WriteText(
-			"WARNING: Exception '%s' loading campaign resources.\n",
-			e.what( ) );
+		String = "";
+		return true;
 	}
-	catch (...)
+
+	RefId = (StringId & STRREF_IDMASK);
+
+	//
+	// If requested, try the alternate table first.
+	//
+
+	if (StringId & STRREF_TABLEMASK)
 	{
-		if (Find != INVALID_HANDLE_VALUE)
+		if ((m_AlternateTlk.get( ) != NULL) &&
+		    (m_AlternateTlk->GetTalkString( RefId, String )))
 		{
-			FindClose( Find );
-			Find = INVALID_HANDLE_VALUE;
+			return true;
 		}
-
-		throw;
 	}
 
-	if (Find != INVALID_HANDLE_VALUE)
+	//
+	// Always fall back to the base table if we've found nothing so far.
+	//
+
+	if ((m_BaseTlk.get( ) != NULL) &&
+	    (m_BaseTlk->GetTalkString( RefId, String )))
 	{
-		FindClose( Find );
-		Find = INVALID_HANDLE_VALUE;
+		return true;
 	}
+
+	return false;
 }
 
-void
-ResourceManager::LoadDirectories(
-	__in_opt const char * CustomSearchPath
-	)
+size_t
+ResourceManager::GetTalkStrings(
+	__in size_t Count,
+	__in_ecount( Count ) const unsigned long * StringIds,
+	__out_ecount( Count ) std::string * Strings
+	) const
 /*++
 
 Routine Description:
 
-	This routine registers other predefined directories with the resource
-	management system.
+	This routine retrieves a batch of localized strings from the string
+	tables.  Each string is resolved as per GetTalkString.
 
 Arguments:
 
-	CustomSearchPath - Optionally supplies a path to a custom location that is
-	                   searched first ahead of the standard directories, e.g to
-	                   provide custom implementation-specific resources that
-	                   are to be exposed via the standard resource system.
+	Count - Supplies the count of STRREFs to look up.
+
+	StringIds - Supplies the STRREFs to look up.
+
+	Strings - Receives the localized strings.  Strings that could not be
+	          located are returned empty.
 
 Return Value:
 
-	None.  Raises an std::exception on failure.
+	The routine returns the count of strings that were located.
+
+	On catastrophic failure, the routine raises an std::exception.
 
 Environment:
 
@@ -2835,83 +2858,2567 @@ Environment:
 
 --*/
 {
-	DirectoryFileReaderPtr   DirFile;
-	std::string              DirName;
-	const char             * ResDirs[ ] =
-	{
-		"pwc",
-		"override"
-	};
+	size_t Found;
 
-	m_DirFiles.reserve(
-		m_DirFiles.size( ) + sizeof( ResDirs ) / sizeof( ResDirs[ 0 ] ) + 1 );
-	m_ResourceFiles[ TIER_DIRECTORY ].reserve(
-		m_ResourceFiles[ TIER_DIRECTORY ].size( ) + sizeof( ResDirs ) / sizeof( ResDirs[ 0 ] ) + 1 );
+	Found = 0;
 
-	if (ARGUMENT_PRESENT( CustomSearchPath ))
+	for (size_t i = 0; i < Count; i += 1)
 	{
-		DirName  = CustomSearchPath;
-		DirName += "/";
+		if (GetTalkString( StringIds[ i ], Strings[ i ] ))
+			Found += 1;
+		else
+			Strings[ i ].clear( );
+	}
 
-		ResDebug2(
-			"ResourceManager::LoadDirectories: Adding custom directory '%s'.\n",
-			DirName.c_str( ));
+	return Found;
+}
 
-		DirFile = new DirectoryFileReader( DirName );
+bool
+ResourceManager::Get2DAString(
+	__in const std::string & ResourceName,
+	__in const std::string & Column,
+	__in size_t Row,
+	__out std::string & Value
+	)
+/*++
 
-		m_DirFiles.push_back( DirFile );
-		m_ResourceFiles[ TIER_DIRECTORY ].push_back( DirFile.get( ) );
-	}
+Routine Description:
 
-	for (size_t i = 0;
-	     i < sizeof( ResDirs ) / sizeof( ResDirs[ 0 ] );
-	     i += 1)
-	{
-		DirName  = m_HomeDir;
-		DirName += "/";
-		DirName += ResDirs[ i ];
+	This routine fetches the string value of a column at a particular row index
+	into the given 2DA file.
 
-		ResDebug2(
-			"ResourceManager::LoadDirectories: Adding home-based directory '%s'.\n",
-			DirName.c_str( ));
+Arguments:
 
-		DirFile = new DirectoryFileReader( DirName );
+	ResourceName - Supplies the RESREF identifier of the .2DA to read.
 
-		m_DirFiles.push_back( DirFile );
-		m_ResourceFiles[ TIER_DIRECTORY ].push_back( DirFile.get( ) );
+	Column - Supplies the column name to look up.
 
-		DirName  = m_InstallDir;
-		DirName += "/";
-		DirName += ResDirs[ i ];
+	Row - Supplies the row index to pull the column from.
 
-		ResDebug2(
-			"ResourceManager::LoadDirectories: Adding install-based directory '%s'.\n",
-			DirName.c_str( ));
+	Value - Receives the string contents of the particular row.
+
+Return Value:
+
+	The routine returns a Boolean value indicating true on success, else false
+	on failure (i.e. unknown string).  On catastrophic failure, an
+	std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	const TwoDAFileReader * Reader;
+
+	Reader = Get2DA( ResourceName );
+
+	if (Reader == NULL)
+		return false;
+
+	//
+	// Delegate the request to the actual .2DA reader implementation.
+	//
+
+	try
+	{
+		return Reader->Get2DAString( Column, Row, Value );
+	}
+	catch (std::exception &e)
+	{
+		m_TextWriter->WriteText(
+			"WARNING: Failed to retrieve 2DA value '%s'/%lu from '%s': exception '%s'.\n",
+			Column.c_str( ),
+			Row,
+			ResourceName.c_str( ),
+			e.what( ));
+
+		return false;
+	}
+}
+
+
+void
+ResourceManager::LoadModuleResourcesInternal(
+	__in const std::string & ModuleResName,
+	__in const std::string & AltTlkFileName,
+	__in const std::string & HomeDir,
+	__in const std::string & InstallDir,
+	__in const std::vector< NWN::ResRef32 > & HAKs,
+	__in_opt ModuleLoadParams * LoadParams,
+	__in bool PartialLoadOnly
+	)
+/*++
+
+Routine Description:
+
+	This routine is invoked when all module resources have been downloaded and
+	are available.  It bears responsibility for loading always-load resources
+	such as TLK files, as well as setting up other state necessary for the
+	proper servicing of demand-load requests.
+
+Arguments:
+
+	ModuleResName - Supplies the resource name of the current module.
+
+	AltTlkFileName - Optionally supplies the name of an alternate tlk file.
+
+	HomeDir - Supplies the game home directory, i.e. Docs\Neverwinter Nights 2.
+
+	InstallDir - Supplies the installation directory of the game.
+
+	HAKs - Supplies the list of HAK files to load.
+
+	LoadParams - Optionally supplies extended module load parameters, such as
+	             the campaign ID.
+
+	PartialLoadOnly - Supplies a Boolean value that indicates whether only a
+	                  partial load, enough to pull data out of the module GFF
+	                  resources, should be performed.
+
+Return Value:
+
+	The routine raises an std::exception on catastrophic failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	std::string Tlk;
+	int         Cp;
+	bool        UseIndexCache;
+
+	CleanDemandLoadedFiles( );
+
+	m_ProviderLoads.clear( );
+
+	m_ModuleResName = ModuleResName;
+	m_HomeDir       = HomeDir;
+	m_InstallDir    = InstallDir;
+
+	//
+	// Ensure that we don't get into DBCS comparisons which gets us a bit more
+	// speed when figuring resrefs via splitpath_s.  Resrefs have a restricted
+	// character set to begin with.
+	//
+
+	Cp = _getmbcp( );
+
+	_setmbcp( _MB_CP_SBCS );
+
+	if (LoadParams != NULL)
+		m_ResManFlags = LoadParams->ResManFlags;
+	else
+		m_ResManFlags = 0;
+
+	//
+	// If all built-in providers are disabled, set the load module only and
+	// load base resource only flags which turn off everything but directory
+	// loads (which we'll explicitly test for later).
+	//
+
+	if (m_ResManFlags & ResManFlagNoBuiltinProviders)
+	{
+		m_ResManFlags |= ResManFlagLoadCoreModuleOnly |
+		                 ResManFlagBaseResourcesOnly;
+	}
+
+	if (m_ResManFlags & ResManFlagLoadCoreModuleOnly)
+		PartialLoadOnly = true;
+
+	ResDebug2(
+		"ResourceManager::LoadModuleResourcesInternal: Beginning resource load of module %s (HomeDir %s, InstallDir %s, AltTlk %s, NumHaks %lu, PartialLoad %lu)...\n",
+		ModuleResName.c_str( ),
+		HomeDir.c_str( ),
+		InstallDir.c_str( ),
+		AltTlkFileName.c_str( ),
+		(unsigned long) HAKs.size( ),
+		PartialLoadOnly ? 1 : 0);
+
+	try
+	{
+		if (LoadParams != NULL)
+		{
+			LoadCustomResourceProviders(
+				LoadParams->CustomFirstChanceAccessors,
+				LoadParams->NumCustomFirstChanceAccessors,
+				true);
+		}
+
+		//
+		// Unless disabled, map the resource index cache, from which the
+		// directory listings of unchanged .hak files and in-box .zip archives
+		// are drawn.  It is rewritten by LoadQueuedProviders if any of these
+		// providers had to be scanned.
+		//
+
+		UseIndexCache = (!PartialLoadOnly) &&
+		                (!m_IndexCacheFile.empty( )) &&
+		                (!(m_ResManFlags & ResManFlagNoIndexCache));
+
+		if (UseIndexCache)
+		{
+			if (!m_IndexCache.Load( m_IndexCacheFile ))
+			{
+				ResDebug2(
+					"ResourceManager::LoadModuleResourcesInternal: Resource index cache '%s' is unavailable, rebuilding.\n",
+					m_IndexCacheFile.c_str( ));
+			}
+		}
+
+		//
+		// Load all built-in resource providers.
+		//
+
+		if ((m_ResManFlags & ResManFlagBaseResourcesOnly) == 0)
+		{
+			LoadModule(
+				LoadParams != NULL ? LoadParams->SearchOrder : ModSearch_Automatic,
+				LoadParams != NULL ? LoadParams->CustomModuleSourcePath : NULL);
+
+			if ((LoadParams != NULL) && (LoadParams->CampaignID != NULL))
+				LoadCampaign( *LoadParams->CampaignID, LoadParams->CampaignIDUsed );
+
+			if (!PartialLoadOnly)
+			{
+				if (!(m_ResManFlags & ResManFlagErf16))
+					LoadHAKFiles< NWN::ResRef32, TIER_ENCAPSULATED >( HAKs, UseIndexCache );
+				else
+					LoadHAKFiles< NWN::ResRef16, TIER_ENCAPSULAT16 >( HAKs, UseIndexCache );
+			}
+		}
+
+		if ((m_ResManFlags & ResManFlagNoBuiltinProviders) == 0)
+		{
+			LoadDirectories(
+				LoadParams != NULL ? LoadParams->CustomSearchPath : NULL );
+		}
+
+		if (!PartialLoadOnly)
+		{
+			LoadZipArchives( UseIndexCache );
+
+			if (LoadParams != NULL && LoadParams->KeyFiles != NULL)
+				LoadFixedKeyFiles( *LoadParams->KeyFiles );
+		}
+
+		//
+		// The HAK, directory, zip and key routines above only queue their
+		// providers; now actually load them all in parallel and register them
+		// in the canonical order.
+		//
+
+		LoadQueuedProviders( );
+
+		if (LoadParams != NULL)
+		{
+			LoadCustomResourceProviders(
+				LoadParams->CustomLastChanceAccessors,
+				LoadParams->NumCustomLastChanceAccessors,
+				false);
+		}
+
+#if USE_INDEX
+		//
+		// Now, discover and index all resources.
+		//
+
+		DiscoverResources( );
+
+		//
+		// If requested, watch directory providers for changes so that they
+		// may be refreshed incrementally by RefreshDirectoryResources.
+		//
+
+		if (m_ResManFlags & ResManFlagWatchDirectories)
+		{
+			for (DirFileVec::iterator it = m_DirFiles.begin( );
+			     it != m_DirFiles.end( );
+			     ++it)
+			{
+				try
+				{
+					(*it)->EnableChangeWatch( );
+				}
+				catch (std::exception &e)
+				{
+					m_TextWriter->WriteText(
+						"WARNING: Failed to watch directory '%s' for changes: '%s'.\n",
+						(*it)->GetDirectoryName( ).c_str( ),
+						e.what( ));
+				}
+			}
+		}
+#endif
+
+		//
+		// Now load talk tables after we've initialized all resources.
+		//
+
+		LoadTalkTables( AltTlkFileName );
+
+		//
+		// Attempt to load GR2 support.
+		//
+
+		if ((m_Gr2Accessor.get( ) == NULL) &&
+		    (!(m_ResManFlags & ResManFlagNoGranny2)))
+		{
+			try
+			{
+				std::string Gr2Path;
+
+				Gr2Path  = m_InstallDir;
+				Gr2Path += "/granny2.dll";
+
+				if (_access( Gr2Path.c_str( ), 0 ))
+					Gr2Path = "granny2.dll";
+
+				m_Gr2Accessor = new Gr2Accessor( Gr2Path, m_TempPath );
+			}
+			catch (std::exception &e)
+			{
+				m_TextWriter->WriteText(
+					"WARNING: Exception '%s' loading granny2.  Model skeletons will be unavailable.\n",
+					e.what( ));
+			}
+		}
+	}
+	catch (...)
+	{
+		m_ProviderLoads.clear( );
+		m_IndexCache.Unload( );
+
+		_setmbcp( Cp );
+		throw;
+	}
+
+	_setmbcp( Cp );
+}
+
+template< typename ResRefLoadType, const size_t LoadTier >
+void
+ResourceManager::LoadHAKFiles(
+	__in const std::vector< NWN::ResRef32 > & HAKs,
+	__in bool UseIndexCache
+	)
+/*++
+
+Routine Description:
+
+	This routine queues module HAK files for loading by LoadQueuedProviders.
+
+Arguments:
+
+	HAKs - Supplies the list of HAK files to load.
+
+	UseIndexCache - Supplies a Boolean value that indicates whether HAK
+	                directory listings are drawn from, and recorded to, the
+	                resource index cache.
+
+Return Value:
+
+	None.  Raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	typedef swutil::SharedPtr< typename ::ErfFileReader< typename ResRefLoadType > > ErfFileReaderPtr;
+	typedef std::vector< typename ErfFileReaderPtr > HakVecType;
+
+	HakVecType & HakFiles = GetHakFiles< ResRefLoadType >( );
+
+#if defined(RES_DEBUG) && RES_DEBUG >= 1
+	ULONG TimeSpent;
+
+	TimeSpent = GetTickCount( );
+#endif
+
+	HakFiles.reserve( HakFiles.size( ) + HAKs.size( ) );
+	m_ResourceFiles[ LoadTier ].reserve(
+		m_ResourceFiles[ LoadTier ].size( ) + HAKs.size( ) );
+
+	for (std::vector< NWN::ResRef32 >::const_reverse_iterator it = HAKs.rbegin( );
+	     it != HAKs.rend( );
+	     ++it)
+	{
+		try
+		{
+			std::string      HAKFile;
+			std::string      HAKPath;
+
+			HAKFile = StrFromResRef( *it );
+
+			CheckResFileName( HAKFile );
+
+			for (size_t Pass = 0; Pass < 2; Pass += 1)
+			{
+				if (Pass == 0)
+					HAKPath = m_HomeDir;
+				else
+					HAKPath = m_InstallDir;
+
+				HAKPath += "/HAK/";
+				HAKPath += HAKFile;
+				HAKPath += ".hak";
+
+				if ((Pass == 0) && _access( HAKPath.c_str( ), 00 ))
+					continue;
+
+				ResDebug2(
+					"ResourceManager::LoadHAKFiles: Queuing HAK '%s'...\n",
+					HAKPath.c_str( ));
+
+				//
+				// Queue it up.  The index cache is consulted now, as it is
+				// only safe to access from this thread.
+				//
+
+				ProviderLoad & Load = QueueProviderLoad(
+					(LoadTier == TIER_ENCAPSULAT16) ? ProviderLoadErf16 : ProviderLoadErf,
+					LoadTier,
+					HAKPath,
+					HAKFile);
+
+				if (UseIndexCache)
+				{
+					WIN32_FILE_ATTRIBUTE_DATA FileData;
+
+					if (GetFileAttributesExA(
+						HAKPath.c_str( ),
+						GetFileExInfoStandard,
+						&FileData))
+					{
+						LookupIndexCache(
+							Load,
+							((ULONG64) FileData.nFileSizeHigh << 32) |
+							((ULONG64) FileData.nFileSizeLow),
+							((ULONG64) FileData.ftLastWriteTime.dwHighDateTime << 32) |
+							((ULONG64) FileData.ftLastWriteTime.dwLowDateTime));
+					}
+				}
+				break;
+			}
+		}
+		catch (std::exception &e)
+		{
+			m_TextWriter->WriteText(
+				"WARNING: Failed to load HAK file '%.32s' (exception '%s').  Certain module resources may be unavailable.\n",
+				it->RefStr,
+				e.what( ));
+		}
+	}
+
+#if defined(RES_DEBUG) && RES_DEBUG >= 1
+	m_TextWriter->WriteText( "HAK: %lu\n", GetTickCount( ) - TimeSpent );
+#endif
+}
+
+void
+ResourceManager::LoadModule(
+	__in ModuleSearchOrder SearchOrder,
+	__in_opt const char * CustomModuleSourcePath
+	)
+/*++
+
+Routine Description:
+
+	This routine registers module resources in the resource manager.
+
+Arguments:
+
+	SearchOrder - Supplies the module search order.  Legal values are drawn from
+	              the ModuleSearchOrder enumeration.
+
+	              ModSearch_Automatic - Try encapsulated, then directory.
+
+	              ModSearch_PrefDirectory - Prefer directory modules.
+
+	              ModSearch_PrefEncapsulated - Prefer encapsulated modules.
+
+	CustomModuleSourcePath - Optionally supplies a custom search path for the
+	                         module.  If provided, the default search logic is
+	                         overridden.
+
+Return Value:
+
+	None.  Raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	try
+	{
+		std::string ModulePath;
+
+		CheckResFileName( m_ModuleResName );
+
+		ResDebug2(
+			"ResourceManager::LoadModule: Beginning module search (search order = %lu)...\n",
+			(unsigned long) SearchOrder );
+
+		//
+		// If we have an override custom module source location, then load the
+		// module directly from there.  The location is a full path and not a
+		// resource name.
+		//
+
+		if (CustomModuleSourcePath != NULL)
+		{
+			struct _stat s;
+
+			ResDebug2(
+				"ResourceManager::LoadModule: Using custom module source path '%s'.\n",
+				CustomModuleSourcePath );
+
+			if ((_stat( CustomModuleSourcePath, &s ) == 0) &&
+			    (s.st_mode & _S_IFDIR))
+			{
+				DirectoryFileReaderPtr ModuleRes;
+
+				ResDebug2(
+					"ResourceManager::LoadModule: Using custom directory '%s'.\n",
+					CustomModuleSourcePath );
+
+				if (!CheckModuleIfo( CustomModuleSourcePath, false ))
+				{
+					throw std::runtime_error(
+							std::string( "No module.ifo in " ) +
+							CustomModuleSourcePath );
+				}
+
+				ModuleRes  = new DirectoryFileReader( CustomModuleSourcePath );
+
+				m_DirFiles.push_back( ModuleRes );
+				m_ResourceFiles[ TIER_DIRECTORY ].push_back( ModuleRes.get( ) );
+			}
+			else
+			{
+				ResDebug2(
+					"ResourceManager::LoadModule: Using custom ERF '%s'.\n",
+					CustomModuleSourcePath );
+
+				if (!CheckModuleIfo( CustomModuleSourcePath, true ))
+				{
+					throw std::runtime_error(
+							std::string( "No module.ifo in " ) +
+							CustomModuleSourcePath );
+				}
+
+				LoadEncapsulatedFile( CustomModuleSourcePath );
+			}
+
+			return;
+		}
+
+		//
+		// Use two passes.  For the first, we'll go with the home directory
+		// instead of the install directory, searching that 'Modules' and 'PWC'
+		// directory set.  Priority is given to the home directory.
+		//
+
+		for (size_t i = 0; i < 2; i += 1)
+		{
+			bool UseHome;
+
+			UseHome = (i == 0);
+
+			ResDebug2(
+				"ResourceManager::LoadModule: Searching for module in %s...\n",
+				UseHome ? "home directory" : "install directory");
+
+			//
+			// Try it as an ERF (.mod) first.
+			//
+
+			ModulePath = GetModulePath( false, UseHome );
+
+			if ((SearchOrder == ModSearch_PrefDirectory) ||
+			    (_access( ModulePath.c_str( ), 00 ))     ||
+			    (!CheckModuleIfo( ModulePath, true )))
+			{
+				//
+				// Try as a PWC next.
+				//
+
+				std::string PWCName;
+
+				PWCName  = "pwc/";
+				PWCName += m_ModuleResName;
+				PWCName += ".pwc";
+
+				ModulePath = GetResourceFilePath( PWCName );
+
+				if ((SearchOrder == ModSearch_PrefDirectory) ||
+				    (_access( ModulePath.c_str( ), 00 ))     ||
+				    (!CheckModuleIfo( ModulePath, true )))
+				{
+					DirectoryFileReaderPtr ModuleRes;
+
+					//
+					// Doesn't exist?  Try as a directory.
+					//
+
+					ModulePath = GetModulePath( true, UseHome );
+
+					if ((SearchOrder == ModSearch_PrefEncapsulated) ||
+					    (_access( ModulePath.c_str( ), 00 ))        ||
+					    (!CheckModuleIfo( ModulePath, false )))
+					{
+						continue;
+					}
+
+					ResDebug2(
+						"ResourceManager::LoadModule: Found module directory '%s'.\n",
+						ModulePath.c_str( ));
+
+					ModuleRes  = new DirectoryFileReader( ModulePath );
+
+					m_DirFiles.push_back( ModuleRes );
+					m_ResourceFiles[ TIER_DIRECTORY ].push_back( ModuleRes.get( ) );
+					return;
+				}
+			}
+
+			ResDebug2(
+				"ResourceManager::LoadModule: Found module ERF file '%s'.\n",
+				ModulePath.c_str( ));
+
+			//
+			// We've got a .mod or a .pwc, both of which are ERFs that include the
+			// necessary client files.  Load them up.
+			//
+
+			LoadEncapsulatedFile( ModulePath );
+			return;
+		}
+
+		//
+		// If we failed completely to find a module, try automatic searching as a
+		// next resort.
+		//
+
+		if (SearchOrder != ModSearch_Automatic)
+			return LoadModule( ModSearch_Automatic, CustomModuleSourcePath );
+
+		//
+		// Finally, try as a NWM (legacy campaign module), should all else
+		// fail.
+		//
+
+		ModulePath = GetModuleNWMPath( );
+
+		if ((!_access( ModulePath.c_str( ), 00 )) &&
+		    (CheckModuleIfo( ModulePath, true )))
+		{
+			ResDebug2(
+				"ResourceManager::LoadModule: Found module NWM ERF file '%s'.\n",
+				ModulePath.c_str( ));
+
+			//
+			// We've got a .nwm, which is a .ERF that includes the necessary
+			// client files.  Load them up.
+			//
+
+			LoadEncapsulatedFile( ModulePath );
+			return;
+		}
+
+		throw std::runtime_error( "Couldn't locate module file." );
+	}
+	catch (std::exception &e)
+	{
+		m_TextWriter->WriteText(
+			"WARNING: Exception '%s' loading module resources.  The area map may not function.\n",
+			e.what( ) );
+
+		if (m_ResManFlags & ResManFlagRequireModuleIfo)
+			throw;
+	}
+}
+
+void
+ResourceManager::LoadCampaign(
+	__in const GUID & CampaignID,
+	__out GUID & CampaignIDUsed
+	)
+/*++
+
+Routine Description:
+
+	This routine registers campaign resources in the resource manager.
+
+	Not all modules have an associated campaign.
+
+Arguments:
+
+	CampaignID - Supplies the campaign ID of the campaign to load.
+
+	CampaignIDUsed - Receives the ID of the campaign that was actually loaded.
+	                 Generally, this is the input campaign ID, unless there was
+	                 no matching GUID (in which case the default ID is used).
+
+Return Value:
+
+	None.  Raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	HANDLE Find;
+
+	Find = INVALID_HANDLE_VALUE;
+
+	//
+	// Set to the default campaign ID first.  If we then find a matching
+	// campaign, we return the real ID.
+	//
+
+	ZeroMemory( &CampaignIDUsed, sizeof( CampaignIDUsed ) );
+	memcpy( &CampaignIDUsed, "AdHocGUID", 9 );
+
+	try
+	{
+		std::string CampaignPath;
+		ResRefT     ResRef;
+		ResType     Type;
+
+		//
+		// Use two passes.  For the first, we'll go with the home directory
+		// instead of the install directory.  Then we'll try the install
+		// directory.
+		//
+
+		for (size_t i = 0; i < 2; i += 1)
+		{
+			bool              UseHome;
+			FileId            ResourceCount;
+			WIN32_FIND_DATAA  FindData;
+			std::string       SearchedPath;
+
+			UseHome = (i == 0);
+
+			ResDebug2(
+				"ResourceManager::LoadCampaign: Searching for campaign in %s...\n",
+				UseHome ? "home directory" : "install directory");
+
+			//
+			// Try and find a campaign that matches our campaign ID.  We sweep
+			// all directories in the campaigns directory for one with a .cam
+			// resource and then choose the first matching one for our campaign
+			// resource directory.
+			//
+
+			CampaignPath  = GetCampaignPath( UseHome );
+			SearchedPath  = CampaignPath;
+			SearchedPath += "*.";
+
+			do
+			{
+				if ((!strcmp( FindData.cFileName, "." )) ||
+					 (!strcmp( FindData.cFileName, ".." )))
+					continue;
+
+				if (!(FindData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+					continue;
+
+				DirectoryFileReaderPtr CampaignSearcher;
+
+				//
+				// We have a directory to search.  Inventory all subdirectories
+				// for a ResCAM type file and pull IDs out until we find one
+				// that matches (or we reach the end).
+				//
+
+				SearchedPath     = CampaignPath + FindData.cFileName;
+				CampaignSearcher = new DirectoryFileReader( SearchedPath );
+				ResourceCount    = CampaignSearcher->GetEncapsulatedFileCount( );
+
+				for (FileId CurId = ResourceCount; CurId != 0; CurId -= 1)
+				{
+					//
+					// Get the resource name and type at this index.
+					//
+
+					if (!CampaignSearcher->GetEncapsulatedFileEntry(
+						CurId - 1,
+						ResRef,
+						Type))
+					{
+						//
+						// It might be an unrecognized type, ignore it if so.
+						//
+						continue;
+					}
+
+					//
+					// We are only searching for campaign descriptor files.
+					//
+
+					if (Type != NWN::ResCAM)
+						continue;
+
+					//
+					// We only want actual campaign.cam files.
+					//
+
+					if (memcmp( &ResRef, "campaign", 8 ))
+						continue;
+
+					ResDebug2(
+						"ResourceManager::LoadCampaign: Found campaign.cam (%s).\n",
+						CampaignSearcher->GetRealFileName( CurId - 1 ).c_str( ));
+
+					//
+					// We have a campaign.cam file, check that the GUID matches.
+					//
+
+					try
+					{
+						std::vector< unsigned char > ID;
+						GffFileReader                Campaign(
+							CampaignSearcher->GetRealFileName( CurId - 1 ),
+							*this);
+
+						if (!Campaign.GetRootStruct( )->GetVOID( "GUID", ID ))
+							throw std::runtime_error( "Failed to read GUID." );
+
+						if (ID.size( ) != sizeof( CampaignID ))
+							throw std::runtime_error( "Malformed GUID." );
+
+						if (!memcmp( &ID[ 0 ], &CampaignID, sizeof( CampaignID ) ))
+						{
+							//
+							// We've found our one.  Register it with the
+							// resource search system and return the ID back to
+							// the caller to let them know which campaign was
+							// in use.
+							//
+
+							m_DirFiles.push_back( CampaignSearcher );
+							m_ResourceFiles[ TIER_DIRECTORY ].push_back(
+								CampaignSearcher.get( ) );
+
+							CampaignIDUsed = CampaignID;
+
+							FindClose( Find );
+							Find = INVALID_HANDLE_VALUE;
+
+							return;
+						}
+					}
+					catch (std::exception &e)
+					{
+						m_TextWriter->WriteText(
+							"WARNING: Failed to process campaign (FileId #%I64lu) in '%s': '%s'.\n",
+							CurId,
+							SearchedPath.c_str( ),
+							e.what( ));
+					}
+				}
+
+				//
+				// "These are not the campaigns that you are looking for."
+				//
+				// Search the next directory if we had one.
+				//
+
+			} while (FindNextFileA( Find, &FindData ));
+
+			//
+			// Try the next directory hierarchy (i.e. the install directory).
+			//
+		}
+
+		//
+		// No campaign can be found.  This is acceptable as modules may be
+		// created without any campaign linkage in effect.
+		//
+	}
+	catch (std::exception &e)
+	{
+		m_TextWriter->WriteText(
+			"WARNING: Exception '%s' loading campaign resources.\n",
+			e.what( ) );
+	}
+	catch (...)
+	{
+		if (Find != INVALID_HANDLE_VALUE)
+		{
+			FindClose( Find );
+			Find = INVALID_HANDLE_VALUE;
+		}
+
+		throw;
+	}
+
+	if (Find != INVALID_HANDLE_VALUE)
+	{
+		FindClose( Find );
+		Find = INVALID_HANDLE_VALUE;
+	}
+}
+
+void
+ResourceManager::LoadDirectories(
+	__in_opt const char * CustomSearchPath
+	)
+/*++
+
+Routine Description:
+
+	This routine queues other predefined directories for registration with the
+	resource management system by LoadQueuedProviders.
+
+Arguments:
+
+	CustomSearchPath - Optionally supplies a path to a custom location that is
+	                   searched first ahead of the standard directories, e.g to
+	                   provide custom implementation-specific resources that
+	                   are to be exposed via the standard resource system.
+
+Return Value:
+
+	None.  Raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	std::string              DirName;
+	const char             * ResDirs[ ] =
+	{
+		"pwc",
+		"override"
+	};
+
+	m_DirFiles.reserve(
+		m_DirFiles.size( ) + sizeof( ResDirs ) / sizeof( ResDirs[ 0 ] ) + 1 );
+	m_ResourceFiles[ TIER_DIRECTORY ].reserve(
+		m_ResourceFiles[ TIER_DIRECTORY ].size( ) + sizeof( ResDirs ) / sizeof( ResDirs[ 0 ] ) + 1 );
+
+	if (ARGUMENT_PRESENT( CustomSearchPath ))
+	{
+		DirName  = CustomSearchPath;
+		DirName += "/";
+
+		ResDebug2(
+			"ResourceManager::LoadDirectories: Adding custom directory '%s'.\n",
+			DirName.c_str( ));
+
+		QueueProviderLoad( ProviderLoadDirectory, TIER_DIRECTORY, DirName, DirName );
+	}
+
+	for (size_t i = 0;
+	     i < sizeof( ResDirs ) / sizeof( ResDirs[ 0 ] );
+	     i += 1)
+	{
+		DirName  = m_HomeDir;
+		DirName += "/";
+		DirName += ResDirs[ i ];
+
+		ResDebug2(
+			"ResourceManager::LoadDirectories: Adding home-based directory '%s'.\n",
+			DirName.c_str( ));
+
+		QueueProviderLoad( ProviderLoadDirectory, TIER_DIRECTORY, DirName, DirName );
+
+		DirName  = m_InstallDir;
+		DirName += "/";
+		DirName += ResDirs[ i ];
+
+		ResDebug2(
+			"ResourceManager::LoadDirectories: Adding install-based directory '%s'.\n",
+			DirName.c_str( ));
+
+		QueueProviderLoad( ProviderLoadDirectory, TIER_DIRECTORY, DirName, DirName );
+	}
+}
+
+void
+ResourceManager::LoadZipArchives(
+	__in bool UseIndexCache
+	)
+/*++
+
+Routine Description:
+
+	This routine queues in-box zip archives for registration with the resource
+	management system by LoadQueuedProviders.
+
+	If requested, the directory listings of the archives are drawn from the
+	resource index cache, and only archives that are new or have changed since
+	the cache was written are scanned.  The cache is rewritten by
+	LoadQueuedProviders if any archive was scanned (or if any cached archive
+	is no longer present).
+
+Arguments:
+
+	UseIndexCache - Supplies a Boolean value that indicates whether archive
+	                directory listings are drawn from, and recorded to, the
+	                resource index cache.
+
+Return Value:
+
+	None.  Raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	std::string              DirName;
+	const char             * ResDirs[ ] =
+	{
+		"Data"
+	};
+#if PERF_TRACE
+	ULONG                    TimeSpent;
+
+	TimeSpent = GetTickCount( );
+#endif
+
+	//
+	// Load all .zip archives in each zip-containing directory.
+	//
+
+	for (size_t i = 0;
+	     i < sizeof( ResDirs ) / sizeof( ResDirs[ 0 ] );
+	     i += 1)
+	{
+		DirName  = m_HomeDir;
+		DirName += "/";
+		DirName += ResDirs[ i ];
+
+		ResDebug2(
+			"ResourceManager::LoadZipArchives: Adding home-based zips from '%s'.\n",
+			DirName.c_str( ));
+
+		LoadDirectoryZipFiles( DirName, UseIndexCache );
+
+		DirName  = m_InstallDir;
+		DirName += "/";
+		DirName += ResDirs[ i ];
+
+		ResDebug2(
+			"ResourceManager::LoadZipArchives: Adding install-based zips from '%s'.\n",
+			DirName.c_str( ));
+
+		LoadDirectoryZipFiles( DirName, UseIndexCache );
+	}
+
+#if PERF_TRACE
+	m_TextWriter->WriteText( "ZIPLOAD: %lu\n", GetTickCount( ) - TimeSpent );
+#endif
+}
+
+void
+ResourceManager::LoadFixedKeyFiles(
+	__in const StringVec & KeyFiles
+	)
+/*++
+
+Routine Description:
+
+	This routine queues in-box .key/.bif archives for registration with the
+	resource management system by LoadQueuedProviders.
+
+Arguments:
+
+	KeyFiles - Supplies the list of key file RESREFs to load.  Earlier listed
+	           RESREFs take priority over later listed RESREFs.
+
+Return Value:
+
+	None.  Raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	std::string              KeyFileName;
+#if PERF_TRACE
+	ULONG                    TimeSpent;
+
+	TimeSpent = GetTickCount( );
+#endif
+
+	//
+	// Load all .key archives (and their associated .bif files) specified.
+	//
+
+	for (StringVec::const_reverse_iterator it = KeyFiles.rbegin( );
+	     it != KeyFiles.rend( );
+	     ++it)
+	{
+		KeyFileName =  m_InstallDir;
+		KeyFileName += "/";
+		KeyFileName += *it;
+		KeyFileName += ".key";
+
+		//
+		// Queue a .key reader context for creation and registration in the
+		// master provider list.
+		//
+
+		ResDebug2(
+			"ResourceManager::LoadFixedKeyFiles: Queuing key file '%s'...\n",
+			KeyFileName.c_str( ));
+
+		ProviderLoad & Load = QueueProviderLoad(
+			ProviderLoadKey,
+			TIER_INBOX_KEY,
+			KeyFileName,
+			KeyFileName);
+
+		Load.BaseDir = m_InstallDir;
+
+		if (m_ResManFlags & ResManFlagLazyBifLoad)
+			Load.KeyFlags |= KeyFileReader::KEY_FLAG_LAZY_BIF_LOAD;
+	}
+
+
+#if PERF_TRACE
+	m_TextWriter->WriteText( "FIXEDKEYLOAD: %lu\n", GetTickCount( ) - TimeSpent );
+#endif
+}
+
+void
+ResourceManager::LoadCustomResourceProviders(
+	__in_ecount( ProviderCount ) IResourceAccessor * const * Providers,
+	__in size_t ProviderCount,
+	__in bool FirstChance
+	)
+/*++
+
+Routine Description:
+
+	This routine registers any custom resource providers that the user has
+	established with the resource system.
+
+Arguments:
+
+	Providers - Optionally supplies a pointer to an array of resource accessor
+	            providers to register.
+
+	ProviderCount - Supplies the count of custom resource accessor providers.
+
+	FirstChance - Supplies a Boolean value indicating true if the providers are
+	              to be registered as first chance (true) or last chance
+	              (false) resource providers with respect to the rest of the
+	              built-in provider set.
+
+Return Value:
+
+	None.  Raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	size_t                   Tier;
+#if PERF_TRACE
+	ULONG                    TimeSpent;
+
+	TimeSpent = GetTickCount( );
+#endif
+
+	if (FirstChance)
+		Tier = TIER_CUSTOM_FIRST;
+	else
+		Tier = TIER_CUSTOM_LAST;
+
+	//
+	// Register all custom providers specified with the resource system.
+	//
+
+	m_ResourceFiles[ Tier ].reserve( ProviderCount );
+
+	for (size_t i = 0; i < ProviderCount; i += 1)
+		m_ResourceFiles[ i ].push_back( Providers[ i ] );
+
+#if PERF_TRACE
+	m_TextWriter->WriteText( "CUSTOMLOAD%lu: %lu\n", (FirstChance) ? 0 : 1, GetTickCount( ) - TimeSpent );
+#endif
+}
+
+void
+ResourceManager::LoadDirectoryZipFiles(
+	__in const std::string & DirName,
+	__in bool UseIndexCache
+	)
+/*++
+
+Routine Description:
+
+	This routine enumerates all .zip files in a given directory hierarchy and
+	queues a ZipFileReader context for creation for each discovered .zip.
+
+	Typically, "in-box" game data files are shipped as .zip archives, verus
+	traditional custom content that is provided as ERFs or raw directories.
+
+	N.B.  The order of filesystem enumeration is significant in that the
+	      resource system assumes that alpha-sorted resources may be traversed
+	      in reverse order in order to implement the canonical resource search
+	      order.  This is required for "in-box" data files that are updated via
+	      the patch distribution system.
+
+Arguments:
+
+	DirName - Supplies the directory to enumerate.  The directory name is not
+	          required to end in a path separation character.
+
+	UseIndexCache - Supplies a Boolean value that indicates whether archive
+	                directory listings are drawn from, and recorded to, the
+	                resource index cache.
+
+Return Value:
+
+	None.  Raises an std::exception on catastrophic failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	std::string       Mask;
+	HANDLE            Find;
+	WIN32_FIND_DATAA  FindData;
+
+	Mask  = DirName;
+	Mask += "\\*.zip";
+
+	Find = FindFirstFileA( Mask.c_str( ), &FindData );
+
+	if (Find == INVALID_HANDLE_VALUE)
+		return;
+
+	try
+	{
+		do
+		{
+			if ((!strcmp( FindData.cFileName, "." )) ||
+				 (!strcmp( FindData.cFileName, ".." )))
+				continue;
+
+			if (FindData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+				continue;
+
+			//
+			// Queue a .zip reader context for creation and registration in
+			// the master provider list.  The index cache is consulted now, as
+			// it is only safe to access from this thread.
+			//
+
+			{
+				std::string FileName;
+
+				FileName  = DirName;
+				FileName += "/";
+				FileName += FindData.cFileName;
+
+				ResDebug2(
+					"ResourceManager::LoadDirectoryZipFiles: Queuing zip file '%s'...\n",
+					FileName.c_str( ));
+
+				ProviderLoad & Load = QueueProviderLoad(
+					ProviderLoadZip,
+					TIER_INBOX,
+					FileName,
+					FindData.cFileName);
+
+				if (UseIndexCache)
+				{
+					LookupIndexCache(
+						Load,
+						((ULONG64) FindData.nFileSizeHigh << 32) |
+						((ULONG64) FindData.nFileSizeLow),
+						((ULONG64) FindData.ftLastWriteTime.dwHighDateTime << 32) |
+						((ULONG64) FindData.ftLastWriteTime.dwLowDateTime));
+				}
+			}
+		} while (FindNextFileA( Find, &FindData )) ;
+	}
+	catch (...)
+	{
+		FindClose( Find );
+		throw;
+	}
+
+	FindClose( Find );
+}
+
+ResourceManager::ProviderLoad &
+ResourceManager::QueueProviderLoad(
+	__in PROVIDER_LOAD_TYPE Type,
+	__in size_t Tier,
+	__in const std::string & Path,
+	__in const std::string & DisplayName
+	)
+/*++
+
+Routine Description:
+
+	This routine queues a resource provider for loading by
+	LoadQueuedProviders.
+
+Arguments:
+
+	Type - Supplies the type of provider to load.
+
+	Tier - Supplies the tier to register the provider in.
+
+	Path - Supplies the path to the provider file or directory.
+
+	DisplayName - Supplies the name of the provider for use in warnings.
+
+Return Value:
+
+	The routine returns the queued load descriptor, which remains valid until
+	the next provider load is queued.  The routine raises an std::exception on
+	failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	ProviderLoad Load;
+
+	Load.Type          = Type;
+	Load.Tier          = Tier;
+	Load.Path          = Path;
+	Load.DisplayName   = DisplayName;
+	Load.UseIndexCache = false;
+	Load.FileSize      = 0;
+	Load.LastWriteTime = 0;
+	Load.CachedEntries = NULL;
+	Load.CachedCount   = 0;
+	Load.KeyFlags      = 0;
+	Load.Failed        = false;
+
+	m_ProviderLoads.push_back( Load );
+
+	return m_ProviderLoads.back( );
+}
+
+void
+ResourceManager::LookupIndexCache(
+	__inout ProviderLoad & Load,
+	__in ULONG64 FileSize,
+	__in ULONG64 LastWriteTime
+	)
+/*++
+
+Routine Description:
+
+	This routine looks up the cached directory listing of a queued .hak or
+	.zip provider in the resource index cache.  If the provider is present
+	with a matching size and last write time, it is constructed from the
+	cached listing by LoadQueuedProvider; otherwise, it is scanned and its
+	listing is captured.  Either way, LoadQueuedProviders records the
+	provider in the cache.
+
+	Only .hak and .zip providers are cached, as each is a single file whose
+	size and last write time cover its entire directory.  A .key file's
+	directory spans its .bif files, which are not tracked, and a directory
+	provider is enumerated recursively, so its last write time does not
+	reflect changes within its subdirectories.
+
+Arguments:
+
+	Load - Supplies the queued load descriptor to update.
+
+	FileSize - Supplies the current size of the provider file.
+
+	LastWriteTime - Supplies the current last write time of the provider
+	                file.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.  Must not be called during the parallel load phase.
+
+--*/
+{
+	Load.UseIndexCache = true;
+	Load.FileSize      = FileSize;
+	Load.LastWriteTime = LastWriteTime;
+	Load.CachedEntries = m_IndexCache.LookupProvider(
+		Load.Path,
+		FileSize,
+		LastWriteTime,
+		Load.CachedCount);
+}
+
+void
+ResourceManager::LoadQueuedProviders(
+	)
+/*++
+
+Routine Description:
+
+	This routine loads all queued resource providers and registers them with
+	the resource management system.
+
+	Provider construction (which parses each provider's directory table) is
+	independent between providers and so is performed in parallel across a
+	set of worker threads.  Once all providers have been constructed, they are
+	registered in the order that they were queued, which is the order in which
+	the LoadXxx routines would have registered them when loading serially, so
+	the canonical search order is unaffected.
+
+	Finally, if any .hak files or zip archives were loaded via the resource
+	index cache, the cache is written back if it changed.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.  Raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	bool                     UsedIndexCache;
+#if PERF_TRACE
+	ULONG                    TimeSpent;
+
+	TimeSpent = GetTickCount( );
+#endif
+
+	ExecuteParallelWork(
+		m_ProviderLoads.size( ),
+		LoadQueuedProvider,
+		&m_ProviderLoads,
+		(m_ResManFlags & ResManFlagNoParallelLoad) ? 1 : 0);
+
+#if PERF_TRACE
+	m_TextWriter->WriteText( "PROVIDERLOAD: %lu\n", GetTickCount( ) - TimeSpent );
+#endif
+
+	//
+	// Register each provider in queue order, reporting failures as each
+	// provider type has always done.
+	//
+
+	UsedIndexCache = false;
+
+	for (ProviderLoadVec::const_iterator it = m_ProviderLoads.begin( );
+	     it != m_ProviderLoads.end( );
+	     ++it)
+	{
+		if (it->Failed)
+		{
+			switch (it->Type)
+			{
+
+			case ProviderLoadErf:
+			case ProviderLoadErf16:
+				m_TextWriter->WriteText(
+					"WARNING: Failed to load HAK file '%.32s' (exception '%s').  Certain module resources may be unavailable.\n",
+					it->DisplayName.c_str( ),
+					it->Error.c_str( ));
+				break;
+
+			case ProviderLoadDirectory:
+				throw std::runtime_error( it->Error );
+
+			case ProviderLoadZip:
+				m_TextWriter->WriteText(
+					"WARNING: Failed to open .zip archive '%s': exception '%s'.\n",
+					it->DisplayName.c_str( ),
+					it->Error.c_str( ));
+				break;
+
+			case ProviderLoadKey:
+				ResDebug2(
+					"WARNING: Failed to open .key archive '%s': exception '%s'.\n",
+					it->DisplayName.c_str( ),
+					it->Error.c_str( ));
+				break;
+
+			}
+
+			continue;
+		}
+
+		switch (it->Type)
+		{
+
+		case ProviderLoadErf:
+			m_HakFiles.push_back( it->Erf );
+			m_ResourceFiles[ it->Tier ].push_back( it->Erf.get( ) );
+			break;
+
+		case ProviderLoadErf16:
+			m_HakFiles16.push_back( it->Erf16 );
+			m_ResourceFiles[ it->Tier ].push_back( it->Erf16.get( ) );
+			break;
+
+		case ProviderLoadDirectory:
+			m_DirFiles.push_back( it->Directory );
+			m_ResourceFiles[ it->Tier ].push_back( it->Directory.get( ) );
+			break;
+
+		case ProviderLoadZip:
+			m_ZipFiles.push_back( it->Zip );
+			m_ResourceFiles[ it->Tier ].push_back( it->Zip.get( ) );
+			break;
+
+		case ProviderLoadKey:
+			m_KeyFiles.push_back( it->Key );
+			m_ResourceFiles[ it->Tier ].push_back( it->Key.get( ) );
+			break;
+
+		}
+
+		if (it->UseIndexCache)
+		{
+			UsedIndexCache = true;
+
+			if (it->CachedEntries != NULL)
+			{
+				m_IndexCache.RecordProvider(
+					it->Path,
+					it->FileSize,
+					it->LastWriteTime,
+					it->CachedEntries,
+					it->CachedCount);
+			}
+			else
+			{
+				m_IndexCache.RecordProvider(
+					it->Path,
+					it->FileSize,
+					it->LastWriteTime,
+					it->ScannedEntries.empty( ) ? NULL : &it->ScannedEntries[ 0 ],
+					it->ScannedEntries.size( ));
+			}
+		}
+	}
+
+	m_ProviderLoads.clear( );
+
+	//
+	// Write back the cache if anything changed.  Failing to do so only costs
+	// us a rescan next time, so it is not fatal.
+	//
+
+	if (UsedIndexCache)
+	{
+		try
+		{
+			if (m_IndexCache.IsModified( ))
+				m_IndexCache.Save( m_IndexCacheFile );
+		}
+		catch (std::exception &e)
+		{
+			m_TextWriter->WriteText(
+				"WARNING: Failed to update resource index cache '%s': exception '%s'.\n",
+				m_IndexCacheFile.c_str( ),
+				e.what( ));
+		}
+	}
+
+	m_IndexCache.Unload( );
+}
+
+void
+ResourceManager::LoadQueuedProvider(
+	__in void * Context,
+	__in size_t WorkItem
+	)
+/*++
+
+Routine Description:
+
+	This routine constructs a single queued resource provider.  It is invoked
+	in parallel for each queued provider by LoadQueuedProviders.
+
+	Only the load descriptor for this work item is touched; in particular, no
+	ResourceManager state may be accessed, and the resource index cache is
+	only read (via entries that were looked up before the parallel phase).
+
+Arguments:
+
+	Context - Supplies the provider load vector.
+
+	WorkItem - Supplies the index of the provider load to perform.
+
+Return Value:
+
+	None.  Failures are recorded in the load descriptor.
+
+Environment:
+
+	User mode, potentially on a worker thread.
+
+--*/
+{
+	ProviderLoad & Load = (*(ProviderLoadVec *) Context)[ WorkItem ];
+
+	try
+	{
+		switch (Load.Type)
+		{
+
+		case ProviderLoadErf:
+			if (Load.CachedEntries != NULL)
+			{
+				Load.Erf = new ::ErfFileReader32(
+					Load.Path,
+					Load.CachedEntries,
+					Load.CachedCount);
+			}
+			else
+			{
+				Load.Erf = new ::ErfFileReader32( Load.Path );
+
+				if (Load.UseIndexCache)
+					Load.Erf->GetDirectoryEntries( Load.ScannedEntries );
+			}
+			break;
+
+		case ProviderLoadErf16:
+			if (Load.CachedEntries != NULL)
+			{
+				Load.Erf16 = new ::ErfFileReader16(
+					Load.Path,
+					Load.CachedEntries,
+					Load.CachedCount);
+			}
+			else
+			{
+				Load.Erf16 = new ::ErfFileReader16( Load.Path );
+
+				if (Load.UseIndexCache)
+					Load.Erf16->GetDirectoryEntries( Load.ScannedEntries );
+			}
+			break;
+
+		case ProviderLoadDirectory:
+			Load.Directory = new DirectoryFileReader( Load.Path );
+			break;
+
+		case ProviderLoadZip:
+			if (Load.CachedEntries != NULL)
+			{
+				Load.Zip = new ZipFileReader(
+					Load.Path,
+					Load.CachedEntries,
+					Load.CachedCount);
+			}
+			else
+			{
+				Load.Zip = new ZipFileReader( Load.Path );
+
+				if (Load.UseIndexCache)
+					Load.Zip->GetDirectoryEntries( Load.ScannedEntries );
+			}
+			break;
+
+		case ProviderLoadKey:
+			Load.Key = new KeyFileReader(
+				Load.Path,
+				Load.BaseDir,
+				Load.KeyFlags);
+			break;
+
+		}
+	}
+	catch (std::exception &e)
+	{
+		Load.Failed = true;
+
+		try
+		{
+			Load.Error = e.what( );
+		}
+		catch (std::bad_alloc)
+		{
+		}
+	}
+}
+
+void
+ResourceManager::LoadTalkTables(
+	__in const std::string & AltTlkFileName
+	)
+/*++
+
+Routine Description:
+
+	This routine loads all talk string tables.
+
+Arguments:
+
+	AltTlkFileName - Optionally supplies the name of an alternate tlk file.
+
+Return Value:
+
+	None.  Raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	std::string TlkFile;
+#if PERF_TRACE
+	ULONG       TimeSpent;
+
+	TimeSpent = GetTickCount( );
+#endif
+
+	if (!AltTlkFileName.empty( ))
+	{
+		try
+		{
+			std::string RelPath;
+
+			CheckResFileName( AltTlkFileName );
+
+			RelPath  = "tlk/";
+			RelPath += AltTlkFileName;
+			RelPath += ".tlk";
+
+			TlkFile  = GetResourceFilePath( RelPath );
+
+			ResDebug2(
+				"ResourceManager::LoadTalkTables: Loading module alternate tlk file '%s'....\n",
+				TlkFile.c_str( ));
+
+			m_AlternateTlk = new TlkFileReader( TlkFile );
+		}
+		catch (std::exception &e)
+		{
+			m_TextWriter->WriteText(
+				"WARNING: Exception '%s' loading alternate TLK.  STRREF lookup may be unavailable.\n",
+				e.what( ) );
+		}
+	}
+
+	if (m_InstallDir.empty( ))
+		return;
+
+	try
+	{
+		TlkFile  = m_InstallDir;
+		TlkFile += "\\dialog.tlk";
+
+		ResDebug2(
+			"ResourceManager::LoadTalkTables: Loading main tlk file '%s'...\n",
+			TlkFile.c_str( ));
+
+		m_BaseTlk = new TlkFileReader( TlkFile );
+	}
+	catch (std::exception &e)
+	{
+		m_TextWriter->WriteText(
+			"WARNING: Exception '%s' loading base TLK.  STRREF lookup may be unavailable.\n",
+			e.what( ) );
+	}
+
+#if PERF_TRACE
+	m_TextWriter->WriteText( "TLK: %lu\n", GetTickCount( ) - TimeSpent );
+#endif
+}
+
+std::string
+ResourceManager::GetResourceFilePath(
+	__in const std::string & RelPathName
+	)
+/*++
+
+Routine Description:
+
+	This routine utilizes the standard search order to locate a path to a
+	given resource file.
+
+Arguments:
+
+	RelPathName - Supplies the relative path name to search for.
+
+Return Value:
+
+	The routine returns the fully qualified path name to use in the field.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	std::string FullPath;
+
+	//
+	// Prefer the home directory, then fall back to the installation directory.
+	//
+
+	FullPath  = m_HomeDir;
+	FullPath += "/";
+	FullPath += RelPathName;
+
+	if (_access( FullPath.c_str( ), 00 ))
+	{
+		FullPath  = m_InstallDir;
+		FullPath += "/";
+		FullPath += RelPathName;
+	}
+
+	return FullPath;
+}
+
+bool
+ResourceManager::CheckModuleIfo(
+	__in const std::string & ModulePath,
+	__in bool Erf
+	) const
+/*++
+
+Routine Description:
+
+	This routine verifies that module.ifo is accessible in a given module
+	fully qualified path.  If module.ifo verification is turned off, then the
+	routine always returns true.
+
+Arguments:
+
+	ModulePath - Supplies the path to inquire about.
+
+	Erf - Supples a Boolean value indicating true if the path refers to an ERF,
+	      else false if the path refers to a directory.
+
+Return Value:
+
+	The routine returns true if the path is acceptable as a module load path,
+	else false if the path was not acceptable.
+
+	On catastrophic failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	static const NWN::ResRef32 ResRef = { "module" };
+
+	if (!(m_ResManFlags & ResManFlagRequireModuleIfo))
+		return true;
+
+	if (!Erf)
+	{
+		DirectoryFileReader Reader( ModulePath );
+
+		return DoesFileExistInResourceAccessor( Reader, ResRef, NWN::ResIFO );
+	}
+	else
+	{
+		if (m_ResManFlags & ResManFlagErf16)
+		{
+			ErfFileReader16 Reader( ModulePath );
+
+			return DoesFileExistInResourceAccessor(
+				Reader,
+				ResRef,
+				NWN::ResIFO);
+		}
+		else
+		{
+			ErfFileReader32 Reader( ModulePath );
+
+			return DoesFileExistInResourceAccessor(
+				Reader,
+				ResRef,
+				NWN::ResIFO);
+		}
+	}
+}
+
+bool
+ResourceManager::DoesFileExistInResourceAccessor(
+	__in IResourceAccessor & Accessor,
+	__in const NWN::ResRef32 & ResRef,
+	__in NWN::ResType ResType
+	) const
+/*++
+
+Routine Description
+
+	This routine checks whether a file exists in a given resource accessor.
+
+	N.B.  It is assumed that the accessor allows a handle to be opened, which
+	      for some accessors implies that no files may already be opened.
+
+Arguments:
+
+	Accessor - Supplies the resource accessor to query.
+
+	ResRef - Supplies the RESREF of the file to query.
+
+	ResType - Supplies the ResType of the file to query.
+
+Return Value:
+
+	The routine returns true if the given file existed in the resource accessor
+	in question.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	FileHandle    File;
+
+	File = Accessor.OpenFile( ResRef, ResType );
+
+	if (File == INVALID_FILE)
+		return false;
+
+	Accessor.CloseFile( File );
+
+	return true;
+}
+
+size_t
+ResourceManager::ForceCloseOpenFileHandles(
+	)
+/*++
+
+Routine Description:
+
+	This routine forcibly closes all open files.  Any file handles that were
+	still open are invalidated (which would cause them to operate incorrectly
+	on the next usage).
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	The routine returns the number of outstanding file handles that had to be
+	forcibly closed.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	size_t FilesForceClosed;
+
+	FilesForceClosed = 0;
+
+	//
+	// Unload 2DA files.
+	//
+
+	Clear2DACache( );
+
+	//
+	// Unload TLK files.
+	//
+
+	m_BaseTlk      = NULL;
+	m_AlternateTlk = NULL;
+
+	//
+	// Close any still-open file handles.
+	//
+
+	FilesForceClosed += m_ResFileHandles.size( );
+
+	for (ResHandleMap::iterator it = m_ResFileHandles.begin( );
+	     it != m_ResFileHandles.end( );
+	     ++it)
+	{
+		m_TextWriter->WriteText(
+			"WARNING: Closing leaked ResourceManager handle %08X\n",
+			it->first );
+
+		if (it->second.Contents.get( ) == NULL)
+			it->second.Accessor->CloseFile( it->second.Handle );
+	}
+
+	m_ResFileHandles.clear( );
+
+	FilesForceClosed += m_NameMap.size( );
+
+	//
+	// If we had demand loaded any files that had to be unpacked, then clear
+	// them out now.
+	//
+
+	for (ResRefNameMap::const_iterator it = m_NameMap.begin( );
+	     it != m_NameMap.end( );
+	     ++it)
+	{
+		m_TextWriter->WriteText(
+			"WARNING: Unloading leaked resource '%s' (%lu refs)...\n",
+			it->second.ResourceFileName.c_str( ),
+			it->second.Refs );
+
+		if (it->second.Delete)
+			DeleteFileA( it->second.ResourceFileName.c_str( ) );
+	}
+
+	m_NameMap.clear( );
+
+	return FilesForceClosed;
+}
+
+void
+ResourceManager::CleanDemandLoadedFiles(
+	)
+/*++
+
+Routine Description:
+
+	This routine unloads any demand-loaded resource data.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	//
+	// Discard any prefetched resources first, as the prefetch worker threads
+	// refer to the resource entries and providers that are about to be
+	// unloaded.
+	//
+
+	m_Prefetcher.Cancel( );
+	m_ResourceCache.Clear( );
+
+	m_EntryContent.clear( );
+	m_ContentSlots.clear( );
+	m_EntryPins.clear( );
+	m_NextContentSlot = 0;
+
+	//
+	// Close out any open file references (internal or external).
+	//
+
+	ForceCloseOpenFileHandles( );
+
+	//
+	// Clear all resource id entries and the name (+type) to resource id map
+	// table.
+	//
+
+	m_ResourceIndex.Clear( );
+	m_ResourceEntries.clear( );
+
+	//
+	// Unload all resource providers.  First, sever the canonical search order
+	// links.
+	//
+
+	for (size_t i = 0; i < MAX_TIERS; i += 1)
+		m_ResourceFiles[ i ].clear( );
+
+	//
+	// Unload all HAK (and other ERF) files.
+	//
+
+	m_HakFiles.clear( );
+	m_HakFiles16.clear( );
+
+	//
+	// Unload all directories.
+	//
+
+	m_DirFiles.clear( );
+
+	//
+	// Unload all zip files.
+	//
+
+	m_ZipFiles.clear( );
+}
+
+void
+ResourceManager::CleanOldTempFiles(
+	__in const char * TempPath
+	)
+/*++
+
+Routine Description:
+
+	This routine cleans up stale temporary files for instances of the client
+	extension that did not cleanly exit.
+
+Arguments:
+
+	TempPath - Supplies the path to the temp directory.
+
+Return Value:
+
+	None.  Raises an std::exception on catastrophic failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	std::string       FileName;
+	HANDLE            Find;
+	WIN32_FIND_DATAA  FindData;
+
+	FileName  = TempPath;
+	FileName += "\\NWN2CliExt_*.";
+
+	Find = FindFirstFileA( FileName.c_str( ), &FindData );
+
+	if (Find == INVALID_HANDLE_VALUE)
+		return;
+
+	try
+	{
+		do
+		{
+			HANDLE Event;
+
+			if ((!strcmp( FindData.cFileName, "." )) ||
+			    (!strcmp( FindData.cFileName, ".." )))
+				continue;
+
+			if (!(FindData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+				continue;
+
+			if (strncmp( FindData.cFileName, "NWN2CliExt_", 11 ))
+				continue;
+
+			//
+			// Check if the remote resource manager is still alive.
+			//
+
+			Event = OpenEventA( SYNCHRONIZE, FALSE, FindData.cFileName );
+
+			if (Event != NULL)
+			{
+				CloseHandle( Event );
+				continue;
+			}
+
+			//
+			// It's gone, clean the files up.
+			//
+
+			FileName  = TempPath;
+			FileName += "\\";
+			FileName += FindData.cFileName;
+
+			m_TextWriter->WriteText(
+				"Cleaning up defunct resource manager instance '%s'...\n",
+				FindData.cFileName );
+
+			DeleteDirectoryFiles( FileName.c_str( ) );
+			RemoveDirectoryA( FileName.c_str( ) );
+
+		} while (FindNextFileA( Find, &FindData )) ;
+	}
+	catch (...)
+	{
+		FindClose( Find );
+		throw;
+	}
+
+	FindClose( Find );
+}
+
+void
+ResourceManager::DeleteDirectoryFiles(
+	__in const char * DirPath
+	)
+/*++
+
+Routine Description:
+
+	This routine removes all files in a directory.  The removal is not a
+	recursive remove.
+
+Arguments:
+
+	DirPath - Supplies the path to the directory to delete.
+
+Return Value:
+
+	None.  Raises an std::exception on catastrophic failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	std::string       FileName;
+	HANDLE            Find;
+	WIN32_FIND_DATAA  FindData;
+
+	FileName  = DirPath;
+	FileName += "\\*.*";
+
+	Find = FindFirstFileA( FileName.c_str( ), &FindData );
+
+	if (Find == INVALID_HANDLE_VALUE)
+		return;
+
+	try
+	{
+		do
+		{
+			if ((!strcmp( FindData.cFileName, "." )) ||
+			    (!strcmp( FindData.cFileName, "..")))
+				continue;
+
+			FileName  = DirPath;
+			FileName += "\\";
+			FileName += FindData.cFileName;
+
+			if (FindData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+				RemoveDirectoryA( FileName.c_str( ) );
+			else
+				DeleteFileA( FileName.c_str( ) );
+		} while (FindNextFileA( Find, &FindData )) ;
+	}
+	catch (...)
+	{
+		FindClose( Find );
+		throw;
+	}
+
+	FindClose( Find );
+}
+
+void
+ResourceManager::DiscoverResources(
+	)
+/*++
+
+Routine Description:
+
+	This routine discovers all resources across all loaded resource accessors,
+	creating resource index entries for each resource.  The canonical order of
+	resource providers and names within a provider is preserved.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.  Raises an std::exception on catastrophic failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	ResourceEntry Entry;
+	FileId        MaxId;
+	ResRefT       ResRef;
+	ResType       Type;
+	FileId        ResourceCount;
+#if defined(RES_DEBUG) && RES_DEBUG >= 1
+	DWORD         TimeSpent;
+#endif
+
+	//
+	// First, total all files available to minimize reallocation.
+	//
+
+	ResourceCount = 0;
+
+	for (size_t i = 0; i < MAX_TIERS; i += 1)
+	{
+		for (ResourceAccessorVec::reverse_iterator it = m_ResourceFiles[ i ].rbegin( );
+		     it != m_ResourceFiles[ i ].rend( );
+		     ++it)
+		{
+			ResourceCount += (*it)->GetEncapsulatedFileCount( );
+		}
+	}
+
+	m_ResourceEntries.reserve( (size_t) ResourceCount );
+	m_ResourceIndex.Reserve( (size_t) ResourceCount );
+
+#if defined(RES_DEBUG) && RES_DEBUG >= 1
+	m_TextWriter->WriteText( "Indexing %lu resources...\n", ResourceCount );
+
+	TimeSpent = GetTickCount( );
+#endif
+
+	//
+	// Search each tier in turn.
+	//
+
+	for (size_t i = 0; i < MAX_TIERS; i += 1)
+	{
+		size_t j;
+
+		//
+		// Search each tier in order, based on the defined behavior of the
+		// BioWare resource manager.  The most recently added resource provider
+		// is searched first.
+		//
+
+		j = 0;
+
+		for (ResourceAccessorVec::reverse_iterator it = m_ResourceFiles[ i ].rbegin( );
+		     it != m_ResourceFiles[ i ].rend( );
+		     ++it)
+		{
+			j += 1;
+
+			MaxId = (*it)->GetEncapsulatedFileCount( );
+
+			//
+			// Iterate over each file, creating file entries for each resource
+			// type in turn.
+			//
+			// We search in reverse order, taking the last entry.  This allows
+			// us to preserve the order of the most recent entry of a
+			// particular tier winning, used to ensure that we retrieve the
+			// most precedent patched file for inbox datafiles. 
+			//
+
+			for (FileId CurId = MaxId; CurId != 0; CurId -= 1)
+			{
+				//
+				// Get the resource name and type at this index.
+				//
+
+				if (!(*it)->GetEncapsulatedFileEntry(
+					CurId - 1,
+					ResRef,
+					Type))
+				{
+					//
+					// It might be an unrecognized type, ignore it if so.
+					//
+					continue;
+				}
+
+				//
+				// Ensure that we have not already claimed this name yet.  We
+				// allow only one mapping for a particular name (+type), and it
+				// is the most precedent one in the canonical search order.
+				//
+				// The index assigns sequential key indicies, which line up
+				// with the resource entry array as we append to both in
+				// lockstep.  Space for the entry has already been reserved.
+				//
+
+				Entry.Accessor  = (*it);
+				Entry.FileIndex = CurId - 1;
+				Entry.Tier      = i;
+				Entry.TierIndex = j;
+
+				m_ResourceEntries.push_back( Entry );
+
+				//
+				// Skip duplicate entry, we've already found the most precedent
+				// version.
+				//
+
+				if (!m_ResourceIndex.Insert( ResRef, Type ))
+				{
+					m_ResourceEntries.pop_back( );
+					continue;
+				}
+
+//				m_TextWriter->WriteText( "Found %.32s\n", ResRef.RefStr );
+			}
+		}
+	}
+
+#if defined(RES_DEBUG) && RES_DEBUG >= 1
+	m_TextWriter->WriteText( "DISCOVER: %lu\n", GetTickCount( ) - TimeSpent );
+#endif
+}
+
+ResourceManager::FileHandle
+ResourceManager::AllocateFileHandle(
+	)
+/*++
+
+Routine Description:
+
+	This routine allocates a new file handle to return to a caller for purposes
+	of accessing resource data.
+
+	The returned handle value is only unique if the caller inserts it into the
+	handle table before another call to AllocateFileHandle.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	The routine returns a legal FileHandle value on success, else it returns
+	INVALID_FILE if there were no more file handles available to return.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	FileHandle Handle;
+	FileHandle FirstHandle;
+	
+	Handle = m_NextFileHandle++;
+
+	if (Handle == INVALID_FILE)
+		Handle = m_NextFileHandle++;
+
+	FirstHandle = Handle;
+
+	while (m_ResFileHandles.find( Handle ) != m_ResFileHandles.end( ) )
+	{
+		Handle = m_NextFileHandle++;
+
+		if (Handle == INVALID_FILE)
+			Handle = m_NextFileHandle++;
+
+		//
+		// If we've wrapped, then there are no handles left to give out.  Fail.
+		//
+
+		if (Handle == FirstHandle)
+			return INVALID_FILE;
+	}
+
+	return Handle;
+}
+
+ResourceManager::FileHandle
+ResourceManager::OpenInMemoryFile(
+	__in size_t EntryIndex,
+	__in ResType Type,
+	__in const DemandBufferPtr & Contents
+	)
+/*++
+
+Routine Description:
+
+	This routine builds a resource manager file handle that is backed by the
+	in-memory (cached or prefetched) contents of a resource entry.  No
+	provider file handle is opened; reads are satisfied directly from the
+	in-memory contents.
+
+Arguments:
+
+	EntryIndex - Supplies the index of the resource entry.
+
+	Type - Supplies the type of the resource.
+
+	Contents - Supplies the in-memory contents of the resource.
+
+Return Value:
+
+	The routine returns a new file handle, which must be closed by a call to
+	CloseFile.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	FileHandle ResManHandle;
+	ResHandle  HandleEntry;
+
+	ResManHandle = AllocateFileHandle( );
 
-		DirFile = new DirectoryFileReader( DirName );
+	if (ResManHandle == INVALID_FILE)
+		throw std::runtime_error( "Failed to build FileHandle" );
 
-		m_DirFiles.push_back( DirFile );
-		m_ResourceFiles[ TIER_DIRECTORY ].push_back( DirFile.get( ) );
-	}
+	HandleEntry.Accessor   = m_ResourceEntries[ EntryIndex ].Accessor;
+	HandleEntry.Handle     = INVALID_FILE;
+	HandleEntry.Type       = Type;
+	HandleEntry.Contents   = Contents;
+
+	m_ResFileHandles.insert(
+		ResHandleMap::value_type( ResManHandle, HandleEntry ) );
+
+	return ResManHandle;
 }
 
-void
-ResourceManager::LoadZipArchives(
+DemandBufferPtr
+ResourceManager::CreateDemandBuffer(
+	__in IResourceAccessor * Accessor,
+	__in FileHandle File
 	)
 /*++
 
 Routine Description:
 
-	This routine registers in-box zip archives with the resource management
-	system.
+	This routine reads the entire contents of an open file into a demand
+	buffer.
+
+	If the accessor can supply a direct mapping of the file (i.e. the file is
+	stored uncompressed and contiguously, such as for ERF, BIF or directory
+	resources), then the file contents are mapped directly from the containing
+	file.  Otherwise, the file is read (and decompressed, as necessary) into a
+	private heap buffer.
 
 Arguments:
 
-	None.
+	Accessor - Supplies the resource accessor that the file was opened with.
+
+	File - Supplies the file handle of the file to read.
 
 Return Value:
 
-	None.  Raises an std::exception on failure.
+	The routine returns the demand buffer on success.  The routine raises an
+	std::exception on failure.
 
 Environment:
 
@@ -2919,70 +5426,98 @@ Environment:
 
 --*/
 {
-	std::string              DirName;
-	const char             * ResDirs[ ] =
-	{
-		"Data"
-	};
-#if PERF_TRACE
-	ULONG                    TimeSpent;
+	HANDLE          BackingFile;
+	ULONG64         BackingFileOffset;
+	size_t          FileSize;
+	DemandBufferPtr Buffer;
 
-	TimeSpent = GetTickCount( );
-#endif
+	FileSize = Accessor->GetEncapsulatedFileSize( File );
 
 	//
-	// Load all .zip archives in each zip-containing directory.
+	// Prefer to map the resource directly out of its containing file.  If
+	// the accessor cannot provide a mapping, or the mapping could not be
+	// established, then read the resource contents into memory instead.
 	//
 
-	for (size_t i = 0;
-	     i < sizeof( ResDirs ) / sizeof( ResDirs[ 0 ] );
-	     i += 1)
+	if (Accessor->GetEncapsulatedFileMapping(
+		File,
+		&BackingFile,
+		&BackingFileOffset))
 	{
-		DirName  = m_HomeDir;
-		DirName += "/";
-		DirName += ResDirs[ i ];
+		try
+		{
+			Buffer = new DemandBuffer(
+				BackingFile,
+				BackingFileOffset,
+				FileSize);
+		}
+		catch (std::exception)
+		{
+			//
+			// Fall through to the buffered read path.
+			//
+		}
+	}
 
-		ResDebug2(
-			"ResourceManager::LoadZipArchives: Adding home-based zips from '%s'.\n",
-			DirName.c_str( ));
+	if (Buffer.get( ) == NULL)
+	{
+		std::vector< unsigned char > FileContents;
+		size_t                       BytesLeft;
+		size_t                       Offset;
+		size_t                       Read;
 
-		LoadDirectoryZipFiles( DirName );
+		FileContents.resize( FileSize );
 
-		DirName  = m_InstallDir;
-		DirName += "/";
-		DirName += ResDirs[ i ];
+		BytesLeft = FileSize;
+		Offset    = 0;
 
-		ResDebug2(
-			"ResourceManager::LoadZipArchives: Adding install-based zips from '%s'.\n",
-			DirName.c_str( ));
+		while (BytesLeft != 0)
+		{
+			if (!Accessor->ReadEncapsulatedFile(
+				File,
+				Offset,
+				BytesLeft,
+				&Read,
+				&FileContents[ Offset ]))
+			{
+				throw std::runtime_error( "ReadEncapsulatedFile failed." );
+			}
+
+			if (Read == 0)
+				throw std::runtime_error( "Read zero bytes." );
 
-		LoadDirectoryZipFiles( DirName );
+			Offset    += Read;
+			BytesLeft -= Read;
+		}
+
+		Buffer = new DemandBuffer( FileContents );
 	}
 
-#if PERF_TRACE
-	m_TextWriter->WriteText( "ZIPLOAD: %lu\n", GetTickCount( ) - TimeSpent );
-#endif
+	return Buffer;
 }
 
-void
-ResourceManager::LoadFixedKeyFiles(
-	__in const StringVec & KeyFiles
+DemandBufferPtr
+ResourceManager::LoadResourceEntry(
+	__in size_t EntryIndex
 	)
 /*++
 
 Routine Description:
 
-	This routine registers in-box .key/.bif archives with the resource
-	management system.
+	This routine loads the entire contents of a resource entry via the
+	resource provider that claimed it.
+
+	The routine may be called from the prefetch worker threads, and thus
+	accesses the resource provider only under the accessor lock.
 
 Arguments:
 
-	KeyFiles - Supplies the list of key file RESREFs to load.  Earlier listed
-	           RESREFs take priority over later listed RESREFs.
+	EntryIndex - Supplies the index of the resource entry to load.
 
 Return Value:
 
-	None.  Raises an std::exception on failure.
+	The routine returns the demand buffer on success.  The routine raises an
+	std::exception on failure.
 
 Environment:
 
@@ -2990,88 +5525,65 @@ Environment:
 
 --*/
 {
-	std::string              KeyFileName;
-#if PERF_TRACE
-	ULONG                    TimeSpent;
-
-	TimeSpent = GetTickCount( );
-#endif
-
-	//
-	// Load all .key archives (and their associated .bif files) specified.
-	//
-
-	for (StringVec::const_reverse_iterator it = KeyFiles.rbegin( );
-	     it != KeyFiles.rend( );
-	     ++it)
-	{
-		KeyFileName =  m_InstallDir;
-		KeyFileName += "/";
-		KeyFileName += *it;
-		KeyFileName += ".key";
+	swutil::ScopedLock    Lock( m_AccessorLock );
+	const ResourceEntry * Entry;
+	FileHandle            Handle;
+	DemandBufferPtr       Buffer;
 
-		//
-		// Create a .key reader context and register the resource file
-		// provider in the master provider list.
-		//
+	Entry  = &m_ResourceEntries[ EntryIndex ];
 
-		try
-		{
-			KeyFileReaderPtr KeyRes;
+	if (Entry->Accessor == NULL)
+		throw std::runtime_error( "Resource entry was removed." );
 
-			ResDebug2(
-				"ResourceManager::LoadFixedKeyFiles: Loading key file '%s'...\n",
-				KeyFileName.c_str( ));
+	Handle = Entry->Accessor->OpenFileByIndex( Entry->FileIndex );
 
-			KeyRes = new KeyFileReader( KeyFileName, m_InstallDir );
+	if (Handle == INVALID_FILE)
+		throw std::runtime_error( "Failed to open resource entry." );
 
-			m_KeyFiles.push_back( KeyRes );
-			m_ResourceFiles[ TIER_INBOX_KEY ].push_back( KeyRes.get( ) );
-		}
-		catch (std::exception &e)
-		{
-			e;
-			ResDebug2(
-				"WARNING: Failed to open .key archive '%s': exception '%s'.\n",
-				KeyFileName.c_str( ),
-				e.what( ));
-		}
+	try
+	{
+		Buffer = CreateDemandBuffer( Entry->Accessor, Handle );
+	}
+	catch (...)
+	{
+		Entry->Accessor->CloseFile( Handle );
+		throw;
 	}
 
+	Entry->Accessor->CloseFile( Handle );
 
-#if PERF_TRACE
-	m_TextWriter->WriteText( "FIXEDKEYLOAD: %lu\n", GetTickCount( ) - TimeSpent );
-#endif
+	return Buffer;
 }
 
-void
-ResourceManager::LoadCustomResourceProviders(
-	__in_ecount( ProviderCount ) IResourceAccessor * const * Providers,
-	__in size_t ProviderCount,
-	__in bool FirstChance
+DemandBufferPtr
+ResourceManager::AcquireResourceContents(
+	__in size_t EntryIndex
 	)
 /*++
 
 Routine Description:
 
-	This routine registers any custom resource providers that the user has
-	established with the resource system.
+	This routine acquires the entire contents of a resource entry.  The
+	contents are served from the resource cache or from the prefetcher if
+	possible, else they are loaded via the resource provider that claimed the
+	resource.
 
-Arguments:
+	Contents that were not already cached are inserted into the resource cache
+	(unless the cache is disabled), such that a later demand for a frequently
+	used resource need not read (and decompress) it again.
 
-	Providers - Optionally supplies a pointer to an array of resource accessor
-	            providers to register.
+	If content sharing is enabled, freshly loaded contents are hashed, and
+	are replaced by the cached contents of an identical resource if there is
+	one, such that identical resources are only retained in memory once.
 
-	ProviderCount - Supplies the count of custom resource accessor providers.
+Arguments:
 
-	FirstChance - Supplies a Boolean value indicating true if the providers are
-	              to be registered as first chance (true) or last chance
-	              (false) resource providers with respect to the rest of the
-	              built-in provider set.
+	EntryIndex - Supplies the index of the resource entry to acquire.
 
 Return Value:
 
-	None.  Raises an std::exception on failure.
+	The routine returns the demand buffer on success.  The routine raises an
+	std::exception on failure.
 
 Environment:
 
@@ -3079,60 +5591,70 @@ Environment:
 
 --*/
 {
-	size_t                   Tier;
-#if PERF_TRACE
-	ULONG                    TimeSpent;
+	DemandBufferPtr Contents;
+	size_t          CacheKey;
 
-	TimeSpent = GetTickCount( );
-#endif
+	CacheKey = GetResourceCacheKey( EntryIndex );
 
-	if (FirstChance)
-		Tier = TIER_CUSTOM_FIRST;
-	else
-		Tier = TIER_CUSTOM_LAST;
+	if (m_ResourceCache.Lookup( CacheKey, Contents ))
+		return Contents;
 
-	//
-	// Register all custom providers specified with the resource system.
-	//
+	if (!m_Prefetcher.Lookup( EntryIndex, Contents ))
+		Contents = LoadResourceEntry( EntryIndex );
 
-	m_ResourceFiles[ Tier ].reserve( ProviderCount );
+	if ((m_ResManFlags & ResManFlagNoResourceCache) == 0)
+	{
+		try
+		{
+			if (m_ResManFlags & ResManFlagShareContents)
+				CacheKey = ShareResourceContents( EntryIndex, Contents );
 
-	for (size_t i = 0; i < ProviderCount; i += 1)
-		m_ResourceFiles[ i ].push_back( Providers[ i ] );
+			m_ResourceCache.Insert( CacheKey, Contents, false );
+		}
+		catch (std::exception)
+		{
+			//
+			// Failing to cache the resource is not fatal; it will simply be
+			// loaded again on next use.
+			//
+		}
+	}
 
-#if PERF_TRACE
-	m_TextWriter->WriteText( "CUSTOMLOAD%lu: %lu\n", (FirstChance) ? 0 : 1, GetTickCount( ) - TimeSpent );
-#endif
+	return Contents;
 }
 
-void
-ResourceManager::LoadDirectoryZipFiles(
-	__in const std::string & DirName
+size_t
+ResourceManager::ShareResourceContents(
+	__in size_t EntryIndex,
+	__inout DemandBufferPtr & Contents
 	)
 /*++
 
 Routine Description:
 
-	This routine enumerates all .zip files in a given directory hierarchy and
-	creates a ZipFileReader context for each discovered .zip.
-
-	Typically, "in-box" game data files are shipped as .zip archives, verus
-	traditional custom content that is provided as ERFs or raw directories.
+	This routine records the content hash of a resource entry whose contents
+	were just loaded, and assigns the entry the shared contents slot of its
+	content hash.
 
-	N.B.  The order of filesystem enumeration is significant in that the
-	      resource system assumes that alpha-sorted resources may be traversed
-	      in reverse order in order to implement the canonical resource search
-	      order.  This is required for "in-box" data files that are updated via
-	      the patch distribution system.
+	If the contents of the slot are cached, they are compared with the loaded
+	contents; if identical, the loaded contents are replaced with the cached
+	contents (so that only one copy is retained), else the hashes collided and
+	the entry is not shared.  If the contents of the slot are not cached, the
+	entry only keeps the slot if it already belonged to it (its contents were
+	compared when it joined); otherwise the hash alone cannot establish that
+	the contents are identical, and the entry is not shared.
 
 Arguments:
 
-	DirName - Supplies the directory to enumerate.  The directory name is not
-	          required to end in a path separation character.
+	EntryIndex - Supplies the index of the resource entry.
+
+	Contents - Supplies the loaded contents of the resource entry.  On return,
+	           receives the shared contents, if they were already cached.
 
 Return Value:
 
-	None.  Raises an std::exception on catastrophic failure.
+	The routine returns the resource cache key of the entry.  The routine
+	raises an std::exception on failure.
 
 Environment:
 
@@ -3140,87 +5662,71 @@ Environment:
 
 --*/
 {
-	std::string       Mask;
-	HANDLE            Find;
-	WIN32_FIND_DATAA  FindData;
+	ContentIdentity           Identity;
+	ContentSlotMap::iterator  it;
+	EntryContentMap::iterator Member;
+	DemandBufferPtr           Shared;
 
-	Mask  = DirName;
-	Mask += "\\*.zip";
+	Identity.Hash = ComputeContentHash( Contents->GetData( ), Contents->GetSize( ) );
+	Identity.Slot = INVALID_CONTENT_SLOT;
 
-	Find = FindFirstFileA( Mask.c_str( ), &FindData );
+	it     = m_ContentSlots.find( Identity.Hash );
+	Member = m_EntryContent.find( EntryIndex );
 
-	if (Find == INVALID_HANDLE_VALUE)
-		return;
+	if (it == m_ContentSlots.end( ))
+	{
+		m_ContentSlots.insert( ContentSlotMap::value_type( Identity.Hash, m_NextContentSlot ) );
 
-	try
+		Identity.Slot      = m_NextContentSlot;
+		m_NextContentSlot += 1;
+	}
+	else if (m_ResourceCache.Lookup( CONTENT_CACHE_KEY | it->second, Shared ))
 	{
-		do
+		if ((Shared->GetSize( ) == Contents->GetSize( )) &&
+		    (!memcmp( Shared->GetData( ), Contents->GetData( ), Contents->GetSize( ) )))
 		{
-			if ((!strcmp( FindData.cFileName, "." )) ||
-				 (!strcmp( FindData.cFileName, ".." )))
-				continue;
-
-			if (FindData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
-				continue;
-
-			//
-			// Create a .zip reader context and register the resource file
-			// provider in the master provider list.
-			//
-
-			try
-			{
-				ZipFileReaderPtr ZipRes;
-				std::string      FileName;
-
-				FileName  = DirName;
-				FileName += "/";
-				FileName += FindData.cFileName;
-
-				ResDebug2(
-					"ResourceManager::LoadDirectoryZipFiles: Loading zip file '%s'...\n",
-					FileName.c_str( ));
-
-				ZipRes = new ZipFileReader( FileName );
-
-				m_ZipFiles.push_back( ZipRes );
-				m_ResourceFiles[ TIER_INBOX ].push_back( ZipRes.get( ) );
-			}
-			catch (std::exception &e)
-			{
-				m_TextWriter->WriteText(
-					"WARNING: Failed to open .zip archive '%s': exception '%s'.\n",
-					FindData.cFileName,
-					e.what( ));
-			}
-		} while (FindNextFileA( Find, &FindData )) ;
+			Identity.Slot = it->second;
+			Contents      = Shared;
+		}
 	}
-	catch (...)
+	else if ((Member != m_EntryContent.end( )) &&
+	         (Member->second.Slot == it->second))
 	{
-		FindClose( Find );
-		throw;
+		//
+		// The entry is reloading the contents of its own slot after they
+		// were discarded from the cache.
+		//
+
+		Identity.Slot = it->second;
 	}
 
-	FindClose( Find );
+	m_EntryContent[ EntryIndex ] = Identity;
+
+	return GetResourceCacheKey( EntryIndex );
 }
 
-void
-ResourceManager::LoadTalkTables(
-	__in const std::string & AltTlkFileName
+ULONG64
+ResourceManager::ComputeContentHash(
+	__in_bcount( Length ) const void * Data,
+	__in size_t Length
 	)
 /*++
 
 Routine Description:
 
-	This routine loads all talk string tables.
+	This routine computes the content hash of a resource, using the 64-bit
+	MurmurHash2 algorithm (MurmurHash64A), which consumes the contents eight
+	bytes at a time.  The length of the contents is folded into the hash.
 
 Arguments:
 
-	AltTlkFileName - Optionally supplies the name of an alternate tlk file.
+	Data - Supplies the resource contents.
+
+	Length - Supplies the length, in bytes, of the resource contents.
 
 Return Value:
 
-	None.  Raises an std::exception on failure.
+	The routine returns the content hash.
 
 Environment:
 
@@ -3228,85 +5734,77 @@ Environment:
 
 --*/
 {
-	std::string TlkFile;
-#if PERF_TRACE
-	ULONG       TimeSpent;
-
-	TimeSpent = GetTickCount( );
-#endif
-
-	if (!AltTlkFileName.empty( ))
-	{
-		try
-		{
-			std::string RelPath;
-
-			CheckResFileName( AltTlkFileName );
-
-			RelPath  = "tlk/";
-			RelPath += AltTlkFileName;
-			RelPath += ".tlk";
-
-			TlkFile  = GetResourceFilePath( RelPath );
-
-			ResDebug2(
-				"ResourceManager::LoadTalkTables: Loading module alternate tlk file '%s'....\n",
-				TlkFile.c_str( ));
-
-			m_AlternateTlk = new TlkFileReader( TlkFile );
-		}
-		catch (std::exception &e)
-		{
-			m_TextWriter->WriteText(
-				"WARNING: Exception '%s' loading alternate TLK.  STRREF lookup may be unavailable.\n",
-				e.what( ) );
-		}
-	}
-
-	if (m_InstallDir.empty( ))
-		return;
+	const ULONG64         m = 0xC6A4A7935BD1E995ui64;
+	const int             r = 47;
+	const unsigned char * p;
+	ULONG64               Hash;
 
-	try
+	p    = (const unsigned char *) Data;
+	Hash = 0x4E574E32ui64 ^ ((ULONG64) Length * m);
+
+	for (size_t i = 0; i < Length / 8; i += 1)
 	{
-		TlkFile  = m_InstallDir;
-		TlkFile += "\\dialog.tlk";
+		ULONG64 k;
 
-		ResDebug2(
-			"ResourceManager::LoadTalkTables: Loading main tlk file '%s'...\n",
-			TlkFile.c_str( ));
+		memcpy( &k, p, sizeof( k ) );
 
-		m_BaseTlk = new TlkFileReader( TlkFile );
+		k *= m;
+		k ^= k >> r;
+		k *= m;
+
+		Hash ^= k;
+		Hash *= m;
+
+		p += 8;
 	}
-	catch (std::exception &e)
+
+	switch (Length & 7)
 	{
-		m_TextWriter->WriteText(
-			"WARNING: Exception '%s' loading base TLK.  STRREF lookup may be unavailable.\n",
-			e.what( ) );
+
+	case 7: Hash ^= (ULONG64) p[ 6 ] << 48;
+	case 6: Hash ^= (ULONG64) p[ 5 ] << 40;
+	case 5: Hash ^= (ULONG64) p[ 4 ] << 32;
+	case 4: Hash ^= (ULONG64) p[ 3 ] << 24;
+	case 3: Hash ^= (ULONG64) p[ 2 ] << 16;
+	case 2: Hash ^= (ULONG64) p[ 1 ] << 8;
+	case 1: Hash ^= (ULONG64) p[ 0 ];
+	        Hash *= m;
+
 	}
 
-#if PERF_TRACE
-	m_TextWriter->WriteText( "TLK: %lu\n", GetTickCount( ) - TimeSpent );
-#endif
+	Hash ^= Hash >> r;
+	Hash *= m;
+	Hash ^= Hash >> r;
+
+	return Hash;
 }
 
-std::string
-ResourceManager::GetResourceFilePath(
-	__in const std::string & RelPathName
+bool
+ResourceManager::GetResourceContentHash(
+	__in const NWN::ResRef32 & ResRef,
+	__in ResType Type,
+	__out ULONG64 & Hash
 	)
 /*++
 
 Routine Description:
 
-	This routine utilizes the standard search order to locate a path to a
-	given resource file.
+	This routine returns the content hash of a resource.  If the resource has
+	not yet been hashed, its contents are acquired (which hashes them if
+	content sharing is enabled) and the hash is remembered.
 
 Arguments:
 
-	RelPathName - Supplies the relative path name to search for.
+	ResRef - Supplies the resource name of the resource.
+
+	Type - Supplies the type of the resource.
+
+	Hash - Receives the content hash of the resource.
 
 Return Value:
 
-	The routine returns the fully qualified path name to use in the field.
+	The routine returns true if the resource exists, else false.  The routine
+	raises an std::exception on failure.
 
 Environment:
 
@@ -3314,52 +5812,60 @@ Environment:
 
 --*/
 {
-	std::string FullPath;
+	size_t                    EntryIndex;
+	EntryContentMap::iterator it;
+	DemandBufferPtr           Contents;
+	ContentIdentity           Identity;
 
-	//
-	// Prefer the home directory, then fall back to the installation directory.
-	//
+	EntryIndex = LookupResourceEntry( ResRef, Type );
 
-	FullPath  = m_HomeDir;
-	FullPath += "/";
-	FullPath += RelPathName;
+	if (EntryIndex == ResourceIndex::INVALID_INDEX)
+		return false;
 
-	if (_access( FullPath.c_str( ), 00 ))
+	it = m_EntryContent.find( EntryIndex );
+
+	if (it == m_EntryContent.end( ))
 	{
-		FullPath  = m_InstallDir;
-		FullPath += "/";
-		FullPath += RelPathName;
+		Contents = AcquireResourceContents( EntryIndex );
+		it       = m_EntryContent.find( EntryIndex );
 	}
 
-	return FullPath;
+	if (it != m_EntryContent.end( ))
+	{
+		Hash = it->second.Hash;
+		return true;
+	}
+
+	Identity.Hash = ComputeContentHash( Contents->GetData( ), Contents->GetSize( ) );
+	Identity.Slot = INVALID_CONTENT_SLOT;
+
+	m_EntryContent[ EntryIndex ] = Identity;
+
+	Hash = Identity.Hash;
+	return true;
 }
 
-bool
-ResourceManager::CheckModuleIfo(
-	__in const std::string & ModulePath,
-	__in bool Erf
-	) const
+void
+ResourceManager::InvalidateResourceEntry(
+	__in size_t EntryIndex
+	)
 /*++
 
 Routine Description:
 
-	This routine verifies that module.ifo is accessible in a given module
-	fully qualified path.  If module.ifo verification is turned off, then the
-	routine always returns true.
+	This routine discards any cached or prefetched contents of a resource
+	entry, after the entry was changed by a directory refresh.
 
-Arguments:
+	The accessor lock must not be held, as a prefetch of the entry that is in
+	progress is waited for.
 
-	ModulePath - Supplies the path to inquire about.
+Arguments:
 
-	Erf - Supples a Boolean value indicating true if the path refers to an ERF,
-	      else false if the path refers to a directory.
+	EntryIndex - Supplies the index of the resource entry to invalidate.
 
 Return Value:
 
-	The routine returns true if the path is acceptable as a module load path,
-	else false if the path was not acceptable.
-
-	On catastrophic failure, an std::exception is raised.
+	None.
 
 Environment:
 
@@ -3367,67 +5873,67 @@ Environment:
 
 --*/
 {
-	static const NWN::ResRef32 ResRef = { "module" };
+	DemandBufferPtr       Discarded;
+	EntryPinMap::iterator Pin;
 
-	if (!(m_ResManFlags & ResManFlagRequireModuleIfo))
-		return true;
+	//
+	// Shared contents remain cached for the other resources that share them;
+	// the entry simply no longer refers to them, and so releases any pins
+	// that it holds on them.  Pins on the entry's own contents are discarded
+	// along with the contents.
+	//
 
-	if (!Erf)
-	{
-		DirectoryFileReader Reader( ModulePath );
+	Pin = m_EntryPins.find( EntryIndex );
 
-		return DoesFileExistInResourceAccessor( Reader, ResRef, NWN::ResIFO );
-	}
-	else
+	if (Pin != m_EntryPins.end( ))
 	{
-		if (m_ResManFlags & ResManFlagErf16)
+		if (Pin->second.CacheKey != EntryIndex)
 		{
-			ErfFileReader16 Reader( ModulePath );
-
-			return DoesFileExistInResourceAccessor(
-				Reader,
-				ResRef,
-				NWN::ResIFO);
+			for (ULONG i = 0; i < Pin->second.PinCount; i += 1)
+				m_ResourceCache.Unpin( Pin->second.CacheKey );
 		}
-		else
-		{
-			ErfFileReader32 Reader( ModulePath );
 
-			return DoesFileExistInResourceAccessor(
-				Reader,
-				ResRef,
-				NWN::ResIFO);
-		}
+		m_EntryPins.erase( Pin );
 	}
+
+	m_ResourceCache.Remove( EntryIndex );
+	m_EntryContent.erase( EntryIndex );
+	m_Prefetcher.Lookup( EntryIndex, Discarded );
 }
 
 bool
-ResourceManager::DoesFileExistInResourceAccessor(
-	__in IResourceAccessor & Accessor,
-	__in const NWN::ResRef32 & ResRef,
-	__in NWN::ResType ResType
-	) const
+ResourceManager::ApplyDirectoryChange(
+	__in DirectoryFileReader * Directory,
+	__in size_t TierIndex,
+	__in const DirectoryFileReader::ResourceChange & Change,
+	__inout std::vector< size_t > & Vacated
+	)
 /*++
 
-Routine Description
-
-	This routine checks whether a file exists in a given resource accessor.
+Routine Description:
 
-	N.B.  It is assumed that the accessor allows a handle to be opened, which
-	      for some accessors implies that no files may already be opened.
+	This routine applies a single directory provider change to the resource
+	index, preserving the canonical precedence of resource providers.
 
 Arguments:
 
-	Accessor - Supplies the resource accessor to query.
+	Directory - Supplies the directory provider that changed.
 
-	ResRef - Supplies the RESREF of the file to query.
+	TierIndex - Supplies the index of the directory provider within the
+	            directory tier, counted from the end (as per ResourceEntry).
 
-	ResType - Supplies the ResType of the file to query.
+	Change - Supplies the change to apply.
+
+	Vacated - Supplies the array to which the index of a vacated resource
+	          entry is appended, should the change remove the provider of a
+	          resource.
 
 Return Value:
 
-	The routine returns true if the given file existed in the resource accessor
-	in question.
+	The routine returns true if the resource index entry changed, else false if
+	the change does not affect the resource index (for example, because a more
+	precedent provider supplies the resource).  The routine raises an
+	std::exception on failure.
 
 Environment:
 
@@ -3435,37 +5941,123 @@ Environment:
 
 --*/
 {
-	FileHandle    File;
+	ResourceEntry   Entry;
+	ResourceEntry * Current;
+	size_t          EntryIndex;
 
-	File = Accessor.OpenFile( ResRef, ResType );
+	Entry.Accessor  = Directory;
+	Entry.FileIndex = Change.FileIndex;
+	Entry.Tier      = TIER_DIRECTORY;
+	Entry.TierIndex = TierIndex;
 
-	if (File == INVALID_FILE)
-		return false;
+	EntryIndex = m_ResourceIndex.Find( Change.Name, Change.Type );
 
-	Accessor.CloseFile( File );
+	switch (Change.Change)
+	{
 
-	return true;
+	case DirectoryWatcher::ChangeAdded:
+		if (EntryIndex == ResourceIndex::INVALID_INDEX)
+		{
+			//
+			// A new resource is assigned the next index, which lines up with
+			// the resource entry array as both are appended in lockstep.
+			//
+
+			swutil::ScopedLock Lock( m_AccessorLock );
+
+			m_ResourceEntries.push_back( Entry );
+
+			try
+			{
+				m_ResourceIndex.Insert( Change.Name, Change.Type );
+			}
+			catch (...)
+			{
+				m_ResourceEntries.pop_back( );
+				throw;
+			}
+
+			return true;
+		}
+
+		Current = &m_ResourceEntries[ EntryIndex ];
+
+		if ((Current->Accessor != NULL) &&
+		    (!IsMorePrecedentEntry( Entry, *Current )))
+		{
+			return false;
+		}
+
+		{
+			swutil::ScopedLock Lock( m_AccessorLock );
+
+			*Current = Entry;
+		}
+
+		InvalidateResourceEntry( EntryIndex );
+		return true;
+
+	case DirectoryWatcher::ChangeRemoved:
+	case DirectoryWatcher::ChangeModified:
+		if (EntryIndex == ResourceIndex::INVALID_INDEX)
+			return false;
+
+		Current = &m_ResourceEntries[ EntryIndex ];
+
+		//
+		// Changes to a file that is shadowed by a more precedent provider do
+		// not affect the resource index.
+		//
+
+		if ((Current->Accessor != Directory) ||
+		    (Current->FileIndex != Change.FileIndex))
+		{
+			return false;
+		}
+
+		if (Change.Change == DirectoryWatcher::ChangeRemoved)
+		{
+			{
+				swutil::ScopedLock Lock( m_AccessorLock );
+
+				Current->Accessor = NULL;
+			}
+
+			Vacated.push_back( EntryIndex );
+		}
+
+		InvalidateResourceEntry( EntryIndex );
+		return true;
+
+	default:
+		return false;
+
+	}
 }
 
-size_t
-ResourceManager::ForceCloseOpenFileHandles(
+void
+ResourceManager::ReassignVacatedEntries(
+	__in const std::vector< size_t > & Vacated
 	)
 /*++
 
 Routine Description:
 
-	This routine forcibly closes all open files.  Any file handles that were
-	still open are invalidated (which would cause them to operate incorrectly
-	on the next usage).
+	This routine fills resource entries that were vacated by the removal of
+	their resource with the next most precedent provider of each resource.
+	Entries for which no other provider exists remain vacant, and are not
+	returned by resource lookups.
+
+	All resource providers are searched in the canonical order (as per
+	DiscoverResources), and the first provider found for each resource wins.
 
 Arguments:
 
-	None.
+	Vacated - Supplies the indicies of the vacated resource entries.
 
 Return Value:
 
-	The routine returns the number of outstanding file handles that had to be
-	forcibly closed.
+	None.  The routine raises an std::exception on failure.
 
 Environment:
 
@@ -3473,82 +6065,182 @@ Environment:
 
 --*/
 {
-	size_t FilesForceClosed;
-
-	FilesForceClosed = 0;
+	ResourceIndex         Pending;
+	std::vector< size_t > PendingEntries;
+	ResRefT               ResRef;
+	ResType               Type;
+	size_t                Remaining;
 
 	//
-	// Unload 2DA files.
+	// Index the names of the resources that are still vacant (a resource may
+	// have been added back by a later change in the same refresh).
 	//
 
-	m_2DAs.clear( );
+	Pending.Reserve( Vacated.size( ) );
+	PendingEntries.reserve( Vacated.size( ) );
 
-	//
-	// Unload TLK files.
-	//
+	for (std::vector< size_t >::const_iterator it = Vacated.begin( );
+	     it != Vacated.end( );
+	     ++it)
+	{
+		if (m_ResourceEntries[ *it ].Accessor != NULL)
+			continue;
 
-	m_BaseTlk      = NULL;
-	m_AlternateTlk = NULL;
+		m_ResourceIndex.GetKey( *it, ResRef, Type );
 
-	//
-	// Close any still-open file handles.
-	//
+		if (Pending.Insert( ResRef, Type ))
+			PendingEntries.push_back( *it );
+	}
+
+	Remaining = PendingEntries.size( );
+
+	if (Remaining == 0)
+		return;
+
+	swutil::ScopedLock Lock( m_AccessorLock );
+
+	for (size_t i = 0; (i < MAX_TIERS) && (Remaining != 0); i += 1)
+	{
+		size_t j;
+
+		j = 0;
+
+		for (ResourceAccessorVec::reverse_iterator it = m_ResourceFiles[ i ].rbegin( );
+		     (it != m_ResourceFiles[ i ].rend( )) && (Remaining != 0);
+		     ++it)
+		{
+			FileId MaxId;
+
+			j += 1;
+
+			MaxId = (*it)->GetEncapsulatedFileCount( );
+
+			for (FileId CurId = MaxId; CurId != 0; CurId -= 1)
+			{
+				ResourceEntry * Entry;
+				size_t          PendingIndex;
+
+				if (!(*it)->GetEncapsulatedFileEntry(
+					CurId - 1,
+					ResRef,
+					Type))
+				{
+					continue;
+				}
+
+				PendingIndex = Pending.Find( ResRef, Type );
+
+				if (PendingIndex == ResourceIndex::INVALID_INDEX)
+					continue;
+
+				Entry = &m_ResourceEntries[ PendingEntries[ PendingIndex ] ];
+
+				if (Entry->Accessor != NULL)
+					continue;
+
+				Entry->Accessor  = (*it);
+				Entry->FileIndex = CurId - 1;
+				Entry->Tier      = i;
+				Entry->TierIndex = j;
+
+				if (--Remaining == 0)
+					break;
+			}
+		}
+	}
+}
+
+DemandBufferPtr
+ResourceManager::PrefetchLoadRoutine(
+	__in void * Context,
+	__in size_t EntryIndex
+	)
+/*++
+
+Routine Description:
+
+	This routine is invoked on a prefetch worker thread in order to load a
+	resource entry into memory.
+
+	A mapped resource is not actually read until its pages are first touched,
+	so each page is touched here in order that the I/O happens on the worker
+	thread instead of on the thread that later consumes the resource.
+
+Arguments:
+
+	Context - Supplies the owning ResourceManager object.
+
+	EntryIndex - Supplies the index of the resource entry to load.
+
+Return Value:
+
+	The routine returns the demand buffer on success.  The routine raises an
+	std::exception on failure.
+
+Environment:
+
+	User mode, prefetch worker thread.
+
+--*/
+{
+	ResourceManager * ResMan = (ResourceManager *) Context;
+	DemandBufferPtr   Buffer;
 
-	FilesForceClosed += m_ResFileHandles.size( );
+	Buffer = ResMan->LoadResourceEntry( EntryIndex );
 
-	for (ResHandleMap::iterator it = m_ResFileHandles.begin( );
-	     it != m_ResFileHandles.end( );
-	     ++it)
+	if (Buffer->IsMapped( ))
 	{
-		m_TextWriter->WriteText(
-			"WARNING: Closing leaked ResourceManager handle %08X\n",
-			it->first );
-		it->second.Accessor->CloseFile( it->second.Handle );
-	}
-
-	m_ResFileHandles.clear( );
+		const volatile unsigned char * Data;
+		size_t                         Size;
+		SYSTEM_INFO                    SysInfo;
+		unsigned char                  Sum;
 
-	FilesForceClosed += m_NameMap.size( );
+		GetSystemInfo( &SysInfo );
 
-	//
-	// If we had demand loaded any files that had to be unpacked, then clear
-	// them out now.
-	//
+		Data = Buffer->GetData( );
+		Size = Buffer->GetSize( );
+		Sum  = 0;
 
-	for (ResRefNameMap::const_iterator it = m_NameMap.begin( );
-	     it != m_NameMap.end( );
-	     ++it)
-	{
-		m_TextWriter->WriteText(
-			"WARNING: Unloading leaked resource '%s' (%lu refs)...\n",
-			it->second.ResourceFileName.c_str( ),
-			it->second.Refs );
+		for (size_t Offset = 0; Offset < Size; Offset += SysInfo.dwPageSize)
+			Sum ^= Data[ Offset ];
 
-		if (it->second.Delete)
-			DeleteFileA( it->second.ResourceFileName.c_str( ) );
+		if (Size != 0)
+			Sum ^= Data[ Size - 1 ];
 	}
 
-	m_NameMap.clear( );
-
-	return FilesForceClosed;
+	return Buffer;
 }
 
-void
-ResourceManager::CleanDemandLoadedFiles(
+const TwoDAFileReader *
+ResourceManager::Get2DA(
+	__in const std::string & ResourceName
 	)
 /*++
 
 Routine Description:
 
-	This routine unloads any demand-loaded resource data.
+	This routine retrieves a cached 2DA reader context.  If the 2DA has not yet
+	been cached, then it will be demand-loaded.  Should the 2DA load fail, then
+	the 2DA will be negatively cached.
+
+	If the 2DA cache is frozen, only the frozen cache is consulted and nothing
+	is demand-loaded, as loading is not safe to perform concurrently.  A 2DA
+	that was not included when the cache was frozen is reported as missing.
 
 Arguments:
 
-	None.
+	ResourceName - Supplies the RESREF of the 2DA file.  It is the callers
+	               responsibility to supply a canonical RESREF identifier.
 
 Return Value:
 
-	None.
+	The routine returns a pointer to a TwoDAFileReader object on success, else
+	it returns NULL on failure, or if the cache is frozen and does not hold the
+	2DA.  The returned pointer may be used until the module resources are
+	unloaded or the 2DA cache is cleared.
+
+	If the 2DA cache is frozen, the routine may be called from multiple threads
+	concurrently.
 
 Environment:
 
@@ -3556,66 +6248,120 @@ Environment:
 
 --*/
 {
+	TwoDANameMap::const_iterator   it;
+	const TwoDAGeneration        * Generation;
+
 	//
-	// Close out any open file references (internal or external).
+	// If the cache is frozen, only the current generation is consulted, and no
+	// state is modified.  The lookup is counted so that Freeze2DACache knows
+	// when superseded generations are no longer in use.
 	//
 
-	ForceCloseOpenFileHandles( );
+	InterlockedIncrement( &m_Frozen2DALookups );
 
-	//
-	// Clear all resource id entries and the name (+type) to resource id map
-	// table.
-	//
+	Generation = m_Frozen2DAs;
 
-	m_NameIdMap.clear( );
-	m_ResourceEntries.clear( );
+	if (Generation != NULL)
+	{
+		const TwoDAFileReader * Reader;
+		size_t                  Index;
 
-	//
-	// Unload all resource providers.  First, sever the canonical search order
-	// links.
-	//
+		Index = Generation->Index.Find( ResourceName, NWN::Res2DA );
 
-	for (size_t i = 0; i < MAX_TIERS; i += 1)
-		m_ResourceFiles[ i ].clear( );
+		if (Index == ResourceIndex::INVALID_INDEX)
+			Reader = NULL;
+		else
+			Reader = Generation->Readers[ Index ].get( );
 
-	//
-	// Unload all HAK (and other ERF) files.
-	//
+		InterlockedDecrement( &m_Frozen2DALookups );
 
-	m_HakFiles.clear( );
-	m_HakFiles16.clear( );
+		return Reader;
+	}
 
-	//
-	// Unload all directories.
-	//
+	InterlockedDecrement( &m_Frozen2DALookups );
 
-	m_DirFiles.clear( );
+	it = m_2DAs.find( ResourceName );
+
+	if (it == m_2DAs.end( ))
+	{
+		//
+		// Try and load the .2DA on demand using the resource manager's search
+		// hierarchy for locating the .2DA file.
+		//
+		// If successful, cache the 2DA object in-memory, drop the demanded
+		// resource buffer (as the TwoDAFileReader does not require continual
+		// access to the raw contents), and delegate the Get2DAString requets
+		// to the newly-instantiated TwoDAReader object.
+		//
+		// N.B.  The 2DA is parsed directly from memory so that no temporary
+		//       file need be created for encapsulated 2DAs.  A current binary
+		//       2DA cache file is used in preference to parsing the 2DA.
+		//
+
+		try
+		{
+			TwoDAFileReaderPtr Reader;
+
+			Reader = Load2DA( ResourceName );
+
+			m_2DAs.insert( TwoDANameMap::value_type( ResourceName, Reader ) );
+
+			return Reader.get( );
+		}
+		catch (std::exception &e)
+		{
+			m_TextWriter->WriteText(
+				"WARNING: Failed to access 2DA '%s': exception '%s'.\n",
+				ResourceName.c_str( ),
+				e.what( ));
+
+			//
+			// Cache a NULL reader pointer so that we don't try and hit the
+			// resource list each time from now on.  Failures to load a 2DA are
+			// not temporary failures and are typically symptomatic of a critical
+			// condition such as a missing or malformed .2DA on-disk.
+			//
+
+			m_2DAs.insert( TwoDANameMap::value_type( ResourceName, (TwoDAFileReader *) NULL ) );
+		}
+
+		return NULL;
+	}
 
 	//
-	// Unload all zip files.
+	// Use the cached 2DA reader.
 	//
 
-	m_ZipFiles.clear( );
+	return it->second.get( );
 }
 
-void
-ResourceManager::CleanOldTempFiles(
-	__in const char * TempPath
+TwoDAFileReaderPtr
+ResourceManager::Load2DA(
+	__in const std::string & ResourceName
 	)
 /*++
 
 Routine Description:
 
-	This routine cleans up stale temporary files for instances of the client
-	extension that did not cleanly exit.
+	This routine creates a TwoDAFileReader for a 2DA.  If a binary 2DA cache
+	file exists for the 2DA, and was built from the same 2DA contents, then the
+	reader is created from the binary cache file.  Otherwise, the text 2DA is
+	parsed and a new binary cache file is written for it.
+
+	The binary cache file is keyed by the 2DA's size and content hash rather
+	than by a timestamp, as encapsulated resources have no timestamp of their
+	own, and as the same 2DA name may be supplied by a different provider on a
+	subsequent load.
 
 Arguments:
 
-	TempPath - Supplies the path to the temp directory.
+	ResourceName - Supplies the RESREF of the 2DA file.  It is the callers
+	               responsibility to supply a canonical RESREF identifier.
 
 Return Value:
 
-	None.  Raises an std::exception on catastrophic failure.
+	The routine returns the new reader.  On failure, an std::exception is
+	raised.
 
 Environment:
 
@@ -3623,90 +6369,137 @@ Environment:
 
 --*/
 {
-	std::string       FileName;
-	HANDLE            Find;
-	WIN32_FIND_DATAA  FindData;
+	TwoDAFileReaderPtr Reader;
+	DemandBufferPtr    Res;
+	std::string        CacheError;
+
+	Res    = DemandView( ResourceName, NWN::Res2DA );
+	Reader = Create2DAReader(
+		ResourceName,
+		*Res,
+		Get2DACacheFileName( ResourceName ),
+		CacheError );
+
+	if (!CacheError.empty( ))
+	{
+		m_TextWriter->WriteText(
+			"WARNING: Failed to write binary 2DA cache for '%s': exception '%s'.\n",
+			ResourceName.c_str( ),
+			CacheError.c_str( ));
+	}
 
-	FileName  = TempPath;
-	FileName += "\\NWN2CliExt_*.";
+	return Reader;
+}
 
-	Find = FindFirstFileA( FileName.c_str( ), &FindData );
+TwoDAFileReaderPtr
+ResourceManager::Create2DAReader(
+	__in const std::string & ResourceName,
+	__in const DemandBuffer & Res,
+	__in const std::string & CacheFileName,
+	__out std::string & CacheError
+	)
+/*++
 
-	if (Find == INVALID_HANDLE_VALUE)
-		return;
+Routine Description:
 
-	try
-	{
-		do
-		{
-			HANDLE Event;
+	This routine creates a TwoDAFileReader for the contents of a 2DA.  If a
+	binary 2DA cache file name is supplied, a current cache file is used in
+	preference to parsing the 2DA, and a new cache file is written if the 2DA
+	had to be parsed.
 
-			if ((!strcmp( FindData.cFileName, "." )) ||
-			    (!strcmp( FindData.cFileName, ".." )))
-				continue;
+	No ResourceManager state is accessed, so that the routine may be called
+	from worker threads.
 
-			if (!(FindData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
-				continue;
+Arguments:
 
-			if (strncmp( FindData.cFileName, "NWN2CliExt_", 11 ))
-				continue;
+	ResourceName - Supplies the RESREF of the 2DA file, for diagnostic
+	               purposes.
 
-			//
-			// Check if the remote resource manager is still alive.
-			//
+	Res - Supplies the raw contents of the text 2DA.
 
-			Event = OpenEventA( SYNCHRONIZE, FALSE, FindData.cFileName );
+	CacheFileName - Supplies the binary 2DA cache file name, else an empty
+	                string if the binary 2DA cache is not to be used.
 
-			if (Event != NULL)
-			{
-				CloseHandle( Event );
-				continue;
-			}
+	CacheError - Receives a description of the failure to write the binary
+	             2DA cache file, if any.  A failure to write the cache file
+	             only costs a reparse on the next load, so it is not fatal.
 
-			//
-			// It's gone, clean the files up.
-			//
+Return Value:
 
-			FileName  = TempPath;
-			FileName += "\\";
-			FileName += FindData.cFileName;
+	The routine returns the new reader.  On failure, an std::exception is
+	raised.
 
-			m_TextWriter->WriteText(
-				"Cleaning up defunct resource manager instance '%s'...\n",
-				FindData.cFileName );
+Environment:
 
-			DeleteDirectoryFiles( FileName.c_str( ) );
-			RemoveDirectoryA( FileName.c_str( ) );
+	User mode, potentially on a worker thread.
 
-		} while (FindNextFileA( Find, &FindData )) ;
+--*/
+{
+	TwoDAFileReaderPtr Reader;
+	ULONG64            SourceHash;
+
+	CacheError.clear( );
+
+	if (CacheFileName.empty( ))
+	{
+		Reader = new TwoDAFileReader(
+			Res.GetData( ),
+			Res.GetSize( ),
+			ResourceName );
+
+		return Reader;
 	}
-	catch (...)
+
+	SourceHash = TwoDAFileReader::ComputeSourceHash(
+		Res.GetData( ),
+		Res.GetSize( ) );
+
+	Reader = TwoDAFileReader::LoadBinaryCache(
+		CacheFileName,
+		Res.GetSize( ),
+		SourceHash );
+
+	if (Reader.get( ) != NULL)
+		return Reader;
+
+	Reader = new TwoDAFileReader(
+		Res.GetData( ),
+		Res.GetSize( ),
+		ResourceName );
+
+	try
 	{
-		FindClose( Find );
-		throw;
+		Reader->WriteBinaryCache(
+			CacheFileName,
+			Res.GetSize( ),
+			SourceHash );
+	}
+	catch (std::exception &e)
+	{
+		CacheError = e.what( );
 	}
 
-	FindClose( Find );
+	return Reader;
 }
 
-void
-ResourceManager::DeleteDirectoryFiles(
-	__in const char * DirPath
-	)
+std::string
+ResourceManager::Get2DACacheFileName(
+	__in const std::string & ResourceName
+	) const
 /*++
 
 Routine Description:
 
-	This routine removes all files in a directory.  The removal is not a
-	recursive remove.
+	This routine returns the binary 2DA cache file name for a 2DA.
 
 Arguments:
 
-	DirPath - Supplies the path to the directory to delete.
+	ResourceName - Supplies the RESREF of the 2DA file.
 
 Return Value:
 
-	None.  Raises an std::exception on catastrophic failure.
+	The routine returns the cache file name, else an empty string if the
+	binary 2DA cache is disabled.  On failure, an std::exception is raised.
 
 Environment:
 
@@ -3714,63 +6507,78 @@ Environment:
 
 --*/
 {
-	std::string       FileName;
-	HANDLE            Find;
-	WIN32_FIND_DATAA  FindData;
+	std::string CacheFileName;
 
-	FileName  = DirPath;
-	FileName += "\\*.*";
+	if ((m_TwoDACachePath.empty( )) || (m_ResManFlags & ResManFlagNo2DACache))
+		return CacheFileName;
 
-	Find = FindFirstFileA( FileName.c_str( ), &FindData );
+	CacheFileName  = m_TwoDACachePath;
+	CacheFileName += ResourceName;
+	CacheFileName += ".2db";
 
-	if (Find == INVALID_HANDLE_VALUE)
-		return;
+	return CacheFileName;
+}
 
-	try
-	{
-		do
-		{
-			if ((!strcmp( FindData.cFileName, "." )) ||
-			    (!strcmp( FindData.cFileName, "..")))
-				continue;
+void
+ResourceManager::Clear2DACache(
+	)
+/*++
 
-			FileName  = DirPath;
-			FileName += "\\";
-			FileName += FindData.cFileName;
+Routine Description:
 
-			if (FindData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
-				RemoveDirectoryA( FileName.c_str( ) );
-			else
-				DeleteFileA( FileName.c_str( ) );
-		} while (FindNextFileA( Find, &FindData )) ;
-	}
-	catch (...)
-	{
-		FindClose( Find );
-		throw;
-	}
+	This routine unloads all cached 2DAs, and thaws the 2DA cache if it had
+	been frozen.  2DAs are subsequently demand loaded on first reference.
+
+	No other thread may be accessing 2DAs while the cache is cleared.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
 
-	FindClose( Find );
+--*/
+{
+	m_2DAs.clear( );
+
+	Free2DAGenerations( false );
 }
 
 void
-ResourceManager::DiscoverResources(
+ResourceManager::Freeze2DACache(
+	__in_opt const std::vector< std::string > * ResourceNames
 	)
 /*++
 
 Routine Description:
 
-	This routine discovers all resources across all loaded resource accessors,
-	creating resource index entries for each resource.  The canonical order of
-	resource providers and names within a provider is preserved.
+	This routine preloads a set of 2DAs and publishes a new, immutable 2DA
+	cache generation containing them, along with every 2DA that was cached
+	already (either lazily, or in the previous generation).  While the cache
+	is frozen, 2DAs outside of the generation are not demand-loaded; Get2DA
+	returns NULL for them.
+
+	The raw 2DA contents are demanded serially, as resource providers are not
+	generally safe for concurrent use.  The 2DAs are then parsed (or loaded
+	from their binary cache files) in parallel.  Finally, the new generation is
+	published with an interlocked exchange, so that concurrent Get2DA callers
+	observe either the old or the new generation in its entirety.
 
 Arguments:
 
-	None.
+	ResourceNames - Optionally supplies the RESREFs of the 2DAs to preload.  If
+	                NULL, every 2DA in the resource index is preloaded.
 
 Return Value:
 
-	None.  Raises an std::exception on catastrophic failure.
+	None.  On failure, an std::exception is raised and the 2DA cache is left
+	unchanged.
 
 Environment:
 
@@ -3778,227 +6586,255 @@ Environment:
 
 --*/
 {
-	ResourceEntry Entry;
-	FileId        MaxId;
-	ResRefT       ResRef;
-	ResType       Type;
-	char          TypeStr[ 32 ];
-	std::string   LookupName;
-	FileId        ResourceCount;
-#if defined(RES_DEBUG) && RES_DEBUG >= 1
-	DWORD         TimeSpent;
-#endif
+	TwoDAPreloadVec           Preloads;
+	TwoDAGeneration         * Generation;
+	const TwoDAGeneration   * Previous;
 
 	//
-	// First, total all files available to minimize reallocation.
+	// Determine the set of 2DAs to load.
 	//
 
-	ResourceCount = 0;
+	if (ResourceNames != NULL)
+	{
+		Preloads.resize( ResourceNames->size( ) );
 
-	for (size_t i = 0; i < MAX_TIERS; i += 1)
+		for (size_t i = 0; i < ResourceNames->size( ); i += 1)
+			Preloads[ i ].ResourceName = (*ResourceNames)[ i ];
+	}
+	else
 	{
-		for (ResourceAccessorVec::reverse_iterator it = m_ResourceFiles[ i ].rbegin( );
-		     it != m_ResourceFiles[ i ].rend( );
-		     ++it)
+		FileId Count;
+
+		Count = GetEncapsulatedFileCount( );
+
+		for (FileId i = 0; i < Count; i += 1)
 		{
-			ResourceCount += (*it)->GetEncapsulatedFileCount( );
-		}
-	}
+			NWN::ResRef32 ResRef;
+			ResType       Type;
 
-	m_ResourceEntries.reserve( (size_t) ResourceCount );
+			if (!GetEncapsulatedFileEntry( i, ResRef, Type ))
+				continue;
 
-#if defined(RES_DEBUG) && RES_DEBUG >= 1
-	m_TextWriter->WriteText( "Indexing %lu resources...\n", ResourceCount );
+			if (Type != NWN::Res2DA)
+				continue;
 
-	TimeSpent = GetTickCount( );
-#endif
+			Preloads.push_back( TwoDAPreload( ) );
+			Preloads.back( ).ResourceName = StrFromResRef( ResRef );
+		}
+	}
 
 	//
-	// Search each tier in turn.
+	// Demand the raw contents of each 2DA on this thread.  A 2DA that cannot
+	// be demanded is negatively cached, just as it would be by Get2DA.
 	//
 
-	for (size_t i = 0; i < MAX_TIERS; i += 1)
+	for (TwoDAPreloadVec::iterator it = Preloads.begin( );
+	     it != Preloads.end( );
+	     ++it)
 	{
-		size_t j;
-
-		//
-		// Search each tier in order, based on the defined behavior of the
-		// BioWare resource manager.  The most recently added resource provider
-		// is searched first.
-		//
+		try
+		{
+			it->Res           = DemandView( it->ResourceName, NWN::Res2DA );
+			it->CacheFileName = Get2DACacheFileName( it->ResourceName );
+		}
+		catch (std::exception &e)
+		{
+			it->Res   = NULL;
+			it->Error = e.what( );
+		}
+	}
 
-		j = 0;
+	ExecuteParallelWork(
+		Preloads.size( ),
+		Preload2DA,
+		&Preloads,
+		(m_ResManFlags & ResManFlagNoParallelLoad) ? 1 : 0);
 
-		for (ResourceAccessorVec::reverse_iterator it = m_ResourceFiles[ i ].rbegin( );
-		     it != m_ResourceFiles[ i ].rend( );
-		     ++it)
-		{
-			j += 1;
+	//
+	// Build the new generation.  Preloaded 2DAs take precedence over any that
+	// were cached previously.
+	//
 
-			MaxId = (*it)->GetEncapsulatedFileCount( );
+	Generation = new TwoDAGeneration;
+	Previous   = m_Frozen2DAs;
 
-			//
-			// Iterate over each file, creating file entries for each resource
-			// type in turn.
-			//
-			// We search in reverse order, taking the last entry.  This allows
-			// us to preserve the order of the most recent entry of a
-			// particular tier winning, used to ensure that we retrieve the
-			// most precedent patched file for inbox datafiles. 
-			//
+	try
+	{
+		Generation->Index.Reserve(
+			Preloads.size( ) +
+			m_2DAs.size( ) +
+			((Previous != NULL) ? Previous->Readers.size( ) : 0) );
 
-			for (FileId CurId = MaxId; CurId != 0; CurId -= 1)
+		for (TwoDAPreloadVec::const_iterator it = Preloads.begin( );
+		     it != Preloads.end( );
+		     ++it)
+		{
+			if (!it->Error.empty( ))
 			{
-				const char * p;
+				m_TextWriter->WriteText(
+					"WARNING: Failed to access 2DA '%s': exception '%s'.\n",
+					it->ResourceName.c_str( ),
+					it->Error.c_str( ));
+			}
 
-				//
-				// Get the resource name and type at this index.
-				//
+			if (!it->CacheError.empty( ))
+			{
+				m_TextWriter->WriteText(
+					"WARNING: Failed to write binary 2DA cache for '%s': exception '%s'.\n",
+					it->ResourceName.c_str( ),
+					it->CacheError.c_str( ));
+			}
 
-				if (!(*it)->GetEncapsulatedFileEntry(
-					CurId - 1,
-					ResRef,
-					Type))
-				{
-					//
-					// It might be an unrecognized type, ignore it if so.
-					//
-					continue;
-				}
+			if (it->ResourceName.size( ) > sizeof( NWN::ResRef32 ))
+				continue;
 
-				p = (const char *) memchr(
-					ResRef.RefStr,
-					'\0',
-					sizeof( ResRef.RefStr ) );
+			if (Generation->Index.Insert( ResRef32FromStr( it->ResourceName ), NWN::Res2DA ))
+				Generation->Readers.push_back( it->Reader );
+		}
 
-				//
-				// Ensure that we have not already claimed this name yet.  We
-				// allow only one mapping for a particular name (+type), and it
-				// is the most precedent one in the canonical search order.
-				//
+		for (TwoDANameMap::const_iterator it = m_2DAs.begin( );
+		     it != m_2DAs.end( );
+		     ++it)
+		{
+			if (it->first.size( ) > sizeof( NWN::ResRef32 ))
+				continue;
 
-				LookupName = _itoa( (int) Type, TypeStr, 10 );
-				LookupName.push_back( 'T' );
+			if (Generation->Index.Insert( ResRef32FromStr( it->first ), NWN::Res2DA ))
+				Generation->Readers.push_back( it->second );
+			else if (it->second.get( ) != NULL)
+				m_Retired2DAReaders.push_back( it->second );
+		}
 
-				if (p == NULL)
-					LookupName.append( ResRef.RefStr, sizeof( ResRef.RefStr ) );
-				else
-					LookupName.append( ResRef.RefStr, p - ResRef.RefStr );
+		if (Previous != NULL)
+		{
+			for (size_t i = 0; i < Previous->Readers.size( ); i += 1)
+			{
+				NWN::ResRef32 ResRef;
+				ResType       Type;
 
-				//
-				// Skip duplicate entry, we've already found the most precedent
-				// version.
-				//
+				Previous->Index.GetKey( i, ResRef, Type );
 
-				if (m_NameIdMap.find( LookupName ) != m_NameIdMap.end( ))
-					continue;
+				if (Generation->Index.Insert( ResRef, Type ))
+					Generation->Readers.push_back( Previous->Readers[ i ] );
+				else if (Previous->Readers[ i ].get( ) != NULL)
+					m_Retired2DAReaders.push_back( Previous->Readers[ i ] );
+			}
+		}
 
-				//
-				// First one, add it as the most precedent.
-				//
+		m_2DAGenerations.push_back( Generation );
+	}
+	catch (...)
+	{
+		delete Generation;
+		throw;
+	}
 
-				Entry.Accessor  = (*it);
-				Entry.FileIndex = CurId - 1;
-				Entry.Tier      = i;
-				Entry.TierIndex = j;
+	//
+	// Publish the new generation.  The previous generation is retained, as
+	// other threads may still be using it (or readers obtained from it).
+	//
 
-//				m_TextWriter->WriteText( "Found %s\n", LookupName.c_str( ) );
+	InterlockedExchangePointer(
+		(PVOID volatile *) &m_Frozen2DAs,
+		Generation );
 
-				m_ResourceEntries.push_back( Entry );
+	m_2DAs.clear( );
 
-				m_NameIdMap.insert(
-					ResourceEntryMap::value_type(
-						LookupName,
-						m_ResourceEntries.size( ) - 1
-						)
-					);
-			}
-		}
-	}
+	//
+	// Release the superseded generations if no lookup is in progress.  Any
+	// lookup that starts from here on observes the new generation.  If a
+	// lookup is in progress, the superseded generations are released by a
+	// later freeze instead.
+	//
 
-#if defined(RES_DEBUG) && RES_DEBUG >= 1
-	m_TextWriter->WriteText( "DISCOVER: %lu\n", GetTickCount( ) - TimeSpent );
-#endif
+	if (InterlockedCompareExchange( &m_Frozen2DALookups, 0, 0 ) == 0)
+		Free2DAGenerations( true );
 }
 
-ResourceManager::FileHandle
-ResourceManager::AllocateFileHandle(
+void
+ResourceManager::Preload2DA(
+	__in void * Context,
+	__in size_t WorkItem
 	)
 /*++
 
 Routine Description:
 
-	This routine allocates a new file handle to return to a caller for purposes
-	of accessing resource data.
+	This routine creates the reader for a single preloaded 2DA.  It is invoked
+	in parallel for each 2DA by Freeze2DACache.
 
-	The returned handle value is only unique if the caller inserts it into the
-	handle table before another call to AllocateFileHandle.
+	Only the preload descriptor for this work item is touched.
 
 Arguments:
 
-	None.
+	Context - Supplies the 2DA preload vector.
+
+	WorkItem - Supplies the index of the 2DA preload to perform.
 
 Return Value:
 
-	The routine returns a legal FileHandle value on success, else it returns
-	INVALID_FILE if there were no more file handles available to return.
+	None.  Failures are recorded in the preload descriptor.
 
 Environment:
 
-	User mode.
+	User mode, potentially on a worker thread.
 
 --*/
 {
-	FileHandle Handle;
-	FileHandle FirstHandle;
-	
-	Handle = m_NextFileHandle++;
-
-	if (Handle == INVALID_FILE)
-		Handle = m_NextFileHandle++;
+	TwoDAPreload & Preload = (*(TwoDAPreloadVec *) Context)[ WorkItem ];
 
-	FirstHandle = Handle;
+	if (Preload.Res.get( ) == NULL)
+		return;
 
-	while (m_ResFileHandles.find( Handle ) != m_ResFileHandles.end( ) )
+	try
 	{
-		Handle = m_NextFileHandle++;
-
-		if (Handle == INVALID_FILE)
-			Handle = m_NextFileHandle++;
-
-		//
-		// If we've wrapped, then there are no handles left to give out.  Fail.
-		//
+		Preload.Reader = Create2DAReader(
+			Preload.ResourceName,
+			*Preload.Res,
+			Preload.CacheFileName,
+			Preload.CacheError );
+	}
+	catch (std::exception &e)
+	{
+		Preload.Reader = NULL;
 
-		if (Handle == FirstHandle)
-			return INVALID_FILE;
+		try
+		{
+			Preload.Error = e.what( );
+		}
+		catch (std::bad_alloc)
+		{
+		}
 	}
 
-	return Handle;
+	//
+	// The raw 2DA contents are no longer required.
+	//
+
+	Preload.Res = NULL;
 }
 
-const TwoDAFileReader *
-ResourceManager::Get2DA(
-	__in const std::string & ResourceName
+void
+ResourceManager::Free2DAGenerations(
 	)
 /*++
 
 Routine Description:
 
-	This routine retrieves a cached 2DA reader context.  If the 2DA has not yet
-	been cached, then it will be demand-loaded.  Should the 2DA load fail, then
-	the 2DA will be negatively cached.
+	This routine releases frozen 2DA cache generations.  Either every
+	generation is released and the 2DA cache is thawed, or only the
+	generations older than the current one are released.
+
+	No other thread may be accessing the generations that are released.
 
 Arguments:
 
-	ResourceName - Supplies the RESREF of the 2DA file.  It is the callers
-	               responsibility to supply a canonical RESREF identifier.
+	KeepCurrent - Supplies true to keep the current generation (and the
+	              retired readers), releasing only older generations.
 
 Return Value:
 
-	The routine returns a pointer to a TwoDAFileReader object on success, else
-	it returns NULL on failure.  The returned pointer may be used until the
-	module resources are unloaded.
+	None.
 
 Environment:
 
@@ -4006,58 +6842,28 @@ Environment:
 
 --*/
 {
-	TwoDANameMap::const_iterator it;
+	TwoDAGeneration * Current;
 
-	it = m_2DAs.find( ResourceName );
+	Current = KeepCurrent ? m_Frozen2DAs : NULL;
 
-	if (it == m_2DAs.end( ))
+	if (!KeepCurrent)
 	{
-		//
-		// Try and load the .2DA on demand using the resource manager's search
-		// hierarchy for locating the .2DA file.
-		//
-		// If successful, cache the 2DA object in-memory, drop the demanded
-		// resource reference (as the TwoDAFileReader does not require
-		// continual file access), and delegate the Get2DAString requets to the
-		// newly-instantiated TwoDAReader object.
-		//
-
-		try
-		{
-			TwoDAFileReaderPtr Reader;
-			DemandResourceStr  Res( *this, ResourceName, NWN::Res2DA );
-
-			Reader = new TwoDAFileReader( Res );
-
-			m_2DAs.insert( TwoDANameMap::value_type( ResourceName, Reader ) );
-
-			return Reader.get( );
-		}
-		catch (std::exception &e)
-		{
-			m_TextWriter->WriteText(
-				"WARNING: Failed to access 2DA '%s': exception '%s'.\n",
-				ResourceName.c_str( ),
-				e.what( ));
-
-			//
-			// Cache a NULL reader pointer so that we don't try and hit the
-			// resource list each time from now on.  Failures to load a 2DA are
-			// not temporary failures and are typically symptomatic of a critical
-			// condition such as a missing or malformed .2DA on-disk.
-			//
-
-			m_2DAs.insert( TwoDANameMap::value_type( ResourceName, (TwoDAFileReader *) NULL ) );
-		}
+		m_Frozen2DAs = NULL;
+		m_Retired2DAReaders.clear( );
+	}
 
-		return NULL;
+	for (TwoDAGenerationVec::iterator it = m_2DAGenerations.begin( );
+	     it != m_2DAGenerations.end( );
+	     ++it)
+	{
+		if (*it != Current)
+			delete *it;
 	}
 
-	//
-	// Use the cached 2DA reader.
-	//
+	m_2DAGenerations.clear( );
 
-	return it->second.get( );
+	if (Current != NULL)
+		m_2DAGenerations.push_back( Current );
 }
 
 template DemandResource< std::string >;
@@ -4079,3 +6885,21 @@ ResourceManager::LoadEncapsulatedFile< NWN::ResRef32 >(
 	__in IResourceAccessor< NWN::ResRef32 >::FileId FileIndex,
 	__out std::vector< unsigned char > & FileContents
 	);
+
+template
+void
+ResourceManager::LoadEncapsulatedFiles< NWN::ResRef16 >(
+	__in IResourceAccessor< NWN::ResRef16 > * Accessor,
+	__in size_t Count,
+	__in_ecount( Count ) const IResourceAccessor< NWN::ResRef16 >::FileId * FileIndicies,
+	__out_ecount( Count ) std::vector< unsigned char > * FileContents
+	);
+
+template
+void
+ResourceManager::LoadEncapsulatedFiles< NWN::ResRef32 >(
+	__in IResourceAccessor< NWN::ResRef32 > * Accessor,
+	__in size_t Count,
+	__in_ecount( Count ) const IResourceAccessor< NWN::ResRef32 >::FileId * FileIndicies,
+	__out_ecount( Count ) std::vector< unsigned char > * FileContents
+	);
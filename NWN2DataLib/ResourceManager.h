@@ -23,6 +23,11 @@ Abstract:
 #include "MeshManager.h"
 
 #include "ResourceAccessor.h"
+#include "DemandBuffer.h"
+#include "ResourceIndex.h"
+#include "ResourceIndexCache.h"
+#include "ResourcePrefetcher.h"
+#include "ResourceCache.h"
 #include "ErfFileReader.h"
 #include "DirectoryFileReader.h"
 #include "ZipFileReader.h"
@@ -129,6 +134,67 @@ public:
 
 		ResManFlagRequireModuleIfo   = 0x00000040,
 
+		//
+		// Do not use the on-disk resource index cache; always scan module
+		// .hak files and in-box .zip archives afresh.
+		//
+
+		ResManFlagNoIndexCache       = 0x00000080,
+
+		//
+		// Load resource providers (and 2DAs preloaded by Freeze2DACache)
+		// serially on the calling thread instead of in parallel.
+		//
+
+		ResManFlagNoParallelLoad     = 0x00000100,
+
+		//
+		// Do not use the on-disk binary 2DA cache; always parse 2DAs from
+		// their text form.
+		//
+
+		ResManFlagNo2DACache         = 0x00000200,
+
+		//
+		// Ignore prefetch requests; resources are only ever loaded when they
+		// are demanded.
+		//
+
+		ResManFlagNoPrefetch         = 0x00000400,
+
+		//
+		// Do not retain the contents of demanded resources in the resource
+		// cache; pinned resources are still retained.
+		//
+
+		ResManFlagNoResourceCache    = 0x00000800,
+
+		//
+		// Watch filesystem directory providers for changes, so that changed
+		// files can be picked up by RefreshDirectoryResources without a full
+		// reload.
+		//
+
+		ResManFlagWatchDirectories   = 0x00001000,
+
+		//
+		// Open the BIF files attached to KEY files only once one of their
+		// resources is accessed, and use the KEY resource tables in place
+		// from mapped views.  A missing or damaged BIF file then surfaces as
+		// a failure to demand its resources rather than as a load failure.
+		//
+
+		ResManFlagLazyBifLoad        = 0x00002000,
+
+		//
+		// Identify resources by content hash once their contents are first
+		// loaded, such that resources with byte-identical contents (such as
+		// copies of the same model in several HAKs) share a single resource
+		// cache entry and demand buffer.
+		//
+
+		ResManFlagShareContents      = 0x00004000,
+
 		LastResManFlag
 	} ResManFlags;
 
@@ -332,6 +398,18 @@ public:
 		__out std::string & String
 		) const;
 
+	//
+	// Look up a batch of strings based on STRREF.  Strings that could not be
+	// found are returned empty.  Returns the count of strings found.
+	//
+
+	size_t
+	GetTalkStrings(
+		__in size_t Count,
+		__in_ecount( Count ) const unsigned long * StringIds,
+		__out_ecount( Count ) std::string * Strings
+		) const;
+
 	//
 	// Look up the value of a particular column at a given row index in a given
 	// .2DA file.
@@ -527,15 +605,55 @@ public:
 
 	//
 	// Unload all cached 2DAs, causing them to be reloaded on the next
-	// reference.
+	// reference.  If the 2DA cache was frozen, it is thawed.
+	//
+	// N.B.  No other thread may be accessing 2DAs while the cache is cleared.
 	//
 
-	inline
 	void
 	Clear2DACache(
-		)
+		);
+
+	//
+	// Preload a set of 2DAs in parallel and freeze the 2DA cache.  If
+	// ResourceNames is NULL, every 2DA in the resource index is preloaded.
+	// 2DAs that were already cached remain cached.
+	//
+	// Once frozen, Get2DA (and the Get2DA* value accessors) only consult an
+	// immutable table of the preloaded 2DAs, and may be called from any number
+	// of threads concurrently.  2DAs that were neither preloaded nor already
+	// cached are NOT demand loaded while the cache is frozen: Get2DA returns
+	// NULL for them (and the value accessors fail) until they are included in
+	// a later Freeze2DACache call or the cache is cleared.  Callers that
+	// freeze a partial set of 2DAs must therefore name every 2DA that will be
+	// used while frozen.
+	//
+	// The cache may be frozen again (for example, to reload changed 2DAs, or
+	// to add 2DAs) while other threads access it; the new table replaces the
+	// old one atomically, and readers previously returned from Get2DA remain
+	// valid until the 2DA cache is cleared or the module resources are
+	// unloaded.  Superseded tables are released once no lookup is using them;
+	// only the readers of 2DAs that were reloaded are retained.
+	//
+	// Only one thread may freeze the cache at a time.  Raises an
+	// std::exception on failure, in which case the cache is left unchanged.
+	//
+
+	void
+	Freeze2DACache(
+		__in_opt const std::vector< std::string > * ResourceNames
+		);
+
+	//
+	// Determine whether the 2DA cache has been frozen.
+	//
+
+	inline
+	bool
+	Is2DACacheFrozen(
+		) const
 	{
-		m_2DAs.clear( );
+		return (m_Frozen2DAs != NULL);
 	}
 
 	//
@@ -578,7 +696,9 @@ public:
 	// contents of the resource.
 	//
 	// If more granular access to individual, large resources is required, then
-	// callers may use the IResourceAccessor APIs.
+	// callers may use the IResourceAccessor APIs.  Callers that only require
+	// the resource contents in memory should use DemandView instead, which
+	// avoids the temporary file copy entirely.
 	//
 	// The caller should release the demand-loaded resource with a call to
 	// Release once the caller is finished with it.
@@ -646,6 +766,47 @@ public:
 		return Demand( R, Type );
 	}
 
+	//
+	// Demand load a resource by resref into memory.  The routine returns a
+	// reference counted, read-only view of the entire contents of the
+	// resource without creating a temporary file.  Uncompressed resources
+	// (i.e. ERF, BIF or directory resources) are mapped directly from their
+	// containing file, whereas compressed resources (i.e. ZIP resources) are
+	// decompressed into a private buffer.
+	//
+	// The returned buffer remains valid for as long as the caller holds a
+	// reference to it, even across module resource reloads.  No call to
+	// Release is required.
+	//
+	// The routine raises an std::exception on failure.
+	//
+
+	DemandBufferPtr
+	DemandView(
+		__in const NWN::ResRef32 & ResRef,
+		__in ResType Type
+		);
+
+	inline
+	DemandBufferPtr
+	DemandView(
+		__in const NWN::ResRef16 & ResRef,
+		__in ResType Type
+		)
+	{
+		return DemandView( ResRef32FromStr( StrFromResRef( ResRef ) ), Type );
+	}
+
+	inline
+	DemandBufferPtr
+	DemandView(
+		__in const std::string & ResRef,
+		__in ResType Type
+		)
+	{
+		return DemandView( ResRef32FromStr( ResRef ), Type );
+	}
+
 	//
 	// Check if a resource exists without opening it.
 	//
@@ -656,6 +817,164 @@ public:
 		__in NWN::ResType Type
 		);
 
+	//
+	// Queue resources to be read into memory ahead of use by the prefetch
+	// worker threads.  A later Demand, DemandView, OpenFile or OpenFileByIndex
+	// call for a prefetched resource is satisfied from memory (once), waiting
+	// for the prefetch to finish if it is in progress.  Resources that do not
+	// exist are ignored, as is the entire request if ResManFlagNoPrefetch is
+	// in effect.
+	//
+	// Once the prefetched resources held in memory reach the prefetch limit,
+	// no further resources are read until some are consumed, so a caller that
+	// queues more than fits should consume resources in roughly the order it
+	// queued them.  Prefetched resources that have not been consumed are
+	// discarded when the module resources are unloaded.  The routine raises an
+	// std::exception on failure.
+	//
+
+	typedef ResourcePrefetcher::PrefetchPriority PrefetchPriority;
+
+	void
+	PrefetchResources(
+		__in_ecount( Count ) const NWN::ResRef32 * ResRefs,
+		__in_ecount( Count ) const ResType * Types,
+		__in size_t Count,
+		__in PrefetchPriority Priority = ResourcePrefetcher::PrefetchPriorityNormal
+		);
+
+	//
+	// Queue the resources that make up an area (its .are, .git and .trx
+	// files) for prefetch.
+	//
+
+	void
+	PrefetchArea(
+		__in const NWN::ResRef32 & AreaResRef,
+		__in PrefetchPriority Priority = ResourcePrefetcher::PrefetchPriorityNormal
+		);
+
+	//
+	// Discard all prefetched resources and any queued prefetch requests.
+	//
+
+	inline
+	void
+	CancelPrefetch(
+		)
+	{
+		m_Prefetcher.Cancel( );
+	}
+
+	//
+	// Set the maximum total size of prefetched resources that are held in
+	// memory, and the count of prefetch worker threads.  The thread count only
+	// takes effect before the first prefetch request.
+	//
+
+	inline
+	void
+	SetPrefetchLimits(
+		__in size_t MaxCacheBytes,
+		__in size_t MaxThreads
+		)
+	{
+		m_Prefetcher.SetLimits( MaxCacheBytes, MaxThreads );
+	}
+
+	//
+	// Set the maximum total size of resource contents that are retained in
+	// memory by the resource cache after being demanded.  The least recently
+	// used resources are discarded once the limit is reached.  A limit of
+	// zero disables the cache for resources that are not pinned.
+	//
+
+	inline
+	void
+	SetResourceCacheLimit(
+		__in size_t MaxCacheBytes
+		)
+	{
+		m_ResourceCache.SetLimit( MaxCacheBytes );
+	}
+
+	//
+	// Load a resource into the resource cache and pin it there, such that it
+	// is never discarded until it is unpinned.  Pins nest.  The routine
+	// returns false if the resource does not exist, and raises an
+	// std::exception on failure.
+	//
+
+	bool
+	PinResource(
+		__in const NWN::ResRef32 & ResRef,
+		__in ResType Type
+		);
+
+	//
+	// Release a pin on a resource taken by PinResource.  The routine returns
+	// false if the resource was not pinned.
+	//
+
+	bool
+	UnpinResource(
+		__in const NWN::ResRef32 & ResRef,
+		__in ResType Type
+		);
+
+	//
+	// Retrieve the hit, miss and eviction counters and the current occupancy
+	// of the resource cache.
+	//
+
+	typedef ResourceCache::Statistics ResourceCacheStatistics;
+
+	inline
+	void
+	GetResourceCacheStatistics(
+		__out ResourceCacheStatistics & Stats
+		) const
+	{
+		m_ResourceCache.GetStatistics( Stats );
+	}
+
+	//
+	// Return the content hash of a resource, which is computed when the
+	// resource contents are first loaded and then remembered for as long as
+	// the resource index entry is unchanged.  Resources with byte-identical
+	// contents have equal content hashes, which allows tools to compare
+	// resources across providers without comparing their contents.  The
+	// routine returns false if the resource does not exist, and raises an
+	// std::exception on failure.
+	//
+
+	bool
+	GetResourceContentHash(
+		__in const NWN::ResRef32 & ResRef,
+		__in ResType Type,
+		__out ULONG64 & Hash
+		);
+
+	//
+	// Apply changes made to watched directory providers (see
+	// ResManFlagWatchDirectories) since the last refresh, without reloading
+	// the module resources.  Only the resource index entries of added,
+	// removed or modified files are updated, and the canonical precedence of
+	// resource providers is preserved.  Cached contents of the affected
+	// resources are discarded.
+	//
+	// The routine returns the count of resource index entries that changed.
+	// It raises an std::exception on failure.
+	//
+	// N.B.  Changed 2DAs are only reloaded once the 2DA cache is cleared (or
+	//       frozen again), and a resource that is currently demand-loaded to
+	//       a temporary file keeps its old contents until it is released.
+	//
+
+	size_t
+	RefreshDirectoryResources(
+		);
+
 	//
 	// Release a reference to a previously demand-loaded resource file.
 	//
@@ -904,6 +1223,19 @@ public:
 		__out_bcount( BytesToRead ) void * Buffer
 		);
 
+	//
+	// Read a batch of ranges of encapsulated files.  The requests are grouped
+	// by resource provider and each group is forwarded as a batch to its
+	// provider, which orders the reads by provider file offset.
+	//
+
+	virtual
+	bool
+	ReadEncapsulatedFiles(
+		__inout_ecount( Count ) ReadRequest * Requests,
+		__in size_t Count
+		);
+
 	//
 	// Return the size of a file.
 	//
@@ -957,6 +1289,19 @@ public:
 		__out std::string & AccessorName
 		);
 
+	//
+	// Return the backing file handle and offset of an encapsulated file, for
+	// use in directly mapping the file contents.
+	//
+
+	virtual
+	bool
+	GetEncapsulatedFileMapping(
+		__in FileHandle File,
+		__out HANDLE * BackingFile,
+		__out ULONG64 * BackingFileOffset
+		);
+
 	//
 	// Check a resource file name to ensure it will not escape out of the
 	// current directory.
@@ -1016,6 +1361,22 @@ public:
 		__out std::vector< unsigned char > & FileContents
 		);
 
+	//
+	// Read a batch of files into vectors, given a resource accessor and the
+	// file indicies.  The contents are read with a single batched read so
+	// that the accessor may order and coalesce the reads.
+	//
+
+	template< typename ResRefType >
+	static
+	void
+	LoadEncapsulatedFiles(
+		__in IResourceAccessor< ResRefType > * Accessor,
+		__in size_t Count,
+		__in_ecount( Count ) const typename IResourceAccessor< ResRefType >::FileId * FileIndicies,
+		__out_ecount( Count ) std::vector< unsigned char > * FileContents
+		);
+
 private:
 
 	inline
@@ -1088,7 +1449,8 @@ private:
 	template< typename ResRefLoadType, const size_t LoadTier >
 	void
 	LoadHAKFiles(
-		__in const std::vector< NWN::ResRef32 > & HAKs
+		__in const std::vector< NWN::ResRef32 > & HAKs,
+		__in bool UseIndexCache
 		);
 
 	//
@@ -1126,6 +1488,7 @@ private:
 
 	void
 	LoadZipArchives(
+		__in bool UseIndexCache
 		);
 
 	//
@@ -1155,7 +1518,28 @@ private:
 
 	void
 	LoadDirectoryZipFiles(
-		__in const std::string & DirName
+		__in const std::string & DirName,
+		__in bool UseIndexCache
+		);
+
+	//
+	// Execute all queued resource provider loads in parallel, then register
+	// the loaded providers in the order in which they were queued.
+	//
+
+	void
+	LoadQueuedProviders(
+		);
+
+	//
+	// Execute a single queued resource provider load (parallel work routine).
+	//
+
+	static
+	void
+	LoadQueuedProvider(
+		__in void * Context,
+		__in size_t WorkItem
 		);
 
 	//
@@ -1243,6 +1627,61 @@ private:
 	DiscoverResources(
 		);
 
+	//
+	// Look up a resource entry index by name and type, returning
+	// ResourceIndex::INVALID_INDEX if no such resource exists.  The name is
+	// converted to canonical (all-lowercase) form before the lookup.
+	//
+
+	inline
+	size_t
+	LookupResourceEntry(
+		__in const NWN::ResRef32 & ResRef,
+		__in ResType Type
+		) const
+	{
+		NWN::ResRef32 Canonical;
+
+		ZeroMemory( &Canonical, sizeof( Canonical ) );
+
+		for (size_t i = 0; i < sizeof( ResRef.RefStr ); i += 1)
+		{
+			if (ResRef.RefStr[ i ] == '\0')
+				break;
+
+			Canonical.RefStr[ i ] = (char) tolower(
+				(int) (unsigned char) ResRef.RefStr[ i ] );
+		}
+
+		return FindResourceEntry( Canonical, Type );
+	}
+
+	//
+	// Look up a resource entry index by canonical name and type, returning
+	// ResourceIndex::INVALID_INDEX if no such resource exists.  An entry whose
+	// resource was removed by a directory refresh is not returned.
+	//
+
+	inline
+	size_t
+	FindResourceEntry(
+		__in const NWN::ResRef32 & ResRef,
+		__in ResType Type
+		) const
+	{
+		size_t EntryIndex;
+
+		EntryIndex = m_ResourceIndex.Find( ResRef, Type );
+
+		if ((EntryIndex != ResourceIndex::INVALID_INDEX) &&
+		    (m_ResourceEntries[ EntryIndex ].Accessor == NULL))
+		{
+			return ResourceIndex::INVALID_INDEX;
+		}
+
+		return EntryIndex;
+	}
+
 	//
 	// Allocate a file handle for the overarching resource manager file
 	// accessor interface.  This file handle may be used with the direct
@@ -1257,9 +1696,138 @@ private:
 	AllocateFileHandle(
 		);
 
+	//
+	// Build a resource manager file handle that is backed by the in-memory
+	// (cached or prefetched) contents of a resource entry rather than by a
+	// provider file handle.  Raises an std::exception on failure.
+	//
+
+	FileHandle
+	OpenInMemoryFile(
+		__in size_t EntryIndex,
+		__in ResType Type,
+		__in const DemandBufferPtr & Contents
+		);
+
+	//
+	// Read the entire contents of an open file into a demand buffer, mapping
+	// the contents directly from the backing file if the accessor allows.
+	// Raises an std::exception on failure.
+	//
+
+	static
+	DemandBufferPtr
+	CreateDemandBuffer(
+		__in IResourceAccessor * Accessor,
+		__in FileHandle File
+		);
+
+	//
+	// Load the entire contents of a resource entry via its provider.  The
+	// routine may be called from the prefetch worker threads.  Raises an
+	// std::exception on failure.
+	//
+
+	DemandBufferPtr
+	LoadResourceEntry(
+		__in size_t EntryIndex
+		);
+
+	//
+	// Discard any cached or prefetched contents of a resource entry, after
+	// the entry was changed by a directory refresh.
+	//
+
+	void
+	InvalidateResourceEntry(
+		__in size_t EntryIndex
+		);
+
+	//
+	// Acquire the entire contents of a resource entry, from the resource
+	// cache or the prefetcher if possible, else via its provider.  Contents
+	// loaded via the provider are inserted into the resource cache.  Raises
+	// an std::exception on failure.
+	//
+
+	DemandBufferPtr
+	AcquireResourceContents(
+		__in size_t EntryIndex
+		);
+
+	//
+	// Record the content hash of a resource entry whose contents were just
+	// loaded and, if another resource with identical contents is cached,
+	// replace the contents with the cached (shared) contents.  The routine
+	// returns the resource cache key of the entry.  Raises an std::exception
+	// on failure.
+	//
+
+	size_t
+	ShareResourceContents(
+		__in size_t EntryIndex,
+		__inout DemandBufferPtr & Contents
+		);
+
+	//
+	// Compute the content hash of a resource (64-bit MurmurHash2).  The
+	// length of the contents is folded into the hash.
+	//
+
+	static
+	ULONG64
+	ComputeContentHash(
+		__in_bcount( Length ) const void * Data,
+		__in size_t Length
+		);
+
+	//
+	// Return the resource cache key of a resource entry.  Entries whose
+	// contents are shared with other entries (see ResManFlagShareContents)
+	// are cached under the key of their shared contents, else they are
+	// cached under their entry index.
+	//
+
+	inline
+	size_t
+	GetResourceCacheKey(
+		__in size_t EntryIndex
+		) const
+	{
+		EntryContentMap::const_iterator it;
+
+		if (m_EntryContent.empty( ))
+			return EntryIndex;
+
+		it = m_EntryContent.find( EntryIndex );
+
+		if ((it == m_EntryContent.end( )) ||
+		    (it->second.Slot == INVALID_CONTENT_SLOT))
+		{
+			return EntryIndex;
+		}
+
+		return CONTENT_CACHE_KEY | it->second.Slot;
+	}
+
+	//
+	// Prefetch worker load routine.  The routine loads a resource entry, and
+	// touches each page of a mapped resource so that the backing file data
+	// is read in on the worker thread.
+	//
+
+	static
+	DemandBufferPtr
+	PrefetchLoadRoutine(
+		__in void * Context,
+		__in size_t EntryIndex
+		);
+
 	//
 	// Acquire a pointer to a TwoDAFileReader given a 2DA Resref name.  If the
-	// 2DA has not already been cached, it will be made cached by the routine.
+	// 2DA has not already been cached, it will be made cached by the routine,
+	// unless the 2DA cache is frozen, in which case NULL is returned for a 2DA
+	// that the frozen cache does not hold.
 	//
 
 	const TwoDAFileReader *
@@ -1267,6 +1835,66 @@ private:
 		__in const std::string & ResourceName
 		);
 
+	//
+	// Create a TwoDAFileReader for a 2DA Resref name, using a current binary
+	// 2DA cache file if one exists, else parsing the text 2DA (and writing a
+	// new binary 2DA cache file for it).  Raises an std::exception on failure.
+	//
+
+	TwoDAFileReaderPtr
+	Load2DA(
+		__in const std::string & ResourceName
+		);
+
+	//
+	// Create a TwoDAFileReader for the contents of a 2DA, using or writing the
+	// supplied binary 2DA cache file (if not empty).  A failure to write the
+	// cache file is returned in CacheError.  No ResourceManager state is
+	// accessed, so that 2DAs may be created in parallel.  Raises an
+	// std::exception on failure.
+	//
+
+	static
+	TwoDAFileReaderPtr
+	Create2DAReader(
+		__in const std::string & ResourceName,
+		__in const DemandBuffer & Res,
+		__in const std::string & CacheFileName,
+		__out std::string & CacheError
+		);
+
+	//
+	// Return the binary 2DA cache file name for a 2DA, or an empty string if
+	// the binary 2DA cache is disabled.
+	//
+
+	std::string
+	Get2DACacheFileName(
+		__in const std::string & ResourceName
+		) const;
+
+	//
+	// Create a single preloaded 2DA (parallel work routine).
+	//
+
+	static
+	void
+	Preload2DA(
+		__in void * Context,
+		__in size_t WorkItem
+		);
+
+	//
+	// Release all frozen 2DA cache generations.  If KeepCurrent is true, the
+	// current generation and the retired readers are kept, and only the older
+	// generations are released.
+	//
+
+	void
+	Free2DAGenerations(
+		__in bool KeepCurrent
+		);
+
 	//
 	// Return the appropriate HAK vector for a given ResRef type.
 	//
@@ -1363,12 +1991,17 @@ private:
 	// Define the resource handle type, to which a FileHandle refers to for the
 	// overarching ResourceManager object.
 	//
+	// A handle to an in-memory (cached or prefetched) resource has no
+	// provider file handle (Handle is INVALID_FILE); its contents are instead
+	// supplied by Contents.
+	//
 
 	struct ResHandle
 	{
 		IResourceAccessor * Accessor;
 		FileHandle          Handle;
 		ResType             Type;
+		DemandBufferPtr     Contents;
 	};
 
 	//
@@ -1387,6 +2020,85 @@ private:
 
 	typedef const enum _PROVIDER_TYPE * PCPROVIDER_TYPE;
 
+	//
+	// Define a queued resource provider load.  The LoadXxx routines queue the
+	// providers that they would load, and LoadQueuedProviders then constructs
+	// all queued providers in parallel.  Providers are registered in queue
+	// order afterwards, which preserves the canonical search order.
+	//
+
+	typedef enum _PROVIDER_LOAD_TYPE
+	{
+		ProviderLoadErf,
+		ProviderLoadErf16,
+		ProviderLoadDirectory,
+		ProviderLoadZip,
+		ProviderLoadKey,
+
+		LastProviderLoadType
+	} PROVIDER_LOAD_TYPE;
+
+	struct ProviderLoad
+	{
+		PROVIDER_LOAD_TYPE                Type;
+		size_t                            Tier;
+		std::string                       Path;
+		std::string                       BaseDir;     // Key files only
+		unsigned long                     KeyFlags;    // Key files only
+		std::string                       DisplayName; // For warnings
+
+		//
+		// Resource index cache state (hak and zip files only).
+		//
+
+		bool                              UseIndexCache;
+		ULONG64                           FileSize;
+		ULONG64                           LastWriteTime;
+		const ResourceIndexCache::Entry * CachedEntries;
+		size_t                            CachedCount;
+		ResourceIndexCache::EntryVec      ScannedEntries;
+
+		//
+		// Load results.  Exactly one provider is set on success.
+		//
+
+		ErfFileReaderPtr                  Erf;
+		ErfFileReader16Ptr                Erf16;
+		DirectoryFileReaderPtr            Directory;
+		ZipFileReaderPtr                  Zip;
+		KeyFileReaderPtr                  Key;
+		bool                              Failed;
+		std::string                       Error;
+	};
+
+	typedef std::vector< ProviderLoad > ProviderLoadVec;
+
+	//
+	// Queue a resource provider load, returning the queued load descriptor
+	// for the caller to fill in any type-specific fields.
+	//
+
+	ProviderLoad &
+	QueueProviderLoad(
+		__in PROVIDER_LOAD_TYPE Type,
+		__in size_t Tier,
+		__in const std::string & Path,
+		__in const std::string & DisplayName
+		);
+
+	//
+	// Look up the cached directory listing of a queued .hak or .zip provider
+	// in the resource index cache, and mark the provider for recording in
+	// the cache once loaded.
+	//
+
+	void
+	LookupIndexCache(
+		__inout ProviderLoad & Load,
+		__in ULONG64 FileSize,
+		__in ULONG64 LastWriteTime
+		);
+
 	//
 	// Define the resource directory entry, used to provide quick access to
 	// files across all resource accessors, in canonical order.
@@ -1394,12 +2106,64 @@ private:
 
 	struct ResourceEntry
 	{
-		IResourceAccessor * Accessor;
+		IResourceAccessor * Accessor;  // NULL if vacated by a refresh
 		FileId              FileIndex;
 		size_t              Tier;
 		size_t              TierIndex; // From end
 	};
 
+	//
+	// Apply a directory provider change to the resource index.  The routine
+	// returns true if the resource index entry changed.  If the resource was
+	// removed, the entry is vacated and its index is appended to Vacated.
+	// Raises an std::exception on failure.
+	//
+
+	bool
+	ApplyDirectoryChange(
+		__in DirectoryFileReader * Directory,
+		__in size_t TierIndex,
+		__in const DirectoryFileReader::ResourceChange & Change,
+		__inout std::vector< size_t > & Vacated
+		);
+
+	//
+	// Fill vacated resource index entries with the next most precedent
+	// provider of each resource, if any.  Raises an std::exception on
+	// failure.
+	//
+
+	void
+	ReassignVacatedEntries(
+		__in const std::vector< size_t > & Vacated
+		);
+
+	//
+	// Return whether a resource entry takes precedence over another entry
+	// for the same resource, per the canonical provider search order.
+	//
+
+	inline
+	static
+	bool
+	IsMorePrecedentEntry(
+		__in const ResourceEntry & Entry,
+		__in const ResourceEntry & Other
+		)
+	{
+		if (Entry.Tier != Other.Tier)
+			return (Entry.Tier < Other.Tier);
+
+		if (Entry.TierIndex != Other.TierIndex)
+			return (Entry.TierIndex < Other.TierIndex);
+
+		//
+		// Within a provider, the last entry for a name wins.
+		//
+
+		return (Entry.FileIndex > Other.FileIndex);
+	}
+
 	//
 	// Priority order between resource types.
 	//
@@ -1471,11 +2235,32 @@ private:
 	typedef std::map< FileHandle, ResHandle > ResHandleMap;
 
 	//
-	// Define the mapping of resource names to resource entries, used to open
-	// by name quickly.
+	// Define a batched read request forwarded to a resource provider, used by
+	// ReadEncapsulatedFiles to group requests by provider.
 	//
 
-	typedef stdext::hash_map< std::string, size_t > ResourceEntryMap;
+	struct ProviderReadOrder
+	{
+		IResourceAccessor * Accessor;
+		FileHandle          Handle;
+		size_t              Request;
+	};
+
+	struct ProviderReadOrderLess
+	{
+		inline
+		bool
+		operator()(
+			__in const ProviderReadOrder & left,
+			__in const ProviderReadOrder & right
+			) const
+		{
+			return left.Accessor < right.Accessor;
+		}
+	};
+
+	typedef std::vector< ProviderReadOrder > ProviderReadOrderVec;
+	typedef std::vector< ReadRequest > ReadRequestVec;
 
 	//
 	// Define the array of all known resources.
@@ -1490,6 +2275,39 @@ private:
 
 	typedef std::map< std::string, TwoDAFileReaderPtr > TwoDANameMap;
 
+	typedef std::vector< TwoDAFileReaderPtr > TwoDAFileReaderPtrVec;
+
+	//
+	// Define a frozen 2DA cache generation, which maps 2DA RESREFs (with the
+	// 2DA resource type) to indicies into an array of readers.  A NULL reader
+	// denotes a 2DA that failed to load.  Generations are never modified once
+	// published.
+	//
+
+	struct TwoDAGeneration
+	{
+		ResourceIndex         Index;
+		TwoDAFileReaderPtrVec Readers;
+	};
+
+	typedef std::vector< TwoDAGeneration * > TwoDAGenerationVec;
+
+	//
+	// Define the state of a single 2DA being preloaded by Freeze2DACache.
+	//
+
+	struct TwoDAPreload
+	{
+		std::string        ResourceName;
+		std::string        CacheFileName;
+		DemandBufferPtr    Res;
+		TwoDAFileReaderPtr Reader;
+		std::string        Error;
+		std::string        CacheError;
+	};
+
+	typedef std::vector< TwoDAPreload > TwoDAPreloadVec;
+
 	//
 	// Gr2Accessor shared pointer.
 	//
@@ -1530,6 +2348,28 @@ private:
 
 	TwoDANameMap              m_2DAs;
 
+	//
+	// Frozen 2DA cache.  m_Frozen2DAs is the current (published) generation,
+	// or NULL if the cache is not frozen.  m_2DAGenerations holds the current
+	// generation and any older generations that could not yet be released
+	// because a lookup was in progress; m_Frozen2DALookups counts the Get2DA
+	// calls in progress.  Readers of 2DAs that were replaced by a reload are
+	// kept in m_Retired2DAReaders until the cache is cleared, so that readers
+	// obtained from an older generation remain valid.
+	//
+
+	TwoDAGeneration * volatile m_Frozen2DAs;
+	TwoDAGenerationVec        m_2DAGenerations;
+	volatile LONG             m_Frozen2DALookups;
+	TwoDAFileReaderPtrVec     m_Retired2DAReaders;
+
+	//
+	// Directory holding the binary 2DA cache files (empty if the cache is
+	// unavailable).
+	//
+
+	std::string               m_TwoDACachePath;
+
 	//
 	// Resource load sources (in priority order).  These may be ERF or ZIP file
 	// readers, or directory file readers.
@@ -1575,17 +2415,11 @@ private:
 	ResHandleMap              m_ResFileHandles;
 
 	//
-	// Mapping of all resource names (+types) to resource entry indicies.
-	//
-	// Keys are formed based on a convention of '<type>T<resref>', where
-	// <type> is the base-10 string representation of the resource type code,
-	// and 'resref' is the canonical (all-lowercase) form of the resource name.
-	//
-	// An uppercase character is never found in a canonical resource name, so
-	// the search string is unambiguous.
+	// Mapping of all resource names (+types) to resource entry indicies.  The
+	// key index of each resource is its index into m_ResourceEntries.
 	//
 
-	ResourceEntryMap          m_NameIdMap;
+	ResourceIndex             m_ResourceIndex;
 
 	//
 	// Array of all loaded resource identifiers with their associated accessor
@@ -1594,6 +2428,80 @@ private:
 
 	ResourceEntryVec          m_ResourceEntries;
 
+	//
+	// Prefetcher for resource entries, keyed by resource entry index.  The
+	// prefetch worker threads access resource providers concurrently with the
+	// owning thread, so all provider access is serialized by m_AccessorLock.
+	//
+
+	swutil::CriticalSection   m_AccessorLock;
+	ResourcePrefetcher        m_Prefetcher;
+
+	//
+	// Byte-budgeted cache of the contents of demanded resources, keyed by
+	// resource entry index.  Only the owning thread accesses the cache.
+	//
+
+	ResourceCache             m_ResourceCache;
+
+	//
+	// Content identities of resource entries whose contents have been
+	// hashed, keyed by resource entry index, and the shared contents slot
+	// assigned to each distinct content hash.  Shared contents are cached
+	// under CONTENT_CACHE_KEY | Slot, which never collides with an entry
+	// index.  An entry only joins a slot once its contents compared equal to
+	// the slot's cached contents; an entry whose hash collides with different
+	// contents, or whose slot's contents were not cached to compare against,
+	// is not shared (its Slot is INVALID_CONTENT_SLOT).
+	//
+
+	struct ContentIdentity
+	{
+		ULONG64 Hash;
+		size_t  Slot;
+	};
+
+	typedef stdext::hash_map< size_t, ContentIdentity > EntryContentMap;
+	typedef stdext::hash_map< ULONG64, size_t > ContentSlotMap;
+
+	static const size_t CONTENT_CACHE_KEY    = (size_t) 1 << (sizeof( size_t ) * 8 - 1);
+	static const size_t INVALID_CONTENT_SLOT = (size_t) -1;
+
+	EntryContentMap           m_EntryContent;
+	ContentSlotMap            m_ContentSlots;
+	size_t                    m_NextContentSlot;
+
+	//
+	// Pins taken by PinResource, keyed by resource entry index.  The cache
+	// key that each entry pinned is recorded, as entries that share their
+	// contents pin the same cache key.
+	//
+
+	struct EntryPin
+	{
+		size_t  CacheKey;
+		ULONG   PinCount;
+	};
+
+	typedef stdext::hash_map< size_t, EntryPin > EntryPinMap;
+
+	EntryPinMap               m_EntryPins;
+
+	//
+	// Persistent cache of provider directory listings, used to avoid
+	// rescanning unchanged .hak files and in-box .zip archives, and the path
+	// to its backing file generations (empty if the cache is unavailable).
+	//
+
+	ResourceIndexCache        m_IndexCache;
+	std::string               m_IndexCacheFile;
+
+	//
+	// Resource provider loads queued for LoadQueuedProviders.
+	//
+
+	ProviderLoadVec           m_ProviderLoads;
+
 	//
 	// Unique identifier for instance disambiguation in the temp storage path.
 	//
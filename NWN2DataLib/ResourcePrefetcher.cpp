@@ -0,0 +1,739 @@
+/*++
+
+Copyright (c) Ken Johnson (Skywing). All rights reserved.
+
+Module Name:
+
+	ResourcePrefetcher.cpp
+
+Abstract:
+
+	This module houses the resource prefetcher, which reads resources into
+	memory ahead of use on a small pool of worker threads.
+
+--*/
+
+#include "Precomp.h"
+#include "ResourcePrefetcher.h"
+#include <process.h>
+
+ResourcePrefetcher::ResourcePrefetcher(
+	)
+/*++
+
+Routine Description:
+
+	This routine constructs a new ResourcePrefetcher object.  No worker
+	threads are started until the first resource is queued.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	The newly constructed object.
+
+Environment:
+
+	User mode.
+
+--*/
+: m_LoadRoutine( NULL ),
+  m_LoadContext( NULL ),
+  m_CacheBytes( 0 ),
+  m_MaxCacheBytes( DEFAULT_MAX_CACHE_BYTES ),
+  m_Loading( 0 ),
+  m_ThreadCount( 0 ),
+  m_MaxThreads( DEFAULT_MAX_THREADS ),
+  m_WorkSemaphore( NULL ),
+  m_StopEvent( NULL ),
+  m_CompletedEvent( NULL ),
+  m_SpaceEvent( NULL )
+{
+}
+
+ResourcePrefetcher::~ResourcePrefetcher(
+	)
+/*++
+
+Routine Description:
+
+	This routine cleans up an already-existing ResourcePrefetcher object.  Any
+	loads that are in progress are waited for, and the worker threads are shut
+	down.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	Cancel( );
+
+	if (m_ThreadCount != 0)
+	{
+		SetEvent( m_StopEvent );
+
+		WaitForMultipleObjects(
+			(DWORD) m_ThreadCount,
+			m_Threads,
+			TRUE,
+			INFINITE);
+
+		for (size_t i = 0; i < m_ThreadCount; i += 1)
+			CloseHandle( m_Threads[ i ] );
+
+		m_ThreadCount = 0;
+	}
+
+	if (m_WorkSemaphore != NULL)
+		CloseHandle( m_WorkSemaphore );
+
+	if (m_StopEvent != NULL)
+		CloseHandle( m_StopEvent );
+
+	if (m_CompletedEvent != NULL)
+		CloseHandle( m_CompletedEvent );
+
+	if (m_SpaceEvent != NULL)
+		CloseHandle( m_SpaceEvent );
+}
+
+void
+ResourcePrefetcher::Initialize(
+	__in LoadRoutine Routine,
+	__in void * Context
+	)
+/*++
+
+Routine Description:
+
+	This routine registers the routine that the worker threads invoke in order
+	to load a resource.
+
+Arguments:
+
+	Routine - Supplies the load routine.
+
+	Context - Supplies the context argument passed to the load routine.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	m_LoadRoutine = Routine;
+	m_LoadContext = Context;
+}
+
+void
+ResourcePrefetcher::SetLimits(
+	__in size_t MaxCacheBytes,
+	__in size_t MaxThreads
+	)
+/*++
+
+Routine Description:
+
+	This routine sets the maximum total size of cached resources and the count
+	of worker threads.  If the cache currently exceeds the new limit, then no
+	further resources are loaded until enough cached resources are consumed;
+	cached resources are not discarded.
+
+Arguments:
+
+	MaxCacheBytes - Supplies the maximum total size, in bytes, of cached
+	                resources.
+
+	MaxThreads - Supplies the count of worker threads to use.  The count only
+	             takes effect if the worker threads have not yet been started.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	swutil::ScopedLock Lock( m_Lock );
+
+	m_MaxCacheBytes = MaxCacheBytes;
+	m_MaxThreads    = max( MaxThreads, (size_t) 1 );
+	m_MaxThreads    = min( m_MaxThreads, (size_t) MAX_PREFETCH_THREADS );
+
+	if ((m_SpaceEvent != NULL) && (m_CacheBytes < m_MaxCacheBytes))
+		SetEvent( m_SpaceEvent );
+}
+
+void
+ResourcePrefetcher::Enqueue(
+	__in_ecount( Count ) const size_t * Resources,
+	__in size_t Count,
+	__in PrefetchPriority Priority
+	)
+/*++
+
+Routine Description:
+
+	This routine queues a set of resources for prefetch.  Resources that are
+	already queued, loading or cached are skipped.
+
+Arguments:
+
+	Resources - Supplies the indicies of the resources to prefetch.
+
+	Count - Supplies the count of resources to prefetch.
+
+	Priority - Supplies the priority of the resources.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure, in which case some
+	of the resources may have been queued.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	size_t Queued;
+
+	if ((unsigned) Priority >= (unsigned) LAST_PREFETCH_PRIORITY)
+		throw std::runtime_error( "Illegal prefetch priority." );
+
+	if (Count == 0)
+		return;
+
+	StartWorkers( );
+
+	Queued = 0;
+
+	{
+		swutil::ScopedLock Lock( m_Lock );
+
+		try
+		{
+			for (size_t i = 0; i < Count; i += 1)
+			{
+				ResourceRecord Record;
+
+				if (m_Records.find( Resources[ i ] ) != m_Records.end( ))
+					continue;
+
+				Record.State    = ResourceStateQueued;
+				Record.Priority = Priority;
+				Record.Position = m_Queues[ Priority ].insert(
+					m_Queues[ Priority ].end( ),
+					Resources[ i ] );
+
+				try
+				{
+					m_Records.insert(
+						ResourceRecordMap::value_type( Resources[ i ], Record ) );
+				}
+				catch (...)
+				{
+					m_Queues[ Priority ].erase( Record.Position );
+					throw;
+				}
+
+				Queued += 1;
+			}
+		}
+		catch (...)
+		{
+			if (Queued != 0)
+				ReleaseSemaphore( m_WorkSemaphore, (LONG) Queued, NULL );
+
+			throw;
+		}
+	}
+
+	if (Queued != 0)
+		ReleaseSemaphore( m_WorkSemaphore, (LONG) Queued, NULL );
+}
+
+bool
+ResourcePrefetcher::Lookup(
+	__in size_t Resource,
+	__out DemandBufferPtr & Buffer
+	)
+/*++
+
+Routine Description:
+
+	This routine retrieves the prefetched contents of a resource, if any.  If
+	the resource is being loaded, then the routine waits for the load to
+	finish.  If the resource is still queued, then it is removed from the queue
+	as the caller is about to load it directly.
+
+Arguments:
+
+	Resource - Supplies the index of the resource to retrieve.
+
+	Buffer - Receives the prefetched contents of the resource on success.
+
+Return Value:
+
+	The routine returns true if the prefetched contents were returned, in
+	which case the resource is dropped from the cache.  Otherwise, the routine
+	returns false and the caller should load the resource itself.
+
+Environment:
+
+	User mode, owning thread only.
+
+--*/
+{
+	ResourceRecordMap::iterator Record;
+
+	m_Lock.Lock( );
+
+	for (;;)
+	{
+		Record = m_Records.find( Resource );
+
+		if (Record == m_Records.end( ))
+		{
+			m_Lock.Unlock( );
+			return false;
+		}
+
+		if (Record->second.State != ResourceStateLoading)
+			break;
+
+		//
+		// Wait for the worker to finish.  As only the owning thread waits on
+		// the completion event, resetting it under the lock cannot cause a
+		// completion to be missed.
+		//
+
+		ResetEvent( m_CompletedEvent );
+
+		m_Lock.Unlock( );
+
+		WaitForSingleObject( m_CompletedEvent, INFINITE );
+
+		m_Lock.Lock( );
+	}
+
+	if (Record->second.State == ResourceStateQueued)
+	{
+		m_Queues[ Record->second.Priority ].erase( Record->second.Position );
+		m_Records.erase( Record );
+
+		m_Lock.Unlock( );
+		return false;
+	}
+
+	Buffer = Record->second.Buffer;
+
+	m_CacheBytes -= Buffer->GetSize( );
+	m_CacheOrder.erase( Record->second.Position );
+	m_Records.erase( Record );
+
+	//
+	// Let any workers that stalled on a full cache resume.
+	//
+
+	if (m_CacheBytes < m_MaxCacheBytes)
+		SetEvent( m_SpaceEvent );
+
+	m_Lock.Unlock( );
+
+	return true;
+}
+
+void
+ResourcePrefetcher::Cancel(
+	)
+/*++
+
+Routine Description:
+
+	This routine discards all queued and cached resources, and waits for any
+	loads that are in progress to finish (their results are discarded).
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode, owning thread only.
+
+--*/
+{
+	m_Lock.Lock( );
+
+	for (;;)
+	{
+		for (size_t i = 0; i < LAST_PREFETCH_PRIORITY; i += 1)
+			m_Queues[ i ].clear( );
+
+		m_CacheOrder.clear( );
+		m_Records.clear( );
+
+		m_CacheBytes = 0;
+
+		if (m_SpaceEvent != NULL)
+			SetEvent( m_SpaceEvent );
+
+		if (m_Loading == 0)
+			break;
+
+		ResetEvent( m_CompletedEvent );
+
+		m_Lock.Unlock( );
+
+		WaitForSingleObject( m_CompletedEvent, INFINITE );
+
+		m_Lock.Lock( );
+	}
+
+	m_Lock.Unlock( );
+}
+
+void
+ResourcePrefetcher::StartWorkers(
+	)
+/*++
+
+Routine Description:
+
+	This routine starts the worker threads, if they have not yet been started.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	if (m_ThreadCount != 0)
+		return;
+
+	if (m_LoadRoutine == NULL)
+		throw std::runtime_error( "Resource prefetcher is not initialized." );
+
+	if (m_WorkSemaphore == NULL)
+	{
+		m_WorkSemaphore = CreateSemaphore( NULL, 0, LONG_MAX, NULL );
+
+		if (m_WorkSemaphore == NULL)
+			throw std::runtime_error( "CreateSemaphore failed." );
+	}
+
+	if (m_StopEvent == NULL)
+	{
+		m_StopEvent = CreateEvent( NULL, TRUE, FALSE, NULL );
+
+		if (m_StopEvent == NULL)
+			throw std::runtime_error( "CreateEvent failed." );
+	}
+
+	if (m_CompletedEvent == NULL)
+	{
+		m_CompletedEvent = CreateEvent( NULL, TRUE, FALSE, NULL );
+
+		if (m_CompletedEvent == NULL)
+			throw std::runtime_error( "CreateEvent failed." );
+	}
+
+	if (m_SpaceEvent == NULL)
+	{
+		m_SpaceEvent = CreateEvent( NULL, TRUE, TRUE, NULL );
+
+		if (m_SpaceEvent == NULL)
+			throw std::runtime_error( "CreateEvent failed." );
+	}
+
+	while (m_ThreadCount < m_MaxThreads)
+	{
+		HANDLE Thread;
+
+		//
+		// N.B.  _beginthreadex is used as the load routine makes use of the
+		//       CRT.
+		//
+
+		Thread = (HANDLE) _beginthreadex(
+			NULL,
+			0,
+			WorkerThread,
+			this,
+			0,
+			NULL);
+
+		if (Thread == NULL)
+			break;
+
+		m_Threads[ m_ThreadCount ] = Thread;
+		m_ThreadCount += 1;
+	}
+
+	if (m_ThreadCount == 0)
+		throw std::runtime_error( "Failed to start prefetch worker threads." );
+}
+
+unsigned
+__stdcall
+ResourcePrefetcher::WorkerThread(
+	__in void * Parameter
+	)
+/*++
+
+Routine Description:
+
+	This routine is the entry point of a prefetch worker thread.
+
+Arguments:
+
+	Parameter - Supplies the owning ResourcePrefetcher object.
+
+Return Value:
+
+	The routine always returns zero.
+
+Environment:
+
+	User mode, worker thread.
+
+--*/
+{
+	((ResourcePrefetcher *) Parameter)->ProcessQueue( );
+
+	return 0;
+}
+
+void
+ResourcePrefetcher::ProcessQueue(
+	)
+/*++
+
+Routine Description:
+
+	This routine claims and loads queued resources until the prefetcher is
+	shut down.  While the cache is full, no resources are claimed; the worker
+	waits for the owner to consume cached resources instead.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode, worker thread.
+
+--*/
+{
+	HANDLE Waits[ 2 ];
+	HANDLE SpaceWaits[ 2 ];
+
+	Waits[ 0 ]      = m_StopEvent;
+	Waits[ 1 ]      = m_WorkSemaphore;
+	SpaceWaits[ 0 ] = m_StopEvent;
+	SpaceWaits[ 1 ] = m_SpaceEvent;
+
+	for (;;)
+	{
+		ResourceRecordMap::iterator Record;
+		DemandBufferPtr             Buffer;
+		size_t                      Resource;
+		bool                        Claimed;
+		bool                        Full;
+
+		if (WaitForMultipleObjects( 2, Waits, FALSE, INFINITE ) != WAIT_OBJECT_0 + 1)
+			break;
+
+		//
+		// Claim the highest priority queued resource.  The queue may be empty
+		// if the resources that released the semaphore were since looked up
+		// or cancelled.
+		//
+
+		Claimed  = false;
+		Full     = false;
+		Resource = 0;
+
+		{
+			swutil::ScopedLock Lock( m_Lock );
+
+			//
+			// If the cache is full, then hand the work item back and wait for
+			// room, rather than loading a resource that would displace one
+			// that the owner has yet to consume.
+			//
+
+			if (m_CacheBytes >= m_MaxCacheBytes)
+			{
+				ResetEvent( m_SpaceEvent );
+				ReleaseSemaphore( m_WorkSemaphore, 1, NULL );
+
+				Full = true;
+			}
+
+			for (size_t i = LAST_PREFETCH_PRIORITY; (i != 0) && (!Full); i -= 1)
+			{
+				if (m_Queues[ i - 1 ].empty( ))
+					continue;
+
+				Resource = m_Queues[ i - 1 ].front( );
+				m_Queues[ i - 1 ].pop_front( );
+
+				Record = m_Records.find( Resource );
+
+				Record->second.State = ResourceStateLoading;
+				m_Loading += 1;
+				Claimed = true;
+				break;
+			}
+		}
+
+		if (Full)
+		{
+			if (WaitForMultipleObjects( 2, SpaceWaits, FALSE, INFINITE ) != WAIT_OBJECT_0 + 1)
+				break;
+
+			continue;
+		}
+
+		if (!Claimed)
+			continue;
+
+		try
+		{
+			Buffer = m_LoadRoutine( m_LoadContext, Resource );
+		}
+		catch (std::exception)
+		{
+			//
+			// The owner will retry the load itself (and report the error) if
+			// the resource is actually used.
+			//
+		}
+
+		//
+		// Publish the result, unless the resource was cancelled while it was
+		// being loaded.
+		//
+
+		{
+			swutil::ScopedLock Lock( m_Lock );
+
+			m_Loading -= 1;
+
+			Record = m_Records.find( Resource );
+
+			if ((Record != m_Records.end( )) &&
+			    (Record->second.State == ResourceStateLoading))
+			{
+				if (Buffer.get( ) != NULL)
+				{
+					try
+					{
+						CacheResource( Record, Buffer );
+					}
+					catch (std::exception)
+					{
+						m_Records.erase( Record );
+					}
+				}
+				else
+				{
+					m_Records.erase( Record );
+				}
+			}
+
+			SetEvent( m_CompletedEvent );
+		}
+	}
+}
+
+void
+ResourcePrefetcher::CacheResource(
+	__in ResourceRecordMap::iterator Record,
+	__in const DemandBufferPtr & Buffer
+	)
+/*++
+
+Routine Description:
+
+	This routine inserts a loaded resource into the cache.  Cached resources
+	are never discarded to make room, as the workers stop claiming resources
+	once the cache is full; a resource that completes after the cache filled
+	is still retained, so the limit may be exceeded by the loads that were in
+	progress at that time.  A resource that is by itself larger than the cache
+	size limit is dropped.
+
+	The caller must hold the lock.
+
+Arguments:
+
+	Record - Supplies the record of the resource, which must be in the loading
+	         state.
+
+	Buffer - Supplies the loaded contents of the resource.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode, worker thread.
+
+--*/
+{
+	size_t Size;
+
+	Size = Buffer->GetSize( );
+
+	if (Size > m_MaxCacheBytes)
+	{
+		m_Records.erase( Record );
+		return;
+	}
+
+	Record->second.Position = m_CacheOrder.insert(
+		m_CacheOrder.end( ),
+		Record->first );
+	Record->second.Buffer   = Buffer;
+	Record->second.State    = ResourceStateCached;
+
+	m_CacheBytes += Size;
+}
+
@@ -0,0 +1,280 @@
+/*++
+
+Copyright (c) Ken Johnson (Skywing). All rights reserved.
+
+Module Name:
+
+	ResourcePrefetcher.h
+
+Abstract:
+
+	This module defines the resource prefetcher, which reads resources into
+	memory ahead of use on a small pool of worker threads.
+
+--*/
+
+#ifndef _PROGRAMS_NWN2DATALIB_RESOURCEPREFETCHER_H
+#define _PROGRAMS_NWN2DATALIB_RESOURCEPREFETCHER_H
+
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+#include "DemandBuffer.h"
+
+//
+// Define the resource prefetcher object.  Resources are identified by an
+// opaque index supplied by the owner (the resource manager uses its resource
+// entry index).  The owner queues resources with a priority; worker threads
+// claim queued resources in priority order, then FIFO order, and load them via
+// the owner's load routine into a cache that is bounded by total size.  When
+// the cache is full, the workers stop claiming queued resources until the
+// owner consumes enough cached resources to make room; a prefetched resource
+// is never discarded before it is consumed (or cancelled), as the owner would
+// then have to read it a second time.  The cache may exceed its limit by the
+// resources that were being loaded when it filled.
+//
+// A cached resource is handed out (and dropped from the cache) the first time
+// that the owner looks it up.  The owner may thus consume a prefetched
+// resource at most once; later requests fall back to a normal load.
+//
+// Only a single thread (the owning thread) may call Enqueue, Lookup or
+// Cancel.  The load routine is invoked on the worker threads, concurrently
+// with the owning thread.
+//
+
+class ResourcePrefetcher
+{
+
+public:
+
+	//
+	// Define the routine that loads a resource on behalf of a worker thread.
+	// The routine must synchronize with the owning thread as necessary.  It
+	// raises an std::exception on failure.
+	//
+
+	typedef
+	DemandBufferPtr
+	(* LoadRoutine)(
+		__in void * Context,
+		__in size_t Resource
+		);
+
+	//
+	// Define prefetch priorities.  Higher priority resources are loaded
+	// before lower priority resources.
+	//
+
+	enum PrefetchPriority
+	{
+		PrefetchPriorityLow,
+		PrefetchPriorityNormal,
+		PrefetchPriorityHigh,
+
+		LAST_PREFETCH_PRIORITY
+	};
+
+	//
+	// Define the default limits.
+	//
+
+	enum
+	{
+		DEFAULT_MAX_CACHE_BYTES = 64 * 1024 * 1024,
+		DEFAULT_MAX_THREADS     = 2,
+		MAX_PREFETCH_THREADS    = 8,
+
+		LAST_PREFETCH_CONSTANT
+	};
+
+	//
+	// Constructor.
+	//
+
+	ResourcePrefetcher(
+		);
+
+	//
+	// Destructor.  Outstanding loads are waited for and the worker threads
+	// are shut down.
+	//
+
+	~ResourcePrefetcher(
+		);
+
+	//
+	// Register the owner's load routine.  This must be done before the first
+	// call to Enqueue.
+	//
+
+	void
+	Initialize(
+		__in LoadRoutine Routine,
+		__in void * Context
+		);
+
+	//
+	// Set the maximum total size of cached resources, and the count of worker
+	// threads to use.  A change in the thread count only takes effect if the
+	// worker threads have not yet been started.  Lowering the size limit does
+	// not discard cached resources.
+	//
+
+	void
+	SetLimits(
+		__in size_t MaxCacheBytes,
+		__in size_t MaxThreads
+		);
+
+	//
+	// Queue resources for prefetch.  Resources that are already queued,
+	// loading or cached are skipped.  Raises an std::exception on failure.
+	//
+
+	void
+	Enqueue(
+		__in_ecount( Count ) const size_t * Resources,
+		__in size_t Count,
+		__in PrefetchPriority Priority
+		);
+
+	//
+	// Retrieve a prefetched resource.  If the resource is being loaded, the
+	// routine waits for the load to finish.  If the resource is still queued,
+	// it is removed from the queue as the caller will load it directly.
+	//
+	// The routine returns true if the prefetched contents were returned, in
+	// which case the resource is dropped from the cache.
+	//
+
+	bool
+	Lookup(
+		__in size_t Resource,
+		__out DemandBufferPtr & Buffer
+		);
+
+	//
+	// Discard all queued and cached resources, and wait for any loads that
+	// are in progress to finish.  This must be done before the resources that
+	// the indicies refer to are invalidated.
+	//
+
+	void
+	Cancel(
+		);
+
+private:
+
+	enum ResourceState
+	{
+		ResourceStateQueued,
+		ResourceStateLoading,
+		ResourceStateCached,
+
+		LAST_RESOURCE_STATE
+	};
+
+	typedef std::list< size_t > ResourceList;
+
+	//
+	// Define the state of a queued, loading or cached resource.  Position
+	// refers to the resource's entry in its priority queue (if queued) or in
+	// the cache order list (if cached).
+	//
+
+	struct ResourceRecord
+	{
+		ResourceState          State;
+		PrefetchPriority       Priority;
+		ResourceList::iterator Position;
+		DemandBufferPtr        Buffer;
+	};
+
+	typedef stdext::hash_map< size_t, ResourceRecord > ResourceRecordMap;
+
+	//
+	// Resource prefetchers are not copyable.
+	//
+
+	ResourcePrefetcher(
+		__in const ResourcePrefetcher & other
+		);
+
+	ResourcePrefetcher &
+	operator=(
+		__in const ResourcePrefetcher & other
+		);
+
+	//
+	// Start the worker threads if they have not yet been started.  Raises an
+	// std::exception on failure.
+	//
+
+	void
+	StartWorkers(
+		);
+
+	//
+	// Worker thread entry point and work loop.
+	//
+
+	static
+	unsigned
+	__stdcall
+	WorkerThread(
+		__in void * Parameter
+		);
+
+	void
+	ProcessQueue(
+		);
+
+	//
+	// Insert a loaded resource into the cache.  The lock must be held.
+	//
+
+	void
+	CacheResource(
+		__in ResourceRecordMap::iterator Record,
+		__in const DemandBufferPtr & Buffer
+		);
+
+	//
+	// Define the owner's load routine.
+	//
+
+	LoadRoutine             m_LoadRoutine;
+	void                  * m_LoadContext;
+
+	//
+	// Define the queue and cache state, guarded by m_Lock.
+	//
+
+	swutil::CriticalSection m_Lock;
+	ResourceRecordMap       m_Records;
+	ResourceList            m_Queues[ LAST_PREFETCH_PRIORITY ];
+	ResourceList            m_CacheOrder;
+	size_t                  m_CacheBytes;
+	size_t                  m_MaxCacheBytes;
+	size_t                  m_Loading;
+
+	//
+	// Define the worker threads.  m_WorkSemaphore is released once for each
+	// queued resource, m_StopEvent signals the workers to exit,
+	// m_CompletedEvent is signaled whenever a load finishes, and m_SpaceEvent
+	// is signaled while the cache is below its size limit.
+	//
+
+	HANDLE                  m_Threads[ MAX_PREFETCH_THREADS ];
+	size_t                  m_ThreadCount;
+	size_t                  m_MaxThreads;
+	HANDLE                  m_WorkSemaphore;
+	HANDLE                  m_StopEvent;
+	HANDLE                  m_CompletedEvent;
+	HANDLE                  m_SpaceEvent;
+
+};
+
+#endif
+
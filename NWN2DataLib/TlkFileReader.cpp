@@ -43,7 +43,10 @@ Environment:
 --*/
 : m_File( INVALID_HANDLE_VALUE ),
   m_FileSize( 0 ),
-  m_StringsOffset( 0 )
+  m_StringsOffset( 0 ),
+  m_View( NULL ),
+  m_UTF8CacheLimit( 0 ),
+  m_Codepage( CP_UTF8 )
 {
 	HANDLE File;
 
@@ -110,6 +113,13 @@ Environment:
 
 --*/
 {
+	if (m_View != NULL)
+	{
+		UnmapViewOfFile( m_View );
+
+		m_View = NULL;
+	}
+
 	if (m_File != INVALID_HANDLE_VALUE)
 	{
 		CloseHandle( m_File );
@@ -159,6 +169,23 @@ Environment:
 	if (!(StringDesc->Flags & TEXT_PRESENT))
 		return true;
 
+	//
+	// If the talk table is mapped, copy the text straight out of the view.
+	//
+
+	if (m_View != NULL)
+	{
+		const char * Text;
+		size_t       Length;
+
+		if (!GetTalkStringView( StringId, Text, Length ))
+			return false;
+
+		String.assign( Text, Length );
+
+		return true;
+	}
+
 	String.resize( StringDesc->StringSize );
 
 	if (StringDesc->StringSize == 0)
@@ -172,6 +199,271 @@ Environment:
 	return true;
 }
 
+template< typename ResRefT >
+bool
+TlkFileReader< ResRefT >::GetTalkStringView(
+	__in typename TlkFileReader< ResRefT >::StrRef StringId,
+	__deref_out_bcount( Length ) const char * & Text,
+	__out size_t & Length
+	) const
+/*++
+
+Routine Description:
+
+	This routine locates the text of a string from the talk file's string
+	directory within the mapped view of the talk file.
+
+Arguments:
+
+	StringId - Supplies the string ordinal to fetch.
+
+	Text - Receives a pointer to the string text.  The text is not null
+	       terminated, and remains valid for the lifetime of the reader.
+
+	Length - Receives the length, in bytes, of the string text.
+
+Return Value:
+
+	The routine returns a Boolean value indicating true on success, else false
+	on failure (i.e. unknown string, or the talk table is not mapped).
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	PCTLK_STRING StringDesc;
+	ULONGLONG    Offset;
+
+	Text   = "";
+	Length = 0;
+
+	if (m_View == NULL)
+		return false;
+
+	StringDesc = LookupStringDescriptor( StringId );
+
+	if (StringDesc == NULL)
+		return false;
+
+	if (!(StringDesc->Flags & TEXT_PRESENT))
+		return true;
+
+	Offset = m_StringsOffset + StringDesc->OffsetToString;
+
+	if ((Offset > m_FileSize) || (StringDesc->StringSize > m_FileSize - Offset))
+		return false;
+
+	Text   = (const char *) m_View + Offset;
+	Length = StringDesc->StringSize;
+
+	return true;
+}
+
+template< typename ResRefT >
+size_t
+TlkFileReader< ResRefT >::GetTalkStrings(
+	__in size_t Count,
+	__in_ecount( Count ) const StrRef * StringIds,
+	__out_ecount( Count ) std::string * Strings
+	) const
+/*++
+
+Routine Description:
+
+	This routine reads a batch of strings from the talk file's string
+	directory.
+
+Arguments:
+
+	Count - Supplies the count of strings to fetch.
+
+	StringIds - Supplies the string ordinals to fetch.
+
+	Strings - Receives the translated strings.  Strings that could not be
+	          found are returned empty.
+
+Return Value:
+
+	The routine returns the count of strings that were found.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	size_t Found;
+
+	Found = 0;
+
+	for (size_t i = 0; i < Count; i += 1)
+	{
+		if (GetTalkString( StringIds[ i ], Strings[ i ] ))
+			Found += 1;
+		else
+			Strings[ i ].clear( );
+	}
+
+	return Found;
+}
+
+template< typename ResRefT >
+void
+TlkFileReader< ResRefT >::SetUTF8Cache(
+	__in size_t MaxStrings,
+	__in UINT Codepage
+	)
+/*++
+
+Routine Description:
+
+	This routine configures the UTF-8 string cache.  Any already cached
+	strings are discarded.
+
+Arguments:
+
+	MaxStrings - Supplies the count of converted strings to retain.  A value
+	             of zero disables caching.
+
+	Codepage - Supplies the code page of the talk table's text, or CP_UTF8 if
+	           the text is already UTF-8.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	swutil::ScopedLock Lock( m_UTF8CacheLock );
+
+	m_UTF8CacheMap.clear( );
+	m_UTF8CacheList.clear( );
+
+	m_UTF8CacheLimit = MaxStrings;
+	m_Codepage       = Codepage;
+}
+
+template< typename ResRefT >
+bool
+TlkFileReader< ResRefT >::GetTalkStringUTF8(
+	__in typename TlkFileReader< ResRefT >::StrRef StringId,
+	__out std::string & String
+	) const
+/*++
+
+Routine Description:
+
+	This routine reads a string from the talk file's string directory and
+	converts it to UTF-8.  Converted strings are retained in the UTF-8 string
+	cache, if the cache is enabled.
+
+Arguments:
+
+	StringId - Supplies the string ordinal to fetch.
+
+	String - Receives the translated string, in UTF-8.
+
+Return Value:
+
+	The routine returns a Boolean value indicating true on success, else false
+	on failure (i.e. unknown string, or conversion failure).
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	UINT Codepage;
+
+	//
+	// Return the cached copy if we have one, marking it most recently used.
+	// The code page is captured under the lock, as SetUTF8Cache may change it
+	// concurrently.
+	//
+
+	{
+		swutil::ScopedLock                    Lock( m_UTF8CacheLock );
+		typename UTF8CacheMap::const_iterator it;
+
+		Codepage = m_Codepage;
+
+		it = m_UTF8CacheMap.find( StringId );
+
+		if (it != m_UTF8CacheMap.end( ))
+		{
+			m_UTF8CacheList.splice(
+				m_UTF8CacheList.begin( ),
+				m_UTF8CacheList,
+				it->second);
+
+			String = it->second->String;
+
+			return true;
+		}
+	}
+
+	if (!GetTalkString( StringId, String ))
+		return false;
+
+	if ((Codepage != CP_UTF8) && (!String.empty( )))
+	{
+		if (!swutil::UTF8Encode( String, String, Codepage ))
+			return false;
+	}
+
+	//
+	// Insert the converted string, evicting the least recently used strings
+	// if the cache is full.  Another thread may have raced us to insert the
+	// same string, or to change the code page, in which case we are done.
+	//
+
+	{
+		swutil::ScopedLock Lock( m_UTF8CacheLock );
+
+		if (m_UTF8CacheLimit == 0)
+			return true;
+
+		if (m_Codepage != Codepage)
+			return true;
+
+		if (m_UTF8CacheMap.find( StringId ) != m_UTF8CacheMap.end( ))
+			return true;
+
+		m_UTF8CacheList.push_front( UTF8CacheEntry( ) );
+
+		try
+		{
+			m_UTF8CacheList.front( ).StringId = StringId;
+			m_UTF8CacheList.front( ).String   = String;
+
+			m_UTF8CacheMap.insert(
+				typename UTF8CacheMap::value_type(
+					StringId,
+					m_UTF8CacheList.begin( ) ) );
+		}
+		catch (...)
+		{
+			m_UTF8CacheList.pop_front( );
+			throw;
+		}
+
+		while (m_UTF8CacheList.size( ) > m_UTF8CacheLimit)
+		{
+			m_UTF8CacheMap.erase( m_UTF8CacheList.back( ).StringId );
+			m_UTF8CacheList.pop_back( );
+		}
+	}
+
+	return true;
+}
+
 template< typename ResRefT >
 void
 TlkFileReader< ResRefT >::ParseTlkFile(
@@ -203,6 +495,16 @@ Environment:
 
 	m_FileWrapper.ReadFile( &Header, sizeof( Header ), "Header" );
 
+	//
+	// The string directory is copied directly out of the mapped view below,
+	// so it must lie entirely within the file.  Check the count against the
+	// file size by division so that the check cannot itself overflow.
+	//
+
+	if ((m_FileSize < sizeof( TLK_HEADER )) ||
+	    (Header.StringCount > (m_FileSize - sizeof( TLK_HEADER )) / sizeof( TLK_STRING )))
+		throw std::runtime_error( "TLK string directory exceeds file size." );
+
 	if (Header.StringCount * sizeof( TLK_STRING ) < Header.StringCount)
 		return;
 
@@ -252,8 +554,12 @@ Environment:
 		UnmapViewOfFile( View );
 		throw;
 	}
-	
-	UnmapViewOfFile( View );
+
+	//
+	// Retain the view so that string text can be returned directly from it.
+	//
+
+	m_View = (const unsigned char *) View;
 }
 
 template TlkFileReader< NWN::ResRef16 >;
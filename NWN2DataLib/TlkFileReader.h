@@ -61,6 +61,58 @@ public:
 		__out std::string & String
 		) const;
 
+	//
+	// Look up a string based on STRREF, returning the text in place within
+	// the mapped talk table instead of copying it.  The text is not null
+	// terminated and remains valid for the lifetime of the reader.  Returns
+	// false if the string could not be found, or if the talk table is not
+	// mapped.
+	//
+
+	bool
+	GetTalkStringView(
+		__in StrRef StringId,
+		__deref_out_bcount( Length ) const char * & Text,
+		__out size_t & Length
+		) const;
+
+	//
+	// Look up a batch of strings based on STRREF.  Strings that could not be
+	// found are returned empty.  Returns the count of strings found.
+	//
+
+	size_t
+	GetTalkStrings(
+		__in size_t Count,
+		__in_ecount( Count ) const StrRef * StringIds,
+		__out_ecount( Count ) std::string * Strings
+		) const;
+
+	//
+	// Configure the UTF-8 string cache.  Codepage supplies the code page of
+	// the talk table's text (CP_UTF8 if no conversion is needed), and
+	// MaxStrings supplies the count of converted strings that are retained,
+	// least recently used first out.  A MaxStrings of zero disables caching.
+	// Any already cached strings are discarded.
+	//
+
+	void
+	SetUTF8Cache(
+		__in size_t MaxStrings,
+		__in UINT Codepage
+		);
+
+	//
+	// Look up a string based on STRREF, converted to UTF-8.  Returns false on
+	// failure, i.e. if the string could not be found or converted.
+	//
+
+	bool
+	GetTalkStringUTF8(
+		__in StrRef StringId,
+		__out std::string & String
+		) const;
+
 	//
 	// Define the TLK on-disk file structures.  This data is based on the
 	// BioWare Aurora engine documentation.
@@ -132,6 +184,20 @@ private:
 
 	typedef std::vector< TLK_STRING > TlkStringVec;
 
+	//
+	// Define the UTF-8 string cache.  The list is kept in most recently used
+	// order, and the map locates each string's list entry by STRREF.
+	//
+
+	struct UTF8CacheEntry
+	{
+		StrRef      StringId;
+		std::string String;
+	};
+
+	typedef std::list< UTF8CacheEntry > UTF8CacheList;
+	typedef stdext::hash_map< StrRef, typename UTF8CacheList::iterator > UTF8CacheMap;
+
 	//
 	// Locate a string descriptor by its reference id.
 	//
@@ -157,12 +223,28 @@ private:
 	mutable FileWrapper   m_FileWrapper;
 	ULONGLONG             m_StringsOffset;
 
+	//
+	// Define the mapped view of the talk table, if the table could be mapped.
+	//
+
+	const unsigned char * m_View;
+
 	//
 	// Resource list data.
 	//
 
 	TlkStringVec          m_StringDir;
 
+	//
+	// UTF-8 string cache data.
+	//
+
+	mutable swutil::CriticalSection m_UTF8CacheLock;
+	mutable UTF8CacheList m_UTF8CacheList;
+	mutable UTF8CacheMap  m_UTF8CacheMap;
+	size_t                m_UTF8CacheLimit;
+	UINT                  m_Codepage;
+
 };
 
 typedef TlkFileReader< NWN::ResRef32 > TlkFileReader32;
@@ -162,6 +162,82 @@ Environment:
 	}
 }
 
+TrxFileReader::TrxFileReader(
+	__in MeshManager & MeshMgr,
+	__in_bcount( DataSize ) const void * TrxRawData,
+	__in size_t DataSize,
+	__in bool LoadOnlyDimensions,
+	__in MODE Mode, /* = ModeTRX */
+	__in IDebugTextOut * TextWriter, /* = NULL */
+	__in bool RefuseDisplayOnlyModels /* = false */
+	)
+/*++
+
+Routine Description:
+
+	This routine constructs a new TrxFileReader object and parses the contents
+	of a TRX file by raw in-memory buffer (such as a demand buffer returned by
+	ResourceManager::DemandView).  The contents are immediately deserialized,
+	so the raw memory buffer need only remain valid for the duration of the
+	constructor.
+
+Arguments:
+
+	MeshMgr - Supplies the mesh manager to which all child meshes are
+	          registered to.
+
+	TrxRawData - Supplies the raw TRX file data to process.
+
+	DataSize - Supplies the length, in bytes, of the raw data buffer.
+
+	LoadOnlyDimensions - Supplies a Boolean value indicating if only area size
+	                     parameters should be loaded, versus all area mesh data
+						 (which is an expensive operation).  This parameter is
+						 only effective for ModeTRX.
+
+	Mode - Supplies the parser mode (e.g. TRX vs MDB).
+
+	TextWriter - Optionally supplies the text output implementation that is
+	             used to indicate debug log messages upwards.
+
+	RefuseDisplayOnlyModels - Supplies a Boolean value that indicates whether
+	                          any model data that is purely display-based is to
+	                          not be loaded.
+
+Return Value:
+
+	The newly constructed object.
+
+Environment:
+
+	User mode.
+
+--*/
+: m_Width( 0 ),
+  m_Height( 0 ),
+  m_File( INVALID_HANDLE_VALUE ),
+  m_FileSize( (ULONG) DataSize ),
+  m_LoadOnlyDimensions( LoadOnlyDimensions ),
+  m_Walkmesh( TextWriter ),
+  m_Mode( Mode ),
+  m_TextWriter( TextWriter ),
+  m_RefuseDisplayOnlyModels( RefuseDisplayOnlyModels )
+{
+	if (DataSize > ULONG_MAX)
+		throw std::runtime_error( ".trx buffer is too large." );
+
+	m_FileWrapper.SetExternalView(
+		(const unsigned char *) TrxRawData,
+		(ULONGLONG) DataSize);
+
+	//
+	// N.B.  The file wrapper is not referenced again once parsing completes,
+	//       so the caller's buffer need not outlive the constructor.
+	//
+
+	ParseTrxFile( MeshMgr );
+}
+
 TrxFileReader::~TrxFileReader(
 	)
 /*++
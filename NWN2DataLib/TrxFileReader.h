@@ -102,6 +102,22 @@ public:
 		__in bool RefuseDisplayOnlyModels = false
 		);
 
+	//
+	// Parse a Trx file from an in-memory buffer, raises an std::exception on
+	// failure.  The buffer need only remain valid for the duration of the
+	// constructor.
+	//
+
+	TrxFileReader(
+		__in MeshManager & MeshMgr,
+		__in_bcount( DataSize ) const void * TrxRawData,
+		__in size_t DataSize,
+		__in bool LoadOnlyDimensions,
+		__in MODE Mode = ModeTRX,
+		__in_opt IDebugTextOut * TextWriter = NULL,
+		__in bool RefuseDisplayOnlyModels = false
+		);
+
 	~TrxFileReader(
 		);
 
@@ -16,14 +16,65 @@ Abstract:
 
 #include "Precomp.h"
 #include "ZipFileReader.h"
-#include "FileWrapper.h"
 
-#define STRICTZIPUNZIP
 #include "../zlib/zlib.h"
-#define _ZLIB_H // unzip.h mistakenly assumes _ZLIB_H instead of ZLIB_H
-#include "../zlib/contrib/minizip/unzip.h"
 
-static void x_fill_fopen_filefunc (zlib_filefunc_def* pzlib_filefunc_def);
+//
+// Define the .zip on-disk record signatures and layouts.  All fields are
+// stored little endian and are not naturally aligned, so they are accessed
+// via the GetZipUShort and GetZipULong helpers.
+//
+
+#define ZIP_EOCD_SIGNATURE         0x06054B50
+#define ZIP_EOCD_SIZE              22
+#define ZIP_EOCD_ENTRY_COUNT       10
+#define ZIP_EOCD_CENTRAL_DIR_SIZE  12
+#define ZIP_EOCD_CENTRAL_DIR_OFF   16
+#define ZIP_EOCD_COMMENT_LENGTH    20
+
+#define ZIP_CDIR_SIGNATURE         0x02014B50
+#define ZIP_CDIR_SIZE              46
+#define ZIP_CDIR_FLAGS             8
+#define ZIP_CDIR_METHOD            10
+#define ZIP_CDIR_COMPRESSED_SIZE   20
+#define ZIP_CDIR_UNCOMPRESSED_SIZE 24
+#define ZIP_CDIR_NAME_LENGTH       28
+#define ZIP_CDIR_EXTRA_LENGTH      30
+#define ZIP_CDIR_COMMENT_LENGTH    32
+#define ZIP_CDIR_LOCAL_HEADER_OFF  42
+
+#define ZIP_LOCAL_SIGNATURE        0x04034B50
+#define ZIP_LOCAL_SIZE             30
+#define ZIP_LOCAL_NAME_LENGTH      26
+#define ZIP_LOCAL_EXTRA_LENGTH     28
+
+#define ZIP_FLAG_ENCRYPTED         0x0001
+
+#define ZIP_METHOD_STORED          0
+#define ZIP_METHOD_DEFLATED        8
+
+static
+inline
+unsigned short
+GetZipUShort(
+	__in_bcount( 2 ) const unsigned char * p
+	)
+{
+	return (unsigned short) (p[ 0 ] | (p[ 1 ] << 8));
+}
+
+static
+inline
+unsigned long
+GetZipULong(
+	__in_bcount( 4 ) const unsigned char * p
+	)
+{
+	return ((unsigned long) p[ 0 ]      ) |
+	       ((unsigned long) p[ 1 ] <<  8) |
+	       ((unsigned long) p[ 2 ] << 16) |
+	       ((unsigned long) p[ 3 ] << 24);
+}
 
 template< typename ResRefT >
 ZipFileReader< ResRefT >::ZipFileReader(
@@ -49,37 +100,102 @@ Environment:
 	User mode.
 
 --*/
-: m_Archive( NULL ),
-  m_FileOpened( false ),
-  m_OpenFileHandle( INVALID_FILE ),
-  m_CurrentOffset( 0 ),
+: m_File( INVALID_HANDLE_VALUE ),
+  m_FileSize( 0 ),
+  m_ArchiveBias( 0 ),
+  m_NextFileHandle( 1 ),
   m_FileName( ArchiveName )
 {
-	//
-	// Create directory file entries as necessary.
-	//
+	OpenArchive( ArchiveName );
+
+	try
+	{
+		ScanArchive( );
+	}
+	catch (...)
+	{
+		CloseArchive( );
+		throw;
+	}
+}
+
+template< typename ResRefT >
+ZipFileReader< ResRefT >::ZipFileReader(
+	__in const std::string & ArchiveName,
+	__in_ecount( EntryCount ) const ResourceIndexCache::Entry * Entries,
+	__in size_t EntryCount
+	)
+/*++
+
+Routine Description:
+
+	This routine constructs a new ZipFileReader object and opens the .zip
+	archive for reading, using a cached directory listing in lieu of scanning
+	the archive's central directory.
+
+Arguments:
+
+	ArchiveName - Supplies the name of the .zip archive to access.
+
+	Entries - Supplies the cached directory listing, as previously returned by
+	          GetDirectoryEntries for an unmodified copy of the archive.
 
-	m_Archive = OpenArchive( ArchiveName );
+	EntryCount - Supplies the count of cached directory entries.
 
-	if (m_Archive == NULL)
+Return Value:
+
+	The newly constructed object.
+
+Environment:
+
+	User mode.
+
+--*/
+: m_File( INVALID_HANDLE_VALUE ),
+  m_FileSize( 0 ),
+  m_ArchiveBias( 0 ),
+  m_NextFileHandle( 1 ),
+  m_FileName( ArchiveName )
+{
+	ULONG64 CentralDirOffset;
+	ULONG64 CentralDirSize;
+	ULONG64 CentralDirEntries;
+
+	OpenArchive( ArchiveName );
+
+	try
 	{
-		try
-		{
-			std::string ErrorStr;
+		//
+		// Locating the central directory is cheap and establishes the archive
+		// bias, which is needed to find local headers when entries are opened.
+		//
 
-			ErrorStr  = "Failed to open .zip archive '";
-			ErrorStr += ArchiveName;
-			ErrorStr += "'.";
+		LocateCentralDirectory(
+			CentralDirOffset,
+			CentralDirSize,
+			CentralDirEntries);
 
-			throw std::runtime_error( ErrorStr );
-		}
-		catch (std::bad_alloc)
-		{
-			throw std::runtime_error( "Failed to open .zip archive." );
-		}
+		m_DirectoryEntries.resize( EntryCount );
+	}
+	catch (...)
+	{
+		CloseArchive( );
+		throw;
 	}
 
-	ScanArchive( m_Archive );
+	for (size_t i = 0; i < EntryCount; i += 1)
+	{
+		DirectoryEntry & Entry = m_DirectoryEntries[ i ];
+
+		ZeroMemory( &Entry.Name, sizeof( Entry.Name ) );
+		memcpy(
+			&Entry.Name,
+			&Entries[ i ].Name,
+			min( sizeof( Entry.Name ), sizeof( Entries[ i ].Name ) ) );
+
+		Entry.Type             = (ResType) Entries[ i ].Type;
+		Entry.CentralDirOffset = Entries[ i ].Locator;
+	}
 }
 
 template< typename ResRefT >
@@ -105,12 +221,7 @@ Environment:
 
 --*/
 {
-	if (m_Archive != NULL)
-	{
-		CloseArchive( m_Archive );
-
-		m_Archive = NULL;
-	}
+	CloseArchive( );
 }
 
 template< typename ResRefT >
@@ -125,9 +236,6 @@ Routine Description:
 
 	This routine logically opens a file within the archive.
 
-	File handles are simply file identifiers for purposes of accessing the .zip
-	archive.
-
 Arguments:
 
 	FileName - Supplies the name of the resource file to open.
@@ -150,13 +258,10 @@ Environment:
 {
 	const DirectoryEntry * Entry;
 
-	if ((Entry = LocateFileByName( FileName, Type )) == NULL)
-		return INVALID_FILE;
+	Entry = LocateFileByName( FileName, Type );
 
-	//
-	// Just pass the request on to OpenFileByIndex, so that it may handle the
-	// request in a uniform fashion.
-	// 
+	if (Entry == NULL)
+		return INVALID_FILE;
 
 	return OpenFileByIndex( Entry - &m_DirectoryEntries[ 0 ] );
 }
@@ -172,10 +277,9 @@ Routine Description:
 
 	This routine logically opens a file within the archive.
 
-	File handles are simply file identifiers for purposes of accessing the .zip
-	archive.
-
-	Currently, the .zip file reader supports only one concurrent open file.
+	The central directory record and local header of the file are read in
+	order to locate the file data, and a new open entry is created for it.
+	Any number of files may be open concurrently.
 
 Arguments:
 
@@ -195,38 +299,102 @@ Environment:
 
 --*/
 {
-	FileHandle   Handle;
-	int          Error;
-	unz_file_pos Pos;
-
-	if (m_FileOpened)
-		return INVALID_FILE;
+	unsigned char    CentralRecord[ ZIP_CDIR_SIZE ];
+	unsigned char    LocalHeader[ ZIP_LOCAL_SIZE ];
+	ULONG64          LocalHeaderOffset;
+	OpenEntry      * Entry;
+	FileHandle       Handle;
 
 	if ((size_t) FileIndex >= m_DirectoryEntries.size( ))
 		return INVALID_FILE;
 
 	//
-	// Seek to the start of the file and open it.
+	// Read the central directory record, which holds the authoritative sizes
+	// and compression method of the file.
 	//
 
-	Handle = m_DirectoryEntries[ (size_t) FileIndex ].FileHandleToReturn;
+	if (!ReadArchive(
+		m_DirectoryEntries[ (size_t) FileIndex ].CentralDirOffset,
+		CentralRecord,
+		sizeof( CentralRecord )))
+	{
+		return INVALID_FILE;
+	}
+
+	if (GetZipULong( CentralRecord ) != ZIP_CDIR_SIGNATURE)
+		return INVALID_FILE;
+
+	if (GetZipUShort( CentralRecord + ZIP_CDIR_FLAGS ) & ZIP_FLAG_ENCRYPTED)
+		return INVALID_FILE;
 
-	Pos.pos_in_zip_directory = (uLong) (((Handle - 1) >>  0) & 0xFFFFFFFF);
-	Pos.num_of_file          = (uLong) (((Handle - 1) >> 32) & 0xFFFFFFFF);
+	switch (GetZipUShort( CentralRecord + ZIP_CDIR_METHOD ))
+	{
 
-	Error = unzGoToFilePos( (unzFile) m_Archive, &Pos );
+	case ZIP_METHOD_STORED:
+	case ZIP_METHOD_DEFLATED:
+		break;
 
-	if (Error)
+	default:
 		return INVALID_FILE;
 
-	Error = unzOpenCurrentFile( (unzFile) m_Archive );
+	}
+
+	//
+	// Now read the local header, which may carry a different extra field
+	// length than the central directory record, to find the file data.
+	//
+
+	LocalHeaderOffset = m_ArchiveBias +
+		GetZipULong( CentralRecord + ZIP_CDIR_LOCAL_HEADER_OFF );
+
+	if (!ReadArchive( LocalHeaderOffset, LocalHeader, sizeof( LocalHeader ) ))
+		return INVALID_FILE;
 
-	if (Error)
+	if (GetZipULong( LocalHeader ) != ZIP_LOCAL_SIGNATURE)
 		return INVALID_FILE;
 
-	m_FileOpened     = true;
-	m_OpenFileHandle = Handle;
-	m_CurrentOffset  = 0;
+	Entry  = NULL;
+	Handle = INVALID_FILE;
+
+	try
+	{
+		Entry = new OpenEntry;
+
+		Entry->Index            = FileIndex;
+		Entry->Method           = GetZipUShort( CentralRecord + ZIP_CDIR_METHOD );
+		Entry->DataOffset       = LocalHeaderOffset +
+		                          ZIP_LOCAL_SIZE +
+		                          GetZipUShort( LocalHeader + ZIP_LOCAL_NAME_LENGTH ) +
+		                          GetZipUShort( LocalHeader + ZIP_LOCAL_EXTRA_LENGTH );
+		Entry->CompressedSize   = GetZipULong( CentralRecord + ZIP_CDIR_COMPRESSED_SIZE );
+		Entry->UncompressedSize = GetZipULong( CentralRecord + ZIP_CDIR_UNCOMPRESSED_SIZE );
+		Entry->Stream           = NULL;
+		Entry->StreamOffset     = 0;
+		Entry->InputOffset      = 0;
+		Entry->RandomAccess     = false;
+
+		if ((Entry->DataOffset > m_FileSize) ||
+		    (Entry->CompressedSize > m_FileSize - Entry->DataOffset) ||
+		    ((Entry->Method == ZIP_METHOD_STORED) &&
+		     (Entry->CompressedSize != Entry->UncompressedSize)))
+		{
+			FreeOpenEntry( Entry );
+			return INVALID_FILE;
+		}
+
+		swutil::ScopedLock Lock( m_OpenEntryLock );
+
+		Handle = m_NextFileHandle++;
+
+		m_OpenEntries.insert( OpenEntryMap::value_type( Handle, Entry ) );
+	}
+	catch (std::exception)
+	{
+		if (Entry != NULL)
+			FreeOpenEntry( Entry );
+
+		return INVALID_FILE;
+	}
 
 	return Handle;
 }
@@ -241,10 +409,7 @@ ZipFileReader< ResRefT >::CloseFile(
 Routine Description:
 
 	This routine logically closes an encapsulated sub-file within the .zip
-	archive.
-
-	Currently, file handles are implemented as simply file offsets within the
-	.zip archive.
+	archive, releasing its inflate state.
 
 Arguments:
 
@@ -262,22 +427,25 @@ Environment:
 
 --*/
 {
-	//
-	// Ensure that the file handle is legal before closing the current file.
-	//
+	OpenEntry * Entry;
 
 	if (File == INVALID_FILE)
 		return false;
 
-	if (!m_FileOpened)
-		return false;
+	{
+		swutil::ScopedLock Lock( m_OpenEntryLock );
 
-	if (File != m_OpenFileHandle)
-		return false;
+		typename OpenEntryMap::iterator it = m_OpenEntries.find( File );
+
+		if (it == m_OpenEntries.end( ))
+			return false;
 
-	unzCloseCurrentFile( (unzFile) m_Archive );
+		Entry = it->second;
+
+		m_OpenEntries.erase( it );
+	}
 
-	m_FileOpened = false;
+	FreeOpenEntry( Entry );
 
 	return true;
 }
@@ -297,7 +465,11 @@ Routine Description:
 
 	This routine logically reads an encapsulated sub-file within the .zip file.
 
-	Presently, only sequential scan is supported for .zip files.
+	Reads may be issued at any offset.  Stored files are read directly from
+	the archive.  Deflated files are read sequentially most efficiently; a
+	backwards seek restarts inflation from the closest preceding seek point
+	(or from the start of the file if there is none), and from that point on
+	seek points are recorded as the file is inflated.
 
 Arguments:
 
@@ -317,6 +489,7 @@ Return Value:
 	The routine returns a Boolean value indicating true on success, else false
 	on failure.  An attempt to read from an invalid file handle, or an attempt
 	to read beyond the end of file would be examples of failure conditions.
+	A read at offset zero of an empty file succeeds, transferring no bytes.
 
 Environment:
 
@@ -324,38 +497,144 @@ Environment:
 
 --*/
 {
-	int Read;
+	OpenEntry * Entry;
 
-	if (BytesToRead > ULONG_MAX)
-		BytesToRead = ULONG_MAX;
+	Entry = LookupOpenEntry( File );
 
-	if (File == INVALID_FILE)
+	if (Entry == NULL)
 		return false;
 
-	if (!m_FileOpened)
-		return false;
+	//
+	// An empty file has no data to read, but a read from its start is still
+	// well-formed, so it transfers no bytes and succeeds.
+	//
 
-	if (File != m_OpenFileHandle)
-		return false;
+	if ((Offset == 0) && (Entry->UncompressedSize == 0))
+	{
+		*BytesRead = 0;
+		return true;
+	}
 
-	if (m_CurrentOffset != Offset)
+	if ((ULONG64) Offset >= Entry->UncompressedSize)
 		return false;
 
-	Read = unzReadCurrentFile(
-		(unzFile) m_Archive,
-		Buffer,
-		(unsigned) BytesToRead);
+	if ((ULONG64) BytesToRead > Entry->UncompressedSize - Offset)
+		BytesToRead = (size_t) (Entry->UncompressedSize - Offset);
 
-	if (Read <= 0)
-		return false;
+	if (Entry->Method == ZIP_METHOD_STORED)
+	{
+		if (!ReadArchive( Entry->DataOffset + Offset, Buffer, BytesToRead ))
+			return false;
+	}
+	else
+	{
+		if (!SeekOpenEntry( Entry, Offset ))
+			return false;
 
-	*BytesRead = (size_t) Read;
+		if (!InflateOpenEntry( Entry, (unsigned char *) Buffer, BytesToRead ))
+			return false;
+	}
 
-	m_CurrentOffset += *BytesRead;
+	*BytesRead = BytesToRead;
 
 	return true;
 }
 
+template< typename ResRefT >
+bool
+ZipFileReader< ResRefT >::ReadEncapsulatedFiles(
+	__inout_ecount( Count ) ReadRequest * Requests,
+	__in size_t Count
+	)
+/*++
+
+Routine Description:
+
+	This routine logically reads a batch of ranges of encapsulated sub-files
+	within the .zip file.
+
+	The requests are sorted into archive order (by entry data offset, then by
+	offset within the entry) and then satisfied in that order.  Thus, the
+	archive is traversed front to back, and each deflated entry is inflated
+	sequentially without restarting.
+
+Arguments:
+
+	Requests - Supplies the read requests.  On return, the BytesRead and
+	           Succeeded fields of each request are filled in.
+
+	Count - Supplies the count of read requests.
+
+Return Value:
+
+	The routine returns a Boolean value indicating true if every request
+	succeeded, else false if any request failed.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	ReadOrderVec Order;
+	bool         AllSucceeded;
+
+	AllSucceeded = true;
+
+	try
+	{
+		Order.reserve( Count );
+
+		for (size_t i = 0; i < Count; i += 1)
+		{
+			OpenEntry * Entry;
+			ReadOrder   Position;
+
+			Requests[ i ].BytesRead = 0;
+			Requests[ i ].Succeeded = false;
+
+			Entry = LookupOpenEntry( Requests[ i ].File );
+
+			if (Entry == NULL)
+			{
+				AllSucceeded = false;
+				continue;
+			}
+
+			Position.DataOffset = Entry->DataOffset;
+			Position.Offset     = Requests[ i ].Offset;
+			Position.Request    = i;
+
+			Order.push_back( Position );
+		}
+	}
+	catch (std::exception)
+	{
+		return false;
+	}
+
+	std::sort( Order.begin( ), Order.end( ), ReadOrderLess( ) );
+
+	for (typename ReadOrderVec::const_iterator it = Order.begin( );
+	     it != Order.end( );
+	     ++it)
+	{
+		ReadRequest & Request = Requests[ it->Request ];
+
+		Request.Succeeded = ReadEncapsulatedFile(
+			Request.File,
+			Request.Offset,
+			Request.BytesToRead,
+			&Request.BytesRead,
+			Request.Buffer);
+
+		if (!Request.Succeeded)
+			AllSucceeded = false;
+	}
+
+	return AllSucceeded;
+}
+
 template< typename ResRefT >
 size_t
 ZipFileReader< ResRefT >::GetEncapsulatedFileSize(
@@ -387,32 +666,14 @@ Environment:
 
 --*/
 {
-	unz_file_info FileInfo;
-	int           Error;
-
-	if (File == INVALID_FILE)
-		return false;
-
-	if (!m_FileOpened)
-		return false;
+	OpenEntry * Entry;
 
-	if (File != m_OpenFileHandle)
-		return false;
-
-	Error = unzGetCurrentFileInfo(
-		(unzFile) m_Archive,
-		&FileInfo,
-		NULL,
-		0,
-		NULL,
-		0,
-		NULL,
-		0);
+	Entry = LookupOpenEntry( File );
 
-	if (Error)
-		return false;
+	if (Entry == NULL)
+		return 0;
 
-	return FileInfo.uncompressed_size;
+	return (size_t) Entry->UncompressedSize;
 }
 
 template< typename ResRefT >
@@ -481,54 +742,14 @@ Environment:
 
 --*/
 {
-	char   FileName[ 260 ];
-	char   Name[ MAX_PATH ];
-	char   Ext[ 32 ];
-	int    Error;
-
-	if (File == INVALID_FILE)
-		return NWN::ResINVALID;
-
-	if (!m_FileOpened)
-		return NWN::ResINVALID;
+	OpenEntry * Entry;
 
-	if (File != m_OpenFileHandle)
-		return NWN::ResINVALID;
-
-	strcpy_s( FileName, "Z:\\" ); // Bogus, for splitpath.
-
-	Error = unzGetCurrentFileInfo(
-		(unzFile) m_Archive,
-		NULL,
-		FileName + 3,
-		sizeof( FileName ) - 3,
-		NULL,
-		0,
-		NULL,
-		0);
-
-	if (Error)
-		return NWN::ResINVALID;
-
-	FileName[ sizeof( FileName ) - sizeof( FileName[ 0 ] ) ] = '\0';
+	Entry = LookupOpenEntry( File );
 
-	_strlwr( FileName );
-
-	if (_splitpath_s(
-		FileName,
-		NULL,
-		0,
-		NULL,
-		0,
-		Name,
-		sizeof( Name ),
-		Ext,
-		sizeof( Ext )) || (Ext[ 0 ] == '\0'))
-	{
+	if (Entry == NULL)
 		return NWN::ResINVALID;
-	}
 
-	return ExtToResType( Ext + 1 );
+	return m_DirectoryEntries[ (size_t) Entry->Index ].Type;
 }
 
 template< typename ResRefT >
@@ -545,9 +766,6 @@ Routine Description:
 	This routine reads an encapsulated file directory entry, returning the name
 	and type of a particular resource.  The enumeration is stable across calls.
 
-	Currently, no files may be opened at the time of this call as the call
-	requires opening a file handle.
-
 Arguments:
 
 	FileIndex - Supplies the index into the logical directory entry to reutrn.
@@ -610,23 +828,32 @@ Environment:
 }
 
 template< typename ResRefT >
-typename ZipFileReader< ResRefT >::ZipArchive
-ZipFileReader< ResRefT >::OpenArchive(
-	__in const std::string & ArchiveName
+bool
+ZipFileReader< ResRefT >::GetEncapsulatedFileMapping(
+	__in FileHandle File,
+	__out HANDLE * BackingFile,
+	__out ULONG64 * BackingFileOffset
 	)
 /*++
 
 Routine Description:
 
-	This routine opens a .zip archive and returns an archive handle for it.
+	This routine returns the backing file and offset of an encapsulated file,
+	so that its contents may be mapped directly.  Only files that are stored
+	(uncompressed) in the archive may be mapped.
 
 Arguments:
 
-	ArchiveName - Supplies the name of the .zip to open.
+	File - Supplies the file handle to inquire about.
+
+	BackingFile - Receives the archive file handle.  The handle remains owned
+	              by the ZipFileReader.
+
+	BackingFileOffset - Receives the offset of the file data in the archive.
 
 Return Value:
 
-	The routine returns an archive handle on success, else NULL on failure.
+	The routine returns true if the file may be mapped, else false.
 
 Environment:
 
@@ -634,31 +861,42 @@ Environment:
 
 --*/
 {
-	zlib_filefunc_def ZIoApis;
+	OpenEntry * Entry;
 
-	x_fill_fopen_filefunc( &ZIoApis );
+	*BackingFile       = INVALID_HANDLE_VALUE;
+	*BackingFileOffset = 0;
 
-	return (ZipArchive) unzOpen2( ArchiveName.c_str( ), &ZIoApis );
+	Entry = LookupOpenEntry( File );
+
+	if ((Entry == NULL) || (Entry->Method != ZIP_METHOD_STORED))
+		return false;
+
+	*BackingFile       = m_File;
+	*BackingFileOffset = Entry->DataOffset;
+
+	return true;
 }
 
 template< typename ResRefT >
 void
-ZipFileReader< ResRefT >::CloseArchive(
-	__in ZipArchive Archive
-	)
+ZipFileReader< ResRefT >::GetDirectoryEntries(
+	__out ResourceIndexCache::EntryVec & Entries
+	) const
 /*++
 
 Routine Description:
 
-	This routine closes an opened .zip archive.
+	This routine returns the directory listing of the archive in a form
+	suitable for caching.  The listing may later be supplied to the cached
+	directory constructor for an unmodified copy of the archive.
 
 Arguments:
 
-	Archive - Supplies the opened archive handle as returned from OpenArchive.
+	Entries - Receives the directory listing.
 
 Return Value:
 
-	None.
+	None.  Raises an std::exception on failure.
 
 Environment:
 
@@ -666,37 +904,41 @@ Environment:
 
 --*/
 {
-	if (m_FileOpened)
+	Entries.resize( m_DirectoryEntries.size( ) );
+
+	for (size_t i = 0; i < m_DirectoryEntries.size( ); i += 1)
 	{
-		unzCloseCurrentFile( (unzFile) Archive );
+		ResourceIndexCache::Entry & Entry = Entries[ i ];
 
-		m_FileOpened = false;
-	}
+		ZeroMemory( &Entry, sizeof( Entry ) );
+		memcpy(
+			&Entry.Name,
+			&m_DirectoryEntries[ i ].Name,
+			min( sizeof( Entry.Name ), sizeof( m_DirectoryEntries[ i ].Name ) ) );
 
-	unzClose( (unzFile) Archive );
+		Entry.Type    = m_DirectoryEntries[ i ].Type;
+		Entry.Locator = m_DirectoryEntries[ i ].CentralDirOffset;
+	}
 }
 
-
 template< typename ResRefT >
 void
-ZipFileReader< ResRefT >::ScanArchive(
-	__in ZipArchive Archive
+ZipFileReader< ResRefT >::OpenArchive(
+	__in const std::string & ArchiveName
 	)
 /*++
 
 Routine Description:
 
-	This routine enumerates all files in a .zip archive, and adds them to the
-	master directory list.
+	This routine opens the .zip archive file for reading.
 
 Arguments:
 
-	Archive - Supplies the .zip archive handle to scaN.
+	ArchiveName - Supplies the name of the .zip to open.
 
 Return Value:
 
-	None.  The routine raises an std::exception on catastrophic failure, such as
-	if there was already an open file handle within the archive.
+	None.  Raises an std::exception on failure.
 
 Environment:
 
@@ -704,66 +946,283 @@ Environment:
 
 --*/
 {
-	char            FileName[ 260 ];
-	int             Error;
-	unz_global_info ZInfo;
-
-	if (m_FileOpened)
-		throw std::runtime_error( "Cannot scan an archive with a file opened." );
-
-	strcpy_s( FileName, "Z:\\" ); // Bogus, for splitpath.
+	LARGE_INTEGER Size;
 
-	Error = unzGoToFirstFile2(
-		(unzFile) Archive,
-		FileName + 3,
-		sizeof( FileName ) - 3 );
-
-	if (Error)
-		throw std::runtime_error( "unzGoToFirstFile failed" );
+	m_File = CreateFileA(
+		ArchiveName.c_str( ),
+		GENERIC_READ,
+		FILE_SHARE_READ | FILE_SHARE_DELETE,
+		NULL,
+		OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS,
+		NULL);
 
-	//
-	// Preallocate the directory entry array based on the count of files in
-	// this archive.
-	//
-	// N.B.  The file count also includes directory-only files, but we do not
-	//       need account for this as we're just reserving raw storage.
-	//
+	if ((m_File != INVALID_HANDLE_VALUE) && (!GetFileSizeEx( m_File, &Size )))
+	{
+		CloseHandle( m_File );
+		m_File = INVALID_HANDLE_VALUE;
+	}
 
-	Error = unzGetGlobalInfo( (unzFile) Archive, &ZInfo );
+	if (m_File == INVALID_HANDLE_VALUE)
+	{
+		try
+		{
+			std::string ErrorStr;
 
-	if (Error)
-		throw std::runtime_error( "unzGetGlobalInfo failed" );
+			ErrorStr  = "Failed to open .zip archive '";
+			ErrorStr += ArchiveName;
+			ErrorStr += "'.";
 
-	//
-	// Max size that we'll prereserve for.
-	//
+			throw std::runtime_error( ErrorStr );
+		}
+		catch (std::bad_alloc)
+		{
+			throw std::runtime_error( "Failed to open .zip archive." );
+		}
+	}
+
+	m_FileSize = (ULONG64) Size.QuadPart;
+}
+
+template< typename ResRefT >
+void
+ZipFileReader< ResRefT >::CloseArchive(
+	)
+/*++
+
+Routine Description:
+
+	This routine closes the .zip archive file, releasing any open entries.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	for (typename OpenEntryMap::iterator it = m_OpenEntries.begin( );
+	     it != m_OpenEntries.end( );
+	     ++it)
+	{
+		FreeOpenEntry( it->second );
+	}
+
+	m_OpenEntries.clear( );
+
+	if (m_File != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle( m_File );
+
+		m_File = INVALID_HANDLE_VALUE;
+	}
+}
+
+template< typename ResRefT >
+void
+ZipFileReader< ResRefT >::LocateCentralDirectory(
+	__out ULONG64 & CentralDirOffset,
+	__out ULONG64 & CentralDirSize,
+	__out ULONG64 & EntryCount
+	)
+/*++
+
+Routine Description:
+
+	This routine locates the end of central directory record of the archive
+	and returns the location of the central directory.
+
+	Data that precedes the archive proper (such as a self-extractor stub) is
+	accounted for by computing the archive bias, which is the difference
+	between where the central directory actually lies and where the end of
+	central directory record claims that it lies.
+
+Arguments:
+
+	CentralDirOffset - Receives the absolute offset of the central directory.
+
+	CentralDirSize - Receives the size of the central directory.
+
+	EntryCount - Receives the count of central directory records.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure, such as if the
+	archive is damaged or is a ZIP64 archive.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	std::vector< unsigned char > Tail;
+	size_t                       TailSize;
+	ULONG64                      TailOffset;
+	const unsigned char        * Eocd;
+	ULONG64                      EocdOffset;
+	ULONG64                      StatedOffset;
+
+	if (m_FileSize < ZIP_EOCD_SIZE)
+		throw std::runtime_error( "File is too small to be a .zip archive." );
+
+	TailSize   = (size_t) min( m_FileSize, (ULONG64) MAX_EOCD_SEARCH );
+	TailOffset = m_FileSize - TailSize;
+
+	Tail.resize( TailSize );
+
+	if (!ReadArchive( TailOffset, &Tail[ 0 ], TailSize ))
+		throw std::runtime_error( "Failed to read .zip end of central directory." );
+
+	//
+	// Search backwards for the end of central directory record.  The record
+	// is accepted only if its comment extends exactly to the end of the file,
+	// which guards against matching the signature within the comment.
+	//
+
+	Eocd = NULL;
+
+	for (size_t i = TailSize - ZIP_EOCD_SIZE + 1; i != 0; i -= 1)
+	{
+		const unsigned char * p = &Tail[ i - 1 ];
+
+		if (GetZipULong( p ) != ZIP_EOCD_SIGNATURE)
+			continue;
+
+		if ((i - 1) + ZIP_EOCD_SIZE + GetZipUShort( p + ZIP_EOCD_COMMENT_LENGTH ) != TailSize)
+			continue;
+
+		Eocd = p;
+		break;
+	}
+
+	if (Eocd == NULL)
+		throw std::runtime_error( "Failed to locate .zip end of central directory." );
+
+	EocdOffset = TailOffset + (Eocd - &Tail[ 0 ]);
+
+	EntryCount     = GetZipUShort( Eocd + ZIP_EOCD_ENTRY_COUNT );
+	CentralDirSize = GetZipULong( Eocd + ZIP_EOCD_CENTRAL_DIR_SIZE );
+	StatedOffset   = GetZipULong( Eocd + ZIP_EOCD_CENTRAL_DIR_OFF );
+
+	if ((EntryCount == 0xFFFF) || (StatedOffset == 0xFFFFFFFF))
+		throw std::runtime_error( "ZIP64 archives are not supported." );
+
+	if ((CentralDirSize > EocdOffset) ||
+	    (StatedOffset > EocdOffset - CentralDirSize))
+	{
+		throw std::runtime_error( "Invalid .zip central directory location." );
+	}
+
+	CentralDirOffset = EocdOffset - CentralDirSize;
+	m_ArchiveBias    = CentralDirOffset - StatedOffset;
+}
+
+template< typename ResRefT >
+void
+ZipFileReader< ResRefT >::ScanArchive(
+	)
+/*++
+
+Routine Description:
+
+	This routine reads the central directory of the archive in a single pass,
+	and adds each file to the master directory list.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.  The routine raises an std::exception on catastrophic failure, such as
+	a damaged central directory.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	std::vector< unsigned char > CentralDir;
+	ULONG64                      CentralDirOffset;
+	ULONG64                      CentralDirSize;
+	ULONG64                      EntryCount;
+	size_t                       Offset;
+	char                         FileName[ 260 ];
+
+	LocateCentralDirectory( CentralDirOffset, CentralDirSize, EntryCount );
+
+	if (CentralDirSize > ULONG_MAX)
+		throw std::runtime_error( "Invalid .zip central directory size." );
+
+	if (CentralDirSize == 0)
+		return;
 
-	if (ZInfo.number_entry > 100 * 1024)
-		ZInfo.number_entry = 100 * 1024;
+	CentralDir.resize( (size_t) CentralDirSize );
 
-	m_DirectoryEntries.reserve( ZInfo.number_entry );
+	if (!ReadArchive( CentralDirOffset, &CentralDir[ 0 ], CentralDir.size( ) ))
+		throw std::runtime_error( "Failed to read .zip central directory." );
 
 	//
-	// Now iterate through each file, retrieving position and name data so that we
-	// may create directory entries as appropriate.
+	// Preallocate the directory entry array based on the count of files in
+	// this archive.
+	//
+	// N.B.  The file count also includes directory-only files, but we do not
+	//       need account for this as we're just reserving raw storage.
+	//
+
+	m_DirectoryEntries.reserve( (size_t) EntryCount );
+
+	strcpy_s( FileName, "Z:\\" ); // Bogus, for splitpath.
+
+	//
+	// Now iterate through each record, retrieving position and name data so
+	// that we may create directory entries as appropriate.
 	//
 
-	do
+	for (Offset = 0; Offset + ZIP_CDIR_SIZE <= CentralDir.size( ); )
 	{
-		DirectoryEntry Entry;
-		size_t         Len;
-		unz_file_pos   FilePos;
-		char           Name[ MAX_PATH ];
-		char           Ext[ 32 ];
+		const unsigned char * Record = &CentralDir[ Offset ];
+		DirectoryEntry        Entry;
+		size_t                RecordSize;
+		size_t                NameLength;
+		size_t                Len;
+		char                  Name[ MAX_PATH ];
+		char                  Ext[ 32 ];
+
+		if (GetZipULong( Record ) != ZIP_CDIR_SIGNATURE)
+			throw std::runtime_error( "Invalid .zip central directory record." );
+
+		NameLength = GetZipUShort( Record + ZIP_CDIR_NAME_LENGTH );
+		RecordSize = ZIP_CDIR_SIZE +
+		             NameLength +
+		             GetZipUShort( Record + ZIP_CDIR_EXTRA_LENGTH ) +
+		             GetZipUShort( Record + ZIP_CDIR_COMMENT_LENGTH );
+
+		if (RecordSize > CentralDir.size( ) - Offset)
+			throw std::runtime_error( "Truncated .zip central directory record." );
+
+		Offset += RecordSize;
 
 		//
 		// Break the name up into its component forms and discern the resource type
 		// from the file extension.
 		//
 
-		FileName[ sizeof( FileName ) - sizeof( FileName[ 0 ] ) ] = '\0';
+		NameLength = min( NameLength, sizeof( FileName ) - 4 );
 
-		if (!FileName[ 0 ])
+		memcpy( FileName + 3, Record + ZIP_CDIR_SIZE, NameLength );
+		FileName[ 3 + NameLength ] = '\0';
+
+		if (!FileName[ 3 ])
 			continue;
 
 		_strlwr( FileName );
@@ -807,28 +1266,11 @@ Environment:
 		ZeroMemory( &Entry.Name, sizeof( Entry.Name ) );
 		memcpy( &Entry.Name, Name, min( sizeof( Entry.Name ), Len ) );
 
-		Entry.Type = ExtToResType( Ext + 1 );
-
-		//
-		// Determine the offset in the zip file to use as a file handle.
-		//
-
-		Error = unzGetFilePos( (unzFile) Archive, &FilePos );
-
-		if (Error)
-			throw std::runtime_error( "unzGetFilePos failed" );
-
-		Entry.FileHandleToReturn = ((((ULONG64) FilePos.pos_in_zip_directory)) |
-		                            (((ULONG64) FilePos.num_of_file) >> 32)) + 1;
+		Entry.Type             = ExtToResType( Ext + 1 );
+		Entry.CentralDirOffset = CentralDirOffset + (Record - &CentralDir[ 0 ]);
 
 		m_DirectoryEntries.push_back( Entry );
-	} while ((Error = unzGoToNextFile2(
-		(unzFile) Archive,
-		FileName + 3,
-		sizeof( FileName ) - 3 )) == 0) ;
-
-	if (Error != UNZ_END_OF_LIST_OF_FILE)
-		throw std::runtime_error( "unzGoToNextFile failed" );
+	}
 }
 
 template< typename ResRefT >
@@ -877,437 +1319,460 @@ Environment:
 	return NULL;
 }
 
-template ZipFileReader< NWN::ResRef32 >;
+template< typename ResRefT >
+typename ZipFileReader< ResRefT >::OpenEntry *
+ZipFileReader< ResRefT >::LookupOpenEntry(
+	__in FileHandle File
+	)
+/*++
 
-#ifdef USE_CRTIO_HACK
-#define _fread_nolock fread
-#define _fwrite_nolock fwrite
-#define _ftell_nolock ftell
-#define _fseek_nolock fseek
+Routine Description:
 
-#if 0
-size_t __cdecl crtfread_nolock(
-    void *buffer,
-    size_t elementSize,
-    size_t count,
-    FILE *stream);
+	This routine looks up the state of an open entry by its file handle.
 
-size_t __cdecl crtfwrite_nolock (
-        const void *buffer,
-        size_t size,
-        size_t num,
-        FILE *stream);
+Arguments:
 
-long __cdecl crtftell_nolock (
+	File - Supplies the file handle to look up.
 
+Return Value:
 
-        FILE *str
-        );
+	The routine returns the open entry on success, else NULL if the file
+	handle was not valid.
 
-int __cdecl crtfseek_nolock (
+Environment:
 
+	User mode.
 
-        FILE *str,
-        long offset,
-        int whence
-        );
-#endif
+--*/
+{
+	swutil::ScopedLock Lock( m_OpenEntryLock );
 
-#endif
+	typename OpenEntryMap::const_iterator it = m_OpenEntries.find( File );
 
-//
-// Define file I/O wrappers for the unzip library.
-//
+	if (it == m_OpenEntries.end( ))
+		return NULL;
 
-static voidpf ZCALLBACK x_fopen_file_func OF((
-   voidpf opaque,
-   const char* filename,
-   int mode));
+	return it->second;
+}
 
-static uLong ZCALLBACK x_fread_file_func OF((
-   voidpf opaque,
-   voidpf stream,
-   void* buf,
-   uLong size));
+template< typename ResRefT >
+void
+ZipFileReader< ResRefT >::FreeOpenEntry(
+	__in OpenEntry * Entry
+	)
+/*++
 
-static uLong ZCALLBACK x_fwrite_file_func OF((
-   voidpf opaque,
-   voidpf stream,
-   const void* buf,
-   uLong size));
+Routine Description:
 
-static long ZCALLBACK x_ftell_file_func OF((
-   voidpf opaque,
-   voidpf stream));
+	This routine releases the state of an open entry, including its inflate
+	state and any seek points.
 
-static long ZCALLBACK x_fseek_file_func OF((
-   voidpf opaque,
-   voidpf stream,
-   uLong offset,
-   int origin));
+Arguments:
 
-static int ZCALLBACK x_fclose_file_func OF((
-   voidpf opaque,
-   voidpf stream));
+	Entry - Supplies the open entry to release.
 
-static int ZCALLBACK x_ferror_file_func OF((
-   voidpf opaque,
-   voidpf stream));
+Return Value:
 
-#define BUFSIZE 1024
+	None.
 
-//
-// On 64-bit builds, use mapped file reader for the major performance gains
-// from avoiding all of the tiny read calls.  On 32-bit, we're stuck with the
-// CRT-like I/O calls due to address space pressure.
-//
+Environment:
 
-#ifdef _WIN64
-#define ZLIBIO_USE_MAPPED_FILE_READER 1
-#else
-#define ZLIBIO_USE_MAPPED_FILE_READER 0
-#endif
+	User mode.
 
-struct FILE_CTX
-{
-    FILE          * stream;
-    size_t          offset;
-#if ZLIBIO_USE_MAPPED_FILE_READER
-	FileWrapper   * MappedFileReader;
-	int             MFRError;
-	bool            MFRAtEof;
-	uLong           MFRFileSize;
-#endif
-};
-
-#define _XSTRM(o) ((FILE_CTX*)o)->stream
-#define _XOFFS(o) ((FILE_CTX*)o)->offset
-
-static voidpf ZCALLBACK x_fopen_file_func(
-   voidpf opaque,
-   const char* filename,
-   int mode)
+--*/
 {
-    FILE* file = NULL;
-    FILE_CTX * ctx = NULL;
-    const char* mode_fopen = NULL;
-    UNREFERENCED_PARAMETER(opaque);
-    if ((mode & ZLIB_FILEFUNC_MODE_READWRITEFILTER)==ZLIB_FILEFUNC_MODE_READ)
-        mode_fopen = "rbSN";
-    else
-    if (mode & ZLIB_FILEFUNC_MODE_EXISTING)
-        mode_fopen = "r+bSN";
-    else
-    if (mode & ZLIB_FILEFUNC_MODE_CREATE)
-        mode_fopen = "wbSN";
-
-#if ZLIBIO_USE_MAPPED_FILE_READER
-	if ((mode_fopen != NULL) && (!(mode & ZLIB_FILEFUNC_MODE_CREATE)))
+	for (SeekPointVec::iterator it = Entry->SeekPoints.begin( );
+	     it != Entry->SeekPoints.end( );
+	     ++it)
 	{
-		HANDLE hf;
+		inflateEnd( it->Stream );
+		delete it->Stream;
+	}
 
-		hf = CreateFile(
-			filename,
-			GENERIC_READ,
-			FILE_SHARE_READ,
-			NULL,
-			OPEN_EXISTING,
-			FILE_ATTRIBUTE_NORMAL,
-			NULL);
+	if (Entry->Stream != NULL)
+	{
+		inflateEnd( Entry->Stream );
+		delete Entry->Stream;
+	}
 
-		if (hf != INVALID_HANDLE_VALUE)
-		{
-			ctx = (FILE_CTX *) malloc( sizeof( FILE_CTX ) );
+	delete Entry;
+}
 
-			try
-			{
-				ctx->MappedFileReader = new FileWrapper( INVALID_HANDLE_VALUE );
-				ctx->MappedFileReader->SetFileHandle( hf, true );
-				ctx->stream = (FILE *) hf;
-				ctx->offset = 0;
-				ctx->MFRError = 0;
-				ctx->MFRAtEof = false;
-				ctx->MFRFileSize = (uLong) ctx->MappedFileReader->GetFileSize( );
-				return ctx;
-			}
-			catch (std::exception)
-			{
-				free( ctx );
-				ctx = NULL;
-				CloseHandle( hf );
-			}
-		}
-	}
-#endif
+template< typename ResRefT >
+bool
+ZipFileReader< ResRefT >::SeekOpenEntry(
+	__inout OpenEntry * Entry,
+	__in ULONG64 Offset
+	)
+/*++
 
-    if ((filename!=NULL) && (mode_fopen != NULL))
-        file = fopen(filename, mode_fopen);
+Routine Description:
 
-    if (file != NULL)
-        setvbuf(file, NULL, _IOFBF, BUFSIZE);
-	else
-		return NULL;
+	This routine positions the inflate state of an open entry at a given
+	uncompressed offset.
 
-    ctx = (FILE_CTX *)malloc(sizeof(FILE_CTX));
-    if (ctx == NULL)
-	{
-        fclose(file);
-        return NULL;
-	}
-    ctx->stream = file;
-    ctx->offset = 0;
-#if ZLIBIO_USE_MAPPED_FILE_READER
-	ctx->MappedFileReader = NULL;
-#endif
-    return ctx;
-}
+	If the current position is at or before the desired offset and there is no
+	closer seek point, inflation simply continues forward.  Otherwise, the
+	inflate state is restored from the closest preceding seek point (or reset
+	to the start of the file) and then inflated forward.
+
+Arguments:
+
+	Entry - Supplies the open entry to position.
+
+	Offset - Supplies the desired uncompressed offset.
+
+Return Value:
+
+	The routine returns a Boolean value indicating true on success, else false
+	on failure.
 
+Environment:
+
+	User mode.
 
-static uLong ZCALLBACK x_fread_file_func(
-   voidpf opaque,
-   voidpf stream,
-   void* buf,
-   uLong size)
+--*/
 {
-    uLong ret;
-	FILE_CTX *ctx;
-    UNREFERENCED_PARAMETER(opaque);
-	ctx = (FILE_CTX *)stream;
-#if ZLIBIO_USE_MAPPED_FILE_READER
-	if (ctx->MappedFileReader != NULL)
+	const SeekPoint * Best;
+
+	//
+	// Create the inflate stream on first use.
+	//
+
+	if (Entry->Stream == NULL)
 	{
-		if (ctx->MFRAtEof)
-			return 0;
+		z_stream * Stream;
 
 		try
 		{
-			ctx->MappedFileReader->ReadFile(
-				buf,
-				size,
-				"zlib minizip file read" );
+			Stream = new z_stream;
 		}
-		catch (std::exception)
+		catch (std::bad_alloc)
 		{
-			((FILE_CTX *)stream)->MFRError = 1;
-			return 0;
+			return false;
 		}
-		return (uLong) size;
+
+		ZeroMemory( Stream, sizeof( *Stream ) );
+
+		if (inflateInit2( Stream, -MAX_WBITS ) != Z_OK)
+		{
+			delete Stream;
+			return false;
+		}
+
+		Entry->Stream       = Stream;
+		Entry->StreamOffset = 0;
+		Entry->InputOffset  = 0;
 	}
-#endif
 
-    ret = (uLong)_fread_nolock(buf, 1, (size_t)size, _XSTRM(stream));
-    _XOFFS(stream) += ret;
-    return ret;
-}
+	if (Entry->StreamOffset == Offset)
+		return true;
 
+	//
+	// Find the closest seek point at or before the desired offset.
+	//
 
-static uLong ZCALLBACK x_fwrite_file_func(
-   voidpf opaque,
-   voidpf stream,
-   const void* buf,
-   uLong size)
-{
-    uLong ret;
-    UNREFERENCED_PARAMETER(opaque);
-#if ZLIBIO_USE_MAPPED_FILE_READER
-	if (((FILE_CTX *)stream)->MappedFileReader != NULL)
-		return 0;
-#endif
-    ret = (uLong)_fwrite_nolock(buf, 1, (size_t)size, _XSTRM(stream));
-    _XOFFS(stream) += ret;
-    return ret;
-}
+	Best = NULL;
 
-inline static long ZCALLBACK x_ftell_file_func(
-   voidpf opaque,
-   voidpf stream)
-{
-    long ret;
-	FILE_CTX *ctx;
-    UNREFERENCED_PARAMETER(opaque);
-	ctx = (FILE_CTX *)stream;
-#if ZLIBIO_USE_MAPPED_FILE_READER
-	if (ctx->MappedFileReader != NULL)
+	for (SeekPointVec::const_iterator it = Entry->SeekPoints.begin( );
+	     it != Entry->SeekPoints.end( );
+	     ++it)
+	{
+		if (it->OutOffset > Offset)
+			break;
+
+		Best = &*it;
+	}
+
+	if (Entry->StreamOffset > Offset)
+	{
+		//
+		// A backwards seek requires the inflate state to be rewound, so start
+		// recording seek points to make subsequent seeks cheaper.
+		//
+
+		Entry->RandomAccess = true;
+
+		if (Best == NULL)
+		{
+			if (inflateReset( Entry->Stream ) != Z_OK)
+				return false;
+
+			Entry->Stream->avail_in = 0;
+			Entry->StreamOffset     = 0;
+			Entry->InputOffset      = 0;
+		}
+	}
+	else if ((Best != NULL) && (Best->OutOffset <= Entry->StreamOffset))
+	{
+		Best = NULL;
+	}
+
+	if (Best != NULL)
 	{
-		if (ctx->MFRAtEof)
-			return (long)ctx->MFRFileSize;
-		else
-			return (long)ctx->MappedFileReader->GetFilePointer();
+		inflateEnd( Entry->Stream );
+
+		if (inflateCopy( Entry->Stream, Best->Stream ) != Z_OK)
+		{
+			delete Entry->Stream;
+			Entry->Stream = NULL;
+			return false;
+		}
+
+		Entry->Stream->avail_in = 0;
+		Entry->StreamOffset     = Best->OutOffset;
+		Entry->InputOffset      = Entry->Stream->total_in;
 	}
-#endif
-//  ret = _ftell_nolock(_XSTRM(stream));
-    ret = (long)_XOFFS(stream);
-    return ret;
+
+	//
+	// Inflate forward to the desired offset, discarding the output.
+	//
+
+	return InflateOpenEntry( Entry, NULL, (size_t) (Offset - Entry->StreamOffset) );
 }
 
-static long ZCALLBACK x_fseek_file_func(
-   voidpf opaque,
-   voidpf stream,
-   uLong offset,
-   int origin)
+template< typename ResRefT >
+bool
+ZipFileReader< ResRefT >::InflateOpenEntry(
+	__inout OpenEntry * Entry,
+	__out_bcount_opt( Length ) unsigned char * Buffer,
+	__in size_t Length
+	)
+/*++
+
+Routine Description:
+
+	This routine inflates data from the current position of an open entry,
+	advancing the position.  If the entry is being randomly accessed, then a
+	seek point is recorded at each seek point interval that is passed.
+
+Arguments:
+
+	Entry - Supplies the open entry to inflate.
+
+	Buffer - Optionally supplies the buffer to receive the data.  If NULL, the
+	         data is discarded.
+
+	Length - Supplies the count of bytes to inflate.
+
+Return Value:
+
+	The routine returns a Boolean value indicating true on success, else false
+	on failure (such as corrupted compressed data).
+
+Environment:
+
+	User mode.
+
+--*/
 {
-    long curpos;
-    uLong delta;
-    int tryread;
-    int fseek_origin=0;
-    long ret;
-    UNREFERENCED_PARAMETER(opaque);
-#if ZLIBIO_USE_MAPPED_FILE_READER
-	if (((FILE_CTX*)stream)->MappedFileReader != NULL)
+	unsigned char   Discard[ 4096 ];
+	z_stream      * Stream;
+
+	Stream = Entry->Stream;
+
+	if (Stream == NULL)
+		return false;
+
+	while (Length != 0)
 	{
-		FILE_CTX *ctx = (FILE_CTX*)stream;
-		FileWrapper *wrapper = ctx->MappedFileReader;
-		long newoffs;
+		size_t Chunk;
+		size_t Produced;
+		int    Status;
 
-		try
+		//
+		// Refill the input buffer from the archive as necessary.
+		//
+
+		if (Stream->avail_in == 0)
 		{
-			switch (origin)
+			size_t InputLength;
+
+			InputLength = (size_t) min(
+				(ULONG64) INPUT_CHUNK_SIZE,
+				Entry->CompressedSize - Entry->InputOffset);
+
+			if (InputLength == 0)
+				return false;
+
+			try
 			{
-			case ZLIB_FILEFUNC_SEEK_CUR:
-				newoffs = x_ftell_file_func(opaque, stream) + (long)offset;
-				break;
-			case ZLIB_FILEFUNC_SEEK_END:
-				newoffs = (long)ctx->MFRFileSize + (long)offset;
-				break;
-			case ZLIB_FILEFUNC_SEEK_SET:
-				newoffs = (long)offset;
-				break;
-			default:
-				return -1;
+				Entry->InputBuffer.resize( INPUT_CHUNK_SIZE );
 			}
-
-			if (newoffs == (long)ctx->MFRFileSize)
+			catch (std::bad_alloc)
 			{
-				ctx->MFRAtEof = true;
+				return false;
 			}
-			else
+
+			if (!ReadArchive(
+				Entry->DataOffset + Entry->InputOffset,
+				&Entry->InputBuffer[ 0 ],
+				InputLength))
 			{
-				ctx->MFRAtEof = false;
-				wrapper->SeekOffset((ULONGLONG)newoffs, "zlib minizip file seek");
+				return false;
 			}
 
-			return 0;
+			Entry->InputOffset += InputLength;
+
+			Stream->next_in  = &Entry->InputBuffer[ 0 ];
+			Stream->avail_in = (uInt) InputLength;
+		}
+
+		//
+		// Bound the output so that we stop on each seek point boundary if we
+		// are recording seek points.
+		//
+
+		Chunk = Length;
+
+		if (Buffer == NULL)
+			Chunk = min( Chunk, sizeof( Discard ) );
+
+		if (Entry->RandomAccess)
+		{
+			ULONG64 NextSeekPoint;
+
+			NextSeekPoint = (Entry->StreamOffset / SEEK_POINT_INTERVAL + 1) * SEEK_POINT_INTERVAL;
+
+			Chunk = (size_t) min( (ULONG64) Chunk, NextSeekPoint - Entry->StreamOffset );
 		}
-		catch (std::exception)
+
+		Stream->next_out  = (Buffer != NULL) ? Buffer : Discard;
+		Stream->avail_out = (uInt) Chunk;
+
+		Status = inflate( Stream, Z_NO_FLUSH );
+
+		Produced = Chunk - Stream->avail_out;
+
+		if (Buffer != NULL)
+			Buffer += Produced;
+
+		Length              -= Produced;
+		Entry->StreamOffset += Produced;
+
+		if (Status == Z_STREAM_END)
 		{
-			((FILE_CTX *)stream)->MFRError = 1;
-			return -1;
+			if (Length != 0)
+				return false;
+
+			break;
+		}
+
+		if ((Status != Z_OK) && (Status != Z_BUF_ERROR))
+			return false;
+
+		if ((Produced == 0) && (Stream->avail_in != 0))
+			return false;
+
+		//
+		// Record a seek point if we have just reached a new boundary.
+		//
+
+		if ((Entry->RandomAccess) &&
+		    (Entry->StreamOffset % SEEK_POINT_INTERVAL == 0) &&
+		    ((Entry->SeekPoints.empty( )) ||
+		     (Entry->SeekPoints.back( ).OutOffset < Entry->StreamOffset)))
+		{
+			SeekPoint Point;
+
+			Point.OutOffset = Entry->StreamOffset;
+
+			try
+			{
+				Point.Stream = new z_stream;
+			}
+			catch (std::bad_alloc)
+			{
+				continue;
+			}
+
+			if (inflateCopy( Point.Stream, Stream ) != Z_OK)
+			{
+				delete Point.Stream;
+				continue;
+			}
+
+			try
+			{
+				Entry->SeekPoints.push_back( Point );
+			}
+			catch (std::bad_alloc)
+			{
+				inflateEnd( Point.Stream );
+				delete Point.Stream;
+			}
 		}
 	}
-#endif
-    switch (origin)
-    {
-    case ZLIB_FILEFUNC_SEEK_CUR :
-        fseek_origin = SEEK_CUR;
-        break;
-    case ZLIB_FILEFUNC_SEEK_END :
-        fseek_origin = SEEK_END;
-        break;
-    case ZLIB_FILEFUNC_SEEK_SET :
-        fseek_origin = SEEK_SET;
-        break;
-    default: return -1;
-    }
-    ret = 0;
-    tryread = 0;
-    delta = 0; // Compiler satisfaction
-    if ((fseek_origin == SEEK_CUR))
-    {
-        if (offset == 0) return 0;
-        if (offset < BUFSIZE)
-        {
-            curpos = (long)_XOFFS(stream);
-            delta = (uLong) offset;
-            tryread = 1;
-        }
-    }
-    else if ((fseek_origin == SEEK_SET))
-    {
-        curpos = (long)_XOFFS(stream);
-        if (offset == (uLong) curpos) return 0;
-        if (offset > (uLong) curpos)
-        {
-            delta = offset - (uLong) curpos;
-            if (delta <= BUFSIZE)
-                tryread = 1;
-//			else
-//                WriteText("Delta too large...%d\n", delta);
-        }// else WriteText("Seek back %d [%lu->%lu]\n", offset - curpos, curpos, offset);
-    }
-    if (tryread)
-    {
-        static char dummy[BUFSIZE];
-        size_t d;
-//        WriteText("Quick seek %lu (%lu)\n", offset, (size_t)delta);
-        d = _fread_nolock(dummy, 1, (size_t)delta, _XSTRM(stream));
-        _XOFFS(stream) += d;
-        if (d == delta) return 0;
-  //      WriteText("Quick seek failed\n", offset, fseek_origin);
-    }
-//	WriteText("Slow seek %d %d\n", offset, fseek_origin);
-    _fseek_nolock(_XSTRM(stream), offset, fseek_origin);
-    _XOFFS(stream) = _ftell_nolock(_XSTRM(stream));
-    return ret;
+
+	return true;
 }
 
-static int ZCALLBACK x_fclose_file_func(
-   voidpf opaque,
-   voidpf stream)
+template< typename ResRefT >
+bool
+ZipFileReader< ResRefT >::ReadArchive(
+	__in ULONG64 Offset,
+	__out_bcount( Length ) void * Buffer,
+	__in size_t Length
+	)
+/*++
+
+Routine Description:
+
+	This routine reads raw bytes from the archive file at a given offset.  The
+	read is positional and does not depend on the file pointer, so the routine
+	may be called concurrently from multiple threads.
+
+Arguments:
+
+	Offset - Supplies the offset of the data to read.
+
+	Buffer - Receives the data.
+
+	Length - Supplies the count of bytes to read.
+
+Return Value:
+
+	The routine returns a Boolean value indicating true if all of the
+	requested bytes were read, else false.
+
+Environment:
+
+	User mode.
+
+--*/
 {
-    int ret;
-	FILE_CTX *ctx;
-    UNREFERENCED_PARAMETER(opaque);
-	ctx = (FILE_CTX*)stream;
-	
-#if ZLIBIO_USE_MAPPED_FILE_READER
-	if (ctx->MappedFileReader == NULL)
-	{
-#endif
-		ret = fclose(_XSTRM(stream));
-#if ZLIBIO_USE_MAPPED_FILE_READER
-	}
-	else
+	unsigned char * p;
+
+	if ((Offset > m_FileSize) || (Length > m_FileSize - Offset))
+		return false;
+
+	p = (unsigned char *) Buffer;
+
+	while (Length != 0)
 	{
-		delete ctx->MappedFileReader;
-		CloseHandle( (HANDLE) ctx->stream );
-		ret = 0;
-	}
-#endif
+		OVERLAPPED Overlapped;
+		DWORD      Request;
+		DWORD      Transferred;
 
-    free((FILE_CTX*)stream);
-    return ret;
-}
+		ZeroMemory( &Overlapped, sizeof( Overlapped ) );
 
-static int ZCALLBACK x_ferror_file_func(
-   voidpf opaque,
-   voidpf stream)
-{
-    int ret;
-	FILE_CTX *ctx;
-    UNREFERENCED_PARAMETER(opaque);
-	ctx = (FILE_CTX*)stream;
-
-#if ZLIBIO_USE_MAPPED_FILE_READER
-	if (ctx->MappedFileReader == NULL)
-#endif
-		ret = ferror(_XSTRM(stream));
-#if ZLIBIO_USE_MAPPED_FILE_READER
-	else
-		ret = ctx->MFRError;
-#endif
+		Overlapped.Offset     = (DWORD) (Offset & 0xFFFFFFFF);
+		Overlapped.OffsetHigh = (DWORD) (Offset >> 32);
 
-    return ret;
-}
+		Request = (DWORD) min( Length, (size_t) 0x10000000 );
 
-static void x_fill_fopen_filefunc(
-  zlib_filefunc_def* pzlib_filefunc_def)
-{
-    pzlib_filefunc_def->zopen_file = x_fopen_file_func;
-    pzlib_filefunc_def->zread_file = x_fread_file_func;
-    pzlib_filefunc_def->zwrite_file = x_fwrite_file_func;
-    pzlib_filefunc_def->ztell_file = x_ftell_file_func;
-    pzlib_filefunc_def->zseek_file = x_fseek_file_func;
-    pzlib_filefunc_def->zclose_file = x_fclose_file_func;
-    pzlib_filefunc_def->zerror_file = x_ferror_file_func;
-    pzlib_filefunc_def->opaque = NULL;
+		if (!::ReadFile( m_File, p, Request, &Transferred, &Overlapped ))
+			return false;
+
+		if (Transferred == 0)
+			return false;
+
+		p      += Transferred;
+		Offset += Transferred;
+		Length -= Transferred;
+	}
+
+	return true;
 }
+
+template ZipFileReader< NWN::ResRef32 >;
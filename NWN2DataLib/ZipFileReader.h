@@ -22,9 +22,17 @@ Abstract:
 #endif
 
 #include "ResourceAccessor.h"
+#include "ResourceIndexCache.h"
 
+struct z_stream_s;
+
+//
+// Define the zip file reader object, used to access .zip archives.
 //
-// Define the directory file reader object, used to access directory files.
+// The central directory is parsed once, when the archive is opened.  Any
+// number of entries may be open at once, each with its own inflate state, and
+// reads may be issued at arbitrary offsets.  Distinct file handles may be used
+// concurrently from multiple threads.
 //
 
 template< typename ResRefT >
@@ -41,6 +49,19 @@ public:
 		__in const std::string & ArchiveName
 		);
 
+	//
+	// Constructor, used when the directory listing of the archive was
+	// previously retrieved via GetDirectoryEntries and has been cached.  The
+	// archive is not rescanned.  Raises an std::exception on catastrophic
+	// failure.
+	//
+
+	ZipFileReader(
+		__in const std::string & ArchiveName,
+		__in_ecount( EntryCount ) const ResourceIndexCache::Entry * Entries,
+		__in size_t EntryCount
+		);
+
 	//
 	// Destructor.
 	//
@@ -95,6 +116,18 @@ public:
 		__out_bcount( BytesToRead ) void * Buffer
 		);
 
+	//
+	// Read a batch of ranges of encapsulated files.  The reads are issued in
+	// archive order, so that each deflated entry is inflated front to back.
+	//
+
+	virtual
+	bool
+	ReadEncapsulatedFiles(
+		__inout_ecount( Count ) ReadRequest * Requests,
+		__in size_t Count
+		);
+
 	//
 	// Return the size of a file.
 	//
@@ -148,13 +181,40 @@ public:
 		__out std::string & AccessorName
 		);
 
+	//
+	// Return the backing file and offset of an encapsulated file, if it is
+	// stored uncompressed in the archive.
+	//
+
+	virtual
+	bool
+	GetEncapsulatedFileMapping(
+		__in FileHandle File,
+		__out HANDLE * BackingFile,
+		__out ULONG64 * BackingFileOffset
+		);
+
+	//
+	// Retrieve the directory listing of the archive in a form suitable for
+	// caching.  Raises an std::exception on failure.
+	//
+
+	void
+	GetDirectoryEntries(
+		__out ResourceIndexCache::EntryVec & Entries
+		) const;
+
 private:
 
-	typedef void * ZipArchive;
+	//
+	// Define the directory entry format.  The locator is the absolute offset
+	// of the entry's central directory record; the remaining details of the
+	// entry are only read from the central directory when it is opened.
+	//
 
 	struct DirectoryEntry
 	{
-		FileHandle  FileHandleToReturn;
+		ULONG64     CentralDirOffset;
 		ResRefT     Name;
 		ResType     Type;
 	};
@@ -162,30 +222,143 @@ private:
 	typedef std::vector< DirectoryEntry > DirectoryEntryVec;
 
 	//
-	// Open a new zip archive.
+	// Define a seek point, which is a snapshot of the inflate state of an
+	// open entry at a given uncompressed offset.
+	//
+
+	struct SeekPoint
+	{
+		ULONG64      OutOffset;
+		z_stream_s * Stream;
+	};
+
+	typedef std::vector< SeekPoint > SeekPointVec;
+
+	//
+	// Define the state of an open entry.  Each open entry has its own inflate
+	// state, so any number of entries may be open and read concurrently.
+	//
+
+	struct OpenEntry
+	{
+		FileId                       Index;
+		unsigned short               Method;
+		ULONG64                      DataOffset;
+		ULONG64                      CompressedSize;
+		ULONG64                      UncompressedSize;
+
+		//
+		// Inflate state (deflated entries only).  The stream is created on
+		// first read, and is positioned at StreamOffset in the uncompressed
+		// data, having consumed InputOffset bytes of compressed data.
+		//
+
+		z_stream_s                 * Stream;
+		ULONG64                      StreamOffset;
+		ULONG64                      InputOffset;
+		std::vector< unsigned char > InputBuffer;
+
+		//
+		// Seek points are only recorded once a backwards seek has been seen,
+		// as purely sequential readers have no use for them.
+		//
+
+		bool                         RandomAccess;
+		SeekPointVec                 SeekPoints;
+	};
+
+	typedef std::map< FileHandle, OpenEntry * > OpenEntryMap;
+
+	//
+	// Define the archive position of a batched read request, used to order
+	// the requests of a ReadEncapsulatedFiles call.
 	//
 
-	ZipArchive
+	struct ReadOrder
+	{
+		ULONG64 DataOffset;
+		size_t  Offset;
+		size_t  Request;
+	};
+
+	struct ReadOrderLess
+	{
+		inline
+		bool
+		operator()(
+			__in const ReadOrder & left,
+			__in const ReadOrder & right
+			) const
+		{
+			if (left.DataOffset != right.DataOffset)
+				return left.DataOffset < right.DataOffset;
+
+			return left.Offset < right.Offset;
+		}
+	};
+
+	typedef std::vector< ReadOrder > ReadOrderVec;
+
+	enum
+	{
+		//
+		// Uncompressed distance between seek points.
+		//
+
+		SEEK_POINT_INTERVAL = 256 * 1024,
+
+		//
+		// Compressed data read size.
+		//
+
+		INPUT_CHUNK_SIZE    = 64 * 1024,
+
+		//
+		// Maximum distance from the end of the archive at which the end of
+		// central directory record may be found (the record plus a maximal
+		// archive comment).
+		//
+
+		MAX_EOCD_SEARCH     = 22 + 0xFFFF,
+
+		LAST_ZIP_CONSTANT
+	};
+
+	//
+	// Open the archive file.  Raises an std::exception on failure.
+	//
+
+	void
 	OpenArchive(
 		__in const std::string & ArchiveName
 		);
 
 	//
-	// Close an opened archive.
+	// Close the archive file and all open entries.
 	//
 
 	void
 	CloseArchive(
-		__in ZipArchive Archive
 		);
 
 	//
-	// Scan directories to create directory file entries.
+	// Locate the central directory of the archive.  Raises an std::exception
+	// on failure.
+	//
+
+	void
+	LocateCentralDirectory(
+		__out ULONG64 & CentralDirOffset,
+		__out ULONG64 & CentralDirSize,
+		__out ULONG64 & EntryCount
+		);
+
+	//
+	// Scan the central directory to create directory file entries.
 	//
 
 	void
 	ScanArchive(
-		__in ZipArchive Archive
 		);
 
 	//
@@ -198,12 +371,75 @@ private:
 		__in ResType Type
 		);
 
-	DirectoryEntryVec m_DirectoryEntries;
-	ZipArchive        m_Archive;
-	bool              m_FileOpened;     // Is m_OpenFileHandle valid?
-	FileHandle        m_OpenFileHandle; // Currently open file handle
-	unsigned __int64  m_CurrentOffset;  // Offset into currently opened file
-	std::string       m_FileName;
+	//
+	// Look up the state of an open entry by file handle.
+	//
+
+	OpenEntry *
+	LookupOpenEntry(
+		__in FileHandle File
+		);
+
+	//
+	// Release the state of an open entry.
+	//
+
+	static
+	void
+	FreeOpenEntry(
+		__in OpenEntry * Entry
+		);
+
+	//
+	// Position the inflate state of an open entry at a given uncompressed
+	// offset, using the closest preceding seek point.
+	//
+
+	bool
+	SeekOpenEntry(
+		__inout OpenEntry * Entry,
+		__in ULONG64 Offset
+		);
+
+	//
+	// Inflate data from the current position of an open entry.  If Buffer is
+	// NULL then the data is discarded.
+	//
+
+	bool
+	InflateOpenEntry(
+		__inout OpenEntry * Entry,
+		__out_bcount_opt( Length ) unsigned char * Buffer,
+		__in size_t Length
+		);
+
+	//
+	// Read raw bytes from the archive file at a given offset.  The routine may
+	// be called concurrently from multiple threads.
+	//
+
+	bool
+	ReadArchive(
+		__in ULONG64 Offset,
+		__out_bcount( Length ) void * Buffer,
+		__in size_t Length
+		);
+
+	//
+	// Define the directory, the archive file, and the open entry table.  The
+	// open entry table (and the next file handle value) is guarded by the
+	// open entry lock.  An individual open entry must only be used by one
+	// thread at a time.
+	//
+
+	DirectoryEntryVec        m_DirectoryEntries;
+	HANDLE                   m_File;
+	ULONG64                  m_FileSize;
+	ULONG64                  m_ArchiveBias;    // Offset of archive in file
+	OpenEntryMap             m_OpenEntries;
+	FileHandle               m_NextFileHandle;
+	swutil::CriticalSection  m_OpenEntryLock;
+	std::string              m_FileName;
 
 };
 
@@ -0,0 +1,4159 @@
+/*++
+
+Copyright (c) Ken Johnson (Skywing). All rights reserved.
+
+Module Name:
+
+	NWScriptNativeCodeGenerator.cpp
+
+Abstract:
+
+	This module houses the native code generator, which lowers the
+	NWScriptAnalyzer IR of a script program directly to x86-64 machine code.
+
+	Each IR subroutine is lowered one control flow at a time.  Integer, object
+	and float locals are assigned registers by a linear scan allocator run over
+	the live intervals of the subroutine; all other variables live in memory.
+
+--*/
+
+#include "Precomp.h"
+#include "../NWNScriptLib/NWScriptInternal.h"
+#include "NWScriptNativeCodeGenerator.h"
+
+//
+// Define the registers used to pass arguments to runtime support routines,
+// and the callee saved registers that may be allocated to variables.
+//
+// N.B.  R15 (the execution context) and RBP (the frame pointer) are never
+//       allocated.  RAX, RCX, RDX, R8-R11 and XMM0-XMM3 are scratch registers
+//       used by instruction lowering.
+//
+
+const X64Assembler::GPR NWScriptNativeCodeGenerator::ArgumentRegisters[ 4 ] =
+{
+	X64Assembler::RCX,
+	X64Assembler::RDX,
+	X64Assembler::R8,
+	X64Assembler::R9
+};
+
+const X64Assembler::GPR NWScriptNativeCodeGenerator::GprPool[ ] =
+{
+	X64Assembler::RBX,
+	X64Assembler::RSI,
+	X64Assembler::RDI,
+	X64Assembler::R12,
+	X64Assembler::R13,
+	X64Assembler::R14
+};
+
+const X64Assembler::XMM NWScriptNativeCodeGenerator::XmmPool[ ] =
+{
+	X64Assembler::XMM6,
+	X64Assembler::XMM7,
+	X64Assembler::XMM8,
+	X64Assembler::XMM9,
+	X64Assembler::XMM10,
+	X64Assembler::XMM11,
+	X64Assembler::XMM12,
+	X64Assembler::XMM13
+};
+
+const size_t NWScriptNativeCodeGenerator::GprPoolSize = sizeof( GprPool ) / sizeof( GprPool[ 0 ] );
+const size_t NWScriptNativeCodeGenerator::XmmPoolSize = sizeof( XmmPool ) / sizeof( XmmPool[ 0 ] );
+
+NWScriptNativeCodeGenerator::NWScriptNativeCodeGenerator(
+	__in_opt IDebugTextOut * TextOut,
+	__in ULONG DebugLevel,
+	__in NWN::OBJECTID ObjectInvalid,
+	__in_opt PCNWSCRIPT_JIT_PARAMS CodeGenParams
+	)
+/*++
+
+Routine Description:
+
+	This routine constructs a new NWScriptNativeCodeGenerator.
+
+Arguments:
+
+	TextOut - Optionally supplies a text output interface that receives debug
+	          output.
+
+	DebugLevel - Supplies the debug output level.
+
+	ObjectInvalid - Supplies the object id of the invalid object.
+
+	CodeGenParams - Optionally supplies extended code generation parameters.
+
+Return Value:
+
+	The newly constructed object.
+
+Environment:
+
+	User mode.
+
+--*/
+: m_TextOut( TextOut ),
+  m_DebugLevel( DebugLevel ),
+  m_ObjectInvalid( ObjectInvalid ),
+  m_CodeGenFlags( 0 ),
+  m_MaxLoopIterations( MAX_LOOP_ITERATIONS ),
+  m_MaxCallDepth( MAX_CALL_DEPTH ),
+  m_Analyzer( NULL ),
+  m_ActionDefs( NULL ),
+  m_ActionCount( 0 ),
+  m_Module( NULL ),
+  m_EntryPC( 0 ),
+  m_NumGlobals( 0 )
+{
+	if (CodeGenParams != NULL)
+	{
+		m_CodeGenFlags = CodeGenParams->CodeGenFlags;
+
+		if (CodeGenParams->Size >= NWSCRIPT_JIT_PARAMS_SIZE_V2)
+		{
+			m_MaxLoopIterations = CodeGenParams->MaxLoopIterations;
+			m_MaxCallDepth      = CodeGenParams->MaxCallDepth;
+		}
+	}
+
+	if (m_MaxLoopIterations <= 0)
+		m_MaxLoopIterations = MAX_LOOP_ITERATIONS;
+	if (m_MaxCallDepth <= 0)
+		m_MaxCallDepth = MAX_CALL_DEPTH;
+}
+
+NWScriptNativeCodeGenerator::~NWScriptNativeCodeGenerator(
+	)
+/*++
+
+Routine Description:
+
+	This routine deletes the current NWScriptNativeCodeGenerator object and its
+	associated members.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+}
+
+void
+NWScriptNativeCodeGenerator::GenerateProgram(
+	__in const NWScriptAnalyzer * Analyzer,
+	__out ProgramModule & Module
+	)
+/*++
+
+Routine Description:
+
+	This routine generates native code for every subroutine of an analyzed
+	script program, and fills in the program module that describes the
+	generated code.
+
+	The module begins with the entry thunk, followed by each subroutine in the
+	order that the analyzer reports them.
+
+Arguments:
+
+	Analyzer - Supplies the analyzer that has raised the script program to IR.
+
+	Module - Receives the generated program.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	typedef std::vector< std::pair< NWScriptSubroutine *, unsigned long > > SubroutineFlagVec;
+
+	PROGRAM_COUNTER   LoaderPC;
+	PROGRAM_COUNTER   GlobalsPC;
+	SubroutineFlagVec Subroutines;
+	ULONG             NextResumeMethodId;
+
+	m_Analyzer = Analyzer;
+	m_Module   = &Module;
+
+	Analyzer->GetActionDefs( m_ActionDefs, m_ActionCount );
+
+	Module.HasGlobals        = false;
+	Module.MaxLoopIterations = m_MaxLoopIterations;
+	Module.MaxCallDepth      = m_MaxCallDepth;
+	Module.CodeGenFlags      = m_CodeGenFlags;
+
+	try
+	{
+		if (Analyzer->GetSubroutines( ).empty( ))
+			throw std::runtime_error( "Script program has no subroutines." );
+
+		LoaderPC           = Analyzer->GetLoaderPC( );
+		GlobalsPC          = Analyzer->GetGlobalsPC( );
+		m_EntryPC          = Analyzer->GetSubroutines( ).front( )->GetAddress( );
+		NextResumeMethodId = 0;
+
+		//
+		// First, discover the role of each subroutine, and create the label
+		// that call sites use to refer to it.  No code is emitted for the
+		// #loader subroutine.
+		//
+
+		for (NWNScriptLib::SubroutinePtrVec::const_iterator it = Analyzer->GetSubroutines( ).begin( );
+		     it != Analyzer->GetSubroutines( ).end( );
+		     ++it)
+		{
+			NWScriptSubroutine * IRSub;
+			unsigned long        Flags;
+
+			IRSub = it->get( );
+			Flags = 0;
+
+			if (Subroutines.empty( ))
+			{
+				Flags |= GSF_ENTRY_POINT;
+			}
+			else if (IRSub->GetAddress( ) == LoaderPC)
+			{
+				continue;
+			}
+			else if (IRSub->GetAddress( ) == GlobalsPC)
+			{
+				Flags |= GSF_GLOBALS;
+			}
+			else if (IRSub->GetFlags( ) & NWScriptSubroutine::SCRIPT_SITUATION)
+			{
+				Flags |= GSF_SCRIPT_SITUATION;
+
+				m_ResumeMethodIds.insert(
+					std::make_pair( IRSub->GetAddress( ), NextResumeMethodId++ ) );
+			}
+
+			m_SubroutineLabels.insert(
+				std::make_pair( IRSub->GetAddress( ), m_Asm.CreateLabel( ) ) );
+
+			Subroutines.push_back( std::make_pair( IRSub, Flags ) );
+		}
+
+		//
+		// Emit the entry thunk at the start of the module, then assign homes to
+		// all program globals, and finally generate each subroutine in turn.
+		//
+
+		GenerateEntryThunk( );
+		AssignGlobalHomes( );
+
+		for (SubroutineFlagVec::const_iterator it = Subroutines.begin( );
+		     it != Subroutines.end( );
+		     ++it)
+		{
+			GenerateSubroutine( it->first, it->second );
+		}
+
+		m_Asm.Finalize( );
+
+		//
+		// Now describe the subroutines that the program invokes directly.
+		//
+
+		Module.ResumeSubroutines.resize( m_ResumeMethodIds.size( ) );
+
+		for (SubroutineFlagVec::const_iterator it = Subroutines.begin( );
+		     it != Subroutines.end( );
+		     ++it)
+		{
+			if (it->second & GSF_ENTRY_POINT)
+			{
+				BuildSubroutineEntry( it->first, Module.EntryPoint );
+			}
+			else if (it->second & GSF_GLOBALS)
+			{
+				BuildSubroutineEntry( it->first, Module.Globals );
+				Module.HasGlobals = true;
+			}
+			else if (it->second & GSF_SCRIPT_SITUATION)
+			{
+				BuildSubroutineEntry(
+					it->first,
+					Module.ResumeSubroutines[ m_ResumeMethodIds[ it->first->GetAddress( ) ] ] );
+			}
+		}
+
+		//
+		// Lay out the code followed by its unwind data, so that exceptions
+		// raised beneath generated code can be unwound through it.
+		//
+
+		{
+			std::vector< unsigned char >    Image;
+			std::vector< RUNTIME_FUNCTION > FunctionTable;
+
+			BuildModuleImage( Image, FunctionTable );
+
+			Module.Code = new NWScriptNativeCode( Image, FunctionTable );
+		}
+	}
+	catch (...)
+	{
+		for (std::vector< NWScriptVariable * >::iterator it = m_HomedVariables.begin( );
+		     it != m_HomedVariables.end( );
+		     ++it)
+		{
+			(*it)->SetUserContext( NULL );
+		}
+
+		m_HomedVariables.clear( );
+		m_Unwind.clear( );
+		throw;
+	}
+
+	//
+	// Release the variable homes now that generation is complete, so that the
+	// IR is left as it was found.
+	//
+
+	for (std::vector< NWScriptVariable * >::iterator it = m_HomedVariables.begin( );
+	     it != m_HomedVariables.end( );
+	     ++it)
+	{
+		(*it)->SetUserContext( NULL );
+	}
+
+	m_HomedVariables.clear( );
+	m_Unwind.clear( );
+
+	if (IsDebugLevel( NWScriptVM::EDL_Calls ))
+	{
+		m_TextOut->WriteText(
+			"NWScriptNativeCodeGenerator::GenerateProgram: Generated %lu bytes of code for %lu subroutines of script %s.\n",
+			(unsigned long) m_Asm.GetCode( ).size( ),
+			(unsigned long) Subroutines.size( ),
+			Analyzer->GetProgramName( ).c_str( ));
+	}
+}
+
+void
+NWScriptNativeCodeGenerator::GenerateEntryThunk(
+	)
+/*++
+
+Routine Description:
+
+	This routine emits the entry thunk (see NWSCRIPT_NATIVE_THUNK), which
+	bridges from the host calling convention to the private calling convention
+	of generated subroutines.
+
+	The thunk saves all callee saved registers, loads the execution context
+	into R15, copies the argument slots to the bottom of its frame, calls the
+	subroutine, and copies the slots back out once the subroutine returns.
+
+	As the argument area is sized at run time, the thunk addresses its frame
+	through RBP, which its unwind data names as the frame register.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	static const GPR SavedRegisters[ ] =
+	{
+		X64Assembler::RBX,
+		X64Assembler::RSI,
+		X64Assembler::RDI,
+		X64Assembler::R12,
+		X64Assembler::R13,
+		X64Assembler::R14,
+		X64Assembler::R15
+	};
+
+	const size_t NumSaved = sizeof( SavedRegisters ) / sizeof( SavedRegisters[ 0 ] );
+	Label        ProbeLoop;
+	Label        ProbeDone;
+
+	//
+	// RBP is established last, as the unwind data requires, but still points
+	// at the saved RBP so that the epilog is the usual one.
+	//
+
+	C_ASSERT( ((NumSaved + 1) * SLOT_SIZE) % 16 == 0 );
+
+	BeginFunctionUnwind( );
+
+	m_Asm.Push( X64Assembler::RBP );
+	RecordUnwindOp( UWOP_PUSH_NONVOL, (UCHAR) X64Assembler::RBP, 0 );
+
+	for (size_t i = 0; i < NumSaved; i += 1)
+	{
+		m_Asm.Push( SavedRegisters[ i ] );
+		RecordUnwindOp( UWOP_PUSH_NONVOL, (UCHAR) SavedRegisters[ i ], 0 );
+	}
+
+	//
+	// An odd number of registers was pushed, so realign the stack.
+	//
+
+	m_Asm.AluRegImm64( X64Assembler::ALU_SUB, X64Assembler::RSP, SLOT_SIZE );
+	RecordUnwindAlloc( SLOT_SIZE );
+
+	m_Asm.LeaRegMem64(
+		X64Assembler::RBP,
+		X64Assembler::RSP,
+		(LONG) ((NumSaved + 1) * SLOT_SIZE));
+	RecordUnwindOp( UWOP_SET_FPREG, 0, 0 );
+
+	m_Unwind.back( ).FrameRegister = (UCHAR) X64Assembler::RBP;
+	m_Unwind.back( ).FrameOffset   = (UCHAR) (((NumSaved + 1) * SLOT_SIZE) / 16);
+
+	EndFunctionProlog( );
+
+	m_Asm.MovRegReg64( X64Assembler::R15, ArgumentRegisters[ 0 ] );
+	m_Asm.MovRegReg64( X64Assembler::R12, ArgumentRegisters[ 1 ] );
+	m_Asm.MovRegReg64( X64Assembler::R13, ArgumentRegisters[ 2 ] );
+	m_Asm.MovRegReg64( X64Assembler::R14, ArgumentRegisters[ 3 ] );
+
+	//
+	// Compute the 16-byte aligned size of the argument area, and allocate it
+	// one page at a time so that the stack guard page is never skipped.
+	//
+
+	ProbeLoop = m_Asm.CreateLabel( );
+	ProbeDone = m_Asm.CreateLabel( );
+
+	m_Asm.MovRegReg64( X64Assembler::RAX, X64Assembler::R14 );
+	m_Asm.ShiftRegImm64( X64Assembler::SHIFT_SHL, X64Assembler::RAX, 3 );
+	m_Asm.AluRegImm64( X64Assembler::ALU_ADD, X64Assembler::RAX, 15 );
+	m_Asm.AluRegImm64( X64Assembler::ALU_AND, X64Assembler::RAX, -16 );
+
+	m_Asm.BindLabel( ProbeLoop );
+	m_Asm.AluRegImm64( X64Assembler::ALU_CMP, X64Assembler::RAX, PAGE_SIZE_PROBE );
+	m_Asm.Jcc( X64Assembler::CC_BE, ProbeDone );
+	m_Asm.AluRegImm64( X64Assembler::ALU_SUB, X64Assembler::RSP, PAGE_SIZE_PROBE );
+	m_Asm.MovMemImm64( X64Assembler::RSP, 0, 0 );
+	m_Asm.AluRegImm64( X64Assembler::ALU_SUB, X64Assembler::RAX, PAGE_SIZE_PROBE );
+	m_Asm.Jmp( ProbeLoop );
+	m_Asm.BindLabel( ProbeDone );
+	m_Asm.AluRegReg64( X64Assembler::ALU_SUB, X64Assembler::RSP, X64Assembler::RAX );
+
+	//
+	// Copy the slots in, call the subroutine, and copy the slots back out.
+	//
+
+	m_Asm.MovRegReg64( X64Assembler::RSI, X64Assembler::R13 );
+	m_Asm.MovRegReg64( X64Assembler::RDI, X64Assembler::RSP );
+	m_Asm.MovRegReg64( X64Assembler::RCX, X64Assembler::R14 );
+	m_Asm.RepMovsq( );
+
+	m_Asm.CallReg( X64Assembler::R12 );
+
+	m_Asm.MovRegReg64( X64Assembler::RSI, X64Assembler::RSP );
+	m_Asm.MovRegReg64( X64Assembler::RDI, X64Assembler::R13 );
+	m_Asm.MovRegReg64( X64Assembler::RCX, X64Assembler::R14 );
+	m_Asm.RepMovsq( );
+
+	m_Asm.LeaRegMem64(
+		X64Assembler::RSP,
+		X64Assembler::RBP,
+		-(LONG) (NumSaved * SLOT_SIZE));
+
+	for (size_t i = NumSaved; i != 0; i -= 1)
+		m_Asm.Pop( SavedRegisters[ i - 1 ] );
+
+	m_Asm.Pop( X64Assembler::RBP );
+	m_Asm.Ret( );
+
+	EndFunctionUnwind( );
+}
+
+void
+NWScriptNativeCodeGenerator::AssignGlobalHomes(
+	)
+/*++
+
+Routine Description:
+
+	This routine assigns each program global a slot in the execution context.
+	Globals are discovered from the frame of #globals, in the same order that
+	the MSIL backend uses, so that saved states agree on global numbering.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	PROGRAM_COUNTER      GlobalsPC;
+	NWScriptSubroutine * GlobalsSub;
+
+	m_NumGlobals = 0;
+	m_Module->GlobalTypes.clear( );
+
+	if ((GlobalsPC = m_Analyzer->GetGlobalsPC( )) == NWNScriptLib::INVALID_PC)
+		return;
+
+	GlobalsSub = NULL;
+
+	for (NWNScriptLib::SubroutinePtrVec::const_iterator it = m_Analyzer->GetSubroutines( ).begin( );
+	     it != m_Analyzer->GetSubroutines( ).end( );
+	     ++it)
+	{
+		if ((*it)->GetAddress( ) == GlobalsPC)
+		{
+			GlobalsSub = it->get( );
+			break;
+		}
+	}
+
+	if (GlobalsSub == NULL)
+		throw std::runtime_error( "Unable to locate NWScriptSubroutine for #globals" );
+
+	for (NWNScriptLib::VariablePtrVec::const_iterator it = GlobalsSub->GetLocals( ).begin( );
+	     it != GlobalsSub->GetLocals( ).end( );
+	     ++it)
+	{
+		NWScriptVariable * Var;
+		VariableHome     * Home;
+
+		//
+		// Skip non-global variables in the frame of #globals.
+		//
+
+		Var = it->get( )->GetHeadVariable( );
+
+		if (Var->GetType( ) == ACTIONTYPE_VOID)
+			continue;
+		else if (Var->GetClass( ) != NWScriptVariable::Global)
+			continue;
+		else if (Var->GetType( ) == LASTACTIONTYPE)
+			continue;
+		else if (Var->GetUserContext( ) != NULL)
+			continue;
+
+		Home       = CreateHome( Var, HK_MEMORY );
+		Home->Base = X64Assembler::R15;
+		Home->Disp = (LONG) (offsetof( NWSCRIPT_NATIVE_CONTEXT, Globals ) + m_NumGlobals * SLOT_SIZE);
+
+		m_Module->GlobalTypes.push_back( Home->Type );
+
+		if (IsDebugLevel( NWScriptVM::EDL_Verbose ))
+		{
+			m_TextOut->WriteText(
+				"[Sub=%s(%08X)] Create global %p (#%lu) as type %lu.\n",
+				GlobalsSub->GetSymbolName( ).c_str( ),
+				GlobalsSub->GetAddress( ),
+				Var,
+				(unsigned long) m_NumGlobals,
+				(unsigned long) Home->Type);
+		}
+
+		m_NumGlobals += 1;
+	}
+}
+
+void
+NWScriptNativeCodeGenerator::BuildSubroutineEntry(
+	__in NWScriptSubroutine * IRSub,
+	__out SubroutineEntry & Entry
+	)
+/*++
+
+Routine Description:
+
+	This routine describes a generated subroutine that the program invokes
+	directly, once the module has been finalized.
+
+Arguments:
+
+	IRSub - Supplies the IR subroutine.
+
+	Entry - Receives the description of the subroutine.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	Entry.Offset          = m_Asm.GetLabelOffset( m_SubroutineLabels[ IRSub->GetAddress( ) ] );
+	Entry.PC              = IRSub->GetAddress( );
+	Entry.NumReturnValues = IRSub->GetNumReturnTypes( );
+	Entry.ReturnType      = IRSub->GetFirstReturnType( );
+
+	Entry.ParameterTypes.clear( );
+
+	for (size_t i = 0; i < IRSub->GetParameters( ).size( ); i += 1)
+		Entry.ParameterTypes.push_back( GetVariableType( &IRSub->GetParameterVariable( i ) ) );
+}
+
+void
+NWScriptNativeCodeGenerator::GenerateSubroutine(
+	__in NWScriptSubroutine * IRSub,
+	__in unsigned long Flags
+	)
+/*++
+
+Routine Description:
+
+	This routine generates native code for an IR subroutine.
+
+Arguments:
+
+	IRSub - Supplies the IR subroutine to generate.
+
+	Flags - Supplies the role of the subroutine (GSUB_FLAGS).
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	SubroutineContext Sub;
+	size_t            FirstHomed;
+
+	Sub.IRSub             = IRSub;
+	Sub.Flags             = Flags;
+	Sub.NumInstructions   = 0;
+	Sub.NumSlots          = 0;
+	Sub.XmmSaveBase       = 0;
+	Sub.TestSlot          = 0;
+	Sub.TestInFlags       = false;
+	Sub.MaxStageSlots     = 0;
+	Sub.MaxCallSlots      = 0;
+	Sub.FrameSize         = 0;
+	Sub.ExitLabel         = m_Asm.CreateLabel( );
+	Sub.CallDepthLabel    = m_Asm.CreateLabel( );
+	Sub.LoopLimitLabel    = m_Asm.CreateLabel( );
+	Sub.DivideByZeroLabel = m_Asm.CreateLabel( );
+	Sub.OverflowLabel     = m_Asm.CreateLabel( );
+	Sub.CallDepthUsed     = false;
+	Sub.LoopLimitUsed     = false;
+	Sub.DivideByZeroUsed  = false;
+	Sub.OverflowUsed      = false;
+
+	FirstHomed = m_HomedVariables.size( );
+
+	BuildFlowGraph( Sub );
+	AssignVariableHomes( Sub );
+
+	if (IsDebugLevel( NWScriptVM::EDL_Verbose ))
+	{
+		m_TextOut->WriteText(
+			"[Sub=%s(%08X)] Generating native code at offset %lu (%lu flows, %lu slots, %lu saved GPRs, %lu saved XMMs).\n",
+			IRSub->GetSymbolName( ).c_str( ),
+			IRSub->GetAddress( ),
+			(unsigned long) m_Asm.GetOffset( ),
+			(unsigned long) Sub.Flows.size( ),
+			(unsigned long) Sub.NumSlots,
+			(unsigned long) Sub.SavedGprs.size( ),
+			(unsigned long) Sub.SavedXmms.size( ));
+	}
+
+	m_Asm.BindLabel( m_SubroutineLabels[ IRSub->GetAddress( ) ] );
+
+	GenerateProlog( Sub );
+
+	for (size_t i = 0; i < Sub.Flows.size( ); i += 1)
+		GenerateFlow( Sub, i );
+
+	GenerateEpilog( Sub );
+	EndFunctionUnwind( );
+
+	//
+	// Release the homes of this subroutine's variables.  Globals were homed
+	// before any subroutine and so remain.
+	//
+
+	for (size_t i = FirstHomed; i < m_HomedVariables.size( ); i += 1)
+		m_HomedVariables[ i ]->SetUserContext( NULL );
+
+	m_HomedVariables.resize( FirstHomed );
+}
+
+void
+NWScriptNativeCodeGenerator::BuildFlowGraph(
+	__inout SubroutineContext & Sub
+	)
+/*++
+
+Routine Description:
+
+	This routine discovers the control flows of a subroutine that are reachable
+	from its entry, and lays them out in emission order: the entry flow first,
+	then all other flows in ascending program counter order.
+
+	Each instruction is assigned a pair of positions (2N for its reads, and
+	2N+1 for its writes) that the register allocator uses to build live
+	intervals.  The sizes of the call and action staging areas are also
+	computed here, as the frame must be sized before any code is emitted.
+
+Arguments:
+
+	Sub - Supplies the subroutine being generated.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	const NWNScriptLib::ControlFlowSet       & IRFlows = Sub.IRSub->GetControlFlows( );
+	NWNScriptLib::ControlFlowSet::const_iterator FlowIt;
+	std::set< PROGRAM_COUNTER >                Reachable;
+	std::vector< PROGRAM_COUNTER >             Pending;
+	std::vector< NWScriptControlFlow * >       Order;
+	PROGRAM_COUNTER                            EntryFlowPC;
+
+	FlowIt = IRFlows.find( Sub.IRSub->GetAddress( ) );
+
+	if (FlowIt == IRFlows.end( ))
+		throw std::runtime_error( "Subroutine has no entry control flow." );
+
+	EntryFlowPC = FlowIt->first;
+
+	Pending.push_back( EntryFlowPC );
+	Reachable.insert( EntryFlowPC );
+
+	while (!Pending.empty( ))
+	{
+		NWScriptControlFlow * Flow;
+
+		FlowIt = IRFlows.find( Pending.back( ) );
+		Pending.pop_back( );
+
+		Flow = FlowIt->second.get( );
+
+		for (size_t i = 0; i < 2; i += 1)
+		{
+			NWScriptControlFlow * Child = Flow->GetChild( i ).get( );
+
+			if (Child == NULL)
+				continue;
+
+			if (IRFlows.find( Child->GetStartPC( ) ) == IRFlows.end( ))
+				throw std::runtime_error( "Control flow successor is not part of the subroutine." );
+
+			if (Reachable.insert( Child->GetStartPC( ) ).second)
+				Pending.push_back( Child->GetStartPC( ) );
+		}
+	}
+
+	Order.push_back( IRFlows.find( EntryFlowPC )->second.get( ) );
+
+	for (FlowIt = IRFlows.begin( ); FlowIt != IRFlows.end( ); ++FlowIt)
+	{
+		if (FlowIt->first == EntryFlowPC)
+			continue;
+		else if (Reachable.find( FlowIt->first ) == Reachable.end( ))
+			continue;
+
+		Order.push_back( FlowIt->second.get( ) );
+	}
+
+	Sub.Flows.resize( Order.size( ) );
+
+	for (size_t i = 0; i < Order.size( ); i += 1)
+	{
+		FlowInfo & Info = Sub.Flows[ i ];
+
+		Info.Flow      = Order[ i ];
+		Info.FlowLabel = m_Asm.CreateLabel( );
+
+		Sub.FlowIndex.insert( std::make_pair( Order[ i ]->GetStartPC( ), i ) );
+	}
+
+	//
+	// Now number the instructions, link each flow to its successors, and size
+	// the staging areas.
+	//
+
+	for (size_t i = 0; i < Sub.Flows.size( ); i += 1)
+	{
+		FlowInfo                                 & Info = Sub.Flows[ i ];
+		const std::list< NWScriptInstruction >   & IR   = Info.Flow->GetIR( );
+
+		Info.StartPos = 2 * Sub.NumInstructions;
+
+		for (std::list< NWScriptInstruction >::const_iterator it = IR.begin( );
+		     it != IR.end( );
+		     ++it)
+		{
+			const NWNScriptLib::VariableWeakPtrVec * ParamList = it->GetParamVarList( );
+			size_t                                   ParamSize = (ParamList != NULL) ? ParamList->size( ) : 0;
+
+			switch (it->GetType( ))
+			{
+
+			case NWScriptInstruction::I_CALL:
+				if (!IsIgnoredCallInstr( Sub, it->GetSubroutine( ) ))
+					Sub.MaxCallSlots = std::max( Sub.MaxCallSlots, ParamSize );
+				break;
+
+			case NWScriptInstruction::I_ACTION:
+			case NWScriptInstruction::I_SAVE_STATE:
+				Sub.MaxStageSlots = std::max( Sub.MaxStageSlots, ParamSize );
+				break;
+
+			}
+
+			Sub.NumInstructions += 1;
+		}
+
+		Info.EndPos = 2 * Sub.NumInstructions;
+
+		for (size_t c = 0; c < 2; c += 1)
+		{
+			NWScriptControlFlow * Child = Info.Flow->GetChild( c ).get( );
+
+			if (Child != NULL)
+				Info.Successors.push_back( LookupFlow( Sub, Child->GetStartPC( ) ) );
+		}
+	}
+}
+
+void
+NWScriptNativeCodeGenerator::AssignVariableHomes(
+	__inout SubroutineContext & Sub
+	)
+/*++
+
+Routine Description:
+
+	This routine assigns a home to every variable referenced by a subroutine,
+	and lays out the subroutine's frame.
+
+	Parameters and return values live in the argument area supplied by the
+	caller.  Locals are offered to the register allocator if they are of a
+	scalar type; the remainder (and any spilled locals) receive frame slots.
+
+	The frame, relative to RBP, is laid out as follows:
+
+	- Saved GPRs, immediately below the saved RBP.
+	- Variable slots (including the I_TEST slot).
+	- XMM register save area.
+	- Outgoing area: callee argument slots, or the register parameter home
+	  area followed by the staging area of a runtime support call.
+
+Arguments:
+
+	Sub - Supplies the subroutine being generated.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	NWScriptSubroutine                * IRSub = Sub.IRSub;
+	size_t                              ParamCount;
+	size_t                              ReturnCount;
+	std::set< NWScriptVariable * >      Seen;
+	std::vector< NWScriptVariable * >   Candidates;
+	std::vector< NWScriptVariable * >   FrameLocals;
+	LiveIntervalVec                     Intervals;
+	size_t                              OutSize;
+	size_t                              Fixed;
+
+	ParamCount  = IRSub->GetParameters( ).size( );
+	ReturnCount = IRSub->GetNumReturnTypes( );
+
+	//
+	// First, home the return values and parameters of the subroutine in the
+	// caller's argument area.
+	//
+
+	for (size_t i = 0; i < ReturnCount; i += 1)
+	{
+		NWScriptVariable * Var = IRSub->GetReturnValueVariable( i ).GetHeadVariable( );
+		VariableHome     * Home;
+
+		if (Var->GetClass( ) != NWScriptVariable::ReturnValue)
+			throw std::runtime_error( "Incorrectly classified subroutine return value detected." );
+		else if (Var->GetUserContext( ) != NULL)
+			throw std::runtime_error( "Aliased subroutine return value detected." );
+
+		Home       = CreateHome( Var, HK_MEMORY );
+		Home->Base = X64Assembler::RBP;
+		Home->Disp = (LONG) (2 * SLOT_SIZE + i * SLOT_SIZE);
+	}
+
+	for (size_t i = 0; i < ParamCount; i += 1)
+	{
+		NWScriptVariable * Var = IRSub->GetParameterVariable( i ).GetHeadVariable( );
+		VariableHome     * Home;
+
+		if (Var->GetClass( ) != NWScriptVariable::Parameter)
+			throw std::runtime_error( "Incorrectly classified subroutine parameter detected." );
+		else if (Var->GetUserContext( ) != NULL)
+			throw std::runtime_error( "Aliased subroutine parameter detected." );
+
+		Home       = CreateHome( Var, HK_MEMORY );
+		Home->Base = X64Assembler::RBP;
+		Home->Disp = (LONG) (2 * SLOT_SIZE + (ReturnCount + i) * SLOT_SIZE);
+	}
+
+	//
+	// Now discover every other variable referenced by reachable code.
+	//
+
+	for (size_t i = 0; i < Sub.Flows.size( ); i += 1)
+	{
+		const std::list< NWScriptInstruction > & IR = Sub.Flows[ i ].Flow->GetIR( );
+
+		for (std::list< NWScriptInstruction >::const_iterator it = IR.begin( );
+		     it != IR.end( );
+		     ++it)
+		{
+			NWNScriptLib::VariableWeakPtrVec ReadVars;
+			NWNScriptLib::VariableWeakPtrVec WriteVars;
+
+			GetInstructionVariables( *it, ReadVars, WriteVars );
+
+			if ((it->GetType( ) == NWScriptInstruction::I_CREATE) ||
+			    (it->GetType( ) == NWScriptInstruction::I_DELETE))
+			{
+				ReadVars.push_back( it->GetVar( 0 ) );
+			}
+
+			ReadVars.insert( ReadVars.end( ), WriteVars.begin( ), WriteVars.end( ) );
+
+			for (NWNScriptLib::VariableWeakPtrVec::const_iterator VarIt = ReadVars.begin( );
+			     VarIt != ReadVars.end( );
+			     ++VarIt)
+			{
+				NWScriptVariable * Var = (*VarIt)->GetHeadVariable( );
+
+				if (Var->GetUserContext( ) != NULL)
+					continue;
+				else if (!Seen.insert( Var ).second)
+					continue;
+
+				switch (Var->GetClass( ))
+				{
+
+				case NWScriptVariable::Global:
+					throw std::runtime_error( "Attempting to retrieve non-allocated global variable." );
+
+				case NWScriptVariable::Constant:
+					AssignConstantHome( Var );
+					break;
+
+				case NWScriptVariable::Parameter:
+				case NWScriptVariable::ReturnValue:
+					throw std::runtime_error( "Referencing parameter or return value of another subroutine." );
+
+				case NWScriptVariable::Local:
+				case NWScriptVariable::CallParameter:
+				case NWScriptVariable::CallReturnValue:
+					if (IsAllocationCandidate( Var ))
+						Candidates.push_back( Var );
+					else
+						FrameLocals.push_back( Var );
+					break;
+
+				default:
+					throw std::runtime_error( "Referencing variable of illegal class." );
+
+				}
+			}
+		}
+	}
+
+	//
+	// Allocate registers, which determines the set of callee saved registers
+	// and so the base of the variable slots.
+	//
+
+	AllocateRegisters( Sub, Candidates, Intervals );
+
+	for (LiveIntervalVec::const_iterator it = Intervals.begin( );
+	     it != Intervals.end( );
+	     ++it)
+	{
+		VariableHome * Home;
+
+		if (!it->Spilled)
+		{
+			if (it->Float)
+			{
+				Home      = CreateHome( it->Var, HK_XMM );
+				Home->Xmm = it->Xmm;
+			}
+			else
+			{
+				Home      = CreateHome( it->Var, HK_GPR );
+				Home->Reg = it->Reg;
+			}
+		}
+		else
+		{
+			Home       = CreateHome( it->Var, HK_MEMORY );
+			Home->Base = X64Assembler::RBP;
+			Home->Disp = GetSlotDisplacement( Sub, Sub.NumSlots++ );
+		}
+	}
+
+	for (std::vector< NWScriptVariable * >::const_iterator it = FrameLocals.begin( );
+	     it != FrameLocals.end( );
+	     ++it)
+	{
+		VariableHome * Home;
+
+		Home       = CreateHome( *it, HK_MEMORY );
+		Home->Base = X64Assembler::RBP;
+		Home->Disp = GetSlotDisplacement( Sub, Sub.NumSlots++ );
+
+		//
+		// Pointer typed slots must start out as the empty string (or a not
+		// yet created engine structure), as the runtime dereferences them.
+		//
+
+		if (NWScriptNativeRuntime::IsPointerType( Home->Type ))
+			Sub.PointerSlots.push_back( Home->Disp );
+	}
+
+	Sub.TestSlot = GetSlotDisplacement( Sub, Sub.NumSlots++ );
+
+	//
+	// Finally, size the frame.  The stack pointer must be 16-byte aligned once
+	// the prolog has run.
+	//
+
+	OutSize = std::max(
+		SHADOW_SPACE_SIZE + Sub.MaxStageSlots * SLOT_SIZE,
+		Sub.MaxCallSlots * SLOT_SIZE);
+	OutSize = (OutSize + 15) & ~(size_t) 15;
+
+	Fixed = (Sub.SavedGprs.size( ) + Sub.NumSlots) * SLOT_SIZE;
+
+	Sub.XmmSaveBase = -(LONG) (Fixed + Sub.SavedXmms.size( ) * 16);
+	Sub.FrameSize   = (LONG) (Sub.NumSlots * SLOT_SIZE + Sub.SavedXmms.size( ) * 16 + OutSize);
+
+	//
+	// Any padding goes above the XMM save area, so that the saves are 16-byte
+	// aligned relative to the stack pointer as the unwind data requires.
+	//
+
+	if (((Sub.SavedGprs.size( ) * SLOT_SIZE) + Sub.FrameSize) % 16)
+	{
+		Sub.FrameSize   += SLOT_SIZE;
+		Sub.XmmSaveBase -= SLOT_SIZE;
+	}
+}
+
+void
+NWScriptNativeCodeGenerator::AllocateRegisters(
+	__inout SubroutineContext & Sub,
+	__in const std::vector< NWScriptVariable * > & Candidates,
+	__inout LiveIntervalVec & Intervals
+	)
+/*++
+
+Routine Description:
+
+	This routine assigns registers to the allocation candidates of a
+	subroutine with a linear scan over their live intervals.  When no register
+	is free, the interval that ends furthest away is spilled.
+
+	Registers are drawn from the callee saved pools, which runtime support
+	routines preserve, so intervals may freely span calls to the runtime.
+
+Arguments:
+
+	Sub - Supplies the subroutine being generated.  The set of registers to
+	      save in the prolog is filled in.
+
+	Candidates - Supplies the variables that may be assigned registers.
+
+	Intervals - Receives the live interval (and assignment) of each candidate.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	std::vector< std::pair< size_t, size_t > > Order;
+	std::vector< size_t >                      ActiveGpr;
+	std::vector< size_t >                      ActiveXmm;
+	std::vector< bool >                        GprFree( GprPoolSize, true );
+	std::vector< bool >                        XmmFree( XmmPoolSize, true );
+	std::vector< bool >                        GprUsed( GprPoolSize, false );
+	std::vector< bool >                        XmmUsed( XmmPoolSize, false );
+
+	ComputeLiveIntervals( Sub, Candidates, Intervals );
+
+	for (size_t i = 0; i < Intervals.size( ); i += 1)
+		Order.push_back( std::make_pair( Intervals[ i ].Start, i ) );
+
+	std::sort( Order.begin( ), Order.end( ) );
+
+	for (size_t o = 0; o < Order.size( ); o += 1)
+	{
+		size_t                  Index   = Order[ o ].second;
+		LiveInterval          & Current = Intervals[ Index ];
+		std::vector< size_t > & Active  = Current.Float ? ActiveXmm : ActiveGpr;
+		std::vector< bool >   & Free    = Current.Float ? XmmFree : GprFree;
+		size_t                  PoolSize;
+		size_t                  Slot;
+
+		PoolSize = Current.Float ? XmmPoolSize : GprPoolSize;
+
+		//
+		// Expire intervals that ended before this one starts.
+		//
+
+		for (size_t a = 0; a < Active.size( ); )
+		{
+			LiveInterval & Old = Intervals[ Active[ a ] ];
+
+			if (Old.End >= Current.Start)
+			{
+				a += 1;
+				continue;
+			}
+
+			for (size_t r = 0; r < PoolSize; r += 1)
+			{
+				if (Current.Float ? (XmmPool[ r ] == Old.Xmm) : (GprPool[ r ] == Old.Reg))
+				{
+					Free[ r ] = true;
+					break;
+				}
+			}
+
+			Active.erase( Active.begin( ) + a );
+		}
+
+		for (Slot = 0; Slot < PoolSize; Slot += 1)
+		{
+			if (Free[ Slot ])
+				break;
+		}
+
+		if (Slot == PoolSize)
+		{
+			size_t Furthest = 0;
+
+			//
+			// No register is free.  Spill whichever of the active intervals and
+			// the current interval ends last.
+			//
+
+			for (size_t a = 1; a < Active.size( ); a += 1)
+			{
+				if (Intervals[ Active[ a ] ].End > Intervals[ Active[ Furthest ] ].End)
+					Furthest = a;
+			}
+
+			if ((Active.empty( )) || (Intervals[ Active[ Furthest ] ].End <= Current.End))
+			{
+				Current.Spilled = true;
+				continue;
+			}
+
+			LiveInterval & Victim = Intervals[ Active[ Furthest ] ];
+
+			Victim.Spilled = true;
+			Current.Reg    = Victim.Reg;
+			Current.Xmm    = Victim.Xmm;
+
+			Active.erase( Active.begin( ) + Furthest );
+			Active.push_back( Index );
+			continue;
+		}
+
+		Free[ Slot ] = false;
+
+		if (Current.Float)
+		{
+			Current.Xmm     = XmmPool[ Slot ];
+			XmmUsed[ Slot ] = true;
+		}
+		else
+		{
+			Current.Reg     = GprPool[ Slot ];
+			GprUsed[ Slot ] = true;
+		}
+
+		Active.push_back( Index );
+	}
+
+	for (size_t r = 0; r < GprPoolSize; r += 1)
+	{
+		if (GprUsed[ r ])
+			Sub.SavedGprs.push_back( GprPool[ r ] );
+	}
+
+	for (size_t r = 0; r < XmmPoolSize; r += 1)
+	{
+		if (XmmUsed[ r ])
+			Sub.SavedXmms.push_back( XmmPool[ r ] );
+	}
+}
+
+void
+NWScriptNativeCodeGenerator::ComputeLiveIntervals(
+	__inout SubroutineContext & Sub,
+	__in const std::vector< NWScriptVariable * > & Candidates,
+	__out LiveIntervalVec & Intervals
+	)
+/*++
+
+Routine Description:
+
+	This routine computes the live interval of each register allocation
+	candidate.  Liveness is first solved across control flows, and the
+	interval of a variable is then the hull of all positions at which it is
+	referenced or live across a flow boundary.
+
+Arguments:
+
+	Sub - Supplies the subroutine being generated.
+
+	Candidates - Supplies the variables to compute intervals for.
+
+	Intervals - Receives one interval per candidate.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	std::map< NWScriptVariable *, size_t > CandidateIndex;
+	size_t                                 Count = Candidates.size( );
+	size_t                                 Pos;
+	bool                                   Changed;
+
+	Intervals.resize( Count );
+
+	for (size_t i = 0; i < Count; i += 1)
+	{
+		LiveInterval & Interval = Intervals[ i ];
+
+		Interval.Var     = Candidates[ i ];
+		Interval.Start   = (size_t) -1;
+		Interval.End     = 0;
+		Interval.Float   = (GetVariableType( Candidates[ i ] ) == ACTIONTYPE_FLOAT);
+		Interval.Spilled = false;
+		Interval.Reg     = X64Assembler::RAX;
+		Interval.Xmm     = X64Assembler::XMM0;
+
+		CandidateIndex.insert( std::make_pair( Candidates[ i ], i ) );
+	}
+
+	if (Count == 0)
+		return;
+
+	//
+	// Gather the local uses and definitions of each flow, and extend the
+	// intervals over each reference.
+	//
+
+	Pos = 0;
+
+	for (size_t f = 0; f < Sub.Flows.size( ); f += 1)
+	{
+		FlowInfo                                 & Info = Sub.Flows[ f ];
+		const std::list< NWScriptInstruction >   & IR   = Info.Flow->GetIR( );
+
+		Info.Use.assign( Count, false );
+		Info.Def.assign( Count, false );
+		Info.LiveIn.assign( Count, false );
+		Info.LiveOut.assign( Count, false );
+
+		for (std::list< NWScriptInstruction >::const_iterator it = IR.begin( );
+		     it != IR.end( );
+		     ++it)
+		{
+			NWNScriptLib::VariableWeakPtrVec ReadVars;
+			NWNScriptLib::VariableWeakPtrVec WriteVars;
+
+			GetInstructionVariables( *it, ReadVars, WriteVars );
+
+			for (size_t v = 0; v < ReadVars.size( ); v += 1)
+			{
+				std::map< NWScriptVariable *, size_t >::const_iterator CandIt;
+
+				CandIt = CandidateIndex.find( ReadVars[ v ]->GetHeadVariable( ) );
+
+				if (CandIt == CandidateIndex.end( ))
+					continue;
+
+				if (!Info.Def[ CandIt->second ])
+					Info.Use[ CandIt->second ] = true;
+
+				Intervals[ CandIt->second ].Start = std::min( Intervals[ CandIt->second ].Start, 2 * Pos );
+				Intervals[ CandIt->second ].End   = std::max( Intervals[ CandIt->second ].End, 2 * Pos );
+			}
+
+			for (size_t v = 0; v < WriteVars.size( ); v += 1)
+			{
+				std::map< NWScriptVariable *, size_t >::const_iterator CandIt;
+
+				CandIt = CandidateIndex.find( WriteVars[ v ]->GetHeadVariable( ) );
+
+				if (CandIt == CandidateIndex.end( ))
+					continue;
+
+				Info.Def[ CandIt->second ] = true;
+
+				Intervals[ CandIt->second ].Start = std::min( Intervals[ CandIt->second ].Start, 2 * Pos + 1 );
+				Intervals[ CandIt->second ].End   = std::max( Intervals[ CandIt->second ].End, 2 * Pos + 1 );
+			}
+
+			Pos += 1;
+		}
+	}
+
+	//
+	// Solve liveness across flows.
+	//
+
+	do
+	{
+		Changed = false;
+
+		for (size_t f = Sub.Flows.size( ); f != 0; f -= 1)
+		{
+			FlowInfo & Info = Sub.Flows[ f - 1 ];
+
+			for (size_t v = 0; v < Count; v += 1)
+			{
+				bool Out = false;
+				bool In;
+
+				for (size_t s = 0; s < Info.Successors.size( ); s += 1)
+				{
+					if (Sub.Flows[ Info.Successors[ s ] ].LiveIn[ v ])
+					{
+						Out = true;
+						break;
+					}
+				}
+
+				In = Info.Use[ v ] || (Out && !Info.Def[ v ]);
+
+				if ((In != Info.LiveIn[ v ]) || (Out != Info.LiveOut[ v ]))
+				{
+					Info.LiveIn[ v ]  = In;
+					Info.LiveOut[ v ] = Out;
+					Changed           = true;
+				}
+			}
+		}
+	} while (Changed);
+
+	//
+	// Extend each interval over the flow boundaries it is live across.
+	//
+
+	for (size_t f = 0; f < Sub.Flows.size( ); f += 1)
+	{
+		const FlowInfo & Info = Sub.Flows[ f ];
+
+		for (size_t v = 0; v < Count; v += 1)
+		{
+			if (Info.LiveIn[ v ])
+			{
+				Intervals[ v ].Start = std::min( Intervals[ v ].Start, Info.StartPos );
+				Intervals[ v ].End   = std::max( Intervals[ v ].End, Info.StartPos );
+			}
+
+			if (Info.LiveOut[ v ])
+			{
+				Intervals[ v ].Start = std::min( Intervals[ v ].Start, Info.EndPos );
+				Intervals[ v ].End   = std::max( Intervals[ v ].End, Info.EndPos );
+			}
+		}
+	}
+}
+
+void
+NWScriptNativeCodeGenerator::GenerateProlog(
+	__inout SubroutineContext & Sub
+	)
+/*++
+
+Routine Description:
+
+	This routine emits the prolog of a subroutine, which establishes the frame,
+	saves the registers that the subroutine allocates, initializes pointer
+	typed frame slots, and charges the call depth budget.
+
+	The stack pointer does not move once the prolog has run, so the unwind
+	data describes the frame relative to RSP and names no frame register.
+
+Arguments:
+
+	Sub - Supplies the subroutine being generated.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	ULONG StackOffset;
+	LONG  NumProbes;
+
+	BeginFunctionUnwind( );
+
+	m_Asm.Push( X64Assembler::RBP );
+	RecordUnwindOp( UWOP_PUSH_NONVOL, (UCHAR) X64Assembler::RBP, 0 );
+
+	m_Asm.MovRegReg64( X64Assembler::RBP, X64Assembler::RSP );
+
+	for (size_t i = 0; i < Sub.SavedGprs.size( ); i += 1)
+	{
+		m_Asm.Push( Sub.SavedGprs[ i ] );
+		RecordUnwindOp( UWOP_PUSH_NONVOL, (UCHAR) Sub.SavedGprs[ i ], 0 );
+	}
+
+	//
+	// Touch each page of the frame below the stack pointer so that the stack
+	// guard page is never skipped, then allocate the frame with a single
+	// adjustment that the unwind data can describe.  R10 and R11 are volatile
+	// and hold nothing at entry.
+	//
+
+	NumProbes = (Sub.FrameSize - 1) / PAGE_SIZE_PROBE;
+
+	if (NumProbes != 0)
+	{
+		Label ProbeLoop = m_Asm.CreateLabel( );
+
+		m_Asm.MovRegReg64( X64Assembler::R11, X64Assembler::RSP );
+		m_Asm.MovRegImm32( X64Assembler::R10, (ULONG) NumProbes );
+
+		m_Asm.BindLabel( ProbeLoop );
+		m_Asm.AluRegImm64( X64Assembler::ALU_SUB, X64Assembler::R11, PAGE_SIZE_PROBE );
+		m_Asm.MovMemImm64( X64Assembler::R11, 0, 0 );
+		m_Asm.AluRegImm64( X64Assembler::ALU_SUB, X64Assembler::R10, 1 );
+		m_Asm.Jcc( X64Assembler::CC_NE, ProbeLoop );
+	}
+
+	if (Sub.FrameSize != 0)
+	{
+		m_Asm.AluRegImm64( X64Assembler::ALU_SUB, X64Assembler::RSP, Sub.FrameSize );
+		RecordUnwindAlloc( (ULONG) Sub.FrameSize );
+	}
+
+	StackOffset = (ULONG) (Sub.SavedGprs.size( ) * SLOT_SIZE + Sub.FrameSize + Sub.XmmSaveBase);
+
+	for (size_t i = 0; i < Sub.SavedXmms.size( ); i += 1)
+	{
+		m_Asm.MovdquMemReg(
+			X64Assembler::RBP,
+			Sub.XmmSaveBase + (LONG) (i * 16),
+			Sub.SavedXmms[ i ]);
+		RecordUnwindSaveXmm( Sub.SavedXmms[ i ], StackOffset + (ULONG) (i * 16) );
+	}
+
+	EndFunctionProlog( );
+
+	for (size_t i = 0; i < Sub.PointerSlots.size( ); i += 1)
+		m_Asm.MovMemImm64( X64Assembler::RBP, Sub.PointerSlots[ i ], 0 );
+
+	if (GuardsEnabled( ))
+	{
+		m_Asm.AluMemImm32(
+			X64Assembler::ALU_SUB,
+			X64Assembler::R15,
+			(LONG) offsetof( NWSCRIPT_NATIVE_CONTEXT, CallDepthBudget ),
+			1);
+		m_Asm.Jcc( X64Assembler::CC_L, Sub.CallDepthLabel );
+
+		Sub.CallDepthUsed = true;
+	}
+}
+
+void
+NWScriptNativeCodeGenerator::GenerateEpilog(
+	__inout SubroutineContext & Sub
+	)
+/*++
+
+Routine Description:
+
+	This routine emits the common exit path of a subroutine, followed by the
+	out of line stubs that record a failure status and leave the subroutine.
+
+Arguments:
+
+	Sub - Supplies the subroutine being generated.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	m_Asm.BindLabel( Sub.ExitLabel );
+
+	if (GuardsEnabled( ))
+	{
+		m_Asm.AluMemImm32(
+			X64Assembler::ALU_ADD,
+			X64Assembler::R15,
+			(LONG) offsetof( NWSCRIPT_NATIVE_CONTEXT, CallDepthBudget ),
+			1);
+	}
+
+	for (size_t i = 0; i < Sub.SavedXmms.size( ); i += 1)
+	{
+		m_Asm.MovdquRegMem(
+			Sub.SavedXmms[ i ],
+			X64Assembler::RBP,
+			Sub.XmmSaveBase + (LONG) (i * 16));
+	}
+
+	m_Asm.LeaRegMem64(
+		X64Assembler::RSP,
+		X64Assembler::RBP,
+		-(LONG) (Sub.SavedGprs.size( ) * SLOT_SIZE));
+
+	for (size_t i = Sub.SavedGprs.size( ); i != 0; i -= 1)
+		m_Asm.Pop( Sub.SavedGprs[ i - 1 ] );
+
+	m_Asm.Pop( X64Assembler::RBP );
+	m_Asm.Ret( );
+
+	//
+	// Emit the failure stubs that were referenced.
+	//
+
+	const struct
+	{
+		bool                   Used;
+		Label                  StubLabel;
+		NWSCRIPT_NATIVE_STATUS Status;
+	} Stubs[ ] =
+	{
+		{ Sub.CallDepthUsed,    Sub.CallDepthLabel,    NNS_CALL_DEPTH_EXCEEDED },
+		{ Sub.LoopLimitUsed,    Sub.LoopLimitLabel,    NNS_LOOP_LIMIT_EXCEEDED },
+		{ Sub.DivideByZeroUsed, Sub.DivideByZeroLabel, NNS_DIVIDE_BY_ZERO      },
+		{ Sub.OverflowUsed,     Sub.OverflowLabel,     NNS_QUOTIENT_OVERFLOW   }
+	};
+
+	for (size_t i = 0; i < sizeof( Stubs ) / sizeof( Stubs[ 0 ] ); i += 1)
+	{
+		if (!Stubs[ i ].Used)
+			continue;
+
+		m_Asm.BindLabel( Stubs[ i ].StubLabel );
+		m_Asm.MovMemImm32(
+			X64Assembler::R15,
+			(LONG) offsetof( NWSCRIPT_NATIVE_CONTEXT, Status ),
+			(ULONG) Stubs[ i ].Status);
+		m_Asm.Jmp( Sub.ExitLabel );
+	}
+}
+
+void
+NWScriptNativeCodeGenerator::GenerateFlow(
+	__inout SubroutineContext & Sub,
+	__in size_t FlowIndex
+	)
+/*++
+
+Routine Description:
+
+	This routine emits the code for a control flow, followed by the transfer
+	of control to its successor (if it does not simply fall through).
+
+Arguments:
+
+	Sub - Supplies the subroutine being generated.
+
+	FlowIndex - Supplies the index of the flow to generate.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	FlowInfo                               & Info = Sub.Flows[ FlowIndex ];
+	const std::list< NWScriptInstruction > & IR   = Info.Flow->GetIR( );
+
+	m_Asm.BindLabel( Info.FlowLabel );
+
+	Sub.TestInFlags = false;
+
+	for (std::list< NWScriptInstruction >::const_iterator it = IR.begin( );
+	     it != IR.end( );
+	     ++it)
+	{
+		const NWScriptInstruction * NextInstr = NULL;
+
+		//
+		// An I_TEST may leave its result in the flags if the next instruction
+		// that emits code is the conditional jump that consumes it.
+		//
+
+		if (it->GetType( ) == NWScriptInstruction::I_TEST)
+		{
+			std::list< NWScriptInstruction >::const_iterator NextIt = it;
+
+			for (++NextIt; NextIt != IR.end( ); ++NextIt)
+			{
+				if ((NextIt->GetType( ) != NWScriptInstruction::I_CREATE) &&
+				    (NextIt->GetType( ) != NWScriptInstruction::I_DELETE))
+				{
+					NextInstr = &*NextIt;
+					break;
+				}
+			}
+		}
+
+		GenerateInstruction( Sub, FlowIndex, *it, NextInstr );
+	}
+
+	switch (Info.Flow->GetTerminationType( ))
+	{
+
+		//
+		// This control flow exited the subroutine.
+		//
+
+	case NWScriptControlFlow::Terminate:
+		if ((IR.empty( )) || (IR.back( ).GetType( ) != NWScriptInstruction::I_RETN))
+			m_Asm.Jmp( Sub.ExitLabel );
+		break;
+
+		//
+		// This control flow merged to another, or is an unconditional jump.
+		//
+
+	case NWScriptControlFlow::Merge:
+	case NWScriptControlFlow::Transfer:
+		GenerateJump(
+			Sub,
+			FlowIndex,
+			LookupFlow( Sub, Info.Flow->GetChild( 0 )->GetStartPC( ) ));
+		break;
+
+		//
+		// This control flow split; the branch was taken by the conditional
+		// jump, so continue to the fallthrough flow.
+		//
+
+	case NWScriptControlFlow::Split:
+		GenerateJump(
+			Sub,
+			FlowIndex,
+			LookupFlow( Sub, Info.Flow->GetChild( 1 )->GetStartPC( ) ));
+		break;
+
+	default:
+		throw std::runtime_error( "Unsupported control flow termination type." );
+
+	}
+}
+
+void
+NWScriptNativeCodeGenerator::GenerateInstruction(
+	__inout SubroutineContext & Sub,
+	__in size_t FlowIndex,
+	__in const NWScriptInstruction & Instr,
+	__in_opt const NWScriptInstruction * NextInstr
+	)
+/*++
+
+Routine Description:
+
+	This routine lowers a single IR instruction to native code.
+
+Arguments:
+
+	Sub - Supplies the subroutine being generated.
+
+	FlowIndex - Supplies the index of the flow containing the instruction.
+
+	Instr - Supplies the instruction to lower.
+
+	NextInstr - Optionally supplies the next instruction in the flow that
+	            emits code.  This is only supplied for I_TEST.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	NWNScriptLib::VariableWeakPtrVec ReadVars;
+	NWNScriptLib::VariableWeakPtrVec WriteVars;
+
+	GetInstructionVariables( Instr, ReadVars, WriteVars );
+
+	switch (Instr.GetType( ))
+	{
+
+	case NWScriptInstruction::I_CREATE:     // Create variable with type (no value)
+		{
+			NWScriptVariable * Var = Instr.GetVar( 0 )->GetHeadVariable( );
+
+			//
+			// Variables have a fixed home for the duration of the subroutine,
+			// so creation only needs to be validated.
+			//
+
+			switch (Var->GetClass( ))
+			{
+
+			case NWScriptVariable::Global:
+				if (!(Sub.Flags & GSF_GLOBALS))
+					throw std::runtime_error( "Creating global variable outside of #globals." );
+				break;
+
+			case NWScriptVariable::Constant:
+			case NWScriptVariable::Local:
+			case NWScriptVariable::CallParameter:
+			case NWScriptVariable::CallReturnValue:
+				break;
+
+			default:
+				throw std::runtime_error( "Creating variable of illegal class with I_CREATE." );
+
+			}
+		}
+		break;
+
+	case NWScriptInstruction::I_DELETE:     // Delete variable
+		{
+			NWScriptVariable * Var = Instr.GetVar( 0 )->GetHeadVariable( );
+
+			switch (Var->GetClass( ))
+			{
+
+			case NWScriptVariable::Global:
+				if (!(Sub.Flags & GSF_GLOBALS))
+					throw std::runtime_error( "Deleting global variable outside of #globals." );
+				break;
+
+			case NWScriptVariable::Constant:
+			case NWScriptVariable::Parameter:
+			case NWScriptVariable::Local:
+			case NWScriptVariable::CallParameter:
+			case NWScriptVariable::CallReturnValue:
+				break;
+
+			default:
+				throw std::runtime_error( "Deleting variable of illegal class with I_DELETE." );
+
+			}
+		}
+		break;
+
+	case NWScriptInstruction::I_INITIALIZE: // Set variable to default value
+		GenerateSetDefaultValue( WriteVars[ 0 ] );
+		break;
+
+	case NWScriptInstruction::I_ASSIGN:     // Copy (assign) variables
+		for (size_t i = 0; i < ReadVars.size( ); i += 1)
+			GenerateAssign( WriteVars[ i ], ReadVars[ i ] );
+		break;
+
+	case NWScriptInstruction::I_JZ:         // Jump if zero
+	case NWScriptInstruction::I_JNZ:        // Jump if not zero
+		GenerateConditionalJump( Sub, FlowIndex, Instr );
+		break;
+
+	case NWScriptInstruction::I_JMP:        // Jump unconditionally [OBSOLETE]
+		//
+		// Handled by termination of the current flow.
+		//
+		break;
+
+	case NWScriptInstruction::I_CALL:       // Call subroutine
+		GenerateCall( Sub, Instr );
+		break;
+
+	case NWScriptInstruction::I_RETN:       // Return from subroutine
+		//
+		// Return values already live in the caller's argument area.
+		//
+		m_Asm.Jmp( Sub.ExitLabel );
+		break;
+
+	case NWScriptInstruction::I_ACTION:     // Call script action
+		GenerateAction( Sub, Instr );
+		break;
+
+	case NWScriptInstruction::I_SAVE_STATE: // Save state for script situation
+		GenerateSaveState( Sub, Instr );
+		break;
+
+	case NWScriptInstruction::I_LOGAND:     // Logical AND (&&)
+	case NWScriptInstruction::I_LOGOR:      // Logical OR (||)
+	case NWScriptInstruction::I_INCOR:      // Bitwise OR (|)
+	case NWScriptInstruction::I_EXCOR:      // Bitwise XOR (^)
+	case NWScriptInstruction::I_BOOLAND:    // Bitwise AND (&)
+	case NWScriptInstruction::I_SHLEFT:     // Shift left (<<)
+	case NWScriptInstruction::I_SHRIGHT:    // Shift signed right (>>, SAR)
+	case NWScriptInstruction::I_USHRIGHT:   // Shift unsigned right (>>)
+	case NWScriptInstruction::I_MOD:        // Modulus (%)
+		GenerateIntegerOperation( Sub, Instr, WriteVars[ 0 ], ReadVars[ 1 ], ReadVars[ 0 ] );
+		break;
+
+	case NWScriptInstruction::I_EQUAL:      // Compare (==)
+	case NWScriptInstruction::I_NEQUAL:     // Compare (!=)
+	case NWScriptInstruction::I_GEQ:        // Compare (>=)
+	case NWScriptInstruction::I_GT:         // Compare (>)
+	case NWScriptInstruction::I_LT:         // Compare (<)
+	case NWScriptInstruction::I_LEQ:        // Compare (<=)
+		GenerateCompare( Sub, Instr, WriteVars[ 0 ], ReadVars[ 1 ], ReadVars[ 0 ] );
+		break;
+
+	case NWScriptInstruction::I_ADD:        // Add (+), concatenate strings
+	case NWScriptInstruction::I_SUB:        // Subtract (-)
+	case NWScriptInstruction::I_MUL:        // Multiply (*)
+	case NWScriptInstruction::I_DIV:        // Divide (/)
+		{
+			NWScriptVariable * Result = WriteVars[ 0 ];
+			NWScriptVariable * Left   = ReadVars[ 1 ];
+			NWScriptVariable * Right  = ReadVars[ 0 ];
+			NWACTION_TYPE      LeftType;
+			NWACTION_TYPE      RightType;
+
+			LeftType  = GetVariableType( Left );
+			RightType = GetVariableType( Right );
+
+			if ((Instr.GetType( ) == NWScriptInstruction::I_ADD) &&
+			    ((LeftType == ACTIONTYPE_STRING) || (RightType == ACTIONTYPE_STRING)))
+			{
+				if ((LeftType != ACTIONTYPE_STRING) ||
+				    (RightType != ACTIONTYPE_STRING) ||
+				    (GetVariableType( Result ) != ACTIONTYPE_STRING))
+				{
+					throw std::runtime_error( "Type mismatch for string concatenate in IR." );
+				}
+
+				m_Asm.MovRegReg64( ArgumentRegisters[ 0 ], X64Assembler::R15 );
+				LoadGpr( ArgumentRegisters[ 1 ], Left );
+				LoadGpr( ArgumentRegisters[ 2 ], Right );
+				GenerateHelperCall( (const void *) &NWScriptNativeRuntime::ConcatenateStrings );
+				GenerateStatusCheck( Sub );
+				StoreGpr( Result, X64Assembler::RAX );
+			}
+			else if ((LeftType == ACTIONTYPE_FLOAT) || (RightType == ACTIONTYPE_FLOAT))
+			{
+				GenerateFloatOperation( Sub, Instr, Result, Left, Right );
+			}
+			else
+			{
+				GenerateIntegerOperation( Sub, Instr, Result, Left, Right );
+			}
+		}
+		break;
+
+	case NWScriptInstruction::I_NEG:        // Negation (-)
+	case NWScriptInstruction::I_COMP:       // Complement (~)
+	case NWScriptInstruction::I_NOT:        // Logical NOT (!)
+	case NWScriptInstruction::I_INC:        // Increment
+	case NWScriptInstruction::I_DEC:        // Decrement
+		GenerateUnaryOperation( Instr, WriteVars[ 0 ], ReadVars[ 0 ] );
+		break;
+
+	case NWScriptInstruction::I_TEST:       // Set zero/not zero based on variable value
+		{
+			NWScriptVariable   * Var = ReadVars[ 0 ];
+			const VariableHome & Home = GetHome( Var );
+
+			if (GetVariableType( Var ) != ACTIONTYPE_INT)
+				throw std::runtime_error( "Illegal operand type for I_TEST." );
+
+			if ((NextInstr != NULL) &&
+			    ((NextInstr->GetType( ) == NWScriptInstruction::I_JZ) ||
+			     (NextInstr->GetType( ) == NWScriptInstruction::I_JNZ)))
+			{
+				//
+				// Leave the result in the flags for the conditional jump.
+				//
+
+				if (Home.Kind == HK_GPR)
+				{
+					m_Asm.TestRegReg32( Home.Reg, Home.Reg );
+				}
+				else if (Home.Kind == HK_MEMORY)
+				{
+					m_Asm.AluMemImm32( X64Assembler::ALU_CMP, Home.Base, Home.Disp, 0 );
+				}
+				else
+				{
+					LoadGpr( X64Assembler::RAX, Var );
+					m_Asm.TestRegReg32( X64Assembler::RAX, X64Assembler::RAX );
+				}
+
+				Sub.TestInFlags = true;
+			}
+			else
+			{
+				LoadGpr( X64Assembler::RAX, Var );
+				m_Asm.MovMemReg32( X64Assembler::RBP, Sub.TestSlot, X64Assembler::RAX );
+
+				Sub.TestInFlags = false;
+			}
+		}
+		break;
+
+	default:
+		throw std::runtime_error( "Unsupported IR instruction for native code generation." );
+
+	}
+}
+
+void
+NWScriptNativeCodeGenerator::GenerateJump(
+	__inout SubroutineContext & Sub,
+	__in size_t FlowIndex,
+	__in size_t TargetIndex
+	)
+/*++
+
+Routine Description:
+
+	This routine transfers control from the end of a flow to another flow.  A
+	backward transfer charges the loop budget.  No jump is needed if the
+	target flow immediately follows.
+
+Arguments:
+
+	Sub - Supplies the subroutine being generated.
+
+	FlowIndex - Supplies the index of the flow being left.
+
+	TargetIndex - Supplies the index of the flow to transfer control to.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	const FlowInfo & Flow   = Sub.Flows[ FlowIndex ];
+	const FlowInfo & Target = Sub.Flows[ TargetIndex ];
+
+	if (Target.Flow->GetStartPC( ) < Flow.Flow->GetEndPC( ))
+		GenerateLoopCheck( Sub );
+
+	if (TargetIndex != FlowIndex + 1)
+		m_Asm.Jmp( Target.FlowLabel );
+}
+
+void
+NWScriptNativeCodeGenerator::GenerateConditionalJump(
+	__inout SubroutineContext & Sub,
+	__in size_t FlowIndex,
+	__in const NWScriptInstruction & Instr
+	)
+/*++
+
+Routine Description:
+
+	This routine lowers an I_JZ or I_JNZ instruction, which branches on the
+	value examined by the preceding I_TEST instruction.
+
+Arguments:
+
+	Sub - Supplies the subroutine being generated.
+
+	FlowIndex - Supplies the index of the flow containing the instruction.
+
+	Instr - Supplies the conditional jump instruction.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	const FlowInfo & Flow = Sub.Flows[ FlowIndex ];
+	size_t           TargetIndex;
+	CONDITION        Condition;
+
+	if (Instr.GetJumpTarget( ) == NULL)
+		throw std::runtime_error( "Conditional jump has no target." );
+
+	TargetIndex = LookupFlow( Sub, Instr.GetJumpTarget( )->GetControlFlow( )->GetStartPC( ) );
+
+	const FlowInfo & Target = Sub.Flows[ TargetIndex ];
+
+	if (!Sub.TestInFlags)
+		m_Asm.AluMemImm32( X64Assembler::ALU_CMP, X64Assembler::RBP, Sub.TestSlot, 0 );
+
+	Sub.TestInFlags = false;
+
+	Condition = (Instr.GetType( ) == NWScriptInstruction::I_JZ) ? X64Assembler::CC_E : X64Assembler::CC_NE;
+
+	if ((GuardsEnabled( )) &&
+	    (Target.Flow->GetStartPC( ) < Flow.Flow->GetEndPC( )))
+	{
+		Label Skip = m_Asm.CreateLabel( );
+
+		//
+		// Backward branch; charge the loop budget on the taken path only.
+		//
+
+		m_Asm.Jcc(
+			(Condition == X64Assembler::CC_E) ? X64Assembler::CC_NE : X64Assembler::CC_E,
+			Skip);
+		GenerateLoopCheck( Sub );
+		m_Asm.Jmp( Target.FlowLabel );
+		m_Asm.BindLabel( Skip );
+	}
+	else
+	{
+		m_Asm.Jcc( Condition, Target.FlowLabel );
+	}
+}
+
+void
+NWScriptNativeCodeGenerator::GenerateLoopCheck(
+	__inout SubroutineContext & Sub
+	)
+/*++
+
+Routine Description:
+
+	This routine charges one iteration against the loop budget of the
+	execution, leaving the subroutine if the budget has been exhausted.
+
+Arguments:
+
+	Sub - Supplies the subroutine being generated.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	if (!GuardsEnabled( ))
+		return;
+
+	m_Asm.AluMemImm32(
+		X64Assembler::ALU_SUB,
+		X64Assembler::R15,
+		(LONG) offsetof( NWSCRIPT_NATIVE_CONTEXT, LoopBudget ),
+		1);
+	m_Asm.Jcc( X64Assembler::CC_L, Sub.LoopLimitLabel );
+
+	Sub.LoopLimitUsed = true;
+}
+
+void
+NWScriptNativeCodeGenerator::GenerateStatusCheck(
+	__inout SubroutineContext & Sub
+	)
+/*++
+
+Routine Description:
+
+	This routine leaves the subroutine if the execution status indicates a
+	failure, following a call that may fail.
+
+Arguments:
+
+	Sub - Supplies the subroutine being generated.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	m_Asm.AluMemImm32(
+		X64Assembler::ALU_CMP,
+		X64Assembler::R15,
+		(LONG) offsetof( NWSCRIPT_NATIVE_CONTEXT, Status ),
+		NNS_SUCCESS);
+	m_Asm.Jcc( X64Assembler::CC_NE, Sub.ExitLabel );
+}
+
+void
+NWScriptNativeCodeGenerator::GenerateAssign(
+	__in NWScriptVariable * Dst,
+	__in NWScriptVariable * Src
+	)
+/*++
+
+Routine Description:
+
+	This routine copies the value of one variable to another.
+
+Arguments:
+
+	Dst - Supplies the variable to assign to.
+
+	Src - Supplies the variable to assign from.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	const VariableHome & DstHome = GetHome( Dst );
+	const VariableHome & SrcHome = GetHome( Src );
+
+	if (DstHome.Type != SrcHome.Type)
+		throw std::runtime_error( "Assigning variables of incompatible types." );
+
+	if (&DstHome == &SrcHome)
+		return;
+
+	if (DstHome.Kind == HK_XMM)
+	{
+		LoadXmm( DstHome.Xmm, Src );
+	}
+	else if (DstHome.Kind == HK_GPR)
+	{
+		LoadGpr( DstHome.Reg, Src );
+	}
+	else if (SrcHome.Kind == HK_GPR)
+	{
+		StoreGpr( Dst, SrcHome.Reg );
+	}
+	else if (SrcHome.Kind == HK_XMM)
+	{
+		StoreXmm( Dst, SrcHome.Xmm );
+	}
+	else
+	{
+		LoadGpr( X64Assembler::RAX, Src );
+		StoreGpr( Dst, X64Assembler::RAX );
+	}
+}
+
+void
+NWScriptNativeCodeGenerator::GenerateSetDefaultValue(
+	__in NWScriptVariable * Var
+	)
+/*++
+
+Routine Description:
+
+	This routine assigns a variable the default value of its type.  Engine
+	structures default to a not yet created structure, which the runtime
+	creates on first use.
+
+Arguments:
+
+	Var - Supplies the variable to initialize.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	const VariableHome & Home = GetHome( Var );
+	ULONG                Value;
+
+	Value = (Home.Type == ACTIONTYPE_OBJECT) ? (ULONG) m_ObjectInvalid : 0;
+
+	switch (Home.Kind)
+	{
+
+	case HK_GPR:
+		m_Asm.MovRegImm32( Home.Reg, Value );
+		break;
+
+	case HK_XMM:
+		m_Asm.MovRegImm32( X64Assembler::RAX, Value );
+		m_Asm.MovdXmmReg32( Home.Xmm, X64Assembler::RAX );
+		break;
+
+	case HK_MEMORY:
+		if (NWScriptNativeRuntime::IsPointerType( Home.Type ))
+			m_Asm.MovMemImm64( Home.Base, Home.Disp, 0 );
+		else
+			m_Asm.MovMemImm32( Home.Base, Home.Disp, Value );
+		break;
+
+	default:
+		throw std::runtime_error( "Initializing a constant variable." );
+
+	}
+}
+
+void
+NWScriptNativeCodeGenerator::GenerateCompare(
+	__inout SubroutineContext & Sub,
+	__in const NWScriptInstruction & Instr,
+	__in NWScriptVariable * Result,
+	__in NWScriptVariable * Left,
+	__in NWScriptVariable * Right
+	)
+/*++
+
+Routine Description:
+
+	This routine lowers a comparison instruction.  The result is an integer
+	that takes logic 1 or logic 0.
+
+	As with the MSIL backend, >= and <= are implemented as the negation of <
+	and >, so an unordered float comparison satisfies both.
+
+Arguments:
+
+	Sub - Supplies the subroutine being generated.
+
+	Instr - Supplies the comparison instruction.
+
+	Result - Supplies the variable that receives the result.
+
+	Left - Supplies the left operand.
+
+	Right - Supplies the right operand.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	NWScriptInstruction::INSTR Op   = Instr.GetType( );
+	NWACTION_TYPE              Type = GetVariableType( Left );
+	bool                       Equality;
+
+	if (Type != GetVariableType( Right ))
+		throw std::runtime_error( "Comparing variables of incompatible types." );
+	else if (GetVariableType( Result ) != ACTIONTYPE_INT)
+		throw std::runtime_error( "Result type mismatch for comparison." );
+
+	Equality = (Op == NWScriptInstruction::I_EQUAL) || (Op == NWScriptInstruction::I_NEQUAL);
+
+	switch (Type)
+	{
+
+	case ACTIONTYPE_INT:
+	case ACTIONTYPE_OBJECT:
+		{
+			CONDITION Condition;
+
+			if ((Type == ACTIONTYPE_OBJECT) && (!Equality))
+				throw std::runtime_error( "Illegal comparison opcode for 'object'." );
+
+			switch (Op)
+			{
+			case NWScriptInstruction::I_EQUAL:  Condition = X64Assembler::CC_E;  break;
+			case NWScriptInstruction::I_NEQUAL: Condition = X64Assembler::CC_NE; break;
+			case NWScriptInstruction::I_GEQ:    Condition = X64Assembler::CC_GE; break;
+			case NWScriptInstruction::I_GT:     Condition = X64Assembler::CC_G;  break;
+			case NWScriptInstruction::I_LT:     Condition = X64Assembler::CC_L;  break;
+			case NWScriptInstruction::I_LEQ:    Condition = X64Assembler::CC_LE; break;
+			default:
+				throw std::runtime_error( "Illegal comparison opcode." );
+			}
+
+			LoadGpr( X64Assembler::RAX, Left );
+			LoadGpr( X64Assembler::RCX, Right );
+			m_Asm.AluRegReg32( X64Assembler::ALU_CMP, X64Assembler::RAX, X64Assembler::RCX );
+			m_Asm.Setcc( Condition, X64Assembler::RAX );
+			m_Asm.MovzxRegReg8( X64Assembler::RAX, X64Assembler::RAX );
+		}
+		break;
+
+	case ACTIONTYPE_FLOAT:
+		{
+			LoadXmm( X64Assembler::XMM0, Left );
+			LoadXmm( X64Assembler::XMM1, Right );
+
+			switch (Op)
+			{
+
+			case NWScriptInstruction::I_EQUAL:
+				m_Asm.UcomissRegReg( X64Assembler::XMM0, X64Assembler::XMM1 );
+				m_Asm.Setcc( X64Assembler::CC_E, X64Assembler::RAX );
+				m_Asm.Setcc( X64Assembler::CC_NP, X64Assembler::RCX );
+				m_Asm.AluRegReg32( X64Assembler::ALU_AND, X64Assembler::RAX, X64Assembler::RCX );
+				break;
+
+			case NWScriptInstruction::I_NEQUAL:
+				m_Asm.UcomissRegReg( X64Assembler::XMM0, X64Assembler::XMM1 );
+				m_Asm.Setcc( X64Assembler::CC_NE, X64Assembler::RAX );
+				m_Asm.Setcc( X64Assembler::CC_P, X64Assembler::RCX );
+				m_Asm.AluRegReg32( X64Assembler::ALU_OR, X64Assembler::RAX, X64Assembler::RCX );
+				break;
+
+			case NWScriptInstruction::I_GT:
+				m_Asm.UcomissRegReg( X64Assembler::XMM0, X64Assembler::XMM1 );
+				m_Asm.Setcc( X64Assembler::CC_A, X64Assembler::RAX );
+				break;
+
+			case NWScriptInstruction::I_LT:
+				m_Asm.UcomissRegReg( X64Assembler::XMM1, X64Assembler::XMM0 );
+				m_Asm.Setcc( X64Assembler::CC_A, X64Assembler::RAX );
+				break;
+
+			case NWScriptInstruction::I_GEQ:
+				m_Asm.UcomissRegReg( X64Assembler::XMM1, X64Assembler::XMM0 );
+				m_Asm.Setcc( X64Assembler::CC_BE, X64Assembler::RAX );
+				break;
+
+			case NWScriptInstruction::I_LEQ:
+				m_Asm.UcomissRegReg( X64Assembler::XMM0, X64Assembler::XMM1 );
+				m_Asm.Setcc( X64Assembler::CC_BE, X64Assembler::RAX );
+				break;
+
+			default:
+				throw std::runtime_error( "Illegal comparison opcode." );
+
+			}
+
+			m_Asm.MovzxRegReg8( X64Assembler::RAX, X64Assembler::RAX );
+		}
+		break;
+
+	case ACTIONTYPE_STRING:
+		{
+			if (!Equality)
+				throw std::runtime_error( "Illegal comparison opcode for 'string'." );
+
+			LoadGpr( ArgumentRegisters[ 0 ], Left );
+			LoadGpr( ArgumentRegisters[ 1 ], Right );
+			GenerateHelperCall( (const void *) &NWScriptNativeRuntime::CompareStrings );
+
+			if (Op == NWScriptInstruction::I_NEQUAL)
+				m_Asm.AluRegImm32( X64Assembler::ALU_XOR, X64Assembler::RAX, 1 );
+		}
+		break;
+
+	default:
+		{
+			if (!NWScriptNativeRuntime::IsEngineType( Type ))
+				throw std::runtime_error( "Comparing equality of unknown typed variable." );
+			else if (!Equality)
+				throw std::runtime_error( "Illegal comparison opcode for engine structure." );
+
+			m_Asm.MovRegReg64( ArgumentRegisters[ 0 ], X64Assembler::R15 );
+			m_Asm.MovRegImm32( ArgumentRegisters[ 1 ], (ULONG) Type );
+			LoadGpr( ArgumentRegisters[ 2 ], Left );
+			LoadGpr( ArgumentRegisters[ 3 ], Right );
+			GenerateHelperCall( (const void *) &NWScriptNativeRuntime::CompareEngineStructures );
+			GenerateStatusCheck( Sub );
+
+			if (Op == NWScriptInstruction::I_NEQUAL)
+				m_Asm.AluRegImm32( X64Assembler::ALU_XOR, X64Assembler::RAX, 1 );
+		}
+		break;
+
+	}
+
+	StoreGpr( Result, X64Assembler::RAX );
+}
+
+void
+NWScriptNativeCodeGenerator::GenerateIntegerOperation(
+	__inout SubroutineContext & Sub,
+	__in const NWScriptInstruction & Instr,
+	__in NWScriptVariable * Result,
+	__in NWScriptVariable * Left,
+	__in NWScriptVariable * Right
+	)
+/*++
+
+Routine Description:
+
+	This routine lowers a binary integer operation.  The left operand is
+	loaded into EAX and the right operand into ECX.
+
+	Division and modulus raise a failure status on a zero divisor, and on the
+	one quotient (INT_MIN / -1) that cannot be represented.
+
+Arguments:
+
+	Sub - Supplies the subroutine being generated.
+
+	Instr - Supplies the instruction.
+
+	Result - Supplies the variable that receives the result.
+
+	Left - Supplies the left operand.
+
+	Right - Supplies the right operand.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	if ((GetVariableType( Left ) != ACTIONTYPE_INT) ||
+	    (GetVariableType( Right ) != ACTIONTYPE_INT))
+	{
+		throw std::runtime_error( "Illegal operand type for integer operation." );
+	}
+	else if (GetVariableType( Result ) != ACTIONTYPE_INT)
+	{
+		throw std::runtime_error( "Result type mismatch for integer operation." );
+	}
+
+	LoadGpr( X64Assembler::RAX, Left );
+	LoadGpr( X64Assembler::RCX, Right );
+
+	switch (Instr.GetType( ))
+	{
+
+	case NWScriptInstruction::I_ADD:
+		m_Asm.AluRegReg32( X64Assembler::ALU_ADD, X64Assembler::RAX, X64Assembler::RCX );
+		break;
+
+	case NWScriptInstruction::I_SUB:
+		m_Asm.AluRegReg32( X64Assembler::ALU_SUB, X64Assembler::RAX, X64Assembler::RCX );
+		break;
+
+	case NWScriptInstruction::I_MUL:
+		m_Asm.ImulRegReg32( X64Assembler::RAX, X64Assembler::RCX );
+		break;
+
+	case NWScriptInstruction::I_DIV:
+	case NWScriptInstruction::I_MOD:
+		{
+			Label Divide = m_Asm.CreateLabel( );
+
+			m_Asm.TestRegReg32( X64Assembler::RCX, X64Assembler::RCX );
+			m_Asm.Jcc( X64Assembler::CC_E, Sub.DivideByZeroLabel );
+			m_Asm.AluRegImm32( X64Assembler::ALU_CMP, X64Assembler::RCX, -1 );
+			m_Asm.Jcc( X64Assembler::CC_NE, Divide );
+			m_Asm.AluRegImm32( X64Assembler::ALU_CMP, X64Assembler::RAX, (LONG) INT_MIN );
+			m_Asm.Jcc( X64Assembler::CC_E, Sub.OverflowLabel );
+			m_Asm.BindLabel( Divide );
+			m_Asm.Cdq( );
+			m_Asm.IdivReg32( X64Assembler::RCX );
+
+			if (Instr.GetType( ) == NWScriptInstruction::I_MOD)
+				m_Asm.MovRegReg32( X64Assembler::RAX, X64Assembler::RDX );
+
+			Sub.DivideByZeroUsed = true;
+			Sub.OverflowUsed     = true;
+		}
+		break;
+
+	case NWScriptInstruction::I_INCOR:
+		m_Asm.AluRegReg32( X64Assembler::ALU_OR, X64Assembler::RAX, X64Assembler::RCX );
+		break;
+
+	case NWScriptInstruction::I_EXCOR:
+		m_Asm.AluRegReg32( X64Assembler::ALU_XOR, X64Assembler::RAX, X64Assembler::RCX );
+		break;
+
+	case NWScriptInstruction::I_BOOLAND:
+		m_Asm.AluRegReg32( X64Assembler::ALU_AND, X64Assembler::RAX, X64Assembler::RCX );
+		break;
+
+	case NWScriptInstruction::I_LOGAND:
+		m_Asm.TestRegReg32( X64Assembler::RAX, X64Assembler::RAX );
+		m_Asm.Setcc( X64Assembler::CC_NE, X64Assembler::RAX );
+		m_Asm.TestRegReg32( X64Assembler::RCX, X64Assembler::RCX );
+		m_Asm.Setcc( X64Assembler::CC_NE, X64Assembler::RCX );
+		m_Asm.AluRegReg32( X64Assembler::ALU_AND, X64Assembler::RAX, X64Assembler::RCX );
+		m_Asm.MovzxRegReg8( X64Assembler::RAX, X64Assembler::RAX );
+		break;
+
+	case NWScriptInstruction::I_LOGOR:
+		m_Asm.AluRegReg32( X64Assembler::ALU_OR, X64Assembler::RAX, X64Assembler::RCX );
+		m_Asm.Setcc( X64Assembler::CC_NE, X64Assembler::RAX );
+		m_Asm.MovzxRegReg8( X64Assembler::RAX, X64Assembler::RAX );
+		break;
+
+	case NWScriptInstruction::I_SHLEFT:
+		m_Asm.ShiftRegCl32( X64Assembler::SHIFT_SHL, X64Assembler::RAX );
+		break;
+
+	case NWScriptInstruction::I_USHRIGHT:
+		//
+		// N.B.  As in the script VM, this is an arithmetic shift.
+		//
+		m_Asm.ShiftRegCl32( X64Assembler::SHIFT_SAR, X64Assembler::RAX );
+		break;
+
+	case NWScriptInstruction::I_SHRIGHT:
+		{
+			Label Positive = m_Asm.CreateLabel( );
+			Label Done     = m_Asm.CreateLabel( );
+
+			//
+			// A negative amount is negated, shifted, and negated again, as the
+			// script VM does.
+			//
+
+			m_Asm.TestRegReg32( X64Assembler::RAX, X64Assembler::RAX );
+			m_Asm.Jcc( X64Assembler::CC_NS, Positive );
+			m_Asm.NegReg32( X64Assembler::RAX );
+			m_Asm.ShiftRegCl32( X64Assembler::SHIFT_SAR, X64Assembler::RAX );
+			m_Asm.NegReg32( X64Assembler::RAX );
+			m_Asm.Jmp( Done );
+			m_Asm.BindLabel( Positive );
+			m_Asm.ShiftRegCl32( X64Assembler::SHIFT_SAR, X64Assembler::RAX );
+			m_Asm.BindLabel( Done );
+		}
+		break;
+
+	default:
+		throw std::runtime_error( "Illegal integer operation." );
+
+	}
+
+	StoreGpr( Result, X64Assembler::RAX );
+}
+
+void
+NWScriptNativeCodeGenerator::GenerateFloatOperation(
+	__inout SubroutineContext & Sub,
+	__in const NWScriptInstruction & Instr,
+	__in NWScriptVariable * Result,
+	__in NWScriptVariable * Left,
+	__in NWScriptVariable * Right
+	)
+/*++
+
+Routine Description:
+
+	This routine lowers a binary arithmetic operation with at least one float
+	operand.  An integer operand is converted to float first.
+
+	As in the script VM, division by zero raises a failure status.
+
+Arguments:
+
+	Sub - Supplies the subroutine being generated.
+
+	Instr - Supplies the instruction.
+
+	Result - Supplies the variable that receives the result.
+
+	Left - Supplies the left operand.
+
+	Right - Supplies the right operand.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	NWScriptVariable * Operands[ 2 ] = { Left, Right };
+	X64Assembler::SSE_OP Op;
+
+	if (GetVariableType( Result ) != ACTIONTYPE_FLOAT)
+		throw std::runtime_error( "Result type mismatch for UpcastBinaryOp." );
+
+	switch (Instr.GetType( ))
+	{
+	case NWScriptInstruction::I_ADD: Op = X64Assembler::SSE_ADD; break;
+	case NWScriptInstruction::I_SUB: Op = X64Assembler::SSE_SUB; break;
+	case NWScriptInstruction::I_MUL: Op = X64Assembler::SSE_MUL; break;
+	case NWScriptInstruction::I_DIV: Op = X64Assembler::SSE_DIV; break;
+	default:
+		throw std::runtime_error( "Illegal floating point operation." );
+	}
+
+	for (size_t i = 0; i < 2; i += 1)
+	{
+		XMM Dst = (i == 0) ? X64Assembler::XMM0 : X64Assembler::XMM1;
+
+		switch (GetVariableType( Operands[ i ] ))
+		{
+
+		case ACTIONTYPE_FLOAT:
+			LoadXmm( Dst, Operands[ i ] );
+			break;
+
+		case ACTIONTYPE_INT:
+			LoadGpr( X64Assembler::RAX, Operands[ i ] );
+			m_Asm.Cvtsi2ssRegReg32( Dst, X64Assembler::RAX );
+			break;
+
+		default:
+			throw std::runtime_error( "Illegal operand type for floating point operation." );
+
+		}
+	}
+
+	if (Op == X64Assembler::SSE_DIV)
+	{
+		m_Asm.MovdRegXmm32( X64Assembler::RAX, X64Assembler::XMM1 );
+		m_Asm.AluRegImm32( X64Assembler::ALU_AND, X64Assembler::RAX, 0x7FFFFFFF );
+		m_Asm.Jcc( X64Assembler::CC_E, Sub.DivideByZeroLabel );
+
+		Sub.DivideByZeroUsed = true;
+	}
+
+	m_Asm.SseRegReg( Op, X64Assembler::XMM0, X64Assembler::XMM1 );
+
+	StoreXmm( Result, X64Assembler::XMM0 );
+}
+
+void
+NWScriptNativeCodeGenerator::GenerateUnaryOperation(
+	__in const NWScriptInstruction & Instr,
+	__in NWScriptVariable * Result,
+	__in NWScriptVariable * Operand
+	)
+/*++
+
+Routine Description:
+
+	This routine lowers a unary operation (negation, complement, logical not,
+	increment or decrement).
+
+Arguments:
+
+	Instr - Supplies the instruction.
+
+	Result - Supplies the variable that receives the result.
+
+	Operand - Supplies the operand.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	NWACTION_TYPE Type = GetVariableType( Operand );
+
+	if (GetVariableType( Result ) != Type)
+		throw std::runtime_error( "Result type mismatch for unary operation." );
+
+	if ((Type == ACTIONTYPE_FLOAT) && (Instr.GetType( ) == NWScriptInstruction::I_NEG))
+	{
+		//
+		// Negate a float by flipping its sign bit.
+		//
+
+		LoadGpr( X64Assembler::RAX, Operand );
+		m_Asm.AluRegImm32( X64Assembler::ALU_XOR, X64Assembler::RAX, (LONG) INT_MIN );
+		StoreGpr( Result, X64Assembler::RAX );
+		return;
+	}
+	else if (Type != ACTIONTYPE_INT)
+	{
+		throw std::runtime_error( "Illegal operand type for unary operation." );
+	}
+
+	LoadGpr( X64Assembler::RAX, Operand );
+
+	switch (Instr.GetType( ))
+	{
+
+	case NWScriptInstruction::I_NEG:
+		m_Asm.NegReg32( X64Assembler::RAX );
+		break;
+
+	case NWScriptInstruction::I_COMP:
+		m_Asm.NotReg32( X64Assembler::RAX );
+		break;
+
+	case NWScriptInstruction::I_NOT:
+		m_Asm.TestRegReg32( X64Assembler::RAX, X64Assembler::RAX );
+		m_Asm.Setcc( X64Assembler::CC_E, X64Assembler::RAX );
+		m_Asm.MovzxRegReg8( X64Assembler::RAX, X64Assembler::RAX );
+		break;
+
+	case NWScriptInstruction::I_INC:
+		m_Asm.AluRegImm32( X64Assembler::ALU_ADD, X64Assembler::RAX, 1 );
+		break;
+
+	case NWScriptInstruction::I_DEC:
+		m_Asm.AluRegImm32( X64Assembler::ALU_SUB, X64Assembler::RAX, 1 );
+		break;
+
+	default:
+		throw std::runtime_error( "Illegal unary operation." );
+
+	}
+
+	StoreGpr( Result, X64Assembler::RAX );
+}
+
+void
+NWScriptNativeCodeGenerator::GenerateCall(
+	__inout SubroutineContext & Sub,
+	__in const NWScriptInstruction & Instr
+	)
+/*++
+
+Routine Description:
+
+	This routine lowers a subroutine call.  The callee's return value slots and
+	parameter slots are placed at the bottom of the frame, and the return
+	values are copied out once the callee returns successfully.
+
+Arguments:
+
+	Sub - Supplies the subroutine being generated.
+
+	Instr - Supplies the I_CALL instruction.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	static const NWNScriptLib::VariableWeakPtrVec EmptyList;
+
+	const NWNScriptLib::VariableWeakPtrVec           & ParamList = (Instr.GetParamVarList( ) != NULL) ? *Instr.GetParamVarList( ) : EmptyList;
+	NWScriptSubroutine                               * CalledSub = Instr.GetSubroutine( );
+	size_t                                             ParamCount;
+	size_t                                             ReturnCount;
+	std::map< PROGRAM_COUNTER, Label >::const_iterator Target;
+
+	ParamCount  = CalledSub->GetParameters( ).size( );
+	ReturnCount = CalledSub->GetNumReturnTypes( );
+
+	if (IsIgnoredCallInstr( Sub, CalledSub ))
+	{
+		//
+		// The call from #globals to the entry point is not made; the program
+		// invokes the entry point itself once #globals returns.
+		//
+		// N.B.  For ignored call sites, only the parameter list in the
+		//       instruction itself is used, as it is permitted to mismatch
+		//       with the prototype of the target.
+		//
+
+		for (size_t i = 0; i < ReturnCount; i += 1)
+			GenerateSetDefaultValue( ParamList.at( i ) );
+
+		return;
+	}
+
+	if (ReturnCount + ParamCount != ParamList.size( ))
+		throw std::runtime_error( "Subroutine call parameter list size is inconsistent." );
+
+	if ((Target = m_SubroutineLabels.find( CalledSub->GetAddress( ) )) == m_SubroutineLabels.end( ))
+		throw std::runtime_error( "Call to unknown subroutine." );
+
+	for (size_t i = 0; i < ParamCount; i += 1)
+	{
+		NWACTION_TYPE ParamType = CalledSub->GetParameterVariable( i ).GetHeadVariable( )->GetType( );
+
+		if ((ParamType != ACTIONTYPE_VOID) &&
+		    (ParamType != GetVariableType( ParamList[ ReturnCount + i ] )))
+		{
+			throw std::runtime_error( "Subroutine call parameter type mismatch." );
+		}
+
+		LoadGpr( X64Assembler::RAX, ParamList[ ReturnCount + i ] );
+		m_Asm.MovMemReg64(
+			X64Assembler::RSP,
+			(LONG) ((ReturnCount + i) * SLOT_SIZE),
+			X64Assembler::RAX);
+	}
+
+	for (size_t i = 0; i < ReturnCount; i += 1)
+	{
+		if (CalledSub->GetReturnTypes( )[ i ] != GetVariableType( ParamList[ i ] ))
+			throw std::runtime_error( "Subroutine call return type mismatch." );
+
+		m_Asm.MovMemImm64( X64Assembler::RSP, (LONG) (i * SLOT_SIZE), 0 );
+	}
+
+	m_Asm.Call( Target->second );
+
+	GenerateStatusCheck( Sub );
+
+	for (size_t i = 0; i < ReturnCount; i += 1)
+	{
+		m_Asm.MovRegMem64( X64Assembler::RAX, X64Assembler::RSP, (LONG) (i * SLOT_SIZE) );
+		StoreGpr( ParamList[ i ], X64Assembler::RAX );
+	}
+}
+
+void
+NWScriptNativeCodeGenerator::GenerateAction(
+	__inout SubroutineContext & Sub,
+	__in const NWScriptInstruction & Instr
+	)
+/*++
+
+Routine Description:
+
+	This routine lowers an action service call.  A call site descriptor is
+	created for the runtime, the parameters are staged, and the runtime
+	invokes the action service handler (through the fast action interface
+	unless an engine structure is involved).
+
+Arguments:
+
+	Sub - Supplies the subroutine being generated.
+
+	Instr - Supplies the I_ACTION instruction.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	static const NWNScriptLib::VariableWeakPtrVec EmptyList;
+
+	const NWNScriptLib::VariableWeakPtrVec & ParamList = (Instr.GetParamVarList( ) != NULL) ? *Instr.GetParamVarList( ) : EmptyList;
+	NWSCRIPT_ACTION                          CalledActionId;
+	size_t                                   ParamCount;
+	PCNWACTION_DEFINITION                    CalledAction;
+	NWACTION_TYPE                            ReturnTypes[ 3 ];
+	size_t                                   ReturnCount;
+	NWScriptNativeRuntime::ActionSite      * Site;
+
+	CalledActionId = (NWSCRIPT_ACTION) Instr.GetActionIndex( );
+	ParamCount     = (size_t) Instr.GetActionParameterCount( );
+
+	if (CalledActionId >= m_ActionCount)
+		throw std::runtime_error( "Invoked out of range action." );
+
+	CalledAction = &m_ActionDefs[ CalledActionId ];
+
+	if (ParamCount < CalledAction->MinParameters)
+		throw std::runtime_error( "Invoked action with too few parameters." );
+	else if (ParamCount > CalledAction->NumParameters)
+		throw std::runtime_error( "Invoked action with too many parameters." );
+
+	ReturnTypes[ 0 ] = CalledAction->ReturnType;
+
+	switch (ReturnTypes[ 0 ])
+	{
+
+	case ACTIONTYPE_VECTOR:
+		ReturnCount      = 3;
+		ReturnTypes[ 0 ] = ACTIONTYPE_FLOAT;
+		ReturnTypes[ 1 ] = ACTIONTYPE_FLOAT;
+		ReturnTypes[ 2 ] = ACTIONTYPE_FLOAT;
+		break;
+
+	case ACTIONTYPE_VOID:
+		ReturnCount = 0;
+		break;
+
+	default:
+		ReturnCount = 1;
+		break;
+
+	}
+
+	if (ReturnCount > ParamList.size( ))
+		throw std::runtime_error( "Return count exceeds real action parameter list size." );
+
+	//
+	// Describe the call site.
+	//
+
+	m_Module->ActionSites.push_back( NWScriptNativeRuntime::ActionSite( ) );
+
+	Site = &m_Module->ActionSites.back( );
+
+	Site->ActionId       = CalledActionId;
+	Site->NumArguments   = ParamCount;
+	Site->NumReturnCells = ReturnCount;
+	Site->Fast           = (ParamList.size( ) <= NWScriptNativeRuntime::MAX_FAST_ACTION_CELLS);
+
+	Site->Types.resize( ParamList.size( ) );
+
+	for (size_t i = 0; i < ParamList.size( ); i += 1)
+	{
+		NWACTION_TYPE Type = GetVariableType( ParamList[ i ] );
+
+		if ((i < ReturnCount) && (Type != ReturnTypes[ i ]))
+			throw std::runtime_error( "Return type mismatch for action service routine invocation." );
+
+		if (NWScriptNativeRuntime::IsEngineType( Type ))
+			Site->Fast = false;
+
+		Site->Types[ i ] = Type;
+	}
+
+	if (Site->Fast)
+	{
+		//
+		// Parameters are pushed from the last cell down to the first, and
+		// return values are popped from the last cell down to the first, just
+		// as they would be on the VM stack.
+		//
+
+		for (size_t i = ParamList.size( ); i != ReturnCount; i -= 1)
+		{
+			switch (Site->Types[ i - 1 ])
+			{
+			case ACTIONTYPE_INT:    Site->Cmds.push_back( NWFASTACTION_PUSHINT );      break;
+			case ACTIONTYPE_FLOAT:  Site->Cmds.push_back( NWFASTACTION_PUSHFLOAT );    break;
+			case ACTIONTYPE_OBJECT: Site->Cmds.push_back( NWFASTACTION_PUSHOBJECTID ); break;
+			case ACTIONTYPE_STRING: Site->Cmds.push_back( NWFASTACTION_PUSHSTRING );   break;
+			default:
+				throw std::runtime_error( "Illegal type for fast action service parameter." );
+			}
+		}
+
+		Site->Cmds.push_back( NWFASTACTION_CALL );
+
+		for (size_t i = ReturnCount; i != 0; i -= 1)
+		{
+			switch (Site->Types[ i - 1 ])
+			{
+			case ACTIONTYPE_INT:    Site->Cmds.push_back( NWFASTACTION_POPINT );      break;
+			case ACTIONTYPE_FLOAT:  Site->Cmds.push_back( NWFASTACTION_POPFLOAT );    break;
+			case ACTIONTYPE_OBJECT: Site->Cmds.push_back( NWFASTACTION_POPOBJECTID ); break;
+			case ACTIONTYPE_STRING: Site->Cmds.push_back( NWFASTACTION_POPSTRING );   break;
+			default:
+				throw std::runtime_error( "Illegal type for fast action service return value." );
+			}
+		}
+	}
+
+	//
+	// Stage the parameters, call the runtime, and unstage the return values.
+	//
+
+	for (size_t i = ReturnCount; i < ParamList.size( ); i += 1)
+	{
+		LoadGpr( X64Assembler::RAX, ParamList[ i ] );
+		m_Asm.MovMemReg64(
+			X64Assembler::RSP,
+			(LONG) (SHADOW_SPACE_SIZE + i * SLOT_SIZE),
+			X64Assembler::RAX);
+	}
+
+	m_Asm.MovRegReg64( ArgumentRegisters[ 0 ], X64Assembler::R15 );
+	m_Asm.MovRegImm64( ArgumentRegisters[ 1 ], (ULONG64) (ULONG_PTR) Site );
+	m_Asm.LeaRegMem64( ArgumentRegisters[ 2 ], X64Assembler::RSP, SHADOW_SPACE_SIZE );
+	GenerateHelperCall( (const void *) &NWScriptNativeRuntime::ExecuteAction );
+	GenerateStatusCheck( Sub );
+
+	for (size_t i = 0; i < ReturnCount; i += 1)
+	{
+		m_Asm.MovRegMem64(
+			X64Assembler::RAX,
+			X64Assembler::RSP,
+			(LONG) (SHADOW_SPACE_SIZE + i * SLOT_SIZE));
+		StoreGpr( ParamList[ i ], X64Assembler::RAX );
+	}
+}
+
+void
+NWScriptNativeCodeGenerator::GenerateSaveState(
+	__inout SubroutineContext & Sub,
+	__in const NWScriptInstruction & Instr
+	)
+/*++
+
+Routine Description:
+
+	This routine lowers a SAVE_STATE instruction.  The saved globals and locals
+	are staged and the runtime captures them into a saved state that may later
+	be resumed at the script situation subroutine.
+
+Arguments:
+
+	Sub - Supplies the subroutine being generated.
+
+	Instr - Supplies the I_SAVE_STATE instruction.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	static const NWNScriptLib::VariableWeakPtrVec EmptyList;
+
+	const NWNScriptLib::VariableWeakPtrVec           & ParamList = (Instr.GetParamVarList( ) != NULL) ? *Instr.GetParamVarList( ) : EmptyList;
+	NWScriptSubroutine                               * ResumeSub = Instr.GetSubroutine( );
+	size_t                                             NumGlobals;
+	std::map< PROGRAM_COUNTER, ULONG >::const_iterator ResumeIt;
+	NWScriptNativeRuntime::SaveSite                  * Site;
+
+	NumGlobals = (size_t) Instr.GetStateNumGlobals( );
+
+	if (NumGlobals > ParamList.size( ))
+		throw std::runtime_error( "Saved global count exceeds save state parameter list size." );
+
+	if ((ResumeIt = m_ResumeMethodIds.find( ResumeSub->GetAddress( ) )) == m_ResumeMethodIds.end( ))
+		throw std::runtime_error( "Saving state for a subroutine that is not a script situation." );
+
+	if (ParamList.size( ) - NumGlobals != ResumeSub->GetParameters( ).size( ))
+		throw std::runtime_error( "Saved local count does not match script situation parameter count." );
+
+	m_Module->SaveSites.push_back( NWScriptNativeRuntime::SaveSite( ) );
+
+	Site = &m_Module->SaveSites.back( );
+
+	Site->ResumeMethodId = ResumeIt->second;
+	Site->ResumeMethodPC = ResumeSub->GetAddress( );
+	Site->NumGlobals     = NumGlobals;
+
+	for (size_t i = 0; i < ParamList.size( ); i += 1)
+	{
+		Site->Types.push_back( GetVariableType( ParamList[ i ] ) );
+
+		LoadGpr( X64Assembler::RAX, ParamList[ i ] );
+		m_Asm.MovMemReg64(
+			X64Assembler::RSP,
+			(LONG) (SHADOW_SPACE_SIZE + i * SLOT_SIZE),
+			X64Assembler::RAX);
+	}
+
+	m_Asm.MovRegReg64( ArgumentRegisters[ 0 ], X64Assembler::R15 );
+	m_Asm.MovRegImm64( ArgumentRegisters[ 1 ], (ULONG64) (ULONG_PTR) Site );
+	m_Asm.LeaRegMem64( ArgumentRegisters[ 2 ], X64Assembler::RSP, SHADOW_SPACE_SIZE );
+	GenerateHelperCall( (const void *) &NWScriptNativeRuntime::SaveState );
+	GenerateStatusCheck( Sub );
+}
+
+void
+NWScriptNativeCodeGenerator::GenerateHelperCall(
+	__in const void * Helper
+	)
+/*++
+
+Routine Description:
+
+	This routine emits a call to a runtime support routine.  The caller has
+	already loaded the argument registers.  The support routine may clobber
+	all scratch registers.
+
+Arguments:
+
+	Helper - Supplies the address of the support routine.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	m_Asm.MovRegImm64( X64Assembler::RAX, (ULONG64) (ULONG_PTR) Helper );
+	m_Asm.CallReg( X64Assembler::RAX );
+}
+
+void
+NWScriptNativeCodeGenerator::BeginFunctionUnwind(
+	)
+/*++
+
+Routine Description:
+
+	This routine starts the unwind description of a generated function at the
+	current code offset.  The function's prolog must follow immediately.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	FunctionUnwind Unwind;
+
+	Unwind.Begin         = m_Asm.GetOffset( );
+	Unwind.End           = Unwind.Begin;
+	Unwind.PrologSize    = 0;
+	Unwind.FrameRegister = 0;
+	Unwind.FrameOffset   = 0;
+
+	m_Unwind.push_back( Unwind );
+}
+
+void
+NWScriptNativeCodeGenerator::RecordUnwindOp(
+	__in UNWIND_OP_CODE Op,
+	__in UCHAR Info,
+	__in ULONG Operand
+	)
+/*++
+
+Routine Description:
+
+	This routine records an unwind operation for the prolog instruction that
+	was just emitted.
+
+Arguments:
+
+	Op - Supplies the unwind operation code.
+
+	Info - Supplies the operation info field.
+
+	Operand - Supplies the operand of operations that take extra slots.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	FunctionUnwind & Unwind = m_Unwind.back( );
+	UnwindOp         Record;
+	size_t           CodeOffset;
+
+	CodeOffset = m_Asm.GetOffset( ) - Unwind.Begin;
+
+	if (CodeOffset > 0xFF)
+		throw std::runtime_error( "Generated prolog is too large to describe." );
+
+	Record.CodeOffset = (UCHAR) CodeOffset;
+	Record.Op         = (UCHAR) Op;
+	Record.Info       = Info;
+	Record.Operand    = Operand;
+
+	Unwind.Ops.push_back( Record );
+}
+
+void
+NWScriptNativeCodeGenerator::RecordUnwindAlloc(
+	__in ULONG Size
+	)
+/*++
+
+Routine Description:
+
+	This routine records the fixed stack allocation that was just emitted,
+	choosing the smallest unwind encoding able to express it.
+
+Arguments:
+
+	Size - Supplies the size of the allocation, a multiple of 8 bytes.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	if (Size <= 128)
+		RecordUnwindOp( UWOP_ALLOC_SMALL, (UCHAR) ((Size - 8) / 8), 0 );
+	else if (Size / 8 <= 0xFFFF)
+		RecordUnwindOp( UWOP_ALLOC_LARGE, 0, Size );
+	else
+		RecordUnwindOp( UWOP_ALLOC_LARGE, 1, Size );
+}
+
+void
+NWScriptNativeCodeGenerator::RecordUnwindSaveXmm(
+	__in XMM Reg,
+	__in ULONG StackOffset
+	)
+/*++
+
+Routine Description:
+
+	This routine records the save of a nonvolatile XMM register that was just
+	emitted.
+
+Arguments:
+
+	Reg - Supplies the register that was saved.
+
+	StackOffset - Supplies the 16-byte aligned offset of the save slot from
+	              the stack pointer as it stands once the prolog has run.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	if (StackOffset % 16)
+		throw std::runtime_error( "Misaligned XMM save slot." );
+
+	if (StackOffset / 16 <= 0xFFFF)
+		RecordUnwindOp( UWOP_SAVE_XMM128, (UCHAR) Reg, StackOffset );
+	else
+		RecordUnwindOp( UWOP_SAVE_XMM128_FAR, (UCHAR) Reg, StackOffset );
+}
+
+void
+NWScriptNativeCodeGenerator::EndFunctionProlog(
+	)
+/*++
+
+Routine Description:
+
+	This routine marks the end of the prolog of the current function.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	FunctionUnwind & Unwind = m_Unwind.back( );
+
+	Unwind.PrologSize = m_Asm.GetOffset( ) - Unwind.Begin;
+
+	if (Unwind.PrologSize > 0xFF)
+		throw std::runtime_error( "Generated prolog is too large to describe." );
+}
+
+void
+NWScriptNativeCodeGenerator::EndFunctionUnwind(
+	)
+/*++
+
+Routine Description:
+
+	This routine marks the end of the current function, including any out of
+	line stubs that follow its epilog.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	m_Unwind.back( ).End = m_Asm.GetOffset( );
+}
+
+void
+NWScriptNativeCodeGenerator::BuildModuleImage(
+	__out std::vector< unsigned char > & Image,
+	__out std::vector< RUNTIME_FUNCTION > & FunctionTable
+	) const
+/*++
+
+Routine Description:
+
+	This routine lays out the executable image of the module: the generated
+	code, followed by the UNWIND_INFO of each generated function.  It also
+	builds the function table describing the image, with addresses relative
+	to the start of the image, for registration with RtlAddFunctionTable.
+
+	Branch displacements are fixed in size, so the code offsets recorded while
+	generating are final.
+
+Arguments:
+
+	Image - Receives the image contents.
+
+	FunctionTable - Receives the function table, sorted by address.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	Image = m_Asm.GetCode( );
+
+	FunctionTable.clear( );
+	FunctionTable.reserve( m_Unwind.size( ) );
+
+	for (FunctionUnwindVec::const_iterator it = m_Unwind.begin( );
+	     it != m_Unwind.end( );
+	     ++it)
+	{
+		std::vector< USHORT > Codes;
+		RUNTIME_FUNCTION      Function;
+
+		//
+		// Unwind codes are listed in reverse prolog order, with the extra
+		// slots of an operation following its own.
+		//
+
+		for (std::vector< UnwindOp >::const_reverse_iterator op = it->Ops.rbegin( );
+		     op != it->Ops.rend( );
+		     ++op)
+		{
+			Codes.push_back( (USHORT) (op->CodeOffset | ((op->Op | (op->Info << 4)) << 8)) );
+
+			switch (op->Op)
+			{
+
+			case UWOP_ALLOC_LARGE:
+				if (op->Info == 0)
+				{
+					Codes.push_back( (USHORT) (op->Operand / 8) );
+					break;
+				}
+
+				Codes.push_back( (USHORT) (op->Operand & 0xFFFF) );
+				Codes.push_back( (USHORT) (op->Operand >> 16) );
+				break;
+
+			case UWOP_SAVE_XMM128:
+				Codes.push_back( (USHORT) (op->Operand / 16) );
+				break;
+
+			case UWOP_SAVE_XMM128_FAR:
+				Codes.push_back( (USHORT) (op->Operand & 0xFFFF) );
+				Codes.push_back( (USHORT) (op->Operand >> 16) );
+				break;
+
+			}
+		}
+
+		if ((Codes.size( ) > 0xFF) || (it->End <= it->Begin))
+			throw std::runtime_error( "Unable to describe generated function for unwinding." );
+
+		//
+		// UNWIND_INFO is DWORD aligned, and its code array is padded to an
+		// even count that the header does not include.
+		//
+
+		Image.resize( (Image.size( ) + 3) & ~(size_t) 3, 0xCC );
+
+		Function.BeginAddress      = (DWORD) it->Begin;
+		Function.EndAddress        = (DWORD) it->End;
+		Function.UnwindData        = (DWORD) Image.size( );
+
+		Image.push_back( 1 );
+		Image.push_back( (unsigned char) it->PrologSize );
+		Image.push_back( (unsigned char) Codes.size( ) );
+		Image.push_back( (unsigned char) (it->FrameRegister | (it->FrameOffset << 4)) );
+
+		if (Codes.size( ) & 1)
+			Codes.push_back( 0 );
+
+		for (std::vector< USHORT >::const_iterator code = Codes.begin( );
+		     code != Codes.end( );
+		     ++code)
+		{
+			Image.push_back( (unsigned char) (*code & 0xFF) );
+			Image.push_back( (unsigned char) (*code >> 8) );
+		}
+
+		FunctionTable.push_back( Function );
+	}
+}
+
+const NWScriptNativeCodeGenerator::VariableHome &
+NWScriptNativeCodeGenerator::GetHome(
+	__in NWScriptVariable * Var
+	) const
+/*++
+
+Routine Description:
+
+	This routine returns the home assigned to a variable.
+
+Arguments:
+
+	Var - Supplies the variable to look up.
+
+Return Value:
+
+	The variable's home.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	const VariableHome * Home;
+
+	Home = (const VariableHome *) Var->GetHeadVariable( )->GetUserContext( );
+
+	if (Home == NULL)
+		throw std::runtime_error( "Referencing variable without an assigned home." );
+
+	return *Home;
+}
+
+NWACTION_TYPE
+NWScriptNativeCodeGenerator::GetVariableType(
+	__in NWScriptVariable * Var
+	) const
+/*++
+
+Routine Description:
+
+	This routine returns the type that generated code uses for a variable.  A
+	variable that was never given a type (e.g. an unreferenced parameter) is
+	treated as an integer, as in the MSIL backend.
+
+Arguments:
+
+	Var - Supplies the variable to look up.
+
+Return Value:
+
+	The variable's type.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	NWACTION_TYPE Type = Var->GetHeadVariable( )->GetType( );
+
+	if (Type == ACTIONTYPE_VOID)
+		return ACTIONTYPE_INT;
+
+	if (!NWScriptNativeRuntime::IsSupportedType( Type ))
+		throw std::runtime_error( "Unsupported variable type for native code generation." );
+
+	return Type;
+}
+
+NWScriptNativeCodeGenerator::VariableHome *
+NWScriptNativeCodeGenerator::CreateHome(
+	__in NWScriptVariable * Var,
+	__in HOME_KIND Kind
+	)
+/*++
+
+Routine Description:
+
+	This routine creates a new home for a variable and attaches it to the
+	variable.  The caller fills in the location.
+
+Arguments:
+
+	Var - Supplies the (head) variable to create a home for.
+
+	Kind - Supplies the kind of home to create.
+
+Return Value:
+
+	The new home.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	VariableHome Home;
+
+	Home.Kind  = Kind;
+	Home.Type  = GetVariableType( Var );
+	Home.Reg   = X64Assembler::RAX;
+	Home.Xmm   = X64Assembler::XMM0;
+	Home.Base  = X64Assembler::RAX;
+	Home.Disp  = 0;
+	Home.Value = 0;
+
+	m_Homes.push_back( Home );
+	m_HomedVariables.push_back( Var );
+
+	Var->SetUserContext( &m_Homes.back( ) );
+
+	return &m_Homes.back( );
+}
+
+void
+NWScriptNativeCodeGenerator::AssignConstantHome(
+	__in NWScriptVariable * Var
+	)
+/*++
+
+Routine Description:
+
+	This routine assigns a home to a constant variable.  Constants are
+	generally materialized as immediates; OBJECT_SELF is read from the
+	execution context.
+
+Arguments:
+
+	Var - Supplies the (head) constant variable.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	const NWScriptAnalyzer::VARIABLE_VALUE & Value = m_Analyzer->GetConstantValue( Var );
+	VariableHome                           * Home;
+
+	if (Value.Type != Var->GetType( ))
+	{
+		char Msg[ 64 ];
+
+		StringCbPrintfA(
+			Msg,
+			sizeof( Msg ),
+			"Inconsistent constant variable type (%lu != %lu)",
+			(unsigned long) Value.Type,
+			(unsigned long) Var->GetType( ));
+
+		throw std::runtime_error( Msg );
+	}
+
+	switch (Var->GetType( ))
+	{
+
+	case ACTIONTYPE_INT:
+		Home        = CreateHome( Var, HK_CONSTANT );
+		Home->Value = (ULONG) Value.Int;
+		break;
+
+	case ACTIONTYPE_FLOAT:
+		{
+			ULONG Bits;
+
+			C_ASSERT( sizeof( Bits ) == sizeof( Value.Float ) );
+
+			memcpy( &Bits, &Value.Float, sizeof( Bits ) );
+
+			Home        = CreateHome( Var, HK_CONSTANT );
+			Home->Value = Bits;
+		}
+		break;
+
+	case ACTIONTYPE_OBJECT:
+		if ((Value.Object == OBJECTID_INVALID) ||
+		    (Value.Object == (ULONG) m_ObjectInvalid))
+		{
+			Home        = CreateHome( Var, HK_CONSTANT );
+			Home->Value = (ULONG) m_ObjectInvalid;
+		}
+		else if (Value.Object == OBJECTID_SELF)
+		{
+			Home       = CreateHome( Var, HK_MEMORY );
+			Home->Base = X64Assembler::R15;
+			Home->Disp = (LONG) offsetof( NWSCRIPT_NATIVE_CONTEXT, ObjectSelf );
+		}
+		else
+		{
+			throw std::runtime_error( "Illegal object id literal" );
+		}
+		break;
+
+	case ACTIONTYPE_STRING:
+		Home        = CreateHome( Var, HK_CONSTANT );
+		Home->Value = (Value.StringPtr != NULL) ? InternString( *Value.StringPtr ) : 0;
+		break;
+
+	default:
+		throw std::runtime_error( "Illegal constant type." );
+
+	}
+}
+
+void
+NWScriptNativeCodeGenerator::LoadGpr(
+	__in GPR Dst,
+	__in NWScriptVariable * Var
+	)
+/*++
+
+Routine Description:
+
+	This routine loads the value of a variable into a general purpose
+	register.  Scalar values are zero extended; float values are loaded as
+	their bit pattern.
+
+Arguments:
+
+	Dst - Supplies the register to load.
+
+	Var - Supplies the variable to load.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	const VariableHome & Home = GetHome( Var );
+
+	switch (Home.Kind)
+	{
+
+	case HK_GPR:
+		if (Home.Reg != Dst)
+			m_Asm.MovRegReg32( Dst, Home.Reg );
+		break;
+
+	case HK_XMM:
+		m_Asm.MovdRegXmm32( Dst, Home.Xmm );
+		break;
+
+	case HK_MEMORY:
+		if (NWScriptNativeRuntime::IsPointerType( Home.Type ))
+			m_Asm.MovRegMem64( Dst, Home.Base, Home.Disp );
+		else
+			m_Asm.MovRegMem32( Dst, Home.Base, Home.Disp );
+		break;
+
+	case HK_CONSTANT:
+		if (Home.Value > 0xFFFFFFFF)
+			m_Asm.MovRegImm64( Dst, Home.Value );
+		else
+			m_Asm.MovRegImm32( Dst, (ULONG) Home.Value );
+		break;
+
+	default:
+		throw std::runtime_error( "Illegal variable home." );
+
+	}
+}
+
+void
+NWScriptNativeCodeGenerator::StoreGpr(
+	__in NWScriptVariable * Var,
+	__in GPR Src
+	)
+/*++
+
+Routine Description:
+
+	This routine stores a general purpose register to a variable.
+
+Arguments:
+
+	Var - Supplies the variable to store to.
+
+	Src - Supplies the register holding the value.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	const VariableHome & Home = GetHome( Var );
+
+	switch (Home.Kind)
+	{
+
+	case HK_GPR:
+		if (Home.Reg != Src)
+			m_Asm.MovRegReg32( Home.Reg, Src );
+		break;
+
+	case HK_XMM:
+		m_Asm.MovdXmmReg32( Home.Xmm, Src );
+		break;
+
+	case HK_MEMORY:
+		if (NWScriptNativeRuntime::IsPointerType( Home.Type ))
+			m_Asm.MovMemReg64( Home.Base, Home.Disp, Src );
+		else
+			m_Asm.MovMemReg32( Home.Base, Home.Disp, Src );
+		break;
+
+	default:
+		throw std::runtime_error( "Assigning to a constant variable." );
+
+	}
+}
+
+void
+NWScriptNativeCodeGenerator::LoadXmm(
+	__in XMM Dst,
+	__in NWScriptVariable * Var
+	)
+/*++
+
+Routine Description:
+
+	This routine loads the value of a float variable into an XMM register.
+
+	N.B.  Loading a constant uses RAX as a temporary.
+
+Arguments:
+
+	Dst - Supplies the register to load.
+
+	Var - Supplies the variable to load.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	const VariableHome & Home = GetHome( Var );
+
+	switch (Home.Kind)
+	{
+
+	case HK_XMM:
+		if (Home.Xmm != Dst)
+			m_Asm.MovssRegReg( Dst, Home.Xmm );
+		break;
+
+	case HK_GPR:
+		m_Asm.MovdXmmReg32( Dst, Home.Reg );
+		break;
+
+	case HK_MEMORY:
+		m_Asm.MovssRegMem( Dst, Home.Base, Home.Disp );
+		break;
+
+	case HK_CONSTANT:
+		m_Asm.MovRegImm32( X64Assembler::RAX, (ULONG) Home.Value );
+		m_Asm.MovdXmmReg32( Dst, X64Assembler::RAX );
+		break;
+
+	default:
+		throw std::runtime_error( "Illegal variable home." );
+
+	}
+}
+
+void
+NWScriptNativeCodeGenerator::StoreXmm(
+	__in NWScriptVariable * Var,
+	__in XMM Src
+	)
+/*++
+
+Routine Description:
+
+	This routine stores an XMM register to a float variable.
+
+Arguments:
+
+	Var - Supplies the variable to store to.
+
+	Src - Supplies the register holding the value.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	const VariableHome & Home = GetHome( Var );
+
+	switch (Home.Kind)
+	{
+
+	case HK_XMM:
+		if (Home.Xmm != Src)
+			m_Asm.MovssRegReg( Home.Xmm, Src );
+		break;
+
+	case HK_GPR:
+		m_Asm.MovdRegXmm32( Home.Reg, Src );
+		break;
+
+	case HK_MEMORY:
+		m_Asm.MovssMemReg( Home.Base, Home.Disp, Src );
+		break;
+
+	default:
+		throw std::runtime_error( "Assigning to a constant variable." );
+
+	}
+}
+
+ULONG64
+NWScriptNativeCodeGenerator::InternString(
+	__in const std::string & String
+	)
+/*++
+
+Routine Description:
+
+	This routine places a string constant into the module's string pool.
+
+Arguments:
+
+	String - Supplies the string contents.
+
+Return Value:
+
+	The slot value of the string (NULL for the empty string).  On failure, an
+	std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	PNWSCRIPT_NATIVE_STRING Str;
+	size_t                  Size;
+
+	if (String.empty( ))
+		return 0;
+
+	Size = (offsetof( NWSCRIPT_NATIVE_STRING, Data ) + String.size( ) + sizeof( ULONG64 ) - 1) / sizeof( ULONG64 );
+
+	m_Module->Strings.push_back( std::vector< ULONG64 >( Size, 0 ) );
+
+	Str = (PNWSCRIPT_NATIVE_STRING) &m_Module->Strings.back( )[ 0 ];
+
+	Str->Length = String.size( );
+	memcpy( Str->Data, String.data( ), String.size( ) );
+
+	return (ULONG64) (ULONG_PTR) Str;
+}
+
+bool
+NWScriptNativeCodeGenerator::IsIgnoredCallInstr(
+	__in const SubroutineContext & Sub,
+	__in NWScriptSubroutine * CalledSub
+	) const
+/*++
+
+Routine Description:
+
+	This routine determines whether a subroutine call should be ignored instead
+	of actually emitted.  This is to support the behavior of ignoring the call
+	to the entry point from #globals, as the generated IR will not contain the
+	correct actual instructions to successfully invoke the entry point.
+
+Arguments:
+
+	Sub - Supplies the subroutine being generated.
+
+	CalledSub - Supplies the IR subroutine being invoked.
+
+Return Value:
+
+	The routine returns true if the call is to be ignored, else false.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	return ((Sub.Flags & GSF_GLOBALS) != 0) &&
+	       (CalledSub->GetAddress( ) == m_EntryPC);
+}
+
+void
+NWScriptNativeCodeGenerator::GetInstructionVariables(
+	__in const NWScriptInstruction & Instr,
+	__out NWNScriptLib::VariableWeakPtrVec & ReadVars,
+	__out NWNScriptLib::VariableWeakPtrVec & WriteVars
+	) const
+/*++
+
+Routine Description:
+
+	This routine retrieves the variables read and written by an instruction.
+
+Arguments:
+
+	Instr - Supplies the instruction to query.
+
+	ReadVars - Receives the variables read by the instruction.
+
+	WriteVars - Receives the variables written by the instruction.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	ReadVars.clear( );
+	WriteVars.clear( );
+
+	m_Analyzer->GetInstructionVariableLists( Instr, &ReadVars, &WriteVars );
+}
+
+bool
+NWScriptNativeCodeGenerator::IsAllocationCandidate(
+	__in NWScriptVariable * Var
+	) const
+/*++
+
+Routine Description:
+
+	This routine determines whether a variable may be assigned a register.
+	Only scalar locals qualify; parameters, return values and globals must
+	live in memory where other code can reach them.
+
+Arguments:
+
+	Var - Supplies the (head) variable to examine.
+
+Return Value:
+
+	The routine returns true if the variable may be assigned a register, else
+	false.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	switch (Var->GetClass( ))
+	{
+
+	case NWScriptVariable::Local:
+	case NWScriptVariable::CallParameter:
+	case NWScriptVariable::CallReturnValue:
+		break;
+
+	default:
+		return false;
+
+	}
+
+	switch (GetVariableType( Var ))
+	{
+
+	case ACTIONTYPE_INT:
+	case ACTIONTYPE_FLOAT:
+	case ACTIONTYPE_OBJECT:
+		return true;
+
+	default:
+		return false;
+
+	}
+}
+
+size_t
+NWScriptNativeCodeGenerator::LookupFlow(
+	__in const SubroutineContext & Sub,
+	__in PROGRAM_COUNTER FlowPC
+	) const
+/*++
+
+Routine Description:
+
+	This routine returns the index of a flow of the subroutine being
+	generated.
+
+Arguments:
+
+	Sub - Supplies the subroutine being generated.
+
+	FlowPC - Supplies the start program counter of the flow.
+
+Return Value:
+
+	The index of the flow.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	FlowIndexMap::const_iterator it = Sub.FlowIndex.find( FlowPC );
+
+	if (it == Sub.FlowIndex.end( ))
+		throw std::runtime_error( "Control flow not found in subroutine." );
+
+	return it->second;
+}
+
+LONG
+NWScriptNativeCodeGenerator::GetSlotDisplacement(
+	__in const SubroutineContext & Sub,
+	__in size_t Slot
+	) const
+/*++
+
+Routine Description:
+
+	This routine returns the frame pointer relative displacement of a variable
+	slot.  Slots are placed immediately below the saved GPRs.
+
+Arguments:
+
+	Sub - Supplies the subroutine being generated.
+
+	Slot - Supplies the slot number.
+
+Return Value:
+
+	The displacement of the slot from RBP.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	return -(LONG) ((Sub.SavedGprs.size( ) + Slot + 1) * SLOT_SIZE);
+}
@@ -0,0 +1,653 @@
+/*++
+
+Copyright (c) Ken Johnson (Skywing). All rights reserved.
+
+Module Name:
+
+	NWScriptNativeCodeGenerator.h
+
+Abstract:
+
+	This module defines the native code generator, which lowers the
+	NWScriptAnalyzer IR of a script program directly to x86-64 machine code.
+
+--*/
+
+#ifndef _SOURCE_PROGRAMS_NWNSCRIPTJITNATIVE_NWSCRIPTNATIVECODEGENERATOR_H
+#define _SOURCE_PROGRAMS_NWNSCRIPTJITNATIVE_NWSCRIPTNATIVECODEGENERATOR_H
+
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+#include "X64Assembler.h"
+#include "NWScriptNativeRuntime.h"
+
+//
+// Define the native code generator.
+//
+// Each IR subroutine becomes a native subroutine.  Variables are assigned a
+// home for the duration of their subroutine: globals live in the execution
+// context, parameters and return values live in the argument area supplied by
+// the caller, and locals are assigned a register by a linear scan allocator
+// (integer, object and float variables) or a frame slot otherwise.
+//
+// The calling convention between generated subroutines is private:
+//
+// - R15 holds the execution context and RBP is the frame pointer.
+// - The caller places the return value slots of the callee, followed by its
+//   parameter slots, at the bottom of its frame, immediately above the return
+//   address of the call.
+// - The callee preserves every register that it allocates to a variable.
+// - On return, the caller checks the context status and, if it is not
+//   NNS_SUCCESS, returns immediately itself.
+//
+
+class NWScriptNativeCodeGenerator
+{
+
+public:
+
+	//
+	// Describe a generated subroutine that the program invokes directly (the
+	// entry point, #globals and script situation subroutines).
+	//
+
+	struct SubroutineEntry
+	{
+		size_t                        Offset;
+		NWNScriptLib::PROGRAM_COUNTER PC;
+		size_t                        NumReturnValues;
+		NWACTION_TYPE                 ReturnType;
+		std::vector< NWACTION_TYPE >  ParameterTypes;
+	};
+
+	typedef std::vector< SubroutineEntry > SubroutineEntryVec;
+
+	//
+	// Define the generated program.  The generated code refers directly to the
+	// call site descriptors and string constants of the module, so the module
+	// may not be moved once it has been generated.
+	//
+
+	struct ProgramModule
+	{
+		NWScriptNativeCode::Ptr                Code;
+		NWScriptNativeRuntime::ActionSiteList  ActionSites;
+		NWScriptNativeRuntime::SaveSiteList    SaveSites;
+		std::list< std::vector< ULONG64 > >    Strings;
+		std::vector< NWACTION_TYPE >           GlobalTypes;
+		SubroutineEntry                        EntryPoint;
+		bool                                   HasGlobals;
+		SubroutineEntry                        Globals;
+		SubroutineEntryVec                     ResumeSubroutines;
+		LONG                                   MaxLoopIterations;
+		LONG                                   MaxCallDepth;
+		ULONG                                  CodeGenFlags;
+	};
+
+	NWScriptNativeCodeGenerator(
+		__in_opt IDebugTextOut * TextOut,
+		__in ULONG DebugLevel,
+		__in NWN::OBJECTID ObjectInvalid,
+		__in_opt PCNWSCRIPT_JIT_PARAMS CodeGenParams
+		);
+
+	~NWScriptNativeCodeGenerator(
+		);
+
+	//
+	// Generate native code for an analyzed script program.  Raises an
+	// std::exception on failure, including if the program uses a construct
+	// that the native code generator does not support.
+	//
+
+	void
+	GenerateProgram(
+		__in const NWScriptAnalyzer * Analyzer,
+		__out ProgramModule & Module
+		);
+
+private:
+
+	typedef X64Assembler::GPR       GPR;
+	typedef X64Assembler::XMM       XMM;
+	typedef X64Assembler::CONDITION CONDITION;
+	typedef X64Assembler::Label     Label;
+
+	typedef NWNScriptLib::PROGRAM_COUNTER PROGRAM_COUNTER;
+
+	enum
+	{
+		MAX_CALL_DEPTH      = 128,
+		MAX_LOOP_ITERATIONS = 100000,
+
+		//
+		// Size of the register parameter home area that precedes the staging
+		// area used for action service calls.
+		//
+
+		SHADOW_SPACE_SIZE   = 32,
+
+		SLOT_SIZE           = sizeof( ULONG64 ),
+		PAGE_SIZE_PROBE     = 4096,
+
+		LAST_CODEGEN_CONSTANT
+	};
+
+	//
+	// Define the x64 unwind operation codes (UNWIND_CODE.UnwindOp) used to
+	// describe the prologs of generated functions.
+	//
+
+	typedef enum _UNWIND_OP_CODE
+	{
+		UWOP_PUSH_NONVOL     = 0,
+		UWOP_ALLOC_LARGE     = 1,
+		UWOP_ALLOC_SMALL     = 2,
+		UWOP_SET_FPREG       = 3,
+		UWOP_SAVE_XMM128     = 8,
+		UWOP_SAVE_XMM128_FAR = 9,
+
+		LAST_UWOP_CODE
+	} UNWIND_OP_CODE, * PUNWIND_OP_CODE;
+
+	//
+	// Define an unwind operation recorded while emitting a prolog, and the
+	// unwind description of one generated function.  Operations are recorded
+	// in prolog order and are reversed when the unwind data is encoded.
+	//
+
+	struct UnwindOp
+	{
+		UCHAR                       CodeOffset;
+		UCHAR                       Op;
+		UCHAR                       Info;
+		ULONG                       Operand;
+	};
+
+	struct FunctionUnwind
+	{
+		size_t                      Begin;
+		size_t                      End;
+		size_t                      PrologSize;
+		UCHAR                       FrameRegister;
+		UCHAR                       FrameOffset;
+		std::vector< UnwindOp >     Ops;
+	};
+
+	typedef std::vector< FunctionUnwind > FunctionUnwindVec;
+
+	//
+	// Define the flags describing a subroutine's role in the program.
+	//
+
+	typedef enum _GSUB_FLAGS
+	{
+		GSF_ENTRY_POINT      = 0x00000001,
+		GSF_GLOBALS          = 0x00000002,
+		GSF_SCRIPT_SITUATION = 0x00000004,
+
+		LAST_GSF_FLAG
+	} GSUB_FLAGS, * PGSUB_FLAGS;
+
+	//
+	// Define where a variable lives during execution of its subroutine.
+	//
+
+	typedef enum _HOME_KIND
+	{
+		HK_GPR,
+		HK_XMM,
+		HK_MEMORY,
+		HK_CONSTANT,
+
+		LAST_HOME_KIND
+	} HOME_KIND, * PHOME_KIND;
+
+	struct VariableHome
+	{
+		HOME_KIND     Kind;
+		NWACTION_TYPE Type;
+		GPR           Reg;
+		XMM           Xmm;
+		GPR           Base;
+		LONG          Disp;
+		ULONG64       Value;
+	};
+
+	typedef std::list< VariableHome > VariableHomeList;
+
+	//
+	// Define the per-control flow state of a subroutine being generated.
+	//
+
+	struct FlowInfo
+	{
+		NWScriptControlFlow  * Flow;
+		Label                  FlowLabel;
+		size_t                 StartPos;
+		size_t                 EndPos;
+		std::vector< size_t >  Successors;
+		std::vector< bool >    Use;
+		std::vector< bool >    Def;
+		std::vector< bool >    LiveIn;
+		std::vector< bool >    LiveOut;
+	};
+
+	typedef std::vector< FlowInfo >                 FlowInfoVec;
+	typedef std::map< PROGRAM_COUNTER, size_t >     FlowIndexMap;
+
+	//
+	// Define the live interval of a register allocation candidate.
+	//
+
+	struct LiveInterval
+	{
+		NWScriptVariable * Var;
+		size_t             Start;
+		size_t             End;
+		bool               Float;
+		bool               Spilled;
+		GPR                Reg;
+		XMM                Xmm;
+	};
+
+	typedef std::vector< LiveInterval > LiveIntervalVec;
+
+	//
+	// Define the state of the subroutine being generated.
+	//
+
+	struct SubroutineContext
+	{
+		NWScriptSubroutine             * IRSub;
+		unsigned long                    Flags;
+		FlowInfoVec                      Flows;
+		FlowIndexMap                     FlowIndex;
+		size_t                           NumInstructions;
+		size_t                           NumSlots;
+		std::vector< LONG >              PointerSlots;
+		std::vector< GPR >               SavedGprs;
+		std::vector< XMM >               SavedXmms;
+		LONG                             XmmSaveBase;
+		LONG                             TestSlot;
+		bool                             TestInFlags;
+		size_t                           MaxStageSlots;
+		size_t                           MaxCallSlots;
+		LONG                             FrameSize;
+		Label                            ExitLabel;
+		Label                            CallDepthLabel;
+		Label                            LoopLimitLabel;
+		Label                            DivideByZeroLabel;
+		Label                            OverflowLabel;
+		bool                             CallDepthUsed;
+		bool                             LoopLimitUsed;
+		bool                             DivideByZeroUsed;
+		bool                             OverflowUsed;
+	};
+
+	//
+	// Generator is not copyable.
+	//
+
+	NWScriptNativeCodeGenerator(
+		__in const NWScriptNativeCodeGenerator & other
+		);
+
+	NWScriptNativeCodeGenerator &
+	operator=(
+		__in const NWScriptNativeCodeGenerator & other
+		);
+
+	//
+	// Program level generation.
+	//
+
+	void
+	GenerateEntryThunk(
+		);
+
+	void
+	AssignGlobalHomes(
+		);
+
+	void
+	BuildSubroutineEntry(
+		__in NWScriptSubroutine * IRSub,
+		__out SubroutineEntry & Entry
+		);
+
+	//
+	// Subroutine level generation.
+	//
+
+	void
+	GenerateSubroutine(
+		__in NWScriptSubroutine * IRSub,
+		__in unsigned long Flags
+		);
+
+	void
+	BuildFlowGraph(
+		__inout SubroutineContext & Sub
+		);
+
+	void
+	AssignVariableHomes(
+		__inout SubroutineContext & Sub
+		);
+
+	void
+	AllocateRegisters(
+		__inout SubroutineContext & Sub,
+		__in const std::vector< NWScriptVariable * > & Candidates,
+		__inout LiveIntervalVec & Intervals
+		);
+
+	void
+	ComputeLiveIntervals(
+		__inout SubroutineContext & Sub,
+		__in const std::vector< NWScriptVariable * > & Candidates,
+		__out LiveIntervalVec & Intervals
+		);
+
+	void
+	GenerateProlog(
+		__inout SubroutineContext & Sub
+		);
+
+	void
+	GenerateEpilog(
+		__inout SubroutineContext & Sub
+		);
+
+	void
+	GenerateFlow(
+		__inout SubroutineContext & Sub,
+		__in size_t FlowIndex
+		);
+
+	void
+	GenerateInstruction(
+		__inout SubroutineContext & Sub,
+		__in size_t FlowIndex,
+		__in const NWScriptInstruction & Instr,
+		__in_opt const NWScriptInstruction * NextInstr
+		);
+
+	void
+	GenerateJump(
+		__inout SubroutineContext & Sub,
+		__in size_t FlowIndex,
+		__in size_t TargetIndex
+		);
+
+	void
+	GenerateConditionalJump(
+		__inout SubroutineContext & Sub,
+		__in size_t FlowIndex,
+		__in const NWScriptInstruction & Instr
+		);
+
+	void
+	GenerateLoopCheck(
+		__inout SubroutineContext & Sub
+		);
+
+	void
+	GenerateStatusCheck(
+		__inout SubroutineContext & Sub
+		);
+
+	//
+	// Instruction lowering.
+	//
+
+	void
+	GenerateAssign(
+		__in NWScriptVariable * Dst,
+		__in NWScriptVariable * Src
+		);
+
+	void
+	GenerateSetDefaultValue(
+		__in NWScriptVariable * Var
+		);
+
+	void
+	GenerateCompare(
+		__inout SubroutineContext & Sub,
+		__in const NWScriptInstruction & Instr,
+		__in NWScriptVariable * Result,
+		__in NWScriptVariable * Left,
+		__in NWScriptVariable * Right
+		);
+
+	void
+	GenerateIntegerOperation(
+		__inout SubroutineContext & Sub,
+		__in const NWScriptInstruction & Instr,
+		__in NWScriptVariable * Result,
+		__in NWScriptVariable * Left,
+		__in NWScriptVariable * Right
+		);
+
+	void
+	GenerateFloatOperation(
+		__inout SubroutineContext & Sub,
+		__in const NWScriptInstruction & Instr,
+		__in NWScriptVariable * Result,
+		__in NWScriptVariable * Left,
+		__in NWScriptVariable * Right
+		);
+
+	void
+	GenerateUnaryOperation(
+		__in const NWScriptInstruction & Instr,
+		__in NWScriptVariable * Result,
+		__in NWScriptVariable * Operand
+		);
+
+	void
+	GenerateCall(
+		__inout SubroutineContext & Sub,
+		__in const NWScriptInstruction & Instr
+		);
+
+	void
+	GenerateAction(
+		__inout SubroutineContext & Sub,
+		__in const NWScriptInstruction & Instr
+		);
+
+	void
+	GenerateSaveState(
+		__inout SubroutineContext & Sub,
+		__in const NWScriptInstruction & Instr
+		);
+
+	void
+	GenerateHelperCall(
+		__in const void * Helper
+		);
+
+	//
+	// Unwind data.
+	//
+
+	void
+	BeginFunctionUnwind(
+		);
+
+	void
+	RecordUnwindOp(
+		__in UNWIND_OP_CODE Op,
+		__in UCHAR Info,
+		__in ULONG Operand
+		);
+
+	void
+	RecordUnwindAlloc(
+		__in ULONG Size
+		);
+
+	void
+	RecordUnwindSaveXmm(
+		__in XMM Reg,
+		__in ULONG StackOffset
+		);
+
+	void
+	EndFunctionProlog(
+		);
+
+	void
+	EndFunctionUnwind(
+		);
+
+	void
+	BuildModuleImage(
+		__out std::vector< unsigned char > & Image,
+		__out std::vector< RUNTIME_FUNCTION > & FunctionTable
+		) const;
+
+	//
+	// Variable access.
+	//
+
+	const VariableHome &
+	GetHome(
+		__in NWScriptVariable * Var
+		) const;
+
+	NWACTION_TYPE
+	GetVariableType(
+		__in NWScriptVariable * Var
+		) const;
+
+	VariableHome *
+	CreateHome(
+		__in NWScriptVariable * Var,
+		__in HOME_KIND Kind
+		);
+
+	void
+	AssignConstantHome(
+		__in NWScriptVariable * Var
+		);
+
+	void
+	LoadGpr(
+		__in GPR Dst,
+		__in NWScriptVariable * Var
+		);
+
+	void
+	StoreGpr(
+		__in NWScriptVariable * Var,
+		__in GPR Src
+		);
+
+	void
+	LoadXmm(
+		__in XMM Dst,
+		__in NWScriptVariable * Var
+		);
+
+	void
+	StoreXmm(
+		__in NWScriptVariable * Var,
+		__in XMM Src
+		);
+
+	//
+	// Miscellaneous helpers.
+	//
+
+	ULONG64
+	InternString(
+		__in const std::string & String
+		);
+
+	bool
+	IsIgnoredCallInstr(
+		__in const SubroutineContext & Sub,
+		__in NWScriptSubroutine * CalledSub
+		) const;
+
+	void
+	GetInstructionVariables(
+		__in const NWScriptInstruction & Instr,
+		__out NWNScriptLib::VariableWeakPtrVec & ReadVars,
+		__out NWNScriptLib::VariableWeakPtrVec & WriteVars
+		) const;
+
+	bool
+	IsAllocationCandidate(
+		__in NWScriptVariable * Var
+		) const;
+
+	size_t
+	LookupFlow(
+		__in const SubroutineContext & Sub,
+		__in PROGRAM_COUNTER FlowPC
+		) const;
+
+	LONG
+	GetSlotDisplacement(
+		__in const SubroutineContext & Sub,
+		__in size_t Slot
+		) const;
+
+	inline
+	bool
+	IsDebugLevel(
+		__in ULONG DebugLevel
+		) const
+	{
+		return ((m_TextOut != NULL) && (m_DebugLevel >= DebugLevel));
+	}
+
+	inline
+	bool
+	GuardsEnabled(
+		) const
+	{
+		return (m_CodeGenFlags & NWCGF_DISABLE_EXECUTION_GUARDS) == 0;
+	}
+
+	//
+	// Define the calling convention of the host platform, used for calls to
+	// runtime support routines.
+	//
+
+	static const GPR  ArgumentRegisters[ 4 ];
+	static const GPR  GprPool[ ];
+	static const XMM  XmmPool[ ];
+	static const size_t GprPoolSize;
+	static const size_t XmmPoolSize;
+
+	IDebugTextOut                         * m_TextOut;
+	ULONG                                   m_DebugLevel;
+	NWN::OBJECTID                           m_ObjectInvalid;
+	ULONG                                   m_CodeGenFlags;
+	LONG                                    m_MaxLoopIterations;
+	LONG                                    m_MaxCallDepth;
+	const NWScriptAnalyzer                * m_Analyzer;
+	PCNWACTION_DEFINITION                   m_ActionDefs;
+	NWSCRIPT_ACTION                         m_ActionCount;
+	ProgramModule                         * m_Module;
+	X64Assembler                            m_Asm;
+	VariableHomeList                        m_Homes;
+	std::map< PROGRAM_COUNTER, Label >      m_SubroutineLabels;
+	std::map< PROGRAM_COUNTER, ULONG >      m_ResumeMethodIds;
+	std::vector< NWScriptVariable * >       m_HomedVariables;
+	FunctionUnwindVec                       m_Unwind;
+	PROGRAM_COUNTER                         m_EntryPC;
+	size_t                                  m_NumGlobals;
+
+};
+
+#endif
+
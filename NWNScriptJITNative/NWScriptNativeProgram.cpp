@@ -0,0 +1,1161 @@
+/*++
+
+Copyright (c) Ken Johnson (Skywing). All rights reserved.
+
+Module Name:
+
+	NWScriptNativeProgram.cpp
+
+Abstract:
+
+	This module houses the representation of a NWScript program that has been
+	compiled directly to native x86-64 code.  The program object owns the
+	generated code, and manages executions of it.
+
+--*/
+
+#include "Precomp.h"
+#include "NWScriptNativeProgram.h"
+
+NWScriptNativeProgram::NWScriptNativeProgram(
+	__in const NWScriptAnalyzer * Analyzer,
+	__in_opt IDebugTextOut * TextOut,
+	__in ULONG DebugLevel,
+	__in INWScriptActions * ActionHandler,
+	__in NWN::OBJECTID ObjectInvalid,
+	__in_opt PCNWSCRIPT_JIT_PARAMS CodeGenParams
+	)
+/*++
+
+Routine Description:
+
+	This routine constructs a new NWScriptNativeProgram, generating native code
+	for the program described by an analyzer.
+
+Arguments:
+
+	Analyzer - Supplies the analysis context that describes the program to
+	           generate code for.
+
+	TextOut - Optionally supplies an IDebugTextOut interface that receives text
+	          debug output from the execution environment.
+
+	DebugLevel - Supplies the debug output level.  Legal values are drawn from
+	             the NWScriptVM::ExecDebugLevel family of enumerations.
+
+	ActionHandler - Supplies the engine actions implementation handler.
+
+	ObjectInvalid - Supplies the object id to reference for the 'object
+	                invalid' manifest constant.
+
+	CodeGenParams - Optionally supplies extension code generation parameters.
+
+Return Value:
+
+	The newly constructed object.  Raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+: m_TextOut( TextOut ),
+  m_DebugLevel( DebugLevel ),
+  m_ActionHandler( ActionHandler ),
+  m_ScriptName( Analyzer->GetProgramName( ) ),
+  m_CurrentActionObjectSelf( NWN::INVALIDOBJID ),
+  m_InvalidObjId( ObjectInvalid ),
+  m_Stack( NULL ),
+  m_Aborted( false ),
+  m_NestingLevel( 0 ),
+  m_CodeGenFlags( 0 )
+{
+	try
+	{
+		NWScriptNativeCodeGenerator CodeGen(
+			TextOut,
+			DebugLevel,
+			ObjectInvalid,
+			CodeGenParams);
+
+		if (CodeGenParams != NULL)
+			m_CodeGenFlags = CodeGenParams->CodeGenFlags;
+
+		CodeGen.GenerateProgram( Analyzer, m_Module );
+	}
+	catch (std::exception &e)
+	{
+		ErrorException( e );
+		throw;
+	}
+}
+
+NWScriptNativeProgram::~NWScriptNativeProgram(
+	)
+/*++
+
+Routine Description:
+
+	This routine deletes the current NWScriptNativeProgram object and its
+	associated members.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+}
+
+int
+NWScriptNativeProgram::ExecuteScript(
+	__in INWScriptStack * VMStack,
+	__in NWN::OBJECTID ObjectSelf,
+	__in_ecount_opt( ParamCount ) const NWScriptParamString * Params,
+	__in size_t ParamCount,
+	__in int DefaultReturnCode,
+	__in ULONG Flags
+	)
+/*++
+
+Routine Description:
+
+	This routine executes a script main routine.  The main routine is either a
+	"void main(void)" or an "int StartingConditional(Params)" routine.
+
+	In the latter case, a return value may be supplied as an integer.
+	Otherwise zero is returned.
+
+	Each execution receives its own set of globals, so nested invocations of
+	the same program do not interfere with one another.
+
+Arguments:
+
+	VMStack - Supplies the stack instance that is used to pass parameters to
+	          action service handlers.
+
+	ObjectSelf - Supplies the object id to reference for the 'object self'
+	             manifest constant.
+
+	Params - Supplies an optional parameter set to pass to the script
+	         StartingConditional entry point.
+
+	ParamCount - Supplies the count of parameters to the entry point.
+
+	DefaultReturnCode - Supplies the default return code on an error condition,
+	                    or if the script did not return a value.
+
+	Flags - Supplies flags that control the execution environment of the
+	        script.  The flags are the same as those that are accepted by the
+	        NWScriptVM::ExecuteScript API.
+
+Return Value:
+
+	If the script is a StartingConditional, its return value is returned.
+	Otherwise, the default return code is returned.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	NWN::OBJECTID    CurrentActionObjectSelf;
+	INWScriptStack * Stack;
+	bool             SetNestingLevel;
+
+	//
+	// As with the MSIL backend, none of the flags bits are meaningful once
+	// code has been successfully generated for the script IR.
+	//
+
+	UNREFERENCED_PARAMETER( Flags );
+
+	CurrentActionObjectSelf = m_CurrentActionObjectSelf;
+	Stack                   = m_Stack;
+
+	SetNestingLevel = false;
+
+	try
+	{
+		const NWScriptNativeCodeGenerator::SubroutineEntry & Entry = m_Module.EntryPoint;
+		NWScriptNativeExecution                              Execution( this, VMStack, ObjectSelf );
+		std::vector< ULONG64 >                               Slots;
+		int                                                  ReturnCode;
+
+		m_NestingLevel  += 1;
+		SetNestingLevel  = true;
+
+		m_CurrentActionObjectSelf = ObjectSelf;
+		m_Stack                   = VMStack;
+
+		if (IsDebugLevel( NWScriptVM::EDL_Calls ))
+		{
+			m_TextOut->WriteText(
+				"NWScriptNativeProgram::ExecuteScript: Running script %s (nesting level %d).\n",
+				m_ScriptName.c_str( ),
+				m_NestingLevel);
+		}
+
+		//
+		// Run #globals first (if the program has globals), as the entry point
+		// expects the globals to have been initialized.
+		//
+
+		if (m_Module.HasGlobals)
+		{
+			Slots.assign(
+				m_Module.Globals.NumReturnValues + m_Module.Globals.ParameterTypes.size( ),
+				0);
+
+			Execution.Invoke(
+				m_Module.Globals.Offset,
+				Slots.empty( ) ? NULL : &Slots[ 0 ],
+				Slots.size( ));
+		}
+
+		//
+		// Now execute the actual entry point.
+		//
+
+		Slots.assign( Entry.NumReturnValues + Entry.ParameterTypes.size( ), 0 );
+
+		if (!Entry.ParameterTypes.empty( ))
+		{
+			ConvertParameterList(
+				Params,
+				ParamCount,
+				Execution,
+				&Slots[ Entry.NumReturnValues ]);
+		}
+
+		Execution.Invoke(
+			Entry.Offset,
+			Slots.empty( ) ? NULL : &Slots[ 0 ],
+			Slots.size( ));
+
+		if ((Entry.NumReturnValues == 1) && (Entry.ReturnType == ACTIONTYPE_INT))
+			ReturnCode = (int) (ULONG) Slots[ 0 ];
+		else
+			ReturnCode = DefaultReturnCode;
+
+		//
+		// Restore the per-invocation members back to their saved states in
+		// case we were a recursive call unwinding.
+		//
+
+		m_CurrentActionObjectSelf = CurrentActionObjectSelf;
+		m_Stack                   = Stack;
+
+		m_NestingLevel -= 1;
+
+		if (m_NestingLevel == 0)
+			m_Aborted = false;
+
+		return ReturnCode;
+	}
+	catch (std::exception &e)
+	{
+		ErrorException( e );
+
+		m_CurrentActionObjectSelf = CurrentActionObjectSelf;
+		m_Stack                   = Stack;
+
+		if (SetNestingLevel)
+			m_NestingLevel -= 1;
+
+		if (m_NestingLevel == 0)
+			m_Aborted = false;
+
+		return DefaultReturnCode;
+	}
+}
+
+void
+NWScriptNativeProgram::ExecuteScriptSituation(
+	__in NWScriptNativeSavedState & ScriptState,
+	__in NWN::OBJECTID ObjectSelf
+	)
+/*++
+
+Routine Description:
+
+	This routine executes a script situation, which is a saved portion of a
+	script that is later run (such as a delayed action).
+
+Arguments:
+
+	ScriptState - Supplies the state of the script to execute.
+
+	ObjectSelf - Supplies the object id to reference for the 'object self'
+	             manifest constant.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	NWN::OBJECTID    CurrentActionObjectSelf;
+	INWScriptStack * Stack;
+	bool             SetNestingLevel;
+
+	CurrentActionObjectSelf = m_CurrentActionObjectSelf;
+	Stack                   = m_Stack;
+
+	SetNestingLevel = false;
+
+	try
+	{
+		const NWScriptNativeValueVec & ProgramGlobals = ScriptState.GetProgramGlobals( );
+		const NWScriptNativeValueVec & Locals         = ScriptState.GetLocals( );
+		NWScriptNativeExecution        Execution( this, ScriptState.GetStack( ), ObjectSelf );
+		ULONG                          ResumeMethodId;
+		std::vector< ULONG64 >         Slots;
+
+		m_NestingLevel  += 1;
+		SetNestingLevel  = true;
+
+		m_CurrentActionObjectSelf = ScriptState.GetCurrentActionObjectSelf( );
+		m_Stack                   = ScriptState.GetStack( );
+
+		ResumeMethodId = ScriptState.GetResumeMethodId( );
+
+		if (IsDebugLevel( NWScriptVM::EDL_Calls ))
+		{
+			m_TextOut->WriteText(
+				"NWScriptNativeProgram::ExecuteScript: Running situation %lu for script %s (nesting level %d).\n",
+				ResumeMethodId,
+				m_ScriptName.c_str( ),
+				m_NestingLevel);
+		}
+
+		if (ResumeMethodId >= m_Module.ResumeSubroutines.size( ))
+			throw std::runtime_error( "Illegal resume method id." );
+
+		const NWScriptNativeCodeGenerator::SubroutineEntry & Entry = m_Module.ResumeSubroutines[ ResumeMethodId ];
+
+		if (Entry.PC != ScriptState.GetResumeMethodPC( ))
+			throw std::runtime_error( "Resume method PC does not match resume method id." );
+
+		//
+		// Restore the program globals, then pass the saved locals to the resume
+		// subroutine.  The types are validated here, as a saved state may have
+		// been restored from a VM stack.
+		//
+
+		if (ProgramGlobals.size( ) != m_Module.GlobalTypes.size( ))
+			throw std::runtime_error( "Saved state global count mismatch." );
+
+		for (size_t i = 0; i < ProgramGlobals.size( ); i += 1)
+		{
+			if (ProgramGlobals[ i ].Type != m_Module.GlobalTypes[ i ])
+				throw std::runtime_error( "Saved state global type mismatch." );
+
+			Execution.GetContext( )->Globals[ i ] = Execution.StoreValue( ProgramGlobals[ i ] );
+		}
+
+		if (Locals.size( ) != Entry.ParameterTypes.size( ))
+			throw std::runtime_error( "Saved state local count mismatch." );
+
+		Slots.assign( Entry.NumReturnValues + Locals.size( ), 0 );
+
+		for (size_t i = 0; i < Locals.size( ); i += 1)
+		{
+			if (Locals[ i ].Type != Entry.ParameterTypes[ i ])
+				throw std::runtime_error( "Saved state local type mismatch." );
+
+			Slots[ Entry.NumReturnValues + i ] = Execution.StoreValue( Locals[ i ] );
+		}
+
+		Execution.Invoke(
+			Entry.Offset,
+			Slots.empty( ) ? NULL : &Slots[ 0 ],
+			Slots.size( ));
+
+		m_CurrentActionObjectSelf = CurrentActionObjectSelf;
+		m_Stack                   = Stack;
+
+		m_NestingLevel -= 1;
+
+		if (m_NestingLevel == 0)
+			m_Aborted = false;
+	}
+	catch (std::exception &e)
+	{
+		ErrorException( e );
+
+		m_CurrentActionObjectSelf = CurrentActionObjectSelf;
+		m_Stack                   = Stack;
+
+		if (SetNestingLevel)
+			m_NestingLevel -= 1;
+
+		if (m_NestingLevel == 0)
+			m_Aborted = false;
+	}
+}
+
+void
+NWScriptNativeProgram::AbortScript(
+	)
+/*++
+
+Routine Description:
+
+	This routine aborts execution of the entire script program.  The abort
+	takes effect when the current action service handler returns.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	m_Aborted = true;
+}
+
+bool
+NWScriptNativeProgram::IsScriptAborted(
+	) const
+/*++
+
+Routine Description:
+
+	This routine returns whether the script program has been flagged for
+	abortive termination (but has not yet exited).
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	The routine returns a Boolean value that indicates whether an abort has
+	been requested (true) or not (false).
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	return m_Aborted;
+}
+
+NWScriptNativeSavedStatePtr
+NWScriptNativeProgram::GetSavedState(
+	)
+/*++
+
+Routine Description:
+
+	This routine returns the most recently created saved state snapshot.  The
+	snapshot is handed off to the caller, so multiple instances cannot be
+	created from the same saved state attempt.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	The routine returns the saved state on success.  On failure, an
+	std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	try
+	{
+		NWScriptNativeSavedStatePtr SavedState;
+
+		if (m_SavedState.get( ) == NULL)
+			throw std::runtime_error( "No saved state is ready." );
+
+		SavedState = m_SavedState;
+		m_SavedState = NWScriptNativeSavedStatePtr( );
+
+		return SavedState;
+	}
+	catch (std::exception &e)
+	{
+		ErrorException( e );
+		throw;
+	}
+}
+
+NWScriptNativeSavedStatePtr
+NWScriptNativeProgram::DuplicateSavedState(
+	__in const NWScriptNativeSavedState & SourceState
+	)
+/*++
+
+Routine Description:
+
+	This routine creates a copy of an existing saved state.
+
+Arguments:
+
+	SourceState - Supplies the source saved state to duplicate.
+
+Return Value:
+
+	The routine returns the new saved state on success.  On failure, an
+	std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	try
+	{
+		NWScriptNativeSavedStatePtr SavedState;
+
+		SavedState = new NWScriptNativeSavedState(
+			SourceState.GetResumeMethodId( ),
+			SourceState.GetResumeMethodPC( ),
+			SourceState.GetStack( ),
+			SourceState.GetCurrentActionObjectSelf( ));
+
+		SavedState->GetProgramGlobals( ) = SourceState.GetProgramGlobals( );
+		SavedState->GetLocals( )         = SourceState.GetLocals( );
+		SavedState->GetGlobals( )        = SourceState.GetGlobals( );
+
+		return SavedState;
+	}
+	catch (std::exception &e)
+	{
+		ErrorException( e );
+		throw;
+	}
+}
+
+void
+NWScriptNativeProgram::PushSavedState(
+	__in const NWScriptNativeSavedState & SourceState,
+	__in INWScriptStack * Stack,
+	__out PULONG ResumeMethodId,
+	__out PROGRAM_COUNTER * ResumeMethodPC,
+	__out PULONG SaveGlobalCount,
+	__out PULONG SaveLocalCount,
+	__out NWN::OBJECTID * CurrentActionObjectSelf
+	)
+/*++
+
+Routine Description:
+
+	This routine creates a copy of an existing saved state by pushing it onto
+	a VM stack (perhaps for serialization purposes).
+
+Arguments:
+
+	SourceState - Supplies the source saved state to save to the stack.  The
+	              state is not consumed by the operation.
+
+	Stack - Supplies the stack to save the state to.
+
+	ResumeMethodId - Receives the script situation id of the subroutine to
+	                 execute on resume.
+
+	ResumeMethodPC - Receives the NWScript program counter of the script
+	                 situation to execute on resume.
+
+	SaveGlobalCount - Receives the count of global variables that were placed
+	                  on to the stack.
+
+	SaveLocalCount - Receives the count of local variables that were placed on
+	                 to the stack.
+
+	CurrentActionObjectSelf - Receives the OBJECT_SELF object identifier for
+	                          the saved state.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	try
+	{
+		NWScriptNativeValueVec SavedBP( 1 );
+
+		if ((m_CodeGenFlags & NWCGF_ENABLE_SAVESTATE_TO_VMSTACK) == 0)
+			throw std::runtime_error( "Script program not generated with save state to stack enabled." );
+
+		*ResumeMethodId          = SourceState.GetResumeMethodId( );
+		*ResumeMethodPC          = SourceState.GetResumeMethodPC( );
+		*CurrentActionObjectSelf = SourceState.GetCurrentActionObjectSelf( );
+		*SaveGlobalCount         = (ULONG) SourceState.GetGlobals( ).size( );
+		*SaveLocalCount          = (ULONG) SourceState.GetLocals( ).size( );
+
+		PushVariablesToStack( Stack, SourceState.GetGlobals( ) );
+
+		//
+		// Push a dummy saved BP on to the stack so that the saved state image
+		// is compatible with the VM.
+		//
+
+		GetDefaultValue( ACTIONTYPE_INT, SavedBP[ 0 ] );
+		PushVariablesToStack( Stack, SavedBP );
+
+		PushVariablesToStack( Stack, SourceState.GetLocals( ) );
+	}
+	catch (std::exception &e)
+	{
+		ErrorException( e );
+		throw;
+	}
+}
+
+NWScriptNativeSavedStatePtr
+NWScriptNativeProgram::PopSavedState(
+	__in INWScriptStack * Stack,
+	__in ULONG ResumeMethodId,
+	__in PROGRAM_COUNTER ResumeMethodPC,
+	__in ULONG SaveGlobalCount,
+	__in ULONG SaveLocalCount,
+	__in NWN::OBJECTID CurrentActionObjectSelf
+	)
+/*++
+
+Routine Description:
+
+	This routine instantiates a saved state from variables stored on a VM
+	stack.
+
+	N.B.  Attempting to restore a stack with an incorrect number of values on
+	      the stack will result in a restore-time exception.  Attempting to
+	      restore a stack with incorrect types on the stack results in a
+	      failure when the saved state is executed.
+
+Arguments:
+
+	Stack - Supplies the stack to restore the state from.  Note that the stack
+	        is configured as the active stack for the instance.
+
+	ResumeMethodId - Supplies the script situation id of the subroutine to
+	                 execute on resume.
+
+	ResumeMethodPC - Supplies the NWScript program counter of the script
+	                 situation to execute on resume.
+
+	SaveGlobalCount - Supplies the count of global variables that were placed
+	                  on to the stack.
+
+	SaveLocalCount - Supplies the count of local variables that were placed on
+	                 to the stack.
+
+	CurrentActionObjectSelf - Supplies the OBJECT_SELF object identifier for
+	                          the saved state.
+
+Return Value:
+
+	The routine returns the new saved state on success.  On failure, an
+	std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	try
+	{
+		NWScriptNativeSavedStatePtr SavedState;
+		NWScriptNativeValueVec      SavedBP;
+		size_t                      NumGlobals;
+
+		if ((m_CodeGenFlags & NWCGF_ENABLE_SAVESTATE_TO_VMSTACK) == 0)
+			throw std::runtime_error( "Script program not generated with save state to stack enabled." );
+
+		SavedState = new NWScriptNativeSavedState(
+			ResumeMethodId,
+			ResumeMethodPC,
+			Stack,
+			CurrentActionObjectSelf);
+
+		PopVariablesFromStack( Stack, SaveLocalCount, SavedState->GetLocals( ) );
+		PopVariablesFromStack( Stack, 1, SavedBP );
+		PopVariablesFromStack( Stack, SaveGlobalCount, SavedState->GetGlobals( ) );
+
+		//
+		// Rebuild the program globals from the globals loaded from the stack.
+		//
+		// N.B.  The globals are provided in order from the highest global to
+		//       the lowest global, whereas program globals are ordered from the
+		//       lowest global to the highest.
+		//
+
+		NumGlobals = m_Module.GlobalTypes.size( );
+
+		SavedState->GetProgramGlobals( ).resize( NumGlobals );
+
+		if (SaveGlobalCount == 0)
+		{
+			for (size_t i = 0; i < NumGlobals; i += 1)
+				GetDefaultValue( m_Module.GlobalTypes[ i ], SavedState->GetProgramGlobals( )[ i ] );
+		}
+		else
+		{
+			if (SaveGlobalCount < NumGlobals)
+				throw std::runtime_error( "Too few globals restored from stack." );
+
+			for (size_t i = 0; i < NumGlobals; i += 1)
+			{
+				SavedState->GetProgramGlobals( )[ i ] =
+					SavedState->GetGlobals( )[ (NumGlobals - i) - 1 ];
+			}
+		}
+
+		return SavedState;
+	}
+	catch (std::exception &e)
+	{
+		ErrorException( e );
+		throw;
+	}
+}
+
+void
+NWScriptNativeProgram::ConvertParameterList(
+	__in_ecount_opt( ParamCount ) const NWScriptParamString * Params,
+	__in size_t ParamCount,
+	__in NWScriptNativeExecution & Execution,
+	__out_ecount( m_Module.EntryPoint.ParameterTypes.size( ) ) ULONG64 * Slots
+	)
+/*++
+
+Routine Description:
+
+	This routine converts parameters to a script to their native types.
+
+Arguments:
+
+	Params - Supplies the parameters to convert.
+
+	ParamCount - Supplies the count of parameters.
+
+	Execution - Supplies the execution that owns any strings created.
+
+	Slots - Receives the entry point parameter slots.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	const std::vector< NWACTION_TYPE > & ParamTypes = m_Module.EntryPoint.ParameterTypes;
+
+	//
+	// Now map the untyped parameters into typed values based on the expected
+	// types of each one in the script program.
+	//
+
+	for (size_t i = 0; i < ParamTypes.size( ); i += 1)
+	{
+		const char * ParamValue;
+		size_t       ParamValueLen;
+
+		if (i < ParamCount)
+		{
+			ParamValue    = Params[ i ].String;
+			ParamValueLen = Params[ i ].Len;
+		}
+		else
+		{
+			ParamValue    = "";
+			ParamValueLen = 0;
+		}
+
+		switch (ParamTypes[ i ])
+		{
+
+		case ACTIONTYPE_INT:
+		case ACTIONTYPE_VOID: // Unused parameters default to integers
+			Slots[ i ] = (ULONG) atoi( ParamValue );
+			break;
+
+		case ACTIONTYPE_FLOAT:
+			{
+				float f = (float) atof( ParamValue );
+				ULONG Bits;
+
+				memcpy( &Bits, &f, sizeof( Bits ) );
+
+				Slots[ i ] = Bits;
+			}
+			break;
+
+		case ACTIONTYPE_STRING:
+			Slots[ i ] = Execution.CreateString( ParamValue, ParamValueLen );
+			break;
+
+		case ACTIONTYPE_OBJECT:
+			{
+				char          * Endp;
+				NWN::OBJECTID   ObjectId;
+
+				ObjectId = (NWN::OBJECTID) strtoul(
+					ParamValue,
+					&Endp,
+					10);
+
+				//
+				// If the conversion failed, return the invalid object id.
+				//
+
+				if (*Endp)
+					ObjectId = m_InvalidObjId;
+
+				Slots[ i ] = ObjectId;
+			}
+			break;
+
+		default:
+			{
+				char Msg[ 64 ];
+
+				StringCbPrintfA(
+					Msg,
+					sizeof( Msg ),
+					"Illegal entry point parameter type %lu (#%lu).",
+					(unsigned long) ParamTypes[ i ],
+					(unsigned long) i);
+
+				throw std::runtime_error( Msg );
+			}
+			break;
+
+		}
+	}
+}
+
+void
+NWScriptNativeProgram::PushVariablesToStack(
+	__in INWScriptStack * Stack,
+	__in const NWScriptNativeValueVec & Vars
+	)
+/*++
+
+Routine Description:
+
+	This routine places a variable set onto a VM stack.
+
+Arguments:
+
+	Stack - Supplies the stack to store the variables to.
+
+	Vars - Supplies the variable set to place on the stack.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	bool Verbose = IsDebugLevel( NWScriptVM::EDL_Verbose );
+
+	try
+	{
+		for (size_t n = Vars.size( ); n != 0; n -= 1)
+		{
+			const NWSCRIPT_NATIVE_VALUE & Var = Vars[ n - 1 ];
+
+			switch (Var.Type)
+			{
+
+			case ACTIONTYPE_INT:
+				if (Verbose)
+					m_TextOut->WriteText( "VMPUSH: (int) %d\n", (int) Var.Scalar );
+
+				Stack->StackPushInt( (int) Var.Scalar );
+				break;
+
+			case ACTIONTYPE_FLOAT:
+				{
+					float f;
+
+					memcpy( &f, &Var.Scalar, sizeof( f ) );
+
+					if (Verbose)
+						m_TextOut->WriteText( "VMPUSH: (float) %g\n", f );
+
+					Stack->StackPushFloat( f );
+				}
+				break;
+
+			case ACTIONTYPE_STRING:
+				{
+					INWScriptStack::NeutralString NeutralStr;
+
+					NeutralStr.first  = (char *) Var.String.data( );
+					NeutralStr.second = Var.String.size( );
+
+					if (Verbose)
+						m_TextOut->WriteText( "VMPUSH: (string) %s\n", Var.String.c_str( ) );
+
+					Stack->StackPushStringAsNeutral( NeutralStr );
+				}
+				break;
+
+			case ACTIONTYPE_OBJECT:
+				if (Verbose)
+					m_TextOut->WriteText( "VMPUSH: (object) %08X\n", Var.Scalar );
+
+				Stack->StackPushObjectId( (NWN::OBJECTID) Var.Scalar );
+				break;
+
+			default:
+				if ((!NWScriptNativeRuntime::IsEngineType( Var.Type )) ||
+				    (Var.Engine.get( ) == NULL))
+				{
+					throw std::runtime_error( "Attempted to save variable of unknown type." );
+				}
+
+				Stack->StackPushEngineStructure( Var.Engine );
+				break;
+
+			}
+		}
+	}
+	catch (...)
+	{
+		throw std::runtime_error( "StackPush failed." );
+	}
+}
+
+void
+NWScriptNativeProgram::PopVariablesFromStack(
+	__in INWScriptStack * Stack,
+	__in ULONG SaveVarCount,
+	__out NWScriptNativeValueVec & Vars
+	)
+/*++
+
+Routine Description:
+
+	This routine restores a variable set from a VM stack.
+
+Arguments:
+
+	Stack - Supplies the stack to restore the variables from.
+
+	SaveVarCount - Supplies the count of variables to remove from the stack.
+
+	Vars - Receives the variables, beginning with the top of the stack.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	bool Verbose = IsDebugLevel( NWScriptVM::EDL_Verbose );
+
+	Vars.clear( );
+	Vars.resize( SaveVarCount );
+
+	try
+	{
+		for (ULONG VarIdx = 0; VarIdx < SaveVarCount; VarIdx += 1)
+		{
+			NWSCRIPT_NATIVE_VALUE           & Var = Vars[ VarIdx ];
+			INWScriptStack::BASE_STACK_TYPE   VarType;
+
+			VarType = Stack->GetTopOfStackType( );
+
+			switch (VarType)
+			{
+
+			case INWScriptStack::BST_INT:
+				{
+					int i = Stack->StackPopInt( );
+
+					if (Verbose)
+						m_TextOut->WriteText( "VMPOP: (int) %d\n", i );
+
+					Var.Type   = ACTIONTYPE_INT;
+					Var.Scalar = (ULONG) i;
+				}
+				break;
+
+			case INWScriptStack::BST_FLOAT:
+				{
+					float f = Stack->StackPopFloat( );
+
+					if (Verbose)
+						m_TextOut->WriteText( "VMPOP: (float) %g\n", f );
+
+					Var.Type = ACTIONTYPE_FLOAT;
+					memcpy( &Var.Scalar, &f, sizeof( f ) );
+				}
+				break;
+
+			case INWScriptStack::BST_STRING:
+				{
+					INWScriptStack::NeutralString Str(
+						Stack->StackPopStringAsNeutral( ) );
+
+					try
+					{
+						Var.Type = ACTIONTYPE_STRING;
+
+						if (Str.second != 0)
+							Var.String.assign( Str.first, Str.second );
+
+						if (Verbose)
+							m_TextOut->WriteText( "VMPOP: (string) %s\n", Var.String.c_str( ) );
+					}
+					catch (...)
+					{
+						NWScriptStack::FreeNeutral( Str.first );
+						throw;
+					}
+
+					NWScriptStack::FreeNeutral( Str.first );
+				}
+				break;
+
+			case INWScriptStack::BST_OBJECTID:
+				{
+					NWN::OBJECTID o = Stack->StackPopObjectId( );
+
+					if (Verbose)
+						m_TextOut->WriteText( "VMPOP: (object) %08X\n", o );
+
+					Var.Type   = ACTIONTYPE_OBJECT;
+					Var.Scalar = (ULONG) o;
+				}
+				break;
+
+			default:
+				if ((VarType < INWScriptStack::BST_ENGINE_0) ||
+				    (VarType > INWScriptStack::BST_ENGINE_9))
+				{
+					throw std::runtime_error( "Attempted to restore variable of unknown type." );
+				}
+
+				Var.Type   = (NWACTION_TYPE) (ACTIONTYPE_ENGINE_0 + (VarType - INWScriptStack::BST_ENGINE_0));
+				Var.Engine = Stack->StackPopEngineStructure(
+					(INWScriptStack::ENGINE_STRUCTURE_NUMBER) (VarType - INWScriptStack::BST_ENGINE_0));
+				break;
+
+			}
+		}
+	}
+	catch (...)
+	{
+		throw std::runtime_error( "StackPop failed." );
+	}
+}
+
+void
+NWScriptNativeProgram::GetDefaultValue(
+	__in NWACTION_TYPE Type,
+	__out NWSCRIPT_NATIVE_VALUE & Value
+	) const
+/*++
+
+Routine Description:
+
+	This routine returns the default value of a variable of a given type.  An
+	engine structure defaults to a not yet created structure, which is created
+	on first use.
+
+Arguments:
+
+	Type - Supplies the type of the variable.
+
+	Value - Receives the default value.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	Value.Type   = Type;
+	Value.Scalar = (Type == ACTIONTYPE_OBJECT) ? (ULONG) m_InvalidObjId : 0;
+	Value.String.clear( );
+	Value.Engine = EngineStructurePtr( );
+}
+
+void
+NWScriptNativeProgram::ErrorException(
+	__in const std::exception & Excpt
+	) const
+/*++
+
+Routine Description:
+
+	This routine issues an error diagnostic for an error-level exception.
+
+Arguments:
+
+	Excpt - Supplies the exception to issue the diagnostic for.
+
+Return Value:
+
+	None.  This routine does not fail.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	if (!IsDebugLevel( NWScriptVM::EDL_Errors ))
+		return;
+
+	m_TextOut->WriteText(
+		"NWScriptNativeProgram: Exception: '%s' in script %s.\n",
+		Excpt.what( ),
+		m_ScriptName.c_str( ));
+}
@@ -0,0 +1,315 @@
+/*++
+
+Copyright (c) Ken Johnson (Skywing). All rights reserved.
+
+Module Name:
+
+	NWScriptNativeProgram.h
+
+Abstract:
+
+	This module defines the representation of a NWScript program that has been
+	compiled directly to native x86-64 code.
+
+--*/
+
+#ifndef _SOURCE_PROGRAMS_NWNSCRIPTJITNATIVE_NWSCRIPTNATIVEPROGRAM_H
+#define _SOURCE_PROGRAMS_NWNSCRIPTJITNATIVE_NWSCRIPTNATIVEPROGRAM_H
+
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+#include "NWScriptNativeRuntime.h"
+#include "NWScriptNativeCodeGenerator.h"
+#include "NWScriptNativeSavedState.h"
+
+class NWScriptNativeProgram
+{
+
+public:
+
+	typedef swutil::SharedPtr< NWScriptNativeProgram > Ptr;
+
+	typedef NWNScriptLib::PROGRAM_COUNTER PROGRAM_COUNTER;
+
+	//
+	// Generate native code for a script program.  Raises an std::exception
+	// on failure.
+	//
+
+	NWScriptNativeProgram(
+		__in const NWScriptAnalyzer * Analyzer,
+		__in_opt IDebugTextOut * TextOut,
+		__in ULONG DebugLevel,
+		__in INWScriptActions * ActionHandler,
+		__in NWN::OBJECTID ObjectInvalid,
+		__in_opt PCNWSCRIPT_JIT_PARAMS CodeGenParams
+		);
+
+	~NWScriptNativeProgram(
+		);
+
+	//
+	// Execute the script and return the result.
+	//
+
+	int
+	ExecuteScript(
+		__in INWScriptStack * VMStack,
+		__in NWN::OBJECTID ObjectSelf,
+		__in_ecount_opt( ParamCount ) const NWScriptParamString * Params,
+		__in size_t ParamCount,
+		__in int DefaultReturnCode,
+		__in ULONG Flags
+		);
+
+	//
+	// Execute a script situation.
+	//
+
+	void
+	ExecuteScriptSituation(
+		__in NWScriptNativeSavedState & ScriptState,
+		__in NWN::OBJECTID ObjectSelf
+		);
+
+	//
+	// Abort the currently running script program.
+	//
+
+	void
+	AbortScript(
+		);
+
+	//
+	// Return whether the script program has been aborted.
+	//
+
+	bool
+	IsScriptAborted(
+		) const;
+
+	//
+	// Return the most recently created saved state.
+	//
+
+	NWScriptNativeSavedStatePtr
+	GetSavedState(
+		);
+
+	//
+	// Duplicate a saved state.
+	//
+
+	NWScriptNativeSavedStatePtr
+	DuplicateSavedState(
+		__in const NWScriptNativeSavedState & SourceState
+		);
+
+	//
+	// Push a saved state on to a VM stack.
+	//
+
+	void
+	PushSavedState(
+		__in const NWScriptNativeSavedState & SourceState,
+		__in INWScriptStack * Stack,
+		__out PULONG ResumeMethodId,
+		__out PROGRAM_COUNTER * ResumeMethodPC,
+		__out PULONG SaveGlobalCount,
+		__out PULONG SaveLocalCount,
+		__out NWN::OBJECTID * CurrentActionObjectSelf
+		);
+
+	//
+	// Create a saved state from a VM stack.
+	//
+
+	NWScriptNativeSavedStatePtr
+	PopSavedState(
+		__in INWScriptStack * Stack,
+		__in ULONG ResumeMethodId,
+		__in PROGRAM_COUNTER ResumeMethodPC,
+		__in ULONG SaveGlobalCount,
+		__in ULONG SaveLocalCount,
+		__in NWN::OBJECTID CurrentActionObjectSelf
+		);
+
+	//
+	// Record the saved state created by a SAVE_STATE instruction.
+	//
+
+	inline
+	void
+	SetSavedState(
+		__in const NWScriptNativeSavedStatePtr & SavedState
+		)
+	{
+		m_SavedState = SavedState;
+	}
+
+	//
+	// Accessors used by the runtime support routines.
+	//
+
+	inline
+	INWScriptActions *
+	GetActionHandler(
+		) const
+	{
+		return m_ActionHandler;
+	}
+
+	inline
+	NWN::OBJECTID
+	GetObjectInvalid(
+		) const
+	{
+		return m_InvalidObjId;
+	}
+
+	inline
+	ULONG
+	GetCodeGenFlags(
+		) const
+	{
+		return m_CodeGenFlags;
+	}
+
+	inline
+	IDebugTextOut *
+	GetTextOut(
+		) const
+	{
+		return m_TextOut;
+	}
+
+	inline
+	bool
+	IsDebugLevel(
+		__in ULONG DebugLevel
+		) const
+	{
+		return ((m_TextOut != NULL) && (m_DebugLevel >= DebugLevel));
+	}
+
+	inline
+	const NWScriptNativeCodeGenerator::ProgramModule &
+	GetModule(
+		) const
+	{
+		return m_Module;
+	}
+
+private:
+
+	//
+	// Programs are not copyable.
+	//
+
+	NWScriptNativeProgram(
+		__in const NWScriptNativeProgram & other
+		);
+
+	NWScriptNativeProgram &
+	operator=(
+		__in const NWScriptNativeProgram & other
+		);
+
+	//
+	// Convert entry point parameters to their native types.
+	//
+
+	void
+	ConvertParameterList(
+		__in_ecount_opt( ParamCount ) const NWScriptParamString * Params,
+		__in size_t ParamCount,
+		__in NWScriptNativeExecution & Execution,
+		__out_ecount( m_Module.EntryPoint.ParameterTypes.size( ) ) ULONG64 * Slots
+		);
+
+	//
+	// Place a variable set on to a VM stack, or remove one from a VM stack.
+	//
+
+	void
+	PushVariablesToStack(
+		__in INWScriptStack * Stack,
+		__in const NWScriptNativeValueVec & Vars
+		);
+
+	void
+	PopVariablesFromStack(
+		__in INWScriptStack * Stack,
+		__in ULONG SaveVarCount,
+		__out NWScriptNativeValueVec & Vars
+		);
+
+	//
+	// Return the default value of a variable of a given type.
+	//
+
+	void
+	GetDefaultValue(
+		__in NWACTION_TYPE Type,
+		__out NWSCRIPT_NATIVE_VALUE & Value
+		) const;
+
+	//
+	// Issue an error diagnostic for an exception.
+	//
+
+	void
+	ErrorException(
+		__in const std::exception & Excpt
+		) const;
+
+	//
+	// Define the debug text output interface.
+	//
+
+	IDebugTextOut                            * m_TextOut;
+	ULONG                                      m_DebugLevel;
+
+	//
+	// Define the action handler used for action service calls.
+	//
+
+	INWScriptActions                         * m_ActionHandler;
+
+	//
+	// Define the generated code and its supporting data.
+	//
+
+	NWScriptNativeCodeGenerator::ProgramModule m_Module;
+
+	//
+	// Define the name of the script, for diagnostics.
+	//
+
+	std::string                                m_ScriptName;
+
+	//
+	// Define the state of the current (outermost) invocation.
+	//
+
+	NWN::OBJECTID                              m_CurrentActionObjectSelf;
+	NWN::OBJECTID                              m_InvalidObjId;
+	INWScriptStack                           * m_Stack;
+	bool                                       m_Aborted;
+	int                                        m_NestingLevel;
+	ULONG                                      m_CodeGenFlags;
+
+	//
+	// Define the most recently created saved state.
+	//
+
+	NWScriptNativeSavedStatePtr                m_SavedState;
+
+};
+
+typedef NWScriptNativeProgram::Ptr NWScriptNativeProgramPtr;
+
+#endif
+
@@ -0,0 +1,1462 @@
+/*++
+
+Copyright (c) Ken Johnson (Skywing). All rights reserved.
+
+Module Name:
+
+	NWScriptNativeRuntime.cpp
+
+Abstract:
+
+	This module houses the runtime environment of natively generated script
+	code, including executable memory management, the per-execution state, and
+	the support routines that generated code calls into.
+
+--*/
+
+#include "Precomp.h"
+#include "NWScriptNativeRuntime.h"
+#include "NWScriptNativeProgram.h"
+
+NWScriptNativeCode::NWScriptNativeCode(
+	__in const std::vector< unsigned char > & Image,
+	__in const std::vector< RUNTIME_FUNCTION > & FunctionTable
+	)
+/*++
+
+Routine Description:
+
+	This routine allocates executable memory for a generated module and copies
+	the module's image into it.  The memory is made read only once the image
+	has been copied, and the module's function table is then registered so
+	that exceptions may be dispatched through generated code.
+
+Arguments:
+
+	Image - Supplies the image of the module: its machine code, followed by
+	        the unwind information referenced by the function table.
+
+	FunctionTable - Supplies the function table of the module, sorted by
+	                address.  All addresses are relative to the start of the
+	                image.
+
+Return Value:
+
+	The newly constructed object.  Raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+: m_Base( NULL ),
+  m_Size( Image.size( ) ),
+  m_FunctionTable( FunctionTable ),
+  m_FunctionTableAdded( false )
+{
+	DWORD OldProtect;
+
+	if ((Image.empty( )) || (FunctionTable.empty( )))
+		throw std::runtime_error( "Generated module is empty." );
+
+	m_Base = (unsigned char *) VirtualAlloc(
+		NULL,
+		m_Size,
+		MEM_COMMIT | MEM_RESERVE,
+		PAGE_READWRITE);
+
+	if (m_Base == NULL)
+		throw std::bad_alloc( );
+
+	memcpy( m_Base, &Image[ 0 ], m_Size );
+
+	if (!VirtualProtect( m_Base, m_Size, PAGE_EXECUTE_READ, &OldProtect ))
+	{
+		VirtualFree( m_Base, 0, MEM_RELEASE );
+		m_Base = NULL;
+
+		throw std::runtime_error( "Failed to protect generated code." );
+	}
+
+	FlushInstructionCache( GetCurrentProcess( ), m_Base, m_Size );
+
+	if (!RtlAddFunctionTable(
+		&m_FunctionTable[ 0 ],
+		(DWORD) m_FunctionTable.size( ),
+		(DWORD64) m_Base))
+	{
+		VirtualFree( m_Base, 0, MEM_RELEASE );
+		m_Base = NULL;
+
+		throw std::runtime_error( "Failed to register generated code function table." );
+	}
+
+	m_FunctionTableAdded = true;
+}
+
+NWScriptNativeCode::~NWScriptNativeCode(
+	)
+/*++
+
+Routine Description:
+
+	This routine deregisters the function table of a generated module and
+	releases its executable memory.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	if (m_FunctionTableAdded)
+	{
+		RtlDeleteFunctionTable( &m_FunctionTable[ 0 ] );
+
+		m_FunctionTableAdded = false;
+	}
+
+	if (m_Base == NULL)
+		return;
+
+	VirtualFree( m_Base, 0, MEM_RELEASE );
+}
+
+NWScriptNativeExecution::NWScriptNativeExecution(
+	__in NWScriptNativeProgram * Program,
+	__in INWScriptStack * VMStack,
+	__in NWN::OBJECTID ObjectSelf
+	)
+/*++
+
+Routine Description:
+
+	This routine constructs a new execution of a generated program.  The
+	execution context is allocated with room for all program globals, which
+	start out zero initialized (i.e. as the integer zero, the empty string, or
+	a not yet created engine structure).
+
+Arguments:
+
+	Program - Supplies the program that is to be executed.
+
+	VMStack - Supplies the stack that is used to pass parameters to action
+	          service handlers.
+
+	ObjectSelf - Supplies the object id to reference for the 'object self'
+	             manifest constant.
+
+Return Value:
+
+	The newly constructed object.  Raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+: m_Program( Program ),
+  m_Stack( VMStack ),
+  m_Context( NULL ),
+  m_ChunkUsed( STRING_CHUNK_SIZE )
+{
+	const NWScriptNativeCodeGenerator::ProgramModule & Module = Program->GetModule( );
+	size_t                                             ContextSize;
+
+	ContextSize  = offsetof( NWSCRIPT_NATIVE_CONTEXT, Globals );
+	ContextSize += sizeof( ULONG64 ) * (Module.GlobalTypes.size( ) + 1);
+
+	m_ContextStorage.resize(
+		(ContextSize + sizeof( ULONG64 ) - 1) / sizeof( ULONG64 ),
+		0);
+
+	m_Context = (PNWSCRIPT_NATIVE_CONTEXT) &m_ContextStorage[ 0 ];
+
+	m_Context->Status          = NNS_SUCCESS;
+	m_Context->CallDepthBudget = Module.MaxCallDepth;
+	m_Context->LoopBudget      = Module.MaxLoopIterations;
+	m_Context->ObjectSelf      = ObjectSelf;
+	m_Context->Execution       = this;
+}
+
+NWScriptNativeExecution::~NWScriptNativeExecution(
+	)
+/*++
+
+Routine Description:
+
+	This routine deletes the current NWScriptNativeExecution object, releasing
+	all strings and engine structures created during the execution.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+}
+
+void
+NWScriptNativeExecution::Invoke(
+	__in size_t Subroutine,
+	__inout_ecount( SlotCount ) ULONG64 * Slots,
+	__in size_t SlotCount
+	)
+/*++
+
+Routine Description:
+
+	This routine transfers control to a generated subroutine via the module's
+	entry thunk, and converts a failure status recorded by generated code into
+	an exception once control has returned.
+
+Arguments:
+
+	Subroutine - Supplies the offset of the subroutine within the module.
+
+	Slots - Supplies the return value slots of the subroutine, followed by the
+	        parameter slots of the subroutine.  On return, the return value
+	        slots have been updated.
+
+	SlotCount - Supplies the count of slots.
+
+Return Value:
+
+	None.  Raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	const unsigned char   * Base;
+	NWSCRIPT_NATIVE_THUNK   Thunk;
+
+	Base  = m_Program->GetModule( ).Code->GetBase( );
+	Thunk = (NWSCRIPT_NATIVE_THUNK) (ULONG_PTR) Base;
+
+	m_Context->Status = NNS_SUCCESS;
+
+	Thunk( m_Context, Base + Subroutine, Slots, SlotCount );
+
+	switch (m_Context->Status)
+	{
+
+	case NNS_SUCCESS:
+		return;
+
+	case NNS_FAILED:
+		throw std::runtime_error( m_ErrorMessage );
+
+	default:
+		throw std::runtime_error(
+			NWScriptNativeRuntime::GetStatusMessage( m_Context->Status ) );
+
+	}
+}
+
+void
+NWScriptNativeExecution::SetError(
+	__in const char * Message
+	)
+/*++
+
+Routine Description:
+
+	This routine records a failure of a runtime support routine.  Generated
+	code returns to its caller once it observes the failure status, and the
+	failure is raised as an exception once control leaves generated code.
+
+	Only the first failure is retained.
+
+Arguments:
+
+	Message - Supplies the failure message.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	if (m_Context->Status != NNS_SUCCESS)
+		return;
+
+	try
+	{
+		m_ErrorMessage = Message;
+	}
+	catch (std::exception)
+	{
+	}
+
+	m_Context->Status = NNS_FAILED;
+}
+
+ULONG64
+NWScriptNativeExecution::CreateString(
+	__in_ecount_opt( Length ) const char * String,
+	__in size_t Length
+	)
+/*++
+
+Routine Description:
+
+	This routine creates a string in the execution's string storage.  Strings
+	are carved out of large chunks, which are released together when the
+	execution ends; strings larger than a chunk receive a chunk of their own.
+
+Arguments:
+
+	String - Optionally supplies the string contents.  If NULL, the caller is
+	         responsible for filling in the string data.
+
+	Length - Supplies the length of the string, in bytes.
+
+Return Value:
+
+	The string slot value (a PCNWSCRIPT_NATIVE_STRING) is returned.  The empty
+	string is represented by zero.  Raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	PNWSCRIPT_NATIVE_STRING   Str;
+	size_t                    Words;
+
+	if (Length == 0)
+		return 0;
+
+	Words = (offsetof( NWSCRIPT_NATIVE_STRING, Data ) + Length + sizeof( ULONG64 ) - 1) / sizeof( ULONG64 );
+
+	if (Words > STRING_CHUNK_SIZE)
+	{
+		//
+		// Large strings are placed in a dedicated chunk at the head of the
+		// list, so that the current (tail) chunk is unaffected.
+		//
+
+		m_StringChunks.push_front( std::vector< ULONG64 >( Words ) );
+
+		Str = (PNWSCRIPT_NATIVE_STRING) &m_StringChunks.front( )[ 0 ];
+	}
+	else
+	{
+		if (m_ChunkUsed + Words > STRING_CHUNK_SIZE)
+		{
+			m_StringChunks.push_back( std::vector< ULONG64 >( STRING_CHUNK_SIZE ) );
+			m_ChunkUsed = 0;
+		}
+
+		Str          = (PNWSCRIPT_NATIVE_STRING) &m_StringChunks.back( )[ m_ChunkUsed ];
+		m_ChunkUsed += Words;
+	}
+
+	Str->Length = Length;
+
+	if (String != NULL)
+		memcpy( Str->Data, String, Length );
+
+	return (ULONG64) (ULONG_PTR) Str;
+}
+
+ULONG64
+NWScriptNativeExecution::CreateEngineStructure(
+	__in const EngineStructurePtr & Struct
+	)
+/*++
+
+Routine Description:
+
+	This routine retains an engine structure for the lifetime of the execution
+	and returns a slot value that refers to it.
+
+Arguments:
+
+	Struct - Supplies the engine structure to retain.
+
+Return Value:
+
+	The engine structure slot value (an EngineStructurePtr *) is returned.
+	Raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	m_EngineStructures.push_back( Struct );
+
+	return (ULONG64) (ULONG_PTR) &m_EngineStructures.back( );
+}
+
+EngineStructurePtr
+NWScriptNativeExecution::GetEngineStructure(
+	__in NWACTION_TYPE Type,
+	__in ULONG64 Slot
+	)
+/*++
+
+Routine Description:
+
+	This routine returns the engine structure referenced by a slot.  Engine
+	structure variables that have not yet been assigned are represented by a
+	zero slot, in which case an empty engine structure is requested from the
+	action handler (as the VM would for an uninitialized variable).
+
+Arguments:
+
+	Type - Supplies the engine structure type of the slot.
+
+	Slot - Supplies the slot value.
+
+Return Value:
+
+	The engine structure is returned.  Raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	EngineStructurePtr Struct;
+
+	if (Slot != 0)
+		return *(EngineStructurePtr *) (ULONG_PTR) Slot;
+
+	Struct = m_Program->GetActionHandler( )->CreateEngineStructure(
+		(INWScriptStack::ENGINE_STRUCTURE_NUMBER) (Type - ACTIONTYPE_ENGINE_0));
+
+	if (Struct.get( ) == NULL)
+		throw std::runtime_error( "Failed to create engine structure." );
+
+	return Struct;
+}
+
+ULONG64
+NWScriptNativeExecution::StoreValue(
+	__in const NWSCRIPT_NATIVE_VALUE & Value
+	)
+/*++
+
+Routine Description:
+
+	This routine converts a typed value into a slot value.
+
+Arguments:
+
+	Value - Supplies the value to convert.
+
+Return Value:
+
+	The slot value is returned.  Raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	switch (Value.Type)
+	{
+
+	case ACTIONTYPE_INT:
+	case ACTIONTYPE_FLOAT:
+	case ACTIONTYPE_OBJECT:
+		return Value.Scalar;
+
+	case ACTIONTYPE_STRING:
+		return CreateString( Value.String.data( ), Value.String.size( ) );
+
+	default:
+		if (!NWScriptNativeRuntime::IsEngineType( Value.Type ))
+			throw std::runtime_error( "Attempted to store variable of unknown type." );
+
+		if (Value.Engine.get( ) == NULL)
+			return 0;
+
+		return CreateEngineStructure( Value.Engine );
+
+	}
+}
+
+void
+NWScriptNativeExecution::LoadValue(
+	__in NWACTION_TYPE Type,
+	__in ULONG64 Slot,
+	__out NWSCRIPT_NATIVE_VALUE & Value
+	)
+/*++
+
+Routine Description:
+
+	This routine converts a slot value into a typed value that may outlive the
+	execution.
+
+Arguments:
+
+	Type - Supplies the type of the slot.
+
+	Slot - Supplies the slot value.
+
+	Value - Receives the typed value.
+
+Return Value:
+
+	None.  Raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	Value.Type   = Type;
+	Value.Scalar = 0;
+	Value.String.clear( );
+	Value.Engine = EngineStructurePtr( );
+
+	switch (Type)
+	{
+
+	case ACTIONTYPE_INT:
+	case ACTIONTYPE_FLOAT:
+	case ACTIONTYPE_OBJECT:
+		Value.Scalar = (ULONG) Slot;
+		break;
+
+	case ACTIONTYPE_STRING:
+		if (Slot != 0)
+		{
+			PCNWSCRIPT_NATIVE_STRING Str = (PCNWSCRIPT_NATIVE_STRING) (ULONG_PTR) Slot;
+
+			Value.String.assign( Str->Data, Str->Length );
+		}
+		break;
+
+	default:
+		if (!NWScriptNativeRuntime::IsEngineType( Type ))
+			throw std::runtime_error( "Attempted to save variable of unknown type." );
+
+		Value.Engine = GetEngineStructure( Type, Slot );
+		break;
+
+	}
+}
+
+void
+NWScriptNativeExecution::PushSlot(
+	__in NWACTION_TYPE Type,
+	__in ULONG64 Slot
+	)
+/*++
+
+Routine Description:
+
+	This routine pushes the value of a slot on to the VM stack, for an action
+	service call that passes its parameters on the VM stack.
+
+Arguments:
+
+	Type - Supplies the type of the slot.
+
+	Slot - Supplies the slot value.
+
+Return Value:
+
+	None.  Raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	bool Verbose = m_Program->IsDebugLevel( NWScriptVM::EDL_Verbose );
+
+	switch (Type)
+	{
+
+	case ACTIONTYPE_INT:
+		if (Verbose)
+			m_Program->GetTextOut( )->WriteText( "VMPUSH: (int) %d\n", (int) (ULONG) Slot );
+
+		m_Stack->StackPushInt( (int) (ULONG) Slot );
+		break;
+
+	case ACTIONTYPE_FLOAT:
+		{
+			ULONG Bits = (ULONG) Slot;
+			float f    = *(float *) &Bits;
+
+			if (Verbose)
+				m_Program->GetTextOut( )->WriteText( "VMPUSH: (float) %g\n", f );
+
+			m_Stack->StackPushFloat( f );
+		}
+		break;
+
+	case ACTIONTYPE_STRING:
+		{
+			PCNWSCRIPT_NATIVE_STRING      Str = (PCNWSCRIPT_NATIVE_STRING) (ULONG_PTR) Slot;
+			INWScriptStack::NeutralString NeutralStr;
+
+			if (Str != NULL)
+			{
+				NeutralStr.first  = (char *) Str->Data;
+				NeutralStr.second = Str->Length;
+			}
+			else
+			{
+				NeutralStr.first  = (char *) "";
+				NeutralStr.second = 0;
+			}
+
+			if (Verbose)
+			{
+				m_Program->GetTextOut( )->WriteText(
+					"VMPUSH: (string) %.*s\n",
+					(int) NeutralStr.second,
+					NeutralStr.first);
+			}
+
+			m_Stack->StackPushStringAsNeutral( NeutralStr );
+		}
+		break;
+
+	case ACTIONTYPE_OBJECT:
+		if (Verbose)
+			m_Program->GetTextOut( )->WriteText( "VMPUSH: (object) %08X\n", (ULONG) Slot );
+
+		m_Stack->StackPushObjectId( (NWN::OBJECTID) Slot );
+		break;
+
+	default:
+		if (!NWScriptNativeRuntime::IsEngineType( Type ))
+			throw std::runtime_error( "Attempted to push variable of unknown type." );
+
+		m_Stack->StackPushEngineStructure( GetEngineStructure( Type, Slot ) );
+		break;
+
+	}
+}
+
+ULONG64
+NWScriptNativeExecution::PopSlot(
+	__in NWACTION_TYPE Type
+	)
+/*++
+
+Routine Description:
+
+	This routine pops a value of a given type from the VM stack, for an action
+	service call that returns its values on the VM stack.
+
+Arguments:
+
+	Type - Supplies the type of the value.
+
+Return Value:
+
+	The slot value is returned.  Raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	bool Verbose = m_Program->IsDebugLevel( NWScriptVM::EDL_Verbose );
+
+	switch (Type)
+	{
+
+	case ACTIONTYPE_INT:
+		{
+			int i = m_Stack->StackPopInt( );
+
+			if (Verbose)
+				m_Program->GetTextOut( )->WriteText( "VMPOP: (int) %d\n", i );
+
+			return (ULONG) i;
+		}
+
+	case ACTIONTYPE_FLOAT:
+		{
+			float f = m_Stack->StackPopFloat( );
+
+			if (Verbose)
+				m_Program->GetTextOut( )->WriteText( "VMPOP: (float) %g\n", f );
+
+			return *(ULONG *) &f;
+		}
+
+	case ACTIONTYPE_STRING:
+		{
+			INWScriptStack::NeutralString NeutralStr( m_Stack->StackPopStringAsNeutral( ) );
+			ULONG64                       Slot;
+
+			try
+			{
+				if (Verbose)
+				{
+					m_Program->GetTextOut( )->WriteText(
+						"VMPOP: (string) %.*s\n",
+						(int) NeutralStr.second,
+						NeutralStr.first != NULL ? NeutralStr.first : "");
+				}
+
+				Slot = CreateString( NeutralStr.first, NeutralStr.second );
+			}
+			catch (...)
+			{
+				NWScriptStack::FreeNeutral( NeutralStr.first );
+				throw;
+			}
+
+			NWScriptStack::FreeNeutral( NeutralStr.first );
+
+			return Slot;
+		}
+
+	case ACTIONTYPE_OBJECT:
+		{
+			NWN::OBJECTID o = m_Stack->StackPopObjectId( );
+
+			if (Verbose)
+				m_Program->GetTextOut( )->WriteText( "VMPOP: (object) %08X\n", o );
+
+			return o;
+		}
+
+	default:
+		if (!NWScriptNativeRuntime::IsEngineType( Type ))
+			throw std::runtime_error( "Attempted to pop variable of unknown type." );
+
+		return CreateEngineStructure(
+			m_Stack->StackPopEngineStructure(
+				(INWScriptStack::ENGINE_STRUCTURE_NUMBER) (Type - ACTIONTYPE_ENGINE_0)));
+
+	}
+}
+
+void
+NWScriptNativeRuntime::ExecuteAction(
+	__in PNWSCRIPT_NATIVE_CONTEXT Context,
+	__in const ActionSite * Site,
+	__inout ULONG64 * Area
+	)
+/*++
+
+Routine Description:
+
+	This routine is called from generated code in order to invoke an action
+	service handler.  Parameters are taken from the argument area and return
+	values are stored back into it.
+
+Arguments:
+
+	Context - Supplies the execution context.
+
+	Site - Supplies the descriptor of the call site.
+
+	Area - Supplies the argument area of the call site.  The area holds the
+	       return value cells of the action, followed by its parameter cells.
+
+Return Value:
+
+	None.  On failure, the execution status is set.
+
+Environment:
+
+	User mode, called from generated code.
+
+--*/
+{
+	NWScriptNativeExecution * Execution = Context->Execution;
+
+	try
+	{
+		if (Site->Fast)
+			ExecuteActionFast( Execution, Site, Area );
+		else
+			ExecuteActionSlow( Execution, Site, Area );
+
+		if (Execution->GetProgram( )->IsScriptAborted( ))
+			throw std::runtime_error( "Script aborted." );
+	}
+	catch (std::exception &e)
+	{
+		Execution->SetError( e.what( ) );
+	}
+	catch (...)
+	{
+		Execution->SetError( "Action service raised an unexpected exception." );
+	}
+}
+
+void
+NWScriptNativeRuntime::SaveState(
+	__in PNWSCRIPT_NATIVE_CONTEXT Context,
+	__in const SaveSite * Site,
+	__in const ULONG64 * Area
+	)
+/*++
+
+Routine Description:
+
+	This routine is called from generated code in order to capture a saved
+	state for a script situation (SAVE_STATE).  The state holds a copy of all
+	program globals, and the locals that are passed to the resume subroutine.
+
+Arguments:
+
+	Context - Supplies the execution context.
+
+	Site - Supplies the descriptor of the SAVE_STATE site.
+
+	Area - Supplies the argument area of the site, which holds the saved
+	       globals followed by the saved locals.
+
+Return Value:
+
+	None.  On failure, the execution status is set.
+
+Environment:
+
+	User mode, called from generated code.
+
+--*/
+{
+	NWScriptNativeExecution * Execution = Context->Execution;
+
+	try
+	{
+		NWScriptNativeProgram                            * Program = Execution->GetProgram( );
+		const NWScriptNativeCodeGenerator::ProgramModule & Module  = Program->GetModule( );
+		NWScriptNativeSavedStatePtr                        State;
+		size_t                                             Count;
+
+		State = new NWScriptNativeSavedState(
+			Site->ResumeMethodId,
+			Site->ResumeMethodPC,
+			Execution->GetStack( ),
+			Context->ObjectSelf);
+
+		Count = Module.GlobalTypes.size( );
+
+		State->GetProgramGlobals( ).resize( Count );
+
+		for (size_t i = 0; i < Count; i += 1)
+		{
+			Execution->LoadValue(
+				Module.GlobalTypes[ i ],
+				Context->Globals[ i ],
+				State->GetProgramGlobals( )[ i ]);
+		}
+
+		//
+		// The globals named by the SAVE_STATE instruction are only needed if
+		// the state may be transferred to a VM stack.
+		//
+
+		if (Program->GetCodeGenFlags( ) & NWCGF_ENABLE_SAVESTATE_TO_VMSTACK)
+		{
+			State->GetGlobals( ).resize( Site->NumGlobals );
+
+			for (size_t i = 0; i < Site->NumGlobals; i += 1)
+			{
+				Execution->LoadValue(
+					Site->Types[ i ],
+					Area[ i ],
+					State->GetGlobals( )[ i ]);
+			}
+		}
+
+		Count = Site->Types.size( ) - Site->NumGlobals;
+
+		State->GetLocals( ).resize( Count );
+
+		for (size_t i = 0; i < Count; i += 1)
+		{
+			Execution->LoadValue(
+				Site->Types[ Site->NumGlobals + i ],
+				Area[ Site->NumGlobals + i ],
+				State->GetLocals( )[ i ]);
+		}
+
+		Program->SetSavedState( State );
+	}
+	catch (std::exception &e)
+	{
+		Execution->SetError( e.what( ) );
+	}
+}
+
+ULONG64
+NWScriptNativeRuntime::ConcatenateStrings(
+	__in PNWSCRIPT_NATIVE_CONTEXT Context,
+	__in ULONG64 Left,
+	__in ULONG64 Right
+	)
+/*++
+
+Routine Description:
+
+	This routine is called from generated code in order to concatenate two
+	strings.
+
+Arguments:
+
+	Context - Supplies the execution context.
+
+	Left - Supplies the left string.
+
+	Right - Supplies the right string.
+
+Return Value:
+
+	The concatenated string is returned.  On failure, the execution status is
+	set.
+
+Environment:
+
+	User mode, called from generated code.
+
+--*/
+{
+	PCNWSCRIPT_NATIVE_STRING LeftStr  = (PCNWSCRIPT_NATIVE_STRING) (ULONG_PTR) Left;
+	PCNWSCRIPT_NATIVE_STRING RightStr = (PCNWSCRIPT_NATIVE_STRING) (ULONG_PTR) Right;
+
+	//
+	// Strings are immutable, so concatenation with the empty string may simply
+	// return the other operand.
+	//
+
+	if (LeftStr == NULL)
+		return Right;
+	else if (RightStr == NULL)
+		return Left;
+
+	try
+	{
+		ULONG64                 Slot;
+		PNWSCRIPT_NATIVE_STRING Str;
+
+		Slot = Context->Execution->CreateString(
+			NULL,
+			LeftStr->Length + RightStr->Length);
+		Str  = (PNWSCRIPT_NATIVE_STRING) (ULONG_PTR) Slot;
+
+		memcpy( Str->Data, LeftStr->Data, LeftStr->Length );
+		memcpy( Str->Data + LeftStr->Length, RightStr->Data, RightStr->Length );
+
+		return Slot;
+	}
+	catch (std::exception &e)
+	{
+		Context->Execution->SetError( e.what( ) );
+		return 0;
+	}
+}
+
+ULONG
+NWScriptNativeRuntime::CompareStrings(
+	__in ULONG64 Left,
+	__in ULONG64 Right
+	)
+/*++
+
+Routine Description:
+
+	This routine is called from generated code in order to compare two strings
+	for equality.
+
+Arguments:
+
+	Left - Supplies the left string.
+
+	Right - Supplies the right string.
+
+Return Value:
+
+	The routine returns 1 if the strings are equal, else 0.
+
+Environment:
+
+	User mode, called from generated code.
+
+--*/
+{
+	PCNWSCRIPT_NATIVE_STRING LeftStr  = (PCNWSCRIPT_NATIVE_STRING) (ULONG_PTR) Left;
+	PCNWSCRIPT_NATIVE_STRING RightStr = (PCNWSCRIPT_NATIVE_STRING) (ULONG_PTR) Right;
+	size_t                   LeftLength;
+	size_t                   RightLength;
+
+	if (LeftStr == RightStr)
+		return 1;
+
+	LeftLength  = (LeftStr != NULL)  ? LeftStr->Length  : 0;
+	RightLength = (RightStr != NULL) ? RightStr->Length : 0;
+
+	if (LeftLength != RightLength)
+		return 0;
+	else if (LeftLength == 0)
+		return 1;
+
+	return (memcmp( LeftStr->Data, RightStr->Data, LeftLength ) == 0) ? 1 : 0;
+}
+
+ULONG
+NWScriptNativeRuntime::CompareEngineStructures(
+	__in PNWSCRIPT_NATIVE_CONTEXT Context,
+	__in ULONG Type,
+	__in ULONG64 Left,
+	__in ULONG64 Right
+	)
+/*++
+
+Routine Description:
+
+	This routine is called from generated code in order to compare two engine
+	structures of the same type for equality.
+
+Arguments:
+
+	Context - Supplies the execution context.
+
+	Type - Supplies the engine structure type (an NWACTION_TYPE).
+
+	Left - Supplies the left engine structure.
+
+	Right - Supplies the right engine structure.
+
+Return Value:
+
+	The routine returns 1 if the engine structures are equal, else 0.  On
+	failure, the execution status is set.
+
+Environment:
+
+	User mode, called from generated code.
+
+--*/
+{
+	try
+	{
+		EngineStructurePtr LeftStruct;
+		EngineStructurePtr RightStruct;
+
+		LeftStruct  = Context->Execution->GetEngineStructure( (NWACTION_TYPE) Type, Left );
+		RightStruct = Context->Execution->GetEngineStructure( (NWACTION_TYPE) Type, Right );
+
+		if (LeftStruct->GetEngineType( ) != RightStruct->GetEngineType( ))
+			throw std::runtime_error( "Comparing engine structures of incompatible types." );
+
+		return LeftStruct->CompareEngineStructure( RightStruct.get( ) ) ? 1 : 0;
+	}
+	catch (std::exception &e)
+	{
+		Context->Execution->SetError( e.what( ) );
+		return 0;
+	}
+}
+
+const char *
+NWScriptNativeRuntime::GetStatusMessage(
+	__in ULONG Status
+	)
+/*++
+
+Routine Description:
+
+	This routine returns the message that describes a failure status raised
+	directly by generated code.
+
+Arguments:
+
+	Status - Supplies the status code, drawn from the NWSCRIPT_NATIVE_STATUS
+	         family of enumerations.
+
+Return Value:
+
+	A pointer to a static string describing the status is returned.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	switch (Status)
+	{
+
+	case NNS_SUCCESS:
+		return "The operation completed successfully.";
+
+	case NNS_CALL_DEPTH_EXCEEDED:
+		return "Maximum call depth exceeded.";
+
+	case NNS_LOOP_LIMIT_EXCEEDED:
+		return "Maximum loop iterations exceeded.";
+
+	case NNS_DIVIDE_BY_ZERO:
+		return "Attempted to divide by zero.";
+
+	case NNS_QUOTIENT_OVERFLOW:
+		return "Quotient overflow in integer division.";
+
+	default:
+		return "Script execution failed.";
+
+	}
+}
+
+bool
+NWScriptNativeRuntime::IsSupportedType(
+	__in NWACTION_TYPE Type
+	)
+/*++
+
+Routine Description:
+
+	This routine determines whether a variable type may be represented by
+	generated code.
+
+Arguments:
+
+	Type - Supplies the type to check.
+
+Return Value:
+
+	The routine returns true if the type is supported, else false.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	switch (Type)
+	{
+
+	case ACTIONTYPE_INT:
+	case ACTIONTYPE_FLOAT:
+	case ACTIONTYPE_STRING:
+	case ACTIONTYPE_OBJECT:
+		return true;
+
+	default:
+		return IsEngineType( Type );
+
+	}
+}
+
+bool
+NWScriptNativeRuntime::IsPointerType(
+	__in NWACTION_TYPE Type
+	)
+/*++
+
+Routine Description:
+
+	This routine determines whether variables of a type hold a pointer (and so
+	occupy a full 64-bit slot).
+
+Arguments:
+
+	Type - Supplies the type to check.
+
+Return Value:
+
+	The routine returns true if the type is held by pointer, else false.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	return (Type == ACTIONTYPE_STRING) || (IsEngineType( Type ));
+}
+
+bool
+NWScriptNativeRuntime::IsEngineType(
+	__in NWACTION_TYPE Type
+	)
+/*++
+
+Routine Description:
+
+	This routine determines whether a type is an engine structure type.
+
+Arguments:
+
+	Type - Supplies the type to check.
+
+Return Value:
+
+	The routine returns true if the type is an engine structure type, else
+	false.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	return (Type >= ACTIONTYPE_ENGINE_0) && (Type <= ACTIONTYPE_ENGINE_9);
+}
+
+void
+NWScriptNativeRuntime::ExecuteActionFast(
+	__in NWScriptNativeExecution * Execution,
+	__in const ActionSite * Site,
+	__inout ULONG64 * Area
+	)
+/*++
+
+Routine Description:
+
+	This routine invokes an action service handler via the fast action service
+	interface, which passes parameters and return values directly rather than
+	through the VM stack.
+
+	The command list was built when the call site was generated: parameters
+	are pushed from the last area cell down to the first parameter cell, and
+	return values are popped into the return cells from the last down to the
+	first, matching the order that the VM stack would be used in.
+
+Arguments:
+
+	Execution - Supplies the current execution.
+
+	Site - Supplies the descriptor of the call site.
+
+	Area - Supplies the argument area of the call site.
+
+Return Value:
+
+	None.  Raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	NWScriptNativeProgram         * Program = Execution->GetProgram( );
+	uintptr_t                       CmdParams[ MAX_FAST_ACTION_CELLS ];
+	INWScriptStack::NeutralString   Strings[ MAX_FAST_ACTION_CELLS ];
+	size_t                          Count;
+	size_t                          Index;
+	bool                            Succeeded;
+
+	if (Program->IsDebugLevel( NWScriptVM::EDL_Verbose ))
+	{
+		Program->GetTextOut( )->WriteText(
+			"VMACTIONFAST: %lu (%lu arguments)\n",
+			(unsigned long) Site->ActionId,
+			(unsigned long) Site->NumArguments);
+	}
+
+	Count = Site->Types.size( );
+	Index = 0;
+
+	for (size_t i = Count; i != Site->NumReturnCells; i -= 1)
+	{
+		switch (Site->Types[ i - 1 ])
+		{
+
+		case ACTIONTYPE_STRING:
+			{
+				PCNWSCRIPT_NATIVE_STRING Str = (PCNWSCRIPT_NATIVE_STRING) (ULONG_PTR) Area[ i - 1 ];
+
+				if (Str != NULL)
+				{
+					Strings[ i - 1 ].first  = (char *) Str->Data;
+					Strings[ i - 1 ].second = Str->Length;
+				}
+				else
+				{
+					Strings[ i - 1 ].first  = (char *) "";
+					Strings[ i - 1 ].second = 0;
+				}
+
+				CmdParams[ Index ] = (uintptr_t) &Strings[ i - 1 ];
+			}
+			break;
+
+		default:
+			CmdParams[ Index ] = (uintptr_t) (ULONG) Area[ i - 1 ];
+			break;
+
+		}
+
+		Index += 1;
+	}
+
+	for (size_t i = Site->NumReturnCells; i != 0; i -= 1)
+	{
+		if (Site->Types[ i - 1 ] == ACTIONTYPE_STRING)
+		{
+			Strings[ i - 1 ].first  = NULL;
+			Strings[ i - 1 ].second = 0;
+
+			CmdParams[ Index ] = (uintptr_t) &Strings[ i - 1 ];
+		}
+		else
+		{
+			Area[ i - 1 ]      = 0;
+			CmdParams[ Index ] = (uintptr_t) &Area[ i - 1 ];
+		}
+
+		Index += 1;
+	}
+
+	try
+	{
+		Succeeded = Program->GetActionHandler( )->OnExecuteActionFromJITFast(
+			Site->ActionId,
+			Site->NumArguments,
+			&Site->Cmds[ 0 ],
+			Site->Cmds.size( ),
+			CmdParams);
+
+		if (Succeeded)
+		{
+			for (size_t i = 0; i < Site->NumReturnCells; i += 1)
+			{
+				if (Site->Types[ i ] != ACTIONTYPE_STRING)
+					continue;
+
+				Area[ i ] = Execution->CreateString(
+					Strings[ i ].first,
+					Strings[ i ].second);
+			}
+		}
+	}
+	catch (...)
+	{
+		for (size_t i = 0; i < Site->NumReturnCells; i += 1)
+		{
+			if (Site->Types[ i ] == ACTIONTYPE_STRING)
+				NWScriptStack::FreeNeutral( Strings[ i ].first );
+		}
+
+		throw;
+	}
+
+	for (size_t i = 0; i < Site->NumReturnCells; i += 1)
+	{
+		if (Site->Types[ i ] == ACTIONTYPE_STRING)
+			NWScriptStack::FreeNeutral( Strings[ i ].first );
+	}
+
+	if (!Succeeded)
+	{
+		char Msg[ 64 ];
+
+		StringCbPrintfA(
+			Msg,
+			sizeof( Msg ),
+			"Action service %lu invocation failed.",
+			(unsigned long) Site->ActionId);
+
+		throw std::runtime_error( Msg );
+	}
+}
+
+void
+NWScriptNativeRuntime::ExecuteActionSlow(
+	__in NWScriptNativeExecution * Execution,
+	__in const ActionSite * Site,
+	__inout ULONG64 * Area
+	)
+/*++
+
+Routine Description:
+
+	This routine invokes an action service handler, passing parameters and
+	return values on the VM stack.  The slow path is used for call sites that
+	involve engine structures.
+
+Arguments:
+
+	Execution - Supplies the current execution.
+
+	Site - Supplies the descriptor of the call site.
+
+	Area - Supplies the argument area of the call site.
+
+Return Value:
+
+	None.  Raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	NWScriptNativeProgram * Program = Execution->GetProgram( );
+	size_t                  Count;
+
+	Count = Site->Types.size( );
+
+	for (size_t i = Count; i != Site->NumReturnCells; i -= 1)
+		Execution->PushSlot( Site->Types[ i - 1 ], Area[ i - 1 ] );
+
+	if (Program->IsDebugLevel( NWScriptVM::EDL_Verbose ))
+	{
+		Program->GetTextOut( )->WriteText(
+			"VMACTION: %lu (%lu arguments)\n",
+			(unsigned long) Site->ActionId,
+			(unsigned long) Site->NumArguments);
+	}
+
+	if (!Program->GetActionHandler( )->OnExecuteActionFromJIT(
+		Site->ActionId,
+		Site->NumArguments))
+	{
+		char Msg[ 64 ];
+
+		StringCbPrintfA(
+			Msg,
+			sizeof( Msg ),
+			"Action service %lu invocation failed.",
+			(unsigned long) Site->ActionId);
+
+		throw std::runtime_error( Msg );
+	}
+
+	for (size_t i = Site->NumReturnCells; i != 0; i -= 1)
+		Area[ i - 1 ] = Execution->PopSlot( Site->Types[ i - 1 ] );
+}
+
@@ -0,0 +1,496 @@
+/*++
+
+Copyright (c) Ken Johnson (Skywing). All rights reserved.
+
+Module Name:
+
+	NWScriptNativeRuntime.h
+
+Abstract:
+
+	This module defines the runtime environment of natively generated script
+	code.  This includes the execution context that generated code operates
+	against, the representation of script values within generated code, and
+	the support routines that generated code calls into for operations that
+	are not expanded inline (such as action service calls).
+
+--*/
+
+#ifndef _SOURCE_PROGRAMS_NWNSCRIPTJITNATIVE_NWSCRIPTNATIVERUNTIME_H
+#define _SOURCE_PROGRAMS_NWNSCRIPTJITNATIVE_NWSCRIPTNATIVERUNTIME_H
+
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+class NWScriptNativeProgram;
+class NWScriptNativeExecution;
+class NWScriptNativeSavedState;
+
+//
+// Define the execution status of generated code.  Generated code does not
+// raise exceptions; instead, a failing operation records a status code in
+// the execution context and returns to the caller, and each caller checks the
+// status after every call that may fail.  (Unwind data is registered for
+// generated code all the same, so that a structured exception raised beneath
+// it, such as by an action service handler, can unwind through it.)
+//
+
+typedef enum _NWSCRIPT_NATIVE_STATUS
+{
+	NNS_SUCCESS,
+	NNS_FAILED,                // Message is held by the execution object
+	NNS_CALL_DEPTH_EXCEEDED,
+	NNS_LOOP_LIMIT_EXCEEDED,
+	NNS_DIVIDE_BY_ZERO,
+	NNS_QUOTIENT_OVERFLOW,
+
+	LAST_NNS_STATUS
+} NWSCRIPT_NATIVE_STATUS, * PNWSCRIPT_NATIVE_STATUS;
+
+typedef const enum _NWSCRIPT_NATIVE_STATUS * PCNWSCRIPT_NATIVE_STATUS;
+
+//
+// Define the representation of a string within generated code.  A string
+// variable holds a pointer to a counted string, or NULL for the empty string.
+// Strings are immutable once created.
+//
+
+typedef struct _NWSCRIPT_NATIVE_STRING
+{
+	size_t Length;
+	char   Data[ 1 ];
+} NWSCRIPT_NATIVE_STRING, * PNWSCRIPT_NATIVE_STRING;
+
+typedef const struct _NWSCRIPT_NATIVE_STRING * PCNWSCRIPT_NATIVE_STRING;
+
+//
+// Define the execution context of generated code.  Generated code keeps the
+// context address in a dedicated register for the duration of the execution,
+// and global variables are addressed relative to it.
+//
+// Each variable (whether global, local, parameter or return value) occupies
+// one 64-bit slot.  Integers, floats and object ids occupy the low 32 bits of
+// their slot.  String slots hold a PCNWSCRIPT_NATIVE_STRING, and engine
+// structure slots hold an EngineStructurePtr * (or NULL for an engine
+// structure that has not yet been created).
+//
+
+typedef struct _NWSCRIPT_NATIVE_CONTEXT
+{
+	ULONG                     Status;
+	LONG                      CallDepthBudget;
+	LONG                      LoopBudget;
+	NWN::OBJECTID             ObjectSelf;
+	NWScriptNativeExecution * Execution;
+	ULONG64                   Globals[ 1 ];
+} NWSCRIPT_NATIVE_CONTEXT, * PNWSCRIPT_NATIVE_CONTEXT;
+
+typedef const struct _NWSCRIPT_NATIVE_CONTEXT * PCNWSCRIPT_NATIVE_CONTEXT;
+
+//
+// Define a typed script value that lives outside of generated code, such as a
+// variable captured by a saved state.
+//
+
+typedef struct _NWSCRIPT_NATIVE_VALUE
+{
+	NWACTION_TYPE      Type;
+	ULONG              Scalar;   // Int, float bits or object id
+	std::string        String;
+	EngineStructurePtr Engine;
+} NWSCRIPT_NATIVE_VALUE, * PNWSCRIPT_NATIVE_VALUE;
+
+typedef const struct _NWSCRIPT_NATIVE_VALUE * PCNWSCRIPT_NATIVE_VALUE;
+
+typedef std::vector< NWSCRIPT_NATIVE_VALUE > NWScriptNativeValueVec;
+
+//
+// Define the entry thunk, which is placed at the start of every generated
+// module.  The thunk establishes the register state that generated code
+// expects, copies the argument slots (return values first, then parameters)
+// on to the stack, calls the subroutine, and copies the slots back out.
+//
+
+typedef
+void
+(* NWSCRIPT_NATIVE_THUNK)(
+	__in PNWSCRIPT_NATIVE_CONTEXT Context,
+	__in const void * Subroutine,
+	__inout_ecount( SlotCount ) ULONG64 * Slots,
+	__in size_t SlotCount
+	);
+
+//
+// Define executable memory that holds a generated module.
+//
+
+class NWScriptNativeCode
+{
+
+public:
+
+	typedef swutil::SharedPtr< NWScriptNativeCode > Ptr;
+
+	//
+	// Copy a generated module image (its code followed by its unwind
+	// information) into newly allocated executable memory, and register the
+	// module's function table, whose addresses are relative to the start of
+	// the image, with the system.  Raises an std::exception on failure.
+	//
+
+	NWScriptNativeCode(
+		__in const std::vector< unsigned char > & Image,
+		__in const std::vector< RUNTIME_FUNCTION > & FunctionTable
+		);
+
+	~NWScriptNativeCode(
+		);
+
+	inline
+	const unsigned char *
+	GetBase(
+		) const
+	{
+		return m_Base;
+	}
+
+private:
+
+	//
+	// Code blocks are not copyable.
+	//
+
+	NWScriptNativeCode(
+		__in const NWScriptNativeCode & other
+		);
+
+	NWScriptNativeCode &
+	operator=(
+		__in const NWScriptNativeCode & other
+		);
+
+	unsigned char                   * m_Base;
+	size_t                            m_Size;
+	std::vector< RUNTIME_FUNCTION >   m_FunctionTable;
+	bool                              m_FunctionTableAdded;
+
+};
+
+//
+// Define the state of one execution of generated code (a call to
+// ExecuteScript or ExecuteScriptSituation).  The execution owns the global
+// variable storage and all strings and engine structures created while the
+// script runs; these are released when the execution ends.
+//
+
+class NWScriptNativeExecution
+{
+
+public:
+
+	NWScriptNativeExecution(
+		__in NWScriptNativeProgram * Program,
+		__in INWScriptStack * VMStack,
+		__in NWN::OBJECTID ObjectSelf
+		);
+
+	~NWScriptNativeExecution(
+		);
+
+	inline
+	PNWSCRIPT_NATIVE_CONTEXT
+	GetContext(
+		)
+	{
+		return m_Context;
+	}
+
+	inline
+	NWScriptNativeProgram *
+	GetProgram(
+		)
+	{
+		return m_Program;
+	}
+
+	inline
+	INWScriptStack *
+	GetStack(
+		)
+	{
+		return m_Stack;
+	}
+
+	//
+	// Run a generated subroutine.  The slot array holds the return value slots
+	// of the subroutine followed by its parameter slots.  Raises an
+	// std::exception if the script fails.
+	//
+
+	void
+	Invoke(
+		__in size_t Subroutine,
+		__inout_ecount( SlotCount ) ULONG64 * Slots,
+		__in size_t SlotCount
+		);
+
+	//
+	// Record a failure of the script, to be raised once control returns from
+	// generated code.
+	//
+
+	void
+	SetError(
+		__in const char * Message
+		);
+
+	//
+	// Create a string that lives as long as the execution.  If no initial
+	// contents are supplied, the caller fills in the string data.
+	//
+
+	ULONG64
+	CreateString(
+		__in_ecount_opt( Length ) const char * String,
+		__in size_t Length
+		);
+
+	//
+	// Store an engine structure for the lifetime of the execution.
+	//
+
+	ULONG64
+	CreateEngineStructure(
+		__in const EngineStructurePtr & Struct
+		);
+
+	//
+	// Return the engine structure held by a slot, creating an empty engine
+	// structure of the given type if the slot does not yet hold one.
+	//
+
+	EngineStructurePtr
+	GetEngineStructure(
+		__in NWACTION_TYPE Type,
+		__in ULONG64 Slot
+		);
+
+	//
+	// Convert between slots and typed values.
+	//
+
+	ULONG64
+	StoreValue(
+		__in const NWSCRIPT_NATIVE_VALUE & Value
+		);
+
+	void
+	LoadValue(
+		__in NWACTION_TYPE Type,
+		__in ULONG64 Slot,
+		__out NWSCRIPT_NATIVE_VALUE & Value
+		);
+
+	//
+	// Push the value of a slot on to the VM stack, or pop a slot's value from
+	// the VM stack.
+	//
+
+	void
+	PushSlot(
+		__in NWACTION_TYPE Type,
+		__in ULONG64 Slot
+		);
+
+	ULONG64
+	PopSlot(
+		__in NWACTION_TYPE Type
+		);
+
+private:
+
+	enum
+	{
+		STRING_CHUNK_SIZE = 4096,
+
+		LAST_EXECUTION_CONSTANT
+	};
+
+	typedef std::list< std::vector< ULONG64 > > ChunkList;
+	typedef std::list< EngineStructurePtr >      EngineStructureList;
+
+	//
+	// Executions are not copyable.
+	//
+
+	NWScriptNativeExecution(
+		__in const NWScriptNativeExecution & other
+		);
+
+	NWScriptNativeExecution &
+	operator=(
+		__in const NWScriptNativeExecution & other
+		);
+
+	NWScriptNativeProgram    * m_Program;
+	INWScriptStack           * m_Stack;
+	std::vector< ULONG64 >     m_ContextStorage;
+	PNWSCRIPT_NATIVE_CONTEXT   m_Context;
+	std::string                m_ErrorMessage;
+	ChunkList                  m_StringChunks;
+	size_t                     m_ChunkUsed;
+	EngineStructureList        m_EngineStructures;
+
+};
+
+//
+// Define the support routines that generated code calls.  Each routine
+// records failures in the execution context rather than raising exceptions,
+// as exceptions cannot propagate through generated code.
+//
+
+class NWScriptNativeRuntime
+{
+
+public:
+
+	enum
+	{
+		//
+		// Define the largest action parameter list that is passed through the
+		// fast action service interface.  Larger lists use the VM stack.
+		//
+
+		MAX_FAST_ACTION_CELLS = 64,
+
+		LAST_RUNTIME_CONSTANT
+	};
+
+	//
+	// Describe an action service call site.  The argument area passed to
+	// ExecuteAction holds one slot per action parameter list entry (return
+	// values first, then parameters in analyzer order).
+	//
+
+	struct ActionSite
+	{
+		NWSCRIPT_ACTION                 ActionId;
+		size_t                          NumArguments;
+		size_t                          NumReturnCells;
+		bool                            Fast;
+		std::vector< NWACTION_TYPE >    Types;
+		std::vector< NWFASTACTION_CMD > Cmds;
+	};
+
+	//
+	// Describe a SAVE_STATE site.  The argument area passed to SaveState holds
+	// one slot per saved global, followed by one slot per saved local.
+	//
+
+	struct SaveSite
+	{
+		ULONG                         ResumeMethodId;
+		NWNScriptLib::PROGRAM_COUNTER ResumeMethodPC;
+		size_t                        NumGlobals;
+		std::vector< NWACTION_TYPE >  Types;
+	};
+
+	typedef std::list< ActionSite > ActionSiteList;
+	typedef std::list< SaveSite >   SaveSiteList;
+
+	static
+	void
+	ExecuteAction(
+		__in PNWSCRIPT_NATIVE_CONTEXT Context,
+		__in const ActionSite * Site,
+		__inout ULONG64 * Area
+		);
+
+	static
+	void
+	SaveState(
+		__in PNWSCRIPT_NATIVE_CONTEXT Context,
+		__in const SaveSite * Site,
+		__in const ULONG64 * Area
+		);
+
+	static
+	ULONG64
+	ConcatenateStrings(
+		__in PNWSCRIPT_NATIVE_CONTEXT Context,
+		__in ULONG64 Left,
+		__in ULONG64 Right
+		);
+
+	static
+	ULONG
+	CompareStrings(
+		__in ULONG64 Left,
+		__in ULONG64 Right
+		);
+
+	static
+	ULONG
+	CompareEngineStructures(
+		__in PNWSCRIPT_NATIVE_CONTEXT Context,
+		__in ULONG Type,
+		__in ULONG64 Left,
+		__in ULONG64 Right
+		);
+
+	//
+	// Return the message describing a failure status.
+	//
+
+	static
+	const char *
+	GetStatusMessage(
+		__in ULONG Status
+		);
+
+	//
+	// Return whether a variable type can be represented in generated code,
+	// and whether it is held by pointer.
+	//
+
+	static
+	bool
+	IsSupportedType(
+		__in NWACTION_TYPE Type
+		);
+
+	static
+	bool
+	IsPointerType(
+		__in NWACTION_TYPE Type
+		);
+
+	static
+	bool
+	IsEngineType(
+		__in NWACTION_TYPE Type
+		);
+
+private:
+
+	static
+	void
+	ExecuteActionFast(
+		__in NWScriptNativeExecution * Execution,
+		__in const ActionSite * Site,
+		__inout ULONG64 * Area
+		);
+
+	static
+	void
+	ExecuteActionSlow(
+		__in NWScriptNativeExecution * Execution,
+		__in const ActionSite * Site,
+		__inout ULONG64 * Area
+		);
+
+};
+
+#endif
+
@@ -0,0 +1,91 @@
+/*++
+
+Copyright (c) Ken Johnson (Skywing). All rights reserved.
+
+Module Name:
+
+	NWScriptNativeSavedState.cpp
+
+Abstract:
+
+	This module houses the representation of a saved resume state for a
+	natively compiled NWScript program.  The resume state includes a reference
+	to the underlying program, a copy of all global and local variables used by
+	the resume context, and the identity of the resume subroutine.
+
+--*/
+
+#include "Precomp.h"
+#include "NWScriptNativeSavedState.h"
+#include "NWScriptNativeProgram.h"
+
+NWScriptNativeSavedState::NWScriptNativeSavedState(
+	__in ULONG ResumeMethodId,
+	__in NWNScriptLib::PROGRAM_COUNTER ResumeMethodPC,
+	__in INWScriptStack * Stack,
+	__in NWN::OBJECTID CurrentActionObjectSelf
+	)
+/*++
+
+Routine Description:
+
+	This routine constructs a new NWScriptNativeSavedState, which contains
+	state that is used to 'resume' execution at a script situation subroutine
+	following a SAVE_STATE operation.
+
+	The caller fills in the saved variables once the object is constructed.
+
+Arguments:
+
+	ResumeMethodId - Supplies the script situation id of the subroutine to
+	                 invoke to resume the state.
+
+	ResumeMethodPC - Supplies the NWScript program counter of the resume
+	                 subroutine.
+
+	Stack - Supplies the VM stack to use for action service handler invocation.
+
+	CurrentActionObjectSelf - Supplies the self object for OBJECT_SELF
+	                          references.
+
+Return Value:
+
+	The newly constructed object.
+
+Environment:
+
+	User mode.
+
+--*/
+: m_ResumeMethodId( ResumeMethodId ),
+  m_ResumeMethodPC( ResumeMethodPC ),
+  m_Stack( Stack ),
+  m_CurrentActionObjectSelf( CurrentActionObjectSelf )
+{
+}
+
+NWScriptNativeSavedState::~NWScriptNativeSavedState(
+	)
+/*++
+
+Routine Description:
+
+	This routine deletes the current NWScriptNativeSavedState object and its
+	associated members.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+}
+
@@ -0,0 +1,236 @@
+/*++
+
+Copyright (c) Ken Johnson (Skywing). All rights reserved.
+
+Module Name:
+
+	NWScriptNativeSavedState.h
+
+Abstract:
+
+	This module defines the representation of a saved resume state for a
+	natively compiled NWScript program.  The resume state includes a reference
+	to the underlying program, a copy of all global and local variables used by
+	the resume context, and the identity of the resume subroutine.
+
+--*/
+
+#ifndef _SOURCE_PROGRAMS_NWNSCRIPTJITNATIVE_NWSCRIPTNATIVESAVEDSTATE_H
+#define _SOURCE_PROGRAMS_NWNSCRIPTJITNATIVE_NWSCRIPTNATIVESAVEDSTATE_H
+
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+#include "NWScriptNativeRuntime.h"
+
+class NWScriptNativeSavedState
+{
+
+public:
+
+	typedef swutil::SharedPtr< NWScriptNativeSavedState > Ptr;
+	typedef swutil::SharedPtr< NWScriptNativeProgram >    ProgramPtr;
+
+	//
+	// Construct a new saved state.  The program reference is attached by the
+	// owner of the program handle once the state is handed out.
+	//
+
+	NWScriptNativeSavedState(
+		__in ULONG ResumeMethodId,
+		__in NWNScriptLib::PROGRAM_COUNTER ResumeMethodPC,
+		__in INWScriptStack * Stack,
+		__in NWN::OBJECTID CurrentActionObjectSelf
+		);
+
+	~NWScriptNativeSavedState(
+		);
+
+	//
+	// Return (or attach) the associated script program.
+	//
+
+	inline
+	const ProgramPtr &
+	GetProgram(
+		) const
+	{
+		return m_Program;
+	}
+
+	inline
+	void
+	SetProgram(
+		__in const ProgramPtr & Program
+		)
+	{
+		m_Program = Program;
+	}
+
+	//
+	// Return the associated resume subroutine identifier.
+	//
+
+	inline
+	ULONG
+	GetResumeMethodId(
+		) const
+	{
+		return m_ResumeMethodId;
+	}
+
+	//
+	// Return the NWScript resume PC for the resume subroutine.
+	//
+
+	inline
+	NWNScriptLib::PROGRAM_COUNTER
+	GetResumeMethodPC(
+		) const
+	{
+		return m_ResumeMethodPC;
+	}
+
+	//
+	// Return the stack to use on action service handler invocations.
+	//
+
+	inline
+	INWScriptStack *
+	GetStack(
+		) const
+	{
+		return m_Stack;
+	}
+
+	//
+	// Return the current self object for OBJECT_SELF references.
+	//
+
+	inline
+	NWN::OBJECTID
+	GetCurrentActionObjectSelf(
+		) const
+	{
+		return m_CurrentActionObjectSelf;
+	}
+
+	//
+	// Return the values of all program globals, in program global order.
+	//
+
+	inline
+	NWScriptNativeValueVec &
+	GetProgramGlobals(
+		)
+	{
+		return m_ProgramGlobals;
+	}
+
+	inline
+	const NWScriptNativeValueVec &
+	GetProgramGlobals(
+		) const
+	{
+		return m_ProgramGlobals;
+	}
+
+	//
+	// Return the list of locals (the parameters of the resume subroutine).
+	//
+
+	inline
+	NWScriptNativeValueVec &
+	GetLocals(
+		)
+	{
+		return m_ResumeLocals;
+	}
+
+	inline
+	const NWScriptNativeValueVec &
+	GetLocals(
+		) const
+	{
+		return m_ResumeLocals;
+	}
+
+	//
+	// Return the list of globals saved by the SAVE_STATE instruction, in VM
+	// stack order.  The list is only retained if the program was generated
+	// with save state to stack enabled.
+	//
+
+	inline
+	NWScriptNativeValueVec &
+	GetGlobals(
+		)
+	{
+		return m_ResumeGlobals;
+	}
+
+	inline
+	const NWScriptNativeValueVec &
+	GetGlobals(
+		) const
+	{
+		return m_ResumeGlobals;
+	}
+
+private:
+
+	//
+	// Define the associated program.
+	//
+
+	ProgramPtr                    m_Program;
+
+	//
+	// Define the method id of the method to invoke on resume.
+	//
+
+	ULONG                         m_ResumeMethodId;
+
+	//
+	// Define the NWScript program counter of the resume method.
+	//
+
+	NWNScriptLib::PROGRAM_COUNTER m_ResumeMethodPC;
+
+	//
+	// Define the stack to use on action service handler invocation.
+	//
+
+	INWScriptStack              * m_Stack;
+
+	//
+	// Define the OBJECT_SELF of the saved state.
+	//
+
+	NWN::OBJECTID                 m_CurrentActionObjectSelf;
+
+	//
+	// Define the program globals to restore.
+	//
+
+	NWScriptNativeValueVec        m_ProgramGlobals;
+
+	//
+	// Define the parameters to pass to the resume method (locals).
+	//
+
+	NWScriptNativeValueVec        m_ResumeLocals;
+
+	//
+	// Define the globals saved by the SAVE_STATE instruction.
+	//
+
+	NWScriptNativeValueVec        m_ResumeGlobals;
+
+};
+
+typedef NWScriptNativeSavedState::Ptr NWScriptNativeSavedStatePtr;
+
+#endif
+
@@ -0,0 +1,66 @@
+/*++
+
+Copyright (c) Ken Johnson (Skywing). All rights reserved.
+
+Module Name:
+
+	Precomp.h
+
+Abstract:
+
+	This module acts as the precompiled header that pulls in all common systems
+	and dependencies of the NWNScriptJITNative module (internal only).
+
+	The module generates code for, and registers unwind data with, the x64
+	Windows ABI, and so is built for x64 Windows only.
+
+--*/
+
+#ifndef _SOURCE_PROGRAMS_NWNSCRIPTJITNATIVE_PRECOMP_H
+#define _SOURCE_PROGRAMS_NWNSCRIPTJITNATIVE_PRECOMP_H
+
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+#if !defined(_WIN64) || !defined(_M_AMD64)
+#error NWNScriptJITNative is supported on x64 Windows only.
+#endif
+
+#define STRSAFE_NO_DEPRECATE
+
+#include <tchar.h>
+#include <strsafe.h>
+#include <winsock2.h>
+#include <windows.h>
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <math.h>
+#include <float.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <list>
+#include <hash_map>
+#include <hash_set>
+#include <functional>
+#include <algorithm>
+#include <set>
+
+#include "../ProjectGlobal/ProjGlobalDefs.h"
+#include "../ProjectGlobal/VersionConstants.h"
+#include "../SkywingUtils/SkywingUtils.h"
+#include "../NWNBaseLib/NWNBaseLib.h"
+#include "../NWN2DataLib/TextOut.h"
+#include "../NWN2DataLib/NWScriptReader.h"
+#include "../NWNScriptLib/NWScriptInterfaces.h"
+#include "../NWNScriptLib/NWScriptVM.h"
+#include "../NWNScriptLib/NWScriptAnalyzer.h"
+#include "../NWNScriptJIT/NWNScriptJIT.h"
+
+using namespace NWScript;
+
+#endif
+
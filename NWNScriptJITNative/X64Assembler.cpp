@@ -0,0 +1,2075 @@
+/*++
+
+Copyright (c) Ken Johnson (Skywing). All rights reserved.
+
+Module Name:
+
+	X64Assembler.cpp
+
+Abstract:
+
+	This module houses the x86-64 instruction encoder used by the native
+	NWScript code generator.
+
+--*/
+
+#include "Precomp.h"
+#include "X64Assembler.h"
+
+X64Assembler::X64Assembler(
+	)
+/*++
+
+Routine Description:
+
+	This routine constructs a new, empty X64Assembler object.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	The newly constructed object.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+}
+
+X64Assembler::~X64Assembler(
+	)
+/*++
+
+Routine Description:
+
+	This routine cleans up an already-existing X64Assembler object.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+}
+
+X64Assembler::Label
+X64Assembler::CreateLabel(
+	)
+/*++
+
+Routine Description:
+
+	This routine creates a new, unbound label.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	The new label is returned.  The routine raises an std::exception on
+	failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	m_Labels.push_back( INVALID_LABEL_OFFSET );
+
+	return m_Labels.size( ) - 1;
+}
+
+void
+X64Assembler::BindLabel(
+	__in Label L
+	)
+/*++
+
+Routine Description:
+
+	This routine binds a label to the current end of the instruction stream.
+
+Arguments:
+
+	L - Supplies the label to bind.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	if (m_Labels.at( L ) != INVALID_LABEL_OFFSET)
+		throw std::runtime_error( "Label bound twice." );
+
+	m_Labels[ L ] = m_Code.size( );
+}
+
+size_t
+X64Assembler::GetLabelOffset(
+	__in Label L
+	) const
+/*++
+
+Routine Description:
+
+	This routine returns the instruction stream offset of a bound label.
+
+Arguments:
+
+	L - Supplies the label to query.
+
+Return Value:
+
+	The offset of the label is returned.  The routine raises an std::exception
+	if the label is not bound.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	if (m_Labels.at( L ) == INVALID_LABEL_OFFSET)
+		throw std::runtime_error( "Label not bound." );
+
+	return m_Labels[ L ];
+}
+
+void
+X64Assembler::Finalize(
+	)
+/*++
+
+Routine Description:
+
+	This routine resolves all pending branch displacements.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	for (FixupVec::const_iterator it = m_Fixups.begin( );
+	     it != m_Fixups.end( );
+	     ++it)
+	{
+		LONG64 Displacement;
+
+		Displacement = (LONG64) GetLabelOffset( it->Target ) - (LONG64) (it->Offset + 4);
+
+		if ((Displacement < LONG_MIN) || (Displacement > LONG_MAX))
+			throw std::runtime_error( "Branch displacement out of range." );
+
+		for (size_t i = 0; i < 4; i += 1)
+			m_Code[ it->Offset + i ] = (unsigned char) ((ULONG64) Displacement >> (i * 8));
+	}
+
+	m_Fixups.clear( );
+}
+
+void
+X64Assembler::MovRegReg32(
+	__in GPR Dst,
+	__in GPR Src
+	)
+/*++
+
+Routine Description:
+
+	This routine emits mov r32, r32.
+
+Arguments:
+
+	Dst - Supplies the destination register.
+
+	Src - Supplies the source register.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	EmitRex( false, Src, Dst );
+	EmitByte( 0x89 );
+	EmitModRmReg( Src, Dst );
+}
+
+void
+X64Assembler::MovRegReg64(
+	__in GPR Dst,
+	__in GPR Src
+	)
+/*++
+
+Routine Description:
+
+	This routine emits mov r64, r64.
+
+Arguments:
+
+	Dst - Supplies the destination register.
+
+	Src - Supplies the source register.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	EmitRex( true, Src, Dst );
+	EmitByte( 0x89 );
+	EmitModRmReg( Src, Dst );
+}
+
+void
+X64Assembler::MovRegImm32(
+	__in GPR Dst,
+	__in ULONG Imm
+	)
+/*++
+
+Routine Description:
+
+	This routine emits mov r32, imm32 (zero extending into the full register).
+	A zero immediate is emitted as xor r32, r32.
+
+	N.B.  As the xor form modifies the flags, the routine must not be used
+	      between a flag producing instruction and its consumer.
+
+Arguments:
+
+	Dst - Supplies the destination register.
+
+	Imm - Supplies the immediate value.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	if (Imm == 0)
+	{
+		AluRegReg32( ALU_XOR, Dst, Dst );
+		return;
+	}
+
+	EmitRex( false, 0, Dst );
+	EmitByte( (UCHAR) (0xB8 + (Dst & 7)) );
+	EmitDword( Imm );
+}
+
+void
+X64Assembler::MovRegImm64(
+	__in GPR Dst,
+	__in ULONG64 Imm
+	)
+/*++
+
+Routine Description:
+
+	This routine emits mov r64, imm64, using the shorter 32-bit form if the
+	immediate value permits.
+
+Arguments:
+
+	Dst - Supplies the destination register.
+
+	Imm - Supplies the immediate value.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	if (Imm <= 0xFFFFFFFF)
+	{
+		MovRegImm32( Dst, (ULONG) Imm );
+		return;
+	}
+
+	EmitRex( true, 0, Dst );
+	EmitByte( (UCHAR) (0xB8 + (Dst & 7)) );
+	EmitQword( Imm );
+}
+
+void
+X64Assembler::MovRegMem32(
+	__in GPR Dst,
+	__in GPR Base,
+	__in LONG Disp
+	)
+/*++
+
+Routine Description:
+
+	This routine emits mov r32, dword [base + disp].
+
+Arguments:
+
+	Dst - Supplies the destination register.
+
+	Base - Supplies the base register of the memory operand.
+
+	Disp - Supplies the displacement of the memory operand.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	EmitRex( false, Dst, Base );
+	EmitByte( 0x8B );
+	EmitModRmMem( Dst, Base, Disp );
+}
+
+void
+X64Assembler::MovRegMem64(
+	__in GPR Dst,
+	__in GPR Base,
+	__in LONG Disp
+	)
+/*++
+
+Routine Description:
+
+	This routine emits mov r64, qword [base + disp].
+
+Arguments:
+
+	Dst - Supplies the destination register.
+
+	Base - Supplies the base register of the memory operand.
+
+	Disp - Supplies the displacement of the memory operand.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	EmitRex( true, Dst, Base );
+	EmitByte( 0x8B );
+	EmitModRmMem( Dst, Base, Disp );
+}
+
+void
+X64Assembler::MovMemReg32(
+	__in GPR Base,
+	__in LONG Disp,
+	__in GPR Src
+	)
+/*++
+
+Routine Description:
+
+	This routine emits mov dword [base + disp], r32.
+
+Arguments:
+
+	Base - Supplies the base register of the memory operand.
+
+	Disp - Supplies the displacement of the memory operand.
+
+	Src - Supplies the source register.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	EmitRex( false, Src, Base );
+	EmitByte( 0x89 );
+	EmitModRmMem( Src, Base, Disp );
+}
+
+void
+X64Assembler::MovMemReg64(
+	__in GPR Base,
+	__in LONG Disp,
+	__in GPR Src
+	)
+/*++
+
+Routine Description:
+
+	This routine emits mov qword [base + disp], r64.
+
+Arguments:
+
+	Base - Supplies the base register of the memory operand.
+
+	Disp - Supplies the displacement of the memory operand.
+
+	Src - Supplies the source register.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	EmitRex( true, Src, Base );
+	EmitByte( 0x89 );
+	EmitModRmMem( Src, Base, Disp );
+}
+
+void
+X64Assembler::MovMemImm32(
+	__in GPR Base,
+	__in LONG Disp,
+	__in ULONG Imm
+	)
+/*++
+
+Routine Description:
+
+	This routine emits mov dword [base + disp], imm32.
+
+Arguments:
+
+	Base - Supplies the base register of the memory operand.
+
+	Disp - Supplies the displacement of the memory operand.
+
+	Imm - Supplies the immediate value.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	EmitRex( false, 0, Base );
+	EmitByte( 0xC7 );
+	EmitModRmMem( 0, Base, Disp );
+	EmitDword( Imm );
+}
+
+void
+X64Assembler::MovMemImm64(
+	__in GPR Base,
+	__in LONG Disp,
+	__in LONG Imm
+	)
+/*++
+
+Routine Description:
+
+	This routine emits mov qword [base + disp], simm32.
+
+Arguments:
+
+	Base - Supplies the base register of the memory operand.
+
+	Disp - Supplies the displacement of the memory operand.
+
+	Imm - Supplies the immediate value, which is sign extended to 64 bits.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	EmitRex( true, 0, Base );
+	EmitByte( 0xC7 );
+	EmitModRmMem( 0, Base, Disp );
+	EmitDword( (ULONG) Imm );
+}
+
+void
+X64Assembler::LeaRegMem64(
+	__in GPR Dst,
+	__in GPR Base,
+	__in LONG Disp
+	)
+/*++
+
+Routine Description:
+
+	This routine emits lea r64, [base + disp].
+
+Arguments:
+
+	Dst - Supplies the destination register.
+
+	Base - Supplies the base register of the address.
+
+	Disp - Supplies the displacement of the address.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	EmitRex( true, Dst, Base );
+	EmitByte( 0x8D );
+	EmitModRmMem( Dst, Base, Disp );
+}
+
+void
+X64Assembler::MovzxRegReg8(
+	__in GPR Dst,
+	__in GPR Src
+	)
+/*++
+
+Routine Description:
+
+	This routine emits movzx r32, r8.
+
+Arguments:
+
+	Dst - Supplies the destination register.
+
+	Src - Supplies the register whose low byte is the source.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	EmitRex( false, Dst, Src, (Src >= RSP) && (Src <= RDI) );
+	EmitByte( 0x0F );
+	EmitByte( 0xB6 );
+	EmitModRmReg( Dst, Src );
+}
+
+void
+X64Assembler::Push(
+	__in GPR Reg
+	)
+/*++
+
+Routine Description:
+
+	This routine emits push r64.
+
+Arguments:
+
+	Reg - Supplies the register to push.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	EmitRex( false, 0, Reg );
+	EmitByte( (UCHAR) (0x50 + (Reg & 7)) );
+}
+
+void
+X64Assembler::Pop(
+	__in GPR Reg
+	)
+/*++
+
+Routine Description:
+
+	This routine emits pop r64.
+
+Arguments:
+
+	Reg - Supplies the register to pop.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	EmitRex( false, 0, Reg );
+	EmitByte( (UCHAR) (0x58 + (Reg & 7)) );
+}
+
+void
+X64Assembler::AluRegReg32(
+	__in ALU_OP Op,
+	__in GPR Dst,
+	__in GPR Src
+	)
+/*++
+
+Routine Description:
+
+	This routine emits a group 1 arithmetic instruction of the form op r32,
+	r32.
+
+Arguments:
+
+	Op - Supplies the operation.
+
+	Dst - Supplies the destination (first) operand.
+
+	Src - Supplies the source (second) operand.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	EmitRex( false, Src, Dst );
+	EmitByte( (UCHAR) ((Op << 3) | 0x01) );
+	EmitModRmReg( Src, Dst );
+}
+
+void
+X64Assembler::AluRegReg64(
+	__in ALU_OP Op,
+	__in GPR Dst,
+	__in GPR Src
+	)
+/*++
+
+Routine Description:
+
+	This routine emits a group 1 arithmetic instruction of the form op r64,
+	r64.
+
+Arguments:
+
+	Op - Supplies the operation.
+
+	Dst - Supplies the destination (first) operand.
+
+	Src - Supplies the source (second) operand.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	EmitRex( true, Src, Dst );
+	EmitByte( (UCHAR) ((Op << 3) | 0x01) );
+	EmitModRmReg( Src, Dst );
+}
+
+void
+X64Assembler::AluRegImm32(
+	__in ALU_OP Op,
+	__in GPR Dst,
+	__in LONG Imm
+	)
+/*++
+
+Routine Description:
+
+	This routine emits a group 1 arithmetic instruction of the form op r32,
+	imm.
+
+Arguments:
+
+	Op - Supplies the operation.
+
+	Dst - Supplies the destination (first) operand.
+
+	Imm - Supplies the immediate operand.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	EmitRex( false, 0, Dst );
+
+	if ((Imm >= -128) && (Imm <= 127))
+	{
+		EmitByte( 0x83 );
+		EmitModRmReg( Op, Dst );
+		EmitByte( (UCHAR) Imm );
+	}
+	else
+	{
+		EmitByte( 0x81 );
+		EmitModRmReg( Op, Dst );
+		EmitDword( (ULONG) Imm );
+	}
+}
+
+void
+X64Assembler::AluRegImm64(
+	__in ALU_OP Op,
+	__in GPR Dst,
+	__in LONG Imm
+	)
+/*++
+
+Routine Description:
+
+	This routine emits a group 1 arithmetic instruction of the form op r64,
+	simm32.
+
+Arguments:
+
+	Op - Supplies the operation.
+
+	Dst - Supplies the destination (first) operand.
+
+	Imm - Supplies the immediate operand, which is sign extended to 64 bits.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	EmitRex( true, 0, Dst );
+
+	if ((Imm >= -128) && (Imm <= 127))
+	{
+		EmitByte( 0x83 );
+		EmitModRmReg( Op, Dst );
+		EmitByte( (UCHAR) Imm );
+	}
+	else
+	{
+		EmitByte( 0x81 );
+		EmitModRmReg( Op, Dst );
+		EmitDword( (ULONG) Imm );
+	}
+}
+
+void
+X64Assembler::AluMemImm32(
+	__in ALU_OP Op,
+	__in GPR Base,
+	__in LONG Disp,
+	__in LONG Imm
+	)
+/*++
+
+Routine Description:
+
+	This routine emits a group 1 arithmetic instruction of the form op dword
+	[base + disp], imm.
+
+Arguments:
+
+	Op - Supplies the operation.
+
+	Base - Supplies the base register of the memory operand.
+
+	Disp - Supplies the displacement of the memory operand.
+
+	Imm - Supplies the immediate operand.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	EmitRex( false, 0, Base );
+
+	if ((Imm >= -128) && (Imm <= 127))
+	{
+		EmitByte( 0x83 );
+		EmitModRmMem( Op, Base, Disp );
+		EmitByte( (UCHAR) Imm );
+	}
+	else
+	{
+		EmitByte( 0x81 );
+		EmitModRmMem( Op, Base, Disp );
+		EmitDword( (ULONG) Imm );
+	}
+}
+
+void
+X64Assembler::TestRegReg32(
+	__in GPR Reg1,
+	__in GPR Reg2
+	)
+/*++
+
+Routine Description:
+
+	This routine emits test r32, r32.
+
+Arguments:
+
+	Reg1 - Supplies the first operand.
+
+	Reg2 - Supplies the second operand.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	EmitRex( false, Reg2, Reg1 );
+	EmitByte( 0x85 );
+	EmitModRmReg( Reg2, Reg1 );
+}
+
+void
+X64Assembler::ImulRegReg32(
+	__in GPR Dst,
+	__in GPR Src
+	)
+/*++
+
+Routine Description:
+
+	This routine emits imul r32, r32.
+
+Arguments:
+
+	Dst - Supplies the destination (first) operand.
+
+	Src - Supplies the source (second) operand.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	EmitRex( false, Dst, Src );
+	EmitByte( 0x0F );
+	EmitByte( 0xAF );
+	EmitModRmReg( Dst, Src );
+}
+
+void
+X64Assembler::Cdq(
+	)
+/*++
+
+Routine Description:
+
+	This routine emits cdq (sign extend eax into edx:eax).
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	EmitByte( 0x99 );
+}
+
+void
+X64Assembler::IdivReg32(
+	__in GPR Divisor
+	)
+/*++
+
+Routine Description:
+
+	This routine emits idiv r32 (signed divide of edx:eax).
+
+Arguments:
+
+	Divisor - Supplies the divisor register.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	EmitRex( false, 0, Divisor );
+	EmitByte( 0xF7 );
+	EmitModRmReg( 7, Divisor );
+}
+
+void
+X64Assembler::NegReg32(
+	__in GPR Reg
+	)
+/*++
+
+Routine Description:
+
+	This routine emits neg r32.
+
+Arguments:
+
+	Reg - Supplies the register to negate.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	EmitRex( false, 0, Reg );
+	EmitByte( 0xF7 );
+	EmitModRmReg( 3, Reg );
+}
+
+void
+X64Assembler::NotReg32(
+	__in GPR Reg
+	)
+/*++
+
+Routine Description:
+
+	This routine emits not r32.
+
+Arguments:
+
+	Reg - Supplies the register to complement.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	EmitRex( false, 0, Reg );
+	EmitByte( 0xF7 );
+	EmitModRmReg( 2, Reg );
+}
+
+void
+X64Assembler::ShiftRegCl32(
+	__in SHIFT_OP Op,
+	__in GPR Reg
+	)
+/*++
+
+Routine Description:
+
+	This routine emits a group 2 shift of the form op r32, cl.
+
+Arguments:
+
+	Op - Supplies the shift operation.
+
+	Reg - Supplies the register to shift.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	EmitRex( false, 0, Reg );
+	EmitByte( 0xD3 );
+	EmitModRmReg( Op, Reg );
+}
+
+void
+X64Assembler::ShiftRegImm64(
+	__in SHIFT_OP Op,
+	__in GPR Reg,
+	__in UCHAR Count
+	)
+/*++
+
+Routine Description:
+
+	This routine emits a group 2 shift of the form op r64, imm8.
+
+Arguments:
+
+	Op - Supplies the shift operation.
+
+	Reg - Supplies the register to shift.
+
+	Count - Supplies the shift count.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	EmitRex( true, 0, Reg );
+	EmitByte( 0xC1 );
+	EmitModRmReg( Op, Reg );
+	EmitByte( Count );
+}
+
+void
+X64Assembler::Setcc(
+	__in CONDITION Condition,
+	__in GPR Dst
+	)
+/*++
+
+Routine Description:
+
+	This routine emits setcc r8.
+
+Arguments:
+
+	Condition - Supplies the condition to test.
+
+	Dst - Supplies the register whose low byte receives the result.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	EmitRex( false, 0, Dst, (Dst >= RSP) && (Dst <= RDI) );
+	EmitByte( 0x0F );
+	EmitByte( (UCHAR) (0x90 + Condition) );
+	EmitModRmReg( 0, Dst );
+}
+
+void
+X64Assembler::MovssRegReg(
+	__in XMM Dst,
+	__in XMM Src
+	)
+/*++
+
+Routine Description:
+
+	This routine emits movss xmm, xmm.
+
+Arguments:
+
+	Dst - Supplies the destination register.
+
+	Src - Supplies the source register.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	EmitSseRegReg( 0xF3, 0x10, Dst, Src );
+}
+
+void
+X64Assembler::MovssRegMem(
+	__in XMM Dst,
+	__in GPR Base,
+	__in LONG Disp
+	)
+/*++
+
+Routine Description:
+
+	This routine emits movss xmm, dword [base + disp].
+
+Arguments:
+
+	Dst - Supplies the destination register.
+
+	Base - Supplies the base register of the memory operand.
+
+	Disp - Supplies the displacement of the memory operand.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	EmitSseRegMem( 0xF3, 0x10, Dst, Base, Disp );
+}
+
+void
+X64Assembler::MovssMemReg(
+	__in GPR Base,
+	__in LONG Disp,
+	__in XMM Src
+	)
+/*++
+
+Routine Description:
+
+	This routine emits movss dword [base + disp], xmm.
+
+Arguments:
+
+	Base - Supplies the base register of the memory operand.
+
+	Disp - Supplies the displacement of the memory operand.
+
+	Src - Supplies the source register.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	EmitSseRegMem( 0xF3, 0x11, Src, Base, Disp );
+}
+
+void
+X64Assembler::MovsdRegMem(
+	__in XMM Dst,
+	__in GPR Base,
+	__in LONG Disp
+	)
+/*++
+
+Routine Description:
+
+	This routine emits movsd xmm, qword [base + disp].
+
+Arguments:
+
+	Dst - Supplies the destination register.
+
+	Base - Supplies the base register of the memory operand.
+
+	Disp - Supplies the displacement of the memory operand.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	EmitSseRegMem( 0xF2, 0x10, Dst, Base, Disp );
+}
+
+void
+X64Assembler::MovsdMemReg(
+	__in GPR Base,
+	__in LONG Disp,
+	__in XMM Src
+	)
+/*++
+
+Routine Description:
+
+	This routine emits movsd qword [base + disp], xmm.
+
+Arguments:
+
+	Base - Supplies the base register of the memory operand.
+
+	Disp - Supplies the displacement of the memory operand.
+
+	Src - Supplies the source register.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	EmitSseRegMem( 0xF2, 0x11, Src, Base, Disp );
+}
+
+void
+X64Assembler::MovdquRegMem(
+	__in XMM Dst,
+	__in GPR Base,
+	__in LONG Disp
+	)
+/*++
+
+Routine Description:
+
+	This routine emits movdqu xmm, oword [base + disp].
+
+Arguments:
+
+	Dst - Supplies the destination register.
+
+	Base - Supplies the base register of the memory operand.
+
+	Disp - Supplies the displacement of the memory operand.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	EmitSseRegMem( 0xF3, 0x6F, Dst, Base, Disp );
+}
+
+void
+X64Assembler::MovdquMemReg(
+	__in GPR Base,
+	__in LONG Disp,
+	__in XMM Src
+	)
+/*++
+
+Routine Description:
+
+	This routine emits movdqu oword [base + disp], xmm.
+
+Arguments:
+
+	Base - Supplies the base register of the memory operand.
+
+	Disp - Supplies the displacement of the memory operand.
+
+	Src - Supplies the source register.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	EmitSseRegMem( 0xF3, 0x7F, Src, Base, Disp );
+}
+
+void
+X64Assembler::MovdXmmReg32(
+	__in XMM Dst,
+	__in GPR Src
+	)
+/*++
+
+Routine Description:
+
+	This routine emits movd xmm, r32.
+
+Arguments:
+
+	Dst - Supplies the destination register.
+
+	Src - Supplies the source register.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	EmitSseRegReg( 0x66, 0x6E, Dst, Src );
+}
+
+void
+X64Assembler::MovdRegXmm32(
+	__in GPR Dst,
+	__in XMM Src
+	)
+/*++
+
+Routine Description:
+
+	This routine emits movd r32, xmm.
+
+Arguments:
+
+	Dst - Supplies the destination register.
+
+	Src - Supplies the source register.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	EmitSseRegReg( 0x66, 0x7E, Src, Dst );
+}
+
+void
+X64Assembler::Cvtsi2ssRegReg32(
+	__in XMM Dst,
+	__in GPR Src
+	)
+/*++
+
+Routine Description:
+
+	This routine emits cvtsi2ss xmm, r32.
+
+Arguments:
+
+	Dst - Supplies the destination register.
+
+	Src - Supplies the source register.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	EmitSseRegReg( 0xF3, 0x2A, Dst, Src );
+}
+
+void
+X64Assembler::SseRegReg(
+	__in SSE_OP Op,
+	__in XMM Dst,
+	__in XMM Src
+	)
+/*++
+
+Routine Description:
+
+	This routine emits a scalar single precision arithmetic instruction of
+	the form op xmm, xmm.
+
+Arguments:
+
+	Op - Supplies the operation.
+
+	Dst - Supplies the destination (first) operand.
+
+	Src - Supplies the source (second) operand.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	EmitSseRegReg( 0xF3, (UCHAR) Op, Dst, Src );
+}
+
+void
+X64Assembler::UcomissRegReg(
+	__in XMM Reg1,
+	__in XMM Reg2
+	)
+/*++
+
+Routine Description:
+
+	This routine emits ucomiss xmm, xmm.
+
+Arguments:
+
+	Reg1 - Supplies the first operand.
+
+	Reg2 - Supplies the second operand.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	EmitSseRegReg( 0, 0x2E, Reg1, Reg2 );
+}
+
+void
+X64Assembler::Jmp(
+	__in Label Target
+	)
+/*++
+
+Routine Description:
+
+	This routine emits jmp rel32.
+
+Arguments:
+
+	Target - Supplies the branch target label.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	EmitByte( 0xE9 );
+	EmitRel32( Target );
+}
+
+void
+X64Assembler::Jcc(
+	__in CONDITION Condition,
+	__in Label Target
+	)
+/*++
+
+Routine Description:
+
+	This routine emits jcc rel32.
+
+Arguments:
+
+	Condition - Supplies the branch condition.
+
+	Target - Supplies the branch target label.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	EmitByte( 0x0F );
+	EmitByte( (UCHAR) (0x80 + Condition) );
+	EmitRel32( Target );
+}
+
+void
+X64Assembler::Call(
+	__in Label Target
+	)
+/*++
+
+Routine Description:
+
+	This routine emits call rel32.
+
+Arguments:
+
+	Target - Supplies the call target label.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	EmitByte( 0xE8 );
+	EmitRel32( Target );
+}
+
+void
+X64Assembler::CallReg(
+	__in GPR Target
+	)
+/*++
+
+Routine Description:
+
+	This routine emits call r64.
+
+Arguments:
+
+	Target - Supplies the register holding the call target address.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	EmitRex( false, 0, Target );
+	EmitByte( 0xFF );
+	EmitModRmReg( 2, Target );
+}
+
+void
+X64Assembler::Ret(
+	)
+/*++
+
+Routine Description:
+
+	This routine emits ret.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	EmitByte( 0xC3 );
+}
+
+void
+X64Assembler::RepMovsq(
+	)
+/*++
+
+Routine Description:
+
+	This routine emits rep movsq.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	EmitByte( 0xF3 );
+	EmitByte( 0x48 );
+	EmitByte( 0xA5 );
+}
+
+void
+X64Assembler::EmitByte(
+	__in UCHAR Byte
+	)
+/*++
+
+Routine Description:
+
+	This routine appends a byte to the instruction stream.
+
+Arguments:
+
+	Byte - Supplies the byte to append.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	m_Code.push_back( Byte );
+}
+
+void
+X64Assembler::EmitDword(
+	__in ULONG Dword
+	)
+/*++
+
+Routine Description:
+
+	This routine appends a little endian dword to the instruction stream.
+
+Arguments:
+
+	Dword - Supplies the dword to append.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	for (size_t i = 0; i < 4; i += 1)
+		EmitByte( (UCHAR) (Dword >> (i * 8)) );
+}
+
+void
+X64Assembler::EmitQword(
+	__in ULONG64 Qword
+	)
+/*++
+
+Routine Description:
+
+	This routine appends a little endian qword to the instruction stream.
+
+Arguments:
+
+	Qword - Supplies the qword to append.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	for (size_t i = 0; i < 8; i += 1)
+		EmitByte( (UCHAR) (Qword >> (i * 8)) );
+}
+
+void
+X64Assembler::EmitRex(
+	__in bool W,
+	__in ULONG Reg,
+	__in ULONG Base,
+	__in bool Force
+	)
+/*++
+
+Routine Description:
+
+	This routine emits a REX prefix, if one is required by the operand size
+	or the register operands of the instruction.
+
+Arguments:
+
+	W - Supplies true if the instruction has a 64-bit operand size.
+
+	Reg - Supplies the ModRM.reg register number (or opcode extension).
+
+	Base - Supplies the ModRM.rm (or base) register number.
+
+	Force - Supplies true if an empty REX prefix must be emitted.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	UCHAR Rex;
+
+	Rex = 0x40;
+
+	if (W)
+		Rex |= 0x08;
+
+	if (Reg & 8)
+		Rex |= 0x04;
+
+	if (Base & 8)
+		Rex |= 0x01;
+
+	if ((Rex != 0x40) || (Force))
+		EmitByte( Rex );
+}
+
+void
+X64Assembler::EmitModRmReg(
+	__in ULONG Reg,
+	__in ULONG Rm
+	)
+/*++
+
+Routine Description:
+
+	This routine emits a register direct ModRM byte.
+
+Arguments:
+
+	Reg - Supplies the ModRM.reg register number (or opcode extension).
+
+	Rm - Supplies the ModRM.rm register number.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	EmitByte( (UCHAR) (0xC0 | ((Reg & 7) << 3) | (Rm & 7)) );
+}
+
+void
+X64Assembler::EmitModRmMem(
+	__in ULONG Reg,
+	__in GPR Base,
+	__in LONG Disp
+	)
+/*++
+
+Routine Description:
+
+	This routine emits the ModRM byte (and SIB byte and displacement, as
+	necessary) for a [base + disp] memory operand.
+
+Arguments:
+
+	Reg - Supplies the ModRM.reg register number (or opcode extension).
+
+	Base - Supplies the base register.
+
+	Disp - Supplies the displacement.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	UCHAR Mod;
+
+	//
+	// RBP and R13 have no displacement-free encoding, so these always take at
+	// least an 8-bit displacement.
+	//
+
+	if ((Disp == 0) && ((Base & 7) != RBP))
+		Mod = 0x00;
+	else if ((Disp >= -128) && (Disp <= 127))
+		Mod = 0x40;
+	else
+		Mod = 0x80;
+
+	EmitByte( (UCHAR) (Mod | ((Reg & 7) << 3) | (Base & 7)) );
+
+	//
+	// RSP and R12 as a base require a SIB byte (no index).
+	//
+
+	if ((Base & 7) == RSP)
+		EmitByte( 0x24 );
+
+	if (Mod == 0x40)
+		EmitByte( (UCHAR) Disp );
+	else if (Mod == 0x80)
+		EmitDword( (ULONG) Disp );
+}
+
+void
+X64Assembler::EmitRel32(
+	__in Label Target
+	)
+/*++
+
+Routine Description:
+
+	This routine emits a 32-bit branch displacement to a label.  The
+	displacement is resolved by Finalize.
+
+Arguments:
+
+	Target - Supplies the branch target label.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	Fixup F;
+
+	if (Target >= m_Labels.size( ))
+		throw std::runtime_error( "Branch to undefined label." );
+
+	F.Offset = m_Code.size( );
+	F.Target = Target;
+
+	m_Fixups.push_back( F );
+
+	EmitDword( 0 );
+}
+
+void
+X64Assembler::EmitSseRegReg(
+	__in UCHAR Prefix,
+	__in UCHAR Opcode,
+	__in ULONG Reg,
+	__in ULONG Rm
+	)
+/*++
+
+Routine Description:
+
+	This routine emits a register direct SSE instruction (0F opcode map).
+
+Arguments:
+
+	Prefix - Supplies the mandatory prefix byte, or zero if there is none.
+
+	Opcode - Supplies the opcode byte following the 0F escape.
+
+	Reg - Supplies the ModRM.reg register number.
+
+	Rm - Supplies the ModRM.rm register number.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	if (Prefix != 0)
+		EmitByte( Prefix );
+
+	EmitRex( false, Reg, Rm );
+	EmitByte( 0x0F );
+	EmitByte( Opcode );
+	EmitModRmReg( Reg, Rm );
+}
+
+void
+X64Assembler::EmitSseRegMem(
+	__in UCHAR Prefix,
+	__in UCHAR Opcode,
+	__in ULONG Reg,
+	__in GPR Base,
+	__in LONG Disp
+	)
+/*++
+
+Routine Description:
+
+	This routine emits an SSE instruction (0F opcode map) with a [base +
+	disp] memory operand.
+
+Arguments:
+
+	Prefix - Supplies the mandatory prefix byte, or zero if there is none.
+
+	Opcode - Supplies the opcode byte following the 0F escape.
+
+	Reg - Supplies the ModRM.reg register number.
+
+	Base - Supplies the base register of the memory operand.
+
+	Disp - Supplies the displacement of the memory operand.
+
+Return Value:
+
+	None.  The routine raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	if (Prefix != 0)
+		EmitByte( Prefix );
+
+	EmitRex( false, Reg, Base );
+	EmitByte( 0x0F );
+	EmitByte( Opcode );
+	EmitModRmMem( Reg, Base, Disp );
+}
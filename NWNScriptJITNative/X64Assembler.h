@@ -0,0 +1,629 @@
+/*++
+
+Copyright (c) Ken Johnson (Skywing). All rights reserved.
+
+Module Name:
+
+	X64Assembler.h
+
+Abstract:
+
+	This module defines the x86-64 instruction encoder used by the native
+	NWScript code generator.  Only the small subset of the instruction set
+	that the code generator requires is supported.
+
+--*/
+
+#ifndef _SOURCE_PROGRAMS_NWNSCRIPTJITNATIVE_X64ASSEMBLER_H
+#define _SOURCE_PROGRAMS_NWNSCRIPTJITNATIVE_X64ASSEMBLER_H
+
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+//
+// Define the x86-64 assembler.  Instructions are appended to an in-memory
+// buffer; branch targets are referenced through labels, which may be bound
+// before or after they are referenced.  All branches use 32-bit
+// displacements, which are resolved by Finalize once all labels are bound.
+//
+// Memory operands are restricted to the [base + displacement] form.
+//
+
+class X64Assembler
+{
+
+public:
+
+	typedef enum _GPR
+	{
+		RAX,
+		RCX,
+		RDX,
+		RBX,
+		RSP,
+		RBP,
+		RSI,
+		RDI,
+		R8,
+		R9,
+		R10,
+		R11,
+		R12,
+		R13,
+		R14,
+		R15,
+
+		LAST_GPR
+	} GPR, * PGPR;
+
+	typedef enum _XMM
+	{
+		XMM0,
+		XMM1,
+		XMM2,
+		XMM3,
+		XMM4,
+		XMM5,
+		XMM6,
+		XMM7,
+		XMM8,
+		XMM9,
+		XMM10,
+		XMM11,
+		XMM12,
+		XMM13,
+		XMM14,
+		XMM15,
+
+		LAST_XMM
+	} XMM, * PXMM;
+
+	//
+	// Condition codes, in their hardware encoding order.
+	//
+
+	typedef enum _CONDITION
+	{
+		CC_O,
+		CC_NO,
+		CC_B,
+		CC_AE,
+		CC_E,
+		CC_NE,
+		CC_BE,
+		CC_A,
+		CC_S,
+		CC_NS,
+		CC_P,
+		CC_NP,
+		CC_L,
+		CC_GE,
+		CC_LE,
+		CC_G,
+
+		LAST_CONDITION
+	} CONDITION, * PCONDITION;
+
+	//
+	// Group 1 arithmetic operations (the value is the /digit encoding).
+	//
+
+	typedef enum _ALU_OP
+	{
+		ALU_ADD = 0,
+		ALU_OR  = 1,
+		ALU_AND = 4,
+		ALU_SUB = 5,
+		ALU_XOR = 6,
+		ALU_CMP = 7,
+
+		LAST_ALU_OP
+	} ALU_OP, * PALU_OP;
+
+	//
+	// Group 2 shift operations (the value is the /digit encoding).
+	//
+
+	typedef enum _SHIFT_OP
+	{
+		SHIFT_SHL = 4,
+		SHIFT_SHR = 5,
+		SHIFT_SAR = 7,
+
+		LAST_SHIFT_OP
+	} SHIFT_OP, * PSHIFT_OP;
+
+	//
+	// Scalar single precision arithmetic operations (the value is the second
+	// opcode byte).
+	//
+
+	typedef enum _SSE_OP
+	{
+		SSE_ADD = 0x58,
+		SSE_MUL = 0x59,
+		SSE_SUB = 0x5C,
+		SSE_DIV = 0x5E,
+
+		LAST_SSE_OP
+	} SSE_OP, * PSSE_OP;
+
+	typedef size_t Label;
+
+	//
+	// Constructor.
+	//
+
+	X64Assembler(
+		);
+
+	//
+	// Destructor.
+	//
+
+	~X64Assembler(
+		);
+
+	//
+	// Label management.  A label must be bound exactly once before Finalize
+	// is called.
+	//
+
+	Label
+	CreateLabel(
+		);
+
+	void
+	BindLabel(
+		__in Label L
+		);
+
+	size_t
+	GetLabelOffset(
+		__in Label L
+		) const;
+
+	//
+	// Resolve all branch displacements.  Raises an std::exception if a
+	// referenced label was never bound.
+	//
+
+	void
+	Finalize(
+		);
+
+	inline
+	size_t
+	GetOffset(
+		) const
+	{
+		return m_Code.size( );
+	}
+
+	inline
+	const std::vector< unsigned char > &
+	GetCode(
+		) const
+	{
+		return m_Code;
+	}
+
+	//
+	// Data movement.
+	//
+
+	void
+	MovRegReg32(
+		__in GPR Dst,
+		__in GPR Src
+		);
+
+	void
+	MovRegReg64(
+		__in GPR Dst,
+		__in GPR Src
+		);
+
+	void
+	MovRegImm32(
+		__in GPR Dst,
+		__in ULONG Imm
+		);
+
+	void
+	MovRegImm64(
+		__in GPR Dst,
+		__in ULONG64 Imm
+		);
+
+	void
+	MovRegMem32(
+		__in GPR Dst,
+		__in GPR Base,
+		__in LONG Disp
+		);
+
+	void
+	MovRegMem64(
+		__in GPR Dst,
+		__in GPR Base,
+		__in LONG Disp
+		);
+
+	void
+	MovMemReg32(
+		__in GPR Base,
+		__in LONG Disp,
+		__in GPR Src
+		);
+
+	void
+	MovMemReg64(
+		__in GPR Base,
+		__in LONG Disp,
+		__in GPR Src
+		);
+
+	void
+	MovMemImm32(
+		__in GPR Base,
+		__in LONG Disp,
+		__in ULONG Imm
+		);
+
+	//
+	// Store a sign-extended 32-bit immediate to a 64-bit memory operand.
+	//
+
+	void
+	MovMemImm64(
+		__in GPR Base,
+		__in LONG Disp,
+		__in LONG Imm
+		);
+
+	void
+	LeaRegMem64(
+		__in GPR Dst,
+		__in GPR Base,
+		__in LONG Disp
+		);
+
+	void
+	MovzxRegReg8(
+		__in GPR Dst,
+		__in GPR Src
+		);
+
+	void
+	Push(
+		__in GPR Reg
+		);
+
+	void
+	Pop(
+		__in GPR Reg
+		);
+
+	//
+	// Integer arithmetic.
+	//
+
+	void
+	AluRegReg32(
+		__in ALU_OP Op,
+		__in GPR Dst,
+		__in GPR Src
+		);
+
+	void
+	AluRegReg64(
+		__in ALU_OP Op,
+		__in GPR Dst,
+		__in GPR Src
+		);
+
+	void
+	AluRegImm32(
+		__in ALU_OP Op,
+		__in GPR Dst,
+		__in LONG Imm
+		);
+
+	void
+	AluRegImm64(
+		__in ALU_OP Op,
+		__in GPR Dst,
+		__in LONG Imm
+		);
+
+	void
+	AluMemImm32(
+		__in ALU_OP Op,
+		__in GPR Base,
+		__in LONG Disp,
+		__in LONG Imm
+		);
+
+	void
+	TestRegReg32(
+		__in GPR Reg1,
+		__in GPR Reg2
+		);
+
+	void
+	ImulRegReg32(
+		__in GPR Dst,
+		__in GPR Src
+		);
+
+	void
+	Cdq(
+		);
+
+	void
+	IdivReg32(
+		__in GPR Divisor
+		);
+
+	void
+	NegReg32(
+		__in GPR Reg
+		);
+
+	void
+	NotReg32(
+		__in GPR Reg
+		);
+
+	void
+	ShiftRegCl32(
+		__in SHIFT_OP Op,
+		__in GPR Reg
+		);
+
+	void
+	ShiftRegImm64(
+		__in SHIFT_OP Op,
+		__in GPR Reg,
+		__in UCHAR Count
+		);
+
+	void
+	Setcc(
+		__in CONDITION Condition,
+		__in GPR Dst
+		);
+
+	//
+	// Scalar floating point.
+	//
+
+	void
+	MovssRegReg(
+		__in XMM Dst,
+		__in XMM Src
+		);
+
+	void
+	MovssRegMem(
+		__in XMM Dst,
+		__in GPR Base,
+		__in LONG Disp
+		);
+
+	void
+	MovssMemReg(
+		__in GPR Base,
+		__in LONG Disp,
+		__in XMM Src
+		);
+
+	void
+	MovsdRegMem(
+		__in XMM Dst,
+		__in GPR Base,
+		__in LONG Disp
+		);
+
+	void
+	MovsdMemReg(
+		__in GPR Base,
+		__in LONG Disp,
+		__in XMM Src
+		);
+
+	void
+	MovdquRegMem(
+		__in XMM Dst,
+		__in GPR Base,
+		__in LONG Disp
+		);
+
+	void
+	MovdquMemReg(
+		__in GPR Base,
+		__in LONG Disp,
+		__in XMM Src
+		);
+
+	void
+	MovdXmmReg32(
+		__in XMM Dst,
+		__in GPR Src
+		);
+
+	void
+	MovdRegXmm32(
+		__in GPR Dst,
+		__in XMM Src
+		);
+
+	void
+	Cvtsi2ssRegReg32(
+		__in XMM Dst,
+		__in GPR Src
+		);
+
+	void
+	SseRegReg(
+		__in SSE_OP Op,
+		__in XMM Dst,
+		__in XMM Src
+		);
+
+	void
+	UcomissRegReg(
+		__in XMM Reg1,
+		__in XMM Reg2
+		);
+
+	//
+	// Control transfer.
+	//
+
+	void
+	Jmp(
+		__in Label Target
+		);
+
+	void
+	Jcc(
+		__in CONDITION Condition,
+		__in Label Target
+		);
+
+	void
+	Call(
+		__in Label Target
+		);
+
+	void
+	CallReg(
+		__in GPR Target
+		);
+
+	void
+	Ret(
+		);
+
+	//
+	// String operations.
+	//
+
+	void
+	RepMovsq(
+		);
+
+private:
+
+	enum
+	{
+		INVALID_LABEL_OFFSET = ~(size_t) 0,
+
+		LAST_ASSEMBLER_CONSTANT
+	};
+
+	//
+	// Define a pending branch displacement, which is resolved once the target
+	// label has been bound.  The displacement is relative to the end of the
+	// 32-bit displacement field (i.e. the end of the instruction).
+	//
+
+	struct Fixup
+	{
+		size_t Offset;
+		Label  Target;
+	};
+
+	typedef std::vector< Fixup > FixupVec;
+
+	//
+	// Assemblers are not copyable.
+	//
+
+	X64Assembler(
+		__in const X64Assembler & other
+		);
+
+	X64Assembler &
+	operator=(
+		__in const X64Assembler & other
+		);
+
+	void
+	EmitByte(
+		__in UCHAR Byte
+		);
+
+	void
+	EmitDword(
+		__in ULONG Dword
+		);
+
+	void
+	EmitQword(
+		__in ULONG64 Qword
+		);
+
+	//
+	// Emit a REX prefix if one is required.  Force requests an empty REX
+	// prefix, which is needed to address the low byte of RSP/RBP/RSI/RDI.
+	//
+
+	void
+	EmitRex(
+		__in bool W,
+		__in ULONG Reg,
+		__in ULONG Base,
+		__in bool Force = false
+		);
+
+	void
+	EmitModRmReg(
+		__in ULONG Reg,
+		__in ULONG Rm
+		);
+
+	void
+	EmitModRmMem(
+		__in ULONG Reg,
+		__in GPR Base,
+		__in LONG Disp
+		);
+
+	void
+	EmitRel32(
+		__in Label Target
+		);
+
+	//
+	// Emit a register to register or register to memory SSE instruction with
+	// a mandatory prefix (or zero for none).
+	//
+
+	void
+	EmitSseRegReg(
+		__in UCHAR Prefix,
+		__in UCHAR Opcode,
+		__in ULONG Reg,
+		__in ULONG Rm
+		);
+
+	void
+	EmitSseRegMem(
+		__in UCHAR Prefix,
+		__in UCHAR Opcode,
+		__in ULONG Reg,
+		__in GPR Base,
+		__in LONG Disp
+		);
+
+	std::vector< unsigned char > m_Code;
+	std::vector< size_t >        m_Labels;
+	FixupVec                     m_Fixups;
+
+};
+
+#endif
@@ -2510,6 +2510,87 @@ Environment:
 		throw type_mismatch_exception( "DecrementStackInt type mismatch" );
 }
 
+bool
+NWScriptStack::AddConstantToStackInt(
+	__in STACK_POINTER SrcDisplacement,
+	__in int Addend,
+	__in STACK_POINTER DestDisplacement
+	)
+/*++
+
+Routine Description:
+
+	This routine adds a constant to an integer relative to the current SP, and
+	assigns the sum to another integer relative to the current SP, without
+	pushing any temporaries.
+
+	Only plain integer cells below the current SP and above any guard zone are
+	handled.  Any other case (dynamic parameters, type mismatches, misaligned
+	or out of range references) is declined so that the caller may perform the
+	equivalent general purpose operations, which handle conversions and raise
+	the appropriate errors.
+
+Arguments:
+
+	SrcDisplacement - Supplies the displacement of the source integer from the
+	                  current SP.
+
+	Addend - Supplies the constant to add to the source integer.
+
+	DestDisplacement - Supplies the displacement of the destination integer
+	                   from the current SP.
+
+Return Value:
+
+	The routine returns true if the sum was assigned, else false if the
+	operation was declined.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	STACK_POINTER Source;
+	STACK_POINTER Destination;
+	size_t        SrcOffset;
+	size_t        DestOffset;
+
+	if ((SrcDisplacement >= 0)                          ||
+	    (DestDisplacement >= 0)                         ||
+	    (SrcDisplacement & (STACK_ENTRY_SIZE - 1))      ||
+	    (DestDisplacement & (STACK_ENTRY_SIZE - 1)))
+	{
+		return false;
+	}
+
+	Source      = GetCurrentSP( ) + SrcDisplacement;
+	Destination = GetCurrentSP( ) + DestDisplacement;
+
+	if ((Source < 0) || (Destination < 0))
+		return false;
+
+	if ((!m_GuardZoneStack.empty( )) &&
+	    ((m_GuardZoneStack.back( ) >= Source) ||
+	     (m_GuardZoneStack.back( ) >= Destination)))
+	{
+		return false;
+	}
+
+	SrcOffset  = (size_t) (Source / STACK_ENTRY_SIZE);
+	DestOffset = (size_t) (Destination / STACK_ENTRY_SIZE);
+
+	if ((m_StackTypes[ SrcOffset ] != SET_INTEGER) ||
+	    (m_StackTypes[ DestOffset ] != SET_INTEGER))
+	{
+		return false;
+	}
+
+	m_Stack[ DestOffset ].Int = (int) ((ULONG) m_Stack[ SrcOffset ].Int + (ULONG) Addend);
+
+	return true;
+}
+
 NWScriptStack::STACK_POINTER
 NWScriptStack::GetStackIntegerSize(
 	) const
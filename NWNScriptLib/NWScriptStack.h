@@ -594,6 +594,22 @@ public:
 		__in STACK_POINTER AbsoluteAddress
 		);
 
+	//
+	// Add a constant to an integer and assign the sum to an integer, where
+	// both integers are at a displacement relative to the current SP.  This
+	// is the fast path for the script VM's fused a = b + k sequence; it only
+	// operates on plain integer cells, and returns false without altering the
+	// stack otherwise (in which case the caller must perform the general
+	// purpose copy and arithmetic operations instead).
+	//
+
+	bool
+	AddConstantToStackInt(
+		__in STACK_POINTER SrcDisplacement,
+		__in int Addend,
+		__in STACK_POINTER DestDisplacement
+		);
+
 
 	//
 	// Return the size of an integer on the stack.
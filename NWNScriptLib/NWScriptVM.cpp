@@ -40,6 +40,13 @@ Abstract:
 #include "NWScriptAnalyzer.h"
 #endif
 
+//
+// Define to 1 in order to fuse common instruction sequences into
+// superinstructions when a script is decoded.
+//
+
+#define FUSE_SUPERINSTRUCTIONS 1
+
 //
 // STACK_PTR( x ) returns a legal SP reference given a stack offset.  In the
 // debugger enabled version however we would like the bogus SP references to
@@ -54,6 +61,122 @@ Abstract:
 #define STACK_PTR( x ) ((x) & ~3) // NOTE: Hardcodes GetStackIntegerSize / STACK_ENTRY_SIZE for performance !
 #endif
 
+//
+// Define the pre-decoded form of a script.  Each instruction is translated
+// once into a fixed-width record whose operands are already in host byte
+// order, whose branch targets are resolved to record indices, and whose
+// string constants are interned in a per-script string table.  The execution
+// loop then walks the record array directly, instead of re-parsing the byte
+// code (and its big-endian operands) through the script reader each time an
+// instruction is executed.
+//
+
+class NWScriptVM::DecodedScript : public NWScriptReader::DecodedProgram
+{
+
+public:
+
+	enum
+	{
+		//
+		// Define the pseudo-opcode that marks an instruction that could not
+		// be decoded.  Decoding stops at such an instruction; executing it
+		// raises an std::exception, as executing the raw byte code would.
+		//
+
+		OP_DECODE_ERROR         = 0xFF,
+
+		//
+		// Define the superinstruction pseudo-opcodes.  A superinstruction
+		// replaces the dispatch opcode of the first instruction of a fused
+		// sequence; the remaining instructions of the sequence retain their
+		// records (and thus remain valid branch targets), and supply their
+		// operands to the superinstruction.
+		//
+
+		//
+		// RSADD.T, CONST.T, CPDOWNSP -8, 4, MOVSP -4 (initialized local).
+		//
+
+		OP_SI_INITIALIZE_LOCAL  = 0xF0,
+
+		//
+		// CPTOPSP, CONSTI, ADDII or SUBII, CPDOWNSP, MOVSP -4 (add a constant
+		// to an integer local and assign the sum to an integer local).
+		//
+
+		OP_SI_ADD_LOCAL_CONST   = 0xF1,
+
+		//
+		// Define the branch target of a branch whose destination does not
+		// begin an instruction.
+		//
+
+		INVALID_TARGET          = 0xFFFFFFFF,
+
+		LAST_DECODED_SCRIPT_CONSTANT
+	};
+
+	struct Instruction
+	{
+		UCHAR           Opcode;
+		UCHAR           TypeOpcode;
+
+		//
+		// Define the opcode to dispatch on, which is either the instruction
+		// opcode or a superinstruction pseudo-opcode, and the count of
+		// instruction records that the dispatch opcode executes.
+		//
+
+		UCHAR           Dispatch;
+		UCHAR           FusedCount;
+
+		USHORT          Length;
+		PROGRAM_COUNTER PC;
+
+		//
+		// Operands are stored as read from the byte code, in order.  String
+		// constants store their index into the string table, and float
+		// constants are stored in FloatOperand.
+		//
+
+		union
+		{
+			ULONG       Operand[ 3 ];
+			float       FloatOperand;
+		};
+
+		//
+		// Branch instructions store the index of the destination record.
+		//
+
+		ULONG           Target;
+	};
+
+	typedef std::vector< Instruction > InstructionVec;
+	typedef std::vector< std::string > StringVec;
+
+	//
+	// Define the decoded instruction records, ordered by program counter.
+	//
+
+	InstructionVec      Instructions;
+
+	//
+	// Define the interned string constants of the script.
+	//
+
+	StringVec           Strings;
+
+	//
+	// Define the length of the instruction stream, i.e. the program counter
+	// at which execution runs off the end of the script.
+	//
+
+	PROGRAM_COUNTER     EndPC;
+
+};
+
 
 
 NWScriptVM::NWScriptVM(
@@ -93,6 +216,7 @@ Environment:
   m_DebugLevel( EDL_Errors ),
   m_InstructionsExecuted( 0 ),
   m_RecursionLevel( 0 ),
+  m_BackwardBranches( 0 ),
   m_CurrentActionObjectSelf( NWN::INVALIDOBJID ),
   m_ActionDefs( ActionDefs ),
   m_ActionCount( ActionCount )
@@ -1148,6 +1272,429 @@ Environment:
 	}
 }
 
+const NWScriptVM::DecodedScript *
+NWScriptVM::GetDecodedScript(
+	__in NWScriptReader * Script
+	)
+/*++
+
+Routine Description:
+
+	This routine retrieves the pre-decoded instruction stream of a script.  The
+	script is decoded the first time that it is executed, and the decoded form
+	is retained by the script reader until the instruction stream is patched.
+
+Arguments:
+
+	Script - Supplies the script to retrieve the decoded form of.  The script's
+	         program counter is undefined on return.
+
+Return Value:
+
+	The routine returns the decoded script.  On failure, an std::exception is
+	raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	NWScriptReader::DecodedProgramPtr Program;
+	DecodedScript                   * Decoded;
+
+	Decoded = static_cast< DecodedScript * >( Script->GetDecodedProgram( ).get( ) );
+
+	if (Decoded != NULL)
+		return Decoded;
+
+	Decoded = new DecodedScript;
+	Program = NWScriptReader::DecodedProgramPtr( Decoded );
+
+	DecodeScript( Script, *Decoded );
+
+	Script->SetDecodedProgram( Program );
+
+	return Decoded;
+}
+
+void
+NWScriptVM::DecodeScript(
+	__in NWScriptReader * Script,
+	__out DecodedScript & Decoded
+	)
+/*++
+
+Routine Description:
+
+	This routine translates the instruction stream of a script into its
+	pre-decoded form.  The byte code is walked linearly from the start of the
+	script; each instruction becomes one fixed-width record.  Branches are then
+	resolved to the index of their destination record.
+
+	Should an instruction be encountered that cannot be decoded, a record is
+	emitted that raises an std::exception if executed, and decoding stops.
+	This preserves the behavior of decoding the byte code at execution time,
+	where an ill-formed instruction is only fatal if it is reached.
+
+Arguments:
+
+	Script - Supplies the script to decode.  The script's program counter is
+	         undefined on return.
+
+	Decoded - Receives the decoded script.  The object must be empty.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	typedef stdext::hash_map< std::string, ULONG > StringIndexMap;
+
+	StringIndexMap  StringIndices;
+	PROGRAM_COUNTER PC;
+
+	PC = 0;
+
+	Script->SetInstructionPointer( 0 );
+
+	while (!Script->ScriptIsEof( ))
+	{
+		DecodedScript::Instruction Instruction;
+		ULONG                      PCOffset;
+		ULONG                      Length;
+
+		ZeroMemory( &Instruction, sizeof( Instruction ) );
+
+		Instruction.PC     = PC;
+		Instruction.Target = DecodedScript::INVALID_TARGET;
+
+		try
+		{
+			Length = DecodeInstruction(
+				Script,
+				Instruction.Opcode,
+				Instruction.TypeOpcode,
+				PCOffset);
+
+			if (Length > 0xFFFF)
+				throw std::runtime_error( "Instruction too long." );
+
+			Instruction.Length     = (USHORT) Length;
+			Instruction.Dispatch   = Instruction.Opcode;
+			Instruction.FusedCount = 1;
+
+			switch (Instruction.Opcode)
+			{
+
+			case OP_CPDOWNSP:
+			case OP_CPTOPSP:
+			case OP_CPDOWNBP:
+			case OP_CPTOPBP:
+				Instruction.Operand[ 0 ] = Script->ReadINT32( );
+				Instruction.Operand[ 1 ] = Script->ReadINT16( );
+				break;
+
+			case OP_CONST:
+				switch (Instruction.TypeOpcode)
+				{
+
+				case TYPE_UNARY_INT:
+				case TYPE_UNARY_OBJECTID:
+					Instruction.Operand[ 0 ] = Script->ReadINT32( );
+					break;
+
+				case TYPE_UNARY_FLOAT:
+					Instruction.FloatOperand = Script->ReadFLOAT( );
+					break;
+
+				case TYPE_UNARY_STRING:
+					{
+						std::string              String;
+						StringIndexMap::iterator it;
+
+						String = Script->ReadString( Length - 4 );
+						it     = StringIndices.find( String );
+
+						if (it == StringIndices.end( ))
+						{
+							it = StringIndices.insert(
+								StringIndexMap::value_type(
+									String,
+									(ULONG) Decoded.Strings.size( ) ) ).first;
+
+							Decoded.Strings.push_back( String );
+						}
+
+						Instruction.Operand[ 0 ] = it->second;
+					}
+					break;
+
+				}
+				break;
+
+			case OP_ACTION:
+				Instruction.Operand[ 0 ] = Script->ReadINT16( );
+				Instruction.Operand[ 1 ] = Script->ReadINT8( );
+				break;
+
+			case OP_EQUAL:
+			case OP_NEQUAL:
+				if (Instruction.TypeOpcode == TYPE_BINARY_STRUCTSTRUCT)
+					Instruction.Operand[ 0 ] = Script->ReadINT16( );
+				break;
+
+			case OP_MOVSP:
+			case OP_JMP:
+			case OP_JSR:
+			case OP_JZ:
+			case OP_JNZ:
+			case OP_DECISP:
+			case OP_INCISP:
+			case OP_DECIBP:
+			case OP_INCIBP:
+				Instruction.Operand[ 0 ] = Script->ReadINT32( );
+				break;
+
+			case OP_DESTRUCT:
+				Instruction.Operand[ 0 ] = Script->ReadINT16( );
+				Instruction.Operand[ 1 ] = Script->ReadINT16( );
+				Instruction.Operand[ 2 ] = Script->ReadINT16( );
+				break;
+
+			case OP_STORE_STATE:
+				Instruction.Operand[ 0 ] = Script->ReadINT32( );
+				Instruction.Operand[ 1 ] = Script->ReadINT32( );
+				break;
+
+			}
+
+			Script->SetInstructionPointer( PC + Length );
+		}
+		catch (std::bad_alloc)
+		{
+			throw;
+		}
+		catch (std::exception)
+		{
+			//
+			// The instruction is ill-formed.  Leave a marker that faults if
+			// it is executed and stop decoding here, as the boundary of the
+			// next instruction is unknown.
+			//
+
+			ZeroMemory( &Instruction.Operand, sizeof( Instruction.Operand ) );
+
+			Instruction.Opcode     = DecodedScript::OP_DECODE_ERROR;
+			Instruction.Dispatch   = DecodedScript::OP_DECODE_ERROR;
+			Instruction.FusedCount = 1;
+			Instruction.Length     = 0;
+
+			Decoded.Instructions.push_back( Instruction );
+			break;
+		}
+
+		Decoded.Instructions.push_back( Instruction );
+
+		PC += Length;
+	}
+
+	Decoded.EndPC = PC;
+
+	//
+	// Now resolve branch destinations.  A branch whose destination does not
+	// begin an instruction is left unresolved, and faults if it is taken.
+	//
+
+	for (DecodedScript::InstructionVec::iterator it = Decoded.Instructions.begin( );
+	     it != Decoded.Instructions.end( );
+	     ++it)
+	{
+		switch (it->Opcode)
+		{
+
+		case OP_JMP:
+		case OP_JSR:
+		case OP_JZ:
+		case OP_JNZ:
+			try
+			{
+				it->Target = LookupDecodedInstruction(
+					&Decoded,
+					it->PC + (PROGRAM_COUNTER) it->Operand[ 0 ]);
+			}
+			catch (std::runtime_error)
+			{
+				it->Target = DecodedScript::INVALID_TARGET;
+			}
+			break;
+
+		}
+	}
+
+#if FUSE_SUPERINSTRUCTIONS
+	FuseSuperinstructions( Decoded );
+#endif
+}
+
+void
+NWScriptVM::FuseSuperinstructions(
+	__inout DecodedScript & Decoded
+	)
+/*++
+
+Routine Description:
+
+	This routine scans a decoded script for the instruction sequences that
+	the NWScript compiler emits for common idioms, and marks the first record
+	of each such sequence to dispatch to a superinstruction that performs the
+	work of the whole sequence directly upon the affected stack cells.
+
+	The set of fused sequences was chosen from the instruction sequence
+	frequencies of typical module script collections (see the
+	ProfileModuleScripts tool).
+
+	Only the dispatch opcode of the first record is altered.  The remaining
+	records are left intact, so a branch into the middle of a sequence still
+	executes the original instructions.
+
+Arguments:
+
+	Decoded - Supplies the decoded script to fuse instructions within.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	DecodedScript::Instruction * I;
+	size_t                       Count;
+
+	Count = Decoded.Instructions.size( );
+
+	for (size_t i = 0; i < Count; i += 1)
+	{
+		I = &Decoded.Instructions[ i ];
+
+		//
+		// RSADD.T, CONST.T, CPDOWNSP -8, 4, MOVSP -4 is the declaration of a
+		// local variable with an initializer.  The net effect is to push the
+		// constant.
+		//
+
+		if ((Count - i >= 4)                                            &&
+		    (I[ 0 ].Opcode == OP_RSADD)                                 &&
+		    ((I[ 0 ].TypeOpcode == TYPE_UNARY_INT)    ||
+		     (I[ 0 ].TypeOpcode == TYPE_UNARY_FLOAT)  ||
+		     (I[ 0 ].TypeOpcode == TYPE_UNARY_STRING))                  &&
+		    (I[ 1 ].Opcode == OP_CONST)                                 &&
+		    (I[ 1 ].TypeOpcode == I[ 0 ].TypeOpcode)                    &&
+		    (I[ 2 ].Opcode == OP_CPDOWNSP)                              &&
+		    ((STACK_POINTER) I[ 2 ].Operand[ 0 ] == -8)                 &&
+		    (I[ 2 ].Operand[ 1 ] == 4)                                  &&
+		    (I[ 3 ].Opcode == OP_MOVSP)                                 &&
+		    ((STACK_POINTER) I[ 3 ].Operand[ 0 ] == -4))
+		{
+			I[ 0 ].Dispatch   = DecodedScript::OP_SI_INITIALIZE_LOCAL;
+			I[ 0 ].FusedCount = 4;
+			continue;
+		}
+
+		//
+		// CPTOPSP, CONSTI, ADDII (or SUBII), CPDOWNSP, MOVSP -4 is an integer
+		// assignment of the form a = b + k (including a += k).  The net effect
+		// is to store the sum into the destination cell.
+		//
+
+		if ((Count - i >= 5)                                            &&
+		    (I[ 0 ].Opcode == OP_CPTOPSP)                               &&
+		    ((STACK_POINTER) I[ 0 ].Operand[ 0 ] < 0)                   &&
+		    (I[ 0 ].Operand[ 1 ] == 4)                                  &&
+		    (I[ 1 ].Opcode == OP_CONST)                                 &&
+		    (I[ 1 ].TypeOpcode == TYPE_UNARY_INT)                       &&
+		    ((I[ 2 ].Opcode == OP_ADD) || (I[ 2 ].Opcode == OP_SUB))    &&
+		    (I[ 2 ].TypeOpcode == TYPE_BINARY_INTINT)                   &&
+		    (I[ 3 ].Opcode == OP_CPDOWNSP)                              &&
+		    ((STACK_POINTER) I[ 3 ].Operand[ 0 ] < -4)                  &&
+		    (I[ 3 ].Operand[ 1 ] == 4)                                  &&
+		    (I[ 4 ].Opcode == OP_MOVSP)                                 &&
+		    ((STACK_POINTER) I[ 4 ].Operand[ 0 ] == -4))
+		{
+			I[ 0 ].Dispatch   = DecodedScript::OP_SI_ADD_LOCAL_CONST;
+			I[ 0 ].FusedCount = 5;
+			continue;
+		}
+	}
+}
+
+ULONG
+NWScriptVM::LookupDecodedInstruction(
+	__in const DecodedScript * Decoded,
+	__in PROGRAM_COUNTER PC
+	)
+/*++
+
+Routine Description:
+
+	This routine locates the pre-decoded instruction that begins at a given
+	program counter, such as a subroutine return address.
+
+Arguments:
+
+	Decoded - Supplies the decoded script to search.
+
+	PC - Supplies the program counter to locate.
+
+Return Value:
+
+	The routine returns the index of the instruction record.  The end of the
+	script maps to the count of instruction records.  If the program counter
+	does not begin an instruction, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	ULONG Low;
+	ULONG High;
+
+	Low  = 0;
+	High = (ULONG) Decoded->Instructions.size( );
+
+	while (Low < High)
+	{
+		ULONG Mid = Low + (High - Low) / 2;
+
+		if (Decoded->Instructions[ Mid ].PC < PC)
+			Low = Mid + 1;
+		else
+			High = Mid;
+	}
+
+	if ((Low < Decoded->Instructions.size( )) &&
+	    (Decoded->Instructions[ Low ].PC == PC))
+	{
+		return Low;
+	}
+
+	if (PC == Decoded->EndPC)
+		return (ULONG) Decoded->Instructions.size( );
+
+	throw std::runtime_error( "Control transfer to an invalid address." );
+}
+
 int
 NWScriptVM::ExecuteInstructions(
 	__in NWScriptReaderPtr & Script,
@@ -1169,7 +1716,8 @@ Routine Description:
 Arguments:
 
 	Script - Supplies the script byte code to execute.  The script's PC must be
-	         prepositioned at the corret location.
+	         prepositioned at the corret location.  The script is executed
+	         from its pre-decoded form, which is generated on first use.
 
 	ObjectSelf - Supplies the object id to reference for the 'object self'
 	             manifest constant.
@@ -1222,16 +1770,23 @@ Environment:
 	STACK_POINTER   EndSP;
 	UCHAR           Opcode;
 	UCHAR           TypeOpcode;
-	ULONG           PCOffset;
+	UCHAR           Dispatch;
 	ULONG           InstructionLength;
+	ULONG           Index;
+	ULONG           InstructionCount;
 	ULONG           BPNestingLevel;
 	size_t          ReturnStackDepth;
 	PROGRAM_COUNTER PC;
 	bool            DebugVerbose;
+	bool            Unfuse;
 	bool            NoReturnValue;
 	bool            ExpectReturnValue;
 	std::string     SymbolName;
 
+	NWScriptReader::DecodedProgramPtr  DecodedProgram;
+	const DecodedScript              * Decoded;
+	const DecodedScript::Instruction * Instruction;
+
 	//
 	// N.B.  NoReturnValue and ExpectReturnValue can only be conclusively
 	//       identified if we are in fixup mode.  Otherwise we don't know for
@@ -1242,6 +1797,7 @@ Environment:
 	ExpectReturnValue = false;
 	BPNestingLevel    = 0;
 	ReturnStackDepth  = VMStack.GetReturnStackDepth( );
+	Unfuse            = false;
 
 	DebugVerbose = IsDebugLevel( EDL_Verbose );
 
@@ -1259,6 +1815,18 @@ Environment:
 	StartSP = VMStack.GetCurrentSP( );
 	PC      = (PROGRAM_COUNTER) Script->GetInstructionPointer( );
 
+	//
+	// Fetch the pre-decoded instruction stream and locate the starting
+	// instruction within it.  A reference is held on the decoded stream, as a
+	// reentrant invocation of the script from an action handler may patch the
+	// script and thus detach the decoded stream from the script reader.
+	//
+
+	Decoded          = GetDecodedScript( Script.get( ) );
+	DecodedProgram   = Script->GetDecodedProgram( );
+	Index            = LookupDecodedInstruction( Decoded, PC );
+	InstructionCount = (ULONG) Decoded->Instructions.size( );
+
 	//
 	// If we do not need to defer parameter pushing for the fixup, then do the
 	// parameter push now.
@@ -1310,7 +1878,7 @@ Environment:
 	// Loop executing instructions.
 	//
 
-	while (!Script->ScriptIsEof( ))
+	while (Index < InstructionCount)
 	{
 		if (++m_InstructionsExecuted > MAX_SCRIPT_INSTRUCTIONS)
 		{
@@ -1324,14 +1892,32 @@ Environment:
 		}
 
 		//
-		// Decode and dispatch the instruction.
+		// Fetch the pre-decoded instruction and dispatch it.
+		//
+
+		Instruction       = &Decoded->Instructions[ Index ];
+		Opcode            = Instruction->Opcode;
+		TypeOpcode        = Instruction->TypeOpcode;
+		InstructionLength = Instruction->Length;
+		PC                = Instruction->PC;
+		Dispatch          = Instruction->Dispatch;
+
+		//
+		// Superinstructions are not used while the entry point fixups are
+		// still pending, as the fixups must observe each instruction, nor when
+		// a superinstruction has asked to fall back to its constituent
+		// instructions.  Nor are they used when their constituent instructions
+		// would exceed the instruction limit, so that the limit is raised at
+		// exactly the same instruction as without superinstructions.
 		//
 
-		InstructionLength = DecodeInstruction(
-			Script.get( ),
-			Opcode,
-			TypeOpcode,
-			PCOffset);
+		if ((FixupState != FixupState_Done) ||
+		    (Unfuse) ||
+		    ((size_t) (Instruction->FusedCount - 1) > MAX_SCRIPT_INSTRUCTIONS - m_InstructionsExecuted))
+		{
+			Dispatch = Opcode;
+			Unfuse   = false;
+		}
 
 		if (FixupState == FixupState_WaitingForStartingConditional)
 		{
@@ -1381,6 +1967,12 @@ Environment:
 		{
 			enum { DBGSTACK = 3 };
 
+			//
+			// Trace each instruction individually.
+			//
+
+			Dispatch = Opcode;
+
 			char  TopStack[ 256 ];
 			ULONG RawStack[ DBGSTACK ];
 			UCHAR RawStackType[ DBGSTACK ];
@@ -1492,7 +2084,7 @@ Environment:
 		}
 #endif
 
-		switch (Opcode)
+		switch (Dispatch)
 		{
 
 		case OP_CPDOWNSP: // Copy down SP (assignment operator)
@@ -1500,8 +2092,8 @@ Environment:
 				STACK_POINTER Offset;
 				STACK_POINTER Size;
 
-				Offset = (STACK_POINTER) Script->ReadINT32( );
-				Size   = (STACK_POINTER) Script->ReadINT16( );
+				Offset = (STACK_POINTER) Instruction->Operand[ 0 ];
+				Size   = (STACK_POINTER) (USHORT) Instruction->Operand[ 1 ];
 
 				Offset = STACK_PTR( Offset );
 				Size   = STACK_PTR( Size );
@@ -1606,8 +2198,8 @@ Environment:
 				STACK_POINTER Offset;
 				STACK_POINTER Size;
 
-				Offset = (STACK_POINTER) Script->ReadINT32( );
-				Size   = (STACK_POINTER) Script->ReadINT16( );
+				Offset = (STACK_POINTER) Instruction->Operand[ 0 ];
+				Size   = (STACK_POINTER) (USHORT) Instruction->Operand[ 1 ];
 
 				Offset = STACK_PTR( Offset );
 				Size   = STACK_PTR( Size );
@@ -1622,26 +2214,23 @@ Environment:
 				{
 
 				case TYPE_UNARY_INT:
-					VMStack.StackPushInt( (int) Script->ReadINT32( ) );
+					VMStack.StackPushInt( (int) Instruction->Operand[ 0 ] );
 					break;
 
 				case TYPE_UNARY_FLOAT:
-					VMStack.StackPushFloat( Script->ReadFLOAT( ) );
+					VMStack.StackPushFloat( Instruction->FloatOperand );
 					break;
 
 				case TYPE_UNARY_STRING:
 					VMStack.StackPushString(
-						Script->ReadString(
-							InstructionLength - 4
-							)
-						);
+						Decoded->Strings[ Instruction->Operand[ 0 ] ]);
 					break;
 
 				case TYPE_UNARY_OBJECTID:
 					{
 						NWN::OBJECTID ObjectId;
 
-						ObjectId = (NWN::OBJECTID) Script->ReadINT32( );
+						ObjectId = (NWN::OBJECTID) Instruction->Operand[ 0 ];
 
 						switch (ObjectId)
 						{
@@ -1732,8 +2321,8 @@ Environment:
 				NWSCRIPT_ACTION ActionId;
 				size_t          ArgumentCount;
 
-				ActionId      = (NWSCRIPT_ACTION) Script->ReadINT16( );
-				ArgumentCount = (size_t) Script->ReadINT8( );
+				ActionId      = (NWSCRIPT_ACTION) (USHORT) Instruction->Operand[ 0 ];
+				ArgumentCount = (size_t) (UCHAR) Instruction->Operand[ 1 ];
 
 				m_CurrentActionObjectSelf = ObjectSelf;
 
@@ -1747,13 +2336,6 @@ Environment:
 					ActionId,
 					ArgumentCount);
 
-				//
-				// If the action recursively called this script then the active
-				// PC may have been reset.  Ensure that it is correct now.
-				//
-
-				Script->SetInstructionPointer( PC + InstructionLength );
-
 				if (IsScriptAborted( ))
 					throw std::runtime_error( "Script program execution abortively terminated." );
 			}
@@ -1888,7 +2470,7 @@ Environment:
 					{
 						USHORT Size;
 
-						Size  = Script->ReadINT16( );
+						Size  = (USHORT) Instruction->Operand[ 0 ];
 
 						Size  = STACK_PTR( Size );
 
@@ -2793,7 +3375,7 @@ Environment:
 			{
 				ULONG Displacement;
 
-				Displacement = Script->ReadINT32( );
+				Displacement = Instruction->Operand[ 0 ];
 
 				Displacement = STACK_PTR( Displacement );
 
@@ -2817,13 +3399,18 @@ Environment:
 			{
 				PROGRAM_COUNTER RelPC;
 
-				RelPC = (PROGRAM_COUNTER) Script->ReadINT32( );
+				RelPC = (PROGRAM_COUNTER) Instruction->Operand[ 0 ];
 
 				if (RelPC == 0)
 					throw std::runtime_error( "Trivial infinite loop (JMP) detected." );
 
-				PC += RelPC;
-				Script->SetInstructionPointer( PC );
+				if (Instruction->Target == DecodedScript::INVALID_TARGET)
+					throw std::runtime_error( "Control transfer to an invalid address." );
+
+				if (Instruction->Target <= Index)
+					m_BackwardBranches += 1;
+
+				Index = Instruction->Target;
 				continue; // Skip normal PC adjustment for this instruction.
 			}
 			break;
@@ -2832,15 +3419,17 @@ Environment:
 			{
 				PROGRAM_COUNTER RelPC;
 
-				RelPC = (PROGRAM_COUNTER) Script->ReadINT32( );
+				RelPC = (PROGRAM_COUNTER) Instruction->Operand[ 0 ];
 
 				if (RelPC == 0)
 					throw std::runtime_error( "Trivial infinite loop (JSR) detected." );
 
 				VMStack.SaveProgramCounter( PC + InstructionLength );
 
-				PC += RelPC;
-				Script->SetInstructionPointer( PC );
+				if (Instruction->Target == DecodedScript::INVALID_TARGET)
+					throw std::runtime_error( "Control transfer to an invalid address." );
+
+				Index = Instruction->Target;
 				continue; // Skip normal PC adjustment for this instruction.
 			}
 			break;
@@ -2850,7 +3439,7 @@ Environment:
 				PROGRAM_COUNTER RelPC;
 				int             i;
 
-				RelPC = (PROGRAM_COUNTER) Script->ReadINT32( );
+				RelPC = (PROGRAM_COUNTER) Instruction->Operand[ 0 ];
 				i     = VMStack.StackPopInt( );
 
 				//
@@ -2863,8 +3452,13 @@ Environment:
 				if (RelPC == 0)
 					throw std::runtime_error( "Trivial infinite loop (JZ) detected." );
 
-				PC += RelPC;
-				Script->SetInstructionPointer( PC );
+				if (Instruction->Target == DecodedScript::INVALID_TARGET)
+					throw std::runtime_error( "Control transfer to an invalid address." );
+
+				if (Instruction->Target <= Index)
+					m_BackwardBranches += 1;
+
+				Index = Instruction->Target;
 				continue; // Skip normal PC adjustment for this instruction.
 			}
 			break;
@@ -2884,8 +3478,8 @@ Environment:
 				// script VM; restore a value from the PC return stack.
 				//
 
-				PC = VMStack.RestoreProgramCounter( );
-				Script->SetInstructionPointer( PC );
+				PC    = VMStack.RestoreProgramCounter( );
+				Index = LookupDecodedInstruction( Decoded, PC );
 				continue; // Skip normal PC adjustment for this instruction.
 			}
 			break;
@@ -2898,9 +3492,9 @@ Environment:
 				STACK_POINTER CurSP;
 				
 				CurSP         = VMStack.GetCurrentSP( );
-				Size          = (STACK_POINTER) Script->ReadINT16( );
-				ExcludeOffset = (STACK_POINTER) Script->ReadINT16( );
-				ExcludeSize   = (STACK_POINTER) Script->ReadINT16( );
+				Size          = (STACK_POINTER) (USHORT) Instruction->Operand[ 0 ];
+				ExcludeOffset = (STACK_POINTER) (USHORT) Instruction->Operand[ 1 ];
+				ExcludeSize   = (STACK_POINTER) (USHORT) Instruction->Operand[ 2 ];
 
 				Size          = STACK_PTR( Size );
 				ExcludeOffset = STACK_PTR( ExcludeOffset );
@@ -2943,7 +3537,7 @@ Environment:
 				STACK_POINTER Offset;
 				STACK_POINTER CurSP;
 
-				Offset = (STACK_POINTER) Script->ReadINT32( );
+				Offset = (STACK_POINTER) Instruction->Operand[ 0 ];
 				Offset = STACK_PTR( Offset );
 				CurSP  = VMStack.GetCurrentSP( );
 
@@ -2960,7 +3554,7 @@ Environment:
 				STACK_POINTER Offset;
 				STACK_POINTER CurSP;
 
-				Offset = (STACK_POINTER) Script->ReadINT32( );
+				Offset = (STACK_POINTER) Instruction->Operand[ 0 ];
 				Offset = STACK_PTR( Offset );
 				CurSP  = VMStack.GetCurrentSP( );
 
@@ -2977,7 +3571,7 @@ Environment:
 				PROGRAM_COUNTER RelPC;
 				int             i;
 
-				RelPC = (PROGRAM_COUNTER) Script->ReadINT32( );
+				RelPC = (PROGRAM_COUNTER) Instruction->Operand[ 0 ];
 				i     = VMStack.StackPopInt( );
 
 				//
@@ -2990,8 +3584,13 @@ Environment:
 				if (RelPC == 0)
 					throw std::runtime_error( "Trivial infinite loop (JNZ) detected." );
 
-				PC += RelPC;
-				Script->SetInstructionPointer( PC );
+				if (Instruction->Target == DecodedScript::INVALID_TARGET)
+					throw std::runtime_error( "Control transfer to an invalid address." );
+
+				if (Instruction->Target <= Index)
+					m_BackwardBranches += 1;
+
+				Index = Instruction->Target;
 				continue; // Skip normal PC adjustment for this instruction.
 			}
 
@@ -3000,8 +3599,8 @@ Environment:
 				STACK_POINTER Offset;
 				STACK_POINTER Size;
 
-				Offset = (STACK_POINTER) Script->ReadINT32( );
-				Size   = (STACK_POINTER) Script->ReadINT16( );
+				Offset = (STACK_POINTER) Instruction->Operand[ 0 ];
+				Size   = (STACK_POINTER) (USHORT) Instruction->Operand[ 1 ];
 
 				Offset = STACK_PTR( Offset );
 				Size   = STACK_PTR( Size );
@@ -3018,8 +3617,8 @@ Environment:
 				STACK_POINTER Offset;
 				STACK_POINTER Size;
 
-				Offset = (STACK_POINTER) Script->ReadINT32( );
-				Size   = (STACK_POINTER) Script->ReadINT16( );
+				Offset = (STACK_POINTER) Instruction->Operand[ 0 ];
+				Size   = (STACK_POINTER) (USHORT) Instruction->Operand[ 1 ];
 
 				Offset = STACK_PTR( Offset );
 				Size   = STACK_PTR( Size );
@@ -3033,7 +3632,7 @@ Environment:
 				STACK_POINTER Offset;
 				STACK_POINTER CurBP;
 
-				Offset = (STACK_POINTER) Script->ReadINT32( );
+				Offset = (STACK_POINTER) Instruction->Operand[ 0 ];
 				Offset = STACK_PTR( Offset );
 				CurBP  = VMStack.GetCurrentBP( );
 
@@ -3047,7 +3646,7 @@ Environment:
 				STACK_POINTER Offset;
 				STACK_POINTER CurBP;
 
-				Offset = (STACK_POINTER) Script->ReadINT32( );
+				Offset = (STACK_POINTER) Instruction->Operand[ 0 ];
 				Offset = STACK_PTR( Offset );
 				CurBP  = VMStack.GetCurrentBP( );
 
@@ -3117,8 +3716,8 @@ Environment:
 				ULONG SaveBP;
 				ULONG SaveSP;
 
-				SaveBP = Script->ReadINT32( );
-				SaveSP = Script->ReadINT32( );
+				SaveBP = Instruction->Operand[ 0 ];
+				SaveSP = Instruction->Operand[ 1 ];
 
 				SaveBP = STACK_PTR( SaveBP );
 				SaveSP = STACK_PTR( SaveSP );
@@ -3138,6 +3737,86 @@ Environment:
 		case OP_NOP: // No operation (ignored).
 			break;
 
+		case DecodedScript::OP_SI_INITIALIZE_LOCAL: // Initialized local
+			{
+				const DecodedScript::Instruction * Const = &Instruction[ 1 ];
+
+				switch (TypeOpcode)
+				{
+
+				case TYPE_UNARY_INT:
+					VMStack.StackPushInt( (int) Const->Operand[ 0 ] );
+					break;
+
+				case TYPE_UNARY_FLOAT:
+					VMStack.StackPushFloat( Const->FloatOperand );
+					break;
+
+				case TYPE_UNARY_STRING:
+					VMStack.StackPushString(
+						Decoded->Strings[ Const->Operand[ 0 ] ]);
+					break;
+
+				}
+
+				m_InstructionsExecuted += Instruction->FusedCount - 1;
+				Index                  += Instruction->FusedCount;
+				continue; // Skip normal PC adjustment for this instruction.
+			}
+			break;
+
+		case DecodedScript::OP_SI_ADD_LOCAL_CONST: // Integer local += constant
+			{
+				STACK_POINTER Source;
+				STACK_POINTER Destination;
+				int           Addend;
+
+				Source      = (STACK_POINTER) Instruction[ 0 ].Operand[ 0 ];
+				Destination = (STACK_POINTER) Instruction[ 3 ].Operand[ 0 ];
+				Addend      = (int) Instruction[ 1 ].Operand[ 0 ];
+
+				Source      = STACK_PTR( Source );
+				Destination = STACK_PTR( Destination );
+
+				if (Instruction[ 2 ].Opcode == OP_SUB)
+					Addend = (int) (0 - (ULONG) Addend);
+
+				//
+				// The destination displacement of the CPDOWNSP is relative to
+				// the SP with the sum pushed.
+				//
+
+				if (!VMStack.AddConstantToStackInt(
+					Source,
+					Addend,
+					Destination + VMStack.GetStackIntegerSize( )))
+				{
+					//
+					// The cells are not plain integers; execute the original
+					// instructions instead, which perform any conversion or
+					// raise the appropriate error.
+					//
+
+					m_InstructionsExecuted -= 1;
+					Unfuse                  = true;
+					continue;
+				}
+
+				m_InstructionsExecuted += Instruction->FusedCount - 1;
+				Index                  += Instruction->FusedCount;
+				continue; // Skip normal PC adjustment for this instruction.
+			}
+			break;
+
+		case DecodedScript::OP_DECODE_ERROR: // Ill-formed instruction
+			DebugPrint(
+				EDL_Errors,
+				"NWScriptVM::ExecuteInstructions( %s ): @%08X: Ill-formed instruction.\n",
+				Script->GetScriptName( ).c_str( ),
+				PC);
+
+			throw std::runtime_error( "Ill-formed instruction." );
+
 		default:
 			DebugPrint(
 				EDL_Errors,
@@ -3154,10 +3833,11 @@ Environment:
 
 		//
 		// If we fell through, then this was not a control transfer (jump), and
-		// so the PC incremented linearly.  Account for this here.
+		// so execution proceeds to the next instruction record.  Account for
+		// this here.
 		//
 
-		PC += InstructionLength;
+		Index += 1;
 	}
 
 main_returned:
@@ -225,6 +225,21 @@ public:
 		return m_SavedState;
 	}
 
+	//
+	// Return the count of backward branches (loop back-edges) that the VM has
+	// taken since it was created.  The counter is never reset, so a caller
+	// attributes back-edges to a script by sampling the counter before and
+	// after running it.
+	//
+
+	inline
+	ULONG64
+	GetBackwardBranchCount(
+		) const
+	{
+		return m_BackwardBranches;
+	}
+
 	//
 	// Check if debug prints are enabled for a level.
 	//
@@ -371,6 +386,57 @@ private:
 		__out ULONG & PCOffset
 		);
 
+	//
+	// Define the pre-decoded form of a script's instruction stream, which is
+	// private to the script VM and cached on the script reader.
+	//
+
+	class DecodedScript;
+
+	//
+	// Retrieve the pre-decoded instruction stream for a script, decoding the
+	// script if it has not yet been decoded.
+	//
+
+	static
+	const DecodedScript *
+	GetDecodedScript(
+		__in NWScriptReader * Script
+		);
+
+	//
+	// Translate a script's instruction stream into its pre-decoded form.
+	//
+
+	static
+	void
+	DecodeScript(
+		__in NWScriptReader * Script,
+		__out DecodedScript & Decoded
+		);
+
+	//
+	// Fuse common instruction sequences of a decoded script into
+	// superinstructions.
+	//
+
+	static
+	void
+	FuseSuperinstructions(
+		__inout DecodedScript & Decoded
+		);
+
+	//
+	// Locate the pre-decoded instruction that begins at a program counter.
+	//
+
+	static
+	ULONG
+	LookupDecodedInstruction(
+		__in const DecodedScript * Decoded,
+		__in PROGRAM_COUNTER PC
+		);
+
 	//
 	// Execute an instruction stream.
 	//
@@ -577,6 +643,13 @@ private:
 
 	size_t                     m_RecursionLevel;
 
+	//
+	// Define the count of backward branches taken over the lifetime of the
+	// VM, for use in profiling which scripts contain hot loops.
+	//
+
+	ULONG64                    m_BackwardBranches;
+
 	//
 	// Define the current saved stack state (generated by a STORE_STATE or
 	// similar instruction).
@@ -0,0 +1,530 @@
+/*++
+
+Copyright (c) Ken Johnson (Skywing). All rights reserved.
+
+Module Name:
+
+	ProfileModuleScripts.cpp
+
+Abstract:
+
+	This module houses a program that reports the most frequent instruction
+	sequences across the compiled scripts of a module.  The report is used to
+	select the instruction sequences that the script VM fuses into
+	superinstructions.
+
+--*/
+
+#include "Precomp.h"
+#include "../NWN2DataLib/TextOut.h"
+#include "../NWN2DataLib/ResourceManager.h"
+#include "../NWN2DataLib/NWScriptReader.h"
+#include "../NWNScriptLib/NWScriptVM.h"
+#include "../NWNScriptLib/NWScriptInternal.h"
+
+//
+// Define the debug text output interface, used to write debug or log messages
+// to the user.
+//
+
+class PrintfTextOut : public IDebugTextOut
+{
+
+public:
+
+	inline
+	PrintfTextOut(
+		)
+	{
+		AllocConsole( );
+	}
+
+	inline
+	~PrintfTextOut(
+		)
+	{
+		FreeConsole( );
+	}
+
+	enum { STD_COLOR = FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE };
+
+	inline
+	virtual
+	void
+	WriteText(
+		__in __format_string const char* fmt,
+		...
+		)
+	{
+		va_list ap;
+
+		va_start( ap, fmt );
+		WriteTextV( STD_COLOR, fmt, ap );
+		va_end( ap );
+	}
+
+	inline
+	virtual
+	void
+	WriteText(
+		__in WORD Attributes,
+		__in __format_string const char* fmt,
+		...
+		)
+	{
+		va_list ap;
+
+		va_start( ap, fmt );
+		WriteTextV( Attributes, fmt, ap );
+		va_end( ap );
+
+		UNREFERENCED_PARAMETER( Attributes );
+	}
+
+	inline
+	virtual
+	void
+	WriteTextV(
+		__in __format_string const char* fmt,
+		__in va_list ap
+		)
+	{
+		WriteTextV( STD_COLOR, fmt, ap );
+	}
+
+	inline
+	virtual
+	void
+	WriteTextV(
+		__in WORD Attributes,
+		__in const char *fmt,
+		__in va_list argptr
+		)
+	/*++
+
+	Routine Description:
+
+		This routine displays text to the log file and the debug console.
+
+		The console output may have color attributes supplied, as per the standard
+		SetConsoleTextAttribute API.
+
+	Arguments:
+
+		Attributes - Supplies color attributes for the text as per the standard
+					 SetConsoleTextAttribute API (e.g. FOREGROUND_RED).
+
+		fmt - Supplies the printf-style format string to use to display text.
+
+		argptr - Supplies format inserts.
+
+	Return Value:
+
+		None.
+
+	Environment:
+
+		User mode.
+
+	--*/
+	{
+		HANDLE console = GetStdHandle( STD_OUTPUT_HANDLE );
+		char buf[8193];
+		StringCbVPrintfA(buf, sizeof( buf ), fmt, argptr);
+		DWORD n = (DWORD)strlen(buf);
+		SetConsoleTextAttribute( console, Attributes );
+		WriteConsoleA(console, buf, n, &n, 0);
+	}
+
+};
+
+//
+// Define the sequence profile.  Each instruction is identified by its opcode
+// and type opcode; a sequence is keyed by the string formed from the
+// identifiers of its instructions.
+//
+
+enum
+{
+	MIN_SEQUENCE_LENGTH     = 2,
+	DEFAULT_SEQUENCE_LENGTH = 5,
+	MAX_SEQUENCE_LENGTH     = 8,
+	DEFAULT_REPORT_COUNT    = 25,
+
+	LAST_PROFILE_CONSTANT
+};
+
+typedef stdext::hash_map< std::string, ULONG64 > SequenceCountMap;
+
+struct SequenceProfile
+{
+	SequenceCountMap Counts[ MAX_SEQUENCE_LENGTH + 1 ];
+	ULONG64          Instructions;
+	ULONG64          Scripts;
+};
+
+bool
+IsControlTransfer(
+	__in UCHAR Opcode
+	)
+/*++
+
+Routine Description:
+
+	This routine determines whether an instruction transfers control elsewhere
+	than the next instruction.
+
+Arguments:
+
+	Opcode - Supplies the instruction opcode.
+
+Return Value:
+
+	The routine returns true if the instruction ends a straight-line run of
+	instructions.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	switch (Opcode)
+	{
+
+	case OP_JMP:
+	case OP_JSR:
+	case OP_JZ:
+	case OP_JNZ:
+	case OP_RETN:
+		return true;
+
+	default:
+		return false;
+
+	}
+}
+
+void
+ProfileScript(
+	__in NWScriptReader * Script,
+	__in size_t MaxLength,
+	__inout SequenceProfile & Profile
+	)
+/*++
+
+Routine Description:
+
+	This routine counts each instruction sequence of a script, up to a maximum
+	length.  Sequences do not extend past a control transfer, as the
+	instructions that follow a branch do not necessarily execute after it.
+
+Arguments:
+
+	Script - Supplies the script to profile.
+
+	MaxLength - Supplies the maximum sequence length to count.
+
+	Profile - Supplies the profile to accumulate counts into.
+
+Return Value:
+
+	None.  An std::exception is raised on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	std::string Run;
+	ULONG       PC;
+
+	PC = 0;
+
+	Script->SetInstructionPointer( 0 );
+
+	while (!Script->ScriptIsEof( ))
+	{
+		UCHAR Opcode;
+		UCHAR TypeOpcode;
+		ULONG PCOffset;
+		ULONG Length;
+
+		Length = NWScriptVM::Disassemble(
+			Script,
+			Opcode,
+			TypeOpcode,
+			PCOffset);
+
+		PC += Length;
+
+		Script->SetInstructionPointer( PC );
+
+		Profile.Instructions += 1;
+
+		//
+		// Append the instruction to the current run, and count each sequence
+		// that ends with it.
+		//
+
+		Run.push_back( (char) Opcode );
+		Run.push_back( (char) TypeOpcode );
+
+		for (size_t n = MIN_SEQUENCE_LENGTH; n <= MaxLength; n += 1)
+		{
+			if (Run.size( ) < n * 2)
+				break;
+
+			Profile.Counts[ n ][ Run.substr( Run.size( ) - n * 2 ) ] += 1;
+		}
+
+		if (Run.size( ) >= MaxLength * 2)
+			Run.erase( 0, 2 );
+
+		if (IsControlTransfer( Opcode ))
+			Run.clear( );
+	}
+
+	Profile.Scripts += 1;
+}
+
+void
+ShowProfile(
+	__in const SequenceProfile & Profile,
+	__in size_t MaxLength,
+	__in size_t ReportCount,
+	__in IDebugTextOut * TextOut
+	)
+/*++
+
+Routine Description:
+
+	This routine prints the most frequent instruction sequences of each length
+	to the text output console.
+
+Arguments:
+
+	Profile - Supplies the accumulated profile.
+
+	MaxLength - Supplies the maximum sequence length that was counted.
+
+	ReportCount - Supplies the count of sequences to report for each length.
+
+	TextOut - Supplies the text output interface.
+
+Return Value:
+
+	None.  An std::exception is raised on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	typedef std::pair< ULONG64, std::string > CountedSequence;
+	typedef std::vector< CountedSequence >    CountedSequenceVec;
+
+	TextOut->WriteText(
+		"Profiled %I64u instructions in %I64u scripts.\n",
+		Profile.Instructions,
+		Profile.Scripts);
+
+	if (Profile.Instructions == 0)
+		return;
+
+	for (size_t n = MIN_SEQUENCE_LENGTH; n <= MaxLength; n += 1)
+	{
+		CountedSequenceVec Sequences;
+
+		for (SequenceCountMap::const_iterator it = Profile.Counts[ n ].begin( );
+		     it != Profile.Counts[ n ].end( );
+		     ++it)
+		{
+			Sequences.push_back( CountedSequence( it->second, it->first ) );
+		}
+
+		std::sort( Sequences.begin( ), Sequences.end( ), std::greater< CountedSequence >( ) );
+
+		if (Sequences.size( ) > ReportCount)
+			Sequences.resize( ReportCount );
+
+		TextOut->WriteText(
+			"\nMost frequent %lu-instruction sequences:\n",
+			(unsigned long) n);
+
+		for (CountedSequenceVec::const_iterator it = Sequences.begin( );
+		     it != Sequences.end( );
+		     ++it)
+		{
+			std::string Mnemonics;
+
+			for (size_t i = 0; i + 1 < it->second.size( ); i += 2)
+			{
+				const char * OpcodeName;
+				const char * TypeOpcodeName;
+
+				NWScriptVM::GetInstructionNames(
+					(UCHAR) it->second[ i ],
+					(UCHAR) it->second[ i + 1 ],
+					&OpcodeName,
+					&TypeOpcodeName);
+
+				if (!Mnemonics.empty( ))
+					Mnemonics += " ; ";
+
+				Mnemonics += OpcodeName;
+				Mnemonics += TypeOpcodeName;
+			}
+
+			TextOut->WriteText(
+				"%12I64u  %6.2f%%  %s\n",
+				it->first,
+				(double) it->first * 100.0 / (double) Profile.Instructions,
+				Mnemonics.c_str( ));
+		}
+	}
+}
+
+int
+__cdecl
+main(
+	__in int argc,
+	__in_ecount( argc ) const char * * argv
+	)
+/*++
+
+Routine Description:
+
+	This routine is the entry point symbol for the module script profiler
+	program.
+
+Arguments:
+
+	argc - Supplies the count of command line arguments.
+
+	argv - Supplies the command line argument vector.
+
+Return Value:
+
+	The routine returns the process exit code.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	const char * ModuleName;
+	const char * NWN2Home;
+	const char * InstallDir;
+	size_t       MaxLength;
+	size_t       ReportCount;
+
+	//
+	// First, check that we've got the necessary arguments.
+	//
+
+	if (argc < 4)
+	{
+		wprintf(
+			L"Usage: %S <module> <nwn2 home directory> <nwn2 install directory> [max sequence length] [sequences to report]\n",
+			argv[ 0 ] );
+
+		return 0;
+	}
+
+	ModuleName  = argv[ 1 ];
+	NWN2Home    = argv[ 2 ];
+	InstallDir  = argv[ 3 ];
+	MaxLength   = DEFAULT_SEQUENCE_LENGTH;
+	ReportCount = DEFAULT_REPORT_COUNT;
+
+	if (argc > 4)
+		MaxLength = (size_t) strtoul( argv[ 4 ], NULL, 10 );
+
+	if (argc > 5)
+		ReportCount = (size_t) strtoul( argv[ 5 ], NULL, 10 );
+
+	if (MaxLength < MIN_SEQUENCE_LENGTH)
+		MaxLength = MIN_SEQUENCE_LENGTH;
+	else if (MaxLength > MAX_SEQUENCE_LENGTH)
+		MaxLength = MAX_SEQUENCE_LENGTH;
+
+	//
+	// Now spin up a resource manager instance.
+	//
+
+	PrintfTextOut   TextOut;
+	ResourceManager ResMan( &TextOut );
+
+	try
+	{
+		SequenceProfile         Profile;
+		ResourceManager::FileId Count;
+
+		Profile.Instructions = 0;
+		Profile.Scripts      = 0;
+
+		//
+		// Load the module without its HAKs, as with the other module tools.
+		// The compiled scripts of the module and of the base game are then
+		// all visible through the resource manager.
+		//
+
+		ResMan.LoadModuleResources(
+			ModuleName,
+			"",
+			NWN2Home,
+			InstallDir,
+			std::vector< NWN::ResRef32 >( )
+			);
+
+		Count = ResMan.GetEncapsulatedFileCount( );
+
+		for (ResourceManager::FileId i = 0; i < Count; i += 1)
+		{
+			NWN::ResRef32 ResRef;
+			NWN::ResType  Type;
+
+			if (!ResMan.GetEncapsulatedFileEntry( i, ResRef, Type ))
+				continue;
+
+			if (Type != NWN::ResNCS)
+				continue;
+
+			try
+			{
+				DemandResource32 ScriptFile( ResMan, ResRef, NWN::ResNCS );
+				NWScriptReader   Script( ScriptFile.GetDemandedFileName( ).c_str( ) );
+
+				ProfileScript( &Script, MaxLength, Profile );
+			}
+			catch (std::exception &e)
+			{
+				TextOut.WriteText(
+					"WARNING: Failed to profile script %s: Exception '%s'.\n",
+					ResMan.StrFromResRef( ResRef ).c_str( ),
+					e.what( ));
+			}
+		}
+
+		ShowProfile( Profile, MaxLength, ReportCount, &TextOut );
+	}
+	catch (std::exception &e)
+	{
+		//
+		// Simple print an error message and abort if we went wrong, such as if
+		// we couldn't load the module.
+		//
+
+		TextOut.WriteText( "ERROR: Exception '%s'.\n", e.what( ) );
+	}
+
+	//
+	// All done.
+	//
+
+	return 0;
+}
@@ -12,6 +12,7 @@
 
 #include "Ref/Ref.h"
 #include "Synchronization/ListAPI.h"
+#include "Synchronization/Lock.h"
 #include "Parsers/BufferParser.h"
 #include "Encoding/Encoding.h"
 #include "Timer/TimerManager.h"
@@ -0,0 +1,120 @@
+/*++
+
+Copyright (c) Ken Johnson (Skywing). All rights reserved.
+
+Module Name:
+
+	Lock.h
+
+Abstract:
+
+	This module defines simple mutual exclusion primitives: a critical section
+	wrapper and a scope-bound lock holder for it.
+
+--*/
+
+#ifndef _PROGRAMS_SKYWINGUTILS_SYNCHRONIZATION_LOCK_H
+#define _PROGRAMS_SKYWINGUTILS_SYNCHRONIZATION_LOCK_H
+
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+namespace swutil
+{
+
+	//
+	// Define a recursive mutual exclusion lock backed by a Win32 critical
+	// section.
+	//
+
+	class CriticalSection
+	{
+
+	public:
+
+		inline
+		CriticalSection(
+			)
+		{
+			InitializeCriticalSection( &m_CritSec );
+		}
+
+		inline
+		~CriticalSection(
+			)
+		{
+			DeleteCriticalSection( &m_CritSec );
+		}
+
+		inline
+		void
+		Lock(
+			)
+		{
+			EnterCriticalSection( &m_CritSec );
+		}
+
+		inline
+		void
+		Unlock(
+			)
+		{
+			LeaveCriticalSection( &m_CritSec );
+		}
+
+	private:
+
+		//
+		// Critical sections cannot be copied.
+		//
+
+		CriticalSection(
+			__in const CriticalSection & other
+			);
+
+		CriticalSection &
+		operator=(
+			__in const CriticalSection & other
+			);
+
+		CRITICAL_SECTION m_CritSec;
+
+	};
+
+	//
+	// Define a lock holder that acquires a critical section for the lifetime
+	// of the holder.
+	//
+
+	class ScopedLock
+	{
+
+	public:
+
+		inline
+		ScopedLock(
+			__in CriticalSection & Lock
+			)
+		: m_Lock( Lock )
+		{
+			m_Lock.Lock( );
+		}
+
+		inline
+		~ScopedLock(
+			)
+		{
+			m_Lock.Unlock( );
+		}
+
+	private:
+
+		CriticalSection & m_Lock;
+
+	};
+
+}
+
+#endif
+